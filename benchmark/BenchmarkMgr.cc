@@ -11,8 +11,11 @@ BenchmarkMgr::BenchmarkMgr(const char *conf, const std::string &user,
     mMtdPool(mtdPool),
     mDataPool(dataPool),
     mMaxFileSize(maxFileSize),
-    mNumFiles(0),
+    mNumOps(0),
     mCreateInDir(false),
+    mIoSize(0),
+    mFileSize(0),
+    mNumEntries(0),
     mCreatedPools(false),
     mDeleteObjects(false)
 {
@@ -72,28 +75,28 @@ BenchmarkMgr::~BenchmarkMgr()
 }
 
 int
-BenchmarkMgr::numFiles()
+BenchmarkMgr::numOps()
 {
-  int nfiles;
-  boost::unique_lock<boost::mutex> lock(mNumFilesMutex);
+  int nops;
+  boost::unique_lock<boost::mutex> lock(mNumOpsMutex);
 
-  nfiles = mNumFiles;
+  nops = mNumOps;
 
-  return nfiles;
+  return nops;
 }
 
 void
-BenchmarkMgr::setNumFiles(int numFiles)
+BenchmarkMgr::setNumOps(int numOps)
 {
-  boost::unique_lock<boost::mutex> lock(mNumFilesMutex);
-  mNumFiles = numFiles;
+  boost::unique_lock<boost::mutex> lock(mNumOpsMutex);
+  mNumOps = numOps;
 }
 
 void
-BenchmarkMgr::incFiles()
+BenchmarkMgr::incOps()
 {
-  boost::unique_lock<boost::mutex> lock(mNumFilesMutex);
-  mNumFiles++;
+  boost::unique_lock<boost::mutex> lock(mNumOpsMutex);
+  mNumOps++;
 }
 
 int
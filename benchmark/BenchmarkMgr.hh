@@ -19,12 +19,20 @@ public:
                bool createPools, size_t bufferSize);
   ~BenchmarkMgr(void);
 
-  int numFiles(void);
-  void setNumFiles(int numFiles);
-  void incFiles(void);
+  int numOps(void);
+  void setNumOps(int numOps);
+  void incOps(void);
   void setCreateInDir(bool create) { mCreateInDir = create; }
   void setDeleteObjects(bool deleteObjects) { mDeleteObjects = deleteObjects; }
   bool createInDir(void) const { return mCreateInDir; }
+  void setIoSize(size_t size) { mIoSize = size; }
+  size_t ioSize(void) const { return mIoSize; }
+  void setFileSize(size_t size) { mFileSize = size; }
+  size_t fileSize(void) const { return mFileSize; }
+  void setNumEntries(size_t numEntries) { mNumEntries = numEntries; }
+  size_t numEntries(void) const { return mNumEntries; }
+  void setPrefix(const std::string &prefix) { mPrefix = prefix; }
+  const std::string & prefix(void) const { return mPrefix; }
   int setupPools(void);
 
   radosfs::Filesystem radosFs;
@@ -35,9 +43,13 @@ private:
   std::string mMtdPool;
   std::string mDataPool;
   const size_t mMaxFileSize;
-  int mNumFiles;
+  int mNumOps;
   bool mCreateInDir;
-  boost::mutex mNumFilesMutex;
+  size_t mIoSize;
+  size_t mFileSize;
+  size_t mNumEntries;
+  std::string mPrefix;
+  boost::mutex mNumOpsMutex;
   bool mCreatedPools;
   bool mDeleteObjects;
 };
@@ -0,0 +1,171 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <limits>
+
+#include "LatencyHistogram.hh"
+
+// Values below LINEAR_BUCKETS get a bucket each; above that, every power of
+// two is split into SUB_BUCKETS buckets
+#define LINEAR_BUCKETS_BITS 7
+#define LINEAR_BUCKETS (1 << LINEAR_BUCKETS_BITS)
+#define SUB_BUCKETS_BITS (LINEAR_BUCKETS_BITS - 1)
+#define SUB_BUCKETS (1 << SUB_BUCKETS_BITS)
+#define MAX_VALUE_BITS 40 // about 12 days in microseconds
+#define NUM_BUCKETS (LINEAR_BUCKETS + \
+                     (MAX_VALUE_BITS - LINEAR_BUCKETS_BITS) * SUB_BUCKETS)
+
+static int
+mostSignificantBit(uint64_t value)
+{
+  int bit = 0;
+
+  while (value >>= 1)
+    bit++;
+
+  return bit;
+}
+
+LatencyHistogram::LatencyHistogram(void)
+  : mCounts(NUM_BUCKETS, 0),
+    mCount(0),
+    mMin(std::numeric_limits<uint64_t>::max()),
+    mMax(0),
+    mSum(.0)
+{}
+
+size_t
+LatencyHistogram::bucketIndex(uint64_t value)
+{
+  if (value < LINEAR_BUCKETS)
+    return value;
+
+  int msb = mostSignificantBit(value);
+
+  if (msb >= MAX_VALUE_BITS)
+    return NUM_BUCKETS - 1;
+
+  const int shift = msb - SUB_BUCKETS_BITS;
+  const uint64_t subBucket = (value >> shift) - SUB_BUCKETS;
+
+  return LINEAR_BUCKETS + (msb - LINEAR_BUCKETS_BITS) * SUB_BUCKETS + subBucket;
+}
+
+uint64_t
+LatencyHistogram::bucketHighestValue(size_t index)
+{
+  if (index < LINEAR_BUCKETS)
+    return index;
+
+  const size_t exponentIndex = (index - LINEAR_BUCKETS) / SUB_BUCKETS;
+  const uint64_t subBucket = (index - LINEAR_BUCKETS) % SUB_BUCKETS;
+  const int shift = exponentIndex + LINEAR_BUCKETS_BITS - SUB_BUCKETS_BITS;
+  const uint64_t lowest = (subBucket + SUB_BUCKETS) << shift;
+
+  return lowest + (((uint64_t) 1 << shift) - 1);
+}
+
+void
+LatencyHistogram::record(uint64_t value)
+{
+  mCounts[bucketIndex(value)]++;
+  mCount++;
+  mSum += value;
+
+  if (value < mMin)
+    mMin = value;
+
+  if (value > mMax)
+    mMax = value;
+}
+
+void
+LatencyHistogram::merge(const LatencyHistogram &other)
+{
+  for (size_t i = 0; i < mCounts.size(); i++)
+    mCounts[i] += other.mCounts[i];
+
+  mCount += other.mCount;
+  mSum += other.mSum;
+
+  if (other.mCount > 0)
+  {
+    if (other.mMin < mMin)
+      mMin = other.mMin;
+
+    if (other.mMax > mMax)
+      mMax = other.mMax;
+  }
+}
+
+void
+LatencyHistogram::reset(void)
+{
+  mCounts.assign(NUM_BUCKETS, 0);
+  mCount = 0;
+  mMin = std::numeric_limits<uint64_t>::max();
+  mMax = 0;
+  mSum = .0;
+}
+
+uint64_t
+LatencyHistogram::min(void) const
+{
+  return mCount > 0 ? mMin : 0;
+}
+
+double
+LatencyHistogram::mean(void) const
+{
+  return mCount > 0 ? mSum / mCount : .0;
+}
+
+// Gets the value below which the given percentage (0 to 100) of the recorded
+// values are; as in HdrHistogram, this is the highest value that is
+// equivalent to the one recorded (i.e. that falls in the same bucket), but
+// never more than the maximum recorded
+uint64_t
+LatencyHistogram::percentile(double percentile) const
+{
+  if (mCount == 0)
+    return 0;
+
+  if (percentile > 100.0)
+    percentile = 100.0;
+
+  uint64_t countAtPercentile = (uint64_t) ((percentile / 100.0) * mCount + 0.5);
+
+  if (countAtPercentile == 0)
+    countAtPercentile = 1;
+
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < mCounts.size(); i++)
+  {
+    total += mCounts[i];
+
+    if (total >= countAtPercentile)
+    {
+      const uint64_t value = bucketHighestValue(i);
+      return value < mMax ? value : mMax;
+    }
+  }
+
+  return mMax;
+}
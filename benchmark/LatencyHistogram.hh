@@ -0,0 +1,64 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __LATENCY_HISTOGRAM_HH__
+#define __LATENCY_HISTOGRAM_HH__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Histogram of latencies (in microseconds) with buckets whose width grows with
+// the values they hold (as in HdrHistogram), so any value is recorded with a
+// relative error below 1% while the memory used stays fixed. The histograms of
+// each thread can then be merged to get the percentiles of the whole run.
+class LatencyHistogram
+{
+public:
+  LatencyHistogram(void);
+
+  void record(uint64_t value);
+
+  void merge(const LatencyHistogram &other);
+
+  void reset(void);
+
+  uint64_t count(void) const { return mCount; }
+
+  uint64_t min(void) const;
+
+  uint64_t max(void) const { return mMax; }
+
+  double mean(void) const;
+
+  uint64_t percentile(double percentile) const;
+
+private:
+  static size_t bucketIndex(uint64_t value);
+
+  static uint64_t bucketHighestValue(size_t index);
+
+  std::vector<uint64_t> mCounts;
+  uint64_t mCount;
+  uint64_t mMin;
+  uint64_t mMax;
+  double mSum;
+};
+
+#endif // __LATENCY_HISTOGRAM_HH__
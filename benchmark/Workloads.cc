@@ -0,0 +1,452 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "Workloads.hh"
+#include "radosfscommon.h"
+
+#define FIND_ARGS "name = '^e.*7$'"
+#define STORM_MTD_KEY "benchmark"
+
+static uint64_t
+elapsedMicroseconds(const struct timespec &before, const struct timespec &after)
+{
+  return (after.tv_sec - before.tv_sec) * 1000000 +
+         (after.tv_nsec - before.tv_nsec) / 1000;
+}
+
+static std::string
+entryName(const char *prefix, uint64_t number)
+{
+  std::stringstream stream;
+  stream << prefix << number;
+  return stream.str();
+}
+
+static int
+createThreadDir(BenchmarkInfo *info)
+{
+  info->prefix += "/";
+
+  radosfs::Dir dir(&info->benchmark->radosFs, info->prefix);
+  int ret = dir.create();
+
+  if (ret != 0)
+  {
+    fprintf(stderr, "\nProblem creating directory %s: %s ... "
+            "Exiting thread %d\n",
+            info->prefix.c_str(), strerror(abs(ret)), info->threadId);
+  }
+
+  return ret;
+}
+
+// Offset of the given op in a file of fileSize bytes read or written in
+// ioSize pieces, either in sequence or at random
+static off_t
+opOffset(BenchmarkInfo *info, uint64_t opNumber, bool random)
+{
+  const size_t ioSize = info->benchmark->ioSize();
+  const size_t numPieces = std::max(info->benchmark->fileSize() / ioSize,
+                                    (size_t) 1);
+
+  if (random)
+    return (rand_r(&info->seed) % numPieces) * ioSize;
+
+  return (opNumber % numPieces) * ioSize;
+}
+
+// Creation of files, optionally writing a buffer to each of them
+
+static int
+setupCreate(BenchmarkInfo *info)
+{
+  if (info->benchmark->createInDir())
+    return createThreadDir(info);
+
+  info->prefix += "-";
+
+  return 0;
+}
+
+static int
+opCreate(BenchmarkInfo *info, uint64_t opNumber)
+{
+  radosfs::File file(&info->benchmark->radosFs,
+                     entryName(info->prefix.c_str(), opNumber),
+                     radosfs::File::MODE_WRITE);
+
+  int ret = file.create();
+
+  if (ret == 0 && info->bufferSize > 0)
+  {
+    const size_t slice = info->bufferSize / info->bufferDivision;
+
+    for (off_t offset = 0; offset + slice <= info->bufferSize; offset += slice)
+      file.write(info->buffer, offset, slice);
+
+    ret = file.sync();
+  }
+
+  return ret;
+}
+
+// Reads and writes of ioSize bytes in a file of fileSize bytes
+
+static int
+setupFile(BenchmarkInfo *info, bool fill)
+{
+  info->file = new radosfs::File(&info->benchmark->radosFs,
+                                 info->prefix + "-io",
+                                 radosfs::File::MODE_READ_WRITE);
+
+  int ret = info->file->create();
+
+  if (ret != 0)
+    return ret;
+
+  const size_t ioSize = info->benchmark->ioSize();
+
+  for (size_t offset = 0; fill && offset < info->benchmark->fileSize();
+       offset += ioSize)
+  {
+    ret = info->file->writeSync(info->buffer, offset, ioSize);
+
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+static int
+setupWrite(BenchmarkInfo *info)
+{
+  return setupFile(info, false);
+}
+
+static int
+setupRead(BenchmarkInfo *info)
+{
+  return setupFile(info, true);
+}
+
+static int
+writeFile(BenchmarkInfo *info, uint64_t opNumber, bool random)
+{
+  return info->file->writeSync(info->buffer, opOffset(info, opNumber, random),
+                               info->benchmark->ioSize());
+}
+
+static int
+readFile(BenchmarkInfo *info, uint64_t opNumber, bool random)
+{
+  ssize_t ret = info->file->read(info->buffer,
+                                 opOffset(info, opNumber, random),
+                                 info->benchmark->ioSize());
+
+  return ret < 0 ? ret : 0;
+}
+
+static int
+opSeqWrite(BenchmarkInfo *info, uint64_t opNumber)
+{
+  return writeFile(info, opNumber, false);
+}
+
+static int
+opRandWrite(BenchmarkInfo *info, uint64_t opNumber)
+{
+  return writeFile(info, opNumber, true);
+}
+
+static int
+opSeqRead(BenchmarkInfo *info, uint64_t opNumber)
+{
+  return readFile(info, opNumber, false);
+}
+
+static int
+opRandRead(BenchmarkInfo *info, uint64_t opNumber)
+{
+  return readFile(info, opNumber, true);
+}
+
+// Small files kept in their inline buffer
+
+static int
+opInline(BenchmarkInfo *info, uint64_t opNumber)
+{
+  const size_t ioSize = info->benchmark->ioSize();
+  radosfs::File file(&info->benchmark->radosFs,
+                     entryName(info->prefix.c_str(), opNumber),
+                     radosfs::File::MODE_READ_WRITE);
+
+  int ret = file.create(-1, "", 0, ioSize);
+
+  if (ret == 0)
+    ret = file.writeSync(info->buffer, 0, ioSize);
+
+  if (ret == 0)
+  {
+    ssize_t bytesRead = file.read(info->buffer, 0, ioSize);
+    ret = bytesRead < 0 ? bytesRead : 0;
+  }
+
+  return ret;
+}
+
+static int
+setupInline(BenchmarkInfo *info)
+{
+  info->prefix += "-inline-";
+
+  return 0;
+}
+
+// Operations over a directory with numEntries files
+
+static int
+setupEntries(BenchmarkInfo *info)
+{
+  int ret = createThreadDir(info);
+
+  if (ret != 0)
+    return ret;
+
+  radosfs::Dir dir(&info->benchmark->radosFs, info->prefix);
+  std::vector<std::string> entries;
+
+  for (size_t i = 0; i < info->benchmark->numEntries(); i++)
+  {
+    entries.push_back(entryName("e", i));
+    info->paths.push_back(info->prefix + entries.back());
+  }
+
+  return dir.createFiles(entries);
+}
+
+static int
+opStat(BenchmarkInfo *info, uint64_t opNumber)
+{
+  struct stat buff;
+
+  return info->benchmark->radosFs.stat(info->paths[opNumber %
+                                                   info->paths.size()],
+                                       &buff);
+}
+
+static int
+opBulkStat(BenchmarkInfo *info, uint64_t opNumber)
+{
+  std::vector<std::pair<int, struct stat> > stats;
+  stats = info->benchmark->radosFs.stat(info->paths);
+
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    if (stats[i].first != 0)
+      return stats[i].first;
+  }
+
+  return 0;
+}
+
+static int
+opList(BenchmarkInfo *info, uint64_t opNumber)
+{
+  radosfs::Dir dir(&info->benchmark->radosFs, info->prefix);
+  std::set<std::string> entries;
+
+  dir.refresh();
+
+  return dir.entryList(entries);
+}
+
+static int
+opListWithStat(BenchmarkInfo *info, uint64_t opNumber)
+{
+  radosfs::Dir dir(&info->benchmark->radosFs, info->prefix);
+  std::map<std::string, struct stat> entries;
+
+  dir.refresh();
+
+  return dir.entryListWithStat(entries);
+}
+
+static int
+opFind(BenchmarkInfo *info, uint64_t opNumber)
+{
+  radosfs::Dir dir(&info->benchmark->radosFs, info->prefix);
+  std::set<std::string> results;
+
+  dir.refresh();
+
+  return dir.find(FIND_ARGS, results);
+}
+
+// Every thread creating, changing and removing files in the same directory
+
+static int
+setupStorm(BenchmarkInfo *info)
+{
+  const std::string dirPath = "/" + info->benchmark->prefix() + "-storm/";
+  radosfs::Dir dir(&info->benchmark->radosFs, dirPath);
+
+  // All threads use the same directory, so it may have been created already
+  int ret = dir.create();
+
+  if (ret == -EEXIST)
+    ret = 0;
+
+  std::stringstream stream;
+  stream << dirPath << "t" << info->threadId << "-";
+  info->prefix = stream.str();
+
+  return ret;
+}
+
+static int
+opStorm(BenchmarkInfo *info, uint64_t opNumber)
+{
+  const std::string path = entryName(info->prefix.c_str(), opNumber);
+  radosfs::File file(&info->benchmark->radosFs, path,
+                     radosfs::File::MODE_READ_WRITE);
+
+  int ret = file.create();
+
+  if (ret != 0)
+    return ret;
+
+  radosfs::Dir dir(&info->benchmark->radosFs, getParentDir(path, 0));
+  const std::string entry = path.substr(dir.path().length());
+  struct stat buff;
+
+  if ((ret = dir.setMetadata(entry, STORM_MTD_KEY, path)) != 0 ||
+      (ret = file.chmod(S_IRWXU)) != 0 ||
+      (ret = file.setXAttr("usr." STORM_MTD_KEY, path)) != 0 ||
+      (ret = file.stat(&buff)) != 0)
+  {
+    file.remove();
+    return ret;
+  }
+
+  return file.remove();
+}
+
+static const Workload workloads[] =
+{
+  {"create", "create files (writing the buffer to them, if set)",
+   setupCreate, opCreate},
+  {"seq-write", "write IO_SIZE bytes at a time, in sequence, to a file",
+   setupWrite, opSeqWrite},
+  {"rand-write", "write IO_SIZE bytes at a time, at random offsets, to a file",
+   setupWrite, opRandWrite},
+  {"seq-read", "read IO_SIZE bytes at a time, in sequence, from a file",
+   setupRead, opSeqRead},
+  {"rand-read", "read IO_SIZE bytes at a time, at random offsets, from a file",
+   setupRead, opRandRead},
+  {"inline", "create, write and read files of IO_SIZE bytes kept in their "
+   "inline buffer", setupInline, opInline},
+  {"stat", "stat one of NUM_ENTRIES files", setupEntries, opStat},
+  {"bulk-stat", "stat NUM_ENTRIES files at once", setupEntries, opBulkStat},
+  {"list", "list a directory with NUM_ENTRIES files", setupEntries, opList},
+  {"list-stat", "list a directory with NUM_ENTRIES files, with their stats",
+   setupEntries, opListWithStat},
+  {"find", "find (" FIND_ARGS ") in a directory with NUM_ENTRIES files",
+   setupEntries, opFind},
+  {"mtd-storm", "create, set metadata, chmod, set xattr, stat and remove "
+   "files, with all threads in the same directory", setupStorm, opStorm}
+};
+
+const Workload *
+getWorkloads(size_t *numWorkloads)
+{
+  *numWorkloads = sizeof(workloads) / sizeof(workloads[0]);
+
+  return workloads;
+}
+
+const Workload *
+getWorkload(const std::string &name)
+{
+  size_t numWorkloads;
+  const Workload *all = getWorkloads(&numWorkloads);
+
+  for (size_t i = 0; i < numWorkloads; i++)
+  {
+    if (name == all[i].name)
+      return &all[i];
+  }
+
+  return 0;
+}
+
+void
+runWorkload(BenchmarkInfo *info, const Workload *workload)
+{
+  std::stringstream prefix;
+  prefix << "/t-" << info->benchmark->prefix() << "-" << info->threadId;
+  info->prefix = prefix.str();
+
+  info->setupRet = workload->setup(info);
+
+  if (info->setupRet != 0)
+  {
+    fprintf(stderr, "\nProblem setting up the %s workload in thread %d: %s\n",
+            workload->name, info->threadId, strerror(abs(info->setupRet)));
+  }
+
+  // The operations only start being measured when all threads are ready
+  info->startBarrier->wait();
+
+  for (uint64_t i = 0; info->setupRet == 0 && !info->shouldExit; i++)
+  {
+    struct timespec timeBefore, timeAfter;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeBefore);
+
+    int ret = workload->op(info, i);
+
+    clock_gettime(CLOCK_MONOTONIC, &timeAfter);
+
+    if (ret != 0)
+    {
+      fprintf(stderr, "Problem in thread %d: %s\n", info->threadId,
+              strerror(abs(ret)));
+      continue;
+    }
+
+    info->latencies.record(elapsedMicroseconds(timeBefore, timeAfter));
+    info->benchmark->incOps();
+  }
+
+  delete info->file;
+  info->file = 0;
+
+  info->exited = true;
+}
@@ -0,0 +1,71 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __BENCHMARK_WORKLOADS_HH__
+#define __BENCHMARK_WORKLOADS_HH__
+
+#include <boost/thread.hpp>
+#include <string>
+#include <vector>
+
+#include "BenchmarkMgr.hh"
+#include "LatencyHistogram.hh"
+
+typedef struct
+{
+  int threadId;
+  BenchmarkMgr *benchmark;
+  char *buffer;
+  size_t bufferSize;
+  size_t bufferDivision;
+  // Where the thread's files (or directory) are created
+  std::string prefix;
+  std::vector<std::string> paths;
+  // The file used by the read and write workloads
+  radosfs::File *file;
+  unsigned int seed;
+  LatencyHistogram latencies;
+  boost::barrier *startBarrier;
+  int setupRet;
+  bool shouldExit;
+  bool exited;
+} BenchmarkInfo;
+
+// Prepares what the workload's operations need (e.g. the files to read), out
+// of the measured time
+typedef int (*WorkloadSetup)(BenchmarkInfo *info);
+
+// Runs one operation of the workload, the one whose latency is measured
+typedef int (*WorkloadOp)(BenchmarkInfo *info, uint64_t opNumber);
+
+typedef struct
+{
+  const char *name;
+  const char *description;
+  WorkloadSetup setup;
+  WorkloadOp op;
+} Workload;
+
+const Workload * getWorkload(const std::string &name);
+
+const Workload * getWorkloads(size_t *numWorkloads);
+
+void runWorkload(BenchmarkInfo *info, const Workload *workload);
+
+#endif // __BENCHMARK_WORKLOADS_HH__
@@ -17,9 +17,12 @@
  * for more details.
  */
 
+#include <algorithm>
 #include <boost/thread.hpp>
 #include <cstdio>
+#include <cstring>
 #include <errno.h>
+#include <fstream>
 #include <limits>
 #include <sstream>
 #include <time.h>
@@ -27,11 +30,16 @@
 #include <getopt.h>
 
 #include "BenchmarkMgr.hh"
+#include "Workloads.hh"
 #include "radosfscommon.h"
 
 #define CONF_ENV_VAR "RADOSFS_BENCHMARK_CLUSTER_CONF"
 #define CLUSTER_CONF_ARG "conf"
 #define DEFAULT_NUM_THREADS 10
+#define DEFAULT_WORKLOAD "create"
+#define DEFAULT_IO_SIZE 4096
+#define DEFAULT_FILE_SIZE (64 * 1024 * 1024)
+#define DEFAULT_NUM_ENTRIES 1000
 #define LINES_PER_HEADER 30
 #define CREATE_IN_DIR_CONF_ARG "create-in-dir"
 #define CREATE_IN_DIR_CONF_ARG_CHAR 'd'
@@ -45,163 +53,115 @@
 #define POOLS_CONF_ARG_CHAR 'p'
 #define DELETE_OBJS_ARG "delete-objects"
 #define DELETE_OBJS_ARG_CHAR 'E'
-
-static std::string commonPrefix;
+#define WORKLOAD_ARG "workload"
+#define WORKLOAD_ARG_CHAR 'w'
+#define IO_SIZE_ARG "io-size"
+#define IO_SIZE_ARG_CHAR 'i'
+#define FILE_SIZE_ARG "file-size"
+#define FILE_SIZE_ARG_CHAR 'f'
+#define NUM_ENTRIES_ARG "num-entries"
+#define NUM_ENTRIES_ARG_CHAR 'N'
+#define JSON_ARG "json"
+#define JSON_ARG_CHAR 'j'
 
 typedef struct
 {
-  int threadId;
-  BenchmarkMgr *benchmark;
-  char *buffer;
+  std::string confPath;
+  std::string user;
+  std::vector<std::string> pools;
+  int runTime;
+  int numThreads;
+  bool createInDir;
   size_t bufferSize;
   size_t bufferDivision;
-  std::vector<int> creationTimes;
-  float minCreationTime;
-  float maxCreationTime;
-  bool shouldExit;
-  bool exited;
-} BenchmarkInfo;
-
-void
-createFiles(BenchmarkInfo *benchmarkInfo)
-{
-  int threadId = benchmarkInfo->threadId;
-  BenchmarkMgr *benchmark = benchmarkInfo->benchmark;
-  benchmarkInfo->minCreationTime = std::numeric_limits<float>::max();
-  benchmarkInfo->maxCreationTime = .0;
-
-  std::stringstream prefix;
-  prefix << "/t-" << commonPrefix << "-" << threadId;
-
-  if (benchmark->createInDir())
-  {
-    prefix << "/";
-
-    radosfs::Dir dir(&benchmark->radosFs, prefix.str());
-    int ret = dir.create();
-
-    if (ret != 0)
-    {
-      fprintf(stderr, "\nProblem creating directory %s: %s ... "
-              "Exiting thread %d\n",
-              prefix.str().c_str(), strerror(ret), threadId);
-
-      goto exitThread;
-    }
-  }
-  else
-  {
-    prefix << "-";
-  }
-
-  for (int i = 0; !benchmarkInfo->shouldExit; i++)
-  {
-    std::stringstream stream;
-    stream << prefix.str() << i;
-
-    struct timespec timeBefore, timeAfter;
-
-    clock_gettime(CLOCK_REALTIME, &timeBefore);
-
-    radosfs::File file(&benchmark->radosFs,
-                       stream.str(),
-                       radosfs::File::MODE_WRITE);
-
-    int ret = file.create();
-
-    if (benchmarkInfo->buffer)
-    {
-      off_t offset = 0;
-      const size_t bufferSize = benchmarkInfo->bufferSize;
-      const size_t slice = bufferSize / benchmarkInfo->bufferDivision;
-
-      for (offset = 0; offset + slice <= bufferSize; offset += slice)
-      {
-        file.write(benchmarkInfo->buffer, offset, slice);
-      }
-
-      file.sync();
-    }
-
-    clock_gettime(CLOCK_REALTIME, &timeAfter);
-
-    if (ret == 0)
-      benchmark->incFiles();
-    else
-    {
-      fprintf(stderr, "Problem in thread %d: %s\n", threadId, strerror(ret));
-      continue;
-    }
-
-    float diffTime = (float) (timeAfter.tv_sec - timeBefore.tv_sec);
-
-    if (diffTime < benchmarkInfo->minCreationTime)
-      benchmarkInfo->minCreationTime = diffTime;
-
-    if (diffTime > benchmarkInfo->maxCreationTime)
-      benchmarkInfo->maxCreationTime = diffTime;
-
-  }
-
-exitThread:
-
-  benchmarkInfo->exited = true;
-}
+  bool deleteObjects;
+  std::string workload;
+  size_t ioSize;
+  size_t fileSize;
+  size_t numEntries;
+  std::string jsonPath;
+} BenchmarkConf;
 
 static void
 showUsage(const char *name)
 {
   fprintf(stderr, "Usage:\n%s DURATION [NUM_THREADS] [--%s=CLUSTER_CONF] "
-          "[--%s=USER_NAME] [--%s] [--%s=SIZE [--%s=NUM]]\n"
+          "[--%s=USER_NAME] [--%s=WORKLOAD] [--%s] [--%s=SIZE [--%s=NUM]] "
+          "[--%s=SIZE] [--%s=SIZE] [--%s=NUM] [--%s=PATH]\n"
           "\tDURATION     - duration of the benchmark in seconds "
           "(has to be > 0)\n"
           "\tNUM_THREADS  - number of concurrent threads\n"
           "\t--%s, -%c - path to the cluster's configuration file\n"
           "\t--%s, -%c - the user name to connect to the Ceph cluster\n"
+          "\t--%s, -%c - the workload to run (default: " DEFAULT_WORKLOAD ")\n"
           "\t--%s, -%c - make each thread work inside its own directory "
           "instead of /\n"
           "\t--%s, -%c - buffer size to be written into each file\n"
-          "\t--%s, -%c - the number of writes it should take to write the buffer\n",
+          "\t--%s, -%c - the number of writes it should take to write the buffer\n"
+          "\t--%s, -%c - size of each read or write (IO_SIZE)\n"
+          "\t--%s, -%c - size of the files read or written (FILE_SIZE)\n"
+          "\t--%s, -%c - number of files in the directories (NUM_ENTRIES)\n"
+          "\t--%s, -%c - write the results as JSON to the given file\n",
           name,
           CLUSTER_CONF_ARG,
           USER_ARG,
+          WORKLOAD_ARG,
           CREATE_IN_DIR_CONF_ARG,
           BUFFER_SIZE_ARG,
           BUFFER_DIVISION_ARG,
+          IO_SIZE_ARG,
+          FILE_SIZE_ARG,
+          NUM_ENTRIES_ARG,
+          JSON_ARG,
           CLUSTER_CONF_ARG,
           CLUSTER_CONF_ARG[0],
           USER_ARG,
           USER_ARG_CHAR,
+          WORKLOAD_ARG,
+          WORKLOAD_ARG_CHAR,
           CREATE_IN_DIR_CONF_ARG,
           CREATE_IN_DIR_CONF_ARG_CHAR,
           BUFFER_SIZE_ARG,
           BUFFER_SIZE_ARG_CHAR,
           BUFFER_DIVISION_ARG,
-          BUFFER_DIVISION_CHAR);
+          BUFFER_DIVISION_CHAR,
+          IO_SIZE_ARG,
+          IO_SIZE_ARG_CHAR,
+          FILE_SIZE_ARG,
+          FILE_SIZE_ARG_CHAR,
+          NUM_ENTRIES_ARG,
+          NUM_ENTRIES_ARG_CHAR,
+          JSON_ARG,
+          JSON_ARG_CHAR);
+
+  size_t numWorkloads;
+  const Workload *workloads = getWorkloads(&numWorkloads);
+
+  fprintf(stderr, "\nWorkloads:\n");
+
+  for (size_t i = 0; i < numWorkloads; i++)
+    fprintf(stderr, "\t%-12s - %s\n", workloads[i].name,
+            workloads[i].description);
 }
 
 static int
-parseArguments(int argc, char **argv,
-               std::string &confPath,
-               std::string &user,
-               std::vector<std::string> &pools,
-               int *runTime,
-               int *numThreads,
-               bool *createInDir,
-               size_t *bufferSize,
-               size_t *bufferDivision,
-               bool *deleteObjects)
+parseArguments(int argc, char **argv, BenchmarkConf &conf)
 {
-  confPath = "";
+  conf.confPath = "";
   const char *confFromEnv(getenv(CONF_ENV_VAR));
   int workers = -1;
   int duration = 0;
   int bufSize = 0;
   int bufDiv = 1;
-  *deleteObjects = false;
+  long ioSize = DEFAULT_IO_SIZE;
+  long fileSize = DEFAULT_FILE_SIZE;
+  long numEntries = DEFAULT_NUM_ENTRIES;
+  conf.deleteObjects = false;
+  conf.createInDir = false;
+  conf.workload = DEFAULT_WORKLOAD;
 
   if (confFromEnv != 0)
-    confPath = confFromEnv;
+    conf.confPath = confFromEnv;
 
   int optionIndex = 0;
   struct option options[] =
@@ -212,6 +172,11 @@ parseArguments(int argc, char **argv,
    {BUFFER_DIVISION_ARG, required_argument, 0, BUFFER_DIVISION_CHAR},
    {POOLS_CONF_ARG, required_argument, 0, POOLS_CONF_ARG_CHAR},
    {DELETE_OBJS_ARG, required_argument, 0, DELETE_OBJS_ARG_CHAR},
+   {WORKLOAD_ARG, required_argument, 0, WORKLOAD_ARG_CHAR},
+   {IO_SIZE_ARG, required_argument, 0, IO_SIZE_ARG_CHAR},
+   {FILE_SIZE_ARG, required_argument, 0, FILE_SIZE_ARG_CHAR},
+   {NUM_ENTRIES_ARG, required_argument, 0, NUM_ENTRIES_ARG_CHAR},
+   {JSON_ARG, required_argument, 0, JSON_ARG_CHAR},
    {0, 0, 0, 0}
   };
 
@@ -231,25 +196,35 @@ parseArguments(int argc, char **argv,
   while ((c = getopt_long(argc, argv, args.c_str(), options, &optionIndex)) != -1)
   {
     if (c == CLUSTER_CONF_ARG[0])
-      confPath = optarg;
+      conf.confPath = optarg;
     else if (c == CREATE_IN_DIR_CONF_ARG_CHAR)
-      *createInDir = true;
+      conf.createInDir = true;
     else if (c == BUFFER_SIZE_ARG_CHAR)
       bufSize = atoi(optarg);
     else if (c == BUFFER_DIVISION_CHAR)
       bufDiv = atoi(optarg);
     else if (c == USER_ARG_CHAR)
-      user = optarg;
+      conf.user = optarg;
     else if (c == POOLS_CONF_ARG_CHAR)
       poolsStr = optarg;
     else if (c == DELETE_OBJS_ARG_CHAR)
-      *deleteObjects = strcmp(optarg, "yes") == 0;
+      conf.deleteObjects = strcmp(optarg, "yes") == 0;
+    else if (c == WORKLOAD_ARG_CHAR)
+      conf.workload = optarg;
+    else if (c == IO_SIZE_ARG_CHAR)
+      ioSize = atol(optarg);
+    else if (c == FILE_SIZE_ARG_CHAR)
+      fileSize = atol(optarg);
+    else if (c == NUM_ENTRIES_ARG_CHAR)
+      numEntries = atol(optarg);
+    else if (c == JSON_ARG_CHAR)
+      conf.jsonPath = optarg;
   }
 
   if (!poolsStr.empty())
   {
-    splitToVector(poolsStr, pools);
-    if (pools.size() > 0 && pools.size() != 2)
+    splitToVector(poolsStr, conf.pools);
+    if (conf.pools.size() > 0 && conf.pools.size() != 2)
     {
       fprintf(stderr, "Error parsing pools '%s'. Pools should be passed as: "
                       "MTD_POOL,DATA_POOL\n", poolsStr.c_str());
@@ -257,7 +232,7 @@ parseArguments(int argc, char **argv,
     }
   }
 
-  if (confPath == "")
+  if (conf.confPath == "")
   {
     fprintf(stderr, "Error: Please specify the " CONF_ENV_VAR " environment "
             "variable or use the --" CLUSTER_CONF_ARG "=... argument.\n");
@@ -265,6 +240,12 @@ parseArguments(int argc, char **argv,
     return -1;
   }
 
+  if (getWorkload(conf.workload) == 0)
+  {
+    fprintf(stderr, "Error: Unknown workload '%s'\n", conf.workload.c_str());
+    return -1;
+  }
+
   optionIndex = optind;
 
   if (optionIndex < argc)
@@ -286,40 +267,76 @@ parseArguments(int argc, char **argv,
     return -1;
   }
 
+  if (ioSize <= 0 || fileSize < ioSize || numEntries <= 0)
+  {
+    fprintf(stderr, "Error: The IO size and number of entries need to be "
+            "positive, and the file size not smaller than the IO size\n");
+    return -1;
+  }
+
   optionIndex++;
 
   if (optionIndex < argc)
     workers = atoi(argv[optionIndex]);
 
-  *runTime = duration;
+  conf.runTime = duration;
 
   if (workers <= 0)
     workers = DEFAULT_NUM_THREADS;
 
-  *numThreads = workers;
+  conf.numThreads = workers;
 
-  *bufferSize = bufSize;
-  *bufferDivision = bufDiv;
+  conf.bufferSize = bufSize;
+  conf.bufferDivision = bufDiv;
+  conf.ioSize = ioSize;
+  conf.fileSize = fileSize;
+  conf.numEntries = numEntries;
 
   return 0;
 }
 
+static void
+writeJsonResults(const BenchmarkConf &conf, const LatencyHistogram &latencies,
+                 int numOps, double elapsedSeconds)
+{
+  std::ofstream out(conf.jsonPath.c_str());
+
+  if (!out)
+  {
+    fprintf(stderr, "Error: Cannot write the results to %s\n",
+            conf.jsonPath.c_str());
+    return;
+  }
+
+  out << "{\n"
+      << "  \"workload\": \"" << conf.workload << "\",\n"
+      << "  \"threads\": " << conf.numThreads << ",\n"
+      << "  \"duration\": " << conf.runTime << ",\n"
+      << "  \"io_size\": " << conf.ioSize << ",\n"
+      << "  \"file_size\": " << conf.fileSize << ",\n"
+      << "  \"num_entries\": " << conf.numEntries << ",\n"
+      << "  \"buffer_size\": " << conf.bufferSize << ",\n"
+      << "  \"ops\": " << numOps << ",\n"
+      << "  \"ops_per_sec\": " << numOps / elapsedSeconds << ",\n"
+      << "  \"latency_us\": {\n"
+      << "    \"count\": " << latencies.count() << ",\n"
+      << "    \"min\": " << latencies.min() << ",\n"
+      << "    \"mean\": " << latencies.mean() << ",\n"
+      << "    \"p50\": " << latencies.percentile(50) << ",\n"
+      << "    \"p90\": " << latencies.percentile(90) << ",\n"
+      << "    \"p99\": " << latencies.percentile(99) << ",\n"
+      << "    \"p999\": " << latencies.percentile(99.9) << ",\n"
+      << "    \"max\": " << latencies.max() << "\n"
+      << "  }\n"
+      << "}\n";
+}
+
 int
 main(int argc, char **argv)
 {
-  std::string confPath, user;
-  int runTime, numThreads;
-  bool createInDir, deleteObjects;
-  size_t bufferSize, bufferDivision;
-  std::vector<std::string> pools;
-
-  runTime = numThreads = 0;
-  createInDir = false;
-  bufferSize = bufferDivision = 0;
+  BenchmarkConf conf;
 
-  int ret = parseArguments(argc, argv, confPath, user, pools, &runTime,
-                           &numThreads, &createInDir, &bufferSize,
-                           &bufferDivision, &deleteObjects);
+  int ret = parseArguments(argc, argv, conf);
 
   if (ret != 0)
   {
@@ -327,13 +344,16 @@ main(int argc, char **argv)
     return ret;
   }
 
+  const Workload *workload = getWorkload(conf.workload);
+  const int runTime = conf.runTime;
+  const int numThreads = conf.numThreads;
   std::string mtdPool, dataPool;
   bool createPools = false;
 
-  if (pools.size() == 2)
+  if (conf.pools.size() == 2)
   {
-    mtdPool = pools[0];
-    dataPool = pools[1];
+    mtdPool = conf.pools[0];
+    dataPool = conf.pools[1];
   }
   else
   {
@@ -342,20 +362,25 @@ main(int argc, char **argv)
     createPools = true;
   }
 
-  BenchmarkMgr benchmark(confPath.c_str(), user, mtdPool, dataPool, createPools,
-                         bufferSize / 1000);
+  BenchmarkMgr benchmark(conf.confPath.c_str(), conf.user, mtdPool, dataPool,
+                         createPools, conf.bufferSize / 1000);
   benchmark.setupPools();
 
   fprintf(stdout, "\n*** RadosFs Benchmark ***\n\n"
-          "Running on cluster configured by %s "
+          "Running the %s workload on cluster configured by %s "
           "for %d seconds with %d threads %s...\n",
-          confPath.c_str(),
+          workload->name,
+          conf.confPath.c_str(),
           runTime,
           numThreads,
-          (createInDir ? "(using their own directory)": "(all writing to / )"));
+          (conf.createInDir ? "(using their own directory)":
+                              "(all writing to / )"));
 
-  benchmark.setCreateInDir(createInDir);
-  benchmark.setDeleteObjects(deleteObjects);
+  benchmark.setCreateInDir(conf.createInDir);
+  benchmark.setDeleteObjects(conf.deleteObjects);
+  benchmark.setIoSize(conf.ioSize);
+  benchmark.setFileSize(conf.fileSize);
+  benchmark.setNumEntries(conf.numEntries);
 
   const int hostnameLength = 32;
   char hostname[hostnameLength];
@@ -364,14 +389,15 @@ main(int argc, char **argv)
   std::stringstream stream;
   stream << hostname << "-" << getpid();
 
-  commonPrefix = stream.str();
+  benchmark.setPrefix(stream.str());
 
   boost::thread *threads[numThreads];
   BenchmarkInfo *infos[numThreads];
-  char *buffer = 0;
+  const size_t bufferSize = std::max(conf.bufferSize, conf.ioSize);
+  char *buffer = new char[bufferSize];
+  boost::barrier startBarrier(numThreads + 1);
 
-  if (bufferSize > 0)
-    buffer = new char[bufferSize];
+  memset(buffer, 'x', bufferSize);
 
   int i;
 
@@ -383,25 +409,36 @@ main(int argc, char **argv)
     info->shouldExit = false;
     info->threadId = i;
     info->buffer = buffer;
-    info->bufferSize = bufferSize;
-    info->bufferDivision = bufferDivision;
+    info->bufferSize = conf.bufferSize;
+    info->bufferDivision = conf.bufferDivision;
+    info->file = 0;
+    info->seed = i;
+    info->startBarrier = &startBarrier;
+    info->setupRet = 0;
 
     infos[i] = info;
 
-    threads[i] = new boost::thread(&createFiles, info);
+    threads[i] = new boost::thread(&runWorkload, info, workload);
   }
 
+  // Wait for the workload to be set up in every thread
+  startBarrier.wait();
+
+  struct timespec startTime, endTime;
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+
   time_t initialTime, currentTime;
   time(&initialTime);
 
   int countDown = runTime;
-  float avgFilesPerSecond = .0;
-  float avgFilesPerThread = .0;
-  int currentNumFiles = 0;
-  int numFiles = 0;
+  float avgOpsPerSecond = .0;
+  float avgOpsPerThread = .0;
+  int currentNumOps = 0;
+  int numOps = 0;
 
   while(countDown > 0)
   {
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
     time(&currentTime);
 
     if ((currentTime - initialTime) >= 1)
@@ -409,53 +446,65 @@ main(int argc, char **argv)
       if (((runTime - countDown) % LINES_PER_HEADER) == 0)
       {
         fprintf(stdout, "\n%4s | %10s | %10s | %10s\n",
-                "sec", "# files", "files/sec", "files/thread");
+                "sec", "# ops", "ops/sec", "ops/thread");
       }
 
-      currentNumFiles = benchmark.numFiles();
-      float totalCreated = currentNumFiles - numFiles;
-      avgFilesPerSecond += totalCreated;
-      avgFilesPerThread += totalCreated / numThreads;
+      currentNumOps = benchmark.numOps();
+      float totalOps = currentNumOps - numOps;
+      avgOpsPerSecond += totalOps;
+      avgOpsPerThread += totalOps / numThreads;
       fprintf(stdout, "%4d | %10d | %10d | %8.2f\n",
               (runTime - countDown + 1),
-              currentNumFiles,
-              (int) totalCreated,
-              totalCreated / numThreads);
+              currentNumOps,
+              (int) totalOps,
+              totalOps / numThreads);
 
       initialTime = currentTime;
-      numFiles = currentNumFiles;
+      numOps = currentNumOps;
       countDown--;
     }
   }
 
-  fprintf(stdout, "\nResult:\n\n");
-  fprintf(stdout, "\tNumber of files:      %10d\n", currentNumFiles);
-  fprintf(stdout, "\tAverage files/sec:    %10.2f\n", avgFilesPerSecond / runTime);
-  fprintf(stdout, "\tAverage files/thread: %10.2f\n", avgFilesPerThread / runTime);
-
-  float minCreationTime = std::numeric_limits<float>::max();
-  float maxCreationTime = std::numeric_limits<float>::min();;
+  LatencyHistogram latencies;
 
   for(i = 0; i < numThreads; i++)
   {
     infos[i]->shouldExit = true;
     threads[i]->join();
 
-    if (infos[i]->minCreationTime < minCreationTime)
-      minCreationTime = infos[i]->minCreationTime;
+    latencies.merge(infos[i]->latencies);
 
-    if (infos[i]->maxCreationTime > maxCreationTime)
-      maxCreationTime = infos[i]->maxCreationTime;
-
-    if (ret != 0)
-    {
-      fprintf(stderr, "ERROR joining thread: %d : %s", ret, strerror(ret));
-      return -1;
-    }
+    delete threads[i];
+    delete infos[i];
   }
 
-  fprintf(stdout, "\tMin creation time:    %10.2f sec\n", minCreationTime);
-  fprintf(stdout, "\tMax creation time:    %10.2f sec\n", maxCreationTime);
+  clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+  const double elapsedSeconds = (endTime.tv_sec - startTime.tv_sec) +
+                                (endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+  currentNumOps = benchmark.numOps();
+
+  fprintf(stdout, "\nResult:\n\n");
+  fprintf(stdout, "\tNumber of ops:        %10d\n", currentNumOps);
+  fprintf(stdout, "\tAverage ops/sec:      %10.2f\n", avgOpsPerSecond / runTime);
+  fprintf(stdout, "\tAverage ops/thread:   %10.2f\n", avgOpsPerThread / runTime);
+  fprintf(stdout, "\n\tLatency (usec):\n");
+  fprintf(stdout, "\t  min:                %10llu\n",
+          (unsigned long long) latencies.min());
+  fprintf(stdout, "\t  mean:               %10.2f\n", latencies.mean());
+  fprintf(stdout, "\t  p50:                %10llu\n",
+          (unsigned long long) latencies.percentile(50));
+  fprintf(stdout, "\t  p90:                %10llu\n",
+          (unsigned long long) latencies.percentile(90));
+  fprintf(stdout, "\t  p99:                %10llu\n",
+          (unsigned long long) latencies.percentile(99));
+  fprintf(stdout, "\t  p999:               %10llu\n",
+          (unsigned long long) latencies.percentile(99.9));
+  fprintf(stdout, "\t  max:                %10llu\n",
+          (unsigned long long) latencies.max());
+
+  if (!conf.jsonPath.empty())
+    writeJsonResults(conf, latencies, currentNumOps, elapsedSeconds);
 
   delete [] buffer;
 
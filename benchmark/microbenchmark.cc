@@ -0,0 +1,542 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <getopt.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <vector>
+
+#include "DirCache.hh"
+#include "FileInlineBuffer.hh"
+#include "radosfscommon.h"
+
+// Runs the pure CPU paths of the library (parsing and encoding) over synthetic
+// inputs, so their optimizations can be measured without a Ceph cluster
+
+#define DEFAULT_NUM_ENTRIES 100000
+#define DEFAULT_NUM_MTD_KEYS 20
+#define DEFAULT_ITERATIONS 1000000
+#define DEFAULT_REPETITIONS 5
+#define DEFAULT_INLINE_BUFFER_SIZE 4096
+#define NUM_ENTRIES_ARG "num-entries"
+#define NUM_ENTRIES_ARG_CHAR 'N'
+#define NUM_MTD_KEYS_ARG "mtd-keys"
+#define NUM_MTD_KEYS_ARG_CHAR 'm'
+#define ITERATIONS_ARG "iterations"
+#define ITERATIONS_ARG_CHAR 'i'
+#define REPETITIONS_ARG "repetitions"
+#define REPETITIONS_ARG_CHAR 'r'
+#define FILTER_ARG "filter"
+#define FILTER_ARG_CHAR 'f'
+#define JSON_ARG "json"
+#define JSON_ARG_CHAR 'j'
+
+typedef struct
+{
+  size_t numEntries;
+  size_t numMtdKeys;
+  size_t iterations;
+  size_t repetitions;
+  std::string filter;
+  std::string jsonPath;
+} MicroBenchmarkConf;
+
+typedef struct
+{
+  std::string name;
+  size_t items;
+  double bestNsPerItem;
+  double medianNsPerItem;
+} MicroBenchmarkResult;
+
+class RadosFsMicroBenchmark
+{
+public:
+  RadosFsMicroBenchmark(const MicroBenchmarkConf &conf);
+
+  void prepare(void);
+
+  // Each of these processes its input as many times as configured and
+  // returns the number of items (entries, tokens, names...) it went through
+
+  size_t parseTextDirLog(void);
+
+  size_t parseBinaryDirLog(void);
+
+  size_t splitTokens(void);
+
+  size_t escapeNames(void);
+
+  size_t unescapeNames(void);
+
+  size_t makeIndexLines(void);
+
+  size_t statFromXAttrs(void);
+
+  size_t makeChunkNames(void);
+
+  size_t readInlineBuffers(void);
+
+  // Used to keep the compiler from discarding the results
+  size_t checksum;
+
+private:
+  const MicroBenchmarkConf &mConf;
+  std::string mTextDirLog;
+  librados::bufferlist mBinaryDirLog;
+  std::string mFileXAttr;
+  std::vector<std::string> mNames;
+  std::vector<std::string> mEscapedNames;
+  librados::bufferlist mInlineBuffer;
+};
+
+typedef size_t (RadosFsMicroBenchmark::*MicroBenchmarkMethod)(void);
+
+typedef struct
+{
+  const char *name;
+  const char *description;
+  MicroBenchmarkMethod method;
+} MicroBenchmark;
+
+static const MicroBenchmark microBenchmarks[] =
+{
+  {"dir-log-text", "DirCache::parseContents over a text log of NUM_ENTRIES "
+   "entries (one in ten removed)", &RadosFsMicroBenchmark::parseTextDirLog},
+  {"dir-log-binary", "DirCache::parseContents over a binary log of "
+   "NUM_ENTRIES entries with MTD_KEYS metadata keys each",
+   &RadosFsMicroBenchmark::parseBinaryDirLog},
+  {"split-token", "splitToken over a file's entry with MTD_KEYS extra keys",
+   &RadosFsMicroBenchmark::splitTokens},
+  {"escape", "escapeObjName", &RadosFsMicroBenchmark::escapeNames},
+  {"unescape", "unescapeObjName", &RadosFsMicroBenchmark::unescapeNames},
+  {"index-line", "getObjectIndexLine", &RadosFsMicroBenchmark::makeIndexLines},
+  {"stat-xattr", "statFromXAttr over a file's entry with MTD_KEYS extra keys",
+   &RadosFsMicroBenchmark::statFromXAttrs},
+  {"chunk-name", "makeFileChunkName", &RadosFsMicroBenchmark::makeChunkNames},
+  {"inline-buffer", "FileInlineBuffer::readInlineBuffer of a 4 KB buffer",
+   &RadosFsMicroBenchmark::readInlineBuffers}
+};
+
+RadosFsMicroBenchmark::RadosFsMicroBenchmark(const MicroBenchmarkConf &conf)
+  : checksum(0),
+    mConf(conf)
+{}
+
+void
+RadosFsMicroBenchmark::prepare(void)
+{
+  std::map<std::string, std::string> metadata;
+
+  for (size_t i = 0; i < mConf.numMtdKeys; i++)
+  {
+    std::stringstream key, value;
+    key << "key-" << i;
+    value << "value for the metadata key number " << i;
+    metadata[key.str()] = value.str();
+  }
+
+  for (size_t i = 0; i < mConf.numEntries; i++)
+  {
+    std::stringstream stream;
+    stream << "entry \"number\" " << i << (i % 5 == 0 ? "/" : "");
+    const std::string name = stream.str();
+
+    mTextDirLog += getObjectIndexLine(name, '+');
+    appendDirLogRecord(mBinaryDirLog, '+', name, metadata);
+
+    if (i % 10 == 0)
+    {
+      mTextDirLog += getObjectIndexLine(name, '-');
+      appendDirLogRecord(mBinaryDirLog, '-', name,
+                         std::map<std::string, std::string>());
+    }
+
+    if (mNames.size() < 1000)
+    {
+      mNames.push_back("/a dir/with \"quotes\"/and%percent/" + name);
+      mEscapedNames.push_back(escapeObjName(mNames.back()));
+    }
+  }
+
+  Stat stat;
+  stat.reset();
+  stat.path = "/dir/file";
+  stat.translatedPath = generateUuid();
+  stat.statBuff.st_mode = S_IFREG | S_IRWXU;
+  stat.statBuff.st_uid = 1000;
+  stat.statBuff.st_gid = 1000;
+  stat.extraData = metadata;
+
+  librados::IoCtx ioctx;
+  stat.pool.reset(new Pool("data-pool", 0, ioctx));
+
+  mFileXAttr = getFileXAttrDirRecord(&stat);
+
+  std::string contents(DEFAULT_INLINE_BUFFER_SIZE, 'x');
+  mInlineBuffer.append_zero(XATTR_FILE_INLINE_BUFFER_HEADER_SIZE);
+  mInlineBuffer.append(contents);
+}
+
+size_t
+RadosFsMicroBenchmark::parseTextDirLog(void)
+{
+  radosfs::DirCache cache("dir-inode", PoolSP());
+  cache.parseContents(mTextDirLog.c_str(), mTextDirLog.length());
+  checksum += cache.numCachedEntries();
+
+  return mConf.numEntries;
+}
+
+size_t
+RadosFsMicroBenchmark::parseBinaryDirLog(void)
+{
+  radosfs::DirCache cache("dir-inode", PoolSP());
+  cache.parseContents(mBinaryDirLog.c_str(), mBinaryDirLog.length());
+  checksum += cache.numCachedEntries();
+
+  return mConf.numEntries;
+}
+
+size_t
+RadosFsMicroBenchmark::splitTokens(void)
+{
+  size_t numTokens = 0;
+  std::string key, value;
+
+  for (size_t i = 0; i < mConf.iterations / 100; i++)
+  {
+    int startPos = 0, lastPos;
+
+    while ((lastPos = splitToken(mFileXAttr, startPos, key, value)) !=
+           startPos)
+    {
+      checksum += value.length();
+      startPos = lastPos;
+      numTokens++;
+    }
+  }
+
+  return numTokens;
+}
+
+size_t
+RadosFsMicroBenchmark::escapeNames(void)
+{
+  for (size_t i = 0; i < mConf.iterations; i++)
+    checksum += escapeObjName(mNames[i % mNames.size()]).length();
+
+  return mConf.iterations;
+}
+
+size_t
+RadosFsMicroBenchmark::unescapeNames(void)
+{
+  for (size_t i = 0; i < mConf.iterations; i++)
+    checksum += unescapeObjName(mEscapedNames[i % mNames.size()]).length();
+
+  return mConf.iterations;
+}
+
+size_t
+RadosFsMicroBenchmark::makeIndexLines(void)
+{
+  for (size_t i = 0; i < mConf.iterations; i++)
+    checksum += getObjectIndexLine(mNames[i % mNames.size()], '+').length();
+
+  return mConf.iterations;
+}
+
+size_t
+RadosFsMicroBenchmark::statFromXAttrs(void)
+{
+  const size_t iterations = mConf.iterations / 100;
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    struct stat buff;
+    std::string link, pool;
+    std::map<std::string, std::string> extraData;
+
+    statFromXAttr("/dir/file", mFileXAttr, &buff, link, pool, extraData);
+    checksum += extraData.size();
+  }
+
+  return iterations;
+}
+
+size_t
+RadosFsMicroBenchmark::makeChunkNames(void)
+{
+  const std::string inode = generateUuid();
+
+  for (size_t i = 0; i < mConf.iterations; i++)
+    checksum += makeFileChunkName(inode, i).length();
+
+  return mConf.iterations;
+}
+
+size_t
+RadosFsMicroBenchmark::readInlineBuffers(void)
+{
+  std::string contents;
+  timespec mtime;
+
+  for (size_t i = 0; i < mConf.iterations; i++)
+  {
+    radosfs::FileInlineBuffer::readInlineBuffer(mInlineBuffer, &mtime,
+                                                &contents);
+    checksum += contents.length();
+  }
+
+  return mConf.iterations;
+}
+
+static double
+elapsedNanoseconds(const struct timespec &before, const struct timespec &after)
+{
+  return (after.tv_sec - before.tv_sec) * 1e9 +
+         (after.tv_nsec - before.tv_nsec);
+}
+
+static MicroBenchmarkResult
+runMicroBenchmark(RadosFsMicroBenchmark &benchmark,
+                  const MicroBenchmark &microBenchmark, size_t repetitions)
+{
+  std::vector<double> nsPerItem;
+  MicroBenchmarkResult result;
+  result.name = microBenchmark.name;
+  result.items = 0;
+
+  for (size_t i = 0; i < repetitions; i++)
+  {
+    struct timespec timeBefore, timeAfter;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeBefore);
+
+    size_t items = (benchmark.*microBenchmark.method)();
+
+    clock_gettime(CLOCK_MONOTONIC, &timeAfter);
+
+    result.items = items;
+    nsPerItem.push_back(elapsedNanoseconds(timeBefore, timeAfter) /
+                        std::max(items, (size_t) 1));
+  }
+
+  std::sort(nsPerItem.begin(), nsPerItem.end());
+
+  result.bestNsPerItem = nsPerItem.front();
+  result.medianNsPerItem = nsPerItem[nsPerItem.size() / 2];
+
+  return result;
+}
+
+static void
+writeJsonResults(const MicroBenchmarkConf &conf,
+                 const std::vector<MicroBenchmarkResult> &results)
+{
+  std::ofstream out(conf.jsonPath.c_str());
+
+  if (!out)
+  {
+    fprintf(stderr, "Error: Cannot write the results to %s\n",
+            conf.jsonPath.c_str());
+    return;
+  }
+
+  out << "{\n"
+      << "  \"num_entries\": " << conf.numEntries << ",\n"
+      << "  \"mtd_keys\": " << conf.numMtdKeys << ",\n"
+      << "  \"iterations\": " << conf.iterations << ",\n"
+      << "  \"repetitions\": " << conf.repetitions << ",\n"
+      << "  \"results\": [\n";
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const MicroBenchmarkResult &result = results[i];
+
+    out << "    {\"name\": \"" << result.name << "\", "
+        << "\"items\": " << result.items << ", "
+        << "\"best_ns_per_item\": " << result.bestNsPerItem << ", "
+        << "\"median_ns_per_item\": " << result.medianNsPerItem << "}"
+        << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+
+  out << "  ]\n"
+      << "}\n";
+}
+
+static void
+showUsage(const char *name)
+{
+  fprintf(stderr, "Usage:\n%s [--%s=NUM] [--%s=NUM] [--%s=NUM] [--%s=NUM] "
+          "[--%s=NAME] [--%s=PATH]\n"
+          "\t--%s, -%c - number of entries in the directory logs "
+          "(NUM_ENTRIES, default: %d)\n"
+          "\t--%s, -%c - number of metadata keys per entry "
+          "(MTD_KEYS, default: %d)\n"
+          "\t--%s, -%c - number of times the smaller paths are run "
+          "(default: %d)\n"
+          "\t--%s, -%c - number of times each benchmark is repeated "
+          "(default: %d)\n"
+          "\t--%s, -%c - only run the benchmarks whose name contains NAME\n"
+          "\t--%s, -%c - write the results as JSON to the given file\n",
+          name,
+          NUM_ENTRIES_ARG, NUM_MTD_KEYS_ARG, ITERATIONS_ARG, REPETITIONS_ARG,
+          FILTER_ARG, JSON_ARG,
+          NUM_ENTRIES_ARG, NUM_ENTRIES_ARG_CHAR, DEFAULT_NUM_ENTRIES,
+          NUM_MTD_KEYS_ARG, NUM_MTD_KEYS_ARG_CHAR, DEFAULT_NUM_MTD_KEYS,
+          ITERATIONS_ARG, ITERATIONS_ARG_CHAR, DEFAULT_ITERATIONS,
+          REPETITIONS_ARG, REPETITIONS_ARG_CHAR, DEFAULT_REPETITIONS,
+          FILTER_ARG, FILTER_ARG_CHAR,
+          JSON_ARG, JSON_ARG_CHAR);
+
+  fprintf(stderr, "\nBenchmarks:\n");
+
+  for (size_t i = 0; i < sizeof(microBenchmarks) / sizeof(microBenchmarks[0]);
+       i++)
+  {
+    fprintf(stderr, "\t%-14s - %s\n", microBenchmarks[i].name,
+            microBenchmarks[i].description);
+  }
+}
+
+static int
+parseArguments(int argc, char **argv, MicroBenchmarkConf &conf)
+{
+  long numEntries = DEFAULT_NUM_ENTRIES;
+  long numMtdKeys = DEFAULT_NUM_MTD_KEYS;
+  long iterations = DEFAULT_ITERATIONS;
+  long repetitions = DEFAULT_REPETITIONS;
+
+  int optionIndex = 0;
+  struct option options[] =
+  {{NUM_ENTRIES_ARG, required_argument, 0, NUM_ENTRIES_ARG_CHAR},
+   {NUM_MTD_KEYS_ARG, required_argument, 0, NUM_MTD_KEYS_ARG_CHAR},
+   {ITERATIONS_ARG, required_argument, 0, ITERATIONS_ARG_CHAR},
+   {REPETITIONS_ARG, required_argument, 0, REPETITIONS_ARG_CHAR},
+   {FILTER_ARG, required_argument, 0, FILTER_ARG_CHAR},
+   {JSON_ARG, required_argument, 0, JSON_ARG_CHAR},
+   {0, 0, 0, 0}
+  };
+
+  int c;
+  std::string args;
+
+  for (int i = 0; options[i].name != 0; i++)
+  {
+    args += options[i].val;
+
+    if (options[i].has_arg != no_argument)
+      args += ":";
+  }
+
+  while ((c = getopt_long(argc, argv, args.c_str(), options, &optionIndex)) != -1)
+  {
+    if (c == NUM_ENTRIES_ARG_CHAR)
+      numEntries = atol(optarg);
+    else if (c == NUM_MTD_KEYS_ARG_CHAR)
+      numMtdKeys = atol(optarg);
+    else if (c == ITERATIONS_ARG_CHAR)
+      iterations = atol(optarg);
+    else if (c == REPETITIONS_ARG_CHAR)
+      repetitions = atol(optarg);
+    else if (c == FILTER_ARG_CHAR)
+      conf.filter = optarg;
+    else if (c == JSON_ARG_CHAR)
+      conf.jsonPath = optarg;
+    else
+      return -1;
+  }
+
+  if (numEntries <= 0 || numMtdKeys < 0 || iterations < 100 ||
+      repetitions <= 0)
+  {
+    fprintf(stderr, "Error: The number of entries and repetitions need to be "
+            "positive and the iterations at least 100\n");
+    return -1;
+  }
+
+  conf.numEntries = numEntries;
+  conf.numMtdKeys = numMtdKeys;
+  conf.iterations = iterations;
+  conf.repetitions = repetitions;
+
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  MicroBenchmarkConf conf;
+
+  if (parseArguments(argc, argv, conf) != 0)
+  {
+    showUsage(argv[0]);
+    return -1;
+  }
+
+  RadosFsMicroBenchmark benchmark(conf);
+
+  fprintf(stdout, "\n*** RadosFs Micro-benchmarks ***\n\n"
+          "Preparing the inputs (%lu entries with %lu metadata keys)...\n",
+          (unsigned long) conf.numEntries, (unsigned long) conf.numMtdKeys);
+
+  benchmark.prepare();
+
+  fprintf(stdout, "\n%-14s | %12s | %14s | %14s\n",
+          "benchmark", "items", "best ns/item", "median ns/item");
+
+  std::vector<MicroBenchmarkResult> results;
+
+  for (size_t i = 0; i < sizeof(microBenchmarks) / sizeof(microBenchmarks[0]);
+       i++)
+  {
+    const MicroBenchmark &microBenchmark = microBenchmarks[i];
+
+    if (!conf.filter.empty() &&
+        std::string(microBenchmark.name).find(conf.filter) == std::string::npos)
+    {
+      continue;
+    }
+
+    MicroBenchmarkResult result = runMicroBenchmark(benchmark, microBenchmark,
+                                                    conf.repetitions);
+    results.push_back(result);
+
+    fprintf(stdout, "%-14s | %12lu | %14.2f | %14.2f\n",
+            result.name.c_str(), (unsigned long) result.items,
+            result.bestNsPerItem, result.medianNsPerItem);
+  }
+
+  if (!conf.jsonPath.empty())
+    writeJsonResults(conf, results);
+
+  // Printed only so the results are used
+  fprintf(stdout, "\n(checksum: %lu)\n", (unsigned long) benchmark.checksum);
+
+  return 0;
+}
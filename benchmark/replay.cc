@@ -0,0 +1,752 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <map>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "BenchmarkMgr.hh"
+#include "LatencyHistogram.hh"
+#include "OpRecorder.hh"
+#include "radosfscommon.h"
+
+#define CONF_ENV_VAR "RADOSFS_BENCHMARK_CLUSTER_CONF"
+#define CLUSTER_CONF_ARG "conf"
+#define DEFAULT_NUM_THREADS 10
+#define DEFAULT_SPEED 1.0
+#define USER_ARG "user"
+#define USER_ARG_CHAR 'u'
+#define POOLS_CONF_ARG "pools"
+#define POOLS_CONF_ARG_CHAR 'p'
+#define SPEED_ARG "speed"
+#define SPEED_ARG_CHAR 'S'
+#define JSON_ARG "json"
+#define JSON_ARG_CHAR 'j'
+
+using radosfs::OpRecorder;
+
+typedef struct
+{
+  std::string confPath;
+  std::string user;
+  std::vector<std::string> pools;
+  std::string tracePath;
+  int numThreads;
+  double speed;
+  std::string jsonPath;
+} ReplayConf;
+
+// An operation of the trace, with the path it is replayed on
+typedef struct
+{
+  OpRecorder::Record record;
+  std::string path;
+} ReplayOp;
+
+typedef struct
+{
+  LatencyHistogram latencies[OpRecorder::OP_COUNT];
+  uint64_t errors[OpRecorder::OP_COUNT];
+  // Operations that failed when replayed but not when recorded, or vice-versa
+  uint64_t diverged[OpRecorder::OP_COUNT];
+} ReplayStats;
+
+typedef struct
+{
+  radosfs::Filesystem *fs;
+  std::vector<ReplayOp> ops;
+  size_t bufferSize;
+  double speed;
+  boost::barrier *startBarrier;
+  struct timespec *startTime;
+  ReplayStats stats;
+} ReplayInfo;
+
+static void
+showUsage(const char *name)
+{
+  fprintf(stderr, "Usage:\n%s TRACE_FILE [NUM_THREADS] [--%s=CLUSTER_CONF] "
+          "[--%s=USER_NAME] [--%s=MTD_POOL,DATA_POOL] [--%s=FACTOR] "
+          "[--%s=PATH]\n"
+          "\tTRACE_FILE   - file with the operations recorded by "
+          "Filesystem::startOpRecording\n"
+          "\tNUM_THREADS  - number of concurrent threads (the operations of "
+          "each recorded thread are replayed in order by the same one)\n"
+          "\t--%s, -%c - path to the cluster's configuration file\n"
+          "\t--%s, -%c - the user name to connect to the Ceph cluster\n"
+          "\t--%s, -%c - the pools to use instead of creating new ones\n"
+          "\t--%s, -%c - how fast to replay the trace compared to when it "
+          "was recorded (e.g. 2 is twice as fast; 0 is as fast as possible; "
+          "default: 1)\n"
+          "\t--%s, -%c - write the results as JSON to the given file\n",
+          name,
+          CLUSTER_CONF_ARG,
+          USER_ARG,
+          POOLS_CONF_ARG,
+          SPEED_ARG,
+          JSON_ARG,
+          CLUSTER_CONF_ARG,
+          CLUSTER_CONF_ARG[0],
+          USER_ARG,
+          USER_ARG_CHAR,
+          POOLS_CONF_ARG,
+          POOLS_CONF_ARG_CHAR,
+          SPEED_ARG,
+          SPEED_ARG_CHAR,
+          JSON_ARG,
+          JSON_ARG_CHAR);
+}
+
+static int
+parseArguments(int argc, char **argv, ReplayConf &conf)
+{
+  conf.confPath = "";
+  const char *confFromEnv(getenv(CONF_ENV_VAR));
+  int workers = -1;
+  conf.speed = DEFAULT_SPEED;
+
+  if (confFromEnv != 0)
+    conf.confPath = confFromEnv;
+
+  int optionIndex = 0;
+  struct option options[] =
+  {{CLUSTER_CONF_ARG, required_argument, 0, CLUSTER_CONF_ARG[0]},
+   {USER_ARG, required_argument, 0, USER_ARG_CHAR},
+   {POOLS_CONF_ARG, required_argument, 0, POOLS_CONF_ARG_CHAR},
+   {SPEED_ARG, required_argument, 0, SPEED_ARG_CHAR},
+   {JSON_ARG, required_argument, 0, JSON_ARG_CHAR},
+   {0, 0, 0, 0}
+  };
+
+  int c;
+  std::string args;
+
+  for (int i = 0; options[i].name != 0; i++)
+  {
+    args += options[i].val;
+
+    if (options[i].has_arg != no_argument)
+      args += ":";
+  }
+
+  std::string poolsStr;
+
+  while ((c = getopt_long(argc, argv, args.c_str(), options, &optionIndex)) != -1)
+  {
+    if (c == CLUSTER_CONF_ARG[0])
+      conf.confPath = optarg;
+    else if (c == USER_ARG_CHAR)
+      conf.user = optarg;
+    else if (c == POOLS_CONF_ARG_CHAR)
+      poolsStr = optarg;
+    else if (c == SPEED_ARG_CHAR)
+      conf.speed = atof(optarg);
+    else if (c == JSON_ARG_CHAR)
+      conf.jsonPath = optarg;
+  }
+
+  if (!poolsStr.empty())
+  {
+    splitToVector(poolsStr, conf.pools);
+    if (conf.pools.size() > 0 && conf.pools.size() != 2)
+    {
+      fprintf(stderr, "Error parsing pools '%s'. Pools should be passed as: "
+                      "MTD_POOL,DATA_POOL\n", poolsStr.c_str());
+      exit(-EINVAL);
+    }
+  }
+
+  if (conf.confPath == "")
+  {
+    fprintf(stderr, "Error: Please specify the " CONF_ENV_VAR " environment "
+            "variable or use the --" CLUSTER_CONF_ARG "=... argument.\n");
+
+    return -1;
+  }
+
+  if (conf.speed < 0)
+  {
+    fprintf(stderr, "Error: The speed cannot be negative\n");
+    return -1;
+  }
+
+  optionIndex = optind;
+
+  if (optionIndex < argc)
+    conf.tracePath = argv[optionIndex];
+
+  if (conf.tracePath.empty())
+  {
+    fprintf(stderr, "Error: Please specify the trace file to replay\n");
+    return -1;
+  }
+
+  optionIndex++;
+
+  if (optionIndex < argc)
+    workers = atoi(argv[optionIndex]);
+
+  if (workers <= 0)
+    workers = DEFAULT_NUM_THREADS;
+
+  conf.numThreads = workers;
+
+  return 0;
+}
+
+static bool
+isDirRecord(const OpRecorder::Record &record)
+{
+  switch (record.op)
+  {
+    case OpRecorder::OP_CREATE_DIR:
+    case OpRecorder::OP_REMOVE_DIR:
+    case OpRecorder::OP_LIST:
+    case OpRecorder::OP_FIND:
+      return true;
+    default:
+      return (record.flags & OpRecorder::FLAG_DIR) != 0;
+  }
+}
+
+static bool
+recordStartsBefore(const OpRecorder::Record &record,
+                   const OpRecorder::Record &otherRecord)
+{
+  return record.startUs < otherRecord.startUs;
+}
+
+static std::string
+hashName(char type, uint64_t hash)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%c%016llx", type, (unsigned long long) hash);
+
+  return name;
+}
+
+// Only the hashes of the paths are recorded, so each one gets a made up path
+// instead: the directories are all created in the replay's root directory
+// and the files in the directory that stands for their recorded parent. This
+// keeps the number of entries in each directory, which is what matters most
+// for listing and finding them.
+static std::string
+replayPath(const std::string &root, const OpRecorder::Record &record)
+{
+  if (isDirRecord(record))
+    return root + hashName('d', record.pathHash) + "/";
+
+  std::string parent = root;
+
+  if (record.parentHash != 0)
+    parent += hashName('d', record.parentHash) + "/";
+
+  return parent + hashName('f', record.pathHash);
+}
+
+// Creates the files and directories that existed when the trace was
+// recorded, i.e. those whose first operation was not creating them and
+// succeeded. The files are given the size that was read from them.
+static int
+createInitialEntries(radosfs::Filesystem &fs, const std::string &root,
+                     const std::vector<OpRecorder::Record> &records,
+                     size_t *numFiles, size_t *numDirs)
+{
+  std::map<std::string, bool> existed;
+  std::map<std::string, uint64_t> sizes;
+  std::set<std::string> dirs;
+
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    const OpRecorder::Record &record = records[i];
+    const std::string &path = replayPath(root, record);
+
+    if (existed.find(path) == existed.end())
+    {
+      existed[path] = record.ret >= 0 &&
+                      record.op != OpRecorder::OP_CREATE_FILE &&
+                      record.op != OpRecorder::OP_CREATE_DIR;
+    }
+
+    if (record.op == OpRecorder::OP_READ && record.ret > 0)
+      sizes[path] = std::max(sizes[path], record.offset + record.ret);
+  }
+
+  // The root directory is always needed, besides those that existed and the
+  // parents of the files that existed
+  dirs.insert(root);
+
+  std::map<std::string, bool>::const_iterator it;
+  for (it = existed.begin(); it != existed.end(); it++)
+  {
+    if (!(*it).second)
+      continue;
+
+    if (isDirPath((*it).first))
+      dirs.insert((*it).first);
+    else
+      dirs.insert(getParentDir((*it).first, 0));
+  }
+
+  std::set<std::string>::const_iterator dirIt;
+  for (dirIt = dirs.begin(); dirIt != dirs.end(); dirIt++)
+  {
+    radosfs::Dir dir(&fs, *dirIt);
+    int ret = dir.create(-1, true);
+
+    if (ret != 0 && ret != -EEXIST)
+    {
+      fprintf(stderr, "Error creating %s: %s\n", (*dirIt).c_str(),
+              strerror(-ret));
+      return ret;
+    }
+  }
+
+  *numDirs = dirs.size();
+  *numFiles = 0;
+
+  for (it = existed.begin(); it != existed.end(); it++)
+  {
+    if (!(*it).second || isDirPath((*it).first))
+      continue;
+
+    const std::string &path = (*it).first;
+    const uint64_t size = sizes[path];
+    radosfs::File file(&fs, path, radosfs::File::MODE_WRITE);
+    int ret = file.create(-1, "", 0, -1, size);
+
+    // Only the last byte is written so the file gets its size
+    if (ret == 0 && size > 0)
+      ret = file.writeSync("x", size - 1, 1);
+
+    if (ret != 0 && ret != -EEXIST)
+    {
+      fprintf(stderr, "Error creating %s: %s\n", path.c_str(),
+              strerror(-ret));
+      return ret;
+    }
+
+    (*numFiles)++;
+  }
+
+  return 0;
+}
+
+static int
+runOp(radosfs::Filesystem *fs, const ReplayOp &op, char *buffer)
+{
+  const OpRecorder::Record &record = op.record;
+
+  switch (record.op)
+  {
+    case OpRecorder::OP_STAT:
+    {
+      struct stat buff;
+      return fs->stat(op.path, &buff);
+    }
+    case OpRecorder::OP_READ:
+    {
+      radosfs::File file(fs, op.path, radosfs::File::MODE_READ);
+      ssize_t ret = file.read(buffer, record.offset, record.length);
+      return ret < 0 ? ret : 0;
+    }
+    case OpRecorder::OP_WRITE:
+    {
+      // The write is waited for, so its latency includes its completion
+      radosfs::File file(fs, op.path, radosfs::File::MODE_WRITE);
+      int ret = file.write(buffer, record.offset, record.length);
+
+      if (ret == 0)
+        ret = file.sync();
+
+      return ret;
+    }
+    case OpRecorder::OP_WRITE_SYNC:
+    {
+      radosfs::File file(fs, op.path, radosfs::File::MODE_WRITE);
+      return file.writeSync(buffer, record.offset, record.length);
+    }
+    case OpRecorder::OP_CREATE_FILE:
+    {
+      radosfs::File file(fs, op.path, radosfs::File::MODE_WRITE);
+      return file.create(-1, "", 0, -1, record.length);
+    }
+    case OpRecorder::OP_REMOVE_FILE:
+    {
+      radosfs::File file(fs, op.path, radosfs::File::MODE_WRITE);
+      return file.remove();
+    }
+    case OpRecorder::OP_TRUNCATE:
+    {
+      radosfs::File file(fs, op.path, radosfs::File::MODE_WRITE);
+      return file.truncate(record.offset);
+    }
+    case OpRecorder::OP_CREATE_DIR:
+    {
+      radosfs::Dir dir(fs, op.path);
+      return dir.create();
+    }
+    case OpRecorder::OP_REMOVE_DIR:
+    {
+      radosfs::Dir dir(fs, op.path);
+      return dir.remove();
+    }
+    case OpRecorder::OP_LIST:
+    {
+      std::set<std::string> entries;
+      radosfs::Dir dir(fs, op.path);
+      dir.refresh();
+      return dir.entryList(entries);
+    }
+    case OpRecorder::OP_FIND:
+    {
+      std::set<std::string> results;
+      radosfs::Dir dir(fs, op.path);
+      return dir.find("", results);
+    }
+    default:
+      return -EINVAL;
+  }
+}
+
+static uint64_t
+microsecondsSince(const struct timespec &start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start.tv_sec) * 1000000LL +
+         (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+static void
+runReplay(ReplayInfo *info)
+{
+  char *buffer = new char[std::max(info->bufferSize, (size_t) 1)];
+  memset(buffer, 'x', info->bufferSize);
+
+  memset(info->stats.errors, 0, sizeof(info->stats.errors));
+  memset(info->stats.diverged, 0, sizeof(info->stats.diverged));
+
+  info->startBarrier->wait();
+
+  for (size_t i = 0; i < info->ops.size(); i++)
+  {
+    const ReplayOp &op = info->ops[i];
+
+    // Keep the time between the operations, scaled by the speed
+    if (info->speed > 0)
+    {
+      const uint64_t dueUs = op.record.startUs / info->speed;
+      const uint64_t elapsedUs = microsecondsSince(*info->startTime);
+
+      if (dueUs > elapsedUs)
+        boost::this_thread::sleep_for(
+              boost::chrono::microseconds(dueUs - elapsedUs));
+    }
+
+    struct timespec opStart;
+    clock_gettime(CLOCK_MONOTONIC, &opStart);
+
+    const int ret = runOp(info->fs, op, buffer);
+
+    info->stats.latencies[op.record.op].record(microsecondsSince(opStart));
+
+    if (ret < 0)
+      info->stats.errors[op.record.op]++;
+
+    if ((ret < 0) != (op.record.ret < 0))
+      info->stats.diverged[op.record.op]++;
+  }
+
+  delete [] buffer;
+}
+
+static void
+writeJsonLatencies(std::ofstream &out, const LatencyHistogram &latencies,
+                   uint64_t errors, uint64_t diverged, const char *indent)
+{
+  out << "{\n"
+      << indent << "  \"count\": " << latencies.count() << ",\n"
+      << indent << "  \"errors\": " << errors << ",\n"
+      << indent << "  \"diverged\": " << diverged << ",\n"
+      << indent << "  \"min\": " << latencies.min() << ",\n"
+      << indent << "  \"mean\": " << latencies.mean() << ",\n"
+      << indent << "  \"p50\": " << latencies.percentile(50) << ",\n"
+      << indent << "  \"p90\": " << latencies.percentile(90) << ",\n"
+      << indent << "  \"p99\": " << latencies.percentile(99) << ",\n"
+      << indent << "  \"p999\": " << latencies.percentile(99.9) << ",\n"
+      << indent << "  \"max\": " << latencies.max() << "\n"
+      << indent << "}";
+}
+
+static void
+writeJsonResults(const ReplayConf &conf, const ReplayStats &stats,
+                 const LatencyHistogram &total, uint64_t totalErrors,
+                 uint64_t totalDiverged, double elapsedSeconds)
+{
+  std::ofstream out(conf.jsonPath.c_str());
+
+  if (!out)
+  {
+    fprintf(stderr, "Error: Cannot write the results to %s\n",
+            conf.jsonPath.c_str());
+    return;
+  }
+
+  out << "{\n"
+      << "  \"trace\": \"" << conf.tracePath << "\",\n"
+      << "  \"threads\": " << conf.numThreads << ",\n"
+      << "  \"speed\": " << conf.speed << ",\n"
+      << "  \"duration\": " << elapsedSeconds << ",\n"
+      << "  \"ops\": " << total.count() << ",\n"
+      << "  \"ops_per_sec\": " << total.count() / elapsedSeconds << ",\n"
+      << "  \"operations\": {";
+
+  bool first = true;
+
+  for (int i = 0; i < OpRecorder::OP_COUNT; i++)
+  {
+    if (stats.latencies[i].count() == 0)
+      continue;
+
+    out << (first ? "\n" : ",\n") << "    \""
+        << OpRecorder::opName((OpRecorder::Op) i) << "\": ";
+    writeJsonLatencies(out, stats.latencies[i], stats.errors[i],
+                       stats.diverged[i], "    ");
+    first = false;
+  }
+
+  out << "\n  },\n"
+      << "  \"latency_us\": ";
+  writeJsonLatencies(out, total, totalErrors, totalDiverged, "  ");
+  out << "\n}\n";
+}
+
+static void
+printLatencies(const char *name, const LatencyHistogram &latencies,
+               uint64_t errors, uint64_t diverged)
+{
+  fprintf(stdout, "\t%-12s %10llu %8llu %8llu %10llu %10llu %10llu %10llu\n",
+          name,
+          (unsigned long long) latencies.count(),
+          (unsigned long long) errors,
+          (unsigned long long) diverged,
+          (unsigned long long) latencies.percentile(50),
+          (unsigned long long) latencies.percentile(90),
+          (unsigned long long) latencies.percentile(99),
+          (unsigned long long) latencies.max());
+}
+
+int
+main(int argc, char **argv)
+{
+  ReplayConf conf;
+
+  int ret = parseArguments(argc, argv, conf);
+
+  if (ret != 0)
+  {
+    showUsage(argv[0]);
+    return ret;
+  }
+
+  std::vector<OpRecorder::Record> records;
+
+  ret = OpRecorder::readRecords(conf.tracePath, records);
+
+  if (ret != 0)
+  {
+    fprintf(stderr, "Error reading the trace %s: %s\n", conf.tracePath.c_str(),
+            strerror(-ret));
+    return ret;
+  }
+
+  // The records are written when the operations finish
+  std::stable_sort(records.begin(), records.end(), recordStartsBefore);
+
+  const int numThreads = conf.numThreads;
+  std::string mtdPool, dataPool;
+  bool createPools = false;
+
+  if (conf.pools.size() == 2)
+  {
+    mtdPool = conf.pools[0];
+    dataPool = conf.pools[1];
+  }
+  else
+  {
+    mtdPool = TEST_POOL_MTD;
+    dataPool = TEST_POOL_DATA;
+    createPools = true;
+  }
+
+  BenchmarkMgr benchmark(conf.confPath.c_str(), conf.user, mtdPool, dataPool,
+                         createPools, 0);
+  benchmark.setupPools();
+
+  const int hostnameLength = 32;
+  char hostname[hostnameLength];
+  gethostname(hostname, hostnameLength);
+
+  std::stringstream stream;
+  stream << "/" << hostname << "-" << getpid() << "-replay/";
+
+  const std::string root = stream.str();
+  size_t numFiles, numDirs;
+
+  fprintf(stdout, "\n*** RadosFs Trace Replay ***\n\n"
+          "Creating the entries of %s (%lu operations) in %s...\n",
+          conf.tracePath.c_str(), records.size(), root.c_str());
+
+  ret = createInitialEntries(benchmark.radosFs, root, records, &numFiles,
+                             &numDirs);
+
+  if (ret != 0)
+    return ret;
+
+  fprintf(stdout, "Created %lu files and %lu directories\n\n"
+          "Replaying the trace on cluster configured by %s with %d threads "
+          "at %s...\n", numFiles, numDirs, conf.confPath.c_str(), numThreads,
+          conf.speed > 0 ? "the recorded pace" : "full speed");
+
+  if (conf.speed > 0 && conf.speed != 1)
+    fprintf(stdout, "(scaled by %.2f)\n", conf.speed);
+
+  boost::thread *threads[numThreads];
+  ReplayInfo *infos[numThreads];
+  boost::barrier startBarrier(numThreads + 1);
+  struct timespec startTime, endTime;
+  int i;
+
+  for (i = 0; i < numThreads; i++)
+  {
+    ReplayInfo *info = new ReplayInfo;
+    info->fs = &benchmark.radosFs;
+    info->bufferSize = 0;
+    info->speed = conf.speed;
+    info->startBarrier = &startBarrier;
+    info->startTime = &startTime;
+
+    infos[i] = info;
+  }
+
+  // The operations of each recorded thread are all replayed by the same
+  // thread, to keep their order
+  std::map<uint32_t, size_t> recordedThreads;
+
+  for (size_t j = 0; j < records.size(); j++)
+  {
+    const OpRecorder::Record &record = records[j];
+
+    if (record.op >= OpRecorder::OP_COUNT)
+      continue;
+
+    if (recordedThreads.find(record.threadId) == recordedThreads.end())
+    {
+      const size_t index = recordedThreads.size();
+      recordedThreads[record.threadId] = index;
+    }
+
+    ReplayInfo *info = infos[recordedThreads[record.threadId] % numThreads];
+    ReplayOp op;
+
+    op.record = record;
+    op.path = replayPath(root, record);
+
+    if (record.op == OpRecorder::OP_READ || record.op == OpRecorder::OP_WRITE ||
+        record.op == OpRecorder::OP_WRITE_SYNC)
+    {
+      info->bufferSize = std::max(info->bufferSize, (size_t) record.length);
+    }
+
+    info->ops.push_back(op);
+  }
+
+  for (i = 0; i < numThreads; i++)
+    threads[i] = new boost::thread(&runReplay, infos[i]);
+
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  startBarrier.wait();
+
+  ReplayStats stats;
+  LatencyHistogram total;
+  uint64_t totalErrors = 0, totalDiverged = 0;
+
+  memset(stats.errors, 0, sizeof(stats.errors));
+  memset(stats.diverged, 0, sizeof(stats.diverged));
+
+  for (i = 0; i < numThreads; i++)
+  {
+    threads[i]->join();
+
+    for (int op = 0; op < OpRecorder::OP_COUNT; op++)
+    {
+      stats.latencies[op].merge(infos[i]->stats.latencies[op]);
+      stats.errors[op] += infos[i]->stats.errors[op];
+      stats.diverged[op] += infos[i]->stats.diverged[op];
+    }
+
+    delete threads[i];
+    delete infos[i];
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+  const double elapsedSeconds = (endTime.tv_sec - startTime.tv_sec) +
+                                (endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+
+  fprintf(stdout, "\nResult (%.2f seconds, %.2f ops/sec):\n\n",
+          elapsedSeconds, records.size() / elapsedSeconds);
+  fprintf(stdout, "\t%-12s %10s %8s %8s %10s %10s %10s %10s\n", "op",
+          "# ops", "errors", "diverged", "p50 (us)", "p90 (us)", "p99 (us)",
+          "max (us)");
+
+  for (int op = 0; op < OpRecorder::OP_COUNT; op++)
+  {
+    if (stats.latencies[op].count() == 0)
+      continue;
+
+    printLatencies(OpRecorder::opName((OpRecorder::Op) op),
+                   stats.latencies[op], stats.errors[op], stats.diverged[op]);
+
+    total.merge(stats.latencies[op]);
+    totalErrors += stats.errors[op];
+    totalDiverged += stats.diverged[op];
+  }
+
+  printLatencies("total", total, totalErrors, totalDiverged);
+
+  if (!conf.jsonPath.empty())
+    writeJsonResults(conf, stats, total, totalErrors, totalDiverged,
+                     elapsedSeconds);
+
+  return 0;
+}
@@ -114,7 +114,11 @@ class PyDir : public Dir, public PyFsObj
     py::tuple entryList()
     {
       std::set<std::string> entries;
-      int rc = Dir::entryList( entries );
+      int rc;
+      {
+        GILRelease release;
+        rc = Dir::entryList( entries );
+      }
 
       py::list l;
       for( std::set<std::string>::iterator it = entries.begin(); it != entries.end(); ++it )
@@ -145,7 +149,11 @@ class PyDir : public Dir, public PyFsObj
     py::tuple stat(void)
     {
       struct stat buff;
-      int rc = Dir::stat( &buff );
+      int rc;
+      {
+        GILRelease release;
+        rc = Dir::stat( &buff );
+      }
       return py::make_tuple( rc, PyStat( buff ) );
     }
 
@@ -124,6 +124,18 @@ class PyFile : public File, public PyFsObj
       return ReadWriteHelper::writeSync_impl<File>( arr, offset, *this );
     }
 
+    /////////////////////////////////////////////////////////////////////////////////////
+    //
+    // 'sync' method
+    //
+    /////////////////////////////////////////////////////////////////////////////////////
+
+    int sync(const std::string &opId)
+    {
+      GILRelease release;
+      return File::sync( opId );
+    }
+
     /////////////////////////////////////////////////////////////////////////////////////
     //
     // 'create' method
@@ -164,7 +176,11 @@ class PyFile : public File, public PyFsObj
     py::tuple stat(void)
     {
       struct stat buff;
-      int rc = File::stat( &buff );
+      int rc;
+      {
+        GILRelease release;
+        rc = File::stat( &buff );
+      }
       return py::make_tuple( rc, PyStat( buff ) );
     }
 
@@ -105,11 +105,14 @@ class PyFileInode : public FileInode
 
     int sync1(const py::str &opId )
     {
-      return FileInode::sync( py::extract<std::string>( opId ) );
+      const std::string id = py::extract<std::string>( opId );
+      GILRelease release;
+      return FileInode::sync( id );
     }
 
     int sync0()
     {
+      GILRelease release;
       return FileInode::sync( "" );
     }
 
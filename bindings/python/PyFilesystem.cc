@@ -74,6 +74,10 @@ void radosfs::PyFilesystem::export_bindings()
       .def( "setDirCacheMaxSize",     &PyFilesystem::setDirCacheMaxSize )
       // 'dirCacheMaxSize' mthod
       .def( "dirCacheMaxSize",        &PyFilesystem::dirCacheMaxSize )
+      // 'setDirCacheMaxBytes' method
+      .def( "setDirCacheMaxBytes",    &PyFilesystem::setDirCacheMaxBytes )
+      // 'dirCacheMaxBytes' method
+      .def( "dirCacheMaxBytes",       &PyFilesystem::dirCacheMaxBytes )
       // 'setDirCompactRatio' method
       .def( "setDirCompactRatio",     &PyFilesystem::setDirCompactRatio )
       // 'dirCompactRatio' method
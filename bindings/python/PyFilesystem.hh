@@ -12,10 +12,12 @@
 
 #include "PyStat.hh"
 #include "PyFsObj.hh"
+#include "PyHelpers.hh"
 
 #include <Python.h>
 
 #include <boost/python.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace py = boost::python;
 
@@ -24,16 +26,12 @@ RADOS_FS_BEGIN_NAMESPACE
 struct PyFileReadData : public FileReadData
 {
   PyFileReadData(py::object arr, off_t offset)
-    : FileReadData( 0, offset, 0, &retValue ), arr( arr ), retValue( 0 )
+    : FileReadData( 0, offset, 0, &retValue ), arr( arr ), retValue( 0 ),
+      view( new PyBufferView( arr, true ) )
   {
-    if( ! PyByteArray_Check( arr.ptr() ) )
-    {
-      PyErr_SetString(PyExc_TypeError, "A bytearray was expected !");
-      throw py::error_already_set();
-    }
-
-    buff = PyByteArray_AsString( arr.ptr() );
-    length = PyByteArray_Size( arr.ptr() );
+    // the buffer is kept exported (so it cannot be resized) while it is read into
+    buff = view->buffer();
+    length = view->length();
   }
 
   ssize_t getRetValue()
@@ -48,6 +46,7 @@ struct PyFileReadData : public FileReadData
 
   py::object arr;
   ssize_t retValue;
+  boost::shared_ptr<PyBufferView> view;
 };
 
 class PyFilesystem : public radosfs::Filesystem
@@ -113,14 +112,23 @@ class PyFilesystem : public radosfs::Filesystem
     {
       std::string path;
       struct stat buff;
-      int rc = Filesystem::stat(path, &buff);
+      int rc;
+      {
+        GILRelease release;
+        rc = Filesystem::stat(path, &buff);
+      }
       return py::make_tuple( rc, PyStat( buff ) );
     }
 
     py::list stat1( const py::list &paths )
     {
       // unpack the py::list and delegate work to real stat
-      std::vector<std::pair<int, struct stat> > v = stat( list_to_strvec( paths ) );
+      const std::vector<std::string> pathsVec = list_to_strvec( paths );
+      std::vector<std::pair<int, struct stat> > v;
+      {
+        GILRelease release;
+        v = stat( pathsVec );
+      }
       // pack the result into py::list
       py::list ret;
       for( std::vector<std::pair<int, struct stat> >::const_iterator it = v.begin(); it != v.end(); ++it )
@@ -11,6 +11,7 @@
 #include "FsObj.hh"
 
 #include "PyStat.hh"
+#include "PyHelpers.hh"
 
 #include <boost/python.hpp>
 
@@ -76,7 +77,11 @@ class PyFsObj : public virtual FsObj
     py::tuple stat(void)
     {
       struct stat buff;
-      int rc = FsObj::stat( &buff );
+      int rc;
+      {
+        GILRelease release;
+        rc = FsObj::stat( &buff );
+      }
       return py::make_tuple( rc, PyStat( buff ) );
     }
 
@@ -0,0 +1,84 @@
+/*
+ * PyHelpers.hh
+ */
+
+#ifndef BINDINGS_PYTHON_PYHELPERS_HH_
+#define BINDINGS_PYTHON_PYHELPERS_HH_
+
+#include "radosfsdefines.h"
+
+#include <Python.h>
+
+#include <boost/python.hpp>
+
+namespace py = boost::python;
+
+RADOS_FS_BEGIN_NAMESPACE
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Releases the GIL for the lifetime of the object so other Python threads can run
+// while a blocking call is in progress (no Python objects may be used meanwhile)
+//
+/////////////////////////////////////////////////////////////////////////////////////
+class GILRelease
+{
+  public :
+
+    GILRelease() : state( PyEval_SaveThread() ) {}
+
+    ~GILRelease()
+    {
+      PyEval_RestoreThread( state );
+    }
+
+  private :
+
+    PyThreadState *state;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// Gives access to the memory of any object supporting the buffer protocol
+// (bytearray, memoryview, numpy arrays, ...) without copying it
+//
+/////////////////////////////////////////////////////////////////////////////////////
+class PyBufferView
+{
+  public :
+
+    PyBufferView(py::object obj, bool writable)
+    {
+      const int flags = writable ? ( PyBUF_SIMPLE | PyBUF_WRITABLE ) : PyBUF_SIMPLE;
+
+      if( PyObject_GetBuffer( obj.ptr(), &view, flags ) != 0 )
+      {
+        PyErr_Clear();
+        PyErr_SetString( PyExc_TypeError, writable ?
+                         "A writable contiguous buffer (e.g. bytearray) was expected !" :
+                         "A contiguous buffer (e.g. bytearray) was expected !" );
+        throw py::error_already_set();
+      }
+    }
+
+    ~PyBufferView()
+    {
+      PyBuffer_Release( &view );
+    }
+
+    char* buffer() { return static_cast<char*>( view.buf ); }
+
+    size_t length() const { return view.len; }
+
+  private :
+
+    // the buffer is released once, so views cannot be copied
+    PyBufferView(const PyBufferView&);
+    PyBufferView& operator=(const PyBufferView&);
+
+    Py_buffer view;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* BINDINGS_PYTHON_PYHELPERS_HH_ */
@@ -25,6 +25,8 @@ class ReadWriteHelper
 
     static void async_op_callback(const std::string &opId, int retCode, void *pair)
     {
+      // the callback is called from the library's threads, which do not hold the GIL
+      PyGILState_STATE gilState = PyGILState_Ensure();
       // extract the python callback and real args from args
       std::pair<py::object, py::object>* p = (std::pair<py::object, py::object>*) pair;
       py::object callback = p->first;
@@ -32,22 +34,24 @@ class ReadWriteHelper
       // delete the wrapper
       delete p;
       // delegate the job to Python callback
-      callback( py::str( opId ), retCode, args );
+      try
+      {
+        callback( py::str( opId ), retCode, args );
+      }
+      catch( const py::error_already_set& )
+      {
+        PyErr_Print();
+      }
+      PyGILState_Release( gilState );
     }
 
     template<class READER>
     static ssize_t read_impl(py::object arr, off_t offset, READER &reader)
     {
-      if( ! PyByteArray_Check( arr.ptr() ) )
-      {
-        PyErr_SetString(PyExc_TypeError, "A bytearray was expected !");
-        throw py::error_already_set();
-      }
-
-      char *buff  = PyByteArray_AsString( arr.ptr() );
-      size_t blen = PyByteArray_Size( arr.ptr() );
+      PyBufferView view( arr, true );
 
-      return reader.read( buff, offset, blen );
+      GILRelease release;
+      return reader.read( view.buffer(), offset, view.length() );
     }
 
     template<class READER>
@@ -67,7 +71,11 @@ class ReadWriteHelper
       std::pair<py::object, py::object>* pair = ( callback ? new std::pair<py::object, py::object>( pyCallback, callbackArg ) : 0 );
       // delegate the work to c++ API
       std::string asyncOpId;
-      int rc = reader.read(intervals, &asyncOpId, callback, pair);
+      int rc;
+      {
+        GILRelease release;
+        rc = reader.read(intervals, &asyncOpId, callback, pair);
+      }
 
       return py::make_tuple( rc, py::str( asyncOpId ) );
     }
@@ -75,14 +83,9 @@ class ReadWriteHelper
     template<class WRITER>
     static py::tuple write_impl(py::object arr, off_t offset, bool copyBuffer, py::object pyCallback, py::object callbackArg, WRITER &writer)
     {
-      if( ! PyByteArray_Check( arr.ptr() ) )
-      {
-        PyErr_SetString(PyExc_TypeError, "A bytearray was expected !");
-        throw py::error_already_set();
-      }
-
-      char *buff = PyByteArray_AsString( arr.ptr() );
-      size_t blen = PyByteArray_Size( arr.ptr() );
+      // unless copyBuffer is set, the object has to be kept (unchanged) until the
+      // write is synced, as before
+      PyBufferView view( arr, false );
 
       // the callback
       AsyncOpCallback callback = ( pyCallback == py::object() ? 0 : ReadWriteHelper::async_op_callback );
@@ -91,7 +94,11 @@ class ReadWriteHelper
       std::pair<py::object, py::object>* pair = ( callback ? new std::pair<py::object, py::object>( pyCallback, callbackArg ) : 0 );
       // delegate the work to c++ API
       std::string asyncOpId;
-      int rc = writer.write( buff, offset, blen, copyBuffer, &asyncOpId, callback, pair);
+      int rc;
+      {
+        GILRelease release;
+        rc = writer.write( view.buffer(), offset, view.length(), copyBuffer, &asyncOpId, callback, pair);
+      }
 
       return py::make_tuple( rc, py::str( asyncOpId ) );
     }
@@ -99,16 +106,10 @@ class ReadWriteHelper
     template<class WRITER>
     static int writeSync_impl(py::object arr, off_t offset, WRITER &writer)
     {
-      if( ! PyByteArray_Check( arr.ptr() ) )
-      {
-        PyErr_SetString(PyExc_TypeError, "A bytearray was expected !");
-        throw py::error_already_set();
-      }
-
-      char *buff  = PyByteArray_AsString( arr.ptr() );
-      size_t blen = PyByteArray_Size( arr.ptr() );
+      PyBufferView view( arr, false );
 
-      return writer.writeSync( buff, offset, blen );
+      GILRelease release;
+      return writer.writeSync( view.buffer(), offset, view.length() );
     }
 };
 
@@ -16,3 +16,105 @@
 # for more details.
 
 from libradosfspy import *
+
+import collections
+import threading
+import weakref
+
+try:
+    import asyncio
+except ImportError:
+    asyncio = None
+
+
+class _CompletionQueue(object):
+    """Hands the results of the asynchronous operations, which finish in the
+    library's threads, to the futures of an event loop thread.
+
+    Completions are queued and the loop is only woken up when the queue was
+    empty, so all the operations that finish before the loop runs are
+    completed in the same loop iteration."""
+
+    def __init__(self, loop):
+        self._loop = loop
+        self._lock = threading.Lock()
+        self._completions = collections.deque()
+        self._scheduled = False
+
+    def push(self, future, result):
+        with self._lock:
+            self._completions.append((future, result))
+            if self._scheduled:
+                return
+            self._scheduled = True
+        self._loop.call_soon_threadsafe(self._complete)
+
+    def _complete(self):
+        with self._lock:
+            completions = self._completions
+            self._completions = collections.deque()
+            self._scheduled = False
+
+        for future, result in completions:
+            if not future.done():
+                future.set_result(result)
+
+
+_completionQueues = weakref.WeakKeyDictionary()
+_completionQueuesLock = threading.Lock()
+
+
+def _getCompletionQueue(loop):
+    with _completionQueuesLock:
+        queue = _completionQueues.get(loop)
+        if queue is None:
+            queue = _CompletionQueue(loop)
+            _completionQueues[loop] = queue
+        return queue
+
+
+def _onAsyncOpFinished(opId, retCode, args):
+    queue, future, keepAlive = args
+    queue.push(future, retCode)
+
+
+def _submit(submit, loop):
+    if asyncio is None:
+        raise RuntimeError('asyncio is not available')
+
+    loop = loop or asyncio.get_event_loop()
+    future = loop.create_future()
+    queue = _getCompletionQueue(loop)
+
+    ret, opId = submit(lambda keepAlive: (queue, future, keepAlive))
+
+    # If the operation could not even be started its callback is not called
+    if ret != 0 and not future.done():
+        future.set_result(ret)
+
+    return future
+
+
+def _aioRead(self, intervals, loop=None):
+    """Reads the given FileReadData intervals asynchronously and returns an
+    asyncio future with the operation's return code (the interval's own
+    return values are in their retValue)."""
+    intervals = list(intervals)
+    return _submit(lambda args: self.read(intervals, _onAsyncOpFinished,
+                                          args(intervals)), loop)
+
+
+def _aioWrite(self, buff, offset, copyBuffer=False, loop=None):
+    """Writes buff (any object supporting the buffer protocol) at offset
+    asynchronously and returns an asyncio future with the operation's return
+    code. Unless copyBuffer is True, buff is kept until the write finishes and
+    must not be changed meanwhile."""
+    return _submit(lambda args: self.write(buff, offset, copyBuffer,
+                                           _onAsyncOpFinished, args(buff)),
+                   loop)
+
+
+File.aioRead = _aioRead
+File.aioWrite = _aioWrite
+FileInode.aioRead = _aioRead
+FileInode.aioWrite = _aioWrite
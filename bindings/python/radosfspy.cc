@@ -37,6 +37,9 @@ struct strvec_to_list
 
 BOOST_PYTHON_MODULE(libradosfspy)
 {
+  // the GIL is released around blocking calls and taken by the async callbacks
+  PyEval_InitThreads();
+
   // register string vector to python converter
   py::to_python_converter<std::vector<std::string>, strvec_to_list>();
 
@@ -1,10 +1,15 @@
 from __future__ import print_function
 import argparse
 import errno
+try:
+    import asyncio
+except ImportError:
+    asyncio = None
 import radosfs
 import unittest
 import rados
 import sys
+import threading
 import uuid
 
 confPath = ''
@@ -91,6 +96,78 @@ class RadosFsTestBase(unittest.TestCase):
         self.assertEqual(dir.remove(), 0)
         self.assertFalse(dir.exists())
 
+    def test_fileBufferProtocol(self):
+        self.addPools()
+        file = radosfs.File(self.fs, '/my-file', radosfs.File.MODE_READ_WRITE)
+        self.assertEqual(file.create(), 0)
+
+        # Any object supporting the buffer protocol can be written and read into
+        contents = bytearray(b'x' * 1024)
+        self.assertEqual(file.writeSync(memoryview(contents), 0), 0)
+
+        buff = bytearray(2048)
+        self.assertEqual(file.read(memoryview(buff)[512:], 0), 1024)
+        self.assertEqual(buff[512:1536], contents)
+
+        # Read-only buffers cannot be read into
+        self.assertRaises(TypeError, file.read, b'read-only', 0)
+
+    def test_fileParallelReads(self):
+        self.addPools()
+        file = radosfs.File(self.fs, '/my-file', radosfs.File.MODE_READ_WRITE)
+        self.assertEqual(file.create(), 0)
+
+        contents = bytearray(b'y' * 4096)
+        self.assertEqual(file.writeSync(contents, 0), 0)
+
+        # The GIL is released while reading so the threads read in parallel
+        results = []
+
+        def read():
+            buff = bytearray(len(contents))
+            results.append((file.read(buff, 0), buff))
+
+        threads = [threading.Thread(target=read) for i in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        self.assertEqual(len(results), len(threads))
+        for ret, buff in results:
+            self.assertEqual(ret, len(contents))
+            self.assertEqual(buff, contents)
+
+    @unittest.skipIf(radosfs.asyncio is None, 'asyncio is not available')
+    def test_fileAio(self):
+        self.addPools()
+        file = radosfs.File(self.fs, '/my-file', radosfs.File.MODE_READ_WRITE)
+        self.assertEqual(file.create(), 0)
+
+        numChunks = 64
+        chunkSize = 1024
+
+        loop = asyncio.new_event_loop()
+        try:
+            # Many operations are in flight at the same time in a single thread
+            writes = [file.aioWrite(bytearray([i]) * chunkSize, i * chunkSize,
+                                    loop=loop)
+                      for i in range(numChunks)]
+            self.assertEqual(loop.run_until_complete(asyncio.gather(*writes)),
+                             [0] * numChunks)
+
+            intervals = [radosfs.FileReadData(bytearray(chunkSize),
+                                              i * chunkSize)
+                         for i in range(numChunks)]
+            read = file.aioRead(intervals, loop=loop)
+            self.assertEqual(loop.run_until_complete(read), 0)
+        finally:
+            loop.close()
+
+        for i, interval in enumerate(intervals):
+            self.assertEqual(interval.retValue, chunkSize)
+            self.assertEqual(interval.buff, bytearray([i]) * chunkSize)
+
 def setupArguments():
     parser = argparse.ArgumentParser()
     # change the name of the 'optional arguments' label, although this should
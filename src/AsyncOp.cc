@@ -29,15 +29,30 @@ AyncOpPriv::AyncOpPriv(const std::string &id)
   : id(id),
     complete(false),
     returnCode(-EINPROGRESS),
+    preparationError(0),
     ready(-1),
     callback(0),
-    callbackArg(0)
+    callbackArg(0),
+    bufferCallback(0),
+    buffer(0),
+    bufferCallbackArg(0),
+    bufferReleased(false),
+    progressDone(0),
+    progressTotal(0),
+    pendingCompletions(0),
+    tracer(0),
+    createdTime(Tracer::Clock::now())
 {}
 
 AyncOpPriv::~AyncOpPriv()
 {
   boost::unique_lock<boost::mutex> lock(opMutex);
 
+  // The completions' callbacks use this instance so we cannot go away before
+  // they have been called
+  while (pendingCompletions > 0)
+    opCond.wait(lock);
+
   CompletionList::iterator it = operations.begin();
   while(it != operations.end())
   {
@@ -46,77 +61,171 @@ AyncOpPriv::~AyncOpPriv()
   }
 }
 
+void
+AyncOpPriv::onCompletionSafe(librados::completion_t comp, void *arg)
+{
+  AyncOpPriv *opPriv = reinterpret_cast<AyncOpPriv *>(arg);
+  boost::unique_lock<boost::mutex> lock(opPriv->opMutex);
+
+  if (opPriv->tracer)
+  {
+    std::map<librados::completion_t, Tracer::Clock::time_point>::iterator it;
+    it = opPriv->completionStarts.find(comp);
+
+    if (it != opPriv->completionStarts.end())
+    {
+      opPriv->tracer->addSpan("aio", "rados", opPriv->id, (*it).second,
+                              Tracer::Clock::now());
+      opPriv->completionStarts.erase(it);
+    }
+  }
+
+  opPriv->pendingCompletions--;
+  opPriv->notifyIfDone();
+}
+
+bool
+AyncOpPriv::doneLocked(void) const
+{
+  // Important: this method needs to be run in a scope where opMutex is locked
+  return returnCode != -EINPROGRESS || (ready == 0 && pendingCompletions == 0);
+}
+
+void
+AyncOpPriv::notifyIfDone(void)
+{
+  // Important: this method needs to be run in a scope where opMutex is locked
+  if (!doneLocked())
+    return;
+
+  opCond.notify_all();
+
+  std::set<AsyncOpWaiter *>::iterator it;
+  for (it = waiters.begin(); it != waiters.end(); it++)
+  {
+    AsyncOpWaiter *waiter = *it;
+    boost::unique_lock<boost::mutex> waiterLock(waiter->mutex);
+
+    waiter->signaled = true;
+    waiter->cond.notify_all();
+  }
+}
+
+bool
+AyncOpPriv::isDone(void)
+{
+  boost::unique_lock<boost::mutex> lock(opMutex);
+  return doneLocked();
+}
+
+void
+AyncOpPriv::addWaiter(AsyncOpWaiter *waiter)
+{
+  boost::unique_lock<boost::mutex> lock(opMutex);
+  waiters.insert(waiter);
+  notifyIfDone();
+}
+
+void
+AyncOpPriv::removeWaiter(AsyncOpWaiter *waiter)
+{
+  boost::unique_lock<boost::mutex> lock(opMutex);
+  waiters.erase(waiter);
+}
+
 int
 AyncOpPriv::waitForCompletion(void)
 {
-  while (returnCode == -EINPROGRESS)
+  bool firstToComplete;
+
   {
     boost::unique_lock<boost::mutex> lock(opMutex);
 
-    if (ready != 0)
-      continue;
-
     radosfs_debug("Async op with id='%s' will now wait for completion...",
                   id.c_str());
 
-    if (operations.size() == 0)
-    {
-      radosfs_debug("Async op with id='%s' had no operations to complete. "
-                    "Setting as complete.", id.c_str());
-      returnCode = 0;
-    }
+    // The completions' callbacks (and the FileIO once it has scheduled all
+    // the operations) wake us up, so there is no need to poll
+    while (!doneLocked())
+      opCond.wait(lock);
 
-    CompletionList::iterator it = operations.begin();
-    while(it != operations.end())
+    if (returnCode == -EINPROGRESS)
     {
-      librados::AioCompletion *completion = *it;
-      completion->wait_for_safe();
+      if (operations.size() == 0)
+      {
+        radosfs_debug("Async op with id='%s' had no operations to complete. "
+                      "Setting as complete.", id.c_str());
+        returnCode = 0;
+      }
 
-      if (returnCode == -EINPROGRESS || returnCode == 0)
+      CompletionList::iterator it = operations.begin();
+      while(it != operations.end())
       {
-        // It needs the overridden return codes for the operations because they
-        // always return the very result of running the operations on their
-        // respective chunks it might not be the correct value to return to the
-        // user. E.g. when reading from an inode that has no extra chunks but is
-        // truncated to a size that would cover having those chunks, then the
-        // code to return cannot be -ENOENT (because we're returning null data
-        // to the user that would be supposedly stored in the chunks).
-
-        if (!overriddenReturnCode(completion, &returnCode))
-          returnCode = completion->get_return_value();
+        librados::AioCompletion *completion = *it;
+
+        if (returnCode == -EINPROGRESS || returnCode == 0)
+        {
+          // It needs the overridden return codes for the operations because
+          // they always return the very result of running the operations on
+          // their respective chunks it might not be the correct value to
+          // return to the user. E.g. when reading from an inode that has no
+          // extra chunks but is truncated to a size that would cover having
+          // those chunks, then the code to return cannot be -ENOENT (because
+          // we're returning null data to the user that would be supposedly
+          // stored in the chunks).
+
+          if (!overriddenReturnCode(completion, &returnCode))
+            returnCode = completion->get_return_value();
+        }
+
+        completion->release();
+        it = operations.erase(it);
       }
 
-      completion->release();
-      it = operations.erase(it);
+      if (returnCode == 0)
+        returnCode = preparationError;
     }
+
     radosfs_debug("Async op with id='%s' finished waiting for completion. "
                   "retcode=%d (%s)",
                   id.c_str(), returnCode, strerror(abs(returnCode)));
-  }
 
-  {
-    boost::unique_lock<boost::mutex> lock(opMutex);
+    firstToComplete = !complete;
     complete = true;
   }
 
-  if (callback)
+  // Once the operations are finished, the buffer is no longer used
+  releaseBuffer();
+
+  // The callback is called only once even if several threads wait for the op
+  if (callback && firstToComplete)
   {
+    TraceSpan span(tracer, "callback", "op", id);
     callback(id, returnCode, callbackArg);
   }
 
   return returnCode;
 }
 
-void
-AyncOpPriv::addCompletion(librados::AioCompletion *comp)
+librados::AioCompletion *
+AyncOpPriv::createCompletion(void)
 {
+  librados::AioCompletion *comp =
+      librados::Rados::aio_create_completion(this, 0, onCompletionSafe);
+
   boost::unique_lock<boost::mutex> lock(opMutex);
   operations.push_back(comp);
+  pendingCompletions++;
+
+  if (tracer)
+    completionStarts[comp->pc] = Tracer::Clock::now();
 
   if (ready < 0)
     ready = 1;
   else
     ready++;
+
+  return comp;
 }
 
 void
@@ -124,6 +233,7 @@ AyncOpPriv::setReady()
 {
   boost::unique_lock<boost::mutex> lock(opMutex);
   ready = 0;
+  notifyIfDone();
 }
 
 void
@@ -132,6 +242,60 @@ AyncOpPriv::setPartialReady()
   boost::unique_lock<boost::mutex> lock(opMutex);
   if (ready > 0)
     ready--;
+  notifyIfDone();
+}
+
+void
+AyncOpPriv::setFinished(int ret)
+{
+  // Used for operations whose work was done on their behalf by another
+  // operation (e.g. writes that were kept in the write-behind buffer)
+  boost::unique_lock<boost::mutex> lock(opMutex);
+  returnCode = ret;
+  ready = 0;
+  notifyIfDone();
+}
+
+void
+AyncOpPriv::setPreparationError(int ret)
+{
+  // Used when some of the operations could not even be submitted (e.g. the
+  // contents of a chunk to rewrite could not be read): the op still waits for
+  // the ones that were, but fails with this code if they succeed
+  boost::unique_lock<boost::mutex> lock(opMutex);
+
+  if (preparationError == 0)
+    preparationError = ret;
+}
+
+void
+AyncOpPriv::setTracer(Tracer *opTracer)
+{
+  // Ops started while tracing another one are part of it, otherwise they are
+  // traced according to the sample rate
+  TraceSpan *span = TraceSpan::current();
+
+  if (span && span->tracer() == opTracer)
+    tracer = opTracer;
+  else if (opTracer && opTracer->shouldTrace())
+    tracer = opTracer;
+}
+
+void
+AyncOpPriv::releaseBuffer(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(opMutex);
+
+    if (bufferReleased || !bufferCallback)
+      return;
+
+    bufferReleased = true;
+  }
+
+  radosfs_debug("Async op with id='%s' released its buffer.", id.c_str());
+
+  bufferCallback(id, buffer, bufferCallbackArg);
 }
 
 void
@@ -155,6 +319,14 @@ AyncOpPriv::overriddenReturnCode(librados::AioCompletion *comp, int *ret)
   return false;
 }
 
+void
+AyncOpPriv::setProgress(u_int64_t done, u_int64_t total)
+{
+  boost::unique_lock<boost::mutex> lock(opMutex);
+  progressDone = done;
+  progressTotal = total;
+}
+
 AsyncOp::AsyncOp(const std::string &id)
   : mPriv(new AyncOpPriv(id))
 {}
@@ -194,4 +366,25 @@ AsyncOp::setCallback(AsyncOpCallback callback, void *arg)
   mPriv->callbackArg = arg;
 }
 
+void
+AsyncOp::setBufferCallback(AsyncOpBufferCallback callback, const char *buff,
+                           void *arg)
+{
+  mPriv->bufferCallback = callback;
+  mPriv->buffer = buff;
+  mPriv->bufferCallbackArg = arg;
+}
+
+void
+AsyncOp::progress(u_int64_t *done, u_int64_t *total)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->opMutex);
+
+  if (done)
+    *done = mPriv->progressDone;
+
+  if (total)
+    *total = mPriv->progressTotal;
+}
+
 RADOS_FS_END_NAMESPACE
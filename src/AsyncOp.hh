@@ -33,7 +33,10 @@
 RADOS_FS_BEGIN_NAMESPACE
 
 class AyncOpPriv;
+class DirTreeRemoval;
 class FileIO;
+class FilesystemPriv;
+struct OpsManager;
 
 class AsyncOp
 {
@@ -46,11 +49,17 @@ public:
   int returnValue(void);
   int waitForCompletion(void);
   void setCallback(AsyncOpCallback callback, void *arg);
+  void setBufferCallback(AsyncOpBufferCallback callback, const char *buff,
+                         void *arg);
+  void progress(u_int64_t *done, u_int64_t *total);
 
 private:
   boost::scoped_ptr<AyncOpPriv> mPriv;
 
+  friend class DirTreeRemoval;
   friend class FileIO;
+  friend class FilesystemPriv;
+  friend struct OpsManager;
 };
 
 RADOS_FS_END_NAMESPACE
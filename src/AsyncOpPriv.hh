@@ -20,11 +20,15 @@
 #ifndef __RADOS_FS_ASYNC_OP_PRIV_HH__
 #define __RADOS_FS_ASYNC_OP_PRIV_HH__
 
+#include <boost/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <rados/librados.hpp>
+#include <set>
 
 #include "Filesystem.hh"
 #include "radosfsdefines.h"
+#include "Tracer.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -33,6 +37,17 @@ typedef std::map<librados::completion_t, int> CompletionRetCodesMap;
 
 class AsyncOp;
 
+// Used for waiting on several ops at once: the ops it is added to signal it
+// when they are done
+struct AsyncOpWaiter
+{
+  AsyncOpWaiter(void) : signaled(false) {}
+
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  bool signaled;
+};
+
 class AyncOpPriv
 {
 public:
@@ -40,21 +55,47 @@ public:
   ~AyncOpPriv(void);
 
   int waitForCompletion(void);
-  void addCompletion(librados::AioCompletion *comp);
+  librados::AioCompletion *createCompletion(void);
+  bool isDone(void);
+  void addWaiter(AsyncOpWaiter *waiter);
+  void removeWaiter(AsyncOpWaiter *waiter);
   void setReady(void);
   void setPartialReady(void);
+  void setFinished(int ret);
+  void setPreparationError(int ret);
+  void releaseBuffer(void);
+  void setProgress(u_int64_t done, u_int64_t total);
   void setOverriddenReturnCode(librados::completion_t comp, int ret);
   bool overriddenReturnCode(librados::AioCompletion *comp, int *ret);
+  bool doneLocked(void) const;
+  void notifyIfDone(void);
+  void setTracer(Tracer *opTracer);
+
+  static void onCompletionSafe(librados::completion_t comp, void *arg);
 
   std::string id;
   bool complete;
   int returnCode;
+  int preparationError;
   int ready;
   AsyncOpCallback callback;
   void *callbackArg;
+  AsyncOpBufferCallback bufferCallback;
+  const char *buffer;
+  void *bufferCallbackArg;
+  bool bufferReleased;
+  u_int64_t progressDone;
+  u_int64_t progressTotal;
+  size_t pendingCompletions;
   boost::mutex opMutex;
+  boost::condition_variable opCond;
+  std::set<AsyncOpWaiter *> waiters;
   CompletionList operations;
   CompletionRetCodesMap opsReturnCodes;
+  // Only set if the op was chosen to be traced
+  Tracer *tracer;
+  Tracer::Clock::time_point createdTime;
+  std::map<librados::completion_t, Tracer::Clock::time_point> completionStarts;
 };
 
 RADOS_FS_END_NAMESPACE
@@ -0,0 +1,181 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <boost/functional/hash.hpp>
+
+#include "ChunkCache.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+ChunkCache::ChunkCache(size_t maxSize, double ttl)
+  : mSize(0),
+    mMaxSize(maxSize),
+    mTtl(ttl)
+{
+  for (size_t i = 0; i < FILE_CHUNK_CACHE_GENERATION_SLOTS; i++)
+    mGenerations[i] = 0;
+}
+
+ChunkCache::~ChunkCache()
+{}
+
+ChunkContentsSP
+ChunkCache::get(const std::string &inode, size_t chunk)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  ChunkContentsSP contents;
+
+  std::map<ChunkKey, ChunkEntry>::iterator it;
+  it = mEntries.find(ChunkKey(inode, chunk));
+
+  if (it == mEntries.end())
+    return contents;
+
+  ChunkEntry &entry = (*it).second;
+  boost::chrono::duration<double> seconds;
+  seconds = boost::chrono::system_clock::now() - entry.cachedTime;
+
+  // Other clients may have changed the chunk, so old entries are discarded
+  if (seconds.count() > mTtl)
+  {
+    removeEntry(it);
+    return contents;
+  }
+
+  // Mark the chunk as the most recently used one
+  mLru.splice(mLru.begin(), mLru, entry.lruIt);
+
+  return entry.contents;
+}
+
+void
+ChunkCache::put(const std::string &inode, size_t chunk,
+                const std::string &contents, u_int64_t generation)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  // The chunk was read before an invalidation so it may be outdated
+  if (generation != inodeGeneration(inode) || contents.length() > mMaxSize)
+    return;
+
+  const ChunkKey key(inode, chunk);
+  std::map<ChunkKey, ChunkEntry>::iterator it = mEntries.find(key);
+
+  if (it != mEntries.end())
+    removeEntry(it);
+
+  evict(contents.length());
+
+  mLru.push_front(key);
+
+  ChunkEntry &entry = mEntries[key];
+  entry.contents.reset(new std::string(contents));
+  entry.cachedTime = boost::chrono::system_clock::now();
+  entry.lruIt = mLru.begin();
+
+  mSize += contents.length();
+}
+
+void
+ChunkCache::invalidate(const std::string &inode)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  inodeGeneration(inode)++;
+
+  std::map<ChunkKey, ChunkEntry>::iterator it;
+  it = mEntries.lower_bound(ChunkKey(inode, 0));
+
+  while (it != mEntries.end() && (*it).first.first == inode)
+  {
+    std::map<ChunkKey, ChunkEntry>::iterator oldIt = it;
+    it++;
+    removeEntry(oldIt);
+  }
+}
+
+u_int64_t
+ChunkCache::generation(const std::string &inode)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return inodeGeneration(inode);
+}
+
+u_int64_t &
+ChunkCache::inodeGeneration(const std::string &inode)
+{
+  // Inodes sharing a slot only make each other's fills be dropped more often
+  boost::hash<std::string> hash;
+  return mGenerations[hash(inode) % FILE_CHUNK_CACHE_GENERATION_SLOTS];
+}
+
+void
+ChunkCache::setMaxSize(size_t maxSize)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mMaxSize = maxSize;
+  evict(0);
+}
+
+size_t
+ChunkCache::maxSize(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mMaxSize;
+}
+
+void
+ChunkCache::setTtl(double ttl)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mTtl = ttl;
+}
+
+double
+ChunkCache::ttl(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mTtl;
+}
+
+size_t
+ChunkCache::size(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mSize;
+}
+
+void
+ChunkCache::evict(size_t neededSize)
+{
+  // Important: this method needs to be run in a scope where mMutex is locked
+  while (!mLru.empty() && mSize + neededSize > mMaxSize)
+    removeEntry(mEntries.find(mLru.back()));
+}
+
+void
+ChunkCache::removeEntry(std::map<ChunkKey, ChunkEntry>::iterator it)
+{
+  // Important: this method needs to be run in a scope where mMutex is locked
+  mSize -= (*it).second.contents->length();
+  mLru.erase((*it).second.lruIt);
+  mEntries.erase(it);
+}
+
+RADOS_FS_END_NAMESPACE
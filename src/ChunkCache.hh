@@ -0,0 +1,83 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __CHUNK_CACHE_HH__
+#define __CHUNK_CACHE_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+typedef boost::shared_ptr<const std::string> ChunkContentsSP;
+
+class ChunkCache
+{
+public:
+  ChunkCache(size_t maxSize, double ttl);
+  virtual ~ChunkCache(void);
+
+  ChunkContentsSP get(const std::string &inode, size_t chunk);
+  void put(const std::string &inode, size_t chunk, const std::string &contents,
+           u_int64_t generation);
+  void invalidate(const std::string &inode);
+  u_int64_t generation(const std::string &inode);
+  void setMaxSize(size_t maxSize);
+  size_t maxSize(void);
+  void setTtl(double ttl);
+  double ttl(void);
+  size_t size(void);
+
+private:
+  typedef std::pair<std::string, size_t> ChunkKey;
+
+  struct ChunkEntry
+  {
+    ChunkContentsSP contents;
+    boost::chrono::system_clock::time_point cachedTime;
+    std::list<ChunkKey>::iterator lruIt;
+  };
+
+  void evict(size_t neededSize);
+  void removeEntry(std::map<ChunkKey, ChunkEntry>::iterator it);
+  u_int64_t &inodeGeneration(const std::string &inode);
+
+  std::map<ChunkKey, ChunkEntry> mEntries;
+  std::list<ChunkKey> mLru;
+  size_t mSize;
+  size_t mMaxSize;
+  double mTtl;
+  // Inodes are hashed into a fixed set of generations so invalidating one
+  // inode does not drop the in-flight fills of all the others, without
+  // having to keep a generation per inode ever seen
+  u_int64_t mGenerations[FILE_CHUNK_CACHE_GENERATION_SLOTS];
+  boost::mutex mMutex;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __CHUNK_CACHE_HH__ */
@@ -0,0 +1,240 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <zlib.h>
+
+#include "ChunkCompression.hh"
+#include "radosfsdefines.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+ChunkCompression::ChunkCompression(void)
+  : mCompressed(false),
+    mRawSize(0),
+    mBlockSize(0)
+{}
+
+static void
+makeRawChunk(const std::string &contents, std::string *data,
+             std::string *info)
+{
+  std::stringstream stream;
+  stream << FILE_COMPRESSION_CODEC_NONE << " " << contents.length();
+
+  data->assign(contents);
+  info->assign(stream.str());
+}
+
+// Compresses the given chunk contents into data. If the contents do not
+// compress well enough, they are kept as they are (so reading them does not
+// cost anything more than before).
+void
+ChunkCompression::compress(const std::string &contents, std::string *data,
+                           std::string *info)
+{
+  const size_t maxLength = contents.length() * FILE_COMPRESSION_MAX_RATIO;
+  std::stringstream sizes;
+  std::string block;
+
+  data->clear();
+
+  if (contents.empty())
+  {
+    makeRawChunk(contents, data, info);
+    return;
+  }
+
+  for (size_t offset = 0; offset < contents.length();
+       offset += FILE_COMPRESSION_BLOCK_SIZE)
+  {
+    const uLong length = std::min((size_t) FILE_COMPRESSION_BLOCK_SIZE,
+                                  contents.length() - offset);
+    uLongf blockLength = compressBound(length);
+
+    block.resize(blockLength);
+
+    int ret = compress2((Bytef *) &block[0], &blockLength,
+                        (const Bytef *) contents.data() + offset, length,
+                        Z_BEST_SPEED);
+
+    if (ret != Z_OK || data->length() + blockLength > maxLength)
+    {
+      makeRawChunk(contents, data, info);
+      return;
+    }
+
+    data->append(block, 0, blockLength);
+
+    if (offset > 0)
+      sizes << ",";
+
+    sizes << blockLength;
+  }
+
+  std::stringstream stream;
+  stream << FILE_COMPRESSION_CODEC_ZLIB << " " << contents.length() << " "
+         << FILE_COMPRESSION_BLOCK_SIZE << " " << sizes.str();
+
+  info->assign(stream.str());
+}
+
+int
+ChunkCompression::parse(const std::string &info)
+{
+  std::istringstream stream(info);
+  std::string codec;
+
+  mCompressed = false;
+  mRawSize = 0;
+  mBlockSize = 0;
+  mBlockOffsets.clear();
+
+  if (!(stream >> codec >> mRawSize))
+    return -EINVAL;
+
+  if (codec == FILE_COMPRESSION_CODEC_NONE)
+    return 0;
+
+  if (codec != FILE_COMPRESSION_CODEC_ZLIB)
+    return -ENOTSUP;
+
+  std::string sizes;
+
+  if (!(stream >> mBlockSize >> sizes) || mBlockSize == 0)
+    return -EINVAL;
+
+  const size_t numBlocks = (mRawSize + mBlockSize - 1) / mBlockSize;
+  std::istringstream sizesStream(sizes);
+  size_t offset = 0;
+  size_t blockLength;
+  char sep;
+
+  mBlockOffsets.reserve(numBlocks + 1);
+  mBlockOffsets.push_back(0);
+
+  while (sizesStream >> blockLength)
+  {
+    offset += blockLength;
+    mBlockOffsets.push_back(offset);
+
+    if (!(sizesStream >> sep))
+      break;
+  }
+
+  if (mBlockOffsets.size() != numBlocks + 1)
+  {
+    mBlockOffsets.clear();
+    return -EINVAL;
+  }
+
+  mCompressed = true;
+
+  return 0;
+}
+
+void
+ChunkCompression::setUncompressed(size_t rawSize)
+{
+  mCompressed = false;
+  mRawSize = rawSize;
+  mBlockSize = 0;
+  mBlockOffsets.clear();
+}
+
+// Copies the given range of the chunk's (raw) contents to buff, decompressing
+// only the blocks that hold it. Returns the number of bytes copied, which is
+// less than length if the chunk ends before.
+ssize_t
+ChunkCompression::read(const char *data, size_t dataLength, off_t offset,
+                       size_t length, char *buff) const
+{
+  if ((size_t) offset >= mRawSize)
+    return 0;
+
+  length = std::min(length, mRawSize - offset);
+
+  if (!mCompressed)
+  {
+    if ((size_t) offset >= dataLength)
+      return 0;
+
+    length = std::min(length, dataLength - offset);
+    memcpy(buff, data + offset, length);
+
+    return length;
+  }
+
+  const size_t firstBlock = offset / mBlockSize;
+  const size_t lastBlock = (offset + length - 1) / mBlockSize;
+  std::string block;
+  size_t copied = 0;
+
+  for (size_t i = firstBlock; i <= lastBlock; i++)
+  {
+    const size_t blockStart = i * mBlockSize;
+    uLongf blockLength = std::min(mBlockSize, mRawSize - blockStart);
+
+    if (mBlockOffsets[i + 1] > dataLength)
+      return -EIO;
+
+    block.resize(blockLength);
+
+    int ret = uncompress((Bytef *) &block[0], &blockLength,
+                         (const Bytef *) data + mBlockOffsets[i],
+                         mBlockOffsets[i + 1] - mBlockOffsets[i]);
+
+    if (ret != Z_OK || blockLength != block.length())
+      return -EIO;
+
+    const size_t start = std::max((size_t) offset, blockStart) - blockStart;
+    const size_t end = std::min(offset + length, blockStart + blockLength) -
+                       blockStart;
+
+    memcpy(buff + copied, block.data() + start, end - start);
+    copied += end - start;
+  }
+
+  return copied;
+}
+
+int
+ChunkCompression::decompress(const char *data, size_t dataLength,
+                             std::string *contents) const
+{
+  contents->resize(mRawSize);
+
+  if (mRawSize == 0)
+    return 0;
+
+  ssize_t ret = read(data, dataLength, 0, mRawSize, &(*contents)[0]);
+
+  if (ret < 0)
+    return ret;
+
+  contents->resize(ret);
+
+  return 0;
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,69 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __CHUNK_COMPRESSION_HH__
+#define __CHUNK_COMPRESSION_HH__
+
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Describes how a chunk's contents are stored. Compressed chunks are split in
+// blocks that are compressed independently, so reading a part of the chunk
+// only needs to decompress the blocks that hold it. The description is kept
+// in the chunk's XATTR_CHUNK_COMPRESSION xattr as
+// "<codec> <raw size> [<block size> <compressed block sizes>]".
+class ChunkCompression
+{
+public:
+  ChunkCompression(void);
+
+  static void compress(const std::string &contents, std::string *data,
+                       std::string *info);
+
+  int parse(const std::string &info);
+
+  void setUncompressed(size_t rawSize);
+
+  bool compressed(void) const { return mCompressed; }
+
+  size_t rawSize(void) const { return mRawSize; }
+
+  ssize_t read(const char *data, size_t dataLength, off_t offset,
+               size_t length, char *buff) const;
+
+  int decompress(const char *data, size_t dataLength,
+                 std::string *contents) const;
+
+private:
+  bool mCompressed;
+  size_t mRawSize;
+  size_t mBlockSize;
+  // Where each compressed block starts in the stored data (plus the end)
+  std::vector<size_t> mBlockOffsets;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __CHUNK_COMPRESSION_HH__ */
@@ -0,0 +1,135 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include "DeadlineQueue.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+DeadlineQueue::DeadlineQueue(void)
+{}
+
+DeadlineQueue::~DeadlineQueue(void)
+{}
+
+void
+DeadlineQueue::schedule(const std::string &key,
+                        const Clock::time_point &deadline)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  std::map<std::string, DeadlineMap::iterator>::iterator it = mKeys.find(key);
+
+  if (it != mKeys.end())
+  {
+    if (it->second->first <= deadline)
+      return;
+
+    mDeadlines.erase(it->second);
+  }
+
+  DeadlineMap::iterator deadlineIt = mDeadlines.insert(
+                                       std::make_pair(deadline, key));
+  mKeys[key] = deadlineIt;
+
+  // Only wake up the consumer if it has to wait for less than before
+  if (deadlineIt == mDeadlines.begin())
+    mCond.notify_all();
+}
+
+void
+DeadlineQueue::scheduleIn(const std::string &key, double seconds)
+{
+  Clock::duration delay = boost::chrono::duration_cast<Clock::duration>(
+                            boost::chrono::duration<double>(seconds));
+
+  schedule(key, Clock::now() + delay);
+}
+
+void
+DeadlineQueue::remove(const std::string &key)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  std::map<std::string, DeadlineMap::iterator>::iterator it = mKeys.find(key);
+
+  if (it == mKeys.end())
+    return;
+
+  mDeadlines.erase(it->second);
+  mKeys.erase(it);
+}
+
+size_t
+DeadlineQueue::popDue(const Clock::time_point &now,
+                      std::vector<std::string> &keys)
+{
+  // Important: this method needs to be run in a scope where mMutex is locked
+  size_t numDue = 0;
+
+  while (!mDeadlines.empty() && mDeadlines.begin()->first <= now)
+  {
+    DeadlineMap::iterator it = mDeadlines.begin();
+    keys.push_back(it->second);
+    mKeys.erase(it->second);
+    mDeadlines.erase(it);
+    numDue++;
+  }
+
+  return numDue;
+}
+
+size_t
+DeadlineQueue::waitForDue(std::vector<std::string> &keys,
+                          const Clock::duration &maxWait)
+{
+  const Clock::time_point waitLimit = Clock::now() + maxWait;
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  while (true)
+  {
+    Clock::time_point now = Clock::now();
+    size_t numDue = popDue(now, keys);
+
+    if (numDue > 0 || now >= waitLimit)
+      return numDue;
+
+    Clock::time_point wakeUp = waitLimit;
+
+    if (!mDeadlines.empty() && mDeadlines.begin()->first < wakeUp)
+      wakeUp = mDeadlines.begin()->first;
+
+    mCond.wait_until(lock, wakeUp);
+  }
+}
+
+size_t
+DeadlineQueue::size(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mKeys.size();
+}
+
+void
+DeadlineQueue::clear(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mDeadlines.clear();
+  mKeys.clear();
+}
+
+RADOS_FS_END_NAMESPACE
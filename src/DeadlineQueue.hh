@@ -0,0 +1,66 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __DEADLINE_QUEUE_HH__
+#define __DEADLINE_QUEUE_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Keeps one deadline per key, ordered by time, so whoever consumes it only
+// has to look at the keys that are due instead of going through all of them.
+// Scheduling a key that is already queued keeps the earliest deadline.
+class DeadlineQueue
+{
+public:
+  typedef boost::chrono::steady_clock Clock;
+
+  DeadlineQueue(void);
+  virtual ~DeadlineQueue(void);
+
+  void schedule(const std::string &key, const Clock::time_point &deadline);
+  void scheduleIn(const std::string &key, double seconds);
+  void remove(const std::string &key);
+  size_t waitForDue(std::vector<std::string> &keys,
+                    const Clock::duration &maxWait);
+  size_t size(void);
+  void clear(void);
+
+private:
+  typedef std::multimap<Clock::time_point, std::string> DeadlineMap;
+
+  size_t popDue(const Clock::time_point &now, std::vector<std::string> &keys);
+
+  DeadlineMap mDeadlines;
+  std::map<std::string, DeadlineMap::iterator> mKeys;
+  boost::mutex mMutex;
+  boost::condition_variable mCond;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __DEADLINE_QUEUE_HH__ */
@@ -17,11 +17,15 @@
  * for more details.
  */
 
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <sys/stat.h>
 
 #include "radosfscommon.h"
+#include "AsyncOpPriv.hh"
 #include "Dir.hh"
 #include "DirPriv.hh"
+#include "File.hh"
 #include "FilesystemPriv.hh"
 #include "Finder.hh"
 #include "QuotaPriv.hh"
@@ -93,7 +97,8 @@ DirPriv::updateDirInfoPtr()
   {
     dirInfo = dir->filesystem()->mPriv->getDirInfo(fsStat()->translatedPath,
                                                    fsStat()->pool,
-                                                   cacheable);
+                                                   cacheable,
+                                                   dirUsesOmapIndex(fsStat()));
 
     return true;
   }
@@ -165,12 +170,14 @@ DirPriv::makeDirsRecursively(Stat *stat, const char *path, uid_t uid, gid_t gid)
     *stat = parentStat;
     stat->path = dir;
     stat->translatedPath = generateUuid();
+    setDirIndexMode(stat, radosFsPriv->dirOmapIndex);
 
     ret = createDirAndInode(stat);
 
     if (ret != 0)
       return ret;
 
+    radosFsPriv->removeDirInode(dir);
     indexObject(&parentStat, stat, '+');
   }
 
@@ -181,6 +188,8 @@ void
 findInThread(Finder *finder, FinderData *data, boost::mutex &mutex,
              boost::condition_variable &cond)
 {
+  // The find is recorded by the thread that started it
+  UnrecordedOps unrecordedOps;
   int ret = finder->find(data);
   bool lastJob = false;
 
@@ -202,7 +211,7 @@ findInThread(Finder *finder, FinderData *data, boost::mutex &mutex,
 
 int
 DirPriv::find(std::set<std::string> &entries, std::set<std::string> &results,
-              const std::map<Finder::FindOptions, FinderArg> &args)
+              const FinderPlan &plan)
 {
   int ret = 0;
   boost::mutex mutex;
@@ -225,17 +234,19 @@ DirPriv::find(std::set<std::string> &entries, std::set<std::string> &results,
     mutex.lock();
 
     data->dir = entry;
-    data->args = &args;
+    data->plan = &plan;
     data->retCode = &ret;
+    data->listener = 0;
     numRelatedJobs++;
     data->numberRelatedJobs = &numRelatedJobs;
 
     mutex.unlock();
 
     jobs.push_back(data);
-    radosFsPriv()->getIoService()->post(boost::bind(&findInThread, &finder,
-                                                    data, boost::ref(mutex),
-                                                    boost::ref(cond)));
+    radosFsPriv()->scheduler.post(boost::bind(&findInThread, &finder, data,
+                                              boost::ref(mutex),
+                                              boost::ref(cond)),
+                                  WorkScheduler::PRIORITY_BACKGROUND);
   }
 
   entries.clear();
@@ -263,6 +274,382 @@ DirPriv::find(std::set<std::string> &entries, std::set<std::string> &results,
   return ret;
 }
 
+DirFindStream::DirFindStream(FilesystemPriv *fsPriv, const FinderPlan &plan,
+                             Dir::FindCallback callback, void *callbackArg,
+                             size_t maxResults)
+  : fsPriv(fsPriv),
+    finder(fsPriv->radosFs),
+    plan(plan),
+    callback(callback),
+    callbackArg(callbackArg),
+    maxResults(maxResults),
+    numResults(0),
+    numJobs(0),
+    retCode(0),
+    stopped(false),
+    uid(FilesystemPriv::uid),
+    gid(FilesystemPriv::gid),
+    // Asking for a limited number of results is what interactive queries do,
+    // so those should not wait behind the background jobs
+    priority(maxResults > 0 ? WorkScheduler::PRIORITY_INTERACTIVE :
+                              WorkScheduler::PRIORITY_BACKGROUND)
+{}
+
+void
+DirFindStream::onDir(const std::string &path)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    if (stopped)
+      return;
+
+    numJobs++;
+  }
+
+  fsPriv->scheduler.post(boost::bind(&DirFindStream::findInDir, this, path),
+                         priority);
+}
+
+bool
+DirFindStream::onResult(const std::string &path)
+{
+  // The callback is called with the mutex locked so it never runs in more than
+  // one thread at the same time
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (stopped)
+    return false;
+
+  numResults++;
+
+  if (!callback(path, callbackArg) ||
+      (maxResults > 0 && numResults >= maxResults))
+  {
+    stopped = true;
+  }
+
+  return !stopped;
+}
+
+bool
+DirFindStream::cancelled(void)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  return stopped;
+}
+
+void
+DirFindStream::findInDir(const std::string path)
+{
+  int ret = 0;
+
+  if (!cancelled())
+  {
+    const uid_t workerUid = FilesystemPriv::uid;
+    const gid_t workerGid = FilesystemPriv::gid;
+
+    FilesystemPriv::uid = uid;
+    FilesystemPriv::gid = gid;
+
+    FinderData data;
+    data.dir = path;
+    data.plan = &plan;
+    data.numberRelatedJobs = 0;
+    data.retCode = 0;
+    data.listener = this;
+
+    ret = finder.find(&data);
+
+    FilesystemPriv::uid = workerUid;
+    FilesystemPriv::gid = workerGid;
+  }
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (ret != 0 && retCode == 0)
+  {
+    retCode = ret;
+    stopped = true;
+  }
+
+  if (--numJobs == 0)
+    cond.notify_all();
+}
+
+int
+DirFindStream::run(const std::string &path)
+{
+  onDir(path);
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  while (numJobs > 0)
+    cond.wait(lock);
+
+  return retCode;
+}
+
+DirTreeWalk::DirTreeWalk(FilesystemPriv *fsPriv)
+  : fsPriv(fsPriv),
+    numJobs(0),
+    retCode(0),
+    runInline(false)
+{}
+
+DirTreeWalk::~DirTreeWalk(void)
+{}
+
+// Posts the pending dirs' jobs while there are less than
+// DIR_TREE_WALK_MAX_JOBS running; has to be called with the mutex locked
+void
+DirTreeWalk::scheduleJobs(void)
+{
+  if (runInline)
+    return;
+
+  while (retCode == 0 && numJobs < DIR_TREE_WALK_MAX_JOBS && !pending.empty())
+  {
+    Stat dir = pending.front();
+    pending.pop_front();
+    numJobs++;
+
+    fsPriv->scheduler.post(boost::bind(&DirTreeWalk::walkDir, this, dir));
+  }
+}
+
+int
+DirTreeWalk::listDir(const Stat &dir, std::vector<std::string> &entries,
+                     std::vector<Stat> &subDirs)
+{
+  std::tr1::shared_ptr<DirCache> dirInfo =
+      fsPriv->getDirInfo(dir.translatedPath, dir.pool, false,
+                         dirUsesOmapIndex(&dir));
+
+  if (!dirInfo)
+    return -ENODEV;
+
+  int ret = dirInfo->update();
+
+  if (ret == -ENOENT)
+    return 0;
+
+  if (ret != 0)
+    return ret;
+
+  const DirCacheContents contents = dirInfo->contents();
+
+  for (size_t i = 0; i < contents.size(); i++)
+  {
+    const std::string entry = contents[i];
+
+    if (entry == "")
+      continue;
+
+    if (entry[entry.length() - 1] != PATH_SEP)
+    {
+      entries.push_back(entry);
+      continue;
+    }
+
+    Stat subDir;
+    ret = fsPriv->stat(dir.path + entry, &subDir);
+
+    // Removed meanwhile, so there is nothing to walk
+    if (ret == -ENOENT)
+      continue;
+
+    if (ret != 0)
+      return ret;
+
+    // Links are only entries in their parent's inode
+    if (S_ISLNK(subDir.statBuff.st_mode))
+      entries.push_back(entry);
+    else
+      subDirs.push_back(subDir);
+  }
+
+  return 0;
+}
+
+void
+DirTreeWalk::walkDir(const Stat dir)
+{
+  std::vector<std::string> entries;
+  std::vector<Stat> subDirs;
+
+  int ret = listDir(dir, entries, subDirs);
+
+  if (ret == 0)
+    ret = processDir(dir, entries, subDirs);
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (ret != 0 && retCode == 0)
+  {
+    radosfs_debug("Failed to walk the subdirs of %s: %s", dir.path.c_str(),
+                  strerror(-ret));
+    retCode = ret;
+  }
+
+  if (ret == 0)
+    pending.insert(pending.end(), subDirs.begin(), subDirs.end());
+
+  numJobs--;
+  scheduleJobs();
+
+  if (numJobs == 0)
+    cond.notify_all();
+}
+
+int
+DirTreeWalk::walk(const Stat &dir)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  runInline = fsPriv->scheduler.inWorkerThread();
+  pending.push_back(dir);
+
+  if (runInline)
+  {
+    while (retCode == 0 && !pending.empty())
+    {
+      Stat next = pending.front();
+      pending.pop_front();
+      numJobs++;
+
+      lock.unlock();
+      walkDir(next);
+      lock.lock();
+    }
+
+    return retCode;
+  }
+
+  scheduleJobs();
+
+  while (numJobs > 0)
+    cond.wait(lock);
+
+  return retCode;
+}
+
+DirTreeMove::DirTreeMove(FilesystemPriv *fsPriv,
+                         Dir::RenameProgressCallback callback,
+                         void *callbackArg)
+  : DirTreeWalk(fsPriv),
+    callback(callback),
+    callbackArg(callbackArg),
+    foundDirs(0)
+{}
+
+int
+DirTreeMove::processDir(const Stat &dir,
+                        const std::vector<std::string> &entries,
+                        std::vector<Stat> &subDirs)
+{
+  const std::string newPath = newRoot + dir.path.substr(oldRoot.length());
+  std::vector<Stat> newSubDirs, createdSubDirs;
+  std::vector<int> results;
+  int ret = 0;
+
+  for (size_t i = 0; i < subDirs.size(); i++)
+  {
+    newSubDirs.push_back(subDirs[i]);
+    newSubDirs.back().path = newPath +
+                             subDirs[i].path.substr(dir.path.length());
+  }
+
+  createDirObjects(newSubDirs, results, DIR_BATCH_CREATE_OPS_IN_FLIGHT);
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  // Only the path objects that were really created are kept, so a rollback
+  // does not remove objects that this move did not create
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    if (results[i] != 0)
+    {
+      if (ret == 0)
+        ret = results[i];
+
+      continue;
+    }
+
+    oldDirs.push_back(subDirs[i]);
+    newDirs.push_back(newSubDirs[i]);
+    createdSubDirs.push_back(subDirs[i]);
+  }
+
+  subDirs.swap(createdSubDirs);
+  foundDirs += results.size();
+
+  // The callback is called with the mutex locked so it never runs in more than
+  // one thread at the same time
+  if (ret == 0 && callback)
+    callback(dir.path, newDirs.size(), foundDirs, callbackArg);
+
+  return ret;
+}
+
+int
+DirTreeMove::removePathObjects(const std::vector<Stat> &stats)
+{
+  std::vector<int> results;
+  int ret = 0;
+
+  removeDirObjects(stats, results, DIR_BATCH_CREATE_OPS_IN_FLIGHT);
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    if (results[i] == 0 || results[i] == -ENOENT)
+      continue;
+
+    radosfs_debug("Failed to remove the path object %s: %s",
+                  stats[i].path.c_str(), strerror(-results[i]));
+
+    if (ret == 0)
+      ret = results[i];
+  }
+
+  return ret;
+}
+
+// Moves the tree and sets whether the move was committed, i.e. whether all the
+// new path objects were created (even if some of the old ones could not be
+// removed afterwards)
+int
+DirTreeMove::run(const Stat &oldDir, const Stat &newDir, bool *committed)
+{
+  *committed = false;
+
+  int ret = createDirObject(&newDir);
+
+  if (ret != 0)
+    return ret;
+
+  oldRoot = oldDir.path;
+  newRoot = newDir.path;
+  oldDirs.push_back(oldDir);
+  newDirs.push_back(newDir);
+  foundDirs = 1;
+
+  ret = walk(oldDir);
+
+  if (ret != 0)
+  {
+    removePathObjects(newDirs);
+    return ret;
+  }
+
+  *committed = true;
+
+  for (size_t i = 0; i < oldDirs.size(); i++)
+    fsPriv->updateDirInode(oldDirs[i].path, newDirs[i].path);
+
+  return removePathObjects(oldDirs);
+}
+
 Stat *
 DirPriv::fsStat(void) const
 {
@@ -276,49 +663,96 @@ DirPriv::radosFsPriv(void)
 }
 
 int
-DirPriv::moveDirTreeObjects(const Stat *oldDir, const Stat *newDir)
+DirPriv::moveDirTreeObjects(const Stat *oldDir, const Stat *newDir,
+                            Dir::RenameProgressCallback callback,
+                            void *callbackArg, bool *committed)
 {
-  if (dirInfo || updateDirInfoPtr())
-  {
-    dirInfo->update();
+  DirTreeMove move(radosFsPriv(), callback, callbackArg);
 
-    std::set<std::string> entries = dirInfo->contents();
+  return move.run(*oldDir, *newDir, committed);
+}
 
-    std::set<std::string>::const_iterator it;
-    for (it = entries.begin(); it != entries.end(); it++)
-    {
-      const std::string &entry = *it;
+// Verifies that the given entries can be created in this directory: they have
+// to be valid names (not containing a path separator), not repeated and not
+// yet existing in the directory
+int
+DirPriv::checkNewEntries(const std::vector<std::string> &entries)
+{
+  std::set<std::string> names;
 
-      if (entry != "" && entry[entry.length() - 1] == PATH_SEP)
-      {
-        Stat oldSubDir, newSubDir;
-        Dir subDir(dir->filesystem(), dir->path() + entry, false);
+  if (dirInfo)
+    dirInfo->update();
 
-        oldSubDir = *subDir.mPriv->fsStat();
-        newSubDir = oldSubDir;
-        newSubDir.path = newDir->path + entry;
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    const std::string &name = entries[i];
 
-        int ret = subDir.mPriv->moveDirTreeObjects(&oldSubDir, &newSubDir);
+    if (name == "" || name.find(PATH_SEP) != std::string::npos)
+    {
+      radosfs_debug("Cannot create entry '%s' in %s: invalid name",
+                    name.c_str(), dir->path().c_str());
+      return -EINVAL;
+    }
 
-        if (ret != 0)
-          return ret;
-      }
+    if (!names.insert(name).second ||
+        (dirInfo && (dirInfo->hasEntry(name) || dirInfo->hasEntry(name + "/"))))
+    {
+      return -EEXIST;
     }
   }
 
-  int ret = createDirObject(newDir);
+  return 0;
+}
 
-  if (ret == 0)
-  {
-    radosFsPriv()->updateDirInode(oldDir->path, newDir->path);
-    ret = oldDir->pool->ioctx.remove(oldDir->path);
-  }
+int
+DirPriv::removeRecursive(AsyncOpSP asyncOp)
+{
+  Stat parentStat, stat;
+  uid_t uid;
+  gid_t gid;
+
+  dir->refresh();
+
+  int ret = radosFsPriv()->stat(parentDir, &parentStat);
+
+  if (ret != 0)
+    return ret;
+
+  dir->filesystem()->getIds(&uid, &gid);
+
+  if (!statBuffHasPermission(parentStat.statBuff, uid, gid, O_WRONLY | O_RDWR))
+    return -EACCES;
+
+  if (!dir->exists())
+    return -ENOENT;
+
+  if (dir->isFile())
+    return -ENOTDIR;
+
+  // A link is only its entry in the parent
+  if (dir->isLink())
+    return dir->remove();
+
+  stat = *fsStat();
+
+  DirTreeRemoval removal(radosFsPriv(), asyncOp);
+  ret = removal.run(stat, &parentStat);
+
+  dir->FsObj::refresh();
+
+  if (dirInfo)
+    updateFsDirCache();
+
+  updateDirInfoPtr();
+
+  radosFsPriv()->updateTMId(&stat);
 
   return ret;
 }
 
 int
-DirPriv::rename(const std::string &destination)
+DirPriv::rename(const std::string &destination,
+                Dir::RenameProgressCallback callback, void *callbackArg)
 {
   int index;
   Stat stat, oldStat, parentStat;
@@ -405,9 +839,25 @@ DirPriv::rename(const std::string &destination)
   if (ret != 0)
     return ret;
 
-  ret = moveDirTreeObjects(&oldStat, &stat);
+  bool committed = false;
+  ret = moveDirTreeObjects(&oldStat, &stat, callback, callbackArg, &committed);
 
-  if (ret == 0)
+  if (!committed)
+  {
+    // The old tree is intact, so its entry is put back in the old parent
+    // (instead of in the new one) and the rename can be retried
+    radosfs_debug("Failed to move the dir tree %s to %s: %s. Restoring the "
+                  "old entry.", oldStat.path.c_str(), newPath.c_str(),
+                  strerror(-ret));
+
+    indexObject(oldParentStat, &oldStat, '+');
+    indexObject(&parentStat, &stat, '-');
+  }
+
+  radosFsPriv()->invalidateStatTree(oldStat.path);
+  radosFsPriv()->invalidateStat(newPath);
+
+  if (committed)
   {
     dir->setPath(newPath);
   }
@@ -468,176 +918,362 @@ DirPriv::getQuotasXAttr(std::string &quotas)
   return ret;
 }
 
+DirTreeRemoval::DirTreeRemoval(FilesystemPriv *fsPriv, AsyncOpSP asyncOp)
+  : DirTreeWalk(fsPriv),
+    asyncOp(asyncOp),
+    uid(FilesystemPriv::uid),
+    gid(FilesystemPriv::gid),
+    numFound(0),
+    numRemoved(0)
+{}
+
+// Drops the inodes of the files among the given entries. Links and inline
+// files have nothing besides their entry in the dir, which goes away with it.
 int
-DirPriv::removeQuotaObject(const Quota &obj, bool applyRecursively)
+DirTreeRemoval::removeFiles(const Stat &dir,
+                            const std::vector<std::string> &entries)
 {
-  std::string quotas;
-  std::map<std::string, librados::bufferlist> omap;
-  const boost::chrono::milliseconds sleepTime(250);
-  int ret = -1;
-  size_t attempts = 3;
-
-  while (attempts-- != 0)
+  for (size_t i = 0; i < entries.size(); i += STAT_BATCH_MAX_ENTRIES)
   {
-    omap.clear();
-    getQuotasXAttr(quotas);
-    std::vector<std::pair<std::string, std::string> > quotasInfo =
-        quotasXAttrToVector(quotas);
+    const size_t end = std::min(entries.size(), i + STAT_BATCH_MAX_ENTRIES);
+    const std::vector<std::string> batch(entries.begin() + i,
+                                         entries.begin() + end);
+    StatAsyncInfo info;
+    info.entries = &batch;
 
-    std::string newQuotasXAttr;
-    bool hadQuota = false;
+    fsPriv->statDirAndEntries(dir.path, &info);
 
-    std::vector<std::pair<std::string, std::string> >::const_iterator it;
-    for (it = quotasInfo.begin(); it != quotasInfo.end(); it++)
+    if (info.statRet != 0)
+      return info.statRet;
+
+    for (size_t j = 0; j < info.entryStats.size(); j++)
     {
-      if ((*it).first == obj.name())
+      const Stat &fileStat = info.entryStats[j].second;
+
+      if (info.entryStats[j].first != 0 || !S_ISREG(fileStat.statBuff.st_mode) ||
+          !fileStat.pool || fileStat.translatedPath == "")
       {
-        hadQuota = true;
         continue;
       }
 
-      newQuotasXAttr.append((*it).first + XATTR_IN_VALUE_SEPARATOR +
-                            obj.pool() + ",");
-    }
+      // The chunks are removed when the last user of the inode releases it
+      // (or by the worker threads, see Filesystem::setFileBackgroundLazyRemoval)
+      FileIOSP io = fsPriv->getOrCreateFileIO(fileStat.translatedPath,
+                                              &fileStat);
 
-    if (!hadQuota)
-      break;
+      if (!io)
+        return -ENODEV;
 
-    if (newQuotasXAttr.empty())
-    {
-      omap[XATTR_QUOTA_OBJECT].append("", 0);
-    }
-    else
-    {
-      // We subtract one from the string's length to exclude the trailing ','
-      // added in the loop above
-      omap[XATTR_QUOTA_OBJECT].append(newQuotasXAttr.data(),
-                                      newQuotasXAttr.length() - 1);
+      io->setLazyRemoval(true);
+      fsPriv->removeFileIO(io);
     }
+  }
 
-    librados::ObjectWriteOperation op;
-    librados::bufferlist cmpBl;
-    cmpBl.append(quotas);
-    std::pair<librados::bufferlist, int> cmp(cmpBl, LIBRADOS_CMPXATTR_OP_EQ);
-    std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-    omapCmp[XATTR_QUOTA_OBJECT] = cmp;
+  return 0;
+}
 
-    op.omap_cmp(omapCmp, 0);
-    op.omap_set(omap);
+int
+DirTreeRemoval::processDir(const Stat &dir,
+                           const std::vector<std::string> &entries,
+                           std::vector<Stat> &subDirs)
+{
+  if (!statBuffHasPermission(dir.statBuff, uid, gid, O_WRONLY | O_RDWR))
+    return -EACCES;
 
-    ret = fsStat()->pool->ioctx.operate(fsStat()->translatedPath, &op);
+  int ret = removeFiles(dir, entries);
 
-    if (ret == 0)
-    {
-      break;
-    }
-    else
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  dirs.insert(dirs.end(), subDirs.begin(), subDirs.end());
+  numFound += entries.size() + subDirs.size();
+
+  if (ret == 0)
+    numRemoved += entries.size();
+
+  asyncOp->mPriv->setProgress(numRemoved, numFound);
+
+  return ret;
+}
+
+int
+DirTreeRemoval::removeDirs(const std::vector<Stat> &dirs)
+{
+  std::vector<int> results;
+  int ret = 0;
+
+  removeDirsAndInodes(dirs, results, DIR_BATCH_CREATE_OPS_IN_FLIGHT);
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    if (results[i] != 0)
     {
-      boost::this_thread::sleep_for(sleepTime);
+      radosfs_debug("Failed to remove the dir %s: %s", dirs[i].path.c_str(),
+                    strerror(-results[i]));
+
+      if (ret == 0)
+        ret = results[i];
+
+      continue;
     }
+
+    fsPriv->removeDirInode(dirs[i].path);
+    fsPriv->dirCache.remove(dirs[i].translatedPath);
+    numRemoved++;
   }
 
-  if (applyRecursively)
+  asyncOp->mPriv->setProgress(numRemoved, numFound);
+
+  return ret;
+}
+
+int
+DirTreeRemoval::run(const Stat &dir, const Stat *parentStat)
+{
+  numFound = 1;
+  asyncOp->mPriv->setProgress(0, numFound);
+
+  int ret = walk(dir);
+
+  if (ret == 0)
   {
-    dir->refresh();
+    // The dirs were found breadth-first, so the deepest ones are at the end
+    std::reverse(dirs.begin(), dirs.end());
+    ret = removeDirs(dirs);
+  }
+
+  fsPriv->invalidateStatTree(dir.path);
+
+  if (ret != 0)
+    return ret;
+
+  ret = removeDirs(std::vector<Stat>(1, dir));
+
+  if (ret == 0)
+    ret = indexObject(parentStat, &dir, '-');
+
+  fsPriv->invalidateStat(dir.path);
+
+  return ret;
+}
+
+// Computes the quotas xattr that results from adding or removing the given
+// quota, returning false if the xattr does not need to change
+static bool
+changeQuotasXAttr(const std::string &quotas, const Quota &quota, bool add,
+                  std::string &newQuotas)
+{
+  std::vector<std::pair<std::string, std::string> > quotasInfo =
+      quotasXAttrToVector(quotas);
+  bool hasQuota = false;
 
-    std::set<std::string> entries;
-    dir->entryList(entries);
+  newQuotas.clear();
 
-    std::set<std::string>::const_iterator it;
-    for (it  = entries.begin(); it != entries.end(); it++)
+  std::vector<std::pair<std::string, std::string> >::const_iterator it;
+  for (it = quotasInfo.begin(); it != quotasInfo.end(); it++)
+  {
+    if ((*it).first == quota.name())
     {
-      const std::string entry = dir->path() + *it;
-      if (isDirPath(entry))
-      {
-        Dir subdir(dir->filesystem(), entry, false);
-        if (!subdir.isLink())
-          subdir.mPriv->removeQuotaObject(obj, true);
-      }
+      hasQuota = true;
+      continue;
     }
+
+    if (!newQuotas.empty())
+      newQuotas.append(",");
+
+    newQuotas.append((*it).first + XATTR_IN_VALUE_SEPARATOR + (*it).second);
   }
 
-  return ret;
+  if (add)
+  {
+    newQuotas = quotas + "," + quota.name() + XATTR_IN_VALUE_SEPARATOR +
+                quota.pool();
+  }
+
+  return hasQuota != add;
 }
 
-int
-DirPriv::addQuotaObject(const Quota &obj, bool applyRecursively)
+// Adds or removes the given quota from the quotas xattr of all the given dirs,
+// with pipelined asynchronous operations. Each xattr is replaced only if it did
+// not change since it was read; the ones that did are read and updated again
+// right away, up to DIR_QUOTA_UPDATE_MAX_ATTEMPTS times.
+static int
+updateQuotasXAttrs(FilesystemPriv *fsPriv, const std::vector<Stat> &dirs,
+                   const Quota &quota, bool add)
 {
-  std::string quotas;
-  std::map<std::string, librados::bufferlist> omap;
-  const boost::chrono::milliseconds sleepTime(250);
-  int ret = -1;
-  size_t attempts = 3;
+  std::vector<size_t> pending;
+  std::vector<std::map<std::string, librados::bufferlist> > omaps(dirs.size());
+  std::vector<int> results(dirs.size(), 0);
+  int ret = 0;
 
-  while (attempts-- != 0)
+  for (size_t i = 0; i < dirs.size(); i++)
+    pending.push_back(i);
+
+  for (size_t attempt = 0;
+       attempt < DIR_QUOTA_UPDATE_MAX_ATTEMPTS && !pending.empty();
+       attempt++)
   {
-    omap.clear();
-    getQuotasXAttr(quotas);
-    std::vector<std::pair<std::string, std::string> > quotasInfo =
-        quotasXAttrToVector(quotas);
+    std::deque<std::pair<size_t, librados::AioCompletion *> > inFlight;
+    std::vector<int> readResults(dirs.size(), 0);
+    std::set<std::string> keys;
+    size_t next = 0;
+
+    keys.insert(XATTR_QUOTA_OBJECT);
 
-    bool alreadyAdded = false;
-    std::vector<std::pair<std::string, std::string> >::const_iterator it;
-    for (it = quotasInfo.begin(); it != quotasInfo.end(); it++)
+    while (next < pending.size() || !inFlight.empty())
     {
-      if ((*it).first == obj.name())
+      if (next < pending.size() &&
+          inFlight.size() < DIR_BATCH_CREATE_OPS_IN_FLIGHT)
       {
-        alreadyAdded = true;
-        break;
+        const size_t index = pending[next++];
+        const Stat &dir = dirs[index];
+        librados::ObjectReadOperation op;
+        librados::AioCompletion *completion =
+            librados::Rados::aio_create_completion();
+
+        omaps[index].clear();
+        op.omap_get_vals_by_keys(keys, &omaps[index], &readResults[index]);
+        dir.pool->ioctx.aio_operate(dir.translatedPath, completion, &op, 0);
+        inFlight.push_back(std::make_pair(index, completion));
+        continue;
       }
+
+      std::pair<size_t, librados::AioCompletion *> op = inFlight.front();
+      inFlight.pop_front();
+
+      op.second->wait_for_complete();
+      results[op.first] = op.second->get_return_value();
+      op.second->release();
+
+      if (results[op.first] == 0)
+        results[op.first] = readResults[op.first];
     }
 
-    if (alreadyAdded)
-      break;
+    std::vector<size_t> conflicting;
+    next = 0;
 
-    librados::ObjectWriteOperation op;
-    librados::bufferlist cmpBl;
-    cmpBl.append(quotas);
-    std::pair<librados::bufferlist, int> cmp(cmpBl, LIBRADOS_CMPXATTR_OP_EQ);
-    std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-    omapCmp[XATTR_QUOTA_OBJECT] = cmp;
+    while (next < pending.size() || !inFlight.empty())
+    {
+      if (next < pending.size() &&
+          inFlight.size() < DIR_BATCH_CREATE_OPS_IN_FLIGHT)
+      {
+        const size_t index = pending[next++];
+        const Stat &dir = dirs[index];
+        std::string quotas, newQuotas;
 
-    quotas.append("," + obj.name() + XATTR_IN_VALUE_SEPARATOR + obj.pool());
-    omap[XATTR_QUOTA_OBJECT].append(quotas);
+        if (results[index] != 0)
+          continue;
 
-    op.omap_cmp(omapCmp, 0);
-    op.omap_set(omap);
+        librados::bufferlist &quotasBl = omaps[index][XATTR_QUOTA_OBJECT];
+        quotas.assign(quotasBl.c_str(), quotasBl.length());
 
-    ret = fsStat()->pool->ioctx.operate(fsStat()->translatedPath, &op);
+        if (!changeQuotasXAttr(quotas, quota, add, newQuotas))
+          continue;
 
-    if (ret == 0)
-    {
-      break;
+        librados::ObjectWriteOperation op;
+        librados::bufferlist cmpBl;
+        std::map<std::string, librados::bufferlist> omap;
+        std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
+
+        cmpBl.append(quotas);
+        omapCmp[XATTR_QUOTA_OBJECT] = std::make_pair(cmpBl,
+                                                     LIBRADOS_CMPXATTR_OP_EQ);
+        omap[XATTR_QUOTA_OBJECT].append(newQuotas);
+
+        op.omap_cmp(omapCmp, 0);
+        op.omap_set(omap);
+
+        librados::AioCompletion *completion =
+            librados::Rados::aio_create_completion();
+        dir.pool->ioctx.aio_operate(dir.translatedPath, completion, &op);
+        inFlight.push_back(std::make_pair(index, completion));
+        continue;
+      }
+
+      std::pair<size_t, librados::AioCompletion *> op = inFlight.front();
+      inFlight.pop_front();
+
+      op.second->wait_for_complete();
+      results[op.first] = op.second->get_return_value();
+      op.second->release();
+
+      // Changed by someone else since it was read
+      if (results[op.first] == -ECANCELED)
+        conflicting.push_back(op.first);
     }
-    else
+
+    pending.swap(conflicting);
+  }
+
+  for (size_t i = 0; i < dirs.size(); i++)
+  {
+    fsPriv->invalidateStat(dirs[i].path);
+
+    if (results[i] != 0 && ret == 0)
     {
-      boost::this_thread::sleep_for(sleepTime);
+      radosfs_debug("Failed to update the quotas of %s: %s",
+                    dirs[i].path.c_str(), strerror(-results[i]));
+      ret = results[i];
     }
   }
 
-  if (applyRecursively)
+  return ret;
+}
+
+DirQuotaUpdate::DirQuotaUpdate(FilesystemPriv *fsPriv, const Quota &quota,
+                               bool add)
+  : DirTreeWalk(fsPriv),
+    quota(quota),
+    add(add)
+{}
+
+int
+DirQuotaUpdate::processDir(const Stat &dir,
+                           const std::vector<std::string> &entries,
+                           std::vector<Stat> &subDirs)
+{
+  return updateQuotasXAttrs(fsPriv, subDirs, quota, add);
+}
+
+int
+DirPriv::removeQuotaObject(const Quota &obj, bool applyRecursively)
+{
+  std::vector<Stat> dirs(1, *fsStat());
+
+  int ret = updateQuotasXAttrs(radosFsPriv(), dirs, obj, false);
+
+  if (ret == 0 && applyRecursively)
   {
-    dir->refresh();
+    DirQuotaUpdate update(radosFsPriv(), obj, false);
+    ret = update.walk(*fsStat());
+  }
 
-    std::set<std::string> entries;
-    dir->entryList(entries);
+  return ret;
+}
 
-    std::set<std::string>::const_iterator it;
-    for (it  = entries.begin(); it != entries.end(); it++)
-    {
-      const std::string entry = dir->path() + *it;
-      if (isDirPath(entry))
-      {
-        Dir subdir(dir->filesystem(), entry, false);
-        if (!subdir.isLink())
-          subdir.mPriv->addQuotaObject(obj, true);
-      }
-    }
+int
+DirPriv::addQuotaObject(const Quota &obj, bool applyRecursively)
+{
+  std::vector<Stat> dirs(1, *fsStat());
+
+  int ret = updateQuotasXAttrs(radosFsPriv(), dirs, obj, true);
+
+  if (ret == 0 && applyRecursively)
+  {
+    DirQuotaUpdate update(radosFsPriv(), obj, true);
+    ret = update.walk(*fsStat());
   }
 
   return ret;
 }
 
+DirListingPriv::DirListingPriv(std::tr1::shared_ptr<DirCache> dirInfo,
+                               const std::string &pathPrefix)
+  : dirInfo(dirInfo),
+    pathPrefix(pathPrefix),
+    lastEntry(""),
+    atEnd(false)
+{}
+
 /**
  * @class Dir
  *
@@ -739,39 +1375,331 @@ Dir::getParent(const std::string &path, int *pos)
 int
 Dir::entryList(std::set<std::string> &entries, bool withAbsolutePath)
 {
+  RecordedOp recordedOp(&mPriv->radosFsPriv()->opRecorder,
+                        OpRecorder::OP_LIST, this);
   if (isFile())
   {
     radosfs_debug("Error: Dir instance has a path file %s ; not listing.",
                   path().c_str());
-    return -ENOTDIR;
+    return recordedOp.finish(-ENOTDIR);
   }
 
   if (isLink())
   {
     if (mPriv->target)
-      return mPriv->target->entryList(entries);
+      return recordedOp.finish(mPriv->target->entryList(entries));
 
     radosfs_debug("No target for link %s", path().c_str());
-    return -ENOLINK;
+    return recordedOp.finish(-ENOLINK);
+  }
+
+  if (!mPriv->dirInfo && !mPriv->updateDirInfoPtr())
+    return recordedOp.finish(-ENOENT);
+
+  if (!isReadable())
+    return recordedOp.finish(-EACCES);
+
+  const DirCacheContents contents = mPriv->dirInfo->contents();
+  const std::string prefix = withAbsolutePath ? path() : "";
+
+  // The contents are sorted, so each insertion goes at the end of the set
+  for (size_t i = 0; i < contents.size(); i++)
+    entries.insert(entries.end(), prefix + contents[i]);
+
+  return recordedOp.finish(0);
+}
+
+/**
+ * Gets a page of the list of files and directories in the directory.
+ *
+ * The entries are returned in sorted order, starting after \a startAfter. For
+ * directories indexed in omap (see Filesystem::setDirOmapIndex), the page is
+ * read from the server without loading the rest of the directory; otherwise
+ * it is taken from the entries cached since the last call to Dir::refresh.
+ *
+ * @param[out] entries a set to store the directory's entries.
+ * @param startAfter the entry after which the listing starts, or an empty
+ *        string to start at the beginning of the directory.
+ * @param maxEntries the maximum number of entries to get.
+ * @param withAbsolutePath the entries in the directory will be returned with
+ *        the full path.
+ * @return the number of entries read on success, an error code otherwise.
+ */
+int
+Dir::entryList(std::set<std::string> &entries, const std::string &startAfter,
+               size_t maxEntries, bool withAbsolutePath)
+{
+  RecordedOp recordedOp(&mPriv->radosFsPriv()->opRecorder,
+                        OpRecorder::OP_LIST, this, 0, maxEntries);
+  if (isFile())
+  {
+    radosfs_debug("Error: Dir instance has a path file %s ; not listing.",
+                  path().c_str());
+    return recordedOp.finish(-ENOTDIR);
+  }
+
+  if (isLink())
+  {
+    if (mPriv->target)
+      return recordedOp.finish(mPriv->target->entryList(entries, startAfter,
+                                                        maxEntries,
+                                                        withAbsolutePath));
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return recordedOp.finish(-ENOLINK);
   }
 
   if (!mPriv->dirInfo && !mPriv->updateDirInfoPtr())
+    return recordedOp.finish(-ENOENT);
+
+  if (!isReadable())
+    return recordedOp.finish(-EACCES);
+
+  if (!withAbsolutePath)
+    return recordedOp.finish(mPriv->dirInfo->listEntries(startAfter, maxEntries,
+                                                         entries));
+
+  std::set<std::string> page;
+  int ret = mPriv->dirInfo->listEntries(startAfter, maxEntries, page);
+
+  std::set<std::string>::const_iterator it;
+  for (it = page.begin(); it != page.end(); it++)
+    entries.insert(path() + *it);
+
+  return recordedOp.finish(ret);
+}
+
+/**
+ * Gets the list of files and directories in the directory together with their
+ * stat information (as Filesystem::stat would get it for each of them).
+ *
+ * This is cheaper than listing the directory and statting each entry: the
+ * files are all statted from the directory's object in a single operation
+ * (per batch of STAT_BATCH_MAX_ENTRIES files) and the subdirectories are
+ * statted in parallel.
+ *
+ * @param[out] entries a map to store the directory's entries and their stat
+ *        information.
+ * @param withAbsolutePath the entries in the directory will be returned with
+ *        the full path.
+ * @note The entries that could not be statted (e.g. because they were removed
+ *       after the directory was refreshed) are not included in \a entries.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Dir::entryListWithStat(std::map<std::string, struct stat> &entries,
+                       bool withAbsolutePath)
+{
+  RecordedOp recordedOp(&mPriv->radosFsPriv()->opRecorder,
+                        OpRecorder::OP_LIST, this);
+  if (isFile())
+  {
+    radosfs_debug("Error: Dir instance has a path file %s ; not listing.",
+                  path().c_str());
+    return recordedOp.finish(-ENOTDIR);
+  }
+
+  if (isLink())
+  {
+    if (mPriv->target)
+      return recordedOp.finish(mPriv->target->entryListWithStat(
+                                 entries, withAbsolutePath));
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return recordedOp.finish(-ENOLINK);
+  }
+
+  if (!mPriv->dirInfo && !mPriv->updateDirInfoPtr())
+    return recordedOp.finish(-ENOENT);
+
+  if (!isReadable())
+    return recordedOp.finish(-EACCES);
+
+  const DirCacheContents contents = mPriv->dirInfo->contents();
+  std::vector<std::string> names;
+
+  names.reserve(contents.size());
+
+  for (size_t i = 0; i < contents.size(); i++)
+    names.push_back(contents[i]);
+  StatResults stats;
+
+  mPriv->radosFsPriv()->statEntryList(path(), names, &stats);
+
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    const std::string &entryPath = path() + names[i];
+
+    if (stats.ret(i) != 0)
+    {
+      radosfs_debug("Error stating %s ; not listing it.", entryPath.c_str());
+      continue;
+    }
+
+    const std::string &name = withAbsolutePath ? entryPath : names[i];
+    entries[name] = stats.statBuff(i);
+  }
+
+  return recordedOp.finish(0);
+}
+
+// Reads the whole contents of a file whose data is not all in its inline
+// buffer (or that is a link)
+static int
+readWholeFile(Filesystem *radosFs, const std::string &path,
+              std::string &contents)
+{
+  File file(radosFs, path, File::MODE_READ);
+  ssize_t readBytes = DIR_READ_FILES_READ_SIZE;
+
+  contents.clear();
+
+  while (readBytes == DIR_READ_FILES_READ_SIZE)
+  {
+    const size_t offset = contents.length();
+    contents.resize(offset + DIR_READ_FILES_READ_SIZE);
+
+    readBytes = file.read(&contents[offset], offset, DIR_READ_FILES_READ_SIZE);
+
+    if (readBytes < 0)
+    {
+      contents.clear();
+      return readBytes;
+    }
+
+    contents.resize(offset + readBytes);
+  }
+
+  return 0;
+}
+
+/**
+ * Reads the whole contents of several (small) files in this directory at once.
+ *
+ * The contents of small files are kept in their inline buffers, which are
+ * stored in this directory's object, so all the given files are statted and
+ * have their inline buffers read with a single operation. Only the files that
+ * do not fit in their inline buffer (or that are links) are then read as
+ * usual.
+ *
+ * @param entries the names of the files to read (relative to this directory).
+ * @param[out] contents the contents of each of the files, in the same order as
+ *             the \a entries (empty for the files that could not be read).
+ * @param[out] retCodes the result of reading each of the files, in the same
+ *             order as the \a entries: 0 on success, -ENOENT if it is not a
+ *             file in this directory, -EACCES if it is not readable or any
+ *             other error code.
+ * @return 0 if the directory could be read (even if some of the files could
+ *         not), an error code otherwise.
+ */
+int
+Dir::readSmallFiles(const std::vector<std::string> &entries,
+                    std::vector<std::string> &contents,
+                    std::vector<int> &retCodes)
+{
+  if (isFile())
+    return -ENOTDIR;
+
+  if (isLink())
+  {
+    if (mPriv->target)
+      return mPriv->target->readSmallFiles(entries, contents, retCodes);
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return -ENOLINK;
+  }
+
+  if (!exists())
     return -ENOENT;
 
   if (!isReadable())
     return -EACCES;
 
-  const std::set<std::string> &contents = mPriv->dirInfo->contents();
-  if (withAbsolutePath)
+  std::vector<InlineFileRead> files;
+  int ret = mPriv->radosFsPriv()->readInlineFiles(path(), entries, &files);
+
+  if (ret != 0)
+    return ret;
+
+  uid_t uid;
+  gid_t gid;
+  Filesystem *radosFs = filesystem();
+
+  radosFs->getIds(&uid, &gid);
+
+  contents.assign(entries.size(), "");
+  retCodes.assign(entries.size(), 0);
+
+  for (size_t i = 0; i < files.size(); i++)
   {
-    std::set<std::string>::const_iterator it;
-    for (it = contents.begin(); it != contents.end(); it++)
+    InlineFileRead &file = files[i];
+
+    if (file.ret != 0)
     {
-      entries.insert(path() + *it);
+      retCodes[i] = file.ret;
+      continue;
     }
+
+    if (!statBuffHasPermission(file.stat.statBuff, uid, gid, O_RDONLY))
+    {
+      retCodes[i] = -EACCES;
+      continue;
+    }
+
+    if (file.complete)
+      contents[i].swap(file.contents);
+    else
+      retCodes[i] = readWholeFile(radosFs, path() + entries[i], contents[i]);
   }
-  else
-    entries.insert(contents.begin(), contents.end());
+
+  return 0;
+}
+
+/**
+ * Opens a listing of the directory's entries that can be read in batches.
+ *
+ * Unlike Dir::entryList, this does not copy the whole list of entries: each
+ * call to DirListing::next gets the following batch (in sorted order) directly
+ * from the directory's cache, or from the server for directories indexed in
+ * omap. Since the listing resumes after the last entry it returned, entries
+ * added or removed meanwhile do not make it skip or repeat other entries.
+ *
+ * @note As with Dir::entryList, the entries of directories that are not
+ *       indexed in omap are the ones cached since the last call to
+ *       Dir::refresh.
+ *
+ * @param[out] listing the listing object to set up.
+ * @param withAbsolutePath the entries in the directory will be returned with
+ *        the full path.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Dir::openListing(DirListing &listing, bool withAbsolutePath)
+{
+  if (isFile())
+  {
+    radosfs_debug("Error: Dir instance has a path file %s ; not listing.",
+                  path().c_str());
+    return -ENOTDIR;
+  }
+
+  if (isLink())
+  {
+    if (mPriv->target)
+      return mPriv->target->openListing(listing, withAbsolutePath);
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return -ENOLINK;
+  }
+
+  if (!mPriv->dirInfo && !mPriv->updateDirInfoPtr())
+    return -ENOENT;
+
+  if (!isReadable())
+    return -EACCES;
+
+  listing.mPriv.reset(new DirListingPriv(mPriv->dirInfo,
+                                         withAbsolutePath ? path() : ""));
 
   return 0;
 }
@@ -795,93 +1723,349 @@ Dir::create(int mode,
             int owner,
             int group)
 {
+  RecordedOp recordedOp(&mPriv->radosFsPriv()->opRecorder,
+                        OpRecorder::OP_CREATE_DIR, this);
   int ret;
   const std::string &dir = path();
   Filesystem *radosFs = filesystem();
 
   if (exists())
   {
-    if (isFile())
-      return -ENOTDIR;
-
-    if (mkpath)
-      return 0;
+    if (isFile())
+      return recordedOp.finish(-ENOTDIR);
+
+    if (mkpath)
+      return recordedOp.finish(0);
+
+    return recordedOp.finish(-EEXIST);
+  }
+
+  const PoolSP pool = mPriv->getPool();
+
+  if (!pool)
+    return recordedOp.finish(-ENODEV);
+
+  uid_t uid = radosFs->uid();
+  gid_t gid = radosFs->gid();
+
+  if (owner < 0)
+    owner = uid;
+
+  if (group < 0)
+    group = gid;
+
+  mode_t permOctal = DEFAULT_MODE_DIR;
+
+  if (mode >= 0)
+    permOctal = mode | S_IFDIR;
+
+  Stat stat, parentStat;
+
+  if (mkpath)
+  {
+    ret = mPriv->makeDirsRecursively(&parentStat, mPriv->parentDir.c_str(), uid,
+                                     gid);
+
+    if (ret != 0)
+      return recordedOp.finish(ret);
+  }
+  else
+  {
+    ret = mPriv->radosFsPriv()->stat(mPriv->parentDir, &parentStat);
+
+    if (ret != 0)
+      return recordedOp.finish(ret);
+  }
+
+  if (!statBuffHasPermission(parentStat.statBuff, uid, gid, O_WRONLY | O_RDWR))
+    return recordedOp.finish(-EACCES);
+
+  stat = parentStat;
+
+  stat.path = dir;
+  stat.translatedPath = generateUuid();
+  stat.statBuff.st_mode = permOctal;
+  stat.statBuff.st_uid = owner;
+  stat.statBuff.st_gid = group;
+  stat.pool = pool;
+
+  timespec spec;
+  clock_gettime(CLOCK_REALTIME, &spec);
+
+  stat.statBuff.st_ctim = spec;
+  stat.statBuff.st_ctime = spec.tv_sec;
+
+  setDirIndexMode(&stat, radosFs->dirOmapIndex());
+
+  MetricsTimer timer(&mPriv->radosFsPriv()->metrics, Metrics::OP_CREATE);
+  TraceSpan span(&mPriv->radosFsPriv()->tracer, "create_dir", "dir", true);
+
+  if (span.active())
+    span.setDetail(stat.path);
+
+  ret = createDirAndInode(&stat);
+
+  if (ret != 0)
+  {
+    radosfs_debug("Problem setting inode in dir %s: %s", stat.path.c_str(),
+                  strerror(abs(ret)));
+    return recordedOp.finish(timer.finish(ret));
+  }
+
+  mPriv->radosFsPriv()->removeDirInode(stat.path);
+  indexObject(&parentStat, &stat, '+');
+
+  FsObj::refresh();
+  mPriv->updateDirInfoPtr();
+
+  mPriv->radosFsPriv()->updateTMId(&stat);
+
+  return recordedOp.finish(0);
+}
+
+/**
+ * Creates several files in this directory at once.
+ *
+ * Instead of indexing each file with its own operation (as File::create does),
+ * all the files are indexed in the directory with a single operation, so
+ * either all or none of them are created. As with File::create, the files'
+ * inode objects are only created when the files are written.
+ *
+ * @param entries the names of the files to create (relative to this
+ *        directory, they cannot contain a path separator).
+ * @param mode the files' mode bits (from sys/stat.h), S_IRWXU, etc. Use -1 for
+ *        the default (S_IRWXU | S_IRGRP | S_IROTH).
+ * @param pool the data pool in which the files' contents will be stored (the
+ *        default pool for the files' paths is used if this is empty).
+ * @param chunk the size of the files' chunks (0 means the default chunk size,
+ *        see Filesystem::setFileChunkSize).
+ * @return 0 on success, -EEXIST if any of the entries already exists or is
+ *         repeated, or any other error code (in which case no files are
+ *         created).
+ */
+int
+Dir::createFiles(const std::vector<std::string> &entries, int mode,
+                 const std::string &pool, size_t chunk)
+{
+  if (isLink())
+  {
+    if (mPriv->target)
+      return mPriv->target->createFiles(entries, mode, pool, chunk);
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return -ENOLINK;
+  }
+
+  if (!exists())
+    return -ENOENT;
+
+  if (isFile())
+    return -ENOTDIR;
+
+  if (entries.empty())
+    return 0;
+
+  uid_t uid;
+  gid_t gid;
+  Filesystem *radosFs = filesystem();
+  Stat *dirStat = mPriv->fsStat();
+
+  radosFs->getIds(&uid, &gid);
+
+  if (!statBuffHasPermission(dirStat->statBuff, uid, gid, O_WRONLY | O_RDWR))
+    return -EACCES;
+
+  int ret = mPriv->checkNewEntries(entries);
+
+  if (ret != 0)
+    return ret;
+
+  long int permOctal = DEFAULT_MODE_FILE;
+
+  if (mode >= 0)
+    permOctal = mode | S_IFREG;
+
+  timespec spec;
+  clock_gettime(CLOCK_REALTIME, &spec);
+
+  std::stringstream inlineBufferSize;
+  inlineBufferSize << DEFAULT_FILE_INLINE_BUFFER_SIZE;
+
+  std::vector<Stat> stats(entries.size());
+
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    Stat &fileStat = stats[i];
+    fileStat.path = path() + entries[i];
+
+    PoolSP dataPool = mPriv->radosFsPriv()->getDataPool(fileStat.path, pool);
+
+    if (!dataPool)
+      return -ENODEV;
+
+    fileStat.translatedPath = generateUuid();
+    fileStat.pool = dataPool;
+    fileStat.statBuff = dirStat->statBuff;
+    fileStat.statBuff.st_uid = uid;
+    fileStat.statBuff.st_gid = gid;
+    fileStat.statBuff.st_mode = permOctal;
+    fileStat.statBuff.st_ctim = spec;
+    fileStat.statBuff.st_ctime = spec.tv_sec;
+
+    std::stringstream chunkSize;
+    chunkSize << mPriv->radosFsPriv()->chooseChunkSize(fileStat.path, dataPool,
+                                                       chunk, 0);
+
+    fileStat.extraData[XATTR_FILE_CHUNK_SIZE] = chunkSize.str();
+    fileStat.extraData[XATTR_FILE_INLINE_BUFFER_SIZE] = inlineBufferSize.str();
+
+    const PoolList &stripePools =
+        mPriv->radosFsPriv()->getStripePools(fileStat.path, dataPool);
+
+    if (!stripePools.empty())
+    {
+      fileStat.extraData[XATTR_FILE_STRIPE_POOLS] =
+          FilesystemPriv::stripePoolNames(stripePools);
+    }
+
+    if (mPriv->radosFsPriv()->shouldCompress(fileStat.path))
+    {
+      fileStat.extraData[XATTR_FILE_COMPRESSION] =
+          FILE_COMPRESSION_CODEC_ZLIB;
+    }
+
+    fileStat.extraData[XATTR_FILE_ALLOCATED_CHUNKS] =
+        FILE_ALLOCATED_CHUNKS_OMAP;
+  }
+
+  ret = indexObjects(dirStat, stats, '+');
+
+  if (ret == -ECANCELED)
+    return -EEXIST;
+
+  if (ret == 0)
+    mPriv->radosFsPriv()->updateTMId(&stats.front());
+
+  return ret;
+}
+
+/**
+ * Creates several subdirectories of this directory at once.
+ *
+ * The path and inode objects of the new directories are created with
+ * pipelined asynchronous operations and then all the directories that were
+ * successfully created are indexed in this directory with a single operation.
+ *
+ * @param entries the names of the directories to create (relative to this
+ *        directory, they cannot contain a path separator).
+ * @param mode the directories' mode bits (from sys/stat.h), S_IRWXU, etc. Use
+ *        -1 for the default (S_IRWXU | S_IRGRP | S_IROTH).
+ * @return 0 on success, -EEXIST if any of the entries already exists or is
+ *         repeated, or any other error code. If creating some of the
+ *         directories fails, the remaining ones are still created and the
+ *         first error is returned.
+ */
+int
+Dir::createDirs(const std::vector<std::string> &entries, int mode)
+{
+  if (isLink())
+  {
+    if (mPriv->target)
+      return mPriv->target->createDirs(entries, mode);
 
-    return -EEXIST;
+    radosfs_debug("No target for link %s", path().c_str());
+    return -ENOLINK;
   }
 
-  const PoolSP pool = mPriv->getPool();
+  if (!exists())
+    return -ENOENT;
 
-  if (!pool)
-    return -ENODEV;
+  if (isFile())
+    return -ENOTDIR;
 
-  uid_t uid = radosFs->uid();
-  gid_t gid = radosFs->gid();
+  if (entries.empty())
+    return 0;
 
-  if (owner < 0)
-    owner = uid;
+  uid_t uid;
+  gid_t gid;
+  Filesystem *radosFs = filesystem();
+  Stat *dirStat = mPriv->fsStat();
 
-  if (group < 0)
-    group = gid;
+  radosFs->getIds(&uid, &gid);
+
+  if (!statBuffHasPermission(dirStat->statBuff, uid, gid, O_WRONLY | O_RDWR))
+    return -EACCES;
+
+  int ret = mPriv->checkNewEntries(entries);
+
+  if (ret != 0)
+    return ret;
 
   mode_t permOctal = DEFAULT_MODE_DIR;
 
   if (mode >= 0)
     permOctal = mode | S_IFDIR;
 
-  Stat stat, parentStat;
+  timespec spec;
+  clock_gettime(CLOCK_REALTIME, &spec);
 
-  if (mkpath)
-  {
-    ret = mPriv->makeDirsRecursively(&parentStat, mPriv->parentDir.c_str(), uid,
-                                     gid);
+  std::vector<Stat> stats(entries.size());
 
-    if (ret != 0)
-      return ret;
-  }
-  else
+  for (size_t i = 0; i < entries.size(); i++)
   {
-    ret = mPriv->radosFsPriv()->stat(mPriv->parentDir, &parentStat);
+    Stat &stat = stats[i];
 
-    if (ret != 0)
-      return ret;
+    stat = *dirStat;
+    stat.path = path() + entries[i] + PATH_SEP;
+    stat.pool = mPriv->radosFsPriv()->getMetadataPoolFromPath(stat.path);
+
+    if (!stat.pool)
+      return -ENODEV;
+
+    stat.translatedPath = generateUuid();
+    stat.statBuff.st_mode = permOctal;
+    stat.statBuff.st_uid = uid;
+    stat.statBuff.st_gid = gid;
+    stat.statBuff.st_ctim = spec;
+    stat.statBuff.st_ctime = spec.tv_sec;
+    stat.extraData.clear();
+
+    setDirIndexMode(&stat, radosFs->dirOmapIndex());
   }
 
-  if (!statBuffHasPermission(parentStat.statBuff, uid, gid, O_WRONLY | O_RDWR))
-    return -EACCES;
+  std::vector<int> results;
+  std::vector<Stat> createdStats;
 
-  stat = parentStat;
+  createDirsAndInodes(stats, results, DIR_BATCH_CREATE_OPS_IN_FLIGHT);
 
-  stat.path = dir;
-  stat.translatedPath = generateUuid();
-  stat.statBuff.st_mode = permOctal;
-  stat.statBuff.st_uid = owner;
-  stat.statBuff.st_gid = group;
-  stat.pool = pool;
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    if (results[i] != 0)
+    {
+      radosfs_debug("Problem creating dir %s: %s", stats[i].path.c_str(),
+                    strerror(abs(results[i])));
 
-  timespec spec;
-  clock_gettime(CLOCK_REALTIME, &spec);
+      if (ret == 0)
+        ret = results[i];
 
-  stat.statBuff.st_ctim = spec;
-  stat.statBuff.st_ctime = spec.tv_sec;
+      continue;
+    }
 
-  ret = createDirAndInode(&stat);
+    mPriv->radosFsPriv()->removeDirInode(stats[i].path);
+    createdStats.push_back(stats[i]);
+  }
 
-  if (ret != 0)
-  {
-    radosfs_debug("Problem setting inode in dir %s: %s", stat.path.c_str(),
-                  strerror(abs(ret)));
+  if (createdStats.empty())
     return ret;
-  }
 
-  indexObject(&parentStat, &stat, '+');
+  int indexRet = indexObjects(dirStat, createdStats, '+');
 
-  FsObj::refresh();
-  mPriv->updateDirInfoPtr();
+  if (ret == 0)
+    ret = indexRet;
 
-  mPriv->radosFsPriv()->updateTMId(&stat);
+  mPriv->radosFsPriv()->updateTMId(&createdStats.front());
 
-  return 0;
+  return ret;
 }
 
 /**
@@ -893,6 +2077,8 @@ Dir::create(int mode,
 int
 Dir::remove()
 {
+  RecordedOp recordedOp(&mPriv->radosFsPriv()->opRecorder,
+                        OpRecorder::OP_REMOVE_DIR, this);
   int ret;
   const std::string &dirPath = path();
   Filesystem *radosFs = filesystem();
@@ -903,19 +2089,19 @@ Dir::remove()
   ret = mPriv->radosFsPriv()->stat(mPriv->parentDir, &stat);
 
   if (ret != 0)
-    return ret;
+    return recordedOp.finish(ret);
 
   if (!statBuffHasPermission(stat.statBuff,
                              radosFs->uid(),
                              radosFs->gid(),
                              O_WRONLY | O_RDWR))
-    return -EACCES;
+    return recordedOp.finish(-EACCES);
 
   if (!exists())
-    return -ENOENT;
+    return recordedOp.finish(-ENOENT);
 
   if (isFile())
-    return -ENOTDIR;
+    return recordedOp.finish(-ENOTDIR);
 
   statPtr = reinterpret_cast<Stat *>(fsStat());
 
@@ -928,7 +2114,7 @@ Dir::remove()
     info->update();
 
     if (info->getEntry(0) != "")
-      return -ENOTEMPTY;
+      return recordedOp.finish(-ENOTEMPTY);
 
     ret = statPtr->pool->ioctx.remove(dirPath);
 
@@ -943,6 +2129,8 @@ Dir::remove()
   if (ret == 0)
     indexObject(&stat, statPtr, '-');
 
+  mPriv->radosFsPriv()->invalidateStat(dirPath);
+
   FsObj::refresh();
 
   if (info)
@@ -952,7 +2140,100 @@ Dir::remove()
 
   mPriv->radosFsPriv()->updateTMId(statPtr);
 
-  return ret;
+  return recordedOp.finish(ret);
+}
+
+/**
+ * Removes the directory asynchronously (see Dir::remove).
+ *
+ * @param[out] asyncOpId a string to return the operation's id, to be used
+ *             with Filesystem::sync, Filesystem::pollOp or
+ *             Filesystem::waitForAnyOp.
+ * @param callback a function to be called when the operation is finished.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @return 0 if the operation was scheduled.
+ * @note This instance must not be used or destroyed until the operation is
+ *       finished.
+ */
+int
+Dir::removeAsync(std::string *asyncOpId, AsyncOpCallback callback,
+                 void *callbackArg)
+{
+  const std::string &opId = mPriv->radosFsPriv()->runMetadataOpAsync(
+                              boost::bind(&Dir::remove, this),
+                              callback, callbackArg, asyncOpId != 0);
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  return 0;
+}
+
+/**
+ * Removes the directory and everything under it, asynchronously.
+ *
+ * The files are removed lazily (see Filesystem::setFileBackgroundLazyRemoval)
+ * and the subdirectories are handled in parallel by the generic worker threads.
+ * The entries are not removed one by one from the directories' indexes, since
+ * those are removed with the directories, deepest first. This directory is the
+ * last one to be removed, so if the operation fails it can simply be repeated.
+ *
+ * @param[out] asyncOpId a string to return the operation's id, to be used
+ *             with Filesystem::sync, Filesystem::pollOp,
+ *             Filesystem::waitForAnyOp or Filesystem::opProgress (which gives
+ *             the number of entries removed and found so far).
+ * @param callback a function to be called when the operation is finished.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @return 0 if the operation was scheduled.
+ * @note This instance must not be used or destroyed until the operation is
+ *       finished.
+ */
+int
+Dir::removeRecursive(std::string *asyncOpId, AsyncOpCallback callback,
+                     void *callbackArg)
+{
+  const std::string &opId = mPriv->radosFsPriv()->runTrackedMetadataOpAsync(
+                              boost::bind(&DirPriv::removeRecursive, mPriv,
+                                          _1),
+                              callback, callbackArg, asyncOpId != 0);
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  return 0;
+}
+
+/**
+ * Creates the directory asynchronously (see Dir::create).
+ *
+ * @param mode the permissions of the directory.
+ * @param mkpath whether the parent directories should be created if needed.
+ * @param owner the uid of the directory's owner.
+ * @param group the gid of the directory's owner.
+ * @param[out] asyncOpId a string to return the operation's id, to be used
+ *             with Filesystem::sync, Filesystem::pollOp or
+ *             Filesystem::waitForAnyOp.
+ * @param callback a function to be called when the operation is finished.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @return 0 if the operation was scheduled.
+ * @note This instance must not be used or destroyed until the operation is
+ *       finished. Many directories can be created in parallel by giving each
+ *       its own instance.
+ */
+int
+Dir::createAsync(int mode, bool mkpath, int owner, int group,
+                 std::string *asyncOpId, AsyncOpCallback callback,
+                 void *callbackArg)
+{
+  const std::string &opId = mPriv->radosFsPriv()->runMetadataOpAsync(
+                              boost::bind(&Dir::create, this, mode, mkpath,
+                                          owner, group),
+                              callback, callbackArg, asyncOpId != 0);
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  return 0;
 }
 
 /**
@@ -988,8 +2269,11 @@ Dir::refresh()
   {
     mPriv->dirInfo->update();
 
+    // Cached dirs are left to the background compaction if it is enabled, so
+    // the caller does not pay for rewriting the log
     const float ratio = mPriv->dirInfo->logRatio();
-    if (ratio != -1 && ratio <= filesystem()->dirCompactRatio())
+    if (ratio != -1 && ratio <= filesystem()->dirCompactRatio() &&
+        !(mPriv->cacheable && filesystem()->dirBackgroundCompaction()))
       compact();
 
     if (mPriv->cacheable)
@@ -1155,7 +2439,7 @@ Dir::compact()
 
   if (mPriv->dirInfo)
   {
-    mPriv->dirInfo->compactDirOpLog();
+    mPriv->dirInfo->compactDirOpLog(filesystem()->dirLogBinaryCompaction());
     return 0;
   }
 
@@ -1200,7 +2484,9 @@ Dir::setMetadata(const std::string &entry, const std::string &key,
       metadata[key] = value;
 
       int ret = indexObjectMetadata(ioctx, mPriv->dirInfo->inode(), entry,
-                                    metadata, '+');
+                                    metadata, '+',
+                                    mPriv->dirInfo->usesOmapIndex(),
+                                    mPriv->dirInfo->pool()->notifyDirChanges);
 
       mPriv->radosFsPriv()->updateTMId(mPriv->fsStat());
 
@@ -1324,7 +2610,8 @@ Dir::removeMetadata(const std::string &entry, const std::string &key)
 
       int ret = indexObjectMetadata(ioctx,
                                     mPriv->dirInfo->inode(), entry, metadata,
-                                    '-');
+                                    '-', mPriv->dirInfo->usesOmapIndex(),
+                                    mPriv->dirInfo->pool()->notifyDirChanges);
 
 
       mPriv->radosFsPriv()->updateTMId(mPriv->fsStat());
@@ -1394,34 +2681,10 @@ setupMtdFindArg(FinderArg &arg, Finder::FindOptions mtdType,
   return static_cast<Finder::FindOptions>(option);
 }
 
-/**
- * Finds the entries in the directory and subdirectories recursively and in
- * parallel.
- *
- * Check out the \ref usefindindir section for learning how to use this method.
- *
- * @param[out] results a set reference to return the paths found.
- * @param args the arguments for the find operation.
- * @return 0 on success, an error code otherwise.
- */
-int
-Dir::find(const std::string args, std::set<std::string> &results)
+static int
+parseFindArgs(const std::string &args, FinderPlan &plan)
 {
-  if (isLink())
-  {
-    if (mPriv->target)
-      return mPriv->target->find(args, results);
-
-    radosfs_debug("No target for link %s", path().c_str());
-    return -ENOLINK;
-  }
-
-  int ret = 0;
-  std::set<std::string> dirs, files, entries;
   std::map<Finder::FindOptions, FinderArg> finderArgs;
-
-  entries.insert(path());
-
   int startPos = 0, lastPos = 0;
   std::string key, value, op;
 
@@ -1529,11 +2792,95 @@ Dir::find(const std::string args, std::set<std::string> &results)
   if (finderArgs.size() == 0)
     return -EINVAL;
 
+  return plan.compile(finderArgs);
+}
+
+/**
+ * Finds the entries in the directory and subdirectories recursively and in
+ * parallel.
+ *
+ * Check out the \ref usefindindir section for learning how to use this method.
+ *
+ * @param[out] results a set reference to return the paths found.
+ * @param args the arguments for the find operation.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Dir::find(const std::string args, std::set<std::string> &results)
+{
+  RecordedOp recordedOp(&mPriv->radosFsPriv()->opRecorder,
+                        OpRecorder::OP_FIND, this);
+  if (isLink())
+  {
+    if (mPriv->target)
+      return recordedOp.finish(mPriv->target->find(args, results));
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return recordedOp.finish(-ENOLINK);
+  }
+
+  int ret = 0;
+  std::set<std::string> dirs, files, entries;
+  FinderPlan plan;
+
+  entries.insert(path());
+
+  ret = parseFindArgs(args, plan);
+
+  if (ret != 0)
+    return recordedOp.finish(ret);
+
   while (entries.size() != 0 &&
-         ((ret = mPriv->find(entries, results, finderArgs)) == 0))
+         ((ret = mPriv->find(entries, results, plan)) == 0))
   {}
 
-  return ret;
+  return recordedOp.finish(ret);
+}
+
+/**
+ * Finds the entries in the directory and subdirectories recursively and in
+ * parallel, handing each of them to the given callback as soon as it is found
+ * instead of waiting for the whole tree to be searched.
+ *
+ * The callback is never called from more than one thread at the same time; it
+ * should return true for the search to go on, or false for it to stop.
+ *
+ * @param args the arguments for the find operation (see Dir::find).
+ * @param callback the function to be called for every entry found.
+ * @param callbackArg the argument to be passed to the callback.
+ * @param maxResults the number of entries after which the search stops (0 means
+ *        no limit).
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Dir::find(const std::string args, FindCallback callback, void *callbackArg,
+          size_t maxResults)
+{
+  RecordedOp recordedOp(&mPriv->radosFsPriv()->opRecorder,
+                        OpRecorder::OP_FIND, this);
+  if (isLink())
+  {
+    if (mPriv->target)
+      return recordedOp.finish(mPriv->target->find(args, callback,
+                                                   callbackArg, maxResults));
+
+    radosfs_debug("No target for link %s", path().c_str());
+    return recordedOp.finish(-ENOLINK);
+  }
+
+  if (!callback)
+    return recordedOp.finish(-EINVAL);
+
+  FinderPlan plan;
+  int ret = parseFindArgs(args, plan);
+
+  if (ret != 0)
+    return recordedOp.finish(ret);
+
+  DirFindStream stream(mPriv->radosFsPriv(), plan, callback, callbackArg,
+                       maxResults);
+
+  return recordedOp.finish(stream.run(path()));
 }
 
 /**
@@ -1591,6 +2938,8 @@ Dir::chmod(long int permissions)
     ret = stat.pool->ioctx.omap_set(stat.translatedPath, omap);
   }
 
+  mPriv->radosFsPriv()->invalidateStat(path());
+
   return ret;
 }
 
@@ -1622,7 +2971,11 @@ Dir::chown(uid_t uid, gid_t gid)
   std::map<std::string, librados::bufferlist> omap;
   omap[XATTR_PERMISSIONS].append(permissions);
 
-  return fsStat.pool->ioctx.omap_set(fsStat.translatedPath, omap);
+  int ret = fsStat.pool->ioctx.omap_set(fsStat.translatedPath, omap);
+
+  mPriv->radosFsPriv()->invalidateStat(path());
+
+  return ret;
 }
 
 /**
@@ -1673,6 +3026,28 @@ Dir::setGid(gid_t gid)
  */
 int
 Dir::rename(const std::string &newName)
+{
+  return rename(newName, 0, 0);
+}
+
+/**
+ * Renames or moves the directory, reporting the progress of moving its tree.
+ *
+ * The subdirectories are moved in parallel, breadth-first. If moving the tree
+ * fails before all the dirs are in the new path, the new path objects are
+ * removed and the directory is kept in its old path, so the rename can be
+ * retried.
+ *
+ * @param newName the new path or name of the directory.
+ * @param callback a function called (never concurrently) every time the subdirs
+ *        of a dir have been moved, with that dir's old path, the number of dirs
+ *        moved so far and the number of dirs found so far.
+ * @param callbackArg a pointer to be passed to the callback.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Dir::rename(const std::string &newName, RenameProgressCallback callback,
+            void *callbackArg)
 {
   if (!exists())
     return -ENOENT;
@@ -1692,7 +3067,7 @@ Dir::rename(const std::string &newName)
 
   dest = getDirPath(sanitizePath(dest));
 
-  return mPriv->rename(dest);
+  return mPriv->rename(dest, callback, callbackArg);
 }
 
 /**
@@ -1770,6 +3145,10 @@ Dir::getTMId(std::string &id)
 
   id.clear();
 
+  // Pending TM ids are sent first so the id read reflects the changes
+  // already made
+  mPriv->radosFsPriv()->flushTMIds();
+
   Stat stat = *reinterpret_cast<Stat *>(fsStat());
 
   std::set<std::string> keys;
@@ -1894,4 +3273,85 @@ Dir::hasQuota() const
   return (mPriv->getQuotasXAttr(quotaXAttr) == 0) && !quotaXAttr.empty();
 }
 
+/**
+ * @class DirListing
+ *
+ * A cursor over the entries of a directory, set up by Dir::openListing.
+ */
+
+/**
+ * Creates a new listing that is not associated with any directory. Use
+ * Dir::openListing to set it up.
+ */
+DirListing::DirListing(void)
+{}
+
+DirListing::~DirListing(void)
+{}
+
+/**
+ * Gets the next batch of entries in the listing.
+ *
+ * @param[out] entries a vector where the entries will be appended, in sorted
+ *             order.
+ * @param batchSize the maximum number of entries to get.
+ * @return the number of entries appended (0 when the end of the listing has
+ *         been reached), or an error code otherwise.
+ */
+int
+DirListing::next(std::vector<std::string> &entries, size_t batchSize)
+{
+  if (!mPriv)
+    return -EBADF;
+
+  if (mPriv->atEnd || batchSize == 0)
+    return 0;
+
+  const size_t firstIndex = entries.size();
+
+  int ret = mPriv->dirInfo->listEntries(mPriv->lastEntry, batchSize, entries);
+
+  if (ret < 0)
+    return ret;
+
+  if ((size_t) ret < batchSize)
+    mPriv->atEnd = true;
+
+  if (ret > 0)
+    mPriv->lastEntry = entries.back();
+
+  if (mPriv->pathPrefix != "")
+  {
+    for (size_t i = firstIndex; i < entries.size(); i++)
+      entries[i] = mPriv->pathPrefix + entries[i];
+  }
+
+  return ret;
+}
+
+/**
+ * Checks whether all the entries in the listing have been read.
+ *
+ * @return true if the end of the listing has been reached (or the listing was
+ *         not opened), false otherwise.
+ */
+bool
+DirListing::atEnd(void) const
+{
+  return !mPriv || mPriv->atEnd;
+}
+
+/**
+ * Makes the listing start again from the first entry of the directory.
+ */
+void
+DirListing::rewind(void)
+{
+  if (mPriv)
+  {
+    mPriv->lastEntry = "";
+    mPriv->atEnd = false;
+  }
+}
+
 RADOS_FS_END_NAMESPACE
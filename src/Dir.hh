@@ -21,7 +21,10 @@
 #define RADOS_FS_DIR_HH
 
 #include <cstdlib>
+#include <map>
 #include <set>
+#include <tr1/memory>
+#include <vector>
 
 #include "Filesystem.hh"
 #include "Quota.hh"
@@ -30,10 +33,36 @@
 RADOS_FS_BEGIN_NAMESPACE
 
 class DirPriv;
+class DirListingPriv;
+
+class DirListing
+{
+public:
+  DirListing(void);
+
+  virtual ~DirListing(void);
+
+  int next(std::vector<std::string> &entries, size_t batchSize);
+
+  bool atEnd(void) const;
+
+  void rewind(void);
+
+private:
+  std::tr1::shared_ptr<DirListingPriv> mPriv;
+
+  friend class Dir;
+};
 
 class Dir : public virtual FsObj
 {
 public:
+  typedef bool (*FindCallback)(const std::string &path, void *args);
+
+  typedef void (*RenameProgressCallback)(const std::string &path,
+                                         size_t movedDirs, size_t foundDirs,
+                                         void *args);
+
   Dir(Filesystem *radosFs, const std::string &path);
 
   Dir(Filesystem *radosFs, const std::string &path, bool cacheable);
@@ -53,8 +82,35 @@ public:
              int ownerUid = -1,
              int ownerGid = -1);
 
+  int removeAsync(std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
+                  void *callbackArg = 0);
+
+  int removeRecursive(std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
+                      void *callbackArg = 0);
+
+  int createAsync(int mode = -1, bool mkPath = false, int ownerUid = -1,
+                  int ownerGid = -1, std::string *asyncOpId = 0,
+                  AsyncOpCallback callback = 0, void *callbackArg = 0);
+
+  int createFiles(const std::vector<std::string> &entries, int mode = -1,
+                  const std::string &pool = "", size_t chunk = 0);
+
+  int createDirs(const std::vector<std::string> &entries, int mode = -1);
+
   int entryList(std::set<std::string> &entries, bool withAbsolutePath=false);
 
+  int entryList(std::set<std::string> &entries, const std::string &startAfter,
+                size_t maxEntries, bool withAbsolutePath=false);
+
+  int entryListWithStat(std::map<std::string, struct stat> &entries,
+                        bool withAbsolutePath=false);
+
+  int openListing(DirListing &listing, bool withAbsolutePath=false);
+
+  int readSmallFiles(const std::vector<std::string> &entries,
+                     std::vector<std::string> &contents,
+                     std::vector<int> &retCodes);
+
   void refresh(void);
 
   int entry(int entryIndex, std::string &path);
@@ -84,6 +140,9 @@ public:
 
   int find(const std::string args, std::set<std::string> &results);
 
+  int find(const std::string args, FindCallback callback,
+           void *callbackArg = 0, size_t maxResults = 0);
+
   int chmod(long int permissions);
 
   int chown(uid_t uid, gid_t gid);
@@ -94,6 +153,9 @@ public:
 
   int rename(const std::string &newName);
 
+  int rename(const std::string &newName, RenameProgressCallback callback,
+             void *callbackArg = 0);
+
   int useTMId(bool useTMId);
 
   bool usingTMId(void);
@@ -113,6 +175,7 @@ private:
 
   friend class ::RadosFsTest;
   friend class DirPriv;
+  friend class Finder;
 };
 
 RADOS_FS_END_NAMESPACE
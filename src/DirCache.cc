@@ -23,19 +23,54 @@
 
 #include "radosfscommon.h"
 #include "DirCache.hh"
+#include "Logger.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
-DirCache::DirCache(const std::string &dirpath, PoolSP pool)
+class DirCacheWatcher : public librados::WatchCtx2
+{
+public:
+  DirCacheWatcher(DirCache *cache)
+    : mCache(cache)
+  {}
+
+  void handle_notify(uint64_t notifyId, uint64_t cookie, uint64_t notifierId,
+                     librados::bufferlist &bl)
+  {
+    mCache->handleNotify(notifyId, cookie, bl);
+  }
+
+  void handle_error(uint64_t cookie, int err)
+  {
+    mCache->handleWatchError(err);
+  }
+
+private:
+  DirCache *mCache;
+};
+
+DirCache::DirCache(const std::string &dirpath, PoolSP pool, bool omapIndex)
   : mInode(dirpath),
     mPool(pool),
+    mEntries(new DirEntryIndex),
     mLastCachedSize(0),
     mLastReadByte(0),
-    mLogNrLines(0)
+    mLogNrLines(0),
+    mOmapIndex(omapIndex),
+    mWatcher(0),
+    mRados(0),
+    mWatchHandle(0),
+    mWatching(false),
+    mChanged(false),
+    mCompacted(false),
+    mMetrics(0)
 {}
 
 DirCache::~DirCache()
-{}
+{
+  unwatch();
+  delete mWatcher;
+}
 
 int
 DirCache::getContentsSize(uint64_t *size) const
@@ -43,107 +78,242 @@ DirCache::getContentsSize(uint64_t *size) const
   return ioctx().stat(mInode, size, 0);
 }
 
+DirCacheContents::DirCacheContents(void)
+{}
+
+DirCacheContents::DirCacheContents(
+                              std::tr1::shared_ptr<const DirEntryIndex> index)
+  : mIndex(index)
+{}
+
+// Important: this method needs to be run in a scope where mContentsMutex is
+// locked
 void
-DirCache::parseContents(char *buff, int length)
+DirCache::applyRecord(DirLogRecord &record)
 {
-  std::istringstream iss(std::string(buff, length));
+  const std::string &name = record.name;
+
+  mLogNrLines++;
 
-  for (std::string line; getline(iss, line, '\n');)
+  DirEntryIndex::Entry *entry = mEntries->find(name);
+
+  if (!entry)
   {
-    int startPos = 0, lastPos = 0;
-    std::string key, name, value;
-    bool deleteEntry = false;
-    std::map<std::string, std::string> metadataToAdd;
-    std::set<std::string> metadataToDelete;
-    const int metadataPrefixLength = strlen(INDEX_METADATA_PREFIX) + 1;
-
-    while ((lastPos = splitToken(line, startPos, key, value)) != startPos)
-    {
-      if (key != "")
-      {
-        value = unescapeObjName(value);
-
-        if (key.compare(1, std::string::npos, INDEX_NAME_KEY) == 0)
-        {
-          name = value;
-
-          if (key[0] == '-')
-          {
-            deleteEntry = true;
-            break;
-          }
-        }
-        else if (key.compare(1,
-                             metadataPrefixLength,
-                             INDEX_METADATA_PREFIX ".") == 0)
-        {
-          const std::string metadataKey =
-              unescapeObjName(key.substr(metadataPrefixLength + 1));
-
-          if (key[0] == '-')
-            metadataToDelete.insert(metadataKey);
-          else
-            metadataToAdd[metadataKey] = value;
-        }
-      }
+    if (record.deleteEntry)
+      return;
 
-      startPos = lastPos;
-      key = value = "";
-    }
+    entry = mEntries->insert(name);
+  }
+  else if (record.deleteEntry)
+  {
+    mEntries->erase(entry);
+    return;
+  }
 
-    boost::unique_lock<boost::mutex> lock(mContentsMutex);
+  std::map<std::string, std::string>::const_iterator mapIt;
+  for (mapIt = record.metadataToAdd.begin();
+       mapIt != record.metadataToAdd.end();
+       mapIt++)
+  {
+    mEntries->setMetadata(entry, (*mapIt).first, (*mapIt).second);
+  }
 
-    mLogNrLines++;
+  std::set<std::string>::const_iterator setIt;
+  for (setIt = record.metadataToDelete.begin();
+       setIt != record.metadataToDelete.end();
+       setIt++)
+  {
+    mEntries->removeMetadata(entry, *setIt);
+  }
+}
 
-    if (mContents.count(name.c_str()) > 0)
-    {
-      if (deleteEntry)
-      {
-        mContents.erase(name.c_str());
-        mEntryNames.erase(name);
-      }
-      else
-      {
-        std::map<std::string, std::string>::iterator mapIt;
-        for (mapIt = metadataToAdd.begin(); mapIt != metadataToAdd.end(); mapIt++)
-        {
-          const std::string &mdKey = (*mapIt).first;
-          const std::string &mdValue = (*mapIt).second;
-          mContents[name].metadata[mdKey] = mdValue;
-        }
-
-        std::set<std::string>::iterator setIt;
-        for (setIt = metadataToDelete.begin(); setIt != metadataToDelete.end(); setIt++)
-        {
-          const std::string &mdKey = *setIt;
-
-          if (mContents[name].metadata.count(mdKey) > 0)
-            mContents[name].metadata.erase(mdKey);
-        }
-      }
-    }
-    else
+void
+DirCache::parseContents(const char *buff, size_t length)
+{
+  const char *pos = buff;
+  const char *end = buff + length;
+
+  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+
+  // Views of the current entries must not see the changes
+  if (!mEntries.unique())
+    mEntries.reset(new DirEntryIndex(*mEntries));
+
+  while (pos < end)
+  {
+    DirLogRecord record;
+
+    if (!parseDirLogRecord(&pos, end, record))
     {
-      DirEntry entry;
-      entry.name = name;
-      mContents[name] = entry;
-      mEntryNames.insert(name);
+      radosfs_debug_category(DIR_CACHE, "Malformed record in dir log %s",
+                             mInode.c_str());
+      break;
     }
+
+    if (record.name != "")
+      applyRecord(record);
   }
+
+  mEntries->commit();
 }
 
 int
 DirCache::update()
+{
+  boost::unique_lock<boost::mutex> lock(mUpdateMutex);
+
+  return updateContents();
+}
+
+int
+DirCache::watch(librados::Rados *rados)
+{
+  // Directories indexed in omap are not replayed so there is nothing to watch
+  if (mOmapIndex)
+    return 0;
+
+  boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+  if (mRados)
+    return 0;
+
+  if (!mWatcher)
+    mWatcher = new DirCacheWatcher(this);
+
+  mRados = rados;
+
+  int ret = mPool->ioctx.watch2(mInode, &mWatchHandle, mWatcher);
+
+  if (ret != 0)
+  {
+    // Keep checking the log's size in every update until it is watched
+    radosfs_debug_category(DIR_CACHE, "Failed to watch dir inode %s: %s",
+                           mInode.c_str(), strerror(-ret));
+    mRados = 0;
+    return ret;
+  }
+
+  mWatching = true;
+
+  // The log may have changed before the watch was registered
+  mChanged = true;
+
+  return 0;
+}
+
+void
+DirCache::unwatch(void)
+{
+  uint64_t handle;
+  librados::Rados *rados;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+    if (!mRados)
+      return;
+
+    rados = mRados;
+    handle = mWatchHandle;
+    mRados = 0;
+    mWatching = false;
+  }
+
+  mPool->ioctx.unwatch2(handle);
+
+  // Make sure that no notification callbacks are still running for this
+  // cache before it can be destroyed
+  rados->watch_flush();
+}
+
+bool
+DirCache::watching(void)
+{
+  boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+  return mRados != 0;
+}
+
+void
+DirCache::handleNotify(uint64_t notifyId, uint64_t cookie,
+                       librados::bufferlist &event)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+    mChanged = true;
+
+    if (std::string(event.c_str(), event.length()) == DIR_NOTIFY_COMPACTED)
+      mCompacted = true;
+  }
+
+  librados::bufferlist reply;
+  mPool->ioctx.notify_ack(mInode, notifyId, cookie, reply);
+}
+
+void
+DirCache::handleWatchError(int error)
+{
+  radosfs_debug_category(DIR_CACHE, "Lost the watch on dir inode %s: %s",
+                         mInode.c_str(), strerror(-error));
+
+  // Notifications may have been missed so the log has to be checked again and
+  // the watch is re-established in the next update
+  boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+  mWatching = false;
+  mChanged = true;
+  mCompacted = true;
+}
+
+// Important: this method needs to be run in a scope where mUpdateMutex is
+// locked
+int
+DirCache::updateContents(void)
 {
   uint64_t size;
 
+  // Directories indexed in omap are always queried directly so there is
+  // nothing to replay
+  if (mOmapIndex)
+    return 0;
+
+  bool compacted = false;
+
+  librados::Rados *rewatchRados = 0;
+  uint64_t lostHandle = 0;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mWatchMutex);
+
+    if (mWatching && !mChanged)
+      return 0;
+
+    // The watch was lost: the inode has to be watched again
+    if (mRados && !mWatching)
+    {
+      rewatchRados = mRados;
+      lostHandle = mWatchHandle;
+      mRados = 0;
+    }
+
+    compacted = mCompacted;
+    mChanged = mCompacted = false;
+  }
+
+  if (rewatchRados)
+  {
+    mPool->ioctx.unwatch2(lostHandle);
+    watch(rewatchRados);
+  }
+
   int ret = getContentsSize(&size);
 
   if (ret != 0)
     return ret;
 
   // If the dir has been compacted, we have to read it from scratch
-  if (size < mLastCachedSize)
+  if (compacted || size < mLastCachedSize)
   {
     clear();
   }
@@ -159,18 +329,22 @@ DirCache::update()
   }
 
   librados::bufferlist buff;
+  MetricsTimer timer(mMetrics, Metrics::OP_DIR_LOG_READ);
 
   ret = ioctx().read(mInode, buff, buffLength, mLastReadByte);
 
   if (ret > 0)
   {
     mLastReadByte = ret;
-    parseContents(buff.c_str(), buffLength);
+    parseContents(buff.c_str(), buff.length());
+
+    if (mMetrics)
+      mMetrics->add(Metrics::COUNTER_DIR_LOG_BYTES_PARSED, buff.length());
   }
   else
   {
     clear();
-    return ret;
+    return timer.finish(ret);
   }
 
   mLastCachedSize = mLastReadByte = size;
@@ -178,29 +352,151 @@ DirCache::update()
   return 0;
 }
 
+DirCacheContents
+DirCache::contents(void)
+{
+  if (!mOmapIndex)
+  {
+    boost::unique_lock<boost::mutex> lock(mContentsMutex);
+    return DirCacheContents(mEntries);
+  }
+
+  std::tr1::shared_ptr<DirEntryIndex> entries(new DirEntryIndex);
+  std::string startAfter("");
+
+  while (true)
+  {
+    std::vector<std::string> page;
+
+    int ret = listEntries(startAfter, DIR_OMAP_LIST_PAGE_SIZE, page);
+
+    if (ret <= 0)
+      break;
+
+    startAfter = page.back();
+
+    for (size_t i = 0; i < page.size(); i++)
+      entries->insert(page[i]);
+
+    if (ret < DIR_OMAP_LIST_PAGE_SIZE)
+      break;
+  }
+
+  entries->commit();
+
+  return DirCacheContents(entries);
+}
+
+int
+DirCache::listEntries(const std::string &startAfter, size_t maxEntries,
+                      std::set<std::string> &entries)
+{
+  std::vector<std::string> batch;
+
+  int ret = listEntries(startAfter, maxEntries, batch);
+
+  if (ret > 0)
+    entries.insert(batch.begin(), batch.end());
+
+  return ret;
+}
+
+int
+DirCache::listEntries(const std::string &startAfter, size_t maxEntries,
+                      std::vector<std::string> &entries)
+{
+  int numEntries = 0;
+
+  if (mOmapIndex)
+  {
+    std::map<std::string, librados::bufferlist> omap;
+    const std::string prefix(XATTR_DIR_ENTRY_PREFIX);
+    std::string startKey("");
+
+    if (startAfter != "")
+      startKey = makeDirEntryKey(startAfter);
+
+    int ret = ioctx().omap_get_vals(mInode, startKey, prefix, maxEntries,
+                                    &omap);
+
+    if (ret < 0)
+      return ret;
+
+    std::map<std::string, librados::bufferlist>::iterator it;
+    entries.reserve(entries.size() + omap.size());
+
+    for (it = omap.begin(); it != omap.end(); it++, numEntries++)
+      entries.push_back((*it).first.substr(prefix.length()));
+
+    return numEntries;
+  }
+
+  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+
+  size_t index = mEntries->upperBound(startAfter);
+
+  for (; index < mEntries->size() && (size_t) numEntries < maxEntries;
+       index++, numEntries++)
+  {
+    entries.push_back(mEntries->name(index));
+  }
+
+  return numEntries;
+}
+
 const std::string
 DirCache::getEntry(int index)
 {
   std::string entry("");
-  boost::unique_lock<boost::mutex> lock(mContentsMutex);
 
-  const int size = (int) mEntryNames.size();
-
-  if (index < size)
+  if (mOmapIndex)
   {
-    std::set<std::string>::iterator it = mEntryNames.begin();
-    std::advance(it, index);
+    std::set<std::string> page;
+    std::string startAfter("");
+
+    while (index >= 0)
+    {
+      page.clear();
+
+      int ret = listEntries(startAfter, DIR_OMAP_LIST_PAGE_SIZE, page);
+
+      if (ret <= 0)
+        break;
+
+      if (index < ret)
+      {
+        std::set<std::string>::iterator it = page.begin();
+        std::advance(it, index);
 
-    entry = *it;
+        entry = *it;
+        break;
+      }
+
+      index -= ret;
+      startAfter = *page.rbegin();
+    }
+
+    return entry;
   }
 
+  boost::unique_lock<boost::mutex> lock(mContentsMutex);
+
+  if (index >= 0 && (size_t) index < mEntries->size())
+    entry = mEntries->name(index);
+
   return entry;
 }
 
 void
-DirCache::compactDirOpLog(void)
+DirCache::compactDirOpLog(bool binaryFormat)
 {
-  update();
+  if (mOmapIndex)
+    return;
+
+  MetricsTimer timer(mMetrics, Metrics::OP_DIR_COMPACTION);
+  boost::unique_lock<boost::mutex> updateLock(mUpdateMutex);
+
+  updateContents();
 
   librados::ObjectWriteOperation omapWriteOp, writeOp;
   std::map<std::string, librados::bufferlist> omap;
@@ -211,32 +507,50 @@ DirCache::compactDirOpLog(void)
 
   ioctx().operate(mInode, &omapWriteOp);
 
-  std::map<std::string, DirEntry>::iterator it;
-  std::string compactContents;
+  librados::bufferlist compactContents;
+  boost::unique_lock<boost::mutex> contentsLock(mContentsMutex);
+  const DirEntryMetadata noMetadata;
 
-  for (it = mContents.begin(); it != mContents.end(); it++)
+  for (size_t i = 0; i < mEntries->size(); i++)
   {
-    const DirEntry &entry = (*it).second;
-    compactContents += '+';
-    compactContents += INDEX_NAME_KEY "=\"" + escapeObjName(entry.name) + "\" ";
+    const std::string name = mEntries->name(i);
+    const DirEntryMetadata *metadata = mEntries->metadata(i);
+
+    if (!metadata)
+      metadata = &noMetadata;
+
+    if (binaryFormat)
+    {
+      appendDirLogRecord(compactContents, '+', name, *metadata);
+      continue;
+    }
+
+    std::string line("+");
+    line += INDEX_NAME_KEY "=\"";
+    appendEscapedObjName(line, name);
+    line += "\" ";
 
     std::map<std::string, std::string>::const_iterator mdIt;
-    for (mdIt = entry.metadata.begin(); mdIt != entry.metadata.end(); mdIt++)
+    for (mdIt = metadata->begin(); mdIt != metadata->end(); mdIt++)
     {
-      compactContents += "+" + (*mdIt).first + "=\"" + (*mdIt).second + "\" ";
+      line += "+" INDEX_METADATA_PREFIX ".\"";
+      appendEscapedObjName(line, (*mdIt).first);
+      line += "\"=\"";
+      appendEscapedObjName(line, (*mdIt).second);
+      line += "\" ";
     }
 
-    compactContents += "\n";
+    line += "\n";
+    compactContents.append(line);
   }
 
+  const size_t numEntries = mEntries->size();
+  contentsLock.unlock();
+
   writeOp.truncate(0);
 
-  if (compactContents != "")
-  {
-    librados::bufferlist buff;
-    buff.append(compactContents);
-    writeOp.write_full(buff);
-  }
+  if (compactContents.length() > 0)
+    writeOp.write_full(compactContents);
 
   int cmpRet;
   std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
@@ -246,22 +560,36 @@ DirCache::compactDirOpLog(void)
   omapCmp[DIR_LOG_UPDATED] = cmp;
   writeOp.omap_cmp(omapCmp, &cmpRet);
 
-  ioctx().operate(mInode, &writeOp);
+  // If the log was appended to meanwhile, the comparison fails and nothing is
+  // written, so the new records will be read in the next update
+  if (ioctx().operate(mInode, &writeOp) != 0)
+    return;
 
-  uint64_t size;
+  // Use the length that was written rather than stat'ing the object, so
+  // records appended right after the compaction are not skipped
+  mLastCachedSize = mLastReadByte = compactContents.length();
 
-  getContentsSize(&size);
+  if (mPool->notifyDirChanges)
+    notifyDirChange(mPool->ioctx, mInode, DIR_NOTIFY_COMPACTED);
 
-  mLastCachedSize = mLastReadByte = size;
+  contentsLock.lock();
+  mLogNrLines = numEntries;
+}
+
+size_t
+DirCache::approximateSize(void)
+{
+  boost::unique_lock<boost::mutex> lock(mContentsMutex);
 
-  mLogNrLines = mContents.size();
+  return sizeof(DirCache) + sizeof(DirEntryIndex) + mInode.length() +
+      mEntries->approximateSize();
 }
 
 float
 DirCache::logRatio() const
 {
   if (mLogNrLines > 0)
-    return mContents.size() / (float) mLogNrLines;
+    return mEntries->size() / (float) mLogNrLines;
 
   return -1;
 }
@@ -270,9 +598,23 @@ bool
 DirCache::hasEntry(const std::string &entry)
 {
   bool entryExists(false);
+
+  if (mOmapIndex)
+  {
+    std::set<std::string> keys;
+    std::map<std::string, librados::bufferlist> omap;
+
+    keys.insert(makeDirEntryKey(entry));
+
+    if (ioctx().omap_get_vals_by_keys(mInode, keys, &omap) < 0)
+      return false;
+
+    return omap.size() > 0;
+  }
+
   boost::unique_lock<boost::mutex> lock(mContentsMutex);
 
-  entryExists = mContents.count(entry) > 0;
+  entryExists = mEntries->find(entry) != 0;
 
   return entryExists;
 }
@@ -283,15 +625,42 @@ DirCache::getMetadata(const std::string &entry,
                       std::string &value)
 {
   int ret = -ENOENT;
+
+  if (mOmapIndex)
+  {
+    std::set<std::string> keys;
+    std::map<std::string, librados::bufferlist> omap;
+    const std::string entryKey = makeDirEntryKey(entry);
+    const std::string mdKey = makeDirEntryMetadataPrefix(entry) + key;
+
+    keys.insert(entryKey);
+    keys.insert(mdKey);
+
+    ret = ioctx().omap_get_vals_by_keys(mInode, keys, &omap);
+
+    if (ret < 0)
+      return ret;
+
+    if (omap.count(entryKey) == 0 || omap.count(mdKey) == 0)
+      return -ENOENT;
+
+    librados::bufferlist &bl = omap[mdKey];
+    value = std::string(bl.c_str(), bl.length());
+
+    return 0;
+  }
+
   boost::unique_lock<boost::mutex> lock(mContentsMutex);
 
-  if (mContents.count(entry) > 0)
+  const DirEntryIndex::Entry *indexEntry = mEntries->find(entry);
+
+  if (indexEntry && indexEntry->metadata)
   {
-    std::map<std::string, std::string> &metadata = mContents[entry].metadata;
+    DirEntryMetadata::const_iterator it = indexEntry->metadata->find(key);
 
-    if (metadata.count(key) > 0)
+    if (it != indexEntry->metadata->end())
     {
-      value = metadata[key];
+      value = (*it).second;
       ret = 0;
     }
   }
@@ -304,12 +673,42 @@ DirCache::getMetadataMap(const std::string &entry,
                          std::map<std::string, std::string> &mtdMap)
 {
   int ret = -ENOENT;
+
+  if (mOmapIndex)
+  {
+    if (!hasEntry(entry))
+      return -ENOENT;
+
+    std::map<std::string, librados::bufferlist> omap;
+    const size_t prefixLength = makeDirEntryMetadataPrefix(entry).length();
+
+    librados::IoCtx ctx = ioctx();
+    ret = getDirEntryMetadata(ctx, mInode, entry, omap);
+
+    if (ret < 0)
+      return ret;
+
+    std::map<std::string, librados::bufferlist>::iterator it;
+    for (it = omap.begin(); it != omap.end(); it++)
+    {
+      librados::bufferlist &bl = (*it).second;
+      mtdMap[(*it).first.substr(prefixLength)] = std::string(bl.c_str(),
+                                                             bl.length());
+    }
+
+    return 0;
+  }
+
   boost::unique_lock<boost::mutex> lock(mContentsMutex);
-  std::map<std::string, DirEntry>::iterator it = mContents.find(entry);
+  const DirEntryIndex::Entry *indexEntry = mEntries->find(entry);
 
-  if (it != mContents.end())
+  if (indexEntry)
   {
-    mtdMap = (*it).second.metadata;
+    if (indexEntry->metadata)
+      mtdMap = *indexEntry->metadata;
+    else
+      mtdMap.clear();
+
     ret = 0;
   }
 
@@ -321,8 +720,12 @@ DirCache::clear(void)
 {
   boost::unique_lock<boost::mutex> lock(mContentsMutex);
 
-  mEntryNames.clear();
-  mContents.clear();
+  // Views of the entries keep them, the cache just starts a new index
+  if (mEntries.unique())
+    mEntries->clear();
+  else
+    mEntries.reset(new DirEntryIndex);
+
   mLastCachedSize = 0;
   mLastReadByte = 0;
   mLogNrLines = 0;
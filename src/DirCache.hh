@@ -24,31 +24,58 @@
 #include <set>
 #include <map>
 #include <string>
+#include <tr1/memory>
+#include <vector>
 #include <rados/librados.hpp>
 
 #include "radosfscommon.h"
 #include "radosfsdefines.h"
+#include "DirEntryIndex.hh"
+#include "DirLog.hh"
+#include "Metrics.hh"
+
+class RadosFsMicroBenchmark;
 
 RADOS_FS_BEGIN_NAMESPACE
 
-typedef struct
+class DirCacheWatcher;
+
+// A read-only view of a DirCache's entries (sorted by name) as they were when
+// it was taken. It shares the cache's index rather than copying it: the cache
+// only copies its index if it changes while there are views of it.
+class DirCacheContents
 {
-  std::string name;
-  std::map<std::string, std::string> metadata;
-} DirEntry;
+public:
+  DirCacheContents(void);
+  DirCacheContents(std::tr1::shared_ptr<const DirEntryIndex> index);
+
+  size_t size(void) const { return mIndex ? mIndex->size() : 0; }
+  bool empty(void) const { return size() == 0; }
+  std::string operator[](size_t index) const { return mIndex->name(index); }
+
+private:
+  std::tr1::shared_ptr<const DirEntryIndex> mIndex;
+};
 
 class DirCache
 {
 public:
-  DirCache(const std::string &inode, PoolSP pool);
+  DirCache(const std::string &inode, PoolSP pool, bool omapIndex = false);
   virtual ~DirCache(void);
 
   int update(void);
   const std::string getEntry(int index);
   librados::IoCtx ioctx(void) const { return mPool->ioctx; }
-  std::set<std::string> contents(void) const { return mEntryNames; }
+  DirCacheContents contents(void);
+  int listEntries(const std::string &startAfter, size_t maxEntries,
+                  std::set<std::string> &entries);
+  int listEntries(const std::string &startAfter, size_t maxEntries,
+                  std::vector<std::string> &entries);
+  size_t numCachedEntries(void) const { return mEntries->size(); }
+  size_t approximateSize(void);
+  bool usesOmapIndex(void) const { return mOmapIndex; }
   std::string inode(void) const { return mInode; }
-  void compactDirOpLog(void);
+  void compactDirOpLog(bool binaryFormat = false);
   float logRatio(void) const;
   bool hasEntry(const std::string &entry);
   int getMetadata(const std::string &entry,
@@ -57,19 +84,43 @@ public:
   int getMetadataMap(const std::string &entry,
                      std::map<std::string, std::string> &mtdMap);
   int getContentsSize(uint64_t *size) const;
+  PoolSP pool(void) const { return mPool; }
+  int watch(librados::Rados *rados);
+  void unwatch(void);
+  bool watching(void);
+  void handleNotify(uint64_t notifyId, uint64_t cookie,
+                    librados::bufferlist &event);
+  void handleWatchError(int error);
+  void setMetrics(Metrics *metrics) { mMetrics = metrics; }
 
 private:
-  void parseContents(char *buff, int length);
+  void parseContents(const char *buff, size_t length);
+  void applyRecord(DirLogRecord &record);
+  int updateContents(void);
   void clear(void);
 
   std::string mInode;
   PoolSP mPool;
-  std::map<std::string, DirEntry> mContents;
-  std::set<std::string> mEntryNames;
+  // Shared with the views returned by contents(), hence copied on write
+  std::tr1::shared_ptr<DirEntryIndex> mEntries;
   uint64_t mLastCachedSize;
   int mLastReadByte;
   boost::mutex mContentsMutex;
+  boost::mutex mUpdateMutex;
   size_t mLogNrLines;
+  bool mOmapIndex;
+  // When the dir inode is watched, the contents are only read again after a
+  // writer notifies a change (or the watch fails)
+  DirCacheWatcher *mWatcher;
+  librados::Rados *mRados;
+  uint64_t mWatchHandle;
+  bool mWatching;
+  bool mChanged;
+  bool mCompacted;
+  boost::mutex mWatchMutex;
+  Metrics *mMetrics;
+
+  friend class ::RadosFsMicroBenchmark;
 };
 
 RADOS_FS_END_NAMESPACE
@@ -0,0 +1,375 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <algorithm>
+
+#include "DirEntryIndex.hh"
+#include "radosfsdefines.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+struct EntryNameLess
+{
+  EntryNameLess(const std::string &arena)
+    : mArena(arena)
+  {}
+
+  bool operator()(const DirEntryIndex::Entry &entry,
+                  const DirEntryIndex::Entry &otherEntry) const
+  {
+    return mArena.compare(entry.nameOffset, entry.nameLength, mArena,
+                          otherEntry.nameOffset, otherEntry.nameLength) < 0;
+  }
+
+  const std::string &mArena;
+};
+
+static bool
+entryIsRemoved(const DirEntryIndex::Entry &entry)
+{
+  return entry.removed;
+}
+
+static size_t
+approximateMetadataSize(const std::string &key, const std::string &value)
+{
+  return key.length() + value.length() + DIR_CACHE_NODE_OVERHEAD;
+}
+
+DirEntryIndex::DirEntryIndex(void)
+  : mNumEntries(0),
+    mNumRemoved(0),
+    mDeadBytes(0),
+    mMetadataSize(0)
+{}
+
+DirEntryIndex::DirEntryIndex(const DirEntryIndex &otherIndex)
+  : mArena(otherIndex.mArena),
+    mEntries(otherIndex.mEntries),
+    mPending(otherIndex.mPending),
+    mPendingNames(otherIndex.mPendingNames),
+    mNumEntries(otherIndex.mNumEntries),
+    mNumRemoved(otherIndex.mNumRemoved),
+    mDeadBytes(otherIndex.mDeadBytes),
+    mMetadataSize(otherIndex.mMetadataSize)
+{
+  // The metadata is owned by each index so it needs to be copied too
+  for (size_t i = 0; i < mEntries.size(); i++)
+  {
+    if (mEntries[i].metadata)
+      mEntries[i].metadata = new DirEntryMetadata(*mEntries[i].metadata);
+  }
+
+  for (size_t i = 0; i < mPending.size(); i++)
+  {
+    if (mPending[i].metadata)
+      mPending[i].metadata = new DirEntryMetadata(*mPending[i].metadata);
+  }
+}
+
+DirEntryIndex::~DirEntryIndex(void)
+{
+  clear();
+}
+
+std::string
+DirEntryIndex::entryName(const Entry &entry) const
+{
+  return mArena.substr(entry.nameOffset, entry.nameLength);
+}
+
+int
+DirEntryIndex::compare(const Entry &entry, const std::string &name) const
+{
+  return mArena.compare(entry.nameOffset, entry.nameLength, name);
+}
+
+// Gets the position of the first committed entry (removed or not) whose name
+// is not lower than the given one
+size_t
+DirEntryIndex::lowerBound(const std::string &name) const
+{
+  size_t first = 0, last = mEntries.size();
+
+  while (first < last)
+  {
+    const size_t middle = first + (last - first) / 2;
+
+    if (compare(mEntries[middle], name) < 0)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+
+  return first;
+}
+
+DirEntryIndex::Entry *
+DirEntryIndex::find(const std::string &name)
+{
+  return const_cast<Entry *>(
+        static_cast<const DirEntryIndex *>(this)->find(name));
+}
+
+const DirEntryIndex::Entry *
+DirEntryIndex::find(const std::string &name) const
+{
+  const size_t pos = lowerBound(name);
+
+  if (pos < mEntries.size() && compare(mEntries[pos], name) == 0)
+    return mEntries[pos].removed ? 0 : &mEntries[pos];
+
+  std::map<std::string, size_t>::const_iterator it = mPendingNames.find(name);
+
+  if (it != mPendingNames.end())
+    return &mPending[(*it).second];
+
+  return 0;
+}
+
+// Adds an entry that does not exist (see find). The returned entry is only
+// valid until the next insertion or commit.
+DirEntryIndex::Entry *
+DirEntryIndex::insert(const std::string &name)
+{
+  const size_t pos = lowerBound(name);
+
+  mNumEntries++;
+
+  // An entry removed in this batch is still in place, so it is just restored
+  if (pos < mEntries.size() && compare(mEntries[pos], name) == 0)
+  {
+    Entry &entry = mEntries[pos];
+    entry.removed = false;
+    mNumRemoved--;
+    mDeadBytes -= entry.nameLength;
+
+    return &entry;
+  }
+
+  Entry entry;
+  entry.nameOffset = mArena.length();
+  entry.nameLength = name.length();
+  entry.removed = false;
+  entry.metadata = 0;
+
+  mArena.append(name);
+  mPendingNames[name] = mPending.size();
+  mPending.push_back(entry);
+
+  return &mPending.back();
+}
+
+void
+DirEntryIndex::erase(Entry *entry)
+{
+  if (entry->removed)
+    return;
+
+  freeMetadata(*entry);
+
+  entry->removed = true;
+  mNumEntries--;
+  mDeadBytes += entry->nameLength;
+
+  if (!mPending.empty() && entry >= &mPending.front() &&
+      entry <= &mPending.back())
+  {
+    mPendingNames.erase(entryName(*entry));
+  }
+  else
+  {
+    mNumRemoved++;
+  }
+}
+
+void
+DirEntryIndex::setMetadata(Entry *entry, const std::string &key,
+                           const std::string &value)
+{
+  if (!entry->metadata)
+  {
+    entry->metadata = new DirEntryMetadata;
+    mMetadataSize += DIR_CACHE_NODE_OVERHEAD;
+  }
+
+  DirEntryMetadata::iterator it = entry->metadata->find(key);
+
+  if (it != entry->metadata->end())
+  {
+    mMetadataSize -= approximateMetadataSize((*it).first, (*it).second);
+    (*it).second = value;
+  }
+  else
+  {
+    (*entry->metadata)[key] = value;
+  }
+
+  mMetadataSize += approximateMetadataSize(key, value);
+}
+
+void
+DirEntryIndex::removeMetadata(Entry *entry, const std::string &key)
+{
+  if (!entry->metadata)
+    return;
+
+  DirEntryMetadata::iterator it = entry->metadata->find(key);
+
+  if (it == entry->metadata->end())
+    return;
+
+  mMetadataSize -= approximateMetadataSize((*it).first, (*it).second);
+  entry->metadata->erase(it);
+
+  if (entry->metadata->empty())
+    freeMetadata(*entry);
+}
+
+void
+DirEntryIndex::freeMetadata(Entry &entry)
+{
+  if (!entry.metadata)
+    return;
+
+  DirEntryMetadata::const_iterator it;
+  for (it = entry.metadata->begin(); it != entry.metadata->end(); it++)
+    mMetadataSize -= approximateMetadataSize((*it).first, (*it).second);
+
+  mMetadataSize -= DIR_CACHE_NODE_OVERHEAD;
+
+  delete entry.metadata;
+  entry.metadata = 0;
+}
+
+// Merges the entries added since the last commit into the sorted vector and
+// drops the removed ones from it
+void
+DirEntryIndex::commit(void)
+{
+  if (!mPending.empty() || mNumRemoved > 0)
+  {
+    mEntries.erase(std::remove_if(mEntries.begin(), mEntries.end(),
+                                  entryIsRemoved),
+                   mEntries.end());
+
+    const size_t numCommitted = mEntries.size();
+
+    mPending.erase(std::remove_if(mPending.begin(), mPending.end(),
+                                  entryIsRemoved),
+                   mPending.end());
+
+    EntryNameLess less(mArena);
+    std::sort(mPending.begin(), mPending.end(), less);
+
+    mEntries.insert(mEntries.end(), mPending.begin(), mPending.end());
+    std::inplace_merge(mEntries.begin(), mEntries.begin() + numCommitted,
+                       mEntries.end(), less);
+
+    // The pending entries may have been the whole contents of the dir, so
+    // their memory is released rather than kept for the next batch
+    std::vector<Entry>().swap(mPending);
+    mPendingNames.clear();
+    mNumRemoved = 0;
+
+    if (mEntries.capacity() > 2 * mEntries.size())
+      std::vector<Entry>(mEntries).swap(mEntries);
+  }
+
+  if (mDeadBytes > mArena.length() / 2)
+    compactArena();
+}
+
+// Important: this method needs to be run only after committing
+void
+DirEntryIndex::compactArena(void)
+{
+  std::string arena;
+  arena.reserve(mArena.length() - mDeadBytes);
+
+  for (size_t i = 0; i < mEntries.size(); i++)
+  {
+    Entry &entry = mEntries[i];
+    const size_t offset = arena.length();
+
+    arena.append(mArena, entry.nameOffset, entry.nameLength);
+    entry.nameOffset = offset;
+  }
+
+  mArena.swap(arena);
+  mDeadBytes = 0;
+}
+
+void
+DirEntryIndex::clear(void)
+{
+  for (size_t i = 0; i < mEntries.size(); i++)
+    delete mEntries[i].metadata;
+
+  for (size_t i = 0; i < mPending.size(); i++)
+    delete mPending[i].metadata;
+
+  std::string().swap(mArena);
+  std::vector<Entry>().swap(mEntries);
+  std::vector<Entry>().swap(mPending);
+  mPendingNames.clear();
+  mNumEntries = mNumRemoved = mDeadBytes = mMetadataSize = 0;
+}
+
+std::string
+DirEntryIndex::name(size_t index) const
+{
+  return entryName(mEntries[index]);
+}
+
+const DirEntryMetadata *
+DirEntryIndex::metadata(size_t index) const
+{
+  return mEntries[index].metadata;
+}
+
+// Gets the position of the first committed entry whose name is greater than
+// the given one
+size_t
+DirEntryIndex::upperBound(const std::string &name) const
+{
+  size_t first = 0, last = mEntries.size();
+
+  while (first < last)
+  {
+    const size_t middle = first + (last - first) / 2;
+
+    if (compare(mEntries[middle], name) <= 0)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+
+  return first;
+}
+
+size_t
+DirEntryIndex::approximateSize(void) const
+{
+  return mArena.capacity() +
+      (mEntries.capacity() + mPending.capacity()) * sizeof(Entry) +
+      mPendingNames.size() * DIR_CACHE_NODE_OVERHEAD + mMetadataSize;
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,98 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __DIR_ENTRY_INDEX_HH__
+#define __DIR_ENTRY_INDEX_HH__
+
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+typedef std::map<std::string, std::string> DirEntryMetadata;
+
+// Keeps the entries of a directory compactly, for dirs with millions of them:
+// the names are stored one after the other in a single buffer (the arena) and
+// the entries are a sorted vector of small fixed-size records pointing into
+// it. The metadata of an entry is only allocated if it has any.
+// Changes are applied in batches: entries that are added are kept apart until
+// commit() merges them into the sorted vector, and removed ones are only
+// dropped from it then, so the position based methods (name, upperBound) are
+// only meant to be used after committing.
+class DirEntryIndex
+{
+public:
+  struct Entry
+  {
+    size_t nameOffset;
+    u_int32_t nameLength;
+    bool removed;
+    DirEntryMetadata *metadata;
+  };
+
+  DirEntryIndex(void);
+  DirEntryIndex(const DirEntryIndex &otherIndex);
+  virtual ~DirEntryIndex(void);
+
+  Entry * find(const std::string &name);
+  const Entry * find(const std::string &name) const;
+  Entry * insert(const std::string &name);
+  void erase(Entry *entry);
+  void setMetadata(Entry *entry, const std::string &key,
+                   const std::string &value);
+  void removeMetadata(Entry *entry, const std::string &key);
+  void commit(void);
+  void clear(void);
+
+  size_t size(void) const { return mNumEntries; }
+  std::string name(size_t index) const;
+  const DirEntryMetadata * metadata(size_t index) const;
+  size_t upperBound(const std::string &name) const;
+  size_t approximateSize(void) const;
+
+private:
+  DirEntryIndex & operator=(const DirEntryIndex &otherIndex);
+
+  std::string entryName(const Entry &entry) const;
+  int compare(const Entry &entry, const std::string &name) const;
+  size_t lowerBound(const std::string &name) const;
+  void compactArena(void);
+  void freeMetadata(Entry &entry);
+
+  std::string mArena;
+  std::vector<Entry> mEntries;
+  // Entries added since the last commit and where to find them by name
+  std::vector<Entry> mPending;
+  std::map<std::string, size_t> mPendingNames;
+  size_t mNumEntries;
+  size_t mNumRemoved;
+  size_t mDeadBytes;
+  size_t mMetadataSize;
+
+  friend struct EntryNameLess;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __DIR_ENTRY_INDEX_HH__ */
@@ -0,0 +1,216 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include "DirInodeCache.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+DirInodeCache::DirInodeCache(size_t maxEntries, double negativeTtl)
+  : mMaxEntries(maxEntries),
+    mNegativeTtl(negativeTtl)
+{}
+
+DirInodeCache::~DirInodeCache(void)
+{}
+
+DirInodeCache::Shard &
+DirInodeCache::shard(const std::string &path)
+{
+  return mShards[hash(path.c_str()) % DIR_INODE_CACHE_NUM_SHARDS];
+}
+
+size_t
+DirInodeCache::shardMaxEntries(void) const
+{
+  return std::max(mMaxEntries / DIR_INODE_CACHE_NUM_SHARDS, (size_t) 1);
+}
+
+bool
+DirInodeCache::get(const std::string &path, Inode &inode, bool *negative)
+{
+  Shard &pathShard = shard(path);
+  boost::unique_lock<boost::mutex> lock(pathShard.mutex);
+
+  EntryMap::iterator it = pathShard.entries.find(path);
+
+  if (it == pathShard.entries.end())
+    return false;
+
+  EntryList::iterator entryIt = (*it).second;
+
+  if ((*entryIt).negative)
+  {
+    boost::chrono::duration<double> age =
+        boost::chrono::steady_clock::now() - (*entryIt).cachedTime;
+
+    if (age.count() >= mNegativeTtl)
+    {
+      pathShard.lru.erase(entryIt);
+      pathShard.entries.erase(it);
+      return false;
+    }
+  }
+
+  pathShard.lru.splice(pathShard.lru.begin(), pathShard.lru, entryIt);
+
+  inode = (*entryIt).inode;
+  *negative = (*entryIt).negative;
+
+  return true;
+}
+
+void
+DirInodeCache::set(const std::string &path, const Inode &inode)
+{
+  setEntry(path, inode, false);
+}
+
+void
+DirInodeCache::setNegative(const std::string &path)
+{
+  if (mNegativeTtl <= 0)
+    return;
+
+  setEntry(path, Inode(), true);
+}
+
+void
+DirInodeCache::setEntry(const std::string &path, const Inode &inode,
+                        bool negative)
+{
+  Shard &pathShard = shard(path);
+  boost::unique_lock<boost::mutex> lock(pathShard.mutex);
+
+  EntryMap::iterator it = pathShard.entries.find(path);
+
+  if (it != pathShard.entries.end())
+  {
+    pathShard.lru.erase((*it).second);
+    pathShard.entries.erase(it);
+  }
+
+  CacheEntry entry;
+  entry.path = path;
+  entry.inode = inode;
+  entry.negative = negative;
+  entry.cachedTime = boost::chrono::steady_clock::now();
+
+  pathShard.lru.push_front(entry);
+  pathShard.entries[path] = pathShard.lru.begin();
+
+  evict(pathShard);
+}
+
+// Important: this method needs to be run in a scope where shard.mutex is
+// locked
+void
+DirInodeCache::evict(Shard &shard)
+{
+  const size_t maxEntries = shardMaxEntries();
+
+  while (shard.entries.size() > maxEntries)
+  {
+    shard.entries.erase(shard.lru.back().path);
+    shard.lru.pop_back();
+  }
+}
+
+void
+DirInodeCache::rename(const std::string &oldPath, const std::string &newPath)
+{
+  Inode inode;
+  bool found = false;
+
+  {
+    Shard &oldShard = shard(oldPath);
+    boost::unique_lock<boost::mutex> lock(oldShard.mutex);
+
+    EntryMap::iterator it = oldShard.entries.find(oldPath);
+
+    if (it != oldShard.entries.end())
+    {
+      found = !(*(*it).second).negative;
+      inode = (*(*it).second).inode;
+
+      oldShard.lru.erase((*it).second);
+      oldShard.entries.erase(it);
+    }
+  }
+
+  if (found)
+    set(newPath, inode);
+  else
+    remove(newPath);
+}
+
+void
+DirInodeCache::remove(const std::string &path)
+{
+  Shard &pathShard = shard(path);
+  boost::unique_lock<boost::mutex> lock(pathShard.mutex);
+
+  EntryMap::iterator it = pathShard.entries.find(path);
+
+  if (it != pathShard.entries.end())
+  {
+    pathShard.lru.erase((*it).second);
+    pathShard.entries.erase(it);
+  }
+}
+
+void
+DirInodeCache::clear(void)
+{
+  for (size_t i = 0; i < DIR_INODE_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+
+    mShards[i].lru.clear();
+    mShards[i].entries.clear();
+  }
+}
+
+void
+DirInodeCache::setMaxEntries(size_t maxEntries)
+{
+  mMaxEntries = maxEntries;
+
+  for (size_t i = 0; i < DIR_INODE_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+    evict(mShards[i]);
+  }
+}
+
+size_t
+DirInodeCache::size(void)
+{
+  size_t numEntries = 0;
+
+  for (size_t i = 0; i < DIR_INODE_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+    numEntries += mShards[i].entries.size();
+  }
+
+  return numEntries;
+}
+
+RADOS_FS_END_NAMESPACE
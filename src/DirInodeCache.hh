@@ -0,0 +1,86 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __DIR_INODE_CACHE_HH__
+#define __DIR_INODE_CACHE_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <string>
+#include <tr1/unordered_map>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// A bounded cache of directory paths to their inodes, split into shards by
+// path. Besides the inodes it also remembers, for a short time, the paths that
+// were not found so that repeated lookups do not hit the metadata pool.
+class DirInodeCache
+{
+public:
+  DirInodeCache(size_t maxEntries, double negativeTtl);
+  virtual ~DirInodeCache(void);
+
+  bool get(const std::string &path, Inode &inode, bool *negative);
+  void set(const std::string &path, const Inode &inode);
+  void setNegative(const std::string &path);
+  void rename(const std::string &oldPath, const std::string &newPath);
+  void remove(const std::string &path);
+  void clear(void);
+  void setMaxEntries(size_t maxEntries);
+  size_t maxEntries(void) const { return mMaxEntries; }
+  void setNegativeTtl(double ttl) { mNegativeTtl = ttl; }
+  double negativeTtl(void) const { return mNegativeTtl; }
+  size_t size(void);
+
+private:
+  struct CacheEntry
+  {
+    std::string path;
+    Inode inode;
+    bool negative;
+    boost::chrono::steady_clock::time_point cachedTime;
+  };
+
+  typedef std::list<CacheEntry> EntryList;
+  typedef std::tr1::unordered_map<std::string, EntryList::iterator> EntryMap;
+
+  struct Shard
+  {
+    EntryList lru;
+    EntryMap entries;
+    boost::mutex mutex;
+  };
+
+  Shard & shard(const std::string &path);
+  size_t shardMaxEntries(void) const;
+  void setEntry(const std::string &path, const Inode &inode, bool negative);
+  void evict(Shard &shard);
+
+  Shard mShards[DIR_INODE_CACHE_NUM_SHARDS];
+  size_t mMaxEntries;
+  double mNegativeTtl;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __DIR_INODE_CACHE_HH__ */
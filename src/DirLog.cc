@@ -0,0 +1,486 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <regex.h>
+
+#include "DirLog.hh"
+#include "radosfsstrings.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+uint32_t
+readUint32(const char *buff)
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(buff);
+
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+      ((uint32_t) bytes[3] << 24);
+}
+
+// Reads a length-prefixed string starting at *pos without going past end.
+// On success, *pos is moved to the first byte after the string.
+bool
+readLengthPrefixed(const char **pos, const char *end, std::string &str)
+{
+  if (end - *pos < 4)
+    return false;
+
+  const uint32_t length = readUint32(*pos);
+  *pos += 4;
+
+  if ((uint32_t) (end - *pos) < length)
+    return false;
+
+  str.assign(*pos, length);
+  *pos += length;
+
+  return true;
+}
+
+void
+appendUint32(std::string &buff, uint32_t value)
+{
+  buff += (char) (value & 0xff);
+  buff += (char) ((value >> 8) & 0xff);
+  buff += (char) ((value >> 16) & 0xff);
+  buff += (char) ((value >> 24) & 0xff);
+}
+
+void
+appendLengthPrefixed(std::string &buff, const std::string &str)
+{
+  appendUint32(buff, str.length());
+  buff += str;
+}
+
+static void
+parseTextRecord(const std::string &line, DirLogRecord &record)
+{
+  int startPos = 0, lastPos = 0;
+  std::string key, value;
+  const int metadataPrefixLength = strlen(INDEX_METADATA_PREFIX) + 1;
+
+  while ((lastPos = splitToken(line, startPos, key, value)) != startPos)
+  {
+    if (key != "")
+    {
+      value = unescapeObjName(value);
+
+      if (key.compare(1, std::string::npos, INDEX_NAME_KEY) == 0)
+      {
+        record.name = value;
+
+        if (key[0] == '-')
+        {
+          record.deleteEntry = true;
+          break;
+        }
+      }
+      else if (key.compare(1,
+                           metadataPrefixLength,
+                           INDEX_METADATA_PREFIX ".") == 0)
+      {
+        const std::string metadataKey =
+            unescapeObjName(key.substr(metadataPrefixLength + 1));
+
+        if (key[0] == '-')
+          record.metadataToDelete.insert(metadataKey);
+        else
+          record.metadataToAdd[metadataKey] = value;
+      }
+    }
+
+    startPos = lastPos;
+    key = value = "";
+  }
+}
+
+static bool
+parseBinaryRecord(const char *buff, size_t length, DirLogRecord &record)
+{
+  const char *pos = buff;
+  const char *end = buff + length;
+  std::string key, value;
+
+  if (!readLengthPrefixed(&pos, end, record.name))
+    return false;
+
+  if (end - pos < 4)
+    return false;
+
+  uint32_t numMetadata = readUint32(pos);
+  pos += 4;
+
+  for (uint32_t i = 0; i < numMetadata; i++)
+  {
+    if (pos == end)
+      return false;
+
+    const char op = *pos++;
+
+    if (!readLengthPrefixed(&pos, end, key) ||
+        !readLengthPrefixed(&pos, end, value))
+    {
+      return false;
+    }
+
+    if (op == '-')
+      record.metadataToDelete.insert(key);
+    else
+      record.metadataToAdd[key] = value;
+  }
+
+  return true;
+}
+
+/**
+ * Parses the dir log record (in the text or binary format) that starts at
+ * \a pos, moving it to the start of the next record.
+ *
+ * @return false if the record is truncated or malformed, true otherwise. A
+ *         record without a name (e.g. an empty line) is not an error.
+ */
+bool
+parseDirLogRecord(const char **pos, const char *end, DirLogRecord &record)
+{
+  record.deleteEntry = false;
+
+  if (**pos == DIR_LOG_RECORD_VERSION)
+  {
+    if (end - *pos < DIR_LOG_RECORD_HEADER_SIZE)
+      return false;
+
+    const char op = (*pos)[1];
+    const uint32_t payloadLength = readUint32(*pos + 2);
+    *pos += DIR_LOG_RECORD_HEADER_SIZE;
+
+    if ((uint32_t) (end - *pos) < payloadLength ||
+        !parseBinaryRecord(*pos, payloadLength, record))
+    {
+      return false;
+    }
+
+    *pos += payloadLength;
+    record.deleteEntry = (op == '-');
+  }
+  else
+  {
+    const char *lineEnd = (const char *) memchr(*pos, '\n', end - *pos);
+
+    if (lineEnd == 0)
+      lineEnd = end;
+
+    parseTextRecord(std::string(*pos, lineEnd - *pos), record);
+    *pos = lineEnd + 1;
+  }
+
+  return true;
+}
+
+/**
+ * Replays the whole given log into the entries it describes (the names and
+ * their metadata).
+ *
+ * @return false if a malformed record was found (the entries up to it are
+ *         still set), true otherwise.
+ */
+bool
+replayDirLog(const char *buff, size_t length, DirLogEntries &entries)
+{
+  const char *pos = buff;
+  const char *end = buff + length;
+
+  while (pos < end)
+  {
+    DirLogRecord record;
+
+    if (!parseDirLogRecord(&pos, end, record))
+      return false;
+
+    if (record.name == "")
+      continue;
+
+    if (record.deleteEntry)
+    {
+      entries.erase(record.name);
+      continue;
+    }
+
+    std::map<std::string, std::string> &metadata = entries[record.name];
+
+    std::map<std::string, std::string>::iterator it;
+    for (it = record.metadataToAdd.begin(); it != record.metadataToAdd.end();
+         it++)
+    {
+      metadata[(*it).first] = (*it).second;
+    }
+
+    std::set<std::string>::iterator setIt;
+    for (setIt = record.metadataToDelete.begin();
+         setIt != record.metadataToDelete.end();
+         setIt++)
+    {
+      metadata.erase(*setIt);
+    }
+  }
+
+  return true;
+}
+
+void
+encodeDirLogQuery(const std::vector<DirLogPredicate> &predicates,
+                  std::string &buff)
+{
+  appendUint32(buff, predicates.size());
+
+  for (size_t i = 0; i < predicates.size(); i++)
+  {
+    const DirLogPredicate &predicate = predicates[i];
+
+    appendUint32(buff, predicate.type);
+    appendUint32(buff, predicate.cmp);
+    buff += (char) predicate.numeric;
+    buff += (char) predicate.icase;
+    appendLengthPrefixed(buff, predicate.key);
+    appendLengthPrefixed(buff, predicate.value);
+  }
+}
+
+bool
+decodeDirLogQuery(const char *buff, size_t length,
+                  std::vector<DirLogPredicate> &predicates)
+{
+  const char *pos = buff;
+  const char *end = buff + length;
+
+  if (end - pos < 4)
+    return false;
+
+  uint32_t numPredicates = readUint32(pos);
+  pos += 4;
+
+  for (uint32_t i = 0; i < numPredicates; i++)
+  {
+    DirLogPredicate predicate;
+
+    if (end - pos < 10)
+      return false;
+
+    predicate.type = readUint32(pos);
+    predicate.cmp = readUint32(pos + 4);
+    predicate.numeric = pos[8] != 0;
+    predicate.icase = pos[9] != 0;
+    pos += 10;
+
+    if (!readLengthPrefixed(&pos, end, predicate.key) ||
+        !readLengthPrefixed(&pos, end, predicate.value))
+    {
+      return false;
+    }
+
+    predicates.push_back(predicate);
+  }
+
+  return true;
+}
+
+static void
+appendStringList(std::string &buff, const std::vector<std::string> &list)
+{
+  appendUint32(buff, list.size());
+
+  for (size_t i = 0; i < list.size(); i++)
+    appendLengthPrefixed(buff, list[i]);
+}
+
+static bool
+readStringList(const char **pos, const char *end,
+               std::vector<std::string> &list)
+{
+  if (end - *pos < 4)
+    return false;
+
+  uint32_t numStrings = readUint32(*pos);
+  *pos += 4;
+
+  for (uint32_t i = 0; i < numStrings; i++)
+  {
+    std::string str;
+
+    if (!readLengthPrefixed(pos, end, str))
+      return false;
+
+    list.push_back(str);
+  }
+
+  return true;
+}
+
+void
+encodeDirLogQueryResult(const std::vector<std::string> &matches,
+                        const std::vector<std::string> &dirs,
+                        std::string &buff)
+{
+  appendStringList(buff, matches);
+  appendStringList(buff, dirs);
+}
+
+bool
+decodeDirLogQueryResult(const char *buff, size_t length,
+                        std::vector<std::string> &matches,
+                        std::vector<std::string> &dirs)
+{
+  const char *pos = buff;
+  const char *end = buff + length;
+
+  return readStringList(&pos, end, matches) && readStringList(&pos, end, dirs);
+}
+
+static bool
+compareNum(int cmp, float value, float expected)
+{
+  return ((cmp & DIR_LOG_CMP_EQ) && value == expected) ||
+         ((cmp & DIR_LOG_CMP_NE) && value != expected) ||
+         ((cmp & DIR_LOG_CMP_LT) && value < expected) ||
+         ((cmp & DIR_LOG_CMP_GT) && value > expected);
+}
+
+static bool
+matchesRegex(int cmp, const regex_t *regex, const std::string &value)
+{
+  // An expression that could not be compiled never matches
+  if (!regex)
+    return false;
+
+  const bool found = regexec(regex, value.c_str(), 0, 0, 0) == 0;
+
+  return ((cmp & DIR_LOG_CMP_EQ) && found) || ((cmp & DIR_LOG_CMP_NE) && !found);
+}
+
+static bool
+matchesPredicate(const DirLogPredicate &predicate, const regex_t *regex,
+                 const std::string &name,
+                 const std::map<std::string, std::string> &metadata)
+{
+  if (predicate.type == DIR_LOG_PREDICATE_NAME)
+    return matchesRegex(predicate.cmp, regex, name);
+
+  std::map<std::string, std::string>::const_iterator it;
+
+  if (predicate.key.empty())
+  {
+    if (!regex)
+      return false;
+
+    bool found = false;
+
+    for (it = metadata.begin(); it != metadata.end() && !found; it++)
+      found = regexec(regex, (*it).first.c_str(), 0, 0, 0) == 0;
+
+    return ((predicate.cmp & DIR_LOG_CMP_EQ) && found) ||
+           ((predicate.cmp & DIR_LOG_CMP_NE) && !found);
+  }
+
+  it = metadata.find(predicate.key);
+
+  if (it == metadata.end())
+    return false;
+
+  if (predicate.numeric)
+  {
+    return compareNum(predicate.cmp, atof((*it).second.c_str()),
+                      atof(predicate.value.c_str()));
+  }
+
+  return matchesRegex(predicate.cmp, regex, (*it).second);
+}
+
+/**
+ * Runs the given predicates over the entries of a dir log.
+ *
+ * @param[out] matches the names of the entries that match all the predicates.
+ * @param[out] dirs the names of all the subdirectories, matching or not (so
+ *        the search can go on in them).
+ * @return 0 on success, -EINVAL if there are no predicates.
+ */
+int
+runDirLogQuery(const DirLogEntries &entries,
+               const std::vector<DirLogPredicate> &predicates,
+               std::vector<std::string> &matches,
+               std::vector<std::string> &dirs)
+{
+  if (predicates.empty())
+    return -EINVAL;
+
+  std::vector<regex_t *> regexes(predicates.size(), (regex_t *) 0);
+
+  for (size_t i = 0; i < predicates.size(); i++)
+  {
+    const DirLogPredicate &predicate = predicates[i];
+
+    if (predicate.numeric || predicate.value.empty())
+      continue;
+
+    regex_t *regex = new regex_t;
+
+    if (regcomp(regex, predicate.value.c_str(),
+                predicate.icase ? REG_ICASE : 0) == 0)
+    {
+      regexes[i] = regex;
+    }
+    else
+    {
+      delete regex;
+    }
+  }
+
+  DirLogEntries::const_iterator it;
+  for (it = entries.begin(); it != entries.end(); it++)
+  {
+    const std::string &name = (*it).first;
+
+    if (name[name.length() - 1] == PATH_SEP)
+      dirs.push_back(name);
+
+    bool matched = true;
+
+    for (size_t i = 0; i < predicates.size() && matched; i++)
+      matched = matchesPredicate(predicates[i], regexes[i], name, (*it).second);
+
+    if (matched)
+      matches.push_back(name);
+  }
+
+  for (size_t i = 0; i < regexes.size(); i++)
+  {
+    if (regexes[i])
+    {
+      regfree(regexes[i]);
+      delete regexes[i];
+    }
+  }
+
+  return 0;
+}
+
+RADOS_FS_END_NAMESPACE
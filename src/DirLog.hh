@@ -0,0 +1,116 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __DIR_LOG_HH__
+#define __DIR_LOG_HH__
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "radosfsdefines.h"
+
+// The format of the directories' logs and the queries that can be run over
+// them. Nothing here depends on librados, so it is also built into the object
+// class that runs the queries on the OSDs.
+
+RADOS_FS_BEGIN_NAMESPACE
+
+typedef struct
+{
+  std::string name;
+  bool deleteEntry;
+  std::map<std::string, std::string> metadataToAdd;
+  std::set<std::string> metadataToDelete;
+} DirLogRecord;
+
+typedef std::map<std::string, std::map<std::string, std::string> >
+DirLogEntries;
+
+enum DirLogPredicateType
+{
+  DIR_LOG_PREDICATE_NAME = 0,
+  DIR_LOG_PREDICATE_MTD
+};
+
+enum DirLogPredicateCmp
+{
+  DIR_LOG_CMP_EQ = 1 << 0,
+  DIR_LOG_CMP_NE = 1 << 1,
+  DIR_LOG_CMP_LT = 1 << 2,
+  DIR_LOG_CMP_GT = 1 << 3
+};
+
+struct DirLogPredicate
+{
+  DirLogPredicate(void)
+    : type(DIR_LOG_PREDICATE_NAME),
+      cmp(DIR_LOG_CMP_EQ),
+      numeric(false),
+      icase(false)
+  {}
+
+  int type;
+  int cmp;
+  // The metadata key whose value is checked; if empty, value is an expression
+  // for the keys that should (or should not) be present
+  std::string key;
+  std::string value;
+  bool numeric;
+  bool icase;
+};
+
+uint32_t readUint32(const char *buff);
+
+bool readLengthPrefixed(const char **pos, const char *end, std::string &str);
+
+void appendUint32(std::string &buff, uint32_t value);
+
+void appendLengthPrefixed(std::string &buff, const std::string &str);
+
+bool parseDirLogRecord(const char **pos, const char *end,
+                       DirLogRecord &record);
+
+bool replayDirLog(const char *buff, size_t length, DirLogEntries &entries);
+
+void encodeDirLogQuery(const std::vector<DirLogPredicate> &predicates,
+                       std::string &buff);
+
+bool decodeDirLogQuery(const char *buff, size_t length,
+                       std::vector<DirLogPredicate> &predicates);
+
+void encodeDirLogQueryResult(const std::vector<std::string> &matches,
+                             const std::vector<std::string> &dirs,
+                             std::string &buff);
+
+bool decodeDirLogQueryResult(const char *buff, size_t length,
+                             std::vector<std::string> &matches,
+                             std::vector<std::string> &dirs);
+
+int runDirLogQuery(const DirLogEntries &entries,
+                   const std::vector<DirLogPredicate> &predicates,
+                   std::vector<std::string> &matches,
+                   std::vector<std::string> &dirs);
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __DIR_LOG_HH__ */
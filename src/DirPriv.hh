@@ -20,11 +20,14 @@
 #ifndef RADOS_FS_DIR_PRIV_HH
 #define RADOS_FS_DIR_PRIV_HH
 
+#include <deque>
 #include <tr1/memory>
 
 #include "radosfsdefines.h"
 #include "DirCache.hh"
+#include "FileIO.hh"
 #include "Finder.hh"
+#include "WorkScheduler.hh"
 #include "Quota.hh"
 #include "QuotaPriv.hh"
 
@@ -57,13 +60,21 @@ public:
 
   int find(std::set<std::string> &entries,
            std::set<std::string> &results,
-           const std::map<Finder::FindOptions, FinderArg> &args);
+           const FinderPlan &plan);
 
   FilesystemPriv *radosFsPriv(void);
 
-  int rename(const std::string &newName);
+  int rename(const std::string &newName,
+             Dir::RenameProgressCallback callback = 0,
+             void *callbackArg = 0);
 
-  int moveDirTreeObjects(const Stat *oldDir, const Stat *newDir);
+  int checkNewEntries(const std::vector<std::string> &entries);
+
+  int removeRecursive(AsyncOpSP asyncOp);
+
+  int moveDirTreeObjects(const Stat *oldDir, const Stat *newDir,
+                         Dir::RenameProgressCallback callback,
+                         void *callbackArg, bool *committed);
 
   std::string getQuotaName(void) const;
 
@@ -82,6 +93,172 @@ public:
   bool cacheable;
 };
 
+// Runs a find operation that hands the results to a callback as they are found.
+// Every directory is searched in its own job, posted as soon as the directory
+// is listed, so there is no waiting for a whole level of the tree to finish
+// before going deeper.
+class DirFindStream : public FinderListener
+{
+public:
+  DirFindStream(FilesystemPriv *fsPriv, const FinderPlan &plan,
+                Dir::FindCallback callback, void *callbackArg,
+                size_t maxResults);
+
+  void onDir(const std::string &path);
+
+  bool onResult(const std::string &path);
+
+  bool cancelled(void);
+
+  int run(const std::string &path);
+
+private:
+  void findInDir(const std::string path);
+
+  FilesystemPriv *fsPriv;
+  Finder finder;
+  const FinderPlan &plan;
+  Dir::FindCallback callback;
+  void *callbackArg;
+  size_t maxResults;
+  size_t numResults;
+  int numJobs;
+  int retCode;
+  bool stopped;
+  uid_t uid;
+  gid_t gid;
+  WorkScheduler::Priority priority;
+  boost::mutex mutex;
+  boost::condition_variable cond;
+};
+
+// Walks a directory tree breadth-first in the generic worker threads, with up
+// to DIR_TREE_WALK_MAX_JOBS directories being handled at the same time. Each
+// directory is listed and its subdirs (not links to dirs) statted in its own
+// job, which then calls processDir with the names of the other entries and the
+// subdirs. Only the subdirs left in the vector by processDir are walked; the
+// walk stops at the first error. When walk is called from a worker thread
+// (e.g. by an asynchronous rename or removal), the directories are handled
+// one by one in that thread instead, since waiting for jobs queued behind it
+// would deadlock once every worker does the same.
+class DirTreeWalk
+{
+public:
+  DirTreeWalk(FilesystemPriv *fsPriv);
+
+  virtual ~DirTreeWalk(void);
+
+  int walk(const Stat &dir);
+
+protected:
+  virtual int processDir(const Stat &dir,
+                         const std::vector<std::string> &entries,
+                         std::vector<Stat> &subDirs) = 0;
+
+  FilesystemPriv *fsPriv;
+  boost::mutex mutex;
+
+private:
+  void walkDir(const Stat dir);
+
+  int listDir(const Stat &dir, std::vector<std::string> &entries,
+              std::vector<Stat> &subDirs);
+
+  void scheduleJobs(void);
+
+  std::deque<Stat> pending;
+  int numJobs;
+  int retCode;
+  bool runInline;
+  boost::condition_variable cond;
+};
+
+// Moves the path objects of a whole directory tree to a new path, creating the
+// new path objects of each directory's subdirs in a batch. The old path
+// objects are only removed once the whole tree has been copied; if anything
+// fails before that, the new ones are removed instead and the old tree is left
+// as it was.
+class DirTreeMove : public DirTreeWalk
+{
+public:
+  DirTreeMove(FilesystemPriv *fsPriv, Dir::RenameProgressCallback callback,
+              void *callbackArg);
+
+  int run(const Stat &oldDir, const Stat &newDir, bool *committed);
+
+protected:
+  int processDir(const Stat &dir, const std::vector<std::string> &entries,
+                 std::vector<Stat> &subDirs);
+
+private:
+  int removePathObjects(const std::vector<Stat> &stats);
+
+  Dir::RenameProgressCallback callback;
+  void *callbackArg;
+  std::string oldRoot;
+  std::string newRoot;
+  std::vector<Stat> oldDirs;
+  std::vector<Stat> newDirs;
+  size_t foundDirs;
+};
+
+// Adds or removes a quota from all the dirs in a tree (except its root),
+// updating the quotas of each directory's subdirs in a batch
+class DirQuotaUpdate : public DirTreeWalk
+{
+public:
+  DirQuotaUpdate(FilesystemPriv *fsPriv, const Quota &quota, bool add);
+
+protected:
+  int processDir(const Stat &dir, const std::vector<std::string> &entries,
+                 std::vector<Stat> &subDirs);
+
+private:
+  const Quota &quota;
+  bool add;
+};
+
+// Removes a whole directory tree. The files in each directory are dropped
+// lazily (see FileIO::setLazyRemoval) without being removed from the
+// directory's index, since that goes away with the directory; the directories
+// are then removed deepest first, and the root of the tree is the last one to
+// go, so a removal that fails can be run again.
+class DirTreeRemoval : public DirTreeWalk
+{
+public:
+  DirTreeRemoval(FilesystemPriv *fsPriv, AsyncOpSP asyncOp);
+
+  int run(const Stat &dir, const Stat *parentStat);
+
+protected:
+  int processDir(const Stat &dir, const std::vector<std::string> &entries,
+                 std::vector<Stat> &subDirs);
+
+private:
+  int removeFiles(const Stat &dir, const std::vector<std::string> &entries);
+
+  int removeDirs(const std::vector<Stat> &dirs);
+
+  AsyncOpSP asyncOp;
+  uid_t uid;
+  gid_t gid;
+  std::vector<Stat> dirs;
+  u_int64_t numFound;
+  u_int64_t numRemoved;
+};
+
+class DirListingPriv
+{
+public:
+  DirListingPriv(std::tr1::shared_ptr<DirCache> dirInfo,
+                 const std::string &pathPrefix);
+
+  std::tr1::shared_ptr<DirCache> dirInfo;
+  std::string pathPrefix;
+  std::string lastEntry;
+  bool atEnd;
+};
+
 RADOS_FS_END_NAMESPACE
 
 #endif /* RADOS_FS_DIR_PRIV_HH */
@@ -30,6 +30,24 @@
 
 RADOS_FS_BEGIN_NAMESPACE
 
+// Gets the lowest offset and the total length of the given intervals, so a
+// vectored read or write is recorded as a single one
+template <typename T>
+static void
+getIntervalsExtent(const std::vector<T> &intervals, uint64_t *offset,
+                   uint64_t *length)
+{
+  *offset = *length = 0;
+
+  for (size_t i = 0; i < intervals.size(); i++)
+  {
+    if (i == 0 || (uint64_t) intervals[i].offset < *offset)
+      *offset = intervals[i].offset;
+
+    *length += intervals[i].length;
+  }
+}
+
 FilePriv::FilePriv(File *fsFile, File::OpenMode mode)
   : fsFile(fsFile),
     target(0),
@@ -73,7 +91,7 @@ FilePriv::updatePath()
 
   updatePermissions();
 
-  inode->mPriv->io.reset();
+  inode->mPriv->releaseFileIO();
 
   if (!fsFile->exists())
   {
@@ -117,7 +135,7 @@ FilePriv::updatePath()
   {
     inode->mPriv->setFileIO(radosFs->mPriv->getOrCreateFileIO(stat->translatedPath,
                                                               stat));
-    if (inlineBufferSize > 0)
+    if (inlineBufferSize > 0 && inode->mPriv->io)
     {
       const Stat *parentStat = parentFsStat();
       inode->mPriv->io->setInlineBuffer(parentStat, fsFile->path(),
@@ -215,12 +233,15 @@ FilePriv::fsStat(void)
   return reinterpret_cast<Stat *>(fsFile->fsStat());
 }
 
+// Gets the stat of the parent of \a destination (following a link if it is
+// one) and the real path of the destination, checking that the current user
+// can write in the parent
 int
-FilePriv::rename(const std::string &destination)
+FilePriv::statDestination(const std::string &destination, Stat &parentStat,
+                          std::string &newPath)
 {
   int index;
   int ret;
-  Stat stat, parentStat;
   std::string destParent = getParentDir(destination, &index);
   std::string baseName;
 
@@ -270,7 +291,24 @@ FilePriv::rename(const std::string &destination)
     }
   }
 
-  const std::string &newPath = destParent + baseName;
+  newPath = destParent + baseName;
+
+  return 0;
+}
+
+int
+FilePriv::rename(const std::string &destination)
+{
+  Stat stat, parentStat;
+  std::string newPath;
+
+  if (!inode->mPriv->io)
+    return -ENODEV;
+
+  int ret = statDestination(destination, parentStat, newPath);
+
+  if (ret != 0)
+    return ret;
 
   ret = fsFile->filesystem()->mPriv->stat(newPath, &stat);
 
@@ -294,6 +332,9 @@ FilePriv::rename(const std::string &destination)
 
   ret = moveLogicalFile(*oldParentStat, parentStat, fsFile->path(), newPath);
 
+  getFsPriv()->invalidateStat(fsFile->path());
+  getFsPriv()->invalidateStat(newPath);
+
   if (ret != 0)
     return ret;
 
@@ -307,6 +348,88 @@ FilePriv::rename(const std::string &destination)
   return ret;
 }
 
+int
+FilePriv::copy(const std::string &destination)
+{
+  Stat stat, parentStat;
+  std::string newPath;
+  uid_t uid;
+  gid_t gid;
+
+  int ret = statDestination(destination, parentStat, newPath);
+
+  if (ret != 0)
+    return ret;
+
+  fsFile->filesystem()->getIds(&uid, &gid);
+
+  if (!statBuffHasPermission(parentStat.statBuff, uid, gid, O_WRONLY))
+    return -EACCES;
+
+  ret = getFsPriv()->stat(newPath, &stat);
+
+  if (ret == 0)
+    return S_ISDIR(stat.statBuff.st_mode) ? -EISDIR : -EEXIST;
+  else if (ret != -ENOENT)
+    return ret;
+
+  // The copy keeps the layout of the file (pool, chunk size, inline buffer
+  // size, striping, etc.) but gets a new inode and belongs to the current user
+  timespec spec;
+  clock_gettime(CLOCK_REALTIME, &spec);
+
+  stat = *fsStat();
+  stat.path = newPath;
+  stat.translatedPath = generateUuid();
+  stat.statBuff.st_uid = uid;
+  stat.statBuff.st_gid = gid;
+  stat.statBuff.st_ctim = spec;
+  stat.statBuff.st_ctime = spec.tv_sec;
+
+  FileIOSP destIO = getFsPriv()->getOrCreateFileIO(stat.translatedPath, &stat);
+
+  if (!getFileIO() || !destIO)
+    return -ENODEV;
+
+  ret = getFileIO()->copyTo(*destIO);
+
+  if (ret != 0)
+    return ret;
+
+  Stat *srcParentStat = parentFsStat();
+  const std::string inlineBufferKey =
+      XATTR_FILE_INLINE_BUFFER + fsFile->path().substr(parentDir.length());
+  std::set<std::string> keys;
+  std::map<std::string, librados::bufferlist> omap;
+
+  keys.insert(inlineBufferKey);
+
+  ret = srcParentStat->pool->ioctx.omap_get_vals_by_keys(
+                                      srcParentStat->translatedPath, keys,
+                                      &omap);
+
+  if (ret == 0)
+  {
+    ret = indexFileWithInlineBuffer(&parentStat, &stat,
+                                    omap[inlineBufferKey]);
+
+    if (ret == -ECANCELED)
+      ret = -EEXIST;
+  }
+
+  getFsPriv()->invalidateStat(newPath);
+
+  if (ret != 0)
+  {
+    destIO->remove();
+    return ret;
+  }
+
+  getFsPriv()->updateTMId(&stat);
+
+  return 0;
+}
+
 void
 FilePriv::setInode(const size_t chunkSize)
 {
@@ -316,6 +439,10 @@ FilePriv::setInode(const size_t chunkSize)
                                         generateUuid(),
                                         fsFile->path(),
                                         chunk));
+  fileIO->setStripePools(getFsPriv()->getStripePools(fsFile->path(),
+                                                     dataPool));
+  fileIO->setCompression(getFsPriv()->shouldCompress(fsFile->path()));
+  fileIO->setTrackAllocatedChunks(true);
   inode->mPriv->setFileIO(fileIO);
   fsFile->filesystem()->mPriv->setFileIO(fileIO);
 
@@ -327,9 +454,17 @@ FilePriv::setInode(const size_t chunkSize)
 }
 
 int
-FilePriv::create(int mode, uid_t uid, gid_t gid, size_t chunk, Stat *fileStatRet)
+FilePriv::create(int mode, uid_t uid, gid_t gid, size_t chunk,
+                 size_t sizeHint, Stat *fileStatRet)
 {
-  setInode(chunk ? chunk : fsFile->filesystem()->fileChunkSize());
+  MetricsTimer timer(&getFsPriv()->metrics, Metrics::OP_CREATE);
+  TraceSpan span(&getFsPriv()->tracer, "create_file", "file", true);
+
+  if (span.active())
+    span.setDetail(fsFile->path());
+
+  setInode(getFsPriv()->chooseChunkSize(fsFile->path(), dataPool, chunk,
+                                        sizeHint));
   Stat *parentStat = parentFsStat();
 
   int ret = inode->mPriv->registerFileWithStats(fsFile->path(), uid, gid, mode,
@@ -338,7 +473,7 @@ FilePriv::create(int mode, uid_t uid, gid_t gid, size_t chunk, Stat *fileStatRet
 
   getFsPriv()->updateTMId(fsStat());
 
-  return ret;
+  return timer.finish(ret);
 }
 
 /**
@@ -443,16 +578,18 @@ File::mode() const
 ssize_t
 File::read(char *buff, off_t offset, size_t blen)
 {
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder, OpRecorder::OP_READ,
+                        this, offset, blen);
   int ret;
   if ((ret = mPriv->verifyExistanceAndType()) != 0)
-    return ret;
+    return recordedOp.finish(ret);
 
   ret = -EACCES;
 
   if (mPriv->permissions & File::MODE_READ)
   {
     if (isLink())
-      return mPriv->target->read(buff, offset, blen);
+      return recordedOp.finish(mPriv->target->read(buff, offset, blen));
 
     ret = mPriv->inode->read(buff, offset, blen);
 
@@ -464,7 +601,7 @@ File::read(char *buff, off_t offset, size_t blen)
     }
   }
 
-  return ret;
+  return recordedOp.finish(ret);
 }
 
 /**
@@ -485,21 +622,27 @@ int
 File::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
            AsyncOpCallback callback, void *callbackArg)
 {
+  uint64_t offset, length;
+  getIntervalsExtent(intervals, &offset, &length);
+
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder, OpRecorder::OP_READ,
+                        this, offset, length);
   int ret;
   if ((ret = mPriv->verifyExistanceAndType()) != 0)
-    return ret;
+    return recordedOp.finish(ret);
 
   ret = -EACCES;
 
   if (mPriv->permissions & File::MODE_READ)
   {
     if (isLink())
-      return mPriv->target->read(intervals, asyncOpId, callback, callbackArg);
+      return recordedOp.finish(mPriv->target->read(intervals, asyncOpId,
+                                                   callback, callbackArg));
 
     ret = mPriv->inode->read(intervals, asyncOpId, callback, callbackArg);
   }
 
-  return ret;
+  return recordedOp.finish(ret);
 }
 
 /**
@@ -514,33 +657,42 @@ File::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
  * @param callback an AsyncOpCallback to be called after the asynchronous
  *        operation is finished
  * @param callbackArg a pointer to the user arguments that will be passed to the
- *        \a callback .
+ *        \a callback and \a bufferCallback .
+ * @param bufferCallback an AsyncOpBufferCallback to be called when \a buff is
+ *        no longer used by the write operation (and can be reused or freed).
+ *        If \a copyBuffer is true, this happens right after the buffer is
+ *        copied, otherwise the buffer is used directly by the operation and is
+ *        only released once the data is written.
  * @return 0 if the operation was initialized, an error code otherwise.
  */
 int
 File::write(const char *buff, off_t offset, size_t blen, bool copyBuffer,
             std::string *asyncOpId, AsyncOpCallback callback,
-            void *callbackArg)
+            void *callbackArg, AsyncOpBufferCallback bufferCallback)
 {
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder, OpRecorder::OP_WRITE,
+                        this, offset, blen);
   int ret;
   if ((ret = mPriv->verifyExistanceAndType()) != 0)
-    return ret;
+    return recordedOp.finish(ret);
 
   if (mPriv->permissions & File::MODE_WRITE)
   {
     if (isLink())
-      return mPriv->target->write(buff, offset, blen, copyBuffer, asyncOpId,
-                                  callback, callbackArg);
+      return recordedOp.finish(mPriv->target->write(buff, offset, blen,
+                                                    copyBuffer, asyncOpId,
+                                                    callback, callbackArg,
+                                                    bufferCallback));
 
     ret = mPriv->inode->write(buff, offset, blen, copyBuffer, asyncOpId,
-                               callback, callbackArg);
+                               callback, callbackArg, bufferCallback);
 
     mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
 
-    return ret;
+    return recordedOp.finish(ret);
   }
 
-  return -EACCES;
+  return recordedOp.finish(-EACCES);
 }
 
 /**
@@ -554,23 +706,74 @@ File::write(const char *buff, off_t offset, size_t blen, bool copyBuffer,
 int
 File::writeSync(const char *buff, off_t offset, size_t blen)
 {
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder,
+                        OpRecorder::OP_WRITE_SYNC, this, offset, blen);
   int ret;
   if ((ret = mPriv->verifyExistanceAndType()) != 0)
-    return ret;
+    return recordedOp.finish(ret);
 
   if (mPriv->permissions & File::MODE_WRITE)
   {
     if (isLink())
-      return mPriv->target->writeSync(buff, offset, blen);
+      return recordedOp.finish(mPriv->target->writeSync(buff, offset, blen));
 
     ret = mPriv->inode->writeSync(buff, offset, blen);
 
     mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
 
-    return ret;
+    return recordedOp.finish(ret);
   }
 
-  return -EACCES;
+  return recordedOp.finish(-EACCES);
+}
+
+/**
+ * Writes several intervals to the file asynchronously, as a single operation.
+ *
+ * This is the counterpart of the vectored File::read: the intervals are grouped
+ * per chunk so each chunk they affect is written with a single operation, and
+ * the file size is only updated once (instead of once for each call to
+ * File::write). Intervals that overlap are applied in the order they are given.
+ *
+ * @see FileWriteData.
+ * @param intervals a vector of FileWriteData objects describing the data to
+ *        write. Their buffers are copied so they can be reused or freed as
+ *        soon as this method returns.
+ * @param[out] asyncOpId a string location to return the id of the
+ *             asynchonous operation (or a null pointer in case none should be
+ *             returned).
+ * @param callback a function to be called upon the end of the write operation.
+ * @param callbackArg a pointer representing user-defined argumetns, to be
+ *        passed to the \a callback.
+ * @return 0 if the operation was initialized, an error code otherwise.
+ */
+int
+File::write(const std::vector<FileWriteData> &intervals, std::string *asyncOpId,
+            AsyncOpCallback callback, void *callbackArg)
+{
+  uint64_t offset, length;
+  getIntervalsExtent(intervals, &offset, &length);
+
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder, OpRecorder::OP_WRITE,
+                        this, offset, length);
+  int ret;
+  if ((ret = mPriv->verifyExistanceAndType()) != 0)
+    return recordedOp.finish(ret);
+
+  if (mPriv->permissions & File::MODE_WRITE)
+  {
+    if (isLink())
+      return recordedOp.finish(mPriv->target->write(intervals, asyncOpId,
+                                                    callback, callbackArg));
+
+    ret = mPriv->inode->write(intervals, asyncOpId, callback, callbackArg);
+
+    mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
+
+    return recordedOp.finish(ret);
+  }
+
+  return recordedOp.finish(-EACCES);
 }
 
 /**
@@ -589,6 +792,9 @@ File::writeSync(const char *buff, off_t offset, size_t blen)
  * @param inlineBufferSize the size for the file's inline buffer. Use this
  *        argument to override the default inline buffer's size (which is
  *        128 KB).
+ * @param sizeHint the size the file is expected to get (in bytes), if known.
+ *        When no \a stripe size is given, it is used to pick one that fits
+ *        the file (see Filesystem::setFileChunkSizePolicy).
  *
  * @note If a value of 0 is given to \a inlineBufferSize, then no inline buffer
  *       will be used and file stripes will always be created when writing to
@@ -597,16 +803,18 @@ File::writeSync(const char *buff, off_t offset, size_t blen)
  */
 int
 File::create(int mode, const std::string pool, size_t chunk,
-             ssize_t inlineBufferSize)
+             ssize_t inlineBufferSize, size_t sizeHint)
 {
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder,
+                        OpRecorder::OP_CREATE_FILE, this, 0, sizeHint);
   int ret;
 
   if (mPriv->dataPool.get() == 0)
-    return -ENODEV;
+    return recordedOp.finish(-ENODEV);
 
   Stat *parentStat = mPriv->parentFsStat();
   if (!parentStat || !parentStat->pool)
-    return -ENOENT;
+    return recordedOp.finish(-ENOENT);
 
   if (pool != "")
     mPriv->updateDataPool(pool);
@@ -615,7 +823,7 @@ File::create(int mode, const std::string pool, size_t chunk,
   const std::string filePath = path();
   if ((exists() && !isFile()) ||
       (filePath != "" && isDirPath(filePath)))
-    return -EISDIR;
+    return recordedOp.finish(-EISDIR);
 
   if (exists())
   {
@@ -625,19 +833,19 @@ File::create(int mode, const std::string pool, size_t chunk,
     }
     else
     {
-      return -EEXIST;
+      return recordedOp.finish(-EEXIST);
     }
   }
 
   if ((mPriv->permissions & File::MODE_WRITE) == 0)
-    return -EACCES;
+    return recordedOp.finish(-EACCES);
 
   if (inlineBufferSize > MAX_FILE_INLINE_BUFFER_SIZE)
   {
     radosfs_debug("Error: Cannot create a file with an inline size > %u. The "
                   "given size was %u.", MAX_FILE_INLINE_BUFFER_SIZE,
                   inlineBufferSize);
-    return -EINVAL;
+    return recordedOp.finish(-EINVAL);
   }
 
   uid_t uid;
@@ -649,7 +857,7 @@ File::create(int mode, const std::string pool, size_t chunk,
     mPriv->inlineBufferSize = inlineBufferSize;
 
   Stat fileStat;
-  ret = mPriv->create(mode, uid, gid, chunk, &fileStat);
+  ret = mPriv->create(mode, uid, gid, chunk, sizeHint, &fileStat);
 
   if (ret == 0)
   {
@@ -658,7 +866,7 @@ File::create(int mode, const std::string pool, size_t chunk,
     mPriv->updatePath();
   }
 
-  return ret;
+  return recordedOp.finish(ret);
 }
 
 /**
@@ -669,6 +877,8 @@ File::create(int mode, const std::string pool, size_t chunk,
 int
 File::remove()
 {
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder,
+                        OpRecorder::OP_REMOVE_FILE, this);
   int ret;
 
   FsObj::refresh();
@@ -676,7 +886,7 @@ File::remove()
   ret = mPriv->verifyExistanceAndType();
 
   if (ret != 0)
-    return ret;
+    return recordedOp.finish(ret);
 
   uid_t uid;
   gid_t gid;
@@ -692,14 +902,76 @@ File::remove()
     Stat *parentStat = reinterpret_cast<Stat *>(parentFsStat());
     indexObject(parentStat, stat, '-');
 
+    mPriv->getFsPriv()->invalidateStat(path());
     mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
   }
   else
-    return -EACCES;
+    return recordedOp.finish(-EACCES);
 
   FsObj::refresh();
 
-  return ret;
+  return recordedOp.finish(ret);
+}
+
+/**
+ * Creates the file asynchronously (see File::create).
+ *
+ * @param mode the permissions of the file.
+ * @param pool the data pool to be used for the file.
+ * @param chunk the chunk size to be used for the file.
+ * @param inlineBufferSize the size of the inline buffer.
+ * @param[out] asyncOpId a string to return the operation's id, to be used
+ *             with Filesystem::sync, Filesystem::pollOp or
+ *             Filesystem::waitForAnyOp.
+ * @param callback a function to be called when the operation is finished.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @param sizeHint the size the file is expected to get.
+ * @return 0 if the operation was scheduled.
+ * @note This instance must not be used or destroyed until the operation is
+ *       finished. Many files can be created in parallel by giving each
+ *       its own instance.
+ */
+int
+File::createAsync(int mode, const std::string pool, size_t chunk,
+                  ssize_t inlineBufferSize, std::string *asyncOpId,
+                  AsyncOpCallback callback, void *callbackArg,
+                  size_t sizeHint)
+{
+  const std::string &opId = mPriv->getFsPriv()->runMetadataOpAsync(
+                              boost::bind(&File::create, this, mode, pool,
+                                          chunk, inlineBufferSize, sizeHint),
+                              callback, callbackArg, asyncOpId != 0);
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  return 0;
+}
+
+/**
+ * Removes the file asynchronously (see File::remove).
+ *
+ * @param[out] asyncOpId a string to return the operation's id, to be used
+ *             with Filesystem::sync, Filesystem::pollOp or
+ *             Filesystem::waitForAnyOp.
+ * @param callback a function to be called when the operation is finished.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @return 0 if the operation was scheduled.
+ * @note This instance must not be used or destroyed until the operation is
+ *       finished.
+ */
+int
+File::removeAsync(std::string *asyncOpId, AsyncOpCallback callback,
+                  void *callbackArg)
+{
+  const std::string &opId = mPriv->getFsPriv()->runMetadataOpAsync(
+                              boost::bind(&File::remove, this),
+                              callback, callbackArg, asyncOpId != 0);
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  return 0;
 }
 
 /**
@@ -711,12 +983,14 @@ File::remove()
 int
 File::truncate(unsigned long long size)
 {
+  RecordedOp recordedOp(&mPriv->getFsPriv()->opRecorder,
+                        OpRecorder::OP_TRUNCATE, this, size);
   int ret;
   if ((ret = mPriv->verifyExistanceAndType()) != 0)
-    return ret;
+    return recordedOp.finish(ret);
 
   if (isLink())
-    return mPriv->target->truncate(size);
+    return recordedOp.finish(mPriv->target->truncate(size));
 
   uid_t uid;
   gid_t gid;
@@ -727,14 +1001,70 @@ File::truncate(unsigned long long size)
   if (!statBuffHasPermission(stat->statBuff, uid, gid,
                              O_WRONLY | O_RDWR))
   {
-    return -EACCES;
+    return recordedOp.finish(-EACCES);
   }
 
   ret = mPriv->inode->truncate(size);
 
+  mPriv->getFsPriv()->invalidateStat(path());
   mPriv->getFsPriv()->updateTMId(mPriv->fsStat());
 
-  return ret;
+  return recordedOp.finish(ret);
+}
+
+/**
+ * Finds the offset of the next data in the file, starting from \a offset
+ * (like SEEK_DATA in lseek). Together with File::seekHole, it allows copying
+ * sparse files without reading their holes.
+ *
+ * The chunks of a file that were never written (after truncating the file to
+ * a bigger size or writing beyond its end) are its holes, so the holes are
+ * multiples of the file's chunk size. Files created by versions that did not
+ * record which chunks were written have no holes.
+ *
+ * @param offset the offset from which to look for data.
+ * @return the offset of the data on success, -ENXIO if there is no data after
+ *         \a offset, or a negative error code otherwise.
+ */
+off_t
+File::seekData(off_t offset)
+{
+  int ret;
+  if ((ret = mPriv->verifyExistanceAndType()) != 0)
+    return ret;
+
+  if (!(mPriv->permissions & File::MODE_READ))
+    return -EACCES;
+
+  if (isLink())
+    return mPriv->target->seekData(offset);
+
+  return mPriv->inode->seekData(offset);
+}
+
+/**
+ * Finds the offset of the next hole in the file, starting from \a offset
+ * (like SEEK_HOLE in lseek). The end of the file counts as a hole.
+ *
+ * @see File::seekData
+ * @param offset the offset from which to look for a hole.
+ * @return the offset of the hole on success, -ENXIO if \a offset is beyond
+ *         the size of the file, or a negative error code otherwise.
+ */
+off_t
+File::seekHole(off_t offset)
+{
+  int ret;
+  if ((ret = mPriv->verifyExistanceAndType()) != 0)
+    return ret;
+
+  if (!(mPriv->permissions & File::MODE_READ))
+    return -EACCES;
+
+  if (isLink())
+    return mPriv->target->seekHole(offset);
+
+  return mPriv->inode->seekHole(offset);
 }
 
 /**
@@ -831,6 +1161,9 @@ File::stat(struct stat *buff)
     // gives us the size of the object, otherwise, we need to check the size set
     // in the inode
 
+    if (!mPriv->getFileIO())
+      return -ENODEV;
+
     std::string inlineContents;
     FileInlineBuffer *inlineBuffer = mPriv->getFileIO()->inlineBuffer();
 
@@ -851,6 +1184,10 @@ File::stat(struct stat *buff)
 
       getTimeFromXAttr(stat, XATTR_MTIME, &stat->statBuff.st_mtim,
                        &stat->statBuff.st_mtime);
+
+      // This client's latest writes may not have set the mtime in the inode yet
+      if (mPriv->getFileIO()->pendingMtime(&stat->statBuff.st_mtim))
+        stat->statBuff.st_mtime = stat->statBuff.st_mtim.tv_sec;
     }
   }
 
@@ -888,7 +1225,11 @@ File::chmod(long int permissions)
   std::map<std::string, librados::bufferlist> omap;
   omap[XATTR_FILE_PREFIX + baseName].append(getFileXAttrDirRecord(&fsStat));
 
-  return mPriv->mtdPool->ioctx.omap_set(parentStat->translatedPath, omap);
+  int ret = mPriv->mtdPool->ioctx.omap_set(parentStat->translatedPath, omap);
+
+  mPriv->getFsPriv()->invalidateStat(path());
+
+  return ret;
 }
 
 /**
@@ -923,7 +1264,11 @@ File::chown(uid_t uid, gid_t gid)
 
   Stat parentStat = *reinterpret_cast<Stat *>(parentFsStat());
 
-  return parentStat.pool->ioctx.omap_set(parentStat.translatedPath, omap);
+  int ret = parentStat.pool->ioctx.omap_set(parentStat.translatedPath, omap);
+
+  mPriv->getFsPriv()->invalidateStat(path());
+
+  return ret;
 }
 
 /**
@@ -1009,6 +1354,49 @@ File::rename(const std::string &newPath)
   return mPriv->rename(dest);
 }
 
+/**
+ * Copies the file to \a destination. The copy gets a new inode whose chunks
+ * are copied by the cluster itself (with RADOS' copy_from) instead of being
+ * read and written back by the client, and the file's inline buffer is copied
+ * together with its entry in the destination's parent directory. The copy
+ * keeps the file's layout and permissions but belongs to the current user.
+ *
+ * @param destination the path of the copy. If it is a relative path, then it
+ *        will be appended to the current parent directory.
+ * @note The destination cannot be an existing file or directory.
+ * @return 0 on success, -EEXIST if the destination exists, an error code
+ *         otherwise.
+ */
+int
+File::copyTo(const std::string &destination)
+{
+  int ret;
+
+  if ((ret = mPriv->verifyExistanceAndType()) != 0)
+    return ret;
+
+  if (isLink())
+    return mPriv->target->copyTo(destination);
+
+  if (destination == "")
+    return -EINVAL;
+
+  if (!isReadable())
+    return -EACCES;
+
+  std::string dest = destination;
+
+  if (dest[0] != PATH_SEP)
+  {
+    dest = getParentDir(path(), 0) + dest;
+  }
+
+  if (dest == "/")
+    return -EISDIR;
+
+  return mPriv->copy(getFilePath(sanitizePath(dest)));
+}
+
 /**
  * Waits for the file's asynchronous operations to be finished. If \a opId is
  * given, it waits only for the operation with the matching id, otherwise it
@@ -1028,6 +1416,70 @@ File::sync(const std::string &opId)
   return ret;
 }
 
+/**
+ * Waits for the file's asynchronous operations with the given \a opIds to be
+ * finished.
+ *
+ * @param opIds the ids of the asynchronous operations.
+ * @return 0 on success, the error code of the first operation that failed
+ *         otherwise.
+ */
+int
+File::sync(const std::vector<std::string> &opIds)
+{
+  int ret = mPriv->inode->sync(opIds);
+
+  if (ret == -ENODEV)
+    ret = 0;
+
+  return ret;
+}
+
+/**
+ * Checks whether the asynchronous operation with the given \a opId has
+ * finished, without blocking.
+ *
+ * @param opId the id of an asynchronous operation.
+ * @return -EINPROGRESS if the operation is still running, -ENOENT if there is
+ *         no such operation, otherwise the operation's return code (0 on
+ *         success). Once the operation's return code is returned, the
+ *         operation is forgotten as if File::sync had been called for it.
+ */
+int
+File::pollOp(const std::string &opId)
+{
+  int ret = mPriv->inode->pollOp(opId);
+
+  if (ret == -ENODEV)
+    ret = -ENOENT;
+
+  return ret;
+}
+
+/**
+ * Waits until any of the file's asynchronous operations with the given
+ * \a opIds is finished. This allows to keep many operations in flight and
+ * reuse their buffers as soon as each of them finishes.
+ *
+ * @param opIds the ids of asynchronous operations.
+ * @param[out] finishedOpId a string to return the id of the operation that
+ *             finished.
+ * @return -ENOENT if none of the operations exist, otherwise the return code
+ *         of the finished operation (0 on success). The finished operation is
+ *         forgotten as if File::sync had been called for it.
+ */
+int
+File::waitForAnyOp(const std::vector<std::string> &opIds,
+                   std::string *finishedOpId)
+{
+  int ret = mPriv->inode->waitForAnyOp(opIds, finishedOpId);
+
+  if (ret == -ENODEV)
+    ret = -ENOENT;
+
+  return ret;
+}
+
 /**
  * Gets the inline buffer's size currently set for the file.
  *
@@ -60,17 +60,34 @@ public:
 
   int write(const char *buff, off_t offset, size_t blen, bool copyBuffer = false,
             std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
-            void *callbackArg = 0);
+            void *callbackArg = 0, AsyncOpBufferCallback bufferCallback = 0);
 
   int writeSync(const char *buff, off_t offset, size_t blen);
 
+  int write(const std::vector<FileWriteData> &intervals,
+            std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
+            void *callbackArg = 0);
+
   int create(int permissions = -1, const std::string pool = "",
-             size_t chunkSize = 0, ssize_t inlineBufferSize = -1);
+             size_t chunkSize = 0, ssize_t inlineBufferSize = -1,
+             size_t sizeHint = 0);
 
   int remove(void);
 
+  int createAsync(int permissions = -1, const std::string pool = "",
+                  size_t chunkSize = 0, ssize_t inlineBufferSize = -1,
+                  std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
+                  void *callbackArg = 0, size_t sizeHint = 0);
+
+  int removeAsync(std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
+                  void *callbackArg = 0);
+
   int truncate(unsigned long long size);
 
+  off_t seekData(off_t offset);
+
+  off_t seekHole(off_t offset);
+
   bool isWritable(void);
 
   bool isReadable(void);
@@ -91,8 +108,17 @@ public:
 
   int rename(const std::string &newPath);
 
+  int copyTo(const std::string &destination);
+
   int sync(const std::string &opId="");
 
+  int sync(const std::vector<std::string> &opIds);
+
+  int pollOp(const std::string &opId);
+
+  int waitForAnyOp(const std::vector<std::string> &opIds,
+                   std::string *finishedOpId = 0);
+
   size_t inlineBufferSize(void) const;
 
   int setXAttr(const std::string &attrName,
@@ -26,6 +26,7 @@
 
 #include "radosfsdefines.h"
 #include "AsyncOpPriv.hh"
+#include "ChunkCompression.hh"
 #include "FileIO.hh"
 #include "Logger.hh"
 #include "FilesystemPriv.hh"
@@ -46,7 +47,6 @@ FileReadDataImp::FileReadDataImp(char *buff, off_t offset, size_t length,
                                  ssize_t *retValue)
   : FileReadData(buff, offset, length, retValue),
     readOpMutex(new boost::shared_mutex),
-    buffList(new librados::bufferlist),
     opResult(0)
 {}
 
@@ -54,21 +54,17 @@ FileReadDataImp::FileReadDataImp(const FileReadDataImp &otherObj)
   : FileReadData(otherObj.buff, otherObj.offset, otherObj.length,
                  otherObj.retValue),
     readOpMutex(otherObj.readOpMutex),
-    buffList(new librados::bufferlist),
     opResult(otherObj.opResult)
 {}
 
 FileReadDataImp::FileReadDataImp(const FileReadData &readData)
   : FileReadData(readData),
     readOpMutex(new boost::shared_mutex),
-    buffList(new librados::bufferlist),
     opResult(0)
 {}
 
 FileReadDataImp::~FileReadDataImp(void)
-{
-  delete buffList;
-}
+{}
 
 void
 FileReadDataImp::addReturnValue(int value)
@@ -83,17 +79,51 @@ FileReadDataImp::addReturnValue(int value)
     *retValue = value;
 }
 
+ReadAheadBuffer::ReadAheadBuffer(off_t offset, size_t length)
+  : readData(new char[length], offset, length, &readBytes),
+    readBytes(0),
+    asyncOp(new AsyncOp(generateUuid()))
+{}
+
+ReadAheadBuffer::~ReadAheadBuffer(void)
+{
+  // The buffer is used by the read operation so it has to be done first
+  asyncOp->waitForCompletion();
+  delete[] readData.buff;
+}
+
 FileIO::FileIO(Filesystem *radosFs, const PoolSP pool, const std::string &iNode,
                size_t chunkSize)
   : mRadosFs(radosFs),
     mPool(pool),
+    mCompression(false),
+    mTrackAllocatedChunks(false),
+    mAllocatedChunksLoaded(false),
     mInode(iNode),
     mPath(""),
     mChunkSize(chunkSize),
     mLazyRemoval(false),
+    mLockStart(expiredLockDuration()),
+    mLockUpdated(mLockStart),
     mLocker(""),
+    mLockExclusive(false),
     mInlineBuffer(0),
-    mHasBackLink(false)
+    mHasBackLink(false),
+    mWriteBehindMaxSize(radosFs ? radosFs->fileWriteBehindSize() : 0),
+    mWriteBehindBytes(0),
+    mWriteBehindSeq(0),
+    mWriteBehindFlushQueue(new WriteBehindFlushQueue),
+    mReadAhead(radosFs ? radosFs->fileReadAhead() : false),
+    mReadAheadNextOffset(0),
+    mReadAheadWindow(0),
+    mCachedSize(-1),
+    mPendingSize(0),
+    mSizeCacheStaleness(radosFs ? radosFs->fileSizeCacheStaleness() : 0),
+    mChunkRemovalWindow(radosFs ? radosFs->fileChunkRemovalWindow() :
+                                  DEFAULT_FILE_CHUNK_REMOVAL_WINDOW),
+    mChunkCache(radosFs ? &radosFs->mPriv->chunkCache : 0),
+    mMetrics(radosFs ? &radosFs->mPriv->metrics : 0),
+    mTracer(radosFs ? &radosFs->mPriv->tracer : 0)
 {
   assert(mChunkSize != 0);
 }
@@ -102,6 +132,9 @@ FileIO::FileIO(Filesystem *radosFs, const PoolSP pool, const std::string &iNode,
                const std::string &path, size_t chunkSize)
   : mRadosFs(radosFs),
     mPool(pool),
+    mCompression(false),
+    mTrackAllocatedChunks(false),
+    mAllocatedChunksLoaded(false),
     mInode(iNode),
     mPath(path),
     mChunkSize(chunkSize),
@@ -109,22 +142,59 @@ FileIO::FileIO(Filesystem *radosFs, const PoolSP pool, const std::string &iNode,
     mLockStart(expiredLockDuration()),
     mLockUpdated(mLockStart),
     mLocker(""),
+    mLockExclusive(false),
     mInlineBuffer(0),
     // If the path is not set, then we assume the backlink has been set in order
     // to avoid trying to do it when needed
-    mHasBackLink(mPath.empty())
+    mHasBackLink(mPath.empty()),
+    mWriteBehindMaxSize(radosFs ? radosFs->fileWriteBehindSize() : 0),
+    mWriteBehindBytes(0),
+    mWriteBehindSeq(0),
+    mWriteBehindFlushQueue(new WriteBehindFlushQueue),
+    mReadAhead(radosFs ? radosFs->fileReadAhead() : false),
+    mReadAheadNextOffset(0),
+    mReadAheadWindow(0),
+    mCachedSize(-1),
+    mPendingSize(0),
+    mSizeCacheStaleness(radosFs ? radosFs->fileSizeCacheStaleness() : 0),
+    mChunkRemovalWindow(radosFs ? radosFs->fileChunkRemovalWindow() :
+                                  DEFAULT_FILE_CHUNK_REMOVAL_WINDOW),
+    mChunkCache(radosFs ? &radosFs->mPriv->chunkCache : 0),
+    mMetrics(radosFs ? &radosFs->mPriv->metrics : 0),
+    mTracer(radosFs ? &radosFs->mPriv->tracer : 0)
 {
   assert(mChunkSize != 0);
 }
 
 FileIO::~FileIO()
 {
+  dropReadAhead();
+  flushWriteBehind();
   mOpManager.sync(false);
   mOpManager.waitForLoneOps();
+  flushPendingSize();
 
   if (mLazyRemoval)
   {
-    remove();
+    // Removing a big file can take long, so it can be left for the worker
+    // threads instead of blocking whoever releases the file
+    if (mRadosFs && mRadosFs->fileBackgroundLazyRemoval())
+    {
+      {
+        boost::unique_lock<boost::mutex> lock(mLockMutex);
+        unlockIfTimeIsOut(FILE_IDLE_LOCK_TIMEOUT);
+      }
+
+      mRadosFs->mPriv->scheduler.post(
+            boost::bind(&FileIO::reapInode, mPool, mStripePools, mInode,
+                        mChunkSize, mChunkRemovalWindow),
+            WorkScheduler::PRIORITY_BACKGROUND);
+    }
+    else
+    {
+      remove();
+    }
+
     return;
   }
 
@@ -292,31 +362,124 @@ FileIO::onReadInlineBufferCompleted(rados_completion_t comp, void *arg)
   delete args;
 }
 
+// Copies the requested ranges of a compressed chunk to the read data's
+// buffers, setting up its read buffers as if the ranges had been read into
+// them directly
+static int
+readCompressedChunk(ReadChunkOpArgs *args)
+{
+  librados::bufferlist &chunkBuff = args->chunkBuffer;
+  librados::bufferlist &infoBuff = args->compressionInfo;
+  ChunkCompression compression;
+  int ret = 0;
+
+  if (args->compressionResult >= 0 && infoBuff.length() > 0)
+    ret = compression.parse(std::string(infoBuff.c_str(), infoBuff.length()));
+  else
+    compression.setUncompressed(chunkBuff.length());
+
+  if (ret < 0)
+    return ret;
+
+  // Caching the chunk needs all of its contents, so it is decompressed at
+  // once instead of only decompressing the blocks that were asked for
+  std::string contents;
+
+  if (args->fillCache)
+  {
+    ret = compression.decompress(chunkBuff.c_str(), chunkBuff.length(),
+                                 &contents);
+
+    if (ret < 0)
+      return ret;
+
+    args->cacheBuffer.append(contents.data(),
+                             std::min(contents.length(),
+                                      args->cacheFillLength));
+    args->cacheResult = 0;
+  }
+
+  for (size_t i = 0; i < args->readData.size(); i++)
+  {
+    FileReadDataImp *data = args->readData[i].get();
+    ssize_t length;
+
+    if (args->fillCache)
+    {
+      ChunkCompression raw;
+      raw.setUncompressed(contents.length());
+      length = raw.read(contents.data(), contents.length(), data->offset,
+                        data->length, data->buff);
+    }
+    else
+    {
+      length = compression.read(chunkBuff.c_str(), chunkBuff.length(),
+                                data->offset, data->length, data->buff);
+    }
+
+    if (length < 0)
+      return length;
+
+    data->opResult = 0;
+    args->readBuffers[i].push_back(ceph::buffer::create_static(length,
+                                                               data->buff));
+  }
+
+  return 0;
+}
+
 void
 FileIO::onReadCompleted(rados_completion_t comp, void *arg)
 {
   ReadChunkOpArgs *args = reinterpret_cast<ReadChunkOpArgs *>(arg);
-  const int ret = rados_aio_get_return_value(comp);
+  int ret = rados_aio_get_return_value(comp);
+
+  radosfs_debug_category(CHUNKS, "Reading inode's chunk #%u complete with "
+                         "retcode=%d (%s)", args->fileChunk, ret,
+                         strerror(abs(ret)));
+
+  if (args->compressed && ret >= 0)
+  {
+    const int decodeRet = readCompressedChunk(args);
+
+    if (decodeRet < 0)
+    {
+      radosfs_debug("Failed to decompress chunk #%lu of inode '%s': %s",
+                    args->fileChunk, args->fileIO->mInode.c_str(),
+                    strerror(abs(decodeRet)));
 
-  radosfs_debug("Reading inode's chunk #%u complete with retcode=%d (%s)",
-                args->fileChunk, ret, strerror(abs(ret)));
+      args->asyncOp->mPriv->setOverriddenReturnCode(comp, decodeRet);
+      ret = decodeRet;
+    }
+  }
 
   for (size_t i = 0; i < args->readData.size(); i++)
   {
-    FileReadDataImpSP data = args->readData[i].first;
-    librados::bufferlist *buff = args->readData[i].second;
+    FileReadDataImpSP data = args->readData[i];
+    librados::bufferlist &buff = args->readBuffers[i];
+    size_t length = 0;
 
-    if (buff->length() > 0)
+    // The buffer list is set up with the user's buffer so its length does not
+    // mean anything if the read failed
+    if (ret >= 0 && data->opResult >= 0)
+      length = std::min((size_t) buff.length(), data->length);
+
+    if (length > 0)
     {
-      memcpy(data->buff, buff->c_str(), buff->length());
-      data->addReturnValue(buff->length());
+      // The data is usually read directly into the user's buffer, otherwise
+      // it needs to be copied
+      if (!buff.is_provided_buffer(data->buff))
+        buff.copy(0, length, data->buff);
+
+      data->addReturnValue(length);
 
-      radosfs_debug("Setting %u bytes from chunk #%d for vector read request: "
-                    "offset=%u; length=%u;", buff->length(), args->fileChunk,
-                    data->offset, data->length);
+      radosfs_debug_category(CHUNKS, "Setting %u bytes from chunk #%d for "
+                             "vector read request: offset=%u; length=%u;",
+                             length, args->fileChunk, data->offset,
+                             data->length);
     }
 
-    if (buff->length() < data->length)
+    if (length < data->length)
     {
       size_t inodeSize = assignInodeSize(args);
       const size_t byteOffset = args->fileChunk * args->fileIO->mChunkSize +
@@ -330,10 +493,29 @@ FileIO::onReadCompleted(rados_completion_t comp, void *arg)
         args->asyncOp->mPriv->setOverriddenReturnCode(comp, 0);
       }
 
-      assignRemainingReadData(data.get(), byteOffset, inodeSize, buff->length());
+      assignRemainingReadData(data.get(), byteOffset, inodeSize, length);
     }
+  }
+
+  if (args->fillCache && ret >= 0 && args->cacheResult >= 0)
+  {
+    FileIO *io = args->fileIO;
+    librados::bufferlist &chunkBuff = args->cacheBuffer;
 
-    delete buff;
+    // If the chunk is as big as what was read, it may not have been read
+    // completely, so it cannot be cached
+    if (chunkBuff.length() < args->cacheFillLength ||
+        args->cacheFillLength == io->mChunkSize)
+    {
+      const std::string contents(chunkBuff.c_str(), chunkBuff.length());
+      io->mChunkCache->put(io->mInode, args->fileChunk, contents,
+                           args->cacheGeneration);
+    }
+    else
+    {
+      boost::unique_lock<boost::mutex> lock(io->mUncacheableChunksMutex);
+      io->mUncacheableChunks.insert(args->fileChunk);
+    }
   }
 
   args->asyncOp->mPriv->setPartialReady();
@@ -362,9 +544,8 @@ FileIO::vectorReadInlineBuffer( const std::vector<FileReadDataImpSP> &readData,
   readOp.omap_get_vals_by_keys(keys, &args->omap, 0);
 
   librados::AioCompletion *completion;
-  completion = librados::Rados::aio_create_completion();
+  completion = args->asyncOp->mPriv->createCompletion();
   completion->set_complete_callback(args, FileIO::onReadInlineBufferCompleted);
-  args->asyncOp->mPriv->addCompletion(completion);
 
   Pool *pool = mInlineBuffer->parentStat.pool.get();
   pool->ioctx.aio_operate(mInlineBuffer->parentStat.translatedPath, completion,
@@ -376,10 +557,17 @@ FileIO::vectorReadChunk(size_t fileChunk,
                         const std::vector<FileReadDataImpSP> &readDataVector,
                         boost::shared_ptr<boost::shared_mutex> readOpMutex,
                         AsyncOpSP asyncOp,
-                        boost::shared_ptr<ssize_t> inodeSize)
+                        boost::shared_ptr<ssize_t> inodeSize,
+                        bool fillCache)
 {
   ReadChunkOpArgs *readOp = new ReadChunkOpArgs;
   readOp->fileChunk = fileChunk;
+  readOp->fillCache = fillCache;
+  readOp->cacheFillLength = 0;
+  readOp->cacheGeneration = 0;
+  readOp->cacheResult = 0;
+  readOp->compressed = mCompression;
+  readOp->compressionResult = 0;
   readOp->readOpMutex = readOpMutex;
   readOp->asyncOp = asyncOp;
   readOp->fileIO = this;
@@ -387,29 +575,67 @@ FileIO::vectorReadChunk(size_t fileChunk,
   librados::ObjectReadOperation op;
   const std::string chunkName = makeFileChunkName(mInode, fileChunk);
 
+  readOp->readData = readDataVector;
+  readOp->readBuffers.resize(readDataVector.size());
+
+  if (fillCache)
+  {
+    readOp->cacheGeneration = mChunkCache->generation(mInode);
+    readOp->cacheFillLength = std::min(mChunkSize, mChunkCache->maxSize() /
+                                       FILE_CHUNK_CACHE_MAX_ENTRY_RATIO);
+  }
+
+  if (mCompression)
+  {
+    // Which blocks hold the requested ranges is only known from the chunk's
+    // compression info, so the whole (compressed) chunk is read with it and
+    // the ranges are decompressed when the read is done
+    op.read(0, mChunkSize, &readOp->chunkBuffer, 0);
+    op.getxattr(XATTR_CHUNK_COMPRESSION, &readOp->compressionInfo,
+                &readOp->compressionResult);
+    op.set_op_flags2(librados::OP_FAILOK);
+
+    librados::AioCompletion *completion = asyncOp->mPriv->createCompletion();
+    completion->set_complete_callback(readOp, FileIO::onReadCompleted);
+    chunkPool(fileChunk)->ioctx.aio_operate(chunkName, completion, &op, 0);
+
+    return;
+  }
+
   for (size_t i = 0; i < readDataVector.size(); i++)
   {
-    FileReadDataImpSP readData(readDataVector[i]);
-    librados::bufferlist *readBuff = new librados::bufferlist;
-    std::pair<FileReadDataImpSP, librados::bufferlist *> dataAndResult(readData,
-                                                                       readBuff);
-    readOp->readData.push_back(dataAndResult);
+    const FileReadDataImpSP &readData = readDataVector[i];
+    librados::bufferlist &readBuff = readOp->readBuffers[i];
+
+    // Set up the user's buffer as the destination of the read so the data does
+    // not need to be copied after the read is done
+    readBuff.push_back(ceph::buffer::create_static(readData->length,
+                                                   readData->buff));
+
+    op.read(readData->offset, readData->length, &readBuff, &readData->opResult);
+    radosfs_debug_category(CHUNKS, "Setting read op for the chunk %s . "
+                           "offset=%u; length=%u;", chunkName.c_str(),
+                           readData->offset, readData->length);
+  }
 
-    op.read(readData->offset, readData->length, readBuff, &readData->opResult);
-    radosfs_debug("Setting read op for the chunk %s . offset=%u; length=%u;",
-                  chunkName.c_str(), readData->offset, readData->length);
+  if (fillCache)
+  {
+    // The whole chunk is read in the same operation so it can be cached; the
+    // generation tells whether the chunk was invalidated meanwhile
+    op.read(0, readOp->cacheFillLength, &readOp->cacheBuffer,
+            &readOp->cacheResult);
   }
 
-  librados::AioCompletion *completion = librados::Rados::aio_create_completion();
+  librados::AioCompletion *completion = asyncOp->mPriv->createCompletion();
   completion->set_complete_callback(readOp, FileIO::onReadCompleted);
-  asyncOp->mPriv->addCompletion(completion);
-  mPool->ioctx.aio_operate(chunkName, completion, &op, 0);
+  chunkPool(fileChunk)->ioctx.aio_operate(chunkName, completion, &op, 0);
 }
 
 int
 FileIO::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
              AsyncOpCallback callback, void *callbackArg)
 {
+  flushWriteBehind();
   mOpManager.sync();
 
   if (intervals.size() == 0)
@@ -419,6 +645,7 @@ FileIO::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
   }
 
   AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+  asyncOp->mPriv->setTracer(mTracer);
 
   if (callback)
     asyncOp->setCallback(callback, callbackArg);
@@ -428,6 +655,14 @@ FileIO::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
   if (asyncOpId)
     asyncOpId->assign(asyncOp->id());
 
+  return vectorRead(intervals, asyncOp);
+}
+
+int
+FileIO::vectorRead(const std::vector<FileReadData> &intervals,
+                   AsyncOpSP asyncOp)
+{
+  TraceSpan span(asyncOp->mPriv->tracer, "read", "file", asyncOp->id());
   std::vector<FileReadDataImpSP> inlineReadData, inodeReadData;
   getInlineAndInodeReadData(intervals, &inlineReadData, &inodeReadData);
   boost::shared_ptr<boost::shared_mutex> readOpMutex(new boost::shared_mutex);
@@ -443,6 +678,8 @@ FileIO::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
 
   std::map<size_t, std::vector<FileReadDataImpSP> > dataPerChunk;
   getReadDataPerChunk(inodeReadData, &dataPerChunk);
+  bool scheduledReads = mInlineBuffer && inlineReadData.size() > 0;
+  bool allocatedChunksRefreshed = false;
 
   if (dataPerChunk.size() > 0)
   {
@@ -452,911 +689,3332 @@ FileIO::read(const std::vector<FileReadData> &intervals, std::string *asyncOpId,
     {
       size_t fileChunk = (*it).first;
       const std::vector<FileReadDataImpSP> &readDataVector = (*it).second;
+      bool fillCache = false;
+
+      // Chunks that were never written are read as zeros without asking the
+      // cluster for them
+      if (isHole(fileChunk, &allocatedChunksRefreshed))
+      {
+        readHole(fileChunk, readDataVector, readOpMutex, asyncOp, inodeSize);
+        continue;
+      }
+
+      if (mChunkCache && mChunkCache->maxSize() > 0)
+      {
+        if (readChunkFromCache(fileChunk, readDataVector, readOpMutex, asyncOp,
+                               inodeSize))
+        {
+          continue;
+        }
+
+        fillCache = shouldFillChunkCache(fileChunk);
+      }
 
       vectorReadChunk(fileChunk, readDataVector, readOpMutex, asyncOp,
-                      inodeSize);
+                      inodeSize, fillCache);
+      scheduledReads = true;
     }
   }
 
+  // If all the data came from the chunk cache, there is nothing to wait for
+  if (!scheduledReads)
+    asyncOp->mPriv->setReady();
+
   return 0;
 }
 
-ssize_t
-FileIO::read(char *buff, off_t offset, size_t blen)
+bool
+FileIO::readChunkFromCache(size_t fileChunk,
+                           const std::vector<FileReadDataImpSP> &readDataVector,
+                           boost::shared_ptr<boost::shared_mutex> readOpMutex,
+                           AsyncOpSP asyncOp,
+                           boost::shared_ptr<ssize_t> inodeSize)
 {
-  mOpManager.sync();
+  ChunkContentsSP contents = mChunkCache->get(mInode, fileChunk);
 
-  if (blen == 0)
+  if (!contents)
+    return false;
+
+  ReadOpArgs args;
+  args.asyncOp = asyncOp;
+  args.readOpMutex = readOpMutex;
+  args.inodeSize = inodeSize;
+  args.fileIO = this;
+
+  for (size_t i = 0; i < readDataVector.size(); i++)
   {
-    radosfs_debug("Invalid length for reading. Cannot read 0 bytes.");
-    return -EINVAL;
-  }
+    FileReadDataImp *data = readDataVector[i].get();
+    size_t length = 0;
 
-  ssize_t opRet = 0;
-  FileReadData readData(buff, offset, blen, &opRet);
+    if ((size_t) data->offset < contents->length())
+    {
+      length = std::min(data->length, contents->length() - data->offset);
+      memcpy(data->buff, contents->c_str() + data->offset, length);
+      data->addReturnValue(length);
+    }
 
-  ssize_t ret = 0;
+    if (length < data->length)
+    {
+      const size_t byteOffset = fileChunk * mChunkSize + data->offset;
+      assignRemainingReadData(data, byteOffset, assignInodeSize(&args), length);
+    }
+  }
 
-  std::vector<FileReadData> intervals;
-  intervals.push_back(readData);
+  radosfs_debug_category(CHUNKS, "Read chunk #%lu of inode '%s' from the "
+                         "chunk cache (op id='%s')", fileChunk, mInode.c_str(),
+                         asyncOp->id().c_str());
 
-  std::string opId;
+  return true;
+}
 
-  ret = read(intervals, &opId);
+void
+FileIO::readHole(size_t fileChunk,
+                 const std::vector<FileReadDataImpSP> &readDataVector,
+                 boost::shared_ptr<boost::shared_mutex> readOpMutex,
+                 AsyncOpSP asyncOp, boost::shared_ptr<ssize_t> inodeSize)
+{
+  ReadOpArgs args;
+  args.asyncOp = asyncOp;
+  args.readOpMutex = readOpMutex;
+  args.inodeSize = inodeSize;
+  args.fileIO = this;
 
-  if (ret != 0)
+  for (size_t i = 0; i < readDataVector.size(); i++)
   {
-    return ret;
+    FileReadDataImp *data = readDataVector[i].get();
+    const size_t byteOffset = fileChunk * mChunkSize + data->offset;
+
+    assignRemainingReadData(data, byteOffset, assignInodeSize(&args), 0);
   }
 
-  ret = sync(opId);
+  radosfs_debug_category(CHUNKS, "Chunk #%lu of inode '%s' is a hole, so it "
+                         "was not read (op id='%s')", fileChunk, mInode.c_str(),
+                         asyncOp->id().c_str());
+}
 
-  if (ret != 0)
-  {
-    return ret;
-  }
+static std::string
+allocatedChunkKey(size_t fileChunk)
+{
+  char chunkNumHex[FILE_CHUNK_LENGTH + 1];
+  sprintf(chunkNumHex, "%0*x", FILE_CHUNK_LENGTH, (unsigned int) fileChunk);
 
-  return opRet;
+  return std::string(FILE_ALLOCATED_CHUNK_KEY_PREFIX) + chunkNumHex;
 }
 
+// Reads which chunks were written from the inode's omap. The keys are never
+// removed (not even when the file is truncated), so what was loaded before is
+// kept: taking a hole for an allocated chunk only costs a read.
 int
-FileIO::writeSync(const char *buff, off_t offset, size_t blen)
+FileIO::loadAllocatedChunks(void)
 {
-  int ret;
+  const size_t prefixLength = strlen(FILE_ALLOCATED_CHUNK_KEY_PREFIX);
+  std::vector<bool> allocated;
+  std::string startAfter;
 
-  AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
-  mOpManager.addOperation(asyncOp);
+  while (true)
+  {
+    std::map<std::string, librados::bufferlist> keys;
+    int ret = mPool->ioctx.omap_get_vals(mInode, startAfter,
+                                         FILE_ALLOCATED_CHUNK_KEY_PREFIX,
+                                         FILE_ALLOCATED_CHUNKS_MAX_KEYS, &keys);
 
-  if ((ret = verifyWriteParams(offset, blen)) != 0)
-    return ret;
+    // Without an inode object, nothing was written yet
+    if (ret == -ENOENT)
+      break;
 
-  return realWrite(const_cast<char *>(buff), offset, blen, false, asyncOp);
-}
+    if (ret < 0)
+    {
+      radosfs_debug("Failed to read the allocated chunks of inode '%s': %s",
+                    mInode.c_str(), strerror(abs(ret)));
+      return ret;
+    }
 
-int
-FileIO::write(const char *buff, off_t offset, size_t blen, std::string *opId,
-              bool copyBuffer, AsyncOpCallback callback, void *arg)
-{
-  int ret = 0;
+    std::map<std::string, librados::bufferlist>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); it++)
+    {
+      const size_t chunk = strtoul((*it).first.c_str() + prefixLength, 0, 16);
 
-  if ((ret = verifyWriteParams(offset, blen)) != 0)
-    return ret;
+      if (allocated.size() <= chunk)
+        allocated.resize(chunk + 1, false);
 
-  AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+      allocated[chunk] = true;
+    }
 
-  if (callback)
-    asyncOp->setCallback(callback, arg);
+    if (keys.size() < FILE_ALLOCATED_CHUNKS_MAX_KEYS)
+      break;
 
-  mOpManager.addOperation(asyncOp);
+    startAfter = (*keys.rbegin()).first;
+  }
 
-  if (opId)
-    opId->assign(asyncOp->id());
+  boost::unique_lock<boost::mutex> lock(mAllocatedChunksMutex);
 
-  char *bufferToWrite = const_cast<char *>(buff);
+  if (mAllocatedChunks.size() < allocated.size())
+    mAllocatedChunks.resize(allocated.size(), false);
 
-  if (copyBuffer)
+  for (size_t i = 0; i < allocated.size(); i++)
   {
-    bufferToWrite = new char[blen];
-    memcpy(bufferToWrite, buff, blen);
+    if (allocated[i])
+      mAllocatedChunks[i] = true;
   }
 
-  mRadosFs->mPriv->getIoService()->post(boost::bind(&FileIO::realWrite, this,
-                                                    bufferToWrite, offset, blen,
-                                                    copyBuffer, asyncOp));
+  mAllocatedChunksLoaded = true;
+  mAllocatedChunksTime = boost::chrono::system_clock::now();
+
   return 0;
 }
 
-void
-onCompleted(rados_completion_t comp, void *arg)
+// Whether the given chunk was never written. The allocated chunks known by
+// this client are trusted in the same way as the cached size (see
+// FileIO::getCachedSize); otherwise they are loaded again, once per operation
+// (which is tracked by refreshed).
+bool
+FileIO::isHole(size_t fileChunk, bool *refreshed)
 {
-  int ret = rados_aio_get_return_value(comp);
-  std::string *msg = reinterpret_cast<std::string *>(arg);
+  // The base chunk is the inode object itself, which is always there
+  if (!mTrackAllocatedChunks || fileChunk == 0)
+    return false;
 
-  radosfs_debug("Completed: %s: retcode=%d (%s)", msg->c_str(), ret,
-                strerror(abs(ret)));
-  delete msg;
-}
+  const boost::chrono::system_clock::time_point now =
+      boost::chrono::system_clock::now();
+  bool fresh;
 
-void
-FileIO::setCompletionDebugMsg(librados::AioCompletion *completion,
-                              const std::string &message)
-{
-  if (mRadosFs->logLevel() == Filesystem::LOG_LEVEL_DEBUG)
   {
-    std::string *arg = new std::string(message);
-    completion->set_complete_callback(arg, onCompleted);
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    fresh = now < mSizeAuthoritativeUntil;
   }
-}
-
-void
-FileIO::lockShared(const std::string &uuid)
-{
-  int ret;
 
   {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
-    boost::chrono::duration<double> seconds;
-    boost::chrono::system_clock::time_point now =
-        boost::chrono::system_clock::now();
-    seconds = now - mLockStart;
-    if (seconds.count() < FILE_LOCK_DURATION - 1)
-    {
-      radosfs_debug("Keep shared lock: %s %s", mLocker.c_str(), uuid.c_str());
-      mLockUpdated = now;
-      if (mLocker == "")
-        mLocker = uuid;
+    boost::unique_lock<boost::mutex> lock(mAllocatedChunksMutex);
 
-      if (mLocker == uuid)
-        return;
+    if (fileChunk < mAllocatedChunks.size() && mAllocatedChunks[fileChunk])
+      return false;
+
+    if (!fresh && mSizeCacheStaleness > 0)
+    {
+      boost::chrono::duration<double> seconds = now - mAllocatedChunksTime;
+      fresh = seconds.count() <= mSizeCacheStaleness;
     }
+
+    if (mAllocatedChunksLoaded && (fresh || *refreshed))
+      return true;
   }
 
-  timeval tm;
-  tm.tv_sec = FILE_LOCK_DURATION;
-  tm.tv_usec = 0;
-  while ((ret = mPool->ioctx.lock_shared(inode(), FILE_CHUNK_LOCKER,
-                                         FILE_CHUNK_LOCKER_COOKIE_WRITE,
-                                         FILE_CHUNK_LOCKER_TAG, "", &tm,
-                                         0)) == -EBUSY)
-  {}
+  // Other clients may have written the chunk meanwhile
+  if (loadAllocatedChunks() < 0)
+    return false;
 
-  boost::unique_lock<boost::mutex> lock(mLockMutex);
-  mLocker = uuid;
-  mLockStart = boost::chrono::system_clock::now();
-  mLockUpdated = mLockStart;
+  *refreshed = true;
 
-  radosfs_debug("Set/renew shared lock: %s ", mLocker.c_str());
+  boost::unique_lock<boost::mutex> lock(mAllocatedChunksMutex);
+
+  return fileChunk >= mAllocatedChunks.size() || !mAllocatedChunks[fileChunk];
 }
 
-void
-FileIO::lockExclusive(const std::string &uuid)
+// Records the given chunks as written in the inode's omap, unless this client
+// already did or saw that. This is done before the chunks are written, since
+// other clients read a chunk without a key as zeros: a chunk is only known to
+// be recorded once the keys are set, so a failure is retried by the next
+// write of the chunk.
+int
+FileIO::markChunksAllocated(const std::set<size_t> &chunks)
 {
-  int ret;
+  if (!mTrackAllocatedChunks)
+    return 0;
+
+  std::map<std::string, librados::bufferlist> keys;
 
   {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
-    boost::chrono::duration<double> seconds;
-    boost::chrono::system_clock::time_point now =
-        boost::chrono::system_clock::now();
-    seconds = now - mLockStart;
-    if (seconds.count() < FILE_LOCK_DURATION - 1)
+    boost::unique_lock<boost::mutex> lock(mAllocatedChunksMutex);
+
+    std::set<size_t>::const_iterator it;
+    for (it = chunks.begin(); it != chunks.end(); it++)
     {
-      radosfs_debug("Keep exclusive lock: %s %s", mLocker.c_str(), uuid.c_str());
-      mLockUpdated = now;
-      if (mLocker == "")
+      const size_t chunk = *it;
+
+      if (chunk == 0 ||
+          (chunk < mAllocatedChunks.size() && mAllocatedChunks[chunk]))
       {
-        mLocker = uuid;
+        continue;
       }
 
-      if (mLocker == uuid)
-        return;
+      keys[allocatedChunkKey(chunk)] = librados::bufferlist();
     }
   }
 
-  timeval tm;
-  tm.tv_sec = FILE_LOCK_DURATION;
-  tm.tv_usec = 0;
-  while ((ret = mPool->ioctx.lock_exclusive(inode(), FILE_CHUNK_LOCKER,
-                                            FILE_CHUNK_LOCKER_COOKIE_OTHER,
-                                            "", &tm, 0)) == -EBUSY)
-  {}
+  if (keys.empty())
+    return 0;
 
-  boost::unique_lock<boost::mutex> lock(mLockMutex);
-  mLocker = uuid;
-  mLockStart = boost::chrono::system_clock::now();
-  mLockUpdated = mLockStart;
+  librados::ObjectWriteOperation op;
+  op.omap_set(keys);
 
-  radosfs_debug("Set/renew exclusive lock: %s ", mLocker.c_str());
-}
+  int ret = mPool->ioctx.operate(inode(), &op);
 
-int
-FileIO::unlockShared()
-{
-  int ret = mPool->ioctx.unlock(inode(), FILE_CHUNK_LOCKER,
-                                FILE_CHUNK_LOCKER_COOKIE_WRITE);
-  mLocker = "";
-  radosfs_debug("Unlocked shared lock: %d", ret);
-  return ret;
-}
+  if (ret != 0)
+  {
+    radosfs_debug("Failed to mark %lu chunks as allocated on '%s': %s",
+                  keys.size(), inode().c_str(), strerror(-ret));
+    return ret;
+  }
 
-int
-FileIO::unlockExclusive()
-{
-  int ret = mPool->ioctx.unlock(inode(), FILE_CHUNK_LOCKER,
-                                FILE_CHUNK_LOCKER_COOKIE_OTHER);
-  mLocker = "";
-  radosfs_debug("Unlocked exclusive lock: %d", ret);
-  return ret;
-}
+  boost::unique_lock<boost::mutex> lock(mAllocatedChunksMutex);
 
-int
-FileIO::unlock()
-{
-  if (unlockShared() != 0)
-    return unlockExclusive();
+  std::set<size_t>::const_iterator it;
+  for (it = chunks.begin(); it != chunks.end(); it++)
+  {
+    if (*it == 0)
+      continue;
+
+    if (mAllocatedChunks.size() <= *it)
+      mAllocatedChunks.resize(*it + 1, false);
+
+    mAllocatedChunks[*it] = true;
+  }
 
   return 0;
 }
 
-int
-FileIO::verifyWriteParams(off_t offset, size_t length)
+/**
+ * Finds where the data of the inode is, starting from \a offset, like
+ * SEEK_DATA in lseek. The holes are the chunks that were never written, so
+ * this only skips whole chunks (and only for inodes that track them).
+ * @param offset the offset from which to look for data.
+ * @return the offset of the data, -ENXIO if there is no data after \a offset,
+ *         or a negative error code otherwise.
+ */
+off_t
+FileIO::seekData(off_t offset)
 {
-  int ret = 0;
+  flushWriteBehind();
+  mOpManager.sync();
+
+  u_int64_t size = 0;
+  ssize_t ret = getLastChunkIndexAndSize(&size);
+
+  if (ret < 0 && ret != -ENOENT && ret != -ENODATA)
+    return ret;
+
+  if (offset < 0 || (u_int64_t) offset >= size)
+    return -ENXIO;
+
+  bool refreshed = false;
+
+  for (size_t chunk = offset / mChunkSize; chunk * mChunkSize < size; chunk++)
+  {
+    if (!isHole(chunk, &refreshed))
+      return std::max(offset, (off_t) (chunk * mChunkSize));
+  }
+
+  return -ENXIO;
+}
+
+/**
+ * Finds the next hole in the inode, starting from \a offset, like SEEK_HOLE
+ * in lseek. The end of the inode counts as a hole.
+ * @see FileIO::seekData
+ * @param offset the offset from which to look for a hole.
+ * @return the offset of the hole, -ENXIO if \a offset is beyond the inode's
+ *         size, or a negative error code otherwise.
+ */
+off_t
+FileIO::seekHole(off_t offset)
+{
+  flushWriteBehind();
+  mOpManager.sync();
+
+  u_int64_t size = 0;
+  ssize_t ret = getLastChunkIndexAndSize(&size);
+
+  if (ret < 0 && ret != -ENOENT && ret != -ENODATA)
+    return ret;
+
+  if (offset < 0 || (u_int64_t) offset >= size)
+    return -ENXIO;
+
+  bool refreshed = false;
+
+  for (size_t chunk = offset / mChunkSize; chunk * mChunkSize < size; chunk++)
+  {
+    if (isHole(chunk, &refreshed))
+      return std::max(offset, (off_t) (chunk * mChunkSize));
+  }
+
+  return size;
+}
+
+bool
+FileIO::shouldFillChunkCache(size_t fileChunk)
+{
+  boost::unique_lock<boost::mutex> lock(mUncacheableChunksMutex);
+
+  return mUncacheableChunks.count(fileChunk) == 0;
+}
+
+void
+FileIO::invalidateChunkCache(void)
+{
+  if (mChunkCache)
+    mChunkCache->invalidate(mInode);
+
+  boost::unique_lock<boost::mutex> lock(mUncacheableChunksMutex);
+  mUncacheableChunks.clear();
+}
+
+ssize_t
+FileIO::read(char *buff, off_t offset, size_t blen)
+{
+  flushWriteBehind();
+  mOpManager.sync();
+
+  if (blen == 0)
+  {
+    radosfs_debug("Invalid length for reading. Cannot read 0 bytes.");
+    return -EINVAL;
+  }
+
+  size_t readAheadBytes = 0;
+  Metrics *metrics = mMetrics;
+  MetricsTimer timer(metrics, Metrics::OP_READ);
+
+  if (mReadAhead)
+    readAheadBytes = readFromReadAhead(buff, offset, blen);
+
+  ssize_t opRet = 0;
+  ssize_t ret = 0;
+
+  if (readAheadBytes < blen)
+  {
+    FileReadData readData(buff + readAheadBytes, offset + readAheadBytes,
+                          blen - readAheadBytes, &opRet);
+
+    std::vector<FileReadData> intervals;
+    intervals.push_back(readData);
+
+    std::string opId;
+
+    ret = read(intervals, &opId);
+
+    if (ret == 0)
+      ret = sync(opId);
+
+    // Only return the error if nothing could be read from the read-ahead
+    // buffers (a subsequent read will return the error then)
+    if (ret != 0)
+    {
+      if (readAheadBytes == 0)
+        return timer.finish(ret);
+
+      if (metrics)
+        metrics->add(Metrics::COUNTER_BYTES_READ, readAheadBytes);
+      return readAheadBytes;
+    }
+  }
+
+  ret = readAheadBytes + opRet;
+
+  if (ret > 0 && metrics)
+    metrics->add(Metrics::COUNTER_BYTES_READ, ret);
+
+  if (mReadAhead && (size_t) ret == blen)
+  {
+    boost::unique_lock<boost::mutex> lock(mReadAheadMutex);
+    scheduleReadAhead(offset + blen);
+  }
+
+  return ret;
+}
+
+void
+FileIO::updateReadAheadWindow(off_t offset, size_t blen,
+                              std::deque<ReadAheadBufferSP> &discarded)
+{
+  // Important: this method needs to be run in a scope where mReadAheadMutex is
+  // locked
+
+  if (offset == mReadAheadNextOffset)
+  {
+    // The read is sequential so the window grows
+    mReadAheadWindow = std::max(mReadAheadWindow * 2, blen);
+
+    if (mReadAheadWindow > FILE_READ_AHEAD_MAX_SIZE)
+      mReadAheadWindow = FILE_READ_AHEAD_MAX_SIZE;
+  }
+  else
+  {
+    // The sequential pattern is broken so the window shrinks and the data
+    // that was read ahead is discarded
+    mReadAheadWindow /= 2;
+
+    if (mReadAheadWindow < FILE_READ_AHEAD_MIN_SIZE)
+      mReadAheadWindow = 0;
+
+    clearReadAheadBuffers(discarded);
+  }
+
+  mReadAheadNextOffset = offset + blen;
+}
+
+size_t
+FileIO::readFromReadAhead(char *buff, off_t offset, size_t blen)
+{
+  // Declared before the lock so the discarded buffers (which may wait for
+  // their reads) are only released after it is unlocked
+  std::deque<ReadAheadBufferSP> buffers, discarded;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mReadAheadMutex);
+    updateReadAheadWindow(offset, blen, discarded);
+    buffers = mReadAheadBuffers;
+  }
+
+  // The read-ahead operations are waited for without holding mReadAheadMutex
+  // so other reads of the file are not blocked by the cluster meanwhile
+  size_t bytesRead = 0;
+  size_t consumed = 0;
+  bool discardAll = false;
+
+  for (size_t i = 0; i < buffers.size() && bytesRead < blen; i++)
+  {
+    const FileReadDataImp &readData = buffers[i]->readData;
+    const off_t currentOffset = offset + bytesRead;
+
+    if (currentOffset >= readData.offset + (off_t) readData.length)
+    {
+      consumed = i + 1;
+      continue;
+    }
+
+    if (currentOffset < readData.offset)
+      break;
+
+    int ret = buffers[i]->asyncOp->waitForCompletion();
+    size_t validBytes = 0;
+
+    if (ret == 0 && buffers[i]->readBytes > 0)
+      validBytes = buffers[i]->readBytes;
+
+    const off_t validEnd = readData.offset + validBytes;
+
+    if (currentOffset >= validEnd)
+    {
+      // The file ended (or an error occurred) before this offset so there is
+      // nothing else to be used from what was read ahead
+      discardAll = true;
+      break;
+    }
+
+    const size_t length = std::min(blen - bytesRead,
+                                   (size_t) (validEnd - currentOffset));
+
+    memcpy(buff + bytesRead,
+           readData.buff + (currentOffset - readData.offset), length);
+    bytesRead += length;
+
+    if (currentOffset + (off_t) length == validEnd)
+    {
+      consumed = i + 1;
+
+      if (validBytes < readData.length)
+      {
+        discardAll = true;
+        break;
+      }
+    }
+  }
+
+  {
+    boost::unique_lock<boost::mutex> lock(mReadAheadMutex);
+
+    if (discardAll)
+    {
+      clearReadAheadBuffers(discarded);
+    }
+    else
+    {
+      // Other reads may have discarded the buffers meanwhile
+      for (size_t i = 0; i < consumed && !mReadAheadBuffers.empty() &&
+             mReadAheadBuffers.front() == buffers[i]; i++)
+      {
+        discarded.push_back(mReadAheadBuffers.front());
+        mReadAheadBuffers.pop_front();
+      }
+    }
+  }
+
+  if (bytesRead > 0)
+  {
+    radosfs_debug("Read %lu bytes from the read-ahead buffers of inode '%s': "
+                  "offset=%lu; length=%lu", bytesRead, inode().c_str(),
+                  offset, blen);
+  }
+
+  return bytesRead;
+}
+
+void
+FileIO::scheduleReadAhead(off_t offset)
+{
+  // Important: this method needs to be run in a scope where mReadAheadMutex is
+  // locked
+
+  if (mReadAheadWindow == 0)
+    return;
+
+  off_t readAheadOffset = offset;
+
+  if (!mReadAheadBuffers.empty())
+  {
+    const FileReadDataImp &last = mReadAheadBuffers.back()->readData;
+    readAheadOffset = std::max(readAheadOffset,
+                               last.offset + (off_t) last.length);
+  }
+
+  off_t windowEnd = std::min((size_t) offset + mReadAheadWindow, mPool->size);
+
+  // Avoid issuing many small reads when only a small part of the window has
+  // been consumed
+  if (readAheadOffset >= windowEnd ||
+      (size_t) (windowEnd - readAheadOffset) < mReadAheadWindow / 2)
+  {
+    return;
+  }
+
+  const size_t length = windowEnd - readAheadOffset;
+  ReadAheadBufferSP readAhead(new ReadAheadBuffer(readAheadOffset, length));
+
+  std::vector<FileReadData> intervals;
+  intervals.push_back(readAhead->readData);
+
+  radosfs_debug("Reading ahead in inode '%s' (op id='%s'): offset=%lu; "
+                "length=%lu", inode().c_str(), readAhead->asyncOp->id().c_str(),
+                readAheadOffset, length);
+
+  vectorRead(intervals, readAhead->asyncOp);
+  mReadAheadBuffers.push_back(readAhead);
+}
+
+void
+FileIO::clearReadAheadBuffers(std::deque<ReadAheadBufferSP> &discarded)
+{
+  // Important: this method needs to be run in a scope where mReadAheadMutex is
+  // locked
+
+  // The buffers wait for their reads when released, so they are handed to the
+  // caller to be released once mReadAheadMutex is unlocked
+  discarded.insert(discarded.end(), mReadAheadBuffers.begin(),
+                   mReadAheadBuffers.end());
+  mReadAheadBuffers.clear();
+}
+
+void
+FileIO::dropReadAhead(void)
+{
+  std::deque<ReadAheadBufferSP> discarded;
+  boost::unique_lock<boost::mutex> lock(mReadAheadMutex);
+
+  clearReadAheadBuffers(discarded);
+  mReadAheadWindow = 0;
+  mReadAheadNextOffset = 0;
+}
+
+int
+FileIO::writeSync(const char *buff, off_t offset, size_t blen)
+{
+  int ret;
+
+  AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+  asyncOp->mPriv->setTracer(mTracer);
+  mOpManager.addOperation(asyncOp);
+
+  if ((ret = verifyWriteParams(offset, blen)) != 0)
+    return ret;
+
+  dropReadAhead();
+  flushWriteBehind();
+
+  ret = realWrite(const_cast<char *>(buff), offset, blen, false, asyncOp, true);
+
+  // The chunks have been written (or failed to) once realWrite returns
+  if (ret == 0)
+    ret = asyncOp->returnValue();
+
+  if (ret == 0)
+    ret = flushPendingSize();
+
+  return ret;
+}
+
+int
+FileIO::write(const char *buff, off_t offset, size_t blen, std::string *opId,
+              bool copyBuffer, AsyncOpCallback callback, void *arg,
+              AsyncOpBufferCallback bufferCallback)
+{
+  int ret = 0;
+
+  if ((ret = verifyWriteParams(offset, blen)) != 0)
+    return ret;
+
+  AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+  asyncOp->mPriv->setTracer(mTracer);
+
+  if (callback)
+    asyncOp->setCallback(callback, arg);
+
+  if (bufferCallback)
+    asyncOp->setBufferCallback(bufferCallback, buff, arg);
+
+  mOpManager.addOperation(asyncOp);
+
+  if (opId)
+    opId->assign(asyncOp->id());
+
+  dropReadAhead();
+
+  if (bufferWrite(buff, offset, blen, asyncOp))
+  {
+    asyncOp->mPriv->releaseBuffer();
+    return 0;
+  }
+
+  // Any data in the write-behind buffer has to be written before this
+  // operation so it does not override it
+  flushWriteBehind();
+
+  char *bufferToWrite = const_cast<char *>(buff);
+
+  if (copyBuffer)
+  {
+    bufferToWrite = new char[blen];
+    memcpy(bufferToWrite, buff, blen);
+    asyncOp->mPriv->releaseBuffer();
+  }
+
+  mRadosFs->mPriv->scheduler.post(boost::bind(&FileIO::realWrite, this,
+                                              bufferToWrite, offset, blen,
+                                              copyBuffer, asyncOp, false));
+  return 0;
+}
+
+void
+onCompleted(rados_completion_t comp, void *arg)
+{
+  int ret = rados_aio_get_return_value(comp);
+  std::string *msg = reinterpret_cast<std::string *>(arg);
+
+  radosfs_debug("Completed: %s: retcode=%d (%s)", msg->c_str(), ret,
+                strerror(abs(ret)));
+  delete msg;
+}
+
+void
+FileIO::setCompletionDebugMsg(librados::AioCompletion *completion,
+                              const std::string &message)
+{
+  if (mRadosFs && mRadosFs->logLevel() == Filesystem::LOG_LEVEL_DEBUG)
+  {
+    std::string *arg = new std::string(message);
+    completion->set_complete_callback(arg, onCompleted);
+  }
+}
+
+static unsigned int
+nextLockBackoff(unsigned int backoff)
+{
+  return std::min(backoff * 2, (unsigned int) FILE_LOCK_BACKOFF_MAX);
+}
+
+int
+FileIO::tryLock(const std::string &uuid, bool exclusive)
+{
+  int ret;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    boost::chrono::duration<double> seconds;
+    boost::chrono::system_clock::time_point now =
+        boost::chrono::system_clock::now();
+
+    {
+      boost::unique_lock<boost::mutex> leaseLock(mLockLeaseMutex);
+      seconds = now - mLockStart;
+    }
+
+    if (seconds.count() < FILE_LOCK_DURATION - 1)
+    {
+      radosfs_debug_category(LOCKS, "Keep %s lock: %s %s",
+                             exclusive ? "exclusive" : "shared",
+                             mLocker.c_str(), uuid.c_str());
+      mLockUpdated = now;
+      if (mLocker == "")
+        mLocker = uuid;
+
+      if (mLocker == uuid)
+      {
+        scheduleIdleCheck(FILE_IDLE_LOCK_TIMEOUT);
+        return 0;
+      }
+    }
+  }
+
+  timeval tm;
+  tm.tv_sec = FILE_LOCK_DURATION;
+  tm.tv_usec = 0;
+
+  Metrics *metrics = mMetrics;
+  MetricsTimer timer(metrics, Metrics::OP_LOCK);
+  TraceSpan span(0, exclusive ? "lock_exclusive" : "lock_shared", "file");
+
+  if (exclusive)
+  {
+    ret = mPool->ioctx.lock_exclusive(inode(), FILE_CHUNK_LOCKER,
+                                      FILE_CHUNK_LOCKER_COOKIE_OTHER, "", &tm,
+                                      0);
+  }
+  else
+  {
+    ret = mPool->ioctx.lock_shared(inode(), FILE_CHUNK_LOCKER,
+                                   FILE_CHUNK_LOCKER_COOKIE_WRITE,
+                                   FILE_CHUNK_LOCKER_TAG, "", &tm, 0);
+  }
+
+  timer.finish(ret);
+
+  if (ret == -EBUSY)
+  {
+    if (metrics)
+      metrics->add(Metrics::COUNTER_LOCK_RETRIES);
+    return ret;
+  }
+
+  boost::unique_lock<boost::mutex> lock(mLockMutex);
+  mLocker = uuid;
+
+  {
+    boost::unique_lock<boost::mutex> leaseLock(mLockLeaseMutex);
+    mLockStart = boost::chrono::system_clock::now();
+    mLockUpdated = mLockStart;
+    mLockExclusive = exclusive;
+  }
+
+  setSizeAuthoritative(exclusive);
+  scheduleIdleCheck(FILE_IDLE_LOCK_TIMEOUT);
+
+  radosfs_debug_category(LOCKS, "Set/renew %s lock: %s ",
+                         exclusive ? "exclusive" : "shared", mLocker.c_str());
+
+  return 0;
+}
+
+void
+FileIO::lock(const std::string &uuid, bool exclusive)
+{
+  unsigned int backoff = FILE_LOCK_BACKOFF_MIN;
+
+  while (tryLock(uuid, exclusive) == -EBUSY)
+  {
+    boost::this_thread::sleep_for(
+          boost::chrono::microseconds(backoffWithJitter(backoff)));
+    backoff = nextLockBackoff(backoff);
+  }
+}
+
+void
+FileIO::lockShared(const std::string &uuid)
+{
+  lock(uuid, false);
+}
+
+void
+FileIO::lockExclusive(const std::string &uuid)
+{
+  lock(uuid, true);
+}
+
+void
+FileIO::renewLockIfNeeded(void)
+{
+  // It only needs mLockLeaseMutex, so it can be run while a write waits for
+  // its operations holding mLockMutex
+  boost::unique_lock<boost::mutex> leaseLock(mLockLeaseMutex);
+  boost::chrono::system_clock::time_point now =
+      boost::chrono::system_clock::now();
+  boost::chrono::duration<double> seconds = now - mLockStart;
+
+  if (seconds.count() < FILE_LOCK_DURATION - FILE_LOCK_RENEW_MARGIN ||
+      seconds.count() >= FILE_LOCK_DURATION - 1)
+  {
+    return;
+  }
+
+  timeval tm;
+  tm.tv_sec = FILE_LOCK_DURATION;
+  tm.tv_usec = 0;
+  int ret;
+
+  if (mLockExclusive)
+  {
+    ret = mPool->ioctx.lock_exclusive(inode(), FILE_CHUNK_LOCKER,
+                                      FILE_CHUNK_LOCKER_COOKIE_OTHER, "", &tm,
+                                      LIBRADOS_LOCK_FLAG_RENEW);
+  }
+  else
+  {
+    ret = mPool->ioctx.lock_shared(inode(), FILE_CHUNK_LOCKER,
+                                   FILE_CHUNK_LOCKER_COOKIE_WRITE,
+                                   FILE_CHUNK_LOCKER_TAG, "", &tm,
+                                   LIBRADOS_LOCK_FLAG_RENEW);
+  }
+
+  if (ret == 0)
+  {
+    mLockStart = now;
+    setSizeAuthoritative(mLockExclusive);
+  }
+
+  radosfs_debug_category(LOCKS, "Renewed %s lock on '%s': retcode=%d (%s)",
+                         mLockExclusive ? "exclusive" : "shared",
+                         inode().c_str(), ret, strerror(abs(ret)));
+}
+
+int
+FileIO::unlockShared()
+{
+  int ret = mPool->ioctx.unlock(inode(), FILE_CHUNK_LOCKER,
+                                FILE_CHUNK_LOCKER_COOKIE_WRITE);
+  mLocker = "";
+  radosfs_debug_category(LOCKS, "Unlocked shared lock: %d", ret);
+  return ret;
+}
+
+int
+FileIO::unlockExclusive()
+{
+  int ret = mPool->ioctx.unlock(inode(), FILE_CHUNK_LOCKER,
+                                FILE_CHUNK_LOCKER_COOKIE_OTHER);
+  mLocker = "";
+  radosfs_debug_category(LOCKS, "Unlocked exclusive lock: %d", ret);
+  return ret;
+}
+
+int
+FileIO::unlock()
+{
+  if (unlockShared() != 0)
+    return unlockExclusive();
+
+  return 0;
+}
+
+int
+FileIO::verifyWriteParams(off_t offset, size_t length)
+{
+  int ret = 0;
 
   if (length == 0)
   {
-    radosfs_debug("Invalid length for writing. Cannot write 0 bytes.");
-    ret = -EINVAL;
+    radosfs_debug("Invalid length for writing. Cannot write 0 bytes.");
+    ret = -EINVAL;
+  }
+
+  if (offset + length > mPool->size)
+    ret = -EFBIG;
+
+  return ret;
+}
+
+int
+FileIO::setAlignedChunkWriteOp(librados::ObjectWriteOperation &op,
+                               size_t chunkIndex,
+                               const size_t offset,
+                               const std::string &newContents)
+{
+  WriteBehindExtents extents;
+  extents[offset] = newContents;
+
+  return setAlignedChunkWriteOp(op, chunkIndex, extents);
+}
+
+// Sets the op to rewrite the chunk with the given extents applied to its
+// current contents. If those cannot be read, the op is left untouched and the
+// error is returned, since writing the chunk would lose them.
+int
+FileIO::setAlignedChunkWriteOp(librados::ObjectWriteOperation &op,
+                               size_t chunkIndex,
+                               const WriteBehindExtents &extents)
+{
+  if (mCompression)
+    return setCompressedChunkWriteOp(op, chunkIndex, extents);
+
+  librados::bufferlist contentsBl;
+  WriteBehindExtents::const_iterator extentIt = extents.begin();
+
+  // A single extent covering the whole chunk does not need the chunk's
+  // current contents, so it is written without reading it first
+  if (extents.size() == 1 && (*extentIt).first == 0 &&
+      (*extentIt).second.length() == mChunkSize)
+  {
+    contentsBl.append((*extentIt).second);
+    op.write_full(contentsBl);
+
+    return 0;
+  }
+
+  std::map<std::string, librados::bufferlist> xattrs;
+  librados::ObjectReadOperation readOp;
+  const std::string chunkName = makeFileChunkName(inode(), chunkIndex);
+
+  readOp.read(0, mChunkSize, &contentsBl, 0);
+  readOp.getxattrs(&xattrs, 0);
+
+  int ret = chunkPool(chunkIndex)->ioctx.operate(chunkName, &readOp, 0);
+
+  // A chunk that does not exist yet is just written from zeros
+  if (ret < 0 && ret != -ENOENT)
+  {
+    radosfs_debug("Failed to read chunk '%s' before rewriting it: %s",
+                  chunkName.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  std::string contents;
+  contents.reserve(mChunkSize);
+
+  if (contentsBl.length() > 0)
+  {
+    contents.assign(contentsBl.c_str(), contentsBl.length());
+  }
+  else
+  {
+    contents.assign(mChunkSize, '\0');
+  }
+
+  for (; extentIt != extents.end(); extentIt++)
+  {
+    const std::string &newContents = (*extentIt).second;
+    contents.replace((*extentIt).first, newContents.length(), newContents);
+  }
+
+  if (contentsBl.length() == contents.length())
+  {
+    contentsBl.copy_in(0, contents.length(), contents.c_str());
+  }
+  else
+  {
+    contentsBl.clear();
+    contentsBl.append(contents);
+  }
+
+  op.remove();
+  op.set_op_flags2(librados::OP_FAILOK);
+  op.create(false);
+
+  std::map<std::string, librados::bufferlist>::iterator it;
+  for (it = xattrs.begin(); it != xattrs.end(); it++)
+  {
+    const std::string &xattrName = (*it).first;
+    op.setxattr(xattrName.c_str(), (*it).second);
+  }
+
+  op.append(contentsBl);
+
+  return 0;
+}
+
+// Reads the (decompressed) contents of a chunk of a compressed file. Chunks
+// that do not exist are considered empty; an error is returned if the chunk
+// cannot be read or decompressed.
+int
+FileIO::readChunkContents(size_t chunkIndex, std::string *contents)
+{
+  librados::bufferlist contentsBl, infoBl;
+  librados::ObjectReadOperation readOp;
+  const std::string chunkName = makeFileChunkName(inode(), chunkIndex);
+  int infoRet = 0;
+
+  contents->clear();
+
+  readOp.read(0, mChunkSize, &contentsBl, 0);
+  readOp.getxattr(XATTR_CHUNK_COMPRESSION, &infoBl, &infoRet);
+  readOp.set_op_flags2(librados::OP_FAILOK);
+
+  int ret = chunkPool(chunkIndex)->ioctx.operate(chunkName, &readOp, 0);
+
+  if (ret == -ENOENT)
+    return 0;
+
+  if (ret < 0)
+  {
+    radosfs_debug("Failed to read chunk '%s' before rewriting it: %s",
+                  chunkName.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  ChunkCompression compression;
+
+  if (infoRet >= 0 && infoBl.length() > 0)
+    ret = compression.parse(std::string(infoBl.c_str(), infoBl.length()));
+  else
+    compression.setUncompressed(contentsBl.length());
+
+  if (ret == 0)
+    ret = compression.decompress(contentsBl.c_str(), contentsBl.length(),
+                                 contents);
+
+  if (ret < 0)
+  {
+    radosfs_debug("Failed to decompress chunk '%s' before rewriting it: %s",
+                  chunkName.c_str(), strerror(abs(ret)));
+    contents->clear();
+  }
+
+  return ret;
+}
+
+// Compressed chunks cannot be changed in place, so the new extents are applied
+// to the chunk's contents and the chunk is compressed and written again as a
+// whole. If truncateSize is not negative, the contents are truncated to it.
+int
+FileIO::setCompressedChunkWriteOp(librados::ObjectWriteOperation &op,
+                                  size_t chunkIndex,
+                                  const WriteBehindExtents &extents,
+                                  ssize_t truncateSize)
+{
+  WriteBehindExtents::const_iterator extentIt = extents.begin();
+  std::string contents;
+
+  // A single extent covering the whole chunk replaces it, so the chunk does
+  // not need to be read (and decompressed) first
+  if (truncateSize >= 0 || extents.size() != 1 || (*extentIt).first != 0 ||
+      (*extentIt).second.length() != mChunkSize)
+  {
+    int ret = readChunkContents(chunkIndex, &contents);
+
+    if (ret != 0)
+      return ret;
+  }
+
+  for (; extentIt != extents.end(); extentIt++)
+  {
+    const std::string &newContents = (*extentIt).second;
+    const size_t end = (*extentIt).first + newContents.length();
+
+    if (contents.length() < end)
+      contents.resize(end, '\0');
+
+    contents.replace((*extentIt).first, newContents.length(), newContents);
+  }
+
+  if (truncateSize >= 0)
+    contents.resize(truncateSize, '\0');
+
+  std::string data, info;
+  ChunkCompression::compress(contents, &data, &info);
+
+  radosfs_debug_category(CHUNKS, "Compressed chunk #%lu of inode '%s' from %lu "
+                         "to %lu bytes", chunkIndex, inode().c_str(),
+                         contents.length(), data.length());
+
+  librados::bufferlist dataBl, infoBl;
+  dataBl.append(data);
+  infoBl.append(info);
+
+  op.write_full(dataBl);
+  op.setxattr(XATTR_CHUNK_COMPRESSION, infoBl);
+
+  return 0;
+}
+
+int
+FileIO::realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
+                  AsyncOpSP asyncOp, bool blockOnLock)
+{
+  int ret = 0;
+  char *originalBuff = buff;
+  Tracer *tracer = asyncOp->mPriv->tracer;
+
+  if (tracer)
+  {
+    tracer->addSpan("queued", "file", asyncOp->id(),
+                    asyncOp->mPriv->createdTime, Tracer::Clock::now());
+  }
+
+  TraceSpan span(tracer, "write", "file", asyncOp->id());
+
+  if (mInlineBuffer && mInlineBuffer->capacity() > 0)
+  {
+    size_t inlineContentsSize = 0;
+    ssize_t opResult = 0;
+
+    if ((size_t) offset < mInlineBuffer->capacity())
+    {
+      opResult = mInlineBuffer->write(buff, offset, blen);
+      inlineContentsSize = opResult;
+    }
+    else
+    {
+      opResult = mInlineBuffer->fillRemainingInlineBuffer();
+    }
+
+    if (opResult < 0)
+    {
+      asyncOp->mPriv->setReady();
+      return ret;
+    }
+
+    offset += (off_t) inlineContentsSize;
+    buff += inlineContentsSize;
+    blen -= (size_t) inlineContentsSize;
+
+    if (blen == 0)
+    {
+      asyncOp->mPriv->setReady();
+
+      if (deleteBuffer)
+        delete[] originalBuff;
+
+      return ret;
+    }
+  }
+
+  touchMtime();
+
+  ChunkWriteArgsSP args(new ChunkWriteArgs);
+  args->buff = buff;
+  args->offset = offset;
+  args->blen = blen;
+  args->originalBuff = originalBuff;
+  args->deleteBuffer = deleteBuffer;
+  args->asyncOp = asyncOp;
+  args->lockBackoff = FILE_LOCK_BACKOFF_MIN;
+
+  if (tracer)
+    args->lockStart = Tracer::Clock::now();
+
+  const size_t firstChunk = offset / mChunkSize;
+  const size_t lastChunk = (offset + blen - 1) / mChunkSize;
+  const bool exclusive = lastChunk > firstChunk;
+
+  if (blockOnLock)
+  {
+    lock(asyncOp->id(), exclusive);
+  }
+  else if (tryLock(asyncOp->id(), exclusive) == -EBUSY)
+  {
+    // Instead of blocking this worker thread while the lock is busy, the
+    // write is handed back to the scheduler to be resumed once the backoff
+    // expires
+    mRadosFs->mPriv->scheduler.postDelayed(
+          boost::bind(&FileIO::retryWriteLock, this, args),
+          backoffWithJitter(args->lockBackoff));
+    return ret;
+  }
+
+  writeChunks(args);
+
+  return ret;
+}
+
+void
+FileIO::retryWriteLock(ChunkWriteArgsSP args)
+{
+  const size_t firstChunk = args->offset / mChunkSize;
+  const size_t lastChunk = (args->offset + args->blen - 1) / mChunkSize;
+  const bool exclusive = lastChunk > firstChunk;
+  TraceSpan span(args->asyncOp->mPriv->tracer, "write", "file",
+                 args->asyncOp->id());
+
+  // If the scheduler is stopping, the delayed jobs are run right away so we
+  // fall back to blocking for the lock instead of retrying endlessly
+  if (mRadosFs->mPriv->scheduler.stopping())
+  {
+    lock(args->asyncOp->id(), exclusive);
+  }
+  else if (tryLock(args->asyncOp->id(), exclusive) == -EBUSY)
+  {
+    args->lockBackoff = nextLockBackoff(args->lockBackoff);
+    mRadosFs->mPriv->scheduler.postDelayed(
+          boost::bind(&FileIO::retryWriteLock, this, args),
+          backoffWithJitter(args->lockBackoff));
+    return;
+  }
+
+  writeChunks(args);
+}
+
+void
+FileIO::writeChunks(ChunkWriteArgsSP args)
+{
+  // Important: this method needs to be run after the chunks' lock has been
+  // acquired
+  char *buff = args->buff;
+  const off_t offset = args->offset;
+  const size_t blen = args->blen;
+  AsyncOpSP asyncOp = args->asyncOp;
+  off_t currentOffset =  offset % mChunkSize;
+  size_t bytesToWrite = blen;
+  size_t firstChunk = offset / mChunkSize;
+  size_t lastChunk = (offset + blen - 1) / mChunkSize;
+  size_t totalChunks = lastChunk - firstChunk + 1;
+  const std::string &opId = asyncOp->id();
+  const size_t totalSize = offset + blen;
+  Metrics *metrics = mMetrics;
+  MetricsTimer timer(metrics, Metrics::OP_WRITE);
+  Tracer *tracer = asyncOp->mPriv->tracer;
+
+  if (tracer)
+  {
+    tracer->addSpan("lock_wait", "file", opId, args->lockStart,
+                    Tracer::Clock::now());
+  }
+
+  {
+    TraceSpan span(tracer, "set_size", "file", opId);
+    setSizeIfBigger(totalSize, asyncOp);
+  }
+
+  int markRet = 0;
+
+  if (mTrackAllocatedChunks)
+  {
+    std::set<size_t> chunks;
+
+    for (size_t chunk = firstChunk; chunk <= lastChunk; chunk++)
+      chunks.insert(chunk);
+
+    markRet = markChunksAllocated(chunks);
+
+    // The chunks are not written if they could not be recorded
+    if (markRet != 0)
+      asyncOp->mPriv->setPreparationError(markRet);
+  }
+
+  radosfs_debug_category(CHUNKS, "Writing in inode '%s' (op id: '%s') to "
+                         "size %lu affecting chunks %lu-%lu", inode().c_str(),
+                         opId.c_str(), totalSize, firstChunk, lastChunk);
+
+  for (size_t i = 0; markRet == 0 && i < totalChunks; i++)
+  {
+    librados::ObjectWriteOperation op;
+    librados::AioCompletion *completion;
+    const std::string &fileChunk = makeFileChunkName(inode(), firstChunk + i);
+    size_t length = std::min(mChunkSize - currentOffset, bytesToWrite);
+    char *chunkBuff = buff + (blen - bytesToWrite);
+
+    if (rewritesWholeChunks())
+    {
+      std::string contentsStr(chunkBuff, length);
+      int chunkRet = setAlignedChunkWriteOp(op, firstChunk + i, currentOffset,
+                                            contentsStr);
+
+      // The chunk is not written rather than losing its current contents
+      if (chunkRet != 0)
+      {
+        asyncOp->mPriv->setPreparationError(chunkRet);
+        currentOffset = 0;
+        bytesToWrite -= length;
+        continue;
+      }
+    }
+    else
+    {
+      // The buffer is not copied but rather used directly by the operation:
+      // it is kept valid at least until this method waits for the operation
+      // to be finished
+      librados::bufferlist contents;
+      contents.append(ceph::buffer::create_static(length, chunkBuff));
+      op.write(currentOffset, contents);
+    }
+
+    TraceSpan span(tracer, "chunk_submit", "file", opId);
+
+    if (span.active())
+      span.setDetail(fileChunk);
+
+    completion = asyncOp->mPriv->createCompletion();
+
+    std::stringstream stream;
+    stream << "Wrote (od id='" << opId << "') chunk '" << fileChunk << "'";
+    setCompletionDebugMsg(completion, stream.str());
+
+    // The chunks of striped files go to different pools, so these are all
+    // in flight at the same time in each of them
+    chunkPool(firstChunk + i)->ioctx.aio_operate(fileChunk, completion, &op);
+
+    currentOffset = 0;
+    bytesToWrite -= length;
+
+    radosfs_debug_category(CHUNKS, "Scheduling writing of chunk '%s' in (op "
+                           "id='%s')", fileChunk.c_str(), opId.c_str());
+  }
+
+  asyncOp->mPriv->setReady();
+
+  {
+    TraceSpan span(tracer, "wait", "file", opId);
+    syncAndResetLocker(asyncOp);
+  }
+
+  timer.finish(asyncOp->returnValue());
+
+  if (metrics)
+    metrics->add(Metrics::COUNTER_BYTES_WRITTEN, blen);
+
+  // Done once the chunks are written: fills of reads started before this
+  // point are dropped by the generation bump and cached ones are removed
+  invalidateChunkCache();
+
+  if (args->deleteBuffer)
+    delete[] args->originalBuff;
+}
+
+const PoolSP &
+FileIO::chunkPool(const PoolSP &pool, const PoolList &stripePools,
+                  size_t chunkIndex)
+{
+  if (stripePools.empty())
+    return pool;
+
+  return stripePools[chunkIndex % stripePools.size()];
+}
+
+int
+FileIO::removeChunkRange(PoolSP pool, const PoolList &stripePools,
+                         const std::string &inode, size_t firstChunk,
+                         size_t lastChunk, size_t window, bool backwards,
+                         AsyncOpSP asyncOp)
+{
+  if (firstChunk > lastChunk)
+    return 0;
+
+  std::deque<librados::AioCompletion *> inFlight;
+  const u_int64_t total = lastChunk - firstChunk + 1;
+  u_int64_t scheduled = 0, done = 0;
+  int ret = 0;
+
+  window = std::max(window, (size_t) 1);
+  asyncOp->mPriv->setProgress(0, total);
+
+  radosfs_debug_category(CHUNKS, "Removing chunks %lu-%lu of inode '%s' (op "
+                         "id='%s') with %lu operations in flight", firstChunk,
+                         lastChunk, inode.c_str(), asyncOp->id().c_str(),
+                         window);
+
+  while (done < total)
+  {
+    // Keep the window of removals in flight full and only wait for the oldest
+    // one when there is no room for more
+    if (scheduled < total && inFlight.size() < window)
+    {
+      const size_t chunk = backwards ? lastChunk - scheduled :
+                                       firstChunk + scheduled;
+      librados::ObjectWriteOperation op;
+      librados::AioCompletion *completion;
+
+      op.remove();
+      completion = librados::Rados::aio_create_completion();
+      chunkPool(pool, stripePools, chunk)->ioctx.aio_operate(
+            makeFileChunkName(inode, chunk), completion, &op);
+      inFlight.push_back(completion);
+      scheduled++;
+
+      continue;
+    }
+
+    librados::AioCompletion *completion = inFlight.front();
+    inFlight.pop_front();
+
+    completion->wait_for_complete();
+    int opRet = completion->get_return_value();
+    completion->release();
+
+    // Chunks that were never written do not exist, so that is not an error
+    if (ret == 0 && opRet != 0 && opRet != -ENOENT)
+      ret = opRet;
+
+    asyncOp->mPriv->setProgress(++done, total);
+  }
+
+  radosfs_debug_category(CHUNKS, "Removed chunks %lu-%lu of inode '%s' (op "
+                         "id='%s'): retcode=%d (%s)", firstChunk, lastChunk,
+                         inode.c_str(), asyncOp->id().c_str(), ret,
+                         strerror(abs(ret)));
+
+  return ret;
+}
+
+void
+FileIO::reapInode(PoolSP pool, const PoolList stripePools,
+                  const std::string inode, size_t chunkSize, size_t window)
+{
+  FileIO io(0, pool, inode, chunkSize);
+  io.setStripePools(stripePools);
+  io.setChunkRemovalWindow(window);
+
+  int ret = io.remove();
+
+  radosfs_debug("Reaped lazily removed inode '%s': retcode=%d (%s)",
+                inode.c_str(), ret, strerror(abs(ret)));
+}
+
+int
+FileIO::remove(void)
+{
+  AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+
+  return remove(asyncOp);
+}
+
+/**
+ * Copies the contents of the file inode into the \a destination inode, which
+ * has to be a new one (not yet written) with the same layout (chunk size,
+ * compression and allocated chunks tracking). Each chunk object is copied by
+ * the cluster itself (copy_from), with up to FILE_CHUNK_COPY_WINDOW copies in
+ * flight, so the data never goes through the client. The chunks' xattributes
+ * (like the size) and omap are copied with them, except for the lock and the
+ * back link, which is set to the destination's path (if it has one).
+ *
+ * @param destination the FileIO of the inode to copy the contents to.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+FileIO::copyTo(FileIO &destination)
+{
+  if (destination.inode() == inode())
+    return -EINVAL;
+
+  if (destination.chunkSize() != chunkSize() ||
+      destination.compression() != compression() ||
+      destination.tracksAllocatedChunks() != tracksAllocatedChunks())
+  {
+    radosfs_debug("Cannot copy inode '%s' to '%s': their layouts differ",
+                  inode().c_str(), destination.inode().c_str());
+    return -EINVAL;
+  }
+
+  u_int64_t size;
+  int ret = destination.readSizeXAttr(&size);
+
+  if (ret == 0)
+    return -EEXIST;
+
+  if (ret != -ENOENT)
+    return ret;
+
+  flushWriteBehind();
+  mOpManager.sync();
+  flushPendingSize();
+
+  // An inode that was never written does not exist yet, so there is nothing
+  // to be copied
+  ret = readSizeXAttr(&size);
+
+  if (ret == -ENOENT)
+    return 0;
+
+  if (ret != 0)
+    return ret;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    unlockShared();
+  }
+
+  const std::string opId = generateUuid();
+  lockExclusive(opId);
+
+  // The size may have been changed by other clients before locking
+  ret = readSizeXAttr(&size);
+
+  if (ret != 0)
+  {
+    resetLocker();
+    return ret;
+  }
+
+  std::string backLink;
+
+  {
+    boost::unique_lock<boost::mutex> lock(destination.mHasBackLinkMutex);
+    backLink = destination.mPath;
+  }
+
+  librados::bufferlist backLinkBl;
+  backLinkBl.append(backLink);
+
+  const size_t lastChunk = (size == 0) ? 0 : (size - 1) / chunkSize();
+  std::deque<std::pair<size_t, librados::AioCompletion *> > inFlight;
+  size_t nextChunk = 0;
+
+  radosfs_debug_category(CHUNKS, "Copying chunks 0-%lu of inode '%s' to '%s' "
+                         "(op id='%s')", lastChunk, inode().c_str(),
+                         destination.inode().c_str(), opId.c_str());
+
+  while (nextChunk <= lastChunk || !inFlight.empty())
+  {
+    if (nextChunk <= lastChunk && inFlight.size() < FILE_CHUNK_COPY_WINDOW)
+    {
+      librados::ObjectWriteOperation op;
+      librados::AioCompletion *completion;
+
+      op.copy_from(makeFileChunkName(inode(), nextChunk),
+                   chunkPool(nextChunk)->ioctx, 0);
+
+      if (nextChunk == 0)
+      {
+        op.rmxattr(FILE_CHUNK_LOCKER_XATTR);
+
+        if (backLink.empty())
+          op.rmxattr(XATTR_INODE_HARD_LINK);
+        else
+          op.setxattr(XATTR_INODE_HARD_LINK, backLinkBl);
+      }
+
+      completion = librados::Rados::aio_create_completion();
+      destination.chunkPool(nextChunk)->ioctx.aio_operate(
+            makeFileChunkName(destination.inode(), nextChunk), completion,
+            &op);
+      inFlight.push_back(std::make_pair(nextChunk, completion));
+      nextChunk++;
+
+      continue;
+    }
+
+    std::pair<size_t, librados::AioCompletion *> op = inFlight.front();
+    inFlight.pop_front();
+
+    op.second->wait_for_complete();
+    int opRet = op.second->get_return_value();
+    op.second->release();
+
+    // Chunks that were never written (holes) do not exist, so that is not an
+    // error, unless it is the inode object itself
+    if (opRet == -ENOENT && op.first > 0)
+      opRet = 0;
+
+    if (ret == 0)
+      ret = opRet;
+  }
+
+  radosfs_debug_category(CHUNKS, "Copied chunks 0-%lu of inode '%s' to '%s' "
+                         "(op id='%s'): retcode=%d (%s)", lastChunk,
+                         inode().c_str(), destination.inode().c_str(),
+                         opId.c_str(), ret, strerror(abs(ret)));
+
+  // All the copies were waited for, so the lock is not needed anymore
+  resetLocker();
+
+  if (ret != 0)
+  {
+    AsyncOpSP removalOp(new AsyncOp(generateUuid()));
+    removeChunkRange(destination.mPool, destination.mStripePools,
+                     destination.inode(), 0, lastChunk,
+                     destination.chunkRemovalWindow(), true, removalOp);
+    return ret;
+  }
+
+  {
+    boost::unique_lock<boost::mutex> lock(destination.mSizeMutex);
+    destination.mCachedSize = size;
+    destination.mCachedSizeTime = boost::chrono::system_clock::now();
+  }
+
+  {
+    boost::unique_lock<boost::mutex> lock(destination.mAllocatedChunksMutex);
+    destination.mAllocatedChunksLoaded = false;
+  }
+
+  if (!backLink.empty())
+    destination.backLinkWritten(backLink);
+
+  return 0;
+}
+
+/**
+ * Removes all the chunks of the file inode. The chunks are removed with up to
+ * the configured number of removals in flight (see
+ * Filesystem::setFileChunkRemovalWindow) and the progress of the removal can
+ * be followed from another thread through \a asyncOp.
+ *
+ * @param asyncOp the operation that tracks the removal.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+FileIO::remove(AsyncOpSP asyncOp)
+{
+  const std::string &opId = asyncOp->id();
+  dropReadAhead();
+  flushWriteBehind();
+  mOpManager.sync();
+
+  {
+    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    unlockShared();
+  }
+
+  lockExclusive(opId);
+
+  ssize_t lastChunk = getLastChunkIndex();
+
+  if (lastChunk < 0)
+  {
+    radosfs_debug("Error trying to remove inode '%s' (retcode=%d): %s",
+                  inode().c_str(), lastChunk, strerror(std::abs(lastChunk)));
+    return lastChunk;
+  }
+
+  radosfs_debug("Remove (op id='%s') inode '%s' affecting chunks 0-%lu",
+                opId.c_str(), inode().c_str(), 0, lastChunk);
+
+  mOpManager.addOperation(asyncOp);
+
+  // We start deleting from the base chunk onward because this will result
+  // in other calls to the object eventually seeing the removal sooner
+  int ret = removeChunkRange(mPool, mStripePools, inode(), 0, lastChunk,
+                             mChunkRemovalWindow, false, asyncOp);
+
+  asyncOp->mPriv->setFinished(ret);
+  syncAndResetLocker(asyncOp);
+  invalidateChunkCache();
+
+  {
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    mPendingSize = 0;
+    mPendingMtime.clear();
+    mCachedSize = -1;
+  }
+
+  return ret;
+}
+
+int
+FileIO::truncate(size_t newSize)
+{
+  AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+
+  return truncate(newSize, asyncOp);
+}
+
+/**
+ * Truncates the file inode to \a newSize. The chunks that are no longer
+ * needed are removed in the same way as in FileIO::remove.
+ *
+ * @param newSize the new size of the file inode.
+ * @param asyncOp the operation that tracks the truncation.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+FileIO::truncate(size_t newSize, AsyncOpSP asyncOp)
+{
+  if (newSize > mPool->size)
+  {
+    radosfs_debug("The size given for truncating is too big for the pool.");
+    return -EFBIG;
+  }
+
+  dropReadAhead();
+  flushWriteBehind();
+  mOpManager.sync();
+
+  touchMtime();
+
+  {
+    boost::unique_lock<boost::mutex> lock(mLockMutex);
+    unlockShared();
+  }
+
+  const std::string &opId = asyncOp->id();
+
+  lockExclusive(opId);
+
+  if (mInlineBuffer)
+  {
+    mInlineBuffer->truncate(newSize);
+  }
+
+  size_t currentSize;
+  ssize_t lastChunk = getLastChunkIndexAndSize(&currentSize);
+
+  if (lastChunk < 0)
+  {
+    if (lastChunk == -ENOENT || lastChunk == -ENODATA)
+      lastChunk = 0;
+    else
+      return lastChunk;
+  }
+
+  size_t newLastChunk = (newSize == 0) ? 0 : (newSize - 1) / chunkSize();
+  bool truncateDown = currentSize > newSize;
+  size_t newLastChunkSize = newSize - newLastChunk * chunkSize();
+  bool hasAlignment = mPool->hasAlignment();
+
+  if (newLastChunk == 0 && newSize > chunkSize())
+    newLastChunk = chunkSize();
+
+  setSize(newSize);
+
+  radosfs_debug_category(CHUNKS, "Truncating chunk '%s' (op id='%s').",
+                         inode().c_str(), opId.c_str());
+
+  mOpManager.addOperation(asyncOp);
+
+  int ret = 0;
+
+  // The chunks out of the new size are removed from the last one backwards
+  if (truncateDown)
+  {
+    ret = removeChunkRange(mPool, mStripePools, inode(), newLastChunk + 1,
+                           lastChunk, mChunkRemovalWindow, true, asyncOp);
+  }
+
+  librados::ObjectWriteOperation op;
+  librados::AioCompletion *completion;
+  const std::string &fileChunk = makeFileChunkName(inode(), newLastChunk);
+
+  // The base chunk should never be deleting on when a truncate occurs
+  // but rather really truncated -- in the case the pool has no alignment --
+  // or have the part out of the truncated range zeroed otherwise.
+  int chunkRet = 0;
+
+  if (mCompression)
+  {
+    WriteBehindExtents noExtents;
+    chunkRet = setCompressedChunkWriteOp(op, newLastChunk, noExtents,
+                                         newLastChunkSize);
+  }
+  else if (hasAlignment)
+  {
+    std::string zeroStr(chunkSize() - newLastChunkSize, '\0');
+    chunkRet = setAlignedChunkWriteOp(op, newLastChunk, newLastChunkSize,
+                                      zeroStr);
+  }
+  else
+  {
+    op.truncate(newLastChunkSize);
+  }
+
+  if (chunkRet == 0)
+  {
+    radosfs_debug_category(CHUNKS, "Truncating chunk '%s' (op id='%s').",
+                           fileChunk.c_str(), opId.c_str());
+
+    op.assert_exists();
+
+    completion = asyncOp->mPriv->createCompletion();
+
+    std::stringstream stream;
+    stream << "Truncate (op id='" << opId << "') chunk '" << fileChunk << "'";
+    setCompletionDebugMsg(completion, stream.str());
+
+    chunkPool(newLastChunk)->ioctx.aio_operate(fileChunk, completion, &op);
+  }
+  else
+  {
+    asyncOp->mPriv->setPreparationError(chunkRet);
+  }
+
+  asyncOp->mPriv->setReady();
+  syncAndResetLocker(asyncOp);
+  invalidateChunkCache();
+
+  if (ret == 0)
+    ret = chunkRet;
+
+  return ret;
+}
+
+ssize_t
+FileIO::getLastChunkIndex(void) const
+{
+  return getLastChunkIndexAndSize(0);
+}
+
+librados::ObjectReadOperation
+makeChunkReadOp(bool hasAlignment, u_int64_t *size, int *statRet,
+                librados::bufferlist *chunkXAttr)
+{
+  librados::ObjectReadOperation op;
+
+  op.stat(size, 0, statRet);
+
+  if (hasAlignment)
+  {
+    std::set<std::string> keys;
+    std::map<std::string, librados::bufferlist> omap;
+
+    // Since the alignment is set, the last chunk will be the same size as the
+    // other ones so we retrieve the real data size which was set as an XAttr
+    keys.insert(XATTR_LAST_CHUNK_SIZE);
+    op.omap_get_vals_by_keys(keys, &omap, 0);
+    op.set_op_flags2(librados::OP_FAILOK);
+  }
+
+  return op;
+}
+
+ssize_t
+getLastValid(int *retValues, size_t valuesSize)
+{
+  ssize_t i;
+  for (i = 0; i < (ssize_t) valuesSize; i++)
+  {
+    if (retValues[i] != 0)
+      break;
+  }
+
+  return i - 1;
+}
+
+ssize_t
+FileIO::getLastChunkIndexAndSize(uint64_t *size) const
+{
+  u_int64_t storedSize(0);
+  ssize_t fileSize(0);
+
+  if (getCachedSize(&storedSize))
+  {
+    fileSize = storedSize;
+  }
+  else
+  {
+    int ret = readSizeXAttr(&storedSize);
+
+    if (ret < 0)
+      return ret;
+
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    mCachedSize = storedSize;
+    mCachedSizeTime = boost::chrono::system_clock::now();
+
+    // A size that was not written yet is more recent than the stored one
+    fileSize = std::max(storedSize, (u_int64_t) mPendingSize);
+  }
+
+  if (size)
+    *size = fileSize;
+
+  if (fileSize > 0)
+    fileSize = (fileSize - 1) / chunkSize();
+
+  return fileSize;
+}
+
+std::string
+FileIO::getChunkPath(off_t offset) const
+{
+  return makeFileChunkName(mInode, offset / mChunkSize);
+}
+
+size_t
+FileIO::getSize() const
+{
+  u_int64_t size = 0;
+  getLastChunkIndexAndSize(&size);
+
+  // Data that is still in the write-behind buffer also counts for the size
+  boost::unique_lock<boost::mutex> lock(mWriteBehindMutex);
+
+  if (mWriteBehindData && mWriteBehindData->fileSize > size)
+    size = mWriteBehindData->fileSize;
+
+  return size;
+}
+
+int
+FileIO::setSizeIfBigger(size_t size, AsyncOpSP asyncOp)
+{
+  bool sizeIsCached, exclusiveLock;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    sizeIsCached = mCachedSize >= 0;
+  }
+
+  {
+    boost::unique_lock<boost::mutex> leaseLock(mLockLeaseMutex);
+    exclusiveLock = mLockExclusive;
+  }
+
+  // Other clients writing with shared locks would not see the sizes kept in
+  // memory until they were flushed, so only exclusive writes are coalesced
+  const bool coalesce = exclusiveLock && !shouldSetBacklink();
+
+  // Getting the size once allows all the following updates to be coalesced
+  if (!sizeIsCached && coalesce)
+    getLastChunkIndexAndSize(0);
+
+  {
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    const bool authoritative =
+        boost::chrono::system_clock::now() < mSizeAuthoritativeUntil;
+
+    // Once the size of the file is known, size updates are kept in memory and
+    // written at most once per FILE_SIZE_UPDATE_INTERVAL; when other clients
+    // may be changing the size, the pending size is set regardless of the
+    // cached one, since the update is only applied if it is bigger anyway
+    if (mCachedSize >= 0 && coalesce)
+    {
+      if (size > mPendingSize && (!authoritative || size > (size_t) mCachedSize))
+      {
+        if (mPendingSize == 0)
+        {
+          mPendingSizeTime = boost::chrono::system_clock::now();
+          scheduleIdleCheck(FILE_SIZE_UPDATE_INTERVAL);
+        }
+
+        mPendingSize = size;
+      }
+
+      return 0;
+    }
+  }
+
+  librados::ObjectWriteOperation writeOp;
+  librados::bufferlist sizeBl, backLinkBl;
+  sizeBl.append(fileSizeToHex(size));
+
+  // Set the new size only if it's greater than the one already set
+  writeOp.setxattr(XATTR_FILE_SIZE, sizeBl);
+  writeOp.cmpxattr(XATTR_FILE_SIZE, LIBRADOS_CMPXATTR_OP_GT, sizeBl);
+
+  // The back link goes in the same operation, so a queued one is no longer
+  // needed
+  if (!mPath.empty() && shouldSetBacklink())
+  {
+    backLinkBl.append(mPath);
+    writeOp.setxattr(XATTR_INODE_HARD_LINK, backLinkBl);
+    mRadosFs->mPriv->takeBacklink(inode());
+  }
+
+  librados::AioCompletion *completion = asyncOp->mPriv->createCompletion();
+
+  std::stringstream stream;
+  stream << "Set size because it was bigger "
+            "(od id='" << asyncOp->id() << "') on '" << inode() << "'";
+  setCompletionDebugMsg(completion, stream.str());
+
+  mPool->ioctx.aio_operate(inode(), completion, &writeOp);
+
+  return 0;
+}
+
+int
+FileIO::setSize(size_t size)
+{
+  librados::bufferlist sizeBl, backLinkBl;
+  sizeBl.append(fileSizeToHex(size));
+
+  librados::ObjectWriteOperation writeOp;
+  writeOp.create(false);
+  writeOp.setxattr(XATTR_FILE_SIZE, sizeBl);
+
+  std::string mtime;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    mtime.swap(mPendingMtime);
+  }
+
+  if (!mtime.empty())
+  {
+    librados::bufferlist mtimeBl;
+    mtimeBl.append(mtime);
+    writeOp.setxattr(XATTR_MTIME, mtimeBl);
+  }
+
+  bool backLinkIsSet = !shouldSetBacklink();
+
+  if (!mPath.empty() && !backLinkIsSet)
+  {
+    backLinkBl.append(mPath);
+    writeOp.setxattr(XATTR_INODE_HARD_LINK, backLinkBl);
+  }
+
+  PendingBacklink queuedBackLink;
+  const bool tookBackLink = !backLinkIsSet &&
+                            mRadosFs->mPriv->takeBacklink(inode(),
+                                                          &queuedBackLink);
+
+  int ret = mPool->ioctx.operate(inode(), &writeOp);
+
+  if (ret == 0 && !backLinkIsSet)
+  {
+    setHasBackLink(true);
+  }
+  else if (tookBackLink)
+  {
+    mRadosFs->mPriv->queueBacklink(queuedBackLink.pool, inode(),
+                                   queuedBackLink.backLink,
+                                   &queuedBackLink.compare);
+  }
+
+  {
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    mPendingSize = 0;
+    mCachedSize = (ret == 0) ? (ssize_t) size : -1;
+    mCachedSizeTime = boost::chrono::system_clock::now();
+
+    // Keep the mtime to be written later, unless a newer one was set meanwhile
+    if (ret != 0 && mPendingMtime.empty())
+      mPendingMtime = mtime;
+  }
+
+  radosfs_debug("Set size %d to '%s': retcode=%d (%s)", size,
+                inode().c_str(), ret, strerror(abs(ret)));
+
+  return ret;
+}
+
+int
+FileIO::readSizeXAttr(u_int64_t *size) const
+{
+  librados::ObjectReadOperation op;
+  librados::bufferlist sizeXAttr;
+
+  op.getxattr(XATTR_FILE_SIZE, &sizeXAttr, 0);
+  op.assert_exists();
+
+  int ret = mPool->ioctx.operate(inode(), &op, 0);
+
+  if (ret < 0)
+    return ret;
+
+  *size = 0;
+
+  if (sizeXAttr.length() > 0)
+  {
+    const std::string sizeStr(sizeXAttr.c_str(), sizeXAttr.length());
+    *size = strtoul(sizeStr.c_str(), 0, 16);
+  }
+
+  return 0;
+}
+
+bool
+FileIO::getCachedSize(u_int64_t *size) const
+{
+  boost::unique_lock<boost::mutex> lock(mSizeMutex);
+
+  if (mCachedSize < 0)
+    return false;
+
+  const boost::chrono::system_clock::time_point now =
+      boost::chrono::system_clock::now();
+
+  // The cached size can be used if no other client can be changing it (the
+  // file is locked exclusively by this client) or if it is recent enough for
+  // the staleness that was configured
+  if (now >= mSizeAuthoritativeUntil)
+  {
+    boost::chrono::duration<double> seconds = now - mCachedSizeTime;
+
+    if (mSizeCacheStaleness <= 0 || seconds.count() > mSizeCacheStaleness)
+      return false;
+  }
+
+  *size = std::max((size_t) mCachedSize, mPendingSize);
+
+  return true;
+}
+
+void
+FileIO::setSizeAuthoritative(bool authoritative)
+{
+  boost::unique_lock<boost::mutex> lock(mSizeMutex);
+
+  if (authoritative)
+  {
+    mSizeAuthoritativeUntil = boost::chrono::system_clock::now() +
+                              boost::chrono::seconds(FILE_LOCK_DURATION - 1);
+  }
+  else
+  {
+    mSizeAuthoritativeUntil = boost::chrono::system_clock::time_point();
+  }
+}
+
+/**
+ * Sets the maximum age of the cached file size that can be used when the size
+ * of the file is requested (if the file is not exclusively locked by this
+ * client, in which case the cached size is always used).
+ * @param seconds the maximum age (in seconds) of the cached size or 0 to
+ *        always get the size from the cluster.
+ */
+void
+FileIO::setSizeCacheStaleness(double seconds)
+{
+  boost::unique_lock<boost::mutex> lock(mSizeMutex);
+  mSizeCacheStaleness = seconds;
+}
+
+/**
+ * Writes the size and mtime set by writes that have been kept in memory (so
+ * several writes only need one size update and no mtime update of their own).
+ * When both are pending, they are written in the same operation.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+FileIO::flushPendingSize(void)
+{
+  size_t size;
+  std::string mtime;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+
+    if (mPendingSize == 0 && mPendingMtime.empty())
+      return 0;
+
+    size = mPendingSize;
+    mPendingSize = 0;
+    mtime.swap(mPendingMtime);
+  }
+
+  librados::ObjectWriteOperation writeOp;
+  librados::bufferlist sizeBl, mtimeBl;
+  int ret = 0;
+
+  sizeBl.append(fileSizeToHex(size));
+  mtimeBl.append(mtime);
+
+  if (size > 0)
+  {
+    // Set the new size only if it's greater than the one already set
+    writeOp.setxattr(XATTR_FILE_SIZE, sizeBl);
+    writeOp.cmpxattr(XATTR_FILE_SIZE, LIBRADOS_CMPXATTR_OP_GT, sizeBl);
+
+    if (!mtime.empty())
+      writeOp.setxattr(XATTR_MTIME, mtimeBl);
+
+    ret = mPool->ioctx.operate(inode(), &writeOp);
+  }
+
+  // The comparison failing means that a bigger size is already set (and that
+  // the mtime, which was in the same operation, still has to be written)
+  if (ret == -ECANCELED || (size == 0 && !mtime.empty()))
+  {
+    librados::ObjectWriteOperation mtimeOp;
+    mtimeOp.setxattr(XATTR_MTIME, mtimeBl);
+
+    ret = mtime.empty() ? 0 : mPool->ioctx.operate(inode(), &mtimeOp);
+  }
+
+  boost::unique_lock<boost::mutex> lock(mSizeMutex);
+
+  if (ret == 0)
+  {
+    mCachedSize = std::max(mCachedSize, (ssize_t) size);
   }
+  else
+  {
+    mPendingSize = std::max(mPendingSize, size);
 
-  if (offset + length > mPool->size)
-    ret = -EFBIG;
+    if (mPendingMtime.empty())
+      mPendingMtime = mtime;
+  }
+
+  radosfs_debug("Flushed pending size %lu and mtime '%s' to '%s': retcode=%d "
+                "(%s)", size, mtime.c_str(), inode().c_str(), ret,
+                strerror(abs(ret)));
 
   return ret;
 }
 
+/**
+ * Sets the file's mtime to the current time. As with the size set by writes,
+ * it is kept in memory and written at most once per FILE_SIZE_UPDATE_INTERVAL
+ * (or when the file is synced, unlocked or released), instead of costing an
+ * operation per write.
+ */
 void
-FileIO::setAlignedChunkWriteOp(librados::ObjectWriteOperation &op,
-                               const std::string &fileChunk,
-                               const size_t offset,
-                               const std::string &newContents)
+FileIO::touchMtime(void)
 {
-  std::map<std::string, librados::bufferlist> xattrs;
-  librados::ObjectReadOperation readOp;
-  librados::bufferlist contentsBl;
+  boost::unique_lock<boost::mutex> lock(mSizeMutex);
 
-  readOp.read(0, mChunkSize, &contentsBl, 0);
-  readOp.getxattrs(&xattrs, 0);
+  if (mPendingMtime.empty())
+  {
+    mPendingMtimeTime = boost::chrono::system_clock::now();
+    scheduleIdleCheck(FILE_SIZE_UPDATE_INTERVAL);
+  }
 
-  mPool->ioctx.operate(fileChunk, &readOp, 0);
+  mPendingMtime = getCurrentTimeStr();
+}
 
-  std::string contents;
-  contents.reserve(mChunkSize);
+/**
+ * Gets the mtime set by this client that was not yet written to the inode.
+ * @param[out] spec the pending mtime.
+ * @return whether there is a pending mtime.
+ */
+bool
+FileIO::pendingMtime(timespec *spec) const
+{
+  boost::unique_lock<boost::mutex> lock(mSizeMutex);
+
+  if (mPendingMtime.empty())
+    return false;
+
+  strToTimespec(mPendingMtime, spec);
+
+  return true;
+}
+
+void
+FileIO::managePendingSize(double interval)
+{
+  bool shouldFlush = false;
 
-  if (contentsBl.length() > 0)
   {
-    contents.assign(contentsBl.c_str(), contentsBl.length());
+    boost::unique_lock<boost::mutex> lock(mSizeMutex);
+    const boost::chrono::system_clock::time_point now =
+        boost::chrono::system_clock::now();
+
+    if (mPendingSize > 0)
+    {
+      boost::chrono::duration<double> seconds = now - mPendingSizeTime;
+      shouldFlush = seconds.count() >= interval;
+    }
+
+    if (!mPendingMtime.empty())
+    {
+      boost::chrono::duration<double> seconds = now - mPendingMtimeTime;
+      shouldFlush = shouldFlush || seconds.count() >= interval;
+    }
+  }
+
+  if (shouldFlush)
+    flushPendingSize();
+}
+
+void
+FileIO::manageIdleLock(double idleTimeout)
+{
+  if (mLockMutex.try_lock())
+  {
+    if (mLocker == "")
+    {
+      unlockIfTimeIsOut(idleTimeout);
+    }
+    else
+    {
+      // The lease of a lock in use is renewed here, so the write path does
+      // not need to do it for every chunk
+      renewLockIfNeeded();
+    }
+
+    mLockMutex.unlock();
   }
-  else if (newContents.length() != mChunkSize)
+  else
   {
-    contents.assign(mChunkSize, '\0');
+    // A write is holding mLockMutex (e.g. waiting for its chunks to be
+    // written), so the lock is in use and its lease may need renewing
+    renewLockIfNeeded();
   }
+}
+
+/**
+ * Checks whether this FileIO still has something for the idle checker to do:
+ * a lock that has not expired, buffered writes, a pending size update or
+ * operations that are still running. Whatever is busy at the moment counts as
+ * needing attention.
+ */
+bool
+FileIO::needsIdleManagement(void)
+{
+  if (hasRunningAsyncOps())
+    return true;
 
-  contents.replace(offset, newContents.length(), newContents);
+  if (!mWriteBehindMutex.try_lock())
+    return true;
 
-  if (contentsBl.length() == contents.length())
+  bool hasWriteBehindData = mWriteBehindData.get() != 0;
+  mWriteBehindMutex.unlock();
+
+  if (hasWriteBehindData)
+    return true;
+
+  if (!mSizeMutex.try_lock())
+    return true;
+
+  bool hasPendingSize = mPendingSize > 0 || !mPendingMtime.empty();
+  mSizeMutex.unlock();
+
+  if (hasPendingSize)
+    return true;
+
+  if (!mLockMutex.try_lock())
+    return true;
+
+  mLockLeaseMutex.lock();
+  boost::chrono::duration<double> seconds =
+      boost::chrono::system_clock::now() - mLockStart;
+  mLockLeaseMutex.unlock();
+
+  bool hasLock = mLocker != "" || seconds.count() < FILE_LOCK_DURATION;
+  mLockMutex.unlock();
+
+  return hasLock;
+}
+
+void
+FileIO::scheduleIdleCheck(double seconds)
+{
+  if (mRadosFs)
+    mRadosFs->mPriv->scheduleFileIOCheck(mInode, seconds);
+}
+
+void
+FileIO::unlockIfTimeIsOut(double idleTimeout)
+{
+  // Important: this method needs to be run in a scoped where mLockMutex is
+  // locked
+  boost::chrono::duration<double> seconds;
+  seconds = boost::chrono::system_clock::now() - mLockUpdated;
+  bool lockIsIdle = seconds.count() >= idleTimeout;
+  bool lockTimedOut = seconds.count() > FILE_LOCK_DURATION;
+
+  if (lockIsIdle && !lockTimedOut)
   {
-    contentsBl.copy_in(0, contents.length(), contents.c_str());
+    radosfs_debug_category(LOCKS, "Unlocked idle lock.");
+
+    // Other clients should see the size of what was written with this lock
+    setSizeAuthoritative(false);
+    flushPendingSize();
+
+    boost::unique_lock<boost::mutex> leaseLock(mLockLeaseMutex);
+
+    unlock();
+
+    // Set the lock start to look as if it expired so it does not try to
+    // unlock (or renew) it anymore.
+    mLockStart = expiredLockDuration();
+    mLockUpdated = mLockStart;
   }
-  else
+}
+
+void
+FileIO::syncAndResetLocker(AsyncOpSP op)
+{
+  boost::unique_lock<boost::mutex> lock(mLockMutex);
+  op->waitForCompletion();
+  mLocker = "";
+}
+
+// Hands back the lock taken for an operation that waited for its own work, so
+// the next one (with its own uuid) can take it again
+void
+FileIO::resetLocker(void)
+{
+  boost::unique_lock<boost::mutex> lock(mLockMutex);
+  mLocker = "";
+}
+
+bool
+FileIO::hasSingleClient(const FileIOSP &io)
+{
+  // If there is only one client using an instance of the given FileIO, then
+  // the use count is 2 because there is a reference hold in FsPriv's map.
+  return io.use_count() == 2;
+}
+
+void
+FileIO::setInlineBuffer(const Stat *parentStat, const std::string path,
+                        size_t bufferSize)
+{
+  std::string parentPath = getParentDir(path, 0);
+
+  if (parentPath == "")
+    return;
+
+  if (mInlineBuffer)
   {
-    contentsBl.clear();
-    contentsBl.append(contents);
+    if ((mInlineBuffer->parentStat.path + mInlineBuffer->fileBaseName) == path)
+      return;
+
+    mInlineBuffer.reset();
   }
 
-  op.remove();
-  op.set_op_flags2(librados::OP_FAILOK);
-  op.create(false);
+  mInlineBuffer.reset(new FileInlineBuffer(mRadosFs, parentStat,
+                                           path.substr(parentPath.length()),
+                                           bufferSize));
+}
 
-  std::map<std::string, librados::bufferlist>::iterator it;
-  for (it = xattrs.begin(); it != xattrs.end(); it++)
+void
+FileIO::setLazyRemoval(bool remove)
+{
+  mLazyRemoval = remove;
+
+  if (mInlineBuffer)
   {
-    const std::string &xattrName = (*it).first;
-    op.setxattr(xattrName.c_str(), (*it).second);
+    boost::unique_lock<boost::mutex> lock(mInlineMemBufferMutex);
+    mInlineBuffer->setMemoryBuffer(&mInlineMemBuffer, &mInlineMemBufferMutex);
+  }
+}
+
+void
+FileIO::setHasBackLink(bool hasBacklink)
+{
+  boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
+  mHasBackLink = hasBacklink;
+}
+
+bool
+FileIO::hasBackLink(void)
+{
+  boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
+  return mHasBackLink;
+}
+
+void
+FileIO::setPath(const std::string &path)
+{
+  boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
+  mPath = path;
+  mHasBackLink = false;
+}
+
+/**
+ * Marks the back link as set if it is the current path of the file (i.e. the
+ * file was not renamed meanwhile).
+ */
+void
+FileIO::backLinkWritten(const std::string &backLink)
+{
+  boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
+
+  if (mPath == backLink)
+    mHasBackLink = true;
+}
+
+/**
+ * Queues setting the file's path as the inode's back link. It is written with
+ * the next size update of the file or, if there's none soon, in a batch with
+ * other back links in the background.
+ */
+void
+FileIO::updateBackLink(const std::string *oldBackLink)
+{
+  std::string path;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
+    path = mPath;
+  }
+
+  mRadosFs->mPriv->queueBacklink(mPool, inode(), path, oldBackLink);
+}
+
+bool
+FileIO::hasRunningAsyncOps()
+{
+  return mOpManager.hasRunningOps();
+}
+
+int
+FileIO::sync(const std::string &opId)
+{
+  flushWriteBehind();
+
+  int ret = mOpManager.sync(opId);
+
+  if (ret == 0)
+    ret = flushPendingSize();
+
+  return ret;
+}
+
+int
+FileIO::pollOp(const std::string &opId)
+{
+  int ret = mOpManager.poll(opId);
+
+  if (ret == 0)
+    ret = flushPendingSize();
+
+  return ret;
+}
+
+int
+FileIO::waitForAnyOp(const std::vector<std::string> &opIds,
+                     std::string *finishedOpId)
+{
+  // Writes kept in the write-behind buffer would otherwise only finish once
+  // the buffer is flushed for being idle
+  flushWriteBehind();
+
+  int ret = mOpManager.waitForAny(opIds, finishedOpId);
+
+  if (ret == 0)
+    ret = flushPendingSize();
+
+  return ret;
+}
+
+void
+FileIO::setWriteBehindSize(size_t size)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mWriteBehindMutex);
+    mWriteBehindMaxSize = size;
+  }
+
+  if (size == 0)
+    flushWriteBehind();
+}
+
+static size_t
+mergeWriteBehindExtent(WriteBehindExtents &extents, off_t offset,
+                       const char *buff, size_t blen)
+{
+  size_t previousBytes = 0;
+  off_t start = offset;
+  std::string contents;
+  WriteBehindExtents::iterator it = extents.upper_bound(offset);
+
+  // Check if the extent before the offset overlaps or is adjacent to the new
+  // data, in which case it is used as the base for the merged extent
+  if (it != extents.begin())
+  {
+    WriteBehindExtents::iterator previous = it;
+    previous--;
+
+    if ((*previous).first + (off_t) (*previous).second.length() >= offset)
+    {
+      start = (*previous).first;
+      contents.swap((*previous).second);
+      previousBytes += contents.length();
+      extents.erase(previous);
+    }
+  }
+
+  const size_t localOffset = offset - start;
+
+  if (contents.length() < localOffset + blen)
+    contents.resize(localOffset + blen);
+
+  contents.replace(localOffset, blen, buff, blen);
+
+  // Absorb the extents that follow and are covered by or adjacent to the
+  // merged one
+  while (it != extents.end() &&
+         (*it).first <= start + (off_t) contents.length())
+  {
+    const std::string &extent = (*it).second;
+    const size_t extentOffset = (*it).first - start;
+
+    if (extentOffset + extent.length() > contents.length())
+      contents.append(extent, contents.length() - extentOffset,
+                      std::string::npos);
+
+    previousBytes += extent.length();
+    extents.erase(it++);
   }
 
-  op.append(contentsBl);
+  extents[start].swap(contents);
+
+  return extents[start].length() - previousBytes;
 }
 
+// Writes several intervals as a single operation: the intervals are grouped
+// per chunk (and copied) the same way as in the write-behind buffer, so each
+// chunk is written with one operation and the size is only updated once
 int
-FileIO::realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
-                  AsyncOpSP asyncOp)
+FileIO::write(const std::vector<FileWriteData> &intervals, std::string *opId,
+              AsyncOpCallback callback, void *arg)
 {
   int ret = 0;
-  char *originalBuff = buff;
-
-  if (mInlineBuffer && mInlineBuffer->capacity() > 0)
-  {
-    size_t inlineContentsSize = 0;
-    ssize_t opResult = 0;
-
-    if ((size_t) offset < mInlineBuffer->capacity())
-    {
-      opResult = mInlineBuffer->write(buff, offset, blen);
-      inlineContentsSize = opResult;
-    }
-    else
-    {
-      opResult = mInlineBuffer->fillRemainingInlineBuffer();
-    }
-
-    if (opResult < 0)
-    {
-      asyncOp->mPriv->setReady();
-      return ret;
-    }
-
-    offset += (off_t) inlineContentsSize;
-    buff += inlineContentsSize;
-    blen -= (size_t) inlineContentsSize;
 
-    if (blen == 0)
-    {
-      asyncOp->mPriv->setReady();
+  if (intervals.empty())
+    return -EINVAL;
 
-      if (deleteBuffer)
-        delete[] originalBuff;
+  for (size_t i = 0; i < intervals.size(); i++)
+  {
+    ret = verifyWriteParams(intervals[i].offset, intervals[i].length);
 
+    if (ret != 0)
       return ret;
-    }
   }
 
-  updateTimeAsyncInXAttr(mPool, mInode, XATTR_MTIME);
+  AsyncOpSP asyncOp(new AsyncOp(generateUuid()));
+  asyncOp->mPriv->setTracer(mTracer);
 
-  off_t currentOffset =  offset % mChunkSize;
-  size_t bytesToWrite = blen;
-  size_t firstChunk = offset / mChunkSize;
-  size_t lastChunk = (offset + blen - 1) / mChunkSize;
-  size_t totalChunks = lastChunk - firstChunk + 1;
-  const std::string &opId = asyncOp->id();
-  const size_t totalSize = offset + blen;
+  if (callback)
+    asyncOp->setCallback(callback, arg);
 
-  if (totalChunks > 1)
-    lockExclusive(opId);
-  else
-    lockShared(opId);
+  mOpManager.addOperation(asyncOp);
+
+  if (opId)
+    opId->assign(asyncOp->id());
 
-  setSizeIfBigger(totalSize, asyncOp);
+  dropReadAhead();
 
-  radosfs_debug("Writing in inode '%s' (op id: '%s') to size %lu affecting "
-                "chunks %lu-%lu", inode().c_str(), opId.c_str(), totalSize,
-                firstChunk, lastChunk);
+  WriteBehindDataSP data(new WriteBehindData);
+  const size_t inlineCapacity = mInlineBuffer ? mInlineBuffer->capacity() : 0;
+  size_t totalBytes = 0;
 
-  for (size_t i = 0; i < totalChunks; i++)
+  for (size_t i = 0; i < intervals.size(); i++)
   {
-    if (totalChunks > 1)
-      lockExclusive(opId);
-    else
-      lockShared(opId);
+    const char *buff = intervals[i].buff;
+    off_t currentOffset = intervals[i].offset;
+    size_t bytesLeft = intervals[i].length;
 
-    librados::ObjectWriteOperation op;
-    librados::bufferlist contents;
-    librados::AioCompletion *completion;
-    const std::string &fileChunk = makeFileChunkName(inode(), firstChunk + i);
-    size_t length = std::min(mChunkSize - currentOffset, bytesToWrite);
-    std::string contentsStr(buff + (blen - bytesToWrite), length);
+    if ((size_t) currentOffset < inlineCapacity)
+    {
+      const size_t length = std::min(inlineCapacity - currentOffset,
+                                     bytesLeft);
+
+      mergeWriteBehindExtent(data->inlineExtents, currentOffset, buff, length);
 
-    contents.append(contentsStr);
+      buff += length;
+      currentOffset += length;
+      bytesLeft -= length;
+    }
 
-    if (mPool->hasAlignment())
+    if (bytesLeft > 0)
     {
-      setAlignedChunkWriteOp(op, fileChunk, currentOffset, contentsStr);
+      data->fileSize = std::max(data->fileSize,
+                                (size_t) currentOffset + bytesLeft);
+      totalBytes += bytesLeft;
     }
-    else
+
+    while (bytesLeft > 0)
     {
-      op.write(currentOffset, contents);
+      const size_t chunk = currentOffset / mChunkSize;
+      const off_t chunkOffset = currentOffset % mChunkSize;
+      const size_t length = std::min(mChunkSize - chunkOffset, bytesLeft);
+
+      mergeWriteBehindExtent(data->chunks[chunk], chunkOffset, buff, length);
+
+      buff += length;
+      currentOffset += length;
+      bytesLeft -= length;
     }
+  }
 
-    completion = librados::Rados::aio_create_completion();
+  data->ops.push_back(asyncOp);
 
-    std::stringstream stream;
-    stream << "Wrote (od id='" << opId << "') chunk '" << fileChunk << "'";
-    setCompletionDebugMsg(completion, stream.str());
+  radosfs_debug("Writing %lu intervals in inode '%s' (op id='%s') affecting "
+                "%lu chunks", intervals.size(), inode().c_str(),
+                asyncOp->id().c_str(), data->chunks.size());
 
-    mPool->ioctx.aio_operate(fileChunk, completion, &op);
-    asyncOp->mPriv->addCompletion(completion);
+  // Any data in the write-behind buffer has to be written before this
+  // operation so it does not override it
+  flushWriteBehind();
 
-    currentOffset = 0;
-    bytesToWrite -= length;
+  bool queued = false;
+
+  // With the write-behind buffer enabled, the intervals are written as if they
+  // had been taken from it, so they keep their order relative to the writes
+  // buffered after them
+  {
+    boost::unique_lock<boost::mutex> lock(mWriteBehindMutex);
 
-    radosfs_debug("Scheduling writing of chunk '%s' in (op id='%s')",
-                  fileChunk.c_str(), opId.c_str());
+    if (mWriteBehindMaxSize > 0)
+    {
+      queueWriteBehindData(data);
+      queued = true;
+    }
   }
 
-  asyncOp->mPriv->setReady();
-  syncAndResetLocker(asyncOp);
+  if (queued)
+  {
+    postWriteBehindFlush();
+  }
+  else
+  {
+    mRadosFs->mPriv->scheduler.post(
+          boost::bind(&FileIO::writeWriteBehindData, this, data));
+  }
 
-  if (deleteBuffer)
-    delete[] originalBuff;
+  if (mMetrics)
+    mMetrics->add(Metrics::COUNTER_BYTES_WRITTEN, totalBytes);
 
-  return ret;
+  return 0;
 }
 
-int
-FileIO::remove()
+bool
+FileIO::bufferWrite(const char *buff, off_t offset, size_t blen,
+                    AsyncOpSP asyncOp)
 {
-  const std::string &opId = generateUuid();
-  mOpManager.sync();
+  WriteBehindDataSP dataToFlush, fullChunksToFlush;
 
   {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
-    unlockShared();
-  }
+    boost::unique_lock<boost::mutex> lock(mWriteBehindMutex);
 
-  lockExclusive(opId);
+    const bool rewritesChunks = rewritesWholeChunks();
 
-  int ret = 0;
-  ssize_t lastChunk = getLastChunkIndex();
+    // Nothing is buffered if the write-behind buffer is disabled, and writes
+    // affecting the inline buffer always go through the regular path
+    if (mWriteBehindMaxSize == 0 ||
+        (mInlineBuffer && (size_t) offset < mInlineBuffer->capacity()))
+    {
+      return false;
+    }
 
-  if (lastChunk < 0)
-  {
-    radosfs_debug("Error trying to remove inode '%s' (retcode=%d): %s",
-                  inode().c_str(), lastChunk, strerror(std::abs(lastChunk)));
-    return lastChunk;
-  }
+    if (!mWriteBehindData)
+      mWriteBehindData.reset(new WriteBehindData);
 
-  radosfs_debug("Remove (op id='%s') inode '%s' affecting chunks 0-%lu",
-                opId.c_str(), inode().c_str(), 0, lastChunk);
+    size_t bytesLeft = blen;
+    off_t currentOffset = offset;
 
-  AsyncOpSP asyncOp(new AsyncOp(opId));
-  mOpManager.addOperation(asyncOp);
+    while (bytesLeft > 0)
+    {
+      const size_t chunk = currentOffset / mChunkSize;
+      const off_t chunkOffset = currentOffset % mChunkSize;
+      const size_t length = std::min(mChunkSize - chunkOffset, bytesLeft);
 
-  // We start deleting from the base chunk onward because this will result
-  // in other calls to the object eventually seeing the removal sooner
-  for (size_t i = 0; i <= (size_t) lastChunk; i++)
-  {
-    lockExclusive(opId);
+      mWriteBehindBytes +=
+          mergeWriteBehindExtent(mWriteBehindData->chunks[chunk], chunkOffset,
+                                 buff + (blen - bytesLeft), length);
 
-    librados::ObjectWriteOperation op;
-    librados::AioCompletion *completion;
-    const std::string &fileChunk = makeFileChunkName(inode(), i);
+      bytesLeft -= length;
+      currentOffset += length;
+    }
 
-    radosfs_debug("Removing chunk '%s' in (op id= '%s')",
-                  fileChunk.c_str(), opId.c_str());
+    mWriteBehindData->fileSize = std::max(mWriteBehindData->fileSize,
+                                          (size_t) offset + blen);
+    mWriteBehindData->ops.push_back(asyncOp);
+    mWriteBehindUpdated = boost::chrono::system_clock::now();
+    scheduleIdleCheck(FILE_WRITE_BEHIND_IDLE_TIMEOUT);
 
-    op.remove();
-    completion = librados::Rados::aio_create_completion();
+    radosfs_debug("Kept write in the write-behind buffer of inode '%s' (op "
+                  "id='%s'): offset=%lu; length=%lu; buffered bytes=%lu",
+                  inode().c_str(), asyncOp->id().c_str(), offset, blen,
+                  mWriteBehindBytes);
 
-    std::stringstream stream;
-    stream << "Remove (op id='" << opId << "') chunk '" << fileChunk << "'";
-    setCompletionDebugMsg(completion, stream.str());
+    size_t maxBufferedBytes = mWriteBehindMaxSize;
+
+    // Partial chunk writes to aligned pools (or of compressed chunks) are kept
+    // until they can be applied together, as each applies to the whole chunk
+    if (rewritesChunks)
+    {
+      fullChunksToFlush = takeFullAlignedChunks(offset, blen);
+      maxBufferedBytes = std::max(maxBufferedBytes,
+                                  FILE_ALIGNED_WRITE_BUFFER_CHUNKS * mChunkSize);
+    }
 
-    mPool->ioctx.aio_operate(fileChunk, completion, &op);
-    asyncOp->mPriv->addCompletion(completion);
+    if (mWriteBehindBytes >= maxBufferedBytes)
+      dataToFlush = takeWriteBehindData();
   }
 
-  asyncOp->mPriv->setReady();
-  syncAndResetLocker(asyncOp);
+  // The data taken was already queued in order, so a single job is enough to
+  // write it all
+  if (fullChunksToFlush || dataToFlush)
+    postWriteBehindFlush();
 
-  return ret;
+  return true;
 }
 
-int
-FileIO::truncate(size_t newSize)
+WriteBehindDataSP
+FileIO::takeFullAlignedChunks(off_t offset, size_t blen)
 {
-  if (newSize > mPool->size)
-  {
-    radosfs_debug("The size given for truncating is too big for the pool.");
-    return -EFBIG;
-  }
+  // Important: this method needs to be run in a scope where mWriteBehindMutex
+  // is locked
+  WriteBehindDataSP data;
+  const size_t firstChunk = offset / mChunkSize;
+  const size_t lastChunk = (offset + blen - 1) / mChunkSize;
 
-  mOpManager.sync();
+  for (size_t chunk = firstChunk; chunk <= lastChunk; chunk++)
+  {
+    std::map<size_t, WriteBehindExtents>::iterator it;
+    it = mWriteBehindData->chunks.find(chunk);
 
-  updateTimeAsyncInXAttr(mPool, mInode, XATTR_MTIME);
+    if (it == mWriteBehindData->chunks.end())
+      continue;
 
-  {
-    boost::unique_lock<boost::mutex> lock(mLockMutex);
-    unlockShared();
-  }
+    WriteBehindExtents &extents = (*it).second;
 
-  const std::string &opId = generateUuid();
+    if (extents.size() != 1 || (*extents.begin()).first != 0 ||
+        (*extents.begin()).second.length() != mChunkSize)
+    {
+      continue;
+    }
 
-  lockExclusive(opId);
+    if (!data)
+      data.reset(new WriteBehindData);
 
-  if (mInlineBuffer)
-  {
-    mInlineBuffer->truncate(newSize);
+    data->chunks[chunk].swap(extents);
+    data->fileSize = std::max(data->fileSize,
+                              std::min(mWriteBehindData->fileSize,
+                                       (chunk + 1) * mChunkSize));
+    mWriteBehindData->chunks.erase(it);
+    mWriteBehindBytes -= mChunkSize;
   }
 
-  size_t currentSize;
-  ssize_t lastChunk = getLastChunkIndexAndSize(&currentSize);
+  if (!data)
+    return data;
 
-  if (lastChunk < 0)
+  // The operations are only considered finished when all their data is
+  // written, so they are only handed along with the last chunks buffered
+  if (mWriteBehindData->chunks.empty())
   {
-    if (lastChunk == -ENOENT || lastChunk == -ENODATA)
-      lastChunk = 0;
-    else
-      return lastChunk;
+    data->ops.swap(mWriteBehindData->ops);
+    data->fileSize = mWriteBehindData->fileSize;
+    mWriteBehindData.reset();
   }
 
-  size_t newLastChunk = (newSize == 0) ? 0 : (newSize - 1) / chunkSize();
-  bool truncateDown = currentSize > newSize;
-  size_t totalChunks = 1;
-  size_t newLastChunkSize = newSize % chunkSize();
-  bool hasAlignment = mPool->hasAlignment();
-
-  if (newLastChunk == 0 && newSize > chunkSize())
-    newLastChunk = chunkSize();
-
-  if (truncateDown)
-    totalChunks = lastChunk - newLastChunk + 1;
+  queueWriteBehindData(data);
 
-  setSize(newSize);
+  radosfs_debug("Flushing %lu full chunks buffered for the aligned pool of "
+                "inode '%s'", data->chunks.size(), inode().c_str());
 
-  radosfs_debug("Truncating chunk '%s' (op id='%s').", inode().c_str(),
-                opId.c_str());
+  return data;
+}
 
-  AsyncOpSP asyncOp(new AsyncOp(opId));
-  mOpManager.addOperation(asyncOp);
+WriteBehindDataSP
+FileIO::takeWriteBehindData(void)
+{
+  // Important: this method needs to be run in a scope where mWriteBehindMutex
+  // is locked
+  WriteBehindDataSP data;
 
-  for (ssize_t i = totalChunks - 1; i >= 0; i--)
+  if (mWriteBehindData)
   {
-    lockExclusive(opId);
-
-    librados::ObjectWriteOperation op;
-    librados::AioCompletion *completion;
-    const std::string &fileChunk = makeFileChunkName(inode(), newLastChunk + i);
-
-    if (i == 0)
-    {
-      // The base chunk should never be deleting on when a truncate occurs
-      // but rather really truncated -- in the case the pool has no alignment --
-      // or have the part out of the truncated range zeroed otherwise.
-      if (hasAlignment)
-      {
-        std::string zeroStr(chunkSize() - newLastChunkSize, '\0');
-        setAlignedChunkWriteOp(op, fileChunk, newLastChunkSize, zeroStr);
-      }
-      else
-      {
-        op.truncate(newLastChunkSize);
-      }
-
-      radosfs_debug("Truncating chunk '%s' (op id='%s').", fileChunk.c_str(),
-                    opId.c_str());
+    data.swap(mWriteBehindData);
+    queueWriteBehindData(data);
+    mWriteBehindBytes = 0;
+  }
 
-      op.assert_exists();
-    }
-    else
-    {
-      op.remove();
+  return data;
+}
 
-      radosfs_debug("Removing chunk '%s' in truncate (op id='%s')",
-                    fileChunk.c_str(), opId.c_str());
-    }
+void
+FileIO::queueWriteBehindData(WriteBehindDataSP data)
+{
+  // Important: this method needs to be run in a scope where mWriteBehindMutex
+  // is locked, so the data is queued in the order of its sequence number
+  boost::unique_lock<boost::mutex> lock(mWriteBehindFlushQueue->mutex);
 
-    completion = librados::Rados::aio_create_completion();
+  data->seq = ++mWriteBehindSeq;
+  mWriteBehindFlushQueue->data.push_back(data);
+}
 
-    std::stringstream stream;
-    stream << "Truncate (op id='" << opId << "') chunk '" << fileChunk << "'";
-    setCompletionDebugMsg(completion, stream.str());
+// Has a worker write the queued data. The job does not wait for anything: if
+// another thread is already writing the queue, it is left to that one.
+void
+FileIO::postWriteBehindFlush(void)
+{
+  mRadosFs->mPriv->scheduler.post(
+        boost::bind(&FileIO::flushWriteBehindQueue, this,
+                    mWriteBehindFlushQueue));
+}
 
-    mPool->ioctx.aio_operate(fileChunk, completion, &op);
-    asyncOp->mPriv->addCompletion(completion);
+int
+FileIO::flushWriteBehind(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mWriteBehindMutex);
+    takeWriteBehindData();
   }
 
-  asyncOp->mPriv->setReady();
-  syncAndResetLocker(asyncOp);
+  waitForWriteBehindFlushes();
 
   return 0;
 }
 
-ssize_t
-FileIO::getLastChunkIndex(void) const
-{
-  return getLastChunkIndexAndSize(0);
-}
-
-librados::ObjectReadOperation
-makeChunkReadOp(bool hasAlignment, u_int64_t *size, int *statRet,
-                librados::bufferlist *chunkXAttr)
+// Waits until all the data taken from the write-behind buffer so far is
+// written, so the flushes posted to the workers (which are given this instance
+// directly) are done before it is destroyed. The queue is written by the
+// calling thread unless another one is writing it already, so this never
+// waits for a job that may be queued behind the caller.
+void
+FileIO::waitForWriteBehindFlushes(void)
 {
-  librados::ObjectReadOperation op;
+  u_int64_t seq;
+  WriteBehindFlushQueueSP queue = mWriteBehindFlushQueue;
 
-  op.stat(size, 0, statRet);
+  {
+    boost::unique_lock<boost::mutex> lock(mWriteBehindMutex);
+    seq = mWriteBehindSeq;
+  }
 
-  if (hasAlignment)
+  while (true)
   {
-    std::set<std::string> keys;
-    std::map<std::string, librados::bufferlist> omap;
+    flushWriteBehindQueue(this, queue);
 
-    // Since the alignment is set, the last chunk will be the same size as the
-    // other ones so we retrieve the real data size which was set as an XAttr
-    keys.insert(XATTR_LAST_CHUNK_SIZE);
-    op.omap_get_vals_by_keys(keys, &omap, 0);
-    op.set_op_flags2(librados::OP_FAILOK);
-  }
+    boost::unique_lock<boost::mutex> lock(queue->mutex);
 
-  return op;
-}
+    while (queue->flushing && queue->flushedSeq < seq)
+      queue->cond.wait(lock);
 
-ssize_t
-getLastValid(int *retValues, size_t valuesSize)
-{
-  ssize_t i;
-  for (i = 0; i < (ssize_t) valuesSize; i++)
-  {
-    if (retValues[i] != 0)
+    if (queue->flushedSeq >= seq)
       break;
   }
-
-  return i - 1;
 }
 
-ssize_t
-FileIO::getLastChunkIndexAndSize(uint64_t *size) const
+// Writes the queued data in order until the queue is empty. Only one thread
+// writes it at a time, and it does not keep that role while running the
+// operations' callbacks (which may write or flush this file again). The FileIO
+// is only used while there is data queued, since it waits for that data to be
+// written before it is destroyed.
+void
+FileIO::flushWriteBehindQueue(FileIO *fileIO, WriteBehindFlushQueueSP queue)
 {
-  librados::ObjectReadOperation op;
-  librados::bufferlist sizeXAttr;
-  ssize_t fileSize(0);
+  while (true)
+  {
+    WriteBehindDataSP data;
 
-  op.getxattr(XATTR_FILE_SIZE, &sizeXAttr, 0);
-  op.assert_exists();
+    {
+      boost::unique_lock<boost::mutex> lock(queue->mutex);
+
+      if (queue->flushing || queue->data.empty())
+        return;
+
+      queue->flushing = true;
+      data = queue->data.front();
+      queue->data.pop_front();
+    }
+
+    int ret = fileIO->writeWriteBehindExtents(data);
+
+    {
+      boost::unique_lock<boost::mutex> lock(queue->mutex);
+
+      queue->flushedSeq = data->seq;
+      queue->flushing = false;
+    }
+
+    queue->cond.notify_all();
 
-  int ret = mPool->ioctx.operate(inode(), &op, 0);
+    // The FileIO may be destroyed as soon as the data is flushed (or its
+    // operations finish), so only the data is used from here on
+    std::vector<AsyncOpSP>::iterator opIt;
+    for (opIt = data->ops.begin(); opIt != data->ops.end(); opIt++)
+    {
+      (*opIt)->mPriv->setFinished(ret);
+      (*opIt)->waitForCompletion();
+    }
+  }
+}
 
-  if (ret < 0)
-    return ret;
+void
+FileIO::manageWriteBehind(double idleTimeout)
+{
+  WriteBehindDataSP data;
 
-  if (sizeXAttr.length() > 0)
+  if (!mWriteBehindMutex.try_lock())
+    return;
+
+  if (mWriteBehindData)
   {
-    const std::string sizeStr(sizeXAttr.c_str(), sizeXAttr.length());
-    fileSize = strtoul(sizeStr.c_str(), 0, 16);
+    boost::chrono::duration<double> seconds;
+    seconds = boost::chrono::system_clock::now() - mWriteBehindUpdated;
+
+    if (seconds.count() >= idleTimeout)
+      data = takeWriteBehindData();
   }
 
-  if (size)
-    *size = fileSize;
+  mWriteBehindMutex.unlock();
 
-  if (fileSize > 0)
-    fileSize = (fileSize - 1) / chunkSize();
+  if (data)
+  {
+    radosfs_debug("Flushing idle write-behind buffer of inode '%s'",
+                  inode().c_str());
 
-  return fileSize;
+    postWriteBehindFlush();
+  }
 }
 
-std::string
-FileIO::getChunkPath(off_t offset) const
+int
+FileIO::writeWriteBehindExtents(WriteBehindDataSP data)
 {
-  return makeFileChunkName(mInode, offset / mChunkSize);
-}
+  int ret = 0;
 
-size_t
-FileIO::getSize() const
-{
-  u_int64_t size = 0;
-  getLastChunkIndexAndSize(&size);
+  if (mInlineBuffer)
+  {
+    // Vectored writes also carry the data meant for the inline buffer
+    WriteBehindExtents::const_iterator it;
+    for (it = data->inlineExtents.begin(); it != data->inlineExtents.end();
+         it++)
+    {
+      ssize_t inlineRet = mInlineBuffer->write((*it).second.c_str(),
+                                               (*it).first,
+                                               (*it).second.length());
 
-  return size;
+      if (inlineRet < 0)
+      {
+        radosfs_debug("Failed to write in the inline buffer of inode '%s': "
+                      "%s", inode().c_str(), strerror(-inlineRet));
+        return inlineRet;
+      }
+    }
+  }
+
+  if (!data->chunks.empty())
+    ret = writeChunkExtents(data);
+
+  return ret;
 }
 
-void
-inodeBackLinkCb(rados_completion_t comp, void *arg)
+// Writes data that is not in the write-behind queue (the vectored writes made
+// while the write-behind buffer is disabled) and finishes its operations
+int
+FileIO::writeWriteBehindData(WriteBehindDataSP data)
 {
-  int ret = rados_aio_get_return_value(comp);
-  FileIO *io = reinterpret_cast<FileIO *>(arg);
+  int ret = writeWriteBehindExtents(data);
 
-  // We only assume we have set the back link if it succeeded to do so or if
-  // didn't because it had already been set (operation canceled)
-  if (ret == 0 || ret == -ECANCELED)
-    io->setHasBackLink(true);
+  // This instance may be destroyed as soon as the operations finish, so only
+  // the data is used from here on
+  std::vector<AsyncOpSP>::iterator opIt;
+  for (opIt = data->ops.begin(); opIt != data->ops.end(); opIt++)
+  {
+    (*opIt)->mPriv->setFinished(ret);
+    (*opIt)->waitForCompletion();
+  }
 
-  rados_aio_release(comp);
+  return ret;
 }
 
+// Writes the extents of each chunk in a single operation per chunk
 int
-FileIO::setSizeIfBigger(size_t size, AsyncOpSP asyncOp)
+FileIO::writeChunkExtents(WriteBehindDataSP data)
 {
-  librados::ObjectWriteOperation writeOp;
-  librados::bufferlist sizeBl, backLinkBl;
-  sizeBl.append(fileSizeToHex(size));
-
-  // Set the new size only if it's greater than the one already set
-  writeOp.setxattr(XATTR_FILE_SIZE, sizeBl);
-  writeOp.cmpxattr(XATTR_FILE_SIZE, LIBRADOS_CMPXATTR_OP_GT, sizeBl);
+  const std::string &opId = generateUuid();
+  AsyncOpSP asyncOp(new AsyncOp(opId));
+  const size_t totalChunks = data->chunks.size();
 
-  if (!mPath.empty() && shouldSetBacklink())
+  // As in realWrite, the inline buffer has to be filled before any data is
+  // written beyond it, otherwise its contents would be taken for the whole
+  // file's
+  if (mInlineBuffer && mInlineBuffer->capacity() > 0)
   {
-    backLinkBl.append(mPath);
-    writeOp.setxattr(XATTR_INODE_HARD_LINK, backLinkBl);
+    int ret = mInlineBuffer->fillRemainingInlineBuffer();
+
+    if (ret < 0)
+      return ret;
   }
 
-  librados::AioCompletion *completion = librados::Rados::aio_create_completion();
+  touchMtime();
 
-  std::stringstream stream;
-  stream << "Set size because it was bigger "
-            "(od id='" << asyncOp->id() << "') on '" << inode() << "'";
-  setCompletionDebugMsg(completion, stream.str());
+  if (totalChunks > 1)
+    lockExclusive(opId);
+  else
+    lockShared(opId);
 
-  mPool->ioctx.aio_operate(inode(), completion, &writeOp);
-  asyncOp->mPriv->addCompletion(completion);
+  setSizeIfBigger(data->fileSize, asyncOp);
 
-  return 0;
-}
+  int markRet = 0;
 
-int
-FileIO::setSize(size_t size)
-{
-  librados::bufferlist sizeBl, backLinkBl;
-  sizeBl.append(fileSizeToHex(size));
+  if (mTrackAllocatedChunks)
+  {
+    std::set<size_t> chunks;
+    std::map<size_t, WriteBehindExtents>::const_iterator chunkIt;
 
-  librados::ObjectWriteOperation writeOp;
-  writeOp.create(false);
-  writeOp.setxattr(XATTR_FILE_SIZE, sizeBl);
+    for (chunkIt = data->chunks.begin(); chunkIt != data->chunks.end();
+         chunkIt++)
+    {
+      chunks.insert((*chunkIt).first);
+    }
 
-  bool backLinkIsSet = !shouldSetBacklink();
+    markRet = markChunksAllocated(chunks);
 
-  if (!mPath.empty() && !backLinkIsSet)
-  {
-    backLinkBl.append(mPath);
-    writeOp.setxattr(XATTR_INODE_HARD_LINK, backLinkBl);
+    if (markRet != 0)
+      asyncOp->mPriv->setPreparationError(markRet);
   }
 
-  int ret = mPool->ioctx.operate(inode(), &writeOp);
-
-  if (ret == 0 && !backLinkIsSet)
-    setHasBackLink(true);
+  radosfs_debug("Flushing write-behind buffer in inode '%s' (op id: '%s') to "
+                "size %lu affecting %lu chunks", inode().c_str(), opId.c_str(),
+                data->fileSize, totalChunks);
 
-  radosfs_debug("Set size %d to '%s': retcode=%d (%s)", size,
-                inode().c_str(), ret, strerror(abs(ret)));
+  std::map<size_t, WriteBehindExtents>::iterator it;
+  for (it = data->chunks.begin(); markRet == 0 && it != data->chunks.end();
+       it++)
+  {
+    librados::ObjectWriteOperation op;
+    librados::AioCompletion *completion;
+    const std::string &fileChunk = makeFileChunkName(inode(), (*it).first);
+    WriteBehindExtents &extents = (*it).second;
 
-  return ret;
-}
+    if (rewritesWholeChunks())
+    {
+      // All the extents of the chunk are applied with a single (or even no,
+      // if they cover the whole chunk) read of the chunk
+      int chunkRet = setAlignedChunkWriteOp(op, (*it).first, extents);
 
-void
-FileIO::manageIdleLock(double idleTimeout)
-{
-  if (mLockMutex.try_lock())
-  {
-    if (mLocker == "")
+      if (chunkRet != 0)
+      {
+        asyncOp->mPriv->setPreparationError(chunkRet);
+        continue;
+      }
+    }
+    else
     {
-      unlockIfTimeIsOut(idleTimeout);
+      WriteBehindExtents::iterator extentIt;
+      for (extentIt = extents.begin(); extentIt != extents.end(); extentIt++)
+      {
+        librados::bufferlist contents;
+        contents.append((*extentIt).second);
+        op.write((*extentIt).first, contents);
+      }
     }
 
-    mLockMutex.unlock();
+    completion = asyncOp->mPriv->createCompletion();
+
+    std::stringstream stream;
+    stream << "Flushed write-behind (od id='" << opId << "') chunk '"
+           << fileChunk << "'";
+    setCompletionDebugMsg(completion, stream.str());
+
+    chunkPool((*it).first)->ioctx.aio_operate(fileChunk, completion, &op);
   }
+
+  asyncOp->mPriv->setReady();
+  syncAndResetLocker(asyncOp);
+
+  // Invalidated only once the chunks are written (see writeChunks)
+  invalidateChunkCache();
+
+  return asyncOp->returnValue();
 }
 
-void
-FileIO::unlockIfTimeIsOut(double idleTimeout)
+int
+OpsManager::sync(bool removeOps)
 {
-  // Important: this method needs to be run in a scoped where mLockMutex is
-  // locked
-  boost::chrono::duration<double> seconds;
-  seconds = boost::chrono::system_clock::now() - mLockUpdated;
-  bool lockIsIdle = seconds.count() >= idleTimeout;
-  bool lockTimedOut = seconds.count() > FILE_LOCK_DURATION;
+  int ret = 0;
+  std::vector<AsyncOpSP> ops;
 
-  if (lockIsIdle && !lockTimedOut)
   {
-    radosfs_debug("Unlocked idle lock.");
+    boost::unique_lock<boost::mutex> lock(opsMutex);
+    std::map<std::string, AsyncOpSP>::iterator it;
 
-    unlock();
+    for (it = mOperations.begin(); it != mOperations.end(); it++)
+      ops.push_back((*it).second);
 
-    // Set the lock start to look as if it expired so it does not try to
-    // unlock it anymore.
-    mLockStart = expiredLockDuration();
-    mLockUpdated = mLockStart;
+    if (removeOps)
+      mOperations.clear();
   }
-}
 
-void
-FileIO::syncAndResetLocker(AsyncOpSP op)
-{
-  boost::unique_lock<boost::mutex> lock(mLockMutex);
-  op->waitForCompletion();
-  mLocker = "";
-}
+  // The ops are waited for (running their callbacks) without holding opsMutex
+  // so other threads can add or poll ops meanwhile
+  for (size_t i = 0; i < ops.size(); i++)
+  {
+    int syncResult = ops[i]->waitForCompletion();
 
-bool
-FileIO::hasSingleClient(const FileIOSP &io)
-{
-  // If there is only one client using an instance of the given FileIO, then
-  // the use count is 2 because there is a reference hold in FsPriv's map.
-  return io.use_count() == 2;
+    // Assign the first error we eventually find
+    if (ret == 0)
+      ret = syncResult;
+  }
+
+  return ret;
 }
 
-void
-FileIO::setInlineBuffer(const Stat *parentStat, const std::string path,
-                        size_t bufferSize)
+int
+OpsManager::sync(const std::string &opId, bool removeOps)
 {
-  std::string parentPath = getParentDir(path, 0);
-
-  if (parentPath == "")
-    return;
+  AsyncOpSP asyncOp;
 
-  if (mInlineBuffer)
   {
-    if ((mInlineBuffer->parentStat.path + mInlineBuffer->fileBaseName) == path)
-      return;
+    boost::unique_lock<boost::mutex> lock(opsMutex);
+    std::map<std::string, AsyncOpSP>::iterator it = mOperations.find(opId);
 
-    mInlineBuffer.reset();
+    if (it == mOperations.end())
+      return -ENOENT;
+
+    asyncOp = (*it).second;
+
+    if (removeOps)
+      mOperations.erase(it);
   }
 
-  mInlineBuffer.reset(new FileInlineBuffer(mRadosFs, parentStat,
-                                           path.substr(parentPath.length()),
-                                           bufferSize));
+  return asyncOp->waitForCompletion();
 }
 
-void
-FileIO::setLazyRemoval(bool remove)
+int
+OpsManager::poll(const std::string &opId)
 {
-  mLazyRemoval = remove;
+  AsyncOpSP op;
 
-  if (mInlineBuffer)
   {
-    boost::unique_lock<boost::mutex> lock(mInlineMemBufferMutex);
-    mInlineBuffer->setMemoryBuffer(&mInlineMemBuffer, &mInlineMemBufferMutex);
+    boost::unique_lock<boost::mutex> lock(opsMutex);
+    std::map<std::string, AsyncOpSP>::iterator it = mOperations.find(opId);
+
+    if (it == mOperations.end())
+      return -ENOENT;
+
+    op = (*it).second;
+
+    if (!op->mPriv->isDone())
+      return -EINPROGRESS;
+
+    mOperations.erase(it);
   }
-}
 
-void
-FileIO::setHasBackLink(bool hasBacklink)
-{
-  boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
-  mHasBackLink = hasBacklink;
+  // The op is done so this does not block, but it runs the op's callback,
+  // which must not be called with opsMutex locked (it may use this FileIO)
+  return op->waitForCompletion();
 }
 
-bool
-FileIO::hasBackLink(void)
+int
+OpsManager::progress(const std::string &opId, u_int64_t *done,
+                     u_int64_t *total)
 {
-  boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
-  return mHasBackLink;
-}
+  boost::unique_lock<boost::mutex> lock(opsMutex);
+  std::map<std::string, AsyncOpSP>::iterator it = mOperations.find(opId);
 
-void
-FileIO::setPath(const std::string &path)
-{
-  boost::unique_lock<boost::mutex> lock(mHasBackLinkMutex);
-  mPath = path;
-  mHasBackLink = false;
-}
+  if (it == mOperations.end())
+    return -ENOENT;
 
-void
-FileIO::updateBackLink(const std::string *oldBackLink)
-{
-  setInodeBacklinkAsync(mPool, mPath, inode(), oldBackLink, inodeBackLinkCb,
-                        this);
-}
+  (*it).second->progress(done, total);
 
-bool
-FileIO::hasRunningAsyncOps()
-{
-  return mOpManager.hasRunningOps();
+  return 0;
 }
 
 int
-OpsManager::sync(bool removeOps)
+OpsManager::waitForAny(const std::vector<std::string> &opIds,
+                       std::string *finishedOpId)
 {
-  int ret = 0;
-  std::map<std::string, AsyncOpSP>::iterator it, oldIt;
-  boost::unique_lock<boost::mutex> lock(opsMutex);
+  std::vector<AsyncOpSP> ops;
 
-  it = mOperations.begin();
-  while (it != mOperations.end())
   {
-    oldIt = it;
-    oldIt++;
+    boost::unique_lock<boost::mutex> lock(opsMutex);
 
-    int syncResult = sync((*it).first, false, removeOps);
+    for (size_t i = 0; i < opIds.size(); i++)
+    {
+      std::map<std::string, AsyncOpSP>::iterator it;
+      it = mOperations.find(opIds[i]);
 
-    // Assign the first error we eventually find
-    if (ret == 0)
-      ret = syncResult;
+      if (it != mOperations.end())
+        ops.push_back((*it).second);
+    }
+  }
+
+  if (ops.empty())
+    return -ENOENT;
+
+  // Register the same waiter in all the ops so whichever finishes first wakes
+  // us up
+  AsyncOpWaiter waiter;
 
-    it = oldIt;
+  for (size_t i = 0; i < ops.size(); i++)
+    ops[i]->mPriv->addWaiter(&waiter);
+
+  {
+    boost::unique_lock<boost::mutex> lock(waiter.mutex);
+
+    while (!waiter.signaled)
+      waiter.cond.wait(lock);
   }
 
-  return ret;
-}
+  for (size_t i = 0; i < ops.size(); i++)
+    ops[i]->mPriv->removeWaiter(&waiter);
 
-int
-OpsManager::sync(const std::string &opId, bool lock, bool removeOps)
-{
-  int ret = -ENOENT;
-  boost::unique_lock<boost::mutex> uniqueLock;
-  AsyncOpSP asyncOp;
+  for (size_t i = 0; i < ops.size(); i++)
+  {
+    AsyncOpSP op = ops[i];
 
-  if (lock)
-    uniqueLock = boost::unique_lock<boost::mutex>(opsMutex);
+    if (!op->mPriv->isDone())
+      continue;
 
-  if (mOperations.count(opId) == 0)
-    return ret;
+    int ret = op->waitForCompletion();
 
-  ret = mOperations[opId]->waitForCompletion();
+    if (finishedOpId)
+      finishedOpId->assign(op->id());
 
-  if (removeOps)
-    mOperations.erase(opId);
+    boost::unique_lock<boost::mutex> lock(opsMutex);
+    mOperations.erase(op->id());
 
-  return ret;
+    return ret;
+  }
+
+  // Not reached: the waiter is only signaled by done ops
+  return -EINPROGRESS;
 }
 
 void
@@ -1396,6 +4054,14 @@ OpsManager::addOperation(AsyncOpSP op)
   mOperations[op->id()] = op;
 }
 
+void
+OpsManager::removeOperation(const std::string &opId)
+{
+  boost::unique_lock<boost::mutex> lock(opsMutex);
+
+  mOperations.erase(opId);
+}
+
 bool
 OpsManager::hasRunningOps()
 {
@@ -21,9 +21,12 @@
 #define RADOS_FS_FILE_IO_HH
 
 #include <boost/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include <cstdlib>
+#include <deque>
+#include <set>
 #include <rados/librados.hpp>
 #include <string>
 #include <utility>
@@ -32,18 +35,25 @@
 
 #include "Filesystem.hh"
 #include "FileInlineBuffer.hh"
+#include "PoolTrie.hh"
 #include "AsyncOp.hh"
 #include "radosfscommon.h"
+#include "Tracer.hh"
 
 #define FILE_CHUNK_LOCKER "file-chunk-locker"
 #define FILE_CHUNK_LOCKER_COOKIE_WRITE "file-chunk-locker-cookie-write"
 #define FILE_CHUNK_LOCKER_COOKIE_OTHER "file-chunk-locker-cookie-other"
 #define FILE_CHUNK_LOCKER_TAG "file-chunk-locker-tag"
+// Where the lock's state is kept in the inode object (by the cls_lock class)
+#define FILE_CHUNK_LOCKER_XATTR "lock." FILE_CHUNK_LOCKER
 #define FILE_LOCK_DURATION 120 // seconds
+#define FILE_LOCK_RENEW_MARGIN 10 // seconds
 
 RADOS_FS_BEGIN_NAMESPACE
 
+class ChunkCache;
 class FileIO;
+class Metrics;
 
 typedef std::tr1::shared_ptr<AsyncOp> AsyncOpSP;
 typedef std::tr1::shared_ptr<FileIO> FileIOSP;
@@ -62,12 +72,84 @@ public:
   void addReturnValue(int value);
 
   boost::shared_ptr<boost::shared_mutex> readOpMutex;
-  librados::bufferlist *buffList;
   int opResult;
 };
 
 typedef boost::shared_ptr<FileReadDataImp> FileReadDataImpSP;
 
+// Maps the offset (inside a chunk) of the data kept in the write-behind buffer
+// to the contents. Adjacent or overlapping extents are always merged.
+typedef std::map<off_t, std::string> WriteBehindExtents;
+
+struct WriteBehindData
+{
+  WriteBehindData(void)
+    : fileSize(0),
+      seq(0)
+  {}
+
+  std::map<size_t, WriteBehindExtents> chunks;
+  // The data for the inline buffer (only set by vectored writes)
+  WriteBehindExtents inlineExtents;
+  std::vector<AsyncOpSP> ops;
+  size_t fileSize;
+  u_int64_t seq;
+};
+
+typedef boost::shared_ptr<WriteBehindData> WriteBehindDataSP;
+
+// The data taken from the write-behind buffer that is waiting to be written, in
+// the order it was taken. It is written by one thread at a time and kept apart
+// from the FileIO, so the jobs posted to write it can still find out there is
+// nothing left to do once the FileIO is gone.
+struct WriteBehindFlushQueue
+{
+  WriteBehindFlushQueue(void)
+    : flushing(false),
+      flushedSeq(0)
+  {}
+
+  std::deque<WriteBehindDataSP> data;
+  bool flushing;
+  u_int64_t flushedSeq;
+  boost::mutex mutex;
+  boost::condition_variable cond;
+};
+
+typedef boost::shared_ptr<WriteBehindFlushQueue> WriteBehindFlushQueueSP;
+
+// The data read ahead goes into the buffer of its FileReadDataImp, from which
+// the following reads are served; the buffer is only released once the read
+// that fills it is done
+struct ReadAheadBuffer
+{
+  ReadAheadBuffer(off_t offset, size_t length);
+  ~ReadAheadBuffer(void);
+
+  FileReadDataImp readData;
+  ssize_t readBytes;
+  AsyncOpSP asyncOp;
+};
+
+typedef boost::shared_ptr<ReadAheadBuffer> ReadAheadBufferSP;
+
+// Holds what is needed to resume a write that is waiting for the chunks'
+// lock, so it does not block a worker thread meanwhile
+struct ChunkWriteArgs
+{
+  char *buff;
+  off_t offset;
+  size_t blen;
+  char *originalBuff;
+  bool deleteBuffer;
+  AsyncOpSP asyncOp;
+  unsigned int lockBackoff;
+  // When the write started waiting for the lock (only set if it is traced)
+  Tracer::Clock::time_point lockStart;
+};
+
+typedef boost::shared_ptr<ChunkWriteArgs> ChunkWriteArgsSP;
+
 struct ReadOpArgs
 {
   AsyncOpSP asyncOp;
@@ -86,7 +168,18 @@ struct ReadInlineOpArgs : ReadOpArgs
 struct ReadChunkOpArgs : ReadOpArgs
 {
   size_t fileChunk;
-  std::vector<std::pair<FileReadDataImpSP, librados::bufferlist *> > readData;
+  std::vector<FileReadDataImpSP> readData;
+  std::vector<librados::bufferlist> readBuffers;
+  bool fillCache;
+  size_t cacheFillLength;
+  u_int64_t cacheGeneration;
+  librados::bufferlist cacheBuffer;
+  int cacheResult;
+  // Compressed chunks are read as a whole, along with their compression info
+  bool compressed;
+  librados::bufferlist chunkBuffer;
+  librados::bufferlist compressionInfo;
+  int compressionResult;
 };
 
 struct OpsManager
@@ -95,9 +188,14 @@ struct OpsManager
   std::map<std::string, AsyncOpSP> mOperations;
 
   int sync(bool removeOps=true);
-  int sync(const std::string &opId, bool lock=true, bool removeOps=true);
+  int sync(const std::string &opId, bool removeOps=true);
+  int poll(const std::string &opId);
+  int progress(const std::string &opId, u_int64_t *done, u_int64_t *total);
+  int waitForAny(const std::vector<std::string> &opIds,
+                 std::string *finishedOpId);
   void waitForLoneOps(void);
   void addOperation(AsyncOpSP op);
+  void removeOperation(const std::string &opId);
   bool hasRunningOps(void);
 };
 
@@ -124,9 +222,13 @@ public:
            void *arg = 0);
 
   int write(const char *buff, off_t offset, size_t blen, std::string *opId = 0,
-            bool copyBuffer=false, AsyncOpCallback callback = 0, void *arg = 0);
+            bool copyBuffer=false, AsyncOpCallback callback = 0, void *arg = 0,
+            AsyncOpBufferCallback bufferCallback = 0);
   int writeSync(const char *buff, off_t offset, size_t blen);
 
+  int write(const std::vector<FileWriteData> &intervals, std::string *opId = 0,
+            AsyncOpCallback callback = 0, void *arg = 0);
+
   std::string inode(void) const { return mInode; }
 
   void setLazyRemoval(bool remove);
@@ -144,8 +246,22 @@ public:
 
   int remove(void);
 
+  int remove(AsyncOpSP asyncOp);
+
+  int copyTo(FileIO &destination);
+
   int truncate(size_t newSize);
 
+  int truncate(size_t newSize, AsyncOpSP asyncOp);
+
+  void setChunkRemovalWindow(size_t window) { mChunkRemovalWindow = window; }
+
+  size_t chunkRemovalWindow(void) const { return mChunkRemovalWindow; }
+
+  int tryLock(const std::string &uuid, bool exclusive);
+
+  void lock(const std::string &uuid, bool exclusive);
+
   void lockShared(const std::string &uuid);
 
   void lockExclusive(const std::string &uuid);
@@ -158,12 +274,36 @@ public:
 
   void manageIdleLock(double idleTimeout);
 
+  bool needsIdleManagement(void);
+
   static bool hasSingleClient(const FileIOSP &io);
 
-  int sync(const std::string &opId) { return mOpManager.sync(opId); }
+  int sync(const std::string &opId);
+  int pollOp(const std::string &opId);
+  int waitForAnyOp(const std::vector<std::string> &opIds,
+                   std::string *finishedOpId);
 
   PoolSP pool(void) const { return mPool; }
 
+  void setStripePools(const PoolList &pools) { mStripePools = pools; }
+
+  const PoolList &stripePools(void) const { return mStripePools; }
+
+  const PoolSP &chunkPool(size_t chunkIndex) const
+  { return chunkPool(mPool, mStripePools, chunkIndex); }
+
+  void setCompression(bool compress) { mCompression = compress; }
+
+  bool compression(void) const { return mCompression; }
+
+  void setTrackAllocatedChunks(bool track) { mTrackAllocatedChunks = track; }
+
+  bool tracksAllocatedChunks(void) const { return mTrackAllocatedChunks; }
+
+  off_t seekData(off_t offset);
+
+  off_t seekHole(off_t offset);
+
   void setInlineBuffer(const Stat *parentStat, const std::string path,
                        size_t bufferSize);
 
@@ -173,6 +313,8 @@ public:
 
   bool hasBackLink(void);
 
+  void backLinkWritten(const std::string &backLink);
+
   bool shouldSetBacklink(void) { return !hasBackLink() && !mPath.empty(); }
 
   void setPath(const std::string &path);
@@ -181,9 +323,40 @@ public:
 
   bool hasRunningAsyncOps(void);
 
+  void setWriteBehindSize(size_t size);
+
+  size_t writeBehindSize(void) const { return mWriteBehindMaxSize; }
+
+  int flushWriteBehind(void);
+
+  void manageWriteBehind(double idleTimeout);
+
+  int flushPendingSize(void);
+
+  void managePendingSize(double interval);
+
+  void touchMtime(void);
+
+  bool pendingMtime(timespec *spec) const;
+
+  void setSizeCacheStaleness(double seconds);
+
 private:
+  void scheduleIdleCheck(double seconds);
+
   Filesystem *mRadosFs;
   const PoolSP mPool;
+  // The pools the chunks are striped over (the first being mPool), if any
+  PoolList mStripePools;
+  // Whether the chunks are compressed (and so always rewritten as a whole)
+  bool mCompression;
+  // Whether the chunks that were written are recorded in the inode's omap, so
+  // the ones that were not (the holes) do not need to be read
+  bool mTrackAllocatedChunks;
+  std::vector<bool> mAllocatedChunks;
+  bool mAllocatedChunksLoaded;
+  boost::chrono::system_clock::time_point mAllocatedChunksTime;
+  boost::mutex mAllocatedChunksMutex;
   const std::string mInode;
   std::string mPath;
   size_t mChunkSize;
@@ -192,22 +365,71 @@ private:
   boost::chrono::system_clock::time_point mLockStart;
   boost::chrono::system_clock::time_point mLockUpdated;
   boost::mutex mLockMutex;
+  // Guards mLockStart and mLockExclusive, so the lease can be renewed while a
+  // write holds mLockMutex waiting for its operations
+  boost::mutex mLockLeaseMutex;
   std::string mLocker;
+  bool mLockExclusive;
   OpsManager mOpManager;
   boost::scoped_ptr<FileInlineBuffer> mInlineBuffer;
   std::string mInlineMemBuffer;
   boost::mutex mInlineMemBufferMutex;
   bool mHasBackLink;
   boost::mutex mHasBackLinkMutex;
+  WriteBehindDataSP mWriteBehindData;
+  size_t mWriteBehindMaxSize;
+  size_t mWriteBehindBytes;
+  boost::chrono::system_clock::time_point mWriteBehindUpdated;
+  mutable boost::mutex mWriteBehindMutex;
+  u_int64_t mWriteBehindSeq;
+  WriteBehindFlushQueueSP mWriteBehindFlushQueue;
+  bool mReadAhead;
+  off_t mReadAheadNextOffset;
+  size_t mReadAheadWindow;
+  std::deque<ReadAheadBufferSP> mReadAheadBuffers;
+  boost::mutex mReadAheadMutex;
+  mutable boost::mutex mSizeMutex;
+  mutable ssize_t mCachedSize;
+  mutable boost::chrono::system_clock::time_point mCachedSizeTime;
+  size_t mPendingSize;
+  boost::chrono::system_clock::time_point mPendingSizeTime;
+  std::string mPendingMtime;
+  boost::chrono::system_clock::time_point mPendingMtimeTime;
+  boost::chrono::system_clock::time_point mSizeAuthoritativeUntil;
+  double mSizeCacheStaleness;
+  size_t mChunkRemovalWindow;
+  ChunkCache *mChunkCache;
+  // Null if there is no filesystem (e.g. when reaping a removed inode)
+  Metrics *mMetrics;
+  Tracer *mTracer;
+  std::set<size_t> mUncacheableChunks;
+  boost::mutex mUncacheableChunksMutex;
 
   int verifyWriteParams(off_t offset, size_t length);
   int realWrite(char *buff, off_t offset, size_t blen, bool deleteBuffer,
-                AsyncOpSP asyncOp);
+                AsyncOpSP asyncOp, bool blockOnLock);
+  void writeChunks(ChunkWriteArgsSP args);
+  void retryWriteLock(ChunkWriteArgsSP args);
+  void renewLockIfNeeded(void);
+  int readSizeXAttr(u_int64_t *size) const;
+  static const PoolSP &chunkPool(const PoolSP &pool,
+                                 const PoolList &stripePools,
+                                 size_t chunkIndex);
+  static int removeChunkRange(PoolSP pool, const PoolList &stripePools,
+                              const std::string &inode, size_t firstChunk,
+                              size_t lastChunk, size_t window, bool backwards,
+                              AsyncOpSP asyncOp);
+  static void reapInode(PoolSP pool, const PoolList stripePools,
+                        const std::string inode, size_t chunkSize,
+                        size_t window);
+  bool getCachedSize(u_int64_t *size) const;
+  void setSizeAuthoritative(bool authoritative);
   int setSizeIfBigger(size_t size, AsyncOpSP asyncOp);
   int setSize(size_t size);
   void setCompletionDebugMsg(librados::AioCompletion *completion,
                              const std::string &message);
   void syncAndResetLocker(AsyncOpSP op);
+  void resetLocker(void);
   void getInlineAndInodeReadData(const std::vector<FileReadData> &intervals,
                                  std::vector<FileReadDataImpSP> *dataInline,
                                  std::vector<FileReadDataImpSP> *dataInode);
@@ -226,12 +448,57 @@ private:
                        const std::vector<FileReadDataImpSP> &readDataVector,
                        boost::shared_ptr<boost::shared_mutex> readOpMutex,
                        AsyncOpSP asyncOp,
-                       boost::shared_ptr<ssize_t> inodeSize);
-  void setAlignedChunkWriteOp(librados::ObjectWriteOperation &op,
-                              const std::string &fileChunk,
-                              const size_t offset,
-                              const std::string &newContents);
+                       boost::shared_ptr<ssize_t> inodeSize,
+                       bool fillCache);
+  bool readChunkFromCache(size_t fileChunk,
+                          const std::vector<FileReadDataImpSP> &readDataVector,
+                          boost::shared_ptr<boost::shared_mutex> readOpMutex,
+                          AsyncOpSP asyncOp,
+                          boost::shared_ptr<ssize_t> inodeSize);
+  bool shouldFillChunkCache(size_t fileChunk);
+  int loadAllocatedChunks(void);
+  bool isHole(size_t fileChunk, bool *refreshed);
+  int markChunksAllocated(const std::set<size_t> &chunks);
+  void readHole(size_t fileChunk,
+                const std::vector<FileReadDataImpSP> &readDataVector,
+                boost::shared_ptr<boost::shared_mutex> readOpMutex,
+                AsyncOpSP asyncOp, boost::shared_ptr<ssize_t> inodeSize);
+  void invalidateChunkCache(void);
+  int setAlignedChunkWriteOp(librados::ObjectWriteOperation &op,
+                             size_t chunkIndex,
+                             const size_t offset,
+                             const std::string &newContents);
+  int setAlignedChunkWriteOp(librados::ObjectWriteOperation &op,
+                             size_t chunkIndex,
+                             const WriteBehindExtents &extents);
+  int setCompressedChunkWriteOp(librados::ObjectWriteOperation &op,
+                                size_t chunkIndex,
+                                const WriteBehindExtents &extents,
+                                ssize_t truncateSize = -1);
+  int readChunkContents(size_t chunkIndex, std::string *contents);
+  bool rewritesWholeChunks(void) const
+  { return mCompression || mPool->hasAlignment(); }
   void unlockIfTimeIsOut(double idleTimeout);
+  bool bufferWrite(const char *buff, off_t offset, size_t blen,
+                   AsyncOpSP asyncOp);
+  WriteBehindDataSP takeWriteBehindData(void);
+  void queueWriteBehindData(WriteBehindDataSP data);
+  void postWriteBehindFlush(void);
+  void waitForWriteBehindFlushes(void);
+  WriteBehindDataSP takeFullAlignedChunks(off_t offset, size_t blen);
+  static void flushWriteBehindQueue(FileIO *fileIO,
+                                    WriteBehindFlushQueueSP queue);
+  int writeWriteBehindExtents(WriteBehindDataSP data);
+  int writeWriteBehindData(WriteBehindDataSP data);
+  int writeChunkExtents(WriteBehindDataSP data);
+  int vectorRead(const std::vector<FileReadData> &intervals,
+                 AsyncOpSP asyncOp);
+  void updateReadAheadWindow(off_t offset, size_t blen,
+                             std::deque<ReadAheadBufferSP> &discarded);
+  size_t readFromReadAhead(char *buff, off_t offset, size_t blen);
+  void scheduleReadAhead(off_t offset);
+  void clearReadAheadBuffers(std::deque<ReadAheadBufferSP> &discarded);
+  void dropReadAhead(void);
 };
 
 RADOS_FS_END_NAMESPACE
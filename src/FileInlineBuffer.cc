@@ -23,6 +23,7 @@
 #include <cstdio>
 #include <errno.h>
 #include <rados/librados.hpp>
+#include <sstream>
 
 #include "radosfsdefines.h"
 #include "AsyncOpPriv.hh"
@@ -41,7 +42,8 @@ FileInlineBuffer::FileInlineBuffer(Filesystem *fs,
     fileBaseName(fileBaseName),
     bufferSize(capacity),
     memoryBuffer(0),
-    memoryBufferMutex(0)
+    memoryBufferMutex(0),
+    hasLastBuffer(false)
 {}
 
 FileInlineBuffer::~FileInlineBuffer()
@@ -125,139 +127,216 @@ setInlineBufflist(librados::bufferlist &buff, timespec *spec,
   buff.append(contents);
 }
 
-ssize_t
-FileInlineBuffer::write(const char *buff, off_t offset, size_t blen)
+static bool
+replaceInlineContents(std::string &contents, const char *buff, off_t offset,
+                      size_t length)
 {
-  int ret = 0;
-
-  if (capacity() > 0 && (size_t) offset < capacity())
+  if (contents.length() < (offset + length))
   {
-    std::string inlineBufferKey = XATTR_FILE_INLINE_BUFFER + fileBaseName;
-    std::map<std::string, librados::bufferlist> omap;
-    std::set<std::string> keys;
-    keys.insert(inlineBufferKey);
-
-    size_t replaceLength(std::min(blen, capacity()));
-
-    if (memoryBuffer)
-    {
-      boost::unique_lock<boost::mutex> lock(*memoryBufferMutex);
-      memoryBuffer->replace(offset, replaceLength, buff, replaceLength);
-      return replaceLength;
-    }
-
-    boost::chrono::milliseconds sleepDuration(25);
-    while (true)
-    {
-      std::string currentContents;
-      std::string inlineBuffer;
-      librados::bufferlist contents;
-
-      ret = getInlineBuffer(&contents);
-      readInlineBuffer(contents, 0, &currentContents);
-
-      if (currentContents.length() < (offset + replaceLength))
-      {
-        const size_t lengthToFill = offset + replaceLength -
-                                    currentContents.length();
-        currentContents.append(lengthToFill, '\0');
-      }
-
-      inlineBuffer = currentContents;
-      inlineBuffer.replace(offset, replaceLength, buff, replaceLength);
-
-      omap[inlineBufferKey].clear();
-
-      timespec currentTime;
-      clock_gettime(CLOCK_REALTIME, &currentTime);
+    const size_t lengthToFill = offset + length - contents.length();
+    contents.append(lengthToFill, '\0');
+  }
 
-      setInlineBufflist(omap[inlineBufferKey], &currentTime, inlineBuffer);
+  contents.replace(offset, length, buff, length);
 
-      std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-      std::pair<librados::bufferlist, int> cmp(contents,
-                                               LIBRADOS_CMPXATTR_OP_EQ);
-      omapCmp[inlineBufferKey] = cmp;
+  return true;
+}
 
-      librados::ObjectWriteOperation writeOp;
-      writeOp.omap_set(omap);
-      writeOp.omap_cmp(omapCmp, 0);
+static bool
+fillInlineContents(std::string &contents, size_t capacity)
+{
+  contents.append(capacity - contents.length(), '\0');
 
-      ret = parentStat.pool->ioctx.operate(parentStat.translatedPath, &writeOp);
+  return true;
+}
 
-      if (ret == -ECANCELED)
-      {
-        sleepDuration *= 2;
-        boost::this_thread::sleep_for(sleepDuration);
-      }
-      else
-      {
-        ret = replaceLength;
-        break;
-      }
-    }
+static bool
+truncateInlineContents(std::string &contents, size_t capacity, size_t size)
+{
+  if (size < contents.length())
+  {
+    contents = contents.substr(0, size);
+  }
+  else if (size > contents.length())
+  {
+    size_t newSize = std::min(capacity, size);
+    contents.append(newSize - contents.length(), '\0');
+  }
+  else
+  {
+    return false;
   }
 
-  return ret;
+  return true;
 }
 
 int
-FileInlineBuffer::fillRemainingInlineBuffer()
+FileInlineBuffer::modifyInlineBuffer(const InlineBufferModifier &modify,
+                                     std::string *newContents)
 {
-  int ret = 0;
   std::string inlineBufferKey = XATTR_FILE_INLINE_BUFFER + fileBaseName;
-  std::map<std::string, librados::bufferlist> omap;
-  std::set<std::string> keys;
-  keys.insert(inlineBufferKey);
+  librados::bufferlist contents;
+  unsigned int backoff = FILE_INLINE_BUFFER_BACKOFF_MIN;
+  int ret = 0;
+  size_t casRetries = 0;
+  TraceSpan span(0, "inline_buffer_cas", "file");
 
-  if (memoryBuffer)
-  {
-    boost::unique_lock<boost::mutex> lock(*memoryBufferMutex);
-    memoryBuffer->append(capacity() - memoryBuffer->length(), '\0');
-    return memoryBuffer->length();
-  }
+  // The last value this instance wrote is used as the expected current value,
+  // so the common case (no other writer changed it meanwhile) does not need to
+  // read the inline buffer before writing it. The value is always compared,
+  // even when the file is locked exclusively, as the inline buffer may be
+  // written before taking the lock (and the last value may be outdated).
+  bool hasLastBuffer = getLastBuffer(&contents);
+  bool retryingLastBuffer = hasLastBuffer;
 
-  boost::chrono::milliseconds sleepDuration(25);
   while (true)
   {
-    std::string currentContents, inlineBuffer;
-    librados::bufferlist contents;
+    std::string inlineBuffer;
 
-    ret = getInlineBuffer(&contents);
-    readInlineBuffer(contents, 0, &currentContents);
+    if (!hasLastBuffer)
+    {
+      contents.clear();
+      getInlineBuffer(&contents);
+    }
+
+    readInlineBuffer(contents, 0, &inlineBuffer);
 
-    inlineBuffer = currentContents;
-    inlineBuffer.append(capacity() - currentContents.length(), '\0');
+    if (!modify(inlineBuffer))
+    {
+      // Not having changes to do may be due to an outdated last buffer
+      if (hasLastBuffer)
+      {
+        hasLastBuffer = retryingLastBuffer = false;
+        continue;
+      }
 
-    omap[inlineBufferKey].clear();
+      break;
+    }
 
+    std::map<std::string, librados::bufferlist> omap;
     timespec currentTime;
     clock_gettime(CLOCK_REALTIME, &currentTime);
 
     setInlineBufflist(omap[inlineBufferKey], &currentTime, inlineBuffer);
 
+    librados::ObjectWriteOperation writeOp;
     std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-    std::pair<librados::bufferlist, int> cmp(contents,
-                                             LIBRADOS_CMPXATTR_OP_EQ);
+    std::pair<librados::bufferlist, int> cmp(contents, LIBRADOS_CMPXATTR_OP_EQ);
     omapCmp[inlineBufferKey] = cmp;
-
-    librados::ObjectWriteOperation writeOp;
-    writeOp.omap_set(omap);
     writeOp.omap_cmp(omapCmp, 0);
+    writeOp.omap_set(omap);
 
     ret = parentStat.pool->ioctx.operate(parentStat.translatedPath, &writeOp);
 
     if (ret == -ECANCELED)
     {
-      sleepDuration *= 2;
-      boost::this_thread::sleep_for(sleepDuration);
+      hasLastBuffer = false;
+      fs->mPriv->metrics.add(Metrics::COUNTER_INLINE_BUFFER_CAS_RETRIES);
+      casRetries++;
+
+      // The last buffer was just outdated, so the current one is read right
+      // away; otherwise another writer is changing it at the same time
+      if (retryingLastBuffer)
+      {
+        retryingLastBuffer = false;
+        continue;
+      }
+
+      boost::this_thread::sleep_for(
+            boost::chrono::microseconds(backoffWithJitter(backoff)));
+      backoff = std::min(backoff * 2,
+                         (unsigned int) FILE_INLINE_BUFFER_BACKOFF_MAX);
+
+      continue;
     }
-    else
+
+    setLastBuffer(ret == 0 ? &omap[inlineBufferKey] : 0);
+
+    if (newContents)
+      newContents->swap(inlineBuffer);
+
+    break;
+  }
+
+  if (span.active() && casRetries > 0)
+  {
+    std::stringstream stream;
+    stream << "retries=" << casRetries;
+    span.setDetail(stream.str());
+  }
+
+  return ret;
+}
+
+bool
+FileInlineBuffer::getLastBuffer(librados::bufferlist *buff)
+{
+  boost::unique_lock<boost::mutex> lock(lastBufferMutex);
+
+  if (!hasLastBuffer)
+    return false;
+
+  *buff = lastBuffer;
+
+  return true;
+}
+
+void
+FileInlineBuffer::setLastBuffer(const librados::bufferlist *buff)
+{
+  boost::unique_lock<boost::mutex> lock(lastBufferMutex);
+
+  hasLastBuffer = buff != 0;
+  lastBuffer.clear();
+
+  if (buff)
+    lastBuffer = *buff;
+}
+
+ssize_t
+FileInlineBuffer::write(const char *buff, off_t offset, size_t blen)
+{
+  int ret = 0;
+
+  if (capacity() > 0 && (size_t) offset < capacity())
+  {
+    size_t replaceLength(std::min(blen, capacity()));
+
+    if (memoryBuffer)
     {
-      ret = inlineBuffer.length();
-      break;
+      boost::unique_lock<boost::mutex> lock(*memoryBufferMutex);
+      memoryBuffer->replace(offset, replaceLength, buff, replaceLength);
+      return replaceLength;
     }
+
+    ret = modifyInlineBuffer(boost::bind(&replaceInlineContents, _1, buff,
+                                         offset, replaceLength));
+
+    if (ret == 0)
+      ret = replaceLength;
+  }
+
+  return ret;
+}
+
+int
+FileInlineBuffer::fillRemainingInlineBuffer(void)
+{
+  if (memoryBuffer)
+  {
+    boost::unique_lock<boost::mutex> lock(*memoryBufferMutex);
+    memoryBuffer->append(capacity() - memoryBuffer->length(), '\0');
+    return memoryBuffer->length();
   }
 
+  std::string inlineBuffer;
+  int ret = modifyInlineBuffer(boost::bind(&fillInlineContents, _1,
+                                           capacity()),
+                               &inlineBuffer);
+
+  if (ret == 0)
+    ret = inlineBuffer.length();
+
   return ret;
 }
 
@@ -270,11 +349,6 @@ FileInlineBuffer::truncate(size_t size)
     return;
   }
 
-  std::string inlineBufferKey = XATTR_FILE_INLINE_BUFFER + fileBaseName;
-  std::map<std::string, librados::bufferlist> omap;
-  std::set<std::string> keys;
-  keys.insert(inlineBufferKey);
-
   if (memoryBuffer)
   {
     boost::unique_lock<boost::mutex> lock(*memoryBufferMutex);
@@ -292,58 +366,8 @@ FileInlineBuffer::truncate(size_t size)
     return;
   }
 
-  boost::chrono::milliseconds sleepDuration(25);
-  while (true)
-  {
-    std::string currentContents, inlineBuffer;
-    librados::bufferlist contents;
-
-    int ret = getInlineBuffer(&contents);
-    readInlineBuffer(contents, 0, &currentContents);
-
-    if (size < currentContents.length())
-    {
-      inlineBuffer = currentContents.substr(0, size);
-    }
-    else if (size > currentContents.length())
-    {
-      inlineBuffer = currentContents;
-      size_t newSize = std::min(capacity(), size);
-      inlineBuffer.append(newSize - currentContents.length(), '\0');
-    }
-    else
-    {
-      break;
-    }
-
-    omap[inlineBufferKey].clear();
-
-    timespec currentTime;
-    clock_gettime(CLOCK_REALTIME, &currentTime);
-
-    setInlineBufflist(omap[inlineBufferKey], &currentTime, inlineBuffer);
-
-    std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-    std::pair<librados::bufferlist, int> cmp(contents,
-                                             LIBRADOS_CMPXATTR_OP_EQ);
-    omapCmp[inlineBufferKey] = cmp;
-
-    librados::ObjectWriteOperation writeOp;
-    writeOp.omap_set(omap);
-    writeOp.omap_cmp(omapCmp, 0);
-
-    ret = parentStat.pool->ioctx.operate(parentStat.translatedPath, &writeOp);
-
-    if (ret == -ECANCELED)
-    {
-      sleepDuration *= 2;
-      boost::this_thread::sleep_for(sleepDuration);
-    }
-    else
-    {
-      break;
-    }
-  }
+  modifyInlineBuffer(boost::bind(&truncateInlineContents, _1, capacity(),
+                                 size));
 }
 
 void
@@ -22,6 +22,7 @@
 
 #include <arpa/inet.h>
 #include <boost/chrono.hpp>
+#include <boost/function.hpp>
 #include <boost/thread/mutex.hpp>
 #include <cstdlib>
 #include <rados/librados.hpp>
@@ -41,6 +42,10 @@
 
 RADOS_FS_BEGIN_NAMESPACE
 
+// Changes the given inline buffer contents, returning false if there is
+// nothing to change
+typedef boost::function<bool (std::string &)> InlineBufferModifier;
+
 class FileInlineBuffer
 {
 public:
@@ -74,6 +79,16 @@ public:
   size_t bufferSize;
   std::string *memoryBuffer;
   boost::mutex *memoryBufferMutex;
+
+private:
+  int modifyInlineBuffer(const InlineBufferModifier &modify,
+                         std::string *newContents=0);
+  bool getLastBuffer(librados::bufferlist *buff);
+  void setLastBuffer(const librados::bufferlist *buff);
+
+  librados::bufferlist lastBuffer;
+  bool hasLastBuffer;
+  boost::mutex lastBufferMutex;
 };
 
 RADOS_FS_END_NAMESPACE
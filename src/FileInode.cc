@@ -17,6 +17,7 @@
  * for more details.
  */
 
+#include <algorithm>
 #include <sys/stat.h>
 #include <sstream>
 
@@ -58,17 +59,37 @@ FileInodePriv::FileInodePriv(Filesystem *fs, FileIOSP fileIO)
 }
 
 FileInodePriv::~FileInodePriv()
-{}
+{
+  releaseFileIO();
+}
 
 void
 FileInodePriv::setFileIO(FileIOSP fileIO)
 {
+  if (io != fileIO)
+    releaseFileIO();
+
   io = fileIO;
 
   if (io)
     name = io->inode();
 }
 
+void
+FileInodePriv::releaseFileIO(void)
+{
+  if (!io)
+    return;
+
+  const std::string inode = io->inode();
+  io.reset();
+
+  // The idle checker only looks at a FileIO when it has something to do, so
+  // it needs to be told when one may have lost its last user
+  if (fs)
+    fs->mPriv->scheduleFileIOCheck(inode, 0);
+}
+
 int
 FileInodePriv::registerFileWithStats(const std::string &path, uid_t uid,
                                      gid_t gid, int mode,
@@ -104,6 +125,18 @@ FileInodePriv::registerFileWithStats(const std::string &path, uid_t uid,
   stream << inlineBufferSize;
   fileStat.extraData[XATTR_FILE_INLINE_BUFFER_SIZE] = stream.str();
 
+  if (!io->stripePools().empty())
+  {
+    fileStat.extraData[XATTR_FILE_STRIPE_POOLS] =
+        FilesystemPriv::stripePoolNames(io->stripePools());
+  }
+
+  if (io->compression())
+    fileStat.extraData[XATTR_FILE_COMPRESSION] = FILE_COMPRESSION_CODEC_ZLIB;
+
+  if (io->tracksAllocatedChunks())
+    fileStat.extraData[XATTR_FILE_ALLOCATED_CHUNKS] = FILE_ALLOCATED_CHUNKS_OMAP;
+
   int ret = indexObject(&parentStat, &fileStat, '+');
 
   if (ret == -ECANCELED)
@@ -180,6 +213,38 @@ FileInodePriv::setBackLink(const std::string &backLink)
   return io->pool()->ioctx.setxattr(io->inode(), XATTR_INODE_HARD_LINK, buff);
 }
 
+// An inode opened by name only knows its layout (e.g. its stripe pools, or
+// whether its chunks are compressed or tracked) from the entry of the file it
+// is registered with, found through its back link. If that layout cannot be used, the inode is left without a FileIO so its
+// operations fail instead of looking for the chunks in the wrong pools.
+void
+FileInodePriv::loadLayout(void)
+{
+  if (!io)
+    return;
+
+  fsPriv()->flushBacklinks();
+
+  std::string backLink;
+  Stat stat;
+
+  if (getFileInodeBackLink(io->pool().get(), name, &backLink) != 0 ||
+      backLink.empty() || fsPriv()->stat(backLink, &stat) != 0 ||
+      stat.translatedPath != name)
+  {
+    return;
+  }
+
+  int ret = fsPriv()->setFileIOLayout(io.get(), &stat);
+
+  if (ret != 0)
+  {
+    radosfs_debug("Cannot use the layout of inode %s from %s: %s",
+                  name.c_str(), backLink.c_str(), strerror(-ret));
+    io.reset();
+  }
+}
+
 /**
  * @class FileInode
  *
@@ -203,7 +268,11 @@ FileInodePriv::setBackLink(const std::string &backLink)
  */
 FileInode::FileInode(Filesystem *fs, const std::string &pool)
   : mPriv(new FileInodePriv(fs, pool, generateUuid(), fs->fileChunkSize()))
-{}
+{
+  // New inodes record their written chunks, as new files do
+  if (mPriv->io)
+    mPriv->io->setTrackAllocatedChunks(true);
+}
 
 /**
  * Creates an new instance of FileInode with the given \a name.
@@ -211,11 +280,15 @@ FileInode::FileInode(Filesystem *fs, const std::string &pool)
  * @param fs a pointer to the Filesystem that contains this file.
  * @param pool the pool where the file inode should be created.
  * @param name the name for this file inode.
+ * @note If the inode is already registered with a file, the layout recorded
+ *       for that file (e.g. its stripe pools or compression) is used.
  */
 FileInode::FileInode(Filesystem *fs, const std::string &pool,
                      const std::string &name)
   : mPriv(new FileInodePriv(fs, pool, name, fs->fileChunkSize()))
-{}
+{
+  mPriv->loadLayout();
+}
 
 /**
  * Creates an new instance of FileInode with the given \a name and \a stripeSize.
@@ -224,11 +297,15 @@ FileInode::FileInode(Filesystem *fs, const std::string &pool,
  * @param pool the pool where the file inode should be created.
  * @param name the name for this file inode.
  * @param stripeSize the stripe size to be used by this file inode.
+ * @note If the inode is already registered with a file, the layout recorded
+ *       for that file (e.g. its stripe pools or compression) is used.
  */
 FileInode::FileInode(Filesystem *fs, const std::string &pool,
                      const std::string &name, const size_t chunkSize)
   : mPriv(new FileInodePriv(fs, pool, name, chunkSize))
-{}
+{
+  mPriv->loadLayout();
+}
 
 /**
  * Creates an new instance of FileInode with an automatically generated name and
@@ -241,7 +318,10 @@ FileInode::FileInode(Filesystem *fs, const std::string &pool,
 FileInode::FileInode(Filesystem *fs, const std::string &pool,
                      const size_t chunkSize)
   : mPriv(new FileInodePriv(fs, pool, generateUuid(), chunkSize))
-{}
+{
+  if (mPriv->io)
+    mPriv->io->setTrackAllocatedChunks(true);
+}
 
 FileInode::FileInode(FileInodePriv *priv)
   : mPriv(priv)
@@ -313,14 +393,16 @@ FileInode::read(const std::vector<FileReadData> &intervals,
  * @param callback an AsyncOpCallback to be called after the asynchronous
  *        operation is finished
  * @param callbackArg a pointer to the user arguments that will be passed to the
- *        \a callback .
+ *        \a callback and \a bufferCallback .
+ * @param bufferCallback an AsyncOpBufferCallback to be called when \a buff is
+ *        no longer used by the write operation (and can be reused or freed).
  * @return 0 if the operation was initialized, an error code otherwise.
 
  */
 int
 FileInode::write(const char *buff, off_t offset, size_t blen, bool copyBuffer,
                  std::string *asyncOpId, AsyncOpCallback callback,
-                 void *callbackArg)
+                 void *callbackArg, AsyncOpBufferCallback bufferCallback)
 {
   if (!mPriv->io)
     return -ENODEV;
@@ -331,7 +413,7 @@ FileInode::write(const char *buff, off_t offset, size_t blen, bool copyBuffer,
 
   std::string opId;
   int ret = mPriv->io->write(buff, offset, blen, &opId, copyBuffer, callback,
-                             callbackArg);
+                             callbackArg, bufferCallback);
 
   if (asyncOpId)
     asyncOpId->assign(opId);
@@ -361,6 +443,50 @@ FileInode::writeSync(const char *buff, off_t offset, size_t blen)
   return mPriv->io->writeSync(buff, offset, blen);
 }
 
+/**
+ * Writes several intervals to the file inode asynchronously, as a single
+ * operation.
+ *
+ * The intervals are grouped per chunk, so each chunk they affect is written
+ * with a single operation, and the size of the inode is only updated once.
+ * Intervals that overlap are applied in the order they are given.
+ *
+ * @see FileWriteData.
+ * @param intervals a vector of FileWriteData objects describing the data to
+ *        write. Their buffers are copied so they can be reused or freed as
+ *        soon as this method returns.
+ * @param[out] asyncOpId a string location to return the id of the asynchonous
+ *             operation (or a null pointer in case none should be returned).
+ * @param callback a function to be called upon the end of the write operation.
+ * @param callbackArg a pointer representing user-defined argumetns, to be
+ *        passed to the \a callback.
+ * @return 0 if the operation was initialized, an error code otherwise.
+ */
+int
+FileInode::write(const std::vector<FileWriteData> &intervals,
+                 std::string *asyncOpId, AsyncOpCallback callback,
+                 void *callbackArg)
+{
+  if (!mPriv->io)
+    return -ENODEV;
+
+  std::string opId;
+  int ret = mPriv->io->write(intervals, &opId, callback, callbackArg);
+
+  if (ret != 0)
+    return ret;
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->asyncOpsMutex);
+    mPriv->asyncOps.push_back(opId);
+  }
+
+  return ret;
+}
+
 /**
  * Removes the file inode.
  *
@@ -375,6 +501,24 @@ FileInode::remove(void)
   return mPriv->io->remove();
 }
 
+/**
+ * Copies the contents of this file inode into the \a destination one, without
+ * them going through the client (see File::copyTo).
+ *
+ * @param destination a new file inode (not yet written) with the same chunk
+ *        size as this one.
+ * @return 0 on success, -EEXIST if \a destination has already been written,
+ *         -EINVAL if its chunk size is different, another error code otherwise.
+ */
+int
+FileInode::copyTo(FileInode &destination)
+{
+  if (!mPriv->io || !destination.mPriv->io)
+    return -ENODEV;
+
+  return mPriv->io->copyTo(*destination.mPriv->io);
+}
+
 /**
  * Truncates the file inode.
  *
@@ -434,6 +578,120 @@ FileInode::sync(const std::string &opId)
   return ret;
 }
 
+/**
+ * Waits for the file inode's asynchronous operations with the given ids to be
+ * finished.
+ *
+ * @param opIds the ids of the asynchronous operations.
+ * @return 0 on success, the error code of the first operation that failed
+ *         otherwise.
+ */
+int
+FileInode::sync(const std::vector<std::string> &opIds)
+{
+  int ret = 0;
+
+  for (size_t i = 0; i < opIds.size(); i++)
+  {
+    int opRet = sync(opIds[i]);
+
+    if (ret == 0)
+      ret = opRet;
+  }
+
+  return ret;
+}
+
+/**
+ * Checks whether the asynchronous operation with the given \a opId has
+ * finished, without blocking.
+ *
+ * @param opId the id of an asynchronous operation.
+ * @return -EINPROGRESS if the operation is still running, -ENOENT if there is
+ *         no such operation, otherwise the operation's return code (0 on
+ *         success). Once this method returns the operation's return code, the
+ *         operation is forgotten like after FileInode::sync.
+ */
+int
+FileInode::pollOp(const std::string &opId)
+{
+  if (!mPriv->io)
+    return -ENODEV;
+
+  boost::unique_lock<boost::mutex> lock(mPriv->asyncOpsMutex);
+
+  std::vector<std::string>::iterator it = std::find(mPriv->asyncOps.begin(),
+                                                    mPriv->asyncOps.end(),
+                                                    opId);
+
+  if (it == mPriv->asyncOps.end())
+    return -ENOENT;
+
+  int ret = mPriv->io->pollOp(opId);
+
+  if (ret != -EINPROGRESS)
+    mPriv->asyncOps.erase(it);
+
+  return ret;
+}
+
+/**
+ * Waits until any of the asynchronous operations with the given \a opIds is
+ * finished.
+ *
+ * @param opIds the ids of asynchronous operations.
+ * @param[out] finishedOpId a string to return the id of the operation that
+ *             finished.
+ * @return -ENOENT if none of the operations exist, otherwise the return code
+ *         of the finished operation (0 on success). The finished operation is
+ *         forgotten like after FileInode::sync.
+ */
+int
+FileInode::waitForAnyOp(const std::vector<std::string> &opIds,
+                        std::string *finishedOpId)
+{
+  if (!mPriv->io)
+    return -ENODEV;
+
+  std::vector<std::string> knownOpIds;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->asyncOpsMutex);
+
+    for (size_t i = 0; i < opIds.size(); i++)
+    {
+      if (std::find(mPriv->asyncOps.begin(), mPriv->asyncOps.end(),
+                    opIds[i]) != mPriv->asyncOps.end())
+      {
+        knownOpIds.push_back(opIds[i]);
+      }
+    }
+  }
+
+  if (knownOpIds.empty())
+    return -ENOENT;
+
+  std::string opId;
+  int ret = mPriv->io->waitForAnyOp(knownOpIds, &opId);
+
+  if (opId.empty())
+    return ret;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->asyncOpsMutex);
+    std::vector<std::string>::iterator it = std::find(mPriv->asyncOps.begin(),
+                                                      mPriv->asyncOps.end(),
+                                                      opId);
+    if (it != mPriv->asyncOps.end())
+      mPriv->asyncOps.erase(it);
+  }
+
+  if (finishedOpId)
+    finishedOpId->assign(opId);
+
+  return ret;
+}
+
 /**
  * Returns the name of the file inode.
  *
@@ -512,6 +770,9 @@ FileInode::registerFile(const std::string &path, uid_t uid, gid_t gid, int mode)
 int
 FileInode::getBackLink(std::string *backLink)
 {
+  // Queued back links are written first so the one read is up to date
+  mPriv->fsPriv()->flushBacklinks();
+
   int ret = getFileInodeBackLink(mPriv->io->pool().get(), name(), backLink);
 
   if (ret == 0 && backLink->empty())
@@ -541,6 +802,40 @@ FileInode::getSize(u_int64_t &size)
   return 0;
 }
 
+/**
+ * Finds the offset of the next data in this file inode (like SEEK_DATA in
+ * lseek).
+ * @see File::seekData
+ * @param offset the offset from which to look for data.
+ * @return the offset of the data on success, -ENXIO if there is no data after
+ *         \a offset, or a negative error code otherwise.
+ */
+off_t
+FileInode::seekData(off_t offset)
+{
+  if (!mPriv->io)
+    return -ENODEV;
+
+  return mPriv->io->seekData(offset);
+}
+
+/**
+ * Finds the offset of the next hole in this file inode (like SEEK_HOLE in
+ * lseek).
+ * @see File::seekHole
+ * @param offset the offset from which to look for a hole.
+ * @return the offset of the hole on success, -ENXIO if \a offset is beyond
+ *         the size of the inode, or a negative error code otherwise.
+ */
+off_t
+FileInode::seekHole(off_t offset)
+{
+  if (!mPriv->io)
+    return -ENODEV;
+
+  return mPriv->io->seekHole(offset);
+}
+
 /**
  * Sets an extended attribute in the file inode.
  *
@@ -45,16 +45,29 @@ public:
 
   int write(const char *buff, off_t offset, size_t blen, bool copyBuffer = false,
             std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
-            void *callbackArg = 0);
+            void *callbackArg = 0, AsyncOpBufferCallback bufferCallback = 0);
 
   int writeSync(const char *buff, off_t offset, size_t blen);
 
+  int write(const std::vector<FileWriteData> &intervals,
+            std::string *asyncOpId = 0, AsyncOpCallback callback = 0,
+            void *callbackArg = 0);
+
   int remove(void);
 
+  int copyTo(FileInode &destination);
+
   int truncate(size_t size);
 
   int sync(const std::string &opId="");
 
+  int sync(const std::vector<std::string> &opIds);
+
+  int pollOp(const std::string &opId);
+
+  int waitForAnyOp(const std::vector<std::string> &opIds,
+                   std::string *finishedOpId = 0);
+
   std::string name(void) const;
 
   int registerFile(const std::string &path, uid_t uid, gid_t gid, int mode=-1);
@@ -63,6 +76,10 @@ public:
 
   int getSize(u_int64_t &size);
 
+  off_t seekData(off_t offset);
+
+  off_t seekHole(off_t offset);
+
   int setXAttr(const std::string &attrName,
                const std::string &value);
 
@@ -42,6 +42,8 @@ public:
 
   void setFileIO(FileIOSP fileIO);
 
+  void releaseFileIO(void);
+
   int registerFile(const std::string &path, uid_t uid, gid_t gid, int mode,
                    size_t inlineBufferSize=0);
 
@@ -51,6 +53,10 @@ public:
 
   int setBackLink(const std::string &backLink);
 
+  void loadLayout(void);
+
+  FilesystemPriv * fsPriv(void) const { return fs->mPriv; }
+
   Filesystem *fs;
   std::string name;
   FileIOSP io;
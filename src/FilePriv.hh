@@ -52,15 +52,21 @@ public:
 
   Stat *parentFsStat(void) { return reinterpret_cast<Stat *>(fsFile->parentFsStat()); }
 
+  int statDestination(const std::string &destination, Stat &parentStat,
+                      std::string &newPath);
+
   int rename(const std::string &destination);
 
+  int copy(const std::string &destination);
+
   void updateDataPool(const std::string &pool);
 
   void setInode(const size_t chunkSize);
 
   FileIOSP getFileIO(void) const { return inode->mPriv->io; }
 
-  int create(int mode, uid_t uid, gid_t gid, size_t chunk, Stat *fileStat);
+  int create(int mode, uid_t uid, gid_t gid, size_t chunk, size_t sizeHint,
+             Stat *fileStat);
 
   FilesystemPriv * getFsPriv(void) { return fsFile->filesystem()->mPriv; }
 
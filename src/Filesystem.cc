@@ -17,18 +17,24 @@
  * for more details.
  */
 
-#include <boost/asio.hpp>
+#include <algorithm>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/progress.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <rados/librados.hpp>
+#include <sstream>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <utility>
 
+#include "AsyncOpPriv.hh"
 #include "Filesystem.hh"
 #include "File.hh"
 #include "FilesystemPriv.hh"
+#include "QuotaPriv.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
@@ -38,193 +44,67 @@ __thread gid_t FilesystemPriv::gid;
 FilesystemPriv::FilesystemPriv(Filesystem *radosFs)
   : radosFs(radosFs),
     initialized(false),
+    tracer(DEFAULT_TRACE_MAX_EVENTS),
+    dirCache(DEFAULT_DIR_CACHE_MAX_SIZE, DEFAULT_DIR_CACHE_MAX_BYTES),
+    dirInodeCache(DEFAULT_DIR_INODE_CACHE_MAX_ENTRIES,
+                  DEFAULT_DIR_INODE_NEGATIVE_CACHE_TTL),
+    statCache(DEFAULT_STAT_CACHE_MAX_ENTRIES, DEFAULT_STAT_CACHE_TTL),
     dirCompactRatio(DEFAULT_DIR_COMPACT_RATIO),
+    dirLogBinaryCompaction(DEFAULT_DIR_LOG_BINARY_COMPACTION),
+    dirOmapIndex(DEFAULT_DIR_OMAP_INDEX),
+    dirBackgroundCompaction(false),
+    dirCacheWatch(false),
+    dirServerSideFind(false),
+    dirCompactionsPerInterval(DEFAULT_DIR_COMPACTIONS_PER_INTERVAL),
     fileChunkSize(FILE_CHUNK_SIZE),
-    numGenericWorkers(DEFAULT_NUM_WORKER_THREADS),
-    ioService(new boost::asio::io_service),
-    asyncWork(new boost::asio::io_service::work(*ioService)),
+    fileStripeWidth(DEFAULT_FILE_STRIPE_WIDTH),
+    fileWriteBehindSize(DEFAULT_FILE_WRITE_BEHIND_SIZE),
+    fileSizeCacheStaleness(DEFAULT_FILE_SIZE_CACHE_STALENESS),
+    fileReadAhead(false),
+    fileChunkRemovalWindow(DEFAULT_FILE_CHUNK_REMOVAL_WINDOW),
+    fileBackgroundLazyRemoval(false),
+    quotaUpdateInterval(DEFAULT_QUOTA_UPDATE_INTERVAL),
+    quotaUpdateMaxPendingSize(DEFAULT_QUOTA_UPDATE_MAX_PENDING_SIZE),
+    tmIdFlushScheduled(false),
+    backlinkFlushScheduled(false),
+    backlinkFlushPosted(false),
+    metricsDumpInterval(DEFAULT_METRICS_DUMP_INTERVAL),
+    chunkCache(DEFAULT_FILE_CHUNK_CACHE_SIZE, DEFAULT_FILE_CHUNK_CACHE_TTL),
+    scheduler(DEFAULT_NUM_WORKER_THREADS),
     fileOpsIdleChecker(boost::bind(&FilesystemPriv::checkFileLocks, this))
 {
   uid = 0;
   gid = 0;
-  dirCache.maxCacheSize = DEFAULT_DIR_CACHE_MAX_SIZE;
 }
 
 FilesystemPriv::~FilesystemPriv()
 {
-  asyncWork.reset();
-  generalWorkerThreads.join_all();
+  scheduler.stop();
 
   fileOpsIdleChecker.interrupt();
   operationsMutex.lock();
   operations.clear();
   operationsMutex.unlock();
+  fileIOChecks.clear();
+
+  // The quotas' objects need to get the sizes that were still being
+  // accumulated before the pools are released
+  flushAllQuotaDeltas();
+  flushTMIds();
+  flushBacklinks();
 
   poolMap.clear();
   mtdPoolMap.clear();
-  dirPathInodeMap.clear();
+  dataPoolTrie.reset();
+  mtdPoolTrie.reset();
+  dirInodeCache.clear();
+
+  // Watched dirs need the cluster connection to be unwatched, so they have to
+  // be released before shutting it down
+  dirCache.clear();
 
   if (initialized)
     radosCluster.shutdown();
-
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
-
-  dirCache.cleanCache();
-}
-
-PriorityCache::PriorityCache()
-  : head(0),
-    tail(0),
-    cacheSize(0),
-    maxCacheSize(DEFAULT_DIR_CACHE_MAX_SIZE)
-{}
-
-PriorityCache::~PriorityCache()
-{}
-
-void
-PriorityCache::cleanCache()
-{
-  std::map<std::string, LinkedList *>::iterator it;
-  for (it = cacheMap.begin(); it != cacheMap.end(); it++)
-  {
-    delete (*it).second;
-  }
-
-  cacheMap.clear();
-}
-
-void
-PriorityCache::removeCache(const std::string &path, bool freeMemory)
-{
-  if (cacheMap.count(path) == 0)
-    return;
-
-  LinkedList *link = cacheMap[path];
-  removeCache(link, freeMemory);
-}
-
-void
-PriorityCache::removeCache(LinkedList *link, bool freeMemory)
-{
-  if (head == link)
-  {
-    head = head->previous;
-
-    if (head)
-      head->next = 0;
-  }
-
-  if (tail == link)
-  {
-    tail = tail->next;
-
-    if (tail)
-      tail->previous = 0;
-  }
-
-  if (link->next != 0)
-    link->next->previous = link->previous;
-
-  if (link->previous != 0)
-    link->previous->next = link->next;
-
-  if (freeMemory)
-  {
-    cacheSize -= link->lastNumEntries;
-    cacheMap.erase(link->cachePtr->inode());
-    delete link;
-  }
-}
-
-void
-PriorityCache::moveToFront(LinkedList *link)
-{
-  if (head == link || link == 0)
-    return;
-
-  if (tail == link)
-  {
-    tail = tail->next;
-
-    if (tail)
-      tail->previous = 0;
-  }
-
-  if (tail == 0)
-    tail = link;
-
-  if (link->next != 0)
-    link->next->previous = link->previous;
-
-  if (link->previous != 0)
-    link->previous->next = link->next;
-
-  link->previous = head;
-  head = link;
-
-  if (link->previous)
-    link->previous->next = link;
-
-  link->next = 0;
-}
-
-void
-PriorityCache::update(std::tr1::shared_ptr<DirCache> cache)
-{
-  LinkedList *list = 0;
-  const size_t dirNumEntries = cache->contents().size();
-
-  // we add 1 to the number of entries because the size of the
-  // cache is the number of directories plus their entries
-  if (dirNumEntries + 1 > maxCacheSize)
-    return;
-
-  if (cacheMap.count(cache->inode()) == 0)
-  {
-    list = new LinkedList;
-    list->cachePtr = cache;
-    list->next = 0;
-    list->previous = 0;
-    list->lastNumEntries = 0;
-
-    cacheMap[cache->inode()] = list;
-  }
-  else
-  {
-    list = cacheMap[cache->inode()];
-  }
-
-  if (dirNumEntries != list->lastNumEntries)
-  {
-    cacheSize += dirNumEntries - list->lastNumEntries;
-    list->lastNumEntries = dirNumEntries;
-  }
-
-  moveToFront(list);
-
-  adjustCache();
-}
-
-void
-PriorityCache::adjustCache()
-{
-  if (size() <= maxCacheSize || tail == 0 || size() == 1)
-    return;
-
-  size_t minCacheSize = (float) maxCacheSize *
-                        DEFAULT_DIR_CACHE_CLEAN_PERCENTAGE;
-
-  if (minCacheSize == 0)
-    minCacheSize = 1;
-
-  while (size() > minCacheSize)
-  {
-    if (tail == 0)
-      break;
-
-    removeCache(tail);
-  }
 }
 
 int
@@ -376,31 +256,29 @@ int
 FilesystemPriv::getDirInode(const std::string &path, Inode &inode,
                             PoolSP &mtdPool)
 {
-  {
-    boost::unique_lock<boost::mutex> (dirPathInodeMutex);
+  bool negative = false;
 
-    if (dirPathInodeMap.count(path) > 0)
-      inode = dirPathInodeMap[path];
-  }
+  if (dirInodeCache.get(path, inode, &negative))
+    return negative ? -ENOENT : 0;
 
-  if (inode.inode == "")
-  {
-    std::string inodeName, poolName;
+  std::string inodeName, poolName;
 
-    int ret = getInodeAndPool(mtdPool->ioctx, path, inodeName, poolName);
+  int ret = getInodeAndPool(mtdPool->ioctx, path, inodeName, poolName);
 
-    if (ret != 0)
-      return ret;
+  if (ret == -ENOENT)
+    dirInodeCache.setNegative(path);
 
-    PoolSP pool = getMtdPoolFromName(poolName);
+  if (ret != 0)
+    return ret;
 
-    if (!pool)
-      return -ENODEV;
+  PoolSP pool = getMtdPoolFromName(poolName);
 
-    inode.inode = inodeName;
-    inode.pool = pool;
-    setDirInode(path, inode);
-  }
+  if (!pool)
+    return -ENODEV;
+
+  inode.inode = inodeName;
+  inode.pool = pool;
+  setDirInode(path, inode);
 
   return 0;
 }
@@ -415,67 +293,20 @@ FilesystemPriv::getDirInode(const std::string &path, Inode &inode)
 void
 FilesystemPriv::setDirInode(const std::string &path, const Inode &inode)
 {
-  boost::unique_lock<boost::mutex> (dirPathInodeMutex);
-  dirPathInodeMap[path] = inode;
+  dirInodeCache.set(path, inode);
 }
 
 void
 FilesystemPriv::updateDirInode(const std::string &oldPath,
                                const std::string &newPath)
 {
-  boost::unique_lock<boost::mutex> (dirPathInodeMutex);
-
-  if (dirPathInodeMap.count(oldPath) > 0)
-  {
-    dirPathInodeMap[newPath] = dirPathInodeMap[oldPath];
-    dirPathInodeMap.erase(oldPath);
-  }
+  dirInodeCache.rename(oldPath, newPath);
 }
 
 void
 FilesystemPriv::removeDirInode(const std::string &path)
 {
-  boost::unique_lock<boost::mutex> (dirPathInodeMutex);
-  dirPathInodeMap.erase(path);
-}
-
-void
-FilesystemPriv::launchThreads(void)
-{
-  size_t threadsToLaunch = DEFAULT_NUM_WORKER_THREADS;
-  size_t currentLaunchedThreads = generalWorkerThreads.size();
-
-  {
-    boost::unique_lock<boost::mutex> lock(genericWorkersMutex);
-
-    threadsToLaunch = numGenericWorkers;
-  }
-
-  while (threadsToLaunch < currentLaunchedThreads)
-  {
-    boost::thread *thread = genericWorkersList.back();
-    genericWorkersList.pop_back();
-    currentLaunchedThreads--;
-
-    generalWorkerThreads.remove_thread(thread);
-    delete thread;
-  }
-
-  while (threadsToLaunch > currentLaunchedThreads)
-  {
-    boost::thread *thread = generalWorkerThreads.create_thread(
-                              boost::bind(&FilesystemPriv::generalWorkerThread,
-                                          this, ioService));
-    genericWorkersList.push_back(thread);
-    currentLaunchedThreads++;
-  }
-}
-
-boost::shared_ptr<boost::asio::io_service>
-FilesystemPriv::getIoService()
-{
-  launchThreads();
-  return ioService;
+  dirInodeCache.remove(path);
 }
 
 int
@@ -566,35 +397,33 @@ FilesystemPriv::statEntry(std::string path, std::string entry,
   else
   {
     FileIOSP fileIO = getOrCreateFileIO(stat->translatedPath, stat);
+
+    if (!fileIO)
+      return -ENODEV;
+
     stat->statBuff.st_size = fileIO->getSize();
   }
 
   return ret;
 }
 
-void
-FilesystemPriv::generalWorkerThread(
-    boost::shared_ptr<boost::asio::io_service> ioService)
-{
-  ioService->run();
-}
-
 void
 FilesystemPriv::statEntries(StatAsyncInfo *info,
                             std::map<std::string, std::string> &xattrs)
 {
+  info->entryStats.resize(info->entries->size());
+
   for (size_t i = 0; i < info->entries->size(); i++)
   {
     const std::string &entryName = (*info->entries)[i];
     const std::string &path = info->stat.path + entryName;
     const std::string &xattr = xattrs[XATTR_FILE_PREFIX + entryName];
-
-    Stat stat;
+    std::pair<int, Stat> &entryStat = info->entryStats[i];
 
     if (xattr == "")
     {
-      stat.path = path;
-      info->entryStats[path] = std::pair<int, Stat>(-ENOENT, stat);
+      entryStat.first = -ENOENT;
+      entryStat.second.path = path;
       continue;
     }
 
@@ -608,12 +437,8 @@ FilesystemPriv::statEntries(StatAsyncInfo *info,
                          XATTR_FILE_INLINE_BUFFER_HEADER_SIZE;
     }
 
-    int ret = statEntry(path, xattr, inlineBufferSize, &stat);
-
-    if (ret == 0 || info->entryStats.count(path) == 0)
-    {
-      info->entryStats[path] = std::pair<int, Stat>(ret, stat);
-    }
+    entryStat.first = statEntry(path, xattr, inlineBufferSize,
+                                &entryStat.second);
   }
 }
 
@@ -651,10 +476,7 @@ FilesystemPriv::statAsync(StatAsyncInfo *info)
 }
 
 int
-FilesystemPriv::statAsyncInfoInThread(const std::string path,
-                                      StatAsyncInfo *info, boost::mutex *mutex,
-                                      boost::condition_variable *cond,
-                                      int *numJobs)
+FilesystemPriv::statDirAndEntries(const std::string &path, StatAsyncInfo *info)
 {
   int ret;
   info->stat.reset();
@@ -664,6 +486,7 @@ FilesystemPriv::statAsyncInfoInThread(const std::string path,
   if (!mtdPool.get())
   {
     ret = -ENODEV;
+    info->statRet = ret;
     return ret;
   }
 
@@ -682,839 +505,825 @@ FilesystemPriv::statAsyncInfoInThread(const std::string path,
     info->statRet = ret;
   }
 
-  mutex->lock();
-  int remaininNumJobs = --*numJobs;
-  mutex->unlock();
-
-  if (remaininNumJobs == 0)
-    cond->notify_all();
-
   return ret;
 }
 
-static void
-gatherPathsByParentDir(const std::vector<std::string> &paths,
-                       std::map<std::string, std::vector<std::string> > &entries)
+// Stats the given files of a dir and gets their inline buffers, both from a
+// single read of the dir's object
+int
+FilesystemPriv::readInlineFiles(const std::string &dirPath,
+                                const std::vector<std::string> &entries,
+                                std::vector<InlineFileRead> *files)
 {
-  for (size_t i = 0; i < paths.size(); i++)
-  {
-    const std::string &path = paths[i];
+  StatAsyncInfo info;
+  info.entries = &entries;
+  info.stat.reset();
+  info.stat.path = getDirPath(dirPath);
 
-    if (path == "/" && entries.count(path) == 0)
-    {
-      entries[path].clear();
-      continue;
-    }
+  PoolSP mtdPool = getMetadataPoolFromPath(info.stat.path);
 
-    std::string parentDir = getParentDir(path, 0);
-    entries[parentDir].push_back(path.substr(parentDir.length()));
-  }
-}
+  if (!mtdPool)
+    return -ENODEV;
 
-std::map<std::string, std::pair<int, Stat> >
-FilesystemPriv::stat(const std::vector<std::string> &paths)
-{
-  std::map<std::string, std::pair<int, Stat> > stats;
-  std::map<std::string, std::vector<std::string> > entries;
+  Inode inode;
+  int ret = getDirInode(info.stat.path, inode, mtdPool);
 
-  gatherPathsByParentDir(paths, entries);
+  if (ret != 0)
+    return ret;
 
-  parallelStat(entries, &stats);
+  std::map<std::string, std::string> xattrs;
 
-  // Call parallel stat again on the paths that were not found
-  entries.clear();
-  std::map<std::string, std::pair<int, Stat> >::iterator it;
-  for (it = stats.begin(); it != stats.end(); it++)
+  for (size_t i = 0; i < entries.size(); i++)
   {
-    std::pair<int, Stat> statResult = (*it).second;
-
-    if (statResult.first != 0)
-    {
-      const std::string &path = (*it).first;
-      entries[path].clear();
-    }
+    xattrs[XATTR_FILE_PREFIX + entries[i]] = "";
+    xattrs[XATTR_FILE_INLINE_BUFFER + entries[i]] = "";
   }
 
-  if (entries.size())
-    parallelStat(entries, &stats);
+  u_int64_t size;
+  time_t mtime;
+  ret = statAndGetXAttrs(inode.pool->ioctx, inode.inode, &size, &mtime,
+                         xattrs);
 
-  return stats;
-}
+  if (ret != 0)
+    return ret;
 
-void
-FilesystemPriv::parallelStat(
-    const std::map<std::string, std::vector<std::string> > &paths,
-    std::map<std::string, std::pair<int, Stat> > *stats)
-{
-  StatAsyncInfo *statInfoList = new StatAsyncInfo[paths.size()];
-  boost::mutex mutex;
-  boost::condition_variable cond;
-  int numJobs = paths.size();
-  std::map<std::string, std::vector<std::string> >::const_iterator it;
-  size_t i;
+  statEntries(&info, xattrs);
+
+  files->clear();
+  files->resize(entries.size());
 
-  for (it = paths.begin(), i = 0; it != paths.end(); it++, i++)
+  for (size_t i = 0; i < entries.size(); i++)
   {
-    std::string dir = (*it).first;
-    StatAsyncInfo *info = &statInfoList[i];
-    info->entries = &(*it).second;
+    InlineFileRead &file = (*files)[i];
+    file.ret = info.entryStats[i].first;
+    file.stat = info.entryStats[i].second;
 
-    getIoService()->post(boost::bind(&FilesystemPriv::statAsyncInfoInThread,
-                                     this, dir, info, &mutex, &cond, &numJobs));
-  }
+    if (file.ret != 0)
+      continue;
 
-  boost::unique_lock<boost::mutex> lock(mutex);
+    std::string &inlineBuffer = xattrs[XATTR_FILE_INLINE_BUFFER + entries[i]];
 
-  if (numJobs > 0)
-    cond.wait(lock);
+    if (inlineBuffer.length() > XATTR_FILE_INLINE_BUFFER_HEADER_SIZE)
+      file.contents = inlineBuffer.substr(XATTR_FILE_INLINE_BUFFER_HEADER_SIZE);
 
-  // Assign the result of statting all the paths to the stats output parameter
-  for (size_t i = 0; i < paths.size(); i++)
-  {
-    StatAsyncInfo *statInfo = &statInfoList[i];
-    std::map<std::string, std::pair<int, Stat> >::const_iterator it;
+    // As when statting, an inline buffer that is not filled up means the file
+    // has no other contents
+    const size_t capacity =
+        getInlineBufferCapacityFromExtraData(file.stat.extraData);
 
-    if (statInfo->statRet == 0)
-    {
-      std::pair<int, Stat> statResult(statInfo->statRet, statInfo->stat);
-      (*stats)[statInfo->stat.path] = statResult;
-    }
+    file.complete = S_ISREG(file.stat.statBuff.st_mode) && capacity > 0 &&
+                    file.contents.length() != capacity;
 
-    for (it = statInfo->entryStats.begin(); it != statInfo->entryStats.end();
-         it++)
-    {
-      const std::string &path = (*it).first;
-      const std::pair<int, Stat> &statResult = (*it).second;
+    if (!file.complete)
+      file.contents.clear();
+  }
 
-      if (stats->count(path) > 0 && stats->at(path).first == 0)
-        continue;
+  return 0;
+}
 
-      (*stats)[path] = statResult;
-    }
+// Splits the given batch (whose entries are emptied) into batches of up to
+// STAT_BATCH_MAX_ENTRIES entries, so large directories are statted by several
+// workers
+static void
+appendIndexedBatches(IndexedStatBatch &batch,
+                     std::vector<IndexedStatBatch> &batches)
+{
+  if (batch.entries.size() <= STAT_BATCH_MAX_ENTRIES)
+  {
+    batches.push_back(IndexedStatBatch());
+    batches.back().dir = batch.dir;
+    batches.back().entries.swap(batch.entries);
+    batches.back().indexes.swap(batch.indexes);
+    return;
+  }
+
+  for (size_t i = 0; i < batch.entries.size(); i += STAT_BATCH_MAX_ENTRIES)
+  {
+    const size_t end = std::min(batch.entries.size(),
+                                i + STAT_BATCH_MAX_ENTRIES);
+    batches.push_back(IndexedStatBatch());
+
+    IndexedStatBatch &newBatch = batches.back();
+    newBatch.dir = batch.dir;
+    newBatch.entries.assign(batch.entries.begin() + i,
+                            batch.entries.begin() + end);
+    newBatch.indexes.assign(batch.indexes.begin() + i,
+                            batch.indexes.begin() + end);
   }
 
-  delete[] statInfoList;
+  batch.entries.clear();
+  batch.indexes.clear();
 }
 
-int
-FilesystemPriv::stat(const std::string &path, Stat *stat)
+static IndexedStatBatch
+dirStatBatch(const std::string &dir, size_t index)
 {
-  PoolSP mtdPool;
-  int ret = -ENODEV;
-  stat->reset();
-  stat->path = getDirPath(path);
-  mtdPool = getMetadataPoolFromPath(stat->path);
+  IndexedStatBatch batch;
+  batch.dir = dir;
+  batch.indexes.push_back(index);
 
-  if (!mtdPool.get())
-    return -ENODEV;
+  return batch;
+}
 
-  if (isDirPath(path))
+static void
+setIndexedBatchResults(const IndexedStatBatch &batch,
+                       const StatAsyncInfo &info,
+                       StatResults *results,
+                       boost::mutex *resultsMutex)
+{
+  if (resultsMutex)
+    resultsMutex->lock();
+
+  if (batch.entries.empty())
   {
-    ret = statDir(mtdPool, stat);
+    if (info.statRet == 0)
+      results->set(batch.indexes[0], 0, info.stat);
+  }
+  else
+  {
+    for (size_t i = 0; i < info.entryStats.size(); i++)
+    {
+      const size_t index = batch.indexes[i];
+      const std::pair<int, Stat> &entryStat = info.entryStats[i];
 
-    if (ret == 0 || ret == -ENODEV)
-      return ret;
+      // Do not replace the result of a path that was already found
+      if (results->ret(index) != 0)
+        results->set(index, entryStat.first, entryStat.second);
+    }
   }
 
-  ret = statFile(mtdPool, stat);
+  if (resultsMutex)
+    resultsMutex->unlock();
+}
 
-  if (ret == 0 || ret == -ENODEV)
-    return ret;
+int
+FilesystemPriv::statIndexedBatch(const IndexedStatBatch &batch,
+                                 StatResults *results,
+                                 boost::mutex *resultsMutex)
+{
+  StatAsyncInfo info;
+  info.entries = &batch.entries;
 
-  ret = statDir(mtdPool, stat);
+  int ret = statDirAndEntries(batch.dir, &info);
+
+  setIndexedBatchResults(batch, info, results, resultsMutex);
 
   return ret;
 }
 
-int
-FilesystemPriv::statDir(PoolSP mtdPool, Stat *stat)
+// Stats the given entries (which are emptied) of a dir in the calling thread,
+// in batches of up to STAT_BATCH_MAX_ENTRIES entries. The dir's inode is only
+// looked up for the first batch and reused for the others.
+void
+FilesystemPriv::statEntryBatches(IndexedStatBatch &batch, StatResults *results)
 {
-  Inode inode;
-  int ret = getDirInode(stat->path, inode, mtdPool);
+  std::vector<IndexedStatBatch> batches;
+  StatAsyncInfo info;
 
-  if (ret == 0)
+  if (batch.entries.empty())
+    return;
+
+  appendIndexedBatches(batch, batches);
+
+  for (size_t i = 0; i < batches.size(); i++)
   {
-    stat->pool = inode.pool;
-    stat->translatedPath = inode.inode;
+    info.entries = &batches[i].entries;
+    info.entryStats.clear();
 
-    ret = statDirObj(*stat);
-  }
+    if (i == 0)
+      statDirAndEntries(batches[i].dir, &info);
+    else
+      statAsync(&info);
 
-  return ret;
+    if (info.statRet != 0)
+      break;
+
+    setIndexedBatchResults(batches[i], info, results, 0);
+  }
 }
 
-int
-FilesystemPriv::statFile(PoolSP mtdPool, Stat *stat)
+void
+FilesystemPriv::statEntryList(const std::string &dirPath,
+                              const std::vector<std::string> &entries,
+                              StatResults *results)
 {
-  int ret;
-  PoolSP dataPool;
-  std::string poolName("");
-  ret = statLink(mtdPool, stat, poolName);
+  IndexedStatBatch files;
+  std::vector<IndexedStatBatch> dirs;
 
-  if (ret == 0)
+  results->reset(dirPath, entries);
+  files.dir = dirPath;
+
+  for (size_t i = 0; i < entries.size(); i++)
   {
-    if (S_ISLNK(stat->statBuff.st_mode))
+    const std::string &entry = entries[i];
+
+    if (isDirPath(entry))
     {
-      if (poolName.empty())
-      {
-        stat->pool = mtdPool;
-      }
-      else
-      {
-        stat->pool = getMtdPoolFromName(poolName);
-      }
+      dirs.push_back(dirStatBatch(dirPath + entry, i));
     }
     else
     {
-      const PoolList &pools = getDataPools(stat->path);
-      if (poolName != "")
-      {
-        const PoolList &pools = getDataPools(stat->path);
-        PoolList::const_iterator it;
-
-        for (it = pools.begin(); it != pools.end(); it++)
-        {
-          if ((*it)->name == poolName)
-          {
-            dataPool = *it;
-            break;
-          }
-        }
-      }
-      else
-      {
-        dataPool = pools.front();
-      }
-
-      stat->pool = dataPool;
+      files.entries.push_back(entry);
+      files.indexes.push_back(i);
     }
   }
 
-  return ret;
-}
-
-int
-FilesystemPriv::createPrefixDir(PoolSP pool, const std::string &prefix)
-{
-  int ret = 0;
-
-  if (pool->ioctx.stat(prefix, 0, 0) != 0)
-  {
-    Stat stat;
-    stat.path = prefix;
-    stat.translatedPath = generateUuid();
-    stat.pool = pool;
-    stat.statBuff.st_uid = ROOT_UID;
-    stat.statBuff.st_gid = ROOT_UID;
-    stat.statBuff.st_mode = DEFAULT_MODE_DIR;
-    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_ctim);
-    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_mtim);
-
-    ret = createDirAndInode(&stat);
-  }
+  // The files' stat information is kept in their parent's xattrs, so they are
+  // all statted with one read of it per batch
+  statEntryBatches(files, results);
 
-  return ret;
+  // Each directory has to be statted from its own object, so those are
+  // statted in parallel by the workers
+  if (!dirs.empty())
+    parallelStat(dirs, results);
 }
 
-int
-FilesystemPriv::addPool(const std::string &name, const std::string &prefix,
-                        PoolMap *map, boost::mutex &mutex, size_t size)
+void
+FilesystemPriv::statDirEntries(const std::string &dirPath,
+                               const std::vector<std::string> &entries,
+                               StatResults *results)
 {
-  int ret = -ENODEV;
-  const std::string &cleanPrefix = sanitizePath(prefix  + "/");
-
-  if (!initialized)
-    return ret;
-
-  if (prefix == "")
-  {
-    radosfs_debug("The pool's prefix cannot be an empty string");
-    return -EINVAL;
-  }
-
-  if (map->count(cleanPrefix) > 0)
-  {
-    radosfs_debug("There is already a pool with the prefix %s. "
-                  "Not adding.", cleanPrefix.c_str());
-    return -EEXIST;
-  }
+  IndexedStatBatch all;
 
-  librados::IoCtx ioctx;
-
-  ret = radosCluster.ioctx_create(name.c_str(), ioctx);
+  results->reset(dirPath, entries);
+  all.dir = dirPath;
+  all.entries = entries;
 
-  if (ret != 0)
-    return ret;
+  for (size_t i = 0; i < entries.size(); i++)
+    all.indexes.push_back(i);
 
-  Pool *pool = new Pool(name.c_str(), size * MEGABYTE_CONVERSION,
-                        ioctx);
-  PoolSP poolSP(pool);
+  // Unlike parallelStat, this stats the entries in the calling thread, so it
+  // can be used from the worker threads without waiting for other jobs
+  statEntryBatches(all, results);
 
-  if (size == 0)
+  // Directories are not indexed with the files' stat information in their
+  // parent, so they (or anything else not found this way) are statted directly
+  for (size_t i = 0; i < entries.size(); i++)
   {
-    ret = createPrefixDir(poolSP, cleanPrefix);
+    if (results->ret(i) == 0)
+      continue;
 
-    if (ret < 0)
-      return ret;
+    Stat entryStat;
+    int ret = stat(dirPath + entries[i], &entryStat);
+    results->set(i, ret, entryStat);
   }
+}
 
-  boost::unique_lock<boost::mutex> lock(mutex);
+void
+FilesystemPriv::statIndexedBatchInThread(const IndexedStatBatch *batch,
+                                         StatResults *results,
+                                         boost::mutex *mutex,
+                                         boost::condition_variable *cond,
+                                         int *numJobs)
+{
+  statIndexedBatch(*batch, results, mutex);
 
-  std::pair<std::string, PoolSP > entry(cleanPrefix, poolSP);
-  map->insert(entry);
+  mutex->lock();
+  int remaininNumJobs = --*numJobs;
+  mutex->unlock();
 
-  return ret;
+  if (remaininNumJobs == 0)
+    cond->notify_all();
 }
 
-PoolSP
-FilesystemPriv::getDataPool(const std::string &path, const std::string &poolName)
+static void
+gatherPathsByParentDir(const std::vector<std::string> &paths,
+                       std::map<std::string, std::vector<std::string> > &entries)
 {
-  PoolSP pool;
-  size_t maxLength = 0;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
-
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  for (size_t i = 0; i < paths.size(); i++)
   {
-    const std::string &prefix = (*it).first;
-    const size_t prefixLength = prefix.length();
-
-    if (prefixLength < maxLength)
-      continue;
+    const std::string &path = paths[i];
 
-    if (path.compare(0, prefixLength, prefix) == 0)
+    if (path == "/" && entries.count(path) == 0)
     {
-      const PoolList &pools = (*it).second;
-
-      if (poolName != "")
-      {
-        PoolList::const_iterator poolIt;
-        for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
-        {
-          if ((*poolIt)->name == poolName)
-          {
-            pool = *poolIt;
-            maxLength = prefixLength;
-
-            break;
-          }
-        }
-      }
-      else
-      {
-        pool = pools.front();
-        maxLength = prefixLength;
-      }
+      entries[path].clear();
+      continue;
     }
 
-    if (pool.get())
-      break;
+    std::string parentDir = getParentDir(path, 0);
+    entries[parentDir].push_back(path.substr(parentDir.length()));
   }
-
-  return pool;
 }
 
-PoolSP
-FilesystemPriv::getDataPoolFromName(const std::string &poolName)
+static void
+splitIntoBatches(const std::map<std::string, std::vector<std::string> > &paths,
+                 std::vector<StatBatch> &batches)
 {
-  PoolSP pool;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  std::map<std::string, std::vector<std::string> >::const_iterator it;
 
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  for (it = paths.begin(); it != paths.end(); it++)
   {
-    const PoolList &pools = (*it).second;
+    const std::string &dir = (*it).first;
+    const std::vector<std::string> &entries = (*it).second;
 
-    if (poolName != "")
+    if (entries.empty())
     {
-      PoolList::const_iterator poolIt;
-      for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
-      {
-        if ((*poolIt)->name == poolName)
-        {
-          pool = *poolIt;
-          break;
-        }
-      }
+      batches.push_back(StatBatch(dir, entries));
+      continue;
     }
-    else
+
+    // Directories with many entries to stat are split in several batches so
+    // they can be statted by different workers
+    for (size_t i = 0; i < entries.size(); i += STAT_BATCH_MAX_ENTRIES)
     {
-      pool = pools.front();
-      break;
+      const size_t end = std::min(entries.size(), i + STAT_BATCH_MAX_ENTRIES);
+      batches.push_back(StatBatch(dir,
+                                  std::vector<std::string>(entries.begin() + i,
+                                                           entries.begin() +
+                                                           end)));
     }
   }
-
-  return pool;
 }
 
-PoolSP
-FilesystemPriv::getMtdPoolFromName(const std::string &name)
+void
+FilesystemPriv::stat(const std::vector<std::string> &paths,
+                     StatResults *results)
 {
-  PoolSP pool;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  std::map<std::string, IndexedStatBatch> entries;
+  std::vector<IndexedStatBatch> batches;
 
-  PoolMap::const_iterator it;
-  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
+  results->reset(paths);
+
+  for (size_t i = 0; i < paths.size(); i++)
   {
-    PoolSP currentPool = (*it).second;
+    const std::string &path = paths[i];
 
-    if (currentPool->name == name)
+    if (path == "/")
     {
-      pool = currentPool;
-      break;
+      batches.push_back(dirStatBatch(path, i));
+      continue;
     }
+
+    std::string parentDir = getParentDir(path, 0);
+    IndexedStatBatch &batch = entries[parentDir];
+    batch.dir = parentDir;
+    batch.entries.push_back(path.substr(parentDir.length()));
+    batch.indexes.push_back(i);
   }
 
-  return pool;
-}
+  std::map<std::string, IndexedStatBatch>::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++)
+    appendIndexedBatches((*it).second, batches);
 
-PoolSP
-FilesystemPriv::getMetadataPoolFromPath(const std::string &path)
-{
-  return getPool(path, &mtdPoolMap, mtdPoolMutex);
+  entries.clear();
+  parallelStat(batches, results);
+
+  // Stat the paths that were not found again, as directories
+  batches.clear();
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    if (results->ret(i) != 0)
+      batches.push_back(dirStatBatch(paths[i], i));
+  }
+
+  if (!batches.empty())
+    parallelStat(batches, results);
 }
 
-PoolSP
-FilesystemPriv::getPool(const std::string &path,
-                        PoolMap *map,
-                        boost::mutex &mutex)
+void
+FilesystemPriv::parallelStat(const std::vector<IndexedStatBatch> &batches,
+                             StatResults *results)
 {
-  PoolSP pool;
-  size_t maxLength = 0;
-  boost::unique_lock<boost::mutex> lock(mutex);
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  int numJobs = batches.size();
 
-  PoolMap::const_iterator it;
-  for (it = map->begin(); it != map->end(); it++)
+  for (size_t i = 0; i < batches.size(); i++)
   {
-    const std::string &prefix = (*it).first;
-    const size_t prefixLength = prefix.length();
-
-    if (prefixLength < maxLength)
-      continue;
-
-    if (path.compare(0, prefixLength, prefix) == 0)
-    {
-      pool = map->at(prefix);
-      maxLength = prefixLength;
-    }
+    scheduler.post(boost::bind(&FilesystemPriv::statIndexedBatchInThread,
+                               this, &batches[i], results, &mutex, &cond,
+                               &numJobs),
+                   WorkScheduler::PRIORITY_INTERACTIVE);
   }
 
-  return pool;
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  while (numJobs > 0)
+    cond.wait(lock);
 }
 
-std::string
-FilesystemPriv::poolPrefix(const std::string &pool, PoolMap *map,
-                           boost::mutex &mutex) const
+void
+FilesystemPriv::statAsync(const std::vector<std::string> &paths,
+                          StatCallback callback, void *callbackArg)
 {
-  std::string prefix("");
-  boost::unique_lock<boost::mutex> lock(mutex);
+  std::map<std::string, std::vector<std::string> > entries;
+  std::vector<StatBatch> batches;
 
-  PoolMap::iterator it;
-  for (it = map->begin(); it != map->end(); it++)
+  gatherPathsByParentDir(paths, entries);
+  splitIntoBatches(entries, batches);
+
+  for (size_t i = 0; i < batches.size(); i++)
   {
-    if ((*it).second->name == pool)
-    {
-      prefix = (*it).first;
-      break;
-    }
+    StatCallbackBatchSP batch(new StatCallbackBatch);
+    batch->batch = batches[i];
+    batch->callback = callback;
+    batch->callbackArg = callbackArg;
+
+    scheduler.post(boost::bind(&FilesystemPriv::statBatchWithCallback, this,
+                               batch),
+                   WorkScheduler::PRIORITY_INTERACTIVE);
   }
-
-  return prefix;
 }
 
-int
-FilesystemPriv::removePool(const std::string &name, PoolMap *map,
-                           boost::mutex &mutex)
+void
+FilesystemPriv::statBatchWithCallback(StatCallbackBatchSP batch)
 {
-  int ret = -ENOENT;
-  const std::string &prefix = poolPrefix(name, map, mutex);
-  boost::unique_lock<boost::mutex> lock(mutex);
+  const std::string &dir = batch->batch.first;
+  const std::vector<std::string> &entries = batch->batch.second;
+  StatAsyncInfo info;
+  info.entries = &entries;
 
-  if (map->count(prefix) > 0)
+  statDirAndEntries(dir, &info);
+
+  if (entries.empty())
   {
-    map->erase(prefix);
-    ret = 0;
+    batch->callback(dir, info.statRet, info.stat.statBuff, batch->callbackArg);
+    return;
   }
 
-  return ret;
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    const std::string path = dir + entries[i];
+    std::pair<int, Stat> statResult(info.statRet != 0 ? info.statRet : -ENOENT,
+                                    Stat());
+
+    if (i < info.entryStats.size())
+      statResult = info.entryStats[i];
+
+    // As when statting synchronously, the paths that are not found as files
+    // are statted as directories
+    if (statResult.first != 0)
+    {
+      std::vector<std::string> noEntries;
+      StatAsyncInfo dirInfo;
+      dirInfo.entries = &noEntries;
+
+      statDirAndEntries(path, &dirInfo);
+
+      if (dirInfo.statRet == 0)
+        statResult = std::pair<int, Stat>(0, dirInfo.stat);
+    }
+
+    batch->callback(path, statResult.first, statResult.second.statBuff,
+                    batch->callbackArg);
+  }
 }
 
+// Runs the metadata op in a worker thread. If the caller does not keep the
+// op's id (idHeld is false) and gives a callback, the op is only reported
+// through the callback, so it is forgotten once that is called.
 std::string
-FilesystemPriv::poolFromPrefix(const std::string &prefix, PoolMap *map,
-                               boost::mutex &mutex) const
+FilesystemPriv::runMetadataOpAsync(const boost::function<int (void)> &job,
+                                   AsyncOpCallback callback, void *callbackArg,
+                                   bool idHeld)
 {
-  std::string pool("");
-  boost::unique_lock<boost::mutex> lock(mutex);
+  AsyncOpSP op(new AsyncOp(generateUuid()));
+  op->mPriv->setTracer(&tracer);
+  op->setCallback(callback, callbackArg);
 
-  if (map->count(prefix) > 0)
-    pool = map->at(prefix)->name;
+  metadataOps.addOperation(op);
 
-  return pool;
+  // The ids are thread-local so the calling thread's ones are passed on to the
+  // worker that runs the op
+  scheduler.post(boost::bind(&FilesystemPriv::metadataOpInThread, this, job,
+                             op, uid, gid, callback && !idHeld));
+
+  return op->id();
 }
 
-std::vector<std::string>
-FilesystemPriv::pools(PoolMap *map,
-                      boost::mutex &mutex) const
+// Like runMetadataOpAsync but the job gets the op, so it can report its
+// progress through it
+std::string
+FilesystemPriv::runTrackedMetadataOpAsync(
+    const boost::function<int (AsyncOpSP)> &job, AsyncOpCallback callback,
+    void *callbackArg, bool idHeld)
 {
-  boost::unique_lock<boost::mutex> lock(mutex);
-  std::vector<std::string> pools;
+  AsyncOpSP op(new AsyncOp(generateUuid()));
+  op->mPriv->setTracer(&tracer);
+  op->setCallback(callback, callbackArg);
 
-  PoolMap::iterator it;
-  for (it = map->begin(); it != map->end(); it++)
-  {
-    pools.push_back((*it).second->name);
-  }
+  metadataOps.addOperation(op);
 
-  return pools;
+  boost::function<int (void)> opJob = boost::bind(job, op);
+
+  scheduler.post(boost::bind(&FilesystemPriv::metadataOpInThread, this, opJob,
+                             op, uid, gid, callback && !idHeld));
+
+  return op->id();
 }
 
-PoolList
-FilesystemPriv::getDataPools(const std::string &path)
+void
+FilesystemPriv::metadataOpInThread(boost::function<int (void)> job,
+                                   AsyncOpSP op, uid_t opUid, gid_t opGid,
+                                   bool forget)
 {
-  size_t maxLength = 0;
-  std::string prefixFound("");
-  PoolList pools;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  const uid_t workerUid = uid;
+  const gid_t workerGid = gid;
 
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  uid = opUid;
+  gid = opGid;
+
+  Tracer *opTracer = op->mPriv->tracer;
+
+  if (opTracer)
   {
-    const std::string &prefix = (*it).first;
-    const size_t prefixLength = prefix.length();
+    opTracer->addSpan("queued", "metadata", op->id(), op->mPriv->createdTime,
+                      Tracer::Clock::now());
+  }
 
-    if (prefixLength < maxLength)
-      continue;
+  int ret;
 
-    if (path.compare(0, prefixLength, prefix) == 0)
-    {
-      prefixFound = prefix;
-      maxLength = prefixLength;
-    }
+  {
+    TraceSpan span(opTracer, "metadata_op", "metadata", op->id());
+    ret = job();
   }
 
-  if (prefixFound != "")
-    pools = poolMap[prefixFound];
+  uid = workerUid;
+  gid = workerGid;
 
-  return pools;
+  op->mPriv->setFinished(ret);
+
+  // Calls the op's callback right away instead of only when it is synced
+  op->waitForCompletion();
+
+  // Nobody can sync or poll an op whose id was not kept, so it would stay in
+  // metadataOps until a sync of all the ops
+  if (forget)
+    metadataOps.removeOperation(op->id());
 }
 
-PoolList
-FilesystemPriv::getDataPools()
+int
+FilesystemPriv::syncMetadataOps(const std::vector<std::string> &opIds,
+                                bool ignoreMissing)
 {
-  PoolList pools;
-  boost::unique_lock<boost::mutex> lock(poolMutex);
+  int ret = 0;
+  std::vector<std::string> pendingOps(opIds);
 
-  PoolListMap::const_iterator it;
-  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  while (!pendingOps.empty())
   {
-    const PoolList &list = (*it).second;
-    pools.insert(pools.end(), list.begin(), list.end());
+    std::string finishedOpId;
+    int opRet = metadataOps.waitForAny(pendingOps, &finishedOpId);
+
+    if (finishedOpId.empty())
+    {
+      // The remaining ops may have been forgotten (see runMetadataOpAsync)
+      if (ret == 0 && !(ignoreMissing && opRet == -ENOENT))
+        ret = opRet;
+
+      break;
+    }
+
+    if (ret == 0)
+      ret = opRet;
+
+    pendingOps.erase(std::find(pendingOps.begin(), pendingOps.end(),
+                               finishedOpId));
   }
 
-  return pools;
+  return ret;
 }
 
-PoolList
-FilesystemPriv::getMtdPools()
+int
+FilesystemPriv::stat(const std::string &path, Stat *stat)
 {
-  PoolList pools;
-  boost::unique_lock<boost::mutex> lock(mtdPoolMutex);
+  MetricsTimer timer(&metrics, Metrics::OP_STAT);
+  TraceSpan span(&tracer, "stat", "stat", true);
 
-  PoolMap::const_iterator it;
-  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
-  {
-    pools.push_back((*it).second);
-  }
+  if (span.active())
+    span.setDetail(path);
 
-  return pools;
+  if (statCache.get(path, stat))
+    return 0;
+
+  int ret = statUncached(path, stat);
+
+  if (ret == 0)
+    statCache.set(path, *stat);
+
+  return timer.finish(ret);
 }
 
-const std::string
-FilesystemPriv::getParentDir(const std::string &obj, int *pos)
+int
+FilesystemPriv::statUncached(const std::string &path, Stat *stat)
 {
-  size_t length = obj.length();
-  size_t index = obj.rfind(PATH_SEP, length - 2);
+  PoolSP mtdPool;
+  int ret = -ENODEV;
+  stat->reset();
+  stat->path = getDirPath(path);
+  mtdPool = getMetadataPoolFromPath(stat->path);
 
-  if (length - 1 < 1 || index == std::string::npos)
-    return "";
+  if (!mtdPool.get())
+    return -ENODEV;
 
-  index++;
+  if (isDirPath(path))
+  {
+    ret = statDir(mtdPool, stat);
 
-  if (pos)
-    *pos = index;
+    if (ret == 0 || ret == -ENODEV)
+      return ret;
+  }
 
-  return obj.substr(0, index);
+  ret = statFile(mtdPool, stat);
+
+  if (ret == 0 || ret == -ENODEV)
+    return ret;
+
+  ret = statDir(mtdPool, stat);
+
+  return ret;
 }
 
 void
-FilesystemPriv::updateDirCache(std::tr1::shared_ptr<DirCache> &cache)
+FilesystemPriv::invalidateStat(const std::string &path)
 {
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
-  dirCache.update(cache);
+  statCache.remove(getFilePath(path));
+  statCache.remove(getDirPath(path));
 }
 
 void
-FilesystemPriv::removeDirCache(std::tr1::shared_ptr<DirCache> &cache)
+FilesystemPriv::invalidateStatTree(const std::string &dirPath)
 {
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
-  dirCache.removeCache(cache->inode());
+  statCache.remove(getFilePath(dirPath));
+  statCache.removeWithPrefix(getDirPath(dirPath));
 }
 
-std::tr1::shared_ptr<DirCache>
-FilesystemPriv::getDirInfo(const std::string &inode, PoolSP pool,
-                           bool addToCache)
+int
+FilesystemPriv::statDir(PoolSP mtdPool, Stat *stat)
 {
-  std::tr1::shared_ptr<DirCache> cache;
-  boost::unique_lock<boost::mutex> lock(dirCacheMutex);
+  Inode inode;
+  int ret = getDirInode(stat->path, inode, mtdPool);
 
-  if (dirCache.cacheMap.count(inode) == 0)
+  if (ret == 0)
   {
-    if (!pool)
-    {
-      return cache;
-    }
-
-    DirCache *dirInfo = new DirCache(inode, pool);
-    cache = std::tr1::shared_ptr<DirCache>(dirInfo);
+    stat->pool = inode.pool;
+    stat->translatedPath = inode.inode;
 
-    if (addToCache)
-      dirCache.update(cache);
+    ret = statDirObj(*stat);
   }
-  else
-    cache = dirCache.cacheMap[inode]->cachePtr;
-
-  return cache;
-}
-
-FileIOSP
-FilesystemPriv::getFileIO(const std::string &path)
-{
-  FileIOSP io;
-  boost::unique_lock<boost::mutex> lock(operationsMutex);
 
-  if (operations.count(path) != 0)
-    io = operations[path];
-
-  return io;
+  return ret;
 }
 
-FileIOSP
-FilesystemPriv::getOrCreateFileIO(const std::string &path, const Stat *stat)
+int
+FilesystemPriv::statFile(PoolSP mtdPool, Stat *stat)
 {
-  FileIOSP io = getFileIO(path);
+  int ret;
+  PoolSP dataPool;
+  std::string poolName("");
+  ret = statLink(mtdPool, stat, poolName);
 
-  if (!io)
+  if (ret == 0)
   {
-    int chunkSize = 0;
-
-    if (stat->extraData.count(XATTR_FILE_CHUNK_SIZE))
+    if (S_ISLNK(stat->statBuff.st_mode))
     {
-      chunkSize = atol(stat->extraData.at(XATTR_FILE_CHUNK_SIZE).c_str());
+      if (poolName.empty())
+      {
+        stat->pool = mtdPool;
+      }
+      else
+      {
+        stat->pool = getMtdPoolFromName(poolName);
+      }
     }
+    else
+    {
+      const PoolList &pools = getDataPools(stat->path);
+      if (poolName != "")
+      {
+        const PoolList &pools = getDataPools(stat->path);
+        PoolList::const_iterator it;
 
-    if (chunkSize == 0)
-      chunkSize = alignChunkSize(radosFs->fileChunkSize(),
-                                   stat->pool->alignment);
-
-    io = FileIOSP(new FileIO(radosFs, stat->pool, stat->translatedPath,
-                             stat->path, chunkSize));
+        for (it = pools.begin(); it != pools.end(); it++)
+        {
+          if ((*it)->name == poolName)
+          {
+            dataPool = *it;
+            break;
+          }
+        }
+      }
+      else
+      {
+        dataPool = pools.front();
+      }
 
-    setFileIO(io);
+      stat->pool = dataPool;
+    }
   }
 
-  return io;
+  return ret;
 }
 
-void
-FilesystemPriv::setFileIO(FileIOSP sharedFileIO)
+int
+FilesystemPriv::createPrefixDir(PoolSP pool, const std::string &prefix)
 {
-  boost::unique_lock<boost::mutex> lock(operationsMutex);
-  operations[sharedFileIO->inode()] = sharedFileIO;
-}
+  int ret = 0;
 
-void
-FilesystemPriv::removeFileIO(FileIOSP sharedFileIO)
-{
-  boost::unique_lock<boost::mutex> lock(operationsMutex);
+  if (pool->ioctx.stat(prefix, 0, 0) != 0)
+  {
+    Stat stat;
+    stat.path = prefix;
+    stat.translatedPath = generateUuid();
+    stat.pool = pool;
+    stat.statBuff.st_uid = ROOT_UID;
+    stat.statBuff.st_gid = ROOT_UID;
+    stat.statBuff.st_mode = DEFAULT_MODE_DIR;
+    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_ctim);
+    clock_gettime(CLOCK_REALTIME, &stat.statBuff.st_mtim);
+    setDirIndexMode(&stat, dirOmapIndex);
 
-  if (operations.count(sharedFileIO->inode()))
-    operations.erase(sharedFileIO->inode());
+    ret = createDirAndInode(&stat);
+
+    if (ret == 0)
+      removeDirInode(prefix);
+  }
+
+  return ret;
 }
 
-void
-FilesystemPriv::updateTMIdSync(std::string path)
+// Makes sure the prefix dirs of the given metadata pools exist. Their objects
+// are statted in parallel and only the missing ones are created.
+int
+FilesystemPriv::createPrefixDirs(const PoolMap &pools)
 {
-  std::map<std::string, librados::bufferlist> omap;
-  omap[XATTR_TMID].append(generateUuid());
+  int ret = 0;
+  PoolMap missing;
+  std::deque<std::pair<PoolMap::const_iterator, librados::AioCompletion *> >
+      inFlight;
+  PoolMap::const_iterator it = pools.begin();
 
-  librados::bufferlist expectedValue;
-  expectedValue.append(1);
+  while (it != pools.end() || !inFlight.empty())
+  {
+    if (it != pools.end() && inFlight.size() < DIR_BATCH_CREATE_OPS_IN_FLIGHT)
+    {
+      librados::AioCompletion *completion;
+      completion = librados::Rados::aio_create_completion();
+      (*it).second->ioctx.aio_stat((*it).first, completion, 0, 0);
+      inFlight.push_back(std::make_pair(it, completion));
+      it++;
 
-  std::pair<librados::bufferlist, int> cmp(expectedValue,
-                                           LIBRADOS_CMPXATTR_OP_EQ);
+      continue;
+    }
 
-  std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-  omapCmp[XATTR_USE_TMID] = cmp;
+    std::pair<PoolMap::const_iterator, librados::AioCompletion *> op;
+    op = inFlight.front();
+    inFlight.pop_front();
 
-  std::string currentPath = path;
-  while ((currentPath = getParentDir(currentPath, 0)) != "")
-  {
-    Inode inode;
-    int ret = getDirInode(currentPath, inode);
+    op.second->wait_for_complete();
+    int statRet = op.second->get_return_value();
+    op.second->release();
 
-    if (ret != 0)
-    {
-      radosfs_debug("Error getting dir's '%s' inode for setting TM id: "
-                    "%s (retcode=%d)", currentPath.c_str(), strerror(abs(ret)),
-                    ret);
-      return;
-    }
+    if (statRet != 0)
+      missing.insert(*op.first);
+  }
 
-    librados::ObjectWriteOperation op;
-    op.omap_cmp(omapCmp, 0);
-    op.omap_set(omap);
-    ret = inode.pool->ioctx.operate(inode.inode, &op);
+  for (it = missing.begin(); it != missing.end(); it++)
+  {
+    ret = createPrefixDir((*it).second, (*it).first);
 
-    if (ret != 0 && ret != -ECANCELED)
+    if (ret < 0)
     {
-      radosfs_debug("Error setting TM id on %s (%s): %s (retcode=%d)",
-                    currentPath.c_str(), inode.inode.c_str(),
-                    strerror(abs(ret)), ret);
-      return;
+      radosfs_debug("Error creating the prefix dir %s: %s (retcode=%d)",
+                    (*it).first.c_str(), strerror(abs(ret)), ret);
+      break;
     }
   }
-}
 
-void
-FilesystemPriv::updateTMId(Stat *stat)
-{
-  getIoService()->post(boost::bind(&FilesystemPriv::updateTMIdSync, this,
-                                   stat->path));
+  return ret;
 }
 
-void
-FilesystemPriv::checkFileLocks(void)
+// Opens the pool with the given name reusing the IoCtx if it was opened
+// already (the same pool is usually set for several prefixes)
+int
+FilesystemPriv::openLayoutPool(const std::string &name,
+                               std::map<std::string, librados::IoCtx> &ioctxs,
+                               librados::IoCtx &ioctx)
 {
-  const boost::chrono::milliseconds sleepTime(FILE_OPS_IDLE_CHECKER_SLEEP);
-  std::map<std::string, std::tr1::shared_ptr<FileIO> >::iterator it, oldIt;
+  std::map<std::string, librados::IoCtx>::iterator it = ioctxs.find(name);
 
-  while (true)
+  if (it != ioctxs.end())
   {
-    boost::unique_lock<boost::mutex> lock(operationsMutex);
-    it = operations.begin();
-    while (it != operations.end())
-    {
-      boost::this_thread::interruption_point();
-      FileIOSP io = (*it).second;
-      if (io)
-      {
-        if (!io->hasRunningAsyncOps() && FileIO::hasSingleClient(io))
-        {
-          oldIt = it;
-          it++;
-          operations.erase(oldIt);
-          continue;
-        }
-        else
-          io->manageIdleLock(FILE_IDLE_LOCK_TIMEOUT);
-      }
-
-      it++;
-    }
-    lock.unlock();
-    boost::this_thread::sleep_for(sleepTime);
+    ioctx = (*it).second;
+    return 0;
   }
-}
-
-/**
- * @class Filesystem
- *
- * Represents the filesystem. Instantiating a Filesystem object is usually the
- * first step when using the library since it corresponds to a Ceph cluster.
- *
- * Before using any of the methods in the class, Filesystem::init should be
- * called in order to set the appropriate Ceph cluster. After the cluster is
- * initialized, at least one metadata and one data pool should be set using
- * Filesystem::addMetadataPool and Filesystem::addDataPool, respectively.
- */
-
-/**
- * @struct FileReadData
- *
- * A struct describing how to read data from a file.
- *
- * @fn FileReadData::FileReadData(char *buff, off_t offset, size_t length,
- *                                ssize_t *retValue=0)
- * Builds an instance of FileReadData.
- *
- * @param[out] buff a pointer to a buffer where the data will be stored.
- * @param offset the offset in the file from which the data will start being
- *        read.
- * @param length the number of bytes to read. The given \a buff should be large
- *        enough to hold this number of bytes.
- * @param[out] retValue the location in which to return the return code of the
- *             read operation (or a null pointer in case this value should not
- *             be returned).
- */
-
-/**
- * Creates a new instance of Filesystem.
- *
- * This is usually the first step to be done when using the library but keep in
- * mind that Filesystem::init should be called in order to do anything
- * meaningful (as otherwise no Ceph cluster will be configured).
- */
-Filesystem::Filesystem()
-  : mPriv(new FilesystemPriv(this))
-{
-}
 
-Filesystem::~Filesystem()
-{
-  delete mPriv;
-}
+  int ret = radosCluster.ioctx_create(name.c_str(), ioctx);
 
-/**
- * Initialize the Ceph cluster.
- * @param userName the user name for for initializing the cluster.
- * @param configurationFile the path to the configuration file describing the
- *        cluster.
- * @return 0 if the cluster has been successfully initialized, an error
- *         code otherwise.
- */
-int
-Filesystem::init(const std::string &userName,
-                 const std::string &configurationFile)
-{
-  int ret = mPriv->createCluster(userName, configurationFile);
+  if (ret == 0)
+    ioctxs[name] = ioctx;
 
   return ret;
 }
 
-/**
- * Sets a pool to be used for the data associated with the given \a prefix.
- * File objects whose path prefixes match the one set by this method will have
- * their data stored in the mapped pool.
- *
- * @note Keep in mind this method does not create the pool in the cluster so it
- *       needs to already exist beforehand.
- * @param name the name of the pool in the cluster.
- * @param prefix the prefix of the paths that is associated with this pool.
- * @param size the greatest size allowed for a file (given in MB).
- * @return 0 on success, an error code otherwise.
- */
 int
-Filesystem::addDataPool(const std::string &name, const std::string &prefix,
-                        size_t size)
+FilesystemPriv::addPool(const std::string &name, const std::string &prefix,
+                        PoolMap *map, boost::mutex &mutex,
+                        PoolTrieHolder *trie, size_t size)
 {
-  librados::IoCtx ioctx;
-  Pool *pool;
-  PoolList *pools = 0;
-  PoolListMap *map;
-  int ret = -EPERM;
+  int ret = -ENODEV;
   const std::string &cleanPrefix = sanitizePath(prefix  + "/");
 
-  if (!mPriv->initialized)
+  if (!initialized)
     return ret;
 
   if (prefix == "")
@@ -1523,625 +1332,3370 @@ Filesystem::addDataPool(const std::string &name, const std::string &prefix,
     return -EINVAL;
   }
 
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
-
-  map = &mPriv->poolMap;
-
   if (map->count(cleanPrefix) > 0)
   {
-    pools = &map->at(cleanPrefix);
-
-    PoolList::const_iterator it;
-
-    for (it = pools->begin(); it != pools->end(); it++)
-    {
-      if ((*it)->name == name)
-      {
-        radosfs_debug("The pool %s is already associated with the prefix %s. "
-                      "Not adding.", name.c_str(), cleanPrefix.c_str());
-        return -EEXIST;
-      }
-    }
+    radosfs_debug("There is already a pool with the prefix %s. "
+                  "Not adding.", cleanPrefix.c_str());
+    return -EEXIST;
   }
 
-  ret = mPriv->radosCluster.ioctx_create(name.c_str(), ioctx);
+  librados::IoCtx ioctx;
+
+  ret = radosCluster.ioctx_create(name.c_str(), ioctx);
 
   if (ret != 0)
     return ret;
 
-  pool = new Pool(name.c_str(), size * MEGABYTE_CONVERSION, ioctx);
-  pool->setAlignment(ioctx.pool_required_alignment());
+  Pool *pool = new Pool(name.c_str(), size * MEGABYTE_CONVERSION,
+                        ioctx);
+  pool->notifyDirChanges = dirCacheWatch;
+  PoolSP poolSP(pool);
 
-  if (pools == 0)
+  if (size == 0)
   {
-    PoolList poolList;
-    std::pair<std::string, PoolList> entry(cleanPrefix, poolList);
-    map->insert(entry);
-    pools = &map->at(cleanPrefix);
+    ret = createPrefixDir(poolSP, cleanPrefix);
+
+    if (ret < 0)
+      return ret;
   }
 
-  pools->push_back(PoolSP(pool));
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  std::pair<std::string, PoolSP > entry(cleanPrefix, poolSP);
+  map->insert(entry);
+  trie->publish(*map);
 
   return ret;
 }
 
-/**
- * Removes a data pool. @note As with Filesystem::addDataPool , this method does
- * not affect the cluster itself which means that the pool will not be deleted
- * from it but rather disassociated from the prefix to which it was previously
- * set.
- * @param name the name
- * @return 0 on success, an error code otherwise.
- */
-int
-Filesystem::removeDataPool(const std::string &name)
+PoolSP
+FilesystemPriv::getDataPool(const std::string &path, const std::string &poolName)
 {
-  int ret = -ENOENT;
-  PoolListMap *map = &mPriv->poolMap;
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  const PoolTrie *trie = dataPoolTrie.get();
 
-  PoolListMap::iterator it;
+  if (poolName != "")
+    return trie->find(path, poolName);
 
-  for (it = map->begin(); it != map->end(); it++)
+  PoolSP pool;
+  const PoolList *pools = trie->find(path);
+
+  if (pools)
+    pool = pools->front();
+
+  return pool;
+}
+
+PoolSP
+FilesystemPriv::getDataPoolFromName(const std::string &poolName)
+{
+  PoolSP pool;
+  boost::unique_lock<boost::mutex> lock(poolMutex);
+
+  PoolListMap::const_iterator it;
+  for (it = poolMap.begin(); it != poolMap.end(); it++)
   {
-    PoolList &pools = (*it).second;
-    PoolList::iterator poolsIt;
+    const PoolList &pools = (*it).second;
 
-    for (poolsIt = pools.begin(); poolsIt != pools.end(); poolsIt++)
+    if (poolName != "")
     {
-      if ((*poolsIt)->name == name)
+      PoolList::const_iterator poolIt;
+      for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
       {
-        pools.erase(poolsIt);
-        ret = 0;
-
-        if (pools.empty())
+        if ((*poolIt)->name == poolName)
         {
-          map->erase((*it).first);
+          pool = *poolIt;
+          break;
         }
-
-        break;
       }
     }
-
-    if (ret == 0)
+    else
+    {
+      pool = pools.front();
       break;
+    }
   }
 
-  return ret;
+  return pool;
 }
 
-/**
- * Gets all the data pools configured for the given \a prefix.
- * @param prefix the prefix for which the data pools are mapped.
- * @return A vector with the names of the pools in question.
- */
-std::vector<std::string>
-Filesystem::dataPools(const std::string &prefix) const
+PoolSP
+FilesystemPriv::getMtdPoolFromName(const std::string &name)
 {
-  std::vector<std::string> pools;
-  const std::string &dirPrefix = getDirPath(prefix);
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  PoolSP pool;
+  boost::unique_lock<boost::mutex> lock(poolMutex);
 
-  if (mPriv->poolMap.count(dirPrefix) > 0)
+  PoolMap::const_iterator it;
+  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
   {
-    const PoolList &poolList = mPriv->poolMap[dirPrefix];
-    PoolList::const_iterator it;
+    PoolSP currentPool = (*it).second;
 
-    for (it = poolList.begin(); it != poolList.end(); it++)
+    if (currentPool->name == name)
     {
-      pools.push_back((*it)->name);
+      pool = currentPool;
+      break;
     }
   }
 
-  return pools;
+  return pool;
+}
+
+PoolSP
+FilesystemPriv::getMetadataPoolFromPath(const std::string &path)
+{
+  return getPool(path, mtdPoolTrie);
+}
+
+PoolSP
+FilesystemPriv::getPool(const std::string &path, const PoolTrieHolder &trie)
+{
+  PoolSP pool;
+  const PoolList *pools = trie.get()->find(path);
+
+  if (pools)
+    pool = pools->front();
+
+  return pool;
 }
 
-/**
- * Gets the prefix associated with the given data pool.
- * @param pool a data pool's name associated with a prefix.
- * @return The prefix associated with the given data pool.
- */
 std::string
-Filesystem::dataPoolPrefix(const std::string &pool) const
+FilesystemPriv::poolPrefix(const std::string &pool, PoolMap *map,
+                           boost::mutex &mutex) const
 {
   std::string prefix("");
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+  boost::unique_lock<boost::mutex> lock(mutex);
 
-  PoolListMap::const_iterator it;
-  for (it = mPriv->poolMap.begin(); it != mPriv->poolMap.end(); it++)
+  PoolMap::iterator it;
+  for (it = map->begin(); it != map->end(); it++)
   {
-    const PoolList &pools = (*it).second;
-    PoolList::const_iterator poolIt;
-
-    for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
+    if ((*it).second->name == pool)
     {
-      if ((*poolIt)->name == pool)
+      prefix = (*it).first;
+      break;
+    }
+  }
+
+  return prefix;
+}
+
+int
+FilesystemPriv::removePool(const std::string &name, PoolMap *map,
+                           boost::mutex &mutex, PoolTrieHolder *trie)
+{
+  int ret = -ENOENT;
+  const std::string &prefix = poolPrefix(name, map, mutex);
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (map->count(prefix) > 0)
+  {
+    map->erase(prefix);
+    trie->publish(*map);
+    ret = 0;
+  }
+
+  return ret;
+}
+
+std::string
+FilesystemPriv::poolFromPrefix(const std::string &prefix, PoolMap *map,
+                               boost::mutex &mutex) const
+{
+  std::string pool("");
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (map->count(prefix) > 0)
+    pool = map->at(prefix)->name;
+
+  return pool;
+}
+
+std::vector<std::string>
+FilesystemPriv::pools(PoolMap *map,
+                      boost::mutex &mutex) const
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  std::vector<std::string> pools;
+
+  PoolMap::iterator it;
+  for (it = map->begin(); it != map->end(); it++)
+  {
+    pools.push_back((*it).second->name);
+  }
+
+  return pools;
+}
+
+PoolList
+FilesystemPriv::getDataPools(const std::string &path)
+{
+  PoolList pools;
+  const PoolList *prefixPools = dataPoolTrie.get()->find(path);
+
+  if (prefixPools)
+    pools = *prefixPools;
+
+  return pools;
+}
+
+PoolList
+FilesystemPriv::getDataPools()
+{
+  PoolList pools;
+  boost::unique_lock<boost::mutex> lock(poolMutex);
+
+  PoolListMap::const_iterator it;
+  for (it = poolMap.begin(); it != poolMap.end(); it++)
+  {
+    const PoolList &list = (*it).second;
+    pools.insert(pools.end(), list.begin(), list.end());
+  }
+
+  return pools;
+}
+
+PoolList
+FilesystemPriv::getMtdPools()
+{
+  PoolList pools;
+  boost::unique_lock<boost::mutex> lock(mtdPoolMutex);
+
+  PoolMap::const_iterator it;
+  for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
+  {
+    pools.push_back((*it).second);
+  }
+
+  return pools;
+}
+
+// Gets the pools to stripe the chunks of a new file in the given pool over:
+// the pool itself followed by the next ones configured for the path's prefix,
+// up to the stripe width. Only pools with the same alignment as the file's
+// pool are used, since the chunks are all written in the same way. An empty
+// list means the file is not striped.
+PoolList
+FilesystemPriv::getStripePools(const std::string &path, const PoolSP &pool)
+{
+  PoolList stripePools;
+
+  if (fileStripeWidth < 2 || !pool)
+    return stripePools;
+
+  const PoolList pools = getDataPools(path);
+  size_t first;
+
+  for (first = 0; first < pools.size(); first++)
+  {
+    if (pools[first].get() == pool.get())
+      break;
+  }
+
+  if (first == pools.size())
+    return stripePools;
+
+  for (size_t i = 0; i < pools.size(); i++)
+  {
+    const PoolSP &stripePool = pools[(first + i) % pools.size()];
+
+    if (stripePool->alignment != pool->alignment)
+    {
+      radosfs_debug("Not striping over pool %s since its alignment differs "
+                    "from the one of %s", stripePool->name.c_str(),
+                    pool->name.c_str());
+      continue;
+    }
+
+    stripePools.push_back(stripePool);
+
+    if (stripePools.size() == fileStripeWidth)
+      break;
+  }
+
+  if (stripePools.size() < 2)
+    stripePools.clear();
+
+  return stripePools;
+}
+
+// Gets the pools from the names recorded in a file's stripe layout. Pools that
+// are no longer configured are still opened so the chunks in them can be
+// reached; if one of them cannot be opened, the layout cannot be used at all
+// (the chunks would be looked for in the wrong pools), so an error is returned.
+int
+FilesystemPriv::getStripePoolsFromNames(const std::string &names,
+                                        const PoolSP &pool,
+                                        PoolList &stripePools)
+{
+  size_t start = 0;
+
+  stripePools.clear();
+
+  while (start < names.length())
+  {
+    size_t end = names.find(FILE_STRIPE_POOLS_SEP, start);
+
+    if (end == std::string::npos)
+      end = names.length();
+
+    const std::string name = names.substr(start, end - start);
+    PoolSP stripePool;
+
+    if (name == pool->name)
+      stripePool = pool;
+    else
+      stripePool = getDataPoolFromName(name);
+
+    if (!stripePool)
+    {
+      librados::IoCtx ioctx;
+      int ret = radosCluster.ioctx_create(name.c_str(), ioctx);
+
+      if (ret != 0)
       {
-        prefix = (*it).first;
-        break;
+        radosfs_debug("Cannot open the stripe pool %s: %s", name.c_str(),
+                      strerror(-ret));
+        stripePools.clear();
+        return ret;
       }
+
+      stripePool = PoolSP(new Pool(name, pool->size, ioctx));
+      stripePool->setAlignment(ioctx.pool_required_alignment());
     }
 
-    if (prefix != "")
-      break;
+    stripePools.push_back(stripePool);
+    start = end + 1;
   }
 
-  return prefix;
+  return 0;
+}
+
+std::string
+FilesystemPriv::stripePoolNames(const PoolList &pools)
+{
+  std::string names;
+
+  for (size_t i = 0; i < pools.size(); i++)
+  {
+    if (i > 0)
+      names += FILE_STRIPE_POOLS_SEP;
+
+    names += pools[i]->name;
+  }
+
+  return names;
+}
+
+// Picks the chunk size of a new file in the given path and pool. Unless
+// chunkSize is given, the file gets about FILE_ADAPTIVE_CHUNKS_PER_FILE chunks
+// for the size it is expected to have (sizeHint), within the limits of the
+// longest prefix's policy or, if there is none, between
+// FILE_MIN_ADAPTIVE_CHUNK_SIZE and the default chunk size. Without the hint,
+// the default chunk size is used (within the policy's limits).
+size_t
+FilesystemPriv::chooseChunkSize(const std::string &path, const PoolSP &pool,
+                                size_t chunkSize, size_t sizeHint)
+{
+  if (chunkSize == 0)
+  {
+    size_t maxChunkSize = fileChunkSize;
+    size_t minChunkSize = std::min((size_t) FILE_MIN_ADAPTIVE_CHUNK_SIZE,
+                                   maxChunkSize);
+    size_t prefixLength = 0;
+
+    {
+      boost::unique_lock<boost::mutex> lock(chunkSizePoliciesMutex);
+
+      std::map<std::string, ChunkSizePolicy>::const_iterator it;
+      for (it = chunkSizePolicies.begin(); it != chunkSizePolicies.end(); it++)
+      {
+        const std::string &prefix = (*it).first;
+
+        if (prefix.length() >= prefixLength &&
+            path.compare(0, prefix.length(), prefix) == 0)
+        {
+          minChunkSize = (*it).second.minChunkSize;
+          maxChunkSize = (*it).second.maxChunkSize;
+          prefixLength = prefix.length();
+        }
+      }
+    }
+
+    chunkSize = fileChunkSize;
+
+    if (sizeHint > 0)
+    {
+      const size_t wanted = (sizeHint + FILE_ADAPTIVE_CHUNKS_PER_FILE - 1) /
+                            FILE_ADAPTIVE_CHUNKS_PER_FILE;
+
+      // Powers of two keep the chunks' boundaries aligned with the usual
+      // sizes of the reads and writes
+      chunkSize = 1;
+      while (chunkSize < wanted)
+        chunkSize <<= 1;
+    }
+
+    chunkSize = std::max(minChunkSize, std::min(chunkSize, maxChunkSize));
+  }
+
+  return alignChunkSize(chunkSize, pool ? pool->alignment : 0);
+}
+
+bool
+FilesystemPriv::shouldCompress(const std::string &path)
+{
+  boost::unique_lock<boost::mutex> lock(compressionPrefixesMutex);
+  bool compress = false;
+  size_t prefixLength = 0;
+
+  std::map<std::string, bool>::const_iterator it;
+  for (it = compressionPrefixes.begin(); it != compressionPrefixes.end(); it++)
+  {
+    const std::string &prefix = (*it).first;
+
+    if (prefix.length() >= prefixLength &&
+        path.compare(0, prefix.length(), prefix) == 0)
+    {
+      compress = (*it).second;
+      prefixLength = prefix.length();
+    }
+  }
+
+  return compress;
+}
+
+const std::string
+FilesystemPriv::getParentDir(const std::string &obj, int *pos)
+{
+  size_t length = obj.length();
+  size_t index = obj.rfind(PATH_SEP, length - 2);
+
+  if (length - 1 < 1 || index == std::string::npos)
+    return "";
+
+  index++;
+
+  if (pos)
+    *pos = index;
+
+  return obj.substr(0, index);
+}
+
+void
+FilesystemPriv::updateDirCache(std::tr1::shared_ptr<DirCache> &cache)
+{
+  dirCache.update(cache);
+}
+
+void
+FilesystemPriv::removeDirCache(std::tr1::shared_ptr<DirCache> &cache)
+{
+  dirCache.remove(cache->inode());
+}
+
+std::tr1::shared_ptr<DirCache>
+FilesystemPriv::getDirInfo(const std::string &inode, PoolSP pool,
+                           bool addToCache, bool omapIndex)
+{
+  std::tr1::shared_ptr<DirCache> cache = dirCache.get(inode);
+
+  metrics.add(cache ? Metrics::COUNTER_DIR_CACHE_HITS :
+                      Metrics::COUNTER_DIR_CACHE_MISSES);
+
+  if (!cache && pool)
+  {
+    DirCache *dirInfo = new DirCache(inode, pool, omapIndex);
+    dirInfo->setMetrics(&metrics);
+    cache = std::tr1::shared_ptr<DirCache>(dirInfo);
+
+    // If another thread cached the same dir meanwhile, use that one instead
+    if (addToCache)
+      cache = dirCache.add(cache);
+  }
+
+  if (cache && addToCache && dirCacheWatch && !cache->watching())
+    cache->watch(&radosCluster);
+
+  return cache;
+}
+
+void
+FilesystemPriv::setDirCacheWatch(bool watch)
+{
+  dirCacheWatch = watch;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mtdPoolMutex);
+
+    PoolMap::iterator it;
+    for (it = mtdPoolMap.begin(); it != mtdPoolMap.end(); it++)
+      (*it).second->notifyDirChanges = watch;
+  }
+
+  if (watch)
+    return;
+
+  std::vector<std::tr1::shared_ptr<DirCache> > caches;
+  dirCache.getAll(caches);
+
+  for (size_t i = 0; i < caches.size(); i++)
+    caches[i]->unwatch();
+}
+
+FileIOSP
+FilesystemPriv::getFileIO(const std::string &path)
+{
+  FileIOSP io;
+  boost::unique_lock<boost::mutex> lock(operationsMutex);
+
+  if (operations.count(path) != 0)
+    io = operations[path];
+
+  return io;
+}
+
+FileIOSP
+FilesystemPriv::getOrCreateFileIO(const std::string &path, const Stat *stat)
+{
+  FileIOSP io = getFileIO(path);
+
+  if (!io)
+  {
+    int chunkSize = 0;
+
+    if (stat->extraData.count(XATTR_FILE_CHUNK_SIZE))
+    {
+      chunkSize = atol(stat->extraData.at(XATTR_FILE_CHUNK_SIZE).c_str());
+    }
+
+    if (chunkSize == 0)
+      chunkSize = alignChunkSize(radosFs->fileChunkSize(),
+                                   stat->pool->alignment);
+
+    io = FileIOSP(new FileIO(radosFs, stat->pool, stat->translatedPath,
+                             stat->path, chunkSize));
+
+    int ret = setFileIOLayout(io.get(), stat);
+
+    if (ret != 0)
+    {
+      radosfs_debug("Cannot get the layout of %s: %s", stat->path.c_str(),
+                    strerror(-ret));
+      return FileIOSP();
+    }
+
+    setFileIO(io);
+  }
+
+  return io;
+}
+
+// Sets up the given FileIO with the layout recorded in its file's entry
+int
+FilesystemPriv::setFileIOLayout(FileIO *io, const Stat *stat)
+{
+  std::map<std::string, std::string>::const_iterator it;
+  it = stat->extraData.find(XATTR_FILE_STRIPE_POOLS);
+
+  if (it != stat->extraData.end())
+  {
+    PoolList stripePools;
+    int ret = getStripePoolsFromNames((*it).second, stat->pool, stripePools);
+
+    if (ret != 0)
+      return ret;
+
+    io->setStripePools(stripePools);
+  }
+
+  io->setCompression(stat->extraData.count(XATTR_FILE_COMPRESSION) > 0);
+  io->setTrackAllocatedChunks(
+        stat->extraData.count(XATTR_FILE_ALLOCATED_CHUNKS) > 0);
+
+  return 0;
+}
+
+void
+FilesystemPriv::setFileIO(FileIOSP sharedFileIO)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(operationsMutex);
+    operations[sharedFileIO->inode()] = sharedFileIO;
+  }
+
+  scheduleFileIOCheck(sharedFileIO->inode(),
+                      FILE_OPS_IDLE_CHECKER_SLEEP / 1000.0);
+}
+
+void
+FilesystemPriv::removeFileIO(FileIOSP sharedFileIO)
+{
+  boost::unique_lock<boost::mutex> lock(operationsMutex);
+
+  if (operations.count(sharedFileIO->inode()))
+    operations.erase(sharedFileIO->inode());
+
+  fileIOChecks.remove(sharedFileIO->inode());
+}
+
+void
+FilesystemPriv::scheduleFileIOCheck(const std::string &inode, double seconds)
+{
+  fileIOChecks.scheduleIn(inode, seconds);
+}
+
+// Marks the TM id of all the ancestors of the given path as needing to be
+// changed. The ancestors are shared by many updates (e.g. the writes of files
+// in the same dir), so they are collected for a short window and each of them
+// is only set once per window.
+void
+FilesystemPriv::updateTMId(Stat *stat)
+{
+  boost::unique_lock<boost::mutex> lock(tmIdMutex);
+
+  std::string currentPath = stat->path;
+  while ((currentPath = getParentDir(currentPath, 0)) != "")
+  {
+    if (!pendingTMIds.insert(currentPath).second)
+      break;
+  }
+
+  if (tmIdFlushScheduled)
+    return;
+
+  tmIdFlushScheduled = true;
+  scheduler.postDelayed(boost::bind(&FilesystemPriv::flushScheduledTMIds,
+                                    this),
+                        DIR_TMID_UPDATE_WINDOW * 1000,
+                        WorkScheduler::PRIORITY_BACKGROUND);
+}
+
+void
+FilesystemPriv::flushScheduledTMIds(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(tmIdMutex);
+    tmIdFlushScheduled = false;
+  }
+
+  flushTMIds();
+}
+
+// Sets a new TM id in all the dirs whose TM id is pending, with pipelined
+// asynchronous operations. All the dirs in the same flush get the same id, so
+// ancestors keep matching their descendants like they did when each update
+// was set on its own.
+void
+FilesystemPriv::flushTMIds(void)
+{
+  boost::unique_lock<boost::mutex> flushLock(tmIdFlushMutex);
+  std::set<std::string> paths;
+
+  {
+    boost::unique_lock<boost::mutex> lock(tmIdMutex);
+    paths.swap(pendingTMIds);
+  }
+
+  if (paths.empty())
+    return;
+
+  std::map<std::string, librados::bufferlist> omap;
+  omap[XATTR_TMID].append(generateUuid());
+
+  librados::bufferlist expectedValue;
+  expectedValue.append(1);
+
+  std::pair<librados::bufferlist, int> cmp(expectedValue,
+                                           LIBRADOS_CMPXATTR_OP_EQ);
+
+  std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
+  omapCmp[XATTR_USE_TMID] = cmp;
+
+  std::deque<std::pair<std::string, librados::AioCompletion *> > inFlight;
+  std::set<std::string>::const_iterator it = paths.begin();
+
+  while (it != paths.end() || !inFlight.empty())
+  {
+    if (it != paths.end() && inFlight.size() < DIR_BATCH_CREATE_OPS_IN_FLIGHT)
+    {
+      const std::string &path = *it++;
+      Inode inode;
+      int ret = getDirInode(path, inode);
+
+      if (ret != 0)
+      {
+        radosfs_debug("Error getting dir's '%s' inode for setting TM id: "
+                      "%s (retcode=%d)", path.c_str(), strerror(abs(ret)),
+                      ret);
+        continue;
+      }
+
+      librados::ObjectWriteOperation op;
+      op.omap_cmp(omapCmp, 0);
+      op.omap_set(omap);
+
+      librados::AioCompletion *completion;
+      completion = librados::Rados::aio_create_completion();
+      inode.pool->ioctx.aio_operate(inode.inode, completion, &op);
+      inFlight.push_back(std::make_pair(path, completion));
+
+      continue;
+    }
+
+    std::pair<std::string, librados::AioCompletion *> op = inFlight.front();
+    inFlight.pop_front();
+
+    op.second->wait_for_complete();
+    int ret = op.second->get_return_value();
+    op.second->release();
+
+    if (ret != 0 && ret != -ECANCELED && ret != -ENOENT)
+    {
+      radosfs_debug("Error setting TM id on %s: %s (retcode=%d)",
+                    op.first.c_str(), strerror(abs(ret)), ret);
+    }
+  }
+}
+
+// Queues setting the back link of a file inode. It is set only if the inode's
+// current back link matches the compare one (or if it has none, when no
+// compare one is given). The queued back links are written in batches in the
+// background, unless a size operation on the inode takes them first (see
+// takeBacklink).
+void
+FilesystemPriv::queueBacklink(PoolSP pool, const std::string &inode,
+                              const std::string &backLink,
+                              const std::string *compare)
+{
+  boost::unique_lock<boost::mutex> lock(backlinksMutex);
+
+  std::map<std::string, PendingBacklink>::iterator it;
+  it = pendingBacklinks.find(inode);
+
+  // A back link that follows the one already queued (e.g. the file being
+  // renamed twice) replaces it but keeps the original comparison, as that is
+  // what is still set in the inode
+  if (it != pendingBacklinks.end() &&
+      ((compare && *compare == it->second.backLink) ||
+       backLink == it->second.backLink))
+  {
+    it->second.backLink = backLink;
+  }
+  else
+  {
+    PendingBacklink &pending = pendingBacklinks[inode];
+    pending.pool = pool;
+    pending.backLink = backLink;
+    pending.compare = compare ? *compare : "";
+  }
+
+  // Until the posted flush runs, the back links queued meanwhile are taken
+  // by it, so a single one is needed
+  if (pendingBacklinks.size() >= FILE_BACKLINK_MAX_PENDING)
+  {
+    if (backlinkFlushPosted)
+      return;
+
+    backlinkFlushPosted = true;
+    scheduler.post(boost::bind(&FilesystemPriv::flushPostedBacklinks, this),
+                   WorkScheduler::PRIORITY_BACKGROUND);
+    return;
+  }
+
+  if (backlinkFlushScheduled)
+    return;
+
+  backlinkFlushScheduled = true;
+  scheduler.postDelayed(boost::bind(&FilesystemPriv::flushScheduledBacklinks,
+                                    this),
+                        FILE_BACKLINK_UPDATE_WINDOW * 1000,
+                        WorkScheduler::PRIORITY_BACKGROUND);
+}
+
+// Removes the queued back link of the given inode, for when it is being set
+// together with another operation on the inode. Returns whether there was one.
+bool
+FilesystemPriv::takeBacklink(const std::string &inode,
+                             PendingBacklink *backLink)
+{
+  boost::unique_lock<boost::mutex> lock(backlinksMutex);
+
+  std::map<std::string, PendingBacklink>::iterator it;
+  it = pendingBacklinks.find(inode);
+
+  if (it == pendingBacklinks.end())
+    return false;
+
+  if (backLink)
+    *backLink = it->second;
+
+  pendingBacklinks.erase(it);
+
+  return true;
+}
+
+void
+FilesystemPriv::flushScheduledBacklinks(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(backlinksMutex);
+    backlinkFlushScheduled = false;
+  }
+
+  flushBacklinks();
+}
+
+void
+FilesystemPriv::flushPostedBacklinks(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(backlinksMutex);
+    backlinkFlushPosted = false;
+  }
+
+  flushBacklinks();
+}
+
+// Writes all the queued back links with pipelined asynchronous operations.
+// A back link that fails to be set is left for radosfsck to repair.
+void
+FilesystemPriv::flushBacklinks(void)
+{
+  boost::unique_lock<boost::mutex> flushLock(backlinksFlushMutex);
+  std::map<std::string, PendingBacklink> backLinks;
+
+  {
+    boost::unique_lock<boost::mutex> lock(backlinksMutex);
+    backLinks.swap(pendingBacklinks);
+  }
+
+  std::deque<std::pair<std::map<std::string, PendingBacklink>::const_iterator,
+                       librados::AioCompletion *> > inFlight;
+  std::map<std::string, PendingBacklink>::const_iterator it;
+  it = backLinks.begin();
+
+  while (it != backLinks.end() || !inFlight.empty())
+  {
+    if (it != backLinks.end() &&
+        inFlight.size() < DIR_BATCH_CREATE_OPS_IN_FLIGHT)
+    {
+      librados::bufferlist backLinkBl, compareBl;
+      backLinkBl.append(it->second.backLink);
+      compareBl.append(it->second.compare);
+
+      librados::ObjectWriteOperation op;
+      op.setxattr(XATTR_INODE_HARD_LINK, backLinkBl);
+      op.cmpxattr(XATTR_INODE_HARD_LINK, LIBRADOS_CMPXATTR_OP_EQ, compareBl);
+
+      librados::AioCompletion *completion;
+      completion = librados::Rados::aio_create_completion();
+      it->second.pool->ioctx.aio_operate(it->first, completion, &op);
+      inFlight.push_back(std::make_pair(it, completion));
+
+      it++;
+      continue;
+    }
+
+    std::pair<std::map<std::string, PendingBacklink>::const_iterator,
+              librados::AioCompletion *> op = inFlight.front();
+    inFlight.pop_front();
+
+    op.second->wait_for_complete();
+    int ret = op.second->get_return_value();
+    op.second->release();
+
+    const std::string &inode = op.first->first;
+
+    // We only assume the back link is set if it succeeded to do so or if it
+    // didn't because it had already been set (operation canceled)
+    if (ret == 0 || ret == -ECANCELED)
+    {
+      FileIOSP io = getFileIO(inode);
+
+      if (io)
+        io->backLinkWritten(op.first->second.backLink);
+    }
+    else
+    {
+      radosfs_debug("Error setting the back link '%s' on %s: %s (retcode=%d)",
+                    op.first->second.backLink.c_str(), inode.c_str(),
+                    strerror(abs(ret)), ret);
+    }
+  }
+}
+
+void
+FilesystemPriv::checkFileIO(const std::string &inode)
+{
+  FileIOSP io = getFileIO(inode);
+
+  if (!io)
+    return;
+
+  io->manageWriteBehind(FILE_WRITE_BEHIND_IDLE_TIMEOUT);
+  io->managePendingSize(FILE_SIZE_UPDATE_INTERVAL);
+  io->manageIdleLock(FILE_IDLE_LOCK_TIMEOUT);
+
+  if (io->needsIdleManagement())
+  {
+    scheduleFileIOCheck(inode, FILE_OPS_IDLE_CHECKER_SLEEP / 1000.0);
+    return;
+  }
+
+  // An idle FileIO is only checked again when it is used or released, so if
+  // nobody else holds it now, it is no longer needed
+  boost::unique_lock<boost::mutex> lock(operationsMutex);
+  std::map<std::string, std::tr1::shared_ptr<FileIO> >::iterator it;
+  it = operations.find(inode);
+
+  if (it != operations.end() && (*it).second == io &&
+      !io->hasRunningAsyncOps() && FileIO::hasSingleClient(io))
+  {
+    operations.erase(it);
+  }
+}
+
+void
+FilesystemPriv::checkFileLocks(void)
+{
+  const boost::chrono::milliseconds sleepTime(FILE_OPS_IDLE_CHECKER_SLEEP);
+  std::vector<std::string> dueInodes, dueQuotas;
+
+  while (true)
+  {
+    // Only the FileIO instances whose check is due are visited, so the work
+    // done here depends on how many of them are active and not on how many
+    // are open
+    dueInodes.clear();
+    fileIOChecks.waitForDue(dueInodes, sleepTime);
+
+    for (size_t i = 0; i < dueInodes.size(); i++)
+    {
+      boost::this_thread::interruption_point();
+      checkFileIO(dueInodes[i]);
+    }
+
+    manageDirCompaction();
+
+    manageMetricsDump();
+
+    dueQuotas.clear();
+    quotaFlushes.waitForDue(dueQuotas, DeadlineQueue::Clock::duration::zero());
+
+    for (size_t i = 0; i < dueQuotas.size(); i++)
+      flushQuotaDelta(dueQuotas[i]);
+
+    boost::this_thread::interruption_point();
+  }
+}
+
+static std::string
+quotaDeltaKey(PoolSP pool, const std::string &quota)
+{
+  return pool->name + PATH_SEP + quota;
+}
+
+// Adds the given differences to the ones of the quota that are still to be
+// written, returning the biggest accumulated difference (in absolute value).
+// Important: this method needs to be run in a scope where the quotaDeltas'
+// mutex is locked.
+static uint64_t
+mergeQuotaDelta(QuotaDelta &delta, const std::map<std::string, int64_t> &sizes)
+{
+  uint64_t maxPending = 0;
+  std::map<std::string, int64_t>::const_iterator it;
+
+  for (it = sizes.begin(); it != sizes.end(); it++)
+  {
+    int64_t &size = delta.sizes[(*it).first];
+    size += (*it).second;
+    maxPending = std::max(maxPending, (uint64_t) llabs(size));
+  }
+
+  return maxPending;
+}
+
+// Accumulates the differences to the current sizes of a quota so they are
+// written later in a single operation (when the quota update interval expires
+// or the accumulated size reaches the maximum pending size). Returns false if
+// the updates are not being accumulated, in which case nothing is done.
+bool
+FilesystemPriv::addQuotaDelta(PoolSP pool, const std::string &quota,
+                              const std::map<std::string, int64_t> &sizes)
+{
+  const double interval = quotaUpdateInterval;
+
+  if (interval <= 0 || !pool)
+    return false;
+
+  const std::string key = quotaDeltaKey(pool, quota);
+  bool flushNow = false;
+
+  {
+    boost::unique_lock<boost::mutex> lock(quotaDeltasMutex);
+    std::map<std::string, QuotaDelta>::iterator it = quotaDeltas.find(key);
+
+    if (it == quotaDeltas.end())
+    {
+      QuotaDelta &delta = quotaDeltas[key];
+      delta.pool = pool;
+      delta.name = quota;
+      it = quotaDeltas.find(key);
+
+      // The sizes are never kept for longer than the interval from the
+      // moment the first of them was accumulated
+      quotaFlushes.scheduleIn(key, interval);
+    }
+
+    uint64_t pending = mergeQuotaDelta((*it).second, sizes);
+    flushNow = quotaUpdateMaxPendingSize > 0 &&
+               pending >= quotaUpdateMaxPendingSize;
+  }
+
+  metrics.add(Metrics::COUNTER_QUOTA_DELTAS_AGGREGATED);
+
+  if (flushNow)
+    flushQuotaDelta(key);
+
+  return true;
+}
+
+int
+FilesystemPriv::flushQuotaDeltas(PoolSP pool, const std::string &quota)
+{
+  if (!pool)
+    return -ENODEV;
+
+  return flushQuotaDelta(quotaDeltaKey(pool, quota));
+}
+
+int
+FilesystemPriv::flushQuotaDelta(const std::string &key)
+{
+  QuotaDelta delta;
+
+  {
+    boost::unique_lock<boost::mutex> lock(quotaDeltasMutex);
+
+    // Returning while another flush is still writing the sizes would let the
+    // caller read them before they are updated
+    while (quotaDeltasInFlight.count(key) > 0)
+      quotaDeltasCond.wait(lock);
+
+    std::map<std::string, QuotaDelta>::iterator it = quotaDeltas.find(key);
+
+    if (it == quotaDeltas.end())
+      return 0;
+
+    delta = (*it).second;
+    quotaDeltas.erase(it);
+    quotaDeltasInFlight.insert(key);
+  }
+
+  quotaFlushes.remove(key);
+
+  MetricsTimer timer(&metrics, Metrics::OP_QUOTA_UPDATE);
+  int ret = timer.finish(QuotaPriv::addToCurrentSizes(delta.pool, delta.name,
+                                                     delta.sizes));
+
+  boost::unique_lock<boost::mutex> lock(quotaDeltasMutex);
+  quotaDeltasInFlight.erase(key);
+  quotaDeltasCond.notify_all();
+
+  if (ret != 0 && ret != -ENOENT)
+  {
+    radosfs_debug("Error updating the quota %s (%d). Retrying later.",
+                  delta.name.c_str(), ret);
+
+    // Not to lose the sizes, they are accumulated again (together with the
+    // ones that may have been added meanwhile)
+    bool isNew = quotaDeltas.count(key) == 0;
+    QuotaDelta &pendingDelta = quotaDeltas[key];
+    pendingDelta.pool = delta.pool;
+    pendingDelta.name = delta.name;
+    mergeQuotaDelta(pendingDelta, delta.sizes);
+
+    if (isNew)
+      quotaFlushes.scheduleIn(key, std::max(quotaUpdateInterval,
+                                            FILE_OPS_IDLE_CHECKER_SLEEP /
+                                            1000.0));
+  }
+
+  return ret;
+}
+
+void
+FilesystemPriv::flushAllQuotaDeltas(void)
+{
+  std::vector<std::string> keys;
+
+  {
+    boost::unique_lock<boost::mutex> lock(quotaDeltasMutex);
+    std::map<std::string, QuotaDelta>::iterator it;
+
+    for (it = quotaDeltas.begin(); it != quotaDeltas.end(); it++)
+      keys.push_back((*it).first);
+  }
+
+  for (size_t i = 0; i < keys.size(); i++)
+    flushQuotaDelta(keys[i]);
+}
+
+void
+FilesystemPriv::dropQuotaDeltas(PoolSP pool, const std::string &quota)
+{
+  if (!pool)
+    return;
+
+  const std::string key = quotaDeltaKey(pool, quota);
+
+  boost::unique_lock<boost::mutex> lock(quotaDeltasMutex);
+  quotaDeltas.erase(key);
+  quotaFlushes.remove(key);
+}
+
+void
+FilesystemPriv::getMetrics(FilesystemMetrics &fsMetrics)
+{
+  metrics.get(fsMetrics);
+
+  {
+    boost::unique_lock<boost::mutex> lock(operationsMutex);
+    fsMetrics.counters["file_io_instances"] = operations.size();
+  }
+
+  {
+    boost::unique_lock<boost::mutex> lock(quotaDeltasMutex);
+    fsMetrics.counters["pending_quota_updates"] = quotaDeltas.size();
+  }
+
+  fsMetrics.counters["dir_cache_entries"] = dirCache.numEntries();
+  fsMetrics.counters["dir_cache_bytes"] = dirCache.size();
+  fsMetrics.counters["stat_cache_hits"] = statCache.hits();
+  fsMetrics.counters["stat_cache_misses"] = statCache.misses();
+}
+
+void
+FilesystemPriv::manageMetricsDump(void)
+{
+  const double interval = metricsDumpInterval;
+
+  if (interval <= 0)
+    return;
+
+  boost::chrono::steady_clock::time_point now =
+      boost::chrono::steady_clock::now();
+
+  if (now - lastMetricsDump < boost::chrono::duration<double>(interval))
+    return;
+
+  lastMetricsDump = now;
+
+  dumpMetrics();
+}
+
+void
+FilesystemPriv::dumpMetrics(void)
+{
+  FilesystemMetrics fsMetrics;
+  std::stringstream stream;
+
+  getMetrics(fsMetrics);
+
+  std::map<std::string, OpMetrics>::const_iterator opIt;
+  for (opIt = fsMetrics.operations.begin();
+       opIt != fsMetrics.operations.end();
+       opIt++)
+  {
+    const OpMetrics &op = (*opIt).second;
+
+    if (op.count == 0)
+      continue;
+
+    stream << (*opIt).first << ": count=" << op.count
+           << " errors=" << op.errors
+           << " avg_us=" << op.totalLatencyUs / op.count
+           << " p50_us=" << op.latencyPercentileUs(50)
+           << " p99_us=" << op.latencyPercentileUs(99) << "; ";
+  }
+
+  std::map<std::string, uint64_t>::const_iterator it;
+  for (it = fsMetrics.counters.begin(); it != fsMetrics.counters.end(); it++)
+    stream << (*it).first << "=" << (*it).second << " ";
+
+  std::string path;
+
+  {
+    boost::unique_lock<boost::mutex> lock(metricsDumpMutex);
+    path = metricsDumpPath;
+  }
+
+  if (path == "")
+  {
+    radosfs_debug("Metrics: %s", stream.str().c_str());
+    return;
+  }
+
+  FILE *file = fopen(path.c_str(), "a");
+
+  if (!file)
+  {
+    radosfs_debug("Cannot dump the metrics to %s: %s", path.c_str(),
+                  strerror(errno));
+    return;
+  }
+
+  fprintf(file, "%ld %s\n", (long) time(0), stream.str().c_str());
+  fclose(file);
+}
+
+void
+FilesystemPriv::manageDirCompaction(void)
+{
+  if (!dirBackgroundCompaction)
+    return;
+
+  boost::chrono::steady_clock::time_point now =
+      boost::chrono::steady_clock::now();
+
+  if (now - lastDirCompactionCheck <
+      boost::chrono::seconds(DIR_COMPACTION_CHECK_INTERVAL))
+    return;
+
+  lastDirCompactionCheck = now;
+
+  // Pick the cached dirs whose logs are the most wasteful, up to the number of
+  // compactions allowed per interval
+  std::multimap<float, std::tr1::shared_ptr<DirCache> > candidates;
+  std::vector<std::tr1::shared_ptr<DirCache> > caches;
+
+  dirCache.getAll(caches);
+
+  std::vector<std::tr1::shared_ptr<DirCache> >::iterator it;
+  for (it = caches.begin(); it != caches.end(); it++)
+  {
+    const float ratio = (*it)->logRatio();
+
+    if (ratio != -1 && ratio <= dirCompactRatio)
+      candidates.insert(std::make_pair(ratio, *it));
+  }
+
+  boost::unique_lock<boost::mutex> compactionLock(dirCompactionMutex);
+
+  size_t numCompactions = dirsBeingCompacted.size();
+  std::multimap<float, std::tr1::shared_ptr<DirCache> >::iterator candIt;
+
+  for (candIt = candidates.begin();
+       candIt != candidates.end() && numCompactions < dirCompactionsPerInterval;
+       candIt++)
+  {
+    std::tr1::shared_ptr<DirCache> cache = (*candIt).second;
+
+    if (dirsBeingCompacted.count(cache->inode()) > 0)
+      continue;
+
+    dirsBeingCompacted.insert(cache->inode());
+    numCompactions++;
+
+    scheduler.post(boost::bind(&FilesystemPriv::compactDirInBackground,
+                               this, cache),
+                   WorkScheduler::PRIORITY_BACKGROUND);
+  }
+}
+
+void
+FilesystemPriv::compactDirInBackground(std::tr1::shared_ptr<DirCache> cache)
+{
+  cache->compactDirOpLog(dirLogBinaryCompaction);
+
+  boost::unique_lock<boost::mutex> lock(dirCompactionMutex);
+  dirsBeingCompacted.erase(cache->inode());
+}
+
+/**
+ * @class Filesystem
+ *
+ * Represents the filesystem. Instantiating a Filesystem object is usually the
+ * first step when using the library since it corresponds to a Ceph cluster.
+ *
+ * Before using any of the methods in the class, Filesystem::init should be
+ * called in order to set the appropriate Ceph cluster. After the cluster is
+ * initialized, at least one metadata and one data pool should be set using
+ * Filesystem::addMetadataPool and Filesystem::addDataPool, respectively.
+ */
+
+/**
+ * @struct FileReadData
+ *
+ * A struct describing how to read data from a file.
+ *
+ * @fn FileReadData::FileReadData(char *buff, off_t offset, size_t length,
+ *                                ssize_t *retValue=0)
+ * Builds an instance of FileReadData.
+ *
+ * @param[out] buff a pointer to a buffer where the data will be stored.
+ * @param offset the offset in the file from which the data will start being
+ *        read.
+ * @param length the number of bytes to read. The given \a buff should be large
+ *        enough to hold this number of bytes.
+ * @param[out] retValue the location in which to return the return code of the
+ *             read operation (or a null pointer in case this value should not
+ *             be returned).
+ */
+
+/**
+ * Creates a new instance of Filesystem.
+ *
+ * This is usually the first step to be done when using the library but keep in
+ * mind that Filesystem::init should be called in order to do anything
+ * meaningful (as otherwise no Ceph cluster will be configured).
+ */
+Filesystem::Filesystem()
+  : mPriv(new FilesystemPriv(this))
+{
+}
+
+Filesystem::~Filesystem()
+{
+  delete mPriv;
+}
+
+/**
+ * Initialize the Ceph cluster.
+ * @param userName the user name for for initializing the cluster.
+ * @param configurationFile the path to the configuration file describing the
+ *        cluster.
+ * @return 0 if the cluster has been successfully initialized, an error
+ *         code otherwise.
+ */
+int
+Filesystem::init(const std::string &userName,
+                 const std::string &configurationFile)
+{
+  int ret = mPriv->createCluster(userName, configurationFile);
+
+  return ret;
+}
+
+/**
+ * Sets a pool to be used for the data associated with the given \a prefix.
+ * File objects whose path prefixes match the one set by this method will have
+ * their data stored in the mapped pool.
+ *
+ * @note Keep in mind this method does not create the pool in the cluster so it
+ *       needs to already exist beforehand.
+ * @param name the name of the pool in the cluster.
+ * @param prefix the prefix of the paths that is associated with this pool.
+ * @param size the greatest size allowed for a file (given in MB).
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::addDataPool(const std::string &name, const std::string &prefix,
+                        size_t size)
+{
+  librados::IoCtx ioctx;
+  Pool *pool;
+  PoolList *pools = 0;
+  PoolListMap *map;
+  int ret = -EPERM;
+  const std::string &cleanPrefix = sanitizePath(prefix  + "/");
+
+  if (!mPriv->initialized)
+    return ret;
+
+  if (prefix == "")
+  {
+    radosfs_debug("The pool's prefix cannot be an empty string");
+    return -EINVAL;
+  }
+
+  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+
+  map = &mPriv->poolMap;
+
+  if (map->count(cleanPrefix) > 0)
+  {
+    pools = &map->at(cleanPrefix);
+
+    PoolList::const_iterator it;
+
+    for (it = pools->begin(); it != pools->end(); it++)
+    {
+      if ((*it)->name == name)
+      {
+        radosfs_debug("The pool %s is already associated with the prefix %s. "
+                      "Not adding.", name.c_str(), cleanPrefix.c_str());
+        return -EEXIST;
+      }
+    }
+  }
+
+  ret = mPriv->radosCluster.ioctx_create(name.c_str(), ioctx);
+
+  if (ret != 0)
+    return ret;
+
+  pool = new Pool(name.c_str(), size * MEGABYTE_CONVERSION, ioctx);
+  pool->setAlignment(ioctx.pool_required_alignment());
+
+  if (pools == 0)
+  {
+    PoolList poolList;
+    std::pair<std::string, PoolList> entry(cleanPrefix, poolList);
+    map->insert(entry);
+    pools = &map->at(cleanPrefix);
+  }
+
+  pools->push_back(PoolSP(pool));
+  mPriv->dataPoolTrie.publish(*map);
+
+  return ret;
+}
+
+/**
+ * Removes a data pool. @note As with Filesystem::addDataPool , this method does
+ * not affect the cluster itself which means that the pool will not be deleted
+ * from it but rather disassociated from the prefix to which it was previously
+ * set.
+ * @param name the name
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::removeDataPool(const std::string &name)
+{
+  int ret = -ENOENT;
+  PoolListMap *map = &mPriv->poolMap;
+  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+
+  PoolListMap::iterator it;
+
+  for (it = map->begin(); it != map->end(); it++)
+  {
+    PoolList &pools = (*it).second;
+    PoolList::iterator poolsIt;
+
+    for (poolsIt = pools.begin(); poolsIt != pools.end(); poolsIt++)
+    {
+      if ((*poolsIt)->name == name)
+      {
+        pools.erase(poolsIt);
+        ret = 0;
+
+        if (pools.empty())
+        {
+          map->erase((*it).first);
+        }
+
+        mPriv->dataPoolTrie.publish(*map);
+
+        break;
+      }
+    }
+
+    if (ret == 0)
+      break;
+  }
+
+  return ret;
+}
+
+/**
+ * Gets all the data pools configured for the given \a prefix.
+ * @param prefix the prefix for which the data pools are mapped.
+ * @return A vector with the names of the pools in question.
+ */
+std::vector<std::string>
+Filesystem::dataPools(const std::string &prefix) const
+{
+  std::vector<std::string> pools;
+  const std::string &dirPrefix = getDirPath(prefix);
+  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+
+  if (mPriv->poolMap.count(dirPrefix) > 0)
+  {
+    const PoolList &poolList = mPriv->poolMap[dirPrefix];
+    PoolList::const_iterator it;
+
+    for (it = poolList.begin(); it != poolList.end(); it++)
+    {
+      pools.push_back((*it)->name);
+    }
+  }
+
+  return pools;
+}
+
+/**
+ * Gets the prefix associated with the given data pool.
+ * @param pool a data pool's name associated with a prefix.
+ * @return The prefix associated with the given data pool.
+ */
+std::string
+Filesystem::dataPoolPrefix(const std::string &pool) const
+{
+  std::string prefix("");
+  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+
+  PoolListMap::const_iterator it;
+  for (it = mPriv->poolMap.begin(); it != mPriv->poolMap.end(); it++)
+  {
+    const PoolList &pools = (*it).second;
+    PoolList::const_iterator poolIt;
+
+    for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
+    {
+      if ((*poolIt)->name == pool)
+      {
+        prefix = (*it).first;
+        break;
+      }
+    }
+
+    if (prefix != "")
+      break;
+  }
+
+  return prefix;
+}
+
+/**
+ * Gets the maximum size of files for the given data pool.
+ * @param pool the name of the data pool from which to get the size.
+ * @return the maximum size of files for the given data pool.
+ */
+ssize_t
+Filesystem::dataPoolSize(const std::string &pool) const
+{
+  ssize_t size = -ENOENT;
+  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+
+  PoolListMap::const_iterator it;
+  for (it = mPriv->poolMap.begin(); it != mPriv->poolMap.end(); it++)
+  {
+    const PoolList &pools = (*it).second;
+    PoolList::const_iterator poolIt;
+
+    for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
+    {
+      if ((*poolIt)->name == pool)
+      {
+        size = (*poolIt)->size;
+        break;
+      }
+    }
+
+    if (size >= 0)
+      break;
+  }
+
+  return size;
+}
+
+/**
+ * Sets a pool to be used for the metadata associated with the given \a prefix.
+ * Directory objects whose path prefixes match the one set by this method will
+ * have their data stored in the mapped pool.
+ *
+ * @note Keep in mind this method does not create the pool in the cluster so it
+ *       needs to already exist beforehand.
+ * @param name the name of the pool in the cluster.
+ * @param prefix the prefix of the paths that is associated with this pool.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::addMetadataPool(const std::string &name, const std::string &prefix)
+{
+  return mPriv->addPool(name,
+                        prefix,
+                        &mPriv->mtdPoolMap,
+                        mPriv->mtdPoolMutex,
+                        &mPriv->mtdPoolTrie);
+}
+
+/**
+ * Removes a metadata pool.
+ *
+ * @note As with Filesystem::addMetadataPool , this method does not affect the
+ *       cluster itself which means that the pool will not be deleted from it
+ *       but rather disassociated from the prefix to which it was previously set.
+ * @param name the name of the metadata pool to remove.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::removeMetadataPool(const std::string &name)
+{
+  return mPriv->removePool(name, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex,
+                           &mPriv->mtdPoolTrie);
+}
+
+/**
+ * Gets all the metadata pools.
+ * @return A vector with the names of the metadata pools.
+ */
+std::vector<std::string>
+Filesystem::metadataPools() const
+{
+  return mPriv->pools(&mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+}
+
+/**
+ * Gets the prefix associated with the given metadata pool.
+ * @param pool a pool's name associated with a prefix.
+ * @return The prefix associated with the given data pool.
+ */
+std::string
+Filesystem::metadataPoolPrefix(const std::string &pool) const
+{
+  return mPriv->poolPrefix(pool, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+}
+
+/**
+ * Gets the pool associated with the given \a prefix. (Does the opposite of
+ * Filesystem::metadataPoolPrefix).
+ * @param prefix a prefix associated with a metadata pool.
+ * @return the name of the pool associated with the given
+ */
+std::string
+Filesystem::metadataPoolFromPrefix(const std::string &prefix) const
+{
+  return mPriv->poolFromPrefix(prefix, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+}
+
+/**
+ * Saves the data and metadata pools that are currently set (with their
+ * prefixes and sizes) to a layout object in the given \a pool, so they can be
+ * set up at once with Filesystem::loadLayout instead of adding each of them.
+ *
+ * @note A layout previously saved in the pool is replaced.
+ * @param pool the name of the pool in which to save the layout.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::saveLayout(const std::string &pool) const
+{
+  if (!mPriv->initialized)
+    return -ENODEV;
+
+  std::ostringstream stream;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->mtdPoolMutex);
+
+    PoolMap::const_iterator it;
+    for (it = mPriv->mtdPoolMap.begin(); it != mPriv->mtdPoolMap.end(); it++)
+    {
+      stream << FS_LAYOUT_MTD_POOL << " " << (*it).second->name << " "
+             << (*it).first << "\n";
+    }
+  }
+
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
+
+    PoolListMap::const_iterator it;
+    for (it = mPriv->poolMap.begin(); it != mPriv->poolMap.end(); it++)
+    {
+      const PoolList &pools = (*it).second;
+
+      // The order is kept since the first pool is the default one for files
+      for (size_t i = 0; i < pools.size(); i++)
+      {
+        stream << FS_LAYOUT_DATA_POOL << " " << pools[i]->name << " "
+               << pools[i]->size / MEGABYTE_CONVERSION << " " << (*it).first
+               << "\n";
+      }
+    }
+  }
+
+  librados::IoCtx ioctx;
+  int ret = mPriv->radosCluster.ioctx_create(pool.c_str(), ioctx);
+
+  if (ret != 0)
+    return ret;
+
+  librados::bufferlist contents;
+  contents.append(stream.str());
+
+  return ioctx.write_full(FS_LAYOUT_OBJ, contents);
+}
+
+/**
+ * Sets the data and metadata pools from the layout saved in the given \a pool
+ * by Filesystem::saveLayout.
+ *
+ * This is an alternative to calling Filesystem::addDataPool and
+ * Filesystem::addMetadataPool for each of the pools, which is slow when there
+ * are many of them: the layout is read at once, each pool is only opened once
+ * even if it is set for several prefixes and the metadata prefixes are checked
+ * in parallel.
+ *
+ * @note No pool is set if any of the layout's pools is already set for the
+ *       same prefix.
+ * @param pool the name of the pool in which the layout was saved.
+ * @return 0 on success, -ENOENT if there is no layout saved in the pool, an
+ *         error code otherwise.
+ */
+int
+Filesystem::loadLayout(const std::string &pool)
+{
+  if (!mPriv->initialized)
+    return -ENODEV;
+
+  std::map<std::string, librados::IoCtx> ioctxs;
+  librados::IoCtx layoutIoctx;
+  int ret = mPriv->openLayoutPool(pool, ioctxs, layoutIoctx);
+
+  if (ret != 0)
+    return ret;
+
+  librados::bufferlist contents;
+  ret = layoutIoctx.read(FS_LAYOUT_OBJ, contents, 0, 0);
+
+  if (ret < 0)
+    return ret;
+
+  PoolMap mtdPools;
+  PoolListMap dataPools;
+  std::istringstream stream(std::string(contents.c_str(), contents.length()));
+  std::string line;
+
+  while (std::getline(stream, line))
+  {
+    if (line.empty())
+      continue;
+
+    std::istringstream lineStream(line);
+    std::string type, name, prefix;
+    size_t size = 0;
+
+    lineStream >> type >> name;
+
+    if (type == FS_LAYOUT_DATA_POOL)
+      lineStream >> size;
+
+    lineStream >> std::ws;
+    std::getline(lineStream, prefix);
+
+    if (lineStream.fail() || prefix.empty() ||
+        (type != FS_LAYOUT_DATA_POOL && type != FS_LAYOUT_MTD_POOL))
+    {
+      radosfs_debug("Malformed line in the layout saved in %s: '%s'",
+                    pool.c_str(), line.c_str());
+      return -EINVAL;
+    }
+
+    librados::IoCtx ioctx;
+    ret = mPriv->openLayoutPool(name, ioctxs, ioctx);
+
+    if (ret != 0)
+    {
+      radosfs_debug("Cannot open the pool %s from the layout: %s "
+                    "(retcode=%d)", name.c_str(), strerror(abs(ret)), ret);
+      return ret;
+    }
+
+    PoolSP poolSP(new Pool(name, size * MEGABYTE_CONVERSION, ioctx));
+
+    if (type == FS_LAYOUT_DATA_POOL)
+    {
+      poolSP->setAlignment(ioctx.pool_required_alignment());
+      dataPools[prefix].push_back(poolSP);
+    }
+    else
+    {
+      poolSP->notifyDirChanges = mPriv->dirCacheWatch;
+      mtdPools[prefix] = poolSP;
+    }
+  }
+
+  ret = mPriv->createPrefixDirs(mtdPools);
+
+  if (ret < 0)
+    return ret;
+
+  boost::unique_lock<boost::mutex> dataLock(mPriv->poolMutex);
+  boost::unique_lock<boost::mutex> mtdLock(mPriv->mtdPoolMutex);
+
+  PoolMap::const_iterator mtdIt;
+  for (mtdIt = mtdPools.begin(); mtdIt != mtdPools.end(); mtdIt++)
+  {
+    if (mPriv->mtdPoolMap.count((*mtdIt).first) > 0)
+    {
+      radosfs_debug("There is already a pool with the prefix %s. "
+                    "Not loading the layout.", (*mtdIt).first.c_str());
+      return -EEXIST;
+    }
+  }
+
+  PoolListMap::const_iterator dataIt;
+  for (dataIt = dataPools.begin(); dataIt != dataPools.end(); dataIt++)
+  {
+    PoolListMap::const_iterator it = mPriv->poolMap.find((*dataIt).first);
+
+    if (it == mPriv->poolMap.end())
+      continue;
+
+    for (size_t i = 0; i < (*dataIt).second.size(); i++)
+    {
+      for (size_t j = 0; j < (*it).second.size(); j++)
+      {
+        if ((*it).second[j]->name == (*dataIt).second[i]->name)
+        {
+          radosfs_debug("The pool %s is already associated with the prefix "
+                        "%s. Not loading the layout.",
+                        (*it).second[j]->name.c_str(), (*it).first.c_str());
+          return -EEXIST;
+        }
+      }
+    }
+  }
+
+  mPriv->mtdPoolMap.insert(mtdPools.begin(), mtdPools.end());
+  mPriv->mtdPoolTrie.publish(mPriv->mtdPoolMap);
+
+  for (dataIt = dataPools.begin(); dataIt != dataPools.end(); dataIt++)
+  {
+    PoolList &pools = mPriv->poolMap[(*dataIt).first];
+    pools.insert(pools.end(), (*dataIt).second.begin(),
+                 (*dataIt).second.end());
+  }
+
+  mPriv->dataPoolTrie.publish(mPriv->poolMap);
+
+  return 0;
+}
+
+/**
+ * Sets the \b uid and \b gid . The \b uid and \b gid are thread local and will
+ * be used for any subsequent operations that require checking permissions.
+ * @param uid the uid to be set.
+ * @param gid the gid to be set.
+ */
+void
+Filesystem::setIds(uid_t uid, gid_t gid)
+{
+  mPriv->setUid(uid);
+  mPriv->setGid(gid);
+}
+
+/**
+ * Gets the current \b uid and \b gid values and sets them in the given \a uid
+ * and \a gid.
+ * @param[out] uid the location in which the uid will be set.
+ * @param[out] gid the location in which the gid will be set.
+ */
+void
+Filesystem::getIds(uid_t *uid, gid_t *gid) const
+{
+  *uid = mPriv->getUid();
+  *gid = mPriv->getGid();
+}
+
+/**
+ * Gets the current \b uid value.
+ * @return the \b uid currently set.
+ */
+uid_t
+Filesystem::uid(void) const
+{
+  return mPriv->uid;
+}
+
+/**
+ * Gets the current \b gid value.
+ * @return the \b gid currently set.
+ */
+gid_t
+Filesystem::gid(void) const
+{
+  return mPriv->gid;
+}
+
+/**
+ * Stats the given \a paths in parallel.
+ *
+ * Paths are statted in parallel not in to the worker threads that will
+ * parallelize the operations from the client side but, in case they have the
+ * same parent, they may be also statted in parallel on the cluster side. This
+ * makes it ideal for e.g. statting all the entries in a directory as all the
+ * files present in the directory will be statted in one go (in batches of up
+ * to STAT_BATCH_MAX_ENTRIES so that large directories are statted by several
+ * workers at the same time).
+ *
+ * @param paths a vector of paths to files or directories.
+ * @return a vector of pairs with the result of the stat operation over the
+ *         paths. Each pair contains the operation's return code (0 on success,
+ *         an error code otherwise) and a \b stat struct with the details of the
+ *         stat operation.
+ */
+std::vector<std::pair<int, struct stat> >
+Filesystem::stat(const std::vector<std::string> &paths)
+{
+  StatResults stats;
+  mPriv->stat(paths, &stats);
+
+  std::vector<std::pair<int, struct stat> > results;
+  results.reserve(paths.size());
+
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    results.push_back(std::pair<int, struct stat>(stats.ret(i),
+                                                  stats.statBuff(i)));
+  }
+
+  return results;
+}
+
+/**
+ * Stats the given \a paths in the background, calling the given \a callback
+ * with the result of each path as soon as it is known.
+ *
+ * The paths are statted in the same way as in Filesystem::stat(const std::vector<std::string>&)
+ * but this method returns right away and the results are streamed instead of
+ * returned all at the end.
+ *
+ * @param paths a vector of paths to files or directories.
+ * @param callback the function to be called with the result of statting each
+ *        path: the path, the operation's return code (0 on success, an error
+ *        code otherwise), the \b stat struct with the details of the path and
+ *        \a callbackArg.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @return 0 if the paths are being statted, -EINVAL if no callback was given.
+ * @note The callback is called once per path, from the generic worker threads
+ *       (see Filesystem::setNumGenericWorkers), so it needs to be thread-safe
+ *       and should not block for long.
+ */
+int
+Filesystem::statAsync(const std::vector<std::string> &paths,
+                      StatCallback callback, void *callbackArg)
+{
+  if (callback == 0)
+    return -EINVAL;
+
+  mPriv->statAsync(paths, callback, callbackArg);
+
+  return 0;
+}
+
+/**
+ * Waits for the asynchronous metadata operation with the given \a opId (as
+ * returned by e.g. File::createAsync or Dir::removeAsync) to be finished. If
+ * no \a opId is given, it waits for all of them.
+ *
+ * @param opId the id of an asynchronous metadata operation.
+ * @return 0 on success, -ENOENT if there is no operation with the given id,
+ *         or the error code of the (first) operation that failed otherwise.
+ */
+int
+Filesystem::sync(const std::string &opId)
+{
+  std::vector<std::string> opIds;
+
+  if (opId.empty())
+  {
+    boost::unique_lock<boost::mutex> lock(mPriv->metadataOps.opsMutex);
+    std::map<std::string, AsyncOpSP>::iterator it;
+
+    for (it = mPriv->metadataOps.mOperations.begin();
+         it != mPriv->metadataOps.mOperations.end(); it++)
+    {
+      opIds.push_back((*it).first);
+    }
+
+    if (opIds.empty())
+      return 0;
+  }
+  else
+  {
+    opIds.push_back(opId);
+  }
+
+  return mPriv->syncMetadataOps(opIds, opId.empty());
+}
+
+/**
+ * Checks whether the asynchronous metadata operation with the given \a opId
+ * has finished, without blocking.
+ *
+ * @param opId the id of an asynchronous metadata operation.
+ * @return -EINPROGRESS if the operation is still running, -ENOENT if there is
+ *         no such operation, otherwise the operation's return code (0 on
+ *         success). Once the operation's return code is returned, the
+ *         operation is forgotten as if Filesystem::sync had been called for it.
+ */
+int
+Filesystem::pollOp(const std::string &opId)
+{
+  return mPriv->metadataOps.poll(opId);
+}
+
+/**
+ * Waits until any of the asynchronous metadata operations with the given
+ * \a opIds is finished.
+ *
+ * @param opIds the ids of asynchronous metadata operations.
+ * @param[out] finishedOpId a string to return the id of the operation that
+ *             finished.
+ * @return -ENOENT if none of the operations exist, otherwise the return code
+ *         of the finished operation (0 on success). The finished operation is
+ *         forgotten as if Filesystem::sync had been called for it.
+ */
+int
+Filesystem::waitForAnyOp(const std::vector<std::string> &opIds,
+                         std::string *finishedOpId)
+{
+  return mPriv->metadataOps.waitForAny(opIds, finishedOpId);
+}
+
+/**
+ * Gets the progress of the asynchronous metadata operation with the given
+ * \a opId, for the operations that report it (e.g. Dir::removeRecursive).
+ *
+ * @param opId the id of an asynchronous metadata operation.
+ * @param[out] done a pointer to return the number of items already handled.
+ * @param[out] total a pointer to return the number of items to handle, as far
+ *             as known by the operation.
+ * @return 0 on success, -ENOENT if there is no such operation.
+ */
+int
+Filesystem::opProgress(const std::string &opId, u_int64_t *done,
+                       u_int64_t *total)
+{
+  return mPriv->metadataOps.progress(opId, done, total);
+}
+
+/**
+ * Stats the given \a path and fills the details in the given \a stat parameter.
+ * @param path the path to be statted.
+ * @param[out] buff the struct to be filled with the stat details.
+ * @return 0 if the path was successfully statted, an error code
+ *         otherwise.
+ */
+int
+Filesystem::stat(const std::string &path, struct stat *buff)
+{
+  int ret = -ENOENT;
+
+  const std::string &sanitizedPath = sanitizePath(path);
+  RecordedOp recordedOp(&mPriv->opRecorder, OpRecorder::OP_STAT,
+                        sanitizedPath);
+
+  if (isDirPath(sanitizedPath))
+  {
+    Dir dir(this, sanitizedPath);
+
+    recordedOp.setFlags(OpRecorder::FLAG_DIR);
+    ret = dir.stat(buff);
+  }
+
+  if (ret != 0)
+  {
+    File file(this, sanitizedPath, File::MODE_READ);
+
+    ret = file.stat(buff);
+  }
+
+  return recordedOp.finish(ret);
+}
+
+/**
+ * Gets the list of all the pools in the configured cluster.
+ * @return A vector with the name of all the pools in the configured cluster.
+ */
+std::vector<std::string>
+Filesystem::allPoolsInCluster() const
+{
+  std::vector<std::string> poolVector;
+  std::list<std::string> poolList;
+
+  mPriv->radosCluster.pool_list(poolList);
+  poolVector.insert(poolVector.begin(), poolList.begin(), poolList.end());
+
+  return poolVector;
+}
+
+/**
+ * Stats the currently configured cluster. The space related values are returned
+ * in KB.
+ * @param[out] totalSpaceKb the location in which to return the total space.
+ * @param[out] usedSpaceKb the location in which to return the used space.
+ * @param[out] availableSpaceKb the location in which to return the available
+ *             space.
+ * @param[out] numberOfObjects  the location in which to return the number of
+ *             objects.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::statCluster(uint64_t *totalSpaceKb, uint64_t *usedSpaceKb,
+                        uint64_t *availableSpaceKb, uint64_t *numberOfObjects)
+{
+  int ret;
+  librados::cluster_stat_t clusterStat;
+
+  ret = mPriv->radosCluster.cluster_stat(clusterStat);
+
+  if (ret != 0)
+    return ret;
+
+  if (totalSpaceKb)
+    *totalSpaceKb = clusterStat.kb;
+
+  if (usedSpaceKb)
+    *usedSpaceKb = clusterStat.kb_used;
+
+  if (availableSpaceKb)
+    *availableSpaceKb = clusterStat.kb_avail;
+
+  if (numberOfObjects)
+    *numberOfObjects = clusterStat.num_objects;
+
+  return ret;
+}
+
+/**
+ * Sets an xattribute in the given \a path .
+ * @param path a path to a file or directory.
+ * @param attrName the name of the xattribute.
+ * @param value the value of the xattribute.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::setXAttr(const std::string &path, const std::string &attrName,
+                     const std::string &value)
+{
+  Stat stat;
+
+  int ret = mPriv->stat(path, &stat);
+
+  if (ret != 0)
+    return ret;
+
+  if (S_ISLNK(stat.statBuff.st_mode))
+    return setXAttr(stat.translatedPath, attrName, value);
+
+  if (!stat.pool)
+    return -ENODEV;
+
+  ret = setXAttrFromPath(stat, uid(), gid(), attrName, value);
+
+  if (ret == 0 && S_ISREG(stat.statBuff.st_mode))
+    mPriv->queueBacklink(stat.pool, stat.translatedPath, stat.path);
+
+  return ret;
+}
+
+/**
+ * Gets an xattribute from the given \a path .
+ * @param path a path to a file or directory.
+ * @param attrName the name of the xattribute.
+ * @param[out] value the variable to receive the value of the xattribute.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::getXAttr(const std::string &path, const std::string &attrName,
+                     std::string &value)
+{
+  Stat stat;
+
+  int ret = mPriv->stat(path, &stat);
+
+  if (ret != 0)
+    return ret;
+
+  if (S_ISLNK(stat.statBuff.st_mode))
+    return getXAttr(stat.translatedPath, attrName, value);
+
+  if (!stat.pool)
+    return -ENODEV;
+
+  return getXAttrFromPath(stat.pool->ioctx, stat.statBuff, uid(), gid(),
+                          stat.translatedPath, attrName, value);
+}
+
+/**
+ * Removes an xattribute from a given \a path .
+ * @param path a path to a file or directory.
+ * @param attrName the name of the xattribute.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::removeXAttr(const std::string &path, const std::string &attrName)
+{
+  Stat stat;
+
+  int ret = mPriv->stat(path, &stat);
+
+  if (ret != 0)
+    return ret;
+
+  if (S_ISLNK(stat.statBuff.st_mode))
+    return removeXAttr(stat.translatedPath, attrName);
+
+  if (!stat.pool)
+    return -ENODEV;
+
+  return removeXAttrFromPath(stat.pool->ioctx, stat.statBuff, uid(), gid(),
+                             stat.translatedPath, attrName);
+}
+
+/**
+ * Gets a map of all the xattributes set in the given \a path.
+ * @param path a path to a file or directory.
+ * @param[out] map the map into which the xattributes will be set.
+ * @return 0 on success, an error code otherwise.
+ */
+int
+Filesystem::getXAttrsMap(const std::string &path,
+                         std::map<std::string, std::string> &map)
+{
+  Stat stat;
+
+  int ret = mPriv->stat(path, &stat);
+
+  if (ret != 0)
+    return ret;
+
+  if (S_ISLNK(stat.statBuff.st_mode))
+    return getXAttrsMap(stat.translatedPath, map);
+
+  if (!stat.pool)
+    return -ENODEV;
+
+  return getMapOfXAttrFromPath(stat.pool->ioctx, stat.statBuff, uid(), gid(),
+                               stat.translatedPath, map);
+}
+
+/**
+ * Sets the maximum size of the directory cache.
+ *
+ * The size is the number of cached directories plus the number of their
+ * entries. The cache is split in shards by directory and each shard can use an
+ * equal part of this size; when a shard goes over its part, its least recently
+ * used directories are evicted one by one until it fits.
+ *
+ * @note The cache is also bounded by the memory it uses, see
+ *       Filesystem::setDirCacheMaxBytes.
+ * @param size the size to set (in directories plus entries).
+ */
+void
+Filesystem::setDirCacheMaxSize(size_t size)
+{
+  mPriv->dirCache.setMaxSize(size);
+}
+
+/**
+ * Gets the maximum size of the directory cache.
+ * @return the maximum size of the directory cache (in directories plus
+ *         entries).
+ */
+size_t
+Filesystem::dirCacheMaxSize(void) const
+{
+  return mPriv->dirCache.maxSize();
+}
+
+/**
+ * Sets the maximum memory used by the directory cache.
+ *
+ * This is the approximate memory, in bytes, used by the cached directories and
+ * their entries. As with Filesystem::setDirCacheMaxSize, each shard of the
+ * cache can use an equal part of it and evicts its least recently used
+ * directories one by one when it goes over that part.
+ *
+ * @param bytes the maximum memory to use (in bytes).
+ */
+void
+Filesystem::setDirCacheMaxBytes(size_t bytes)
+{
+  mPriv->dirCache.setMaxBytes(bytes);
+}
+
+/**
+ * Gets the maximum memory used by the directory cache.
+ * @return the maximum memory used by the directory cache (in bytes).
+ */
+size_t
+Filesystem::dirCacheMaxBytes(void) const
+{
+  return mPriv->dirCache.maxBytes();
+}
+
+/**
+ * Sets the directory compaction ratio.
+ * @param ratio the ratio to set.
+ */
+void
+Filesystem::setDirCompactRatio(float ratio)
+{
+  mPriv->dirCompactRatio = ratio;
+}
+
+/**
+ * Gets the directory compaction ratio.
+ * @return the directory compaction ratio.
+ */
+float
+Filesystem::dirCompactRatio(void) const
+{
+  return mPriv->dirCompactRatio;
+}
+
+/**
+ * Sets whether directories are compacted into the binary log format.
+ *
+ * When enabled, compacting a directory rewrites its log as binary,
+ * length-prefixed records, which are much faster to parse when the directory
+ * is read from scratch. Entries added afterwards keep being appended as text
+ * and both formats are read transparently. Directories compacted this way
+ * cannot be read by versions of the library that only know the text format.
+ *
+ * @param binary whether to compact directories into the binary format.
+ */
+void
+Filesystem::setDirLogBinaryCompaction(bool binary)
+{
+  mPriv->dirLogBinaryCompaction = binary;
+}
+
+/**
+ * Gets whether directories are compacted into the binary log format.
+ * @see Filesystem::setDirLogBinaryCompaction
+ * @return true if directories are compacted into the binary format, false
+ *         otherwise.
+ */
+bool
+Filesystem::dirLogBinaryCompaction(void) const
+{
+  return mPriv->dirLogBinaryCompaction;
+}
+
+/**
+ * Sets whether new directories keep their entries in omap.
+ *
+ * Directories created while this is enabled store each entry (and its
+ * metadata) as omap keys in the directory's inode object instead of appending
+ * it to the directory log. Listing them is paged on the server side and
+ * looking up an entry or its metadata only reads the keys involved, so
+ * clients never need to load the whole directory. The mode of existing
+ * directories is not changed.
+ *
+ * @param omapIndex whether new directories should be indexed in omap.
+ */
+void
+Filesystem::setDirOmapIndex(bool omapIndex)
+{
+  mPriv->dirOmapIndex = omapIndex;
+}
+
+/**
+ * Gets whether new directories keep their entries in omap.
+ * @see Filesystem::setDirOmapIndex
+ * @return true if new directories are indexed in omap, false otherwise.
+ */
+bool
+Filesystem::dirOmapIndex(void) const
+{
+  return mPriv->dirOmapIndex;
+}
+
+/**
+ * Sets whether cached directories should be compacted in the background.
+ *
+ * When enabled, Dir::refresh no longer compacts cacheable directories itself
+ * when their *compact ratio* drops to the one set with
+ * Filesystem::setDirCompactRatio. Instead, the cached directories are checked
+ * periodically and the ones that need it are compacted by the generic worker
+ * threads, at most Filesystem::dirCompactionsPerInterval at a time.
+ * Directories that are not cacheable are still compacted by Dir::refresh.
+ *
+ * @param background whether to compact directories in the background.
+ */
+void
+Filesystem::setDirBackgroundCompaction(bool background)
+{
+  mPriv->dirBackgroundCompaction = background;
+}
+
+/**
+ * Sets whether cached directories should be watched for changes.
+ *
+ * By default, updating a cached directory (e.g. in Dir::refresh) always stats
+ * its inode object to find out whether its log has grown. When this option is
+ * enabled, cached directories register a watch on their inode objects and
+ * every change to a directory's log done through this Filesystem sends a
+ * notification to its watchers, so cached directories are only read again
+ * when they are notified. This also detects compactions that result in a log
+ * with the same size as before.
+ *
+ * @note All the clients that change the directories need to have this option
+ *       enabled, otherwise their changes will not be seen in the watched
+ *       directories.
+ *
+ * @param watch whether to watch the cached directories.
+ */
+void
+Filesystem::setDirCacheWatch(bool watch)
+{
+  mPriv->setDirCacheWatch(watch);
+}
+
+/**
+ * Gets whether cached directories are watched for changes.
+ * @see Filesystem::setDirCacheWatch
+ * @return true if cached directories are watched, false otherwise.
+ */
+bool
+Filesystem::dirCacheWatch(void) const
+{
+  return mPriv->dirCacheWatch;
+}
+
+/**
+ * Sets whether Dir::find should check the names and metadata of the entries
+ * on the OSDs.
+ *
+ * When this option is enabled, the name and metadata (\b mtd) arguments of a
+ * find operation are evaluated by the \b radosfs object class, on the OSD that
+ * holds each directory's log, so only the matching entries and the
+ * subdirectories are sent to the client instead of the whole log. The other
+ * arguments are still checked by the client.
+ *
+ * @note The object class (libcls_radosfs.so) has to be installed and loaded in
+ *       the OSDs. If it is not available, the option is disabled the first
+ *       time a find operation tries to use it.
+ *
+ * @param serverSide whether to check the entries on the OSDs.
+ */
+void
+Filesystem::setDirServerSideFind(bool serverSide)
+{
+  mPriv->dirServerSideFind = serverSide;
+}
+
+/**
+ * Gets whether Dir::find checks the names and metadata of the entries on the
+ * OSDs.
+ * @see Filesystem::setDirServerSideFind
+ * @return true if the entries are checked on the OSDs, false otherwise.
+ */
+bool
+Filesystem::dirServerSideFind(void) const
+{
+  return mPriv->dirServerSideFind;
+}
+
+/**
+ * Gets whether cached directories are compacted in the background.
+ * @see Filesystem::setDirBackgroundCompaction
+ * @return true if directories are compacted in the background, false
+ *         otherwise.
+ */
+bool
+Filesystem::dirBackgroundCompaction(void) const
+{
+  return mPriv->dirBackgroundCompaction;
+}
+
+/**
+ * Sets the maximum number of directories being compacted in the background at
+ * a time. Directories are checked every second and the ones with the lowest
+ * *compact ratio* are compacted first.
+ *
+ * @param numCompactions the maximum number of simultaneous background
+ *        compactions (it cannot be lower than 1).
+ */
+void
+Filesystem::setDirCompactionsPerInterval(size_t numCompactions)
+{
+  mPriv->dirCompactionsPerInterval = std::max(numCompactions, (size_t) 1);
+}
+
+/**
+ * Gets the maximum number of directories being compacted in the background at
+ * a time.
+ * @see Filesystem::setDirCompactionsPerInterval
+ * @return the maximum number of simultaneous background compactions.
+ */
+size_t
+Filesystem::dirCompactionsPerInterval(void) const
+{
+  return mPriv->dirCompactionsPerInterval;
+}
+
+/**
+ * Sets the maximum number of directory paths whose inodes are cached.
+ *
+ * Translating a directory path into its inode requires reading the path's
+ * object, so the inodes that were found are kept in a cache (split into shards
+ * by path) and the least recently used ones are dropped when the cache goes
+ * over this number of entries.
+ *
+ * @param maxEntries the maximum number of cached directory inodes.
+ */
+void
+Filesystem::setDirInodeCacheMaxEntries(size_t maxEntries)
+{
+  mPriv->dirInodeCache.setMaxEntries(maxEntries);
+}
+
+/**
+ * Gets the maximum number of directory paths whose inodes are cached.
+ * @see Filesystem::setDirInodeCacheMaxEntries
+ * @return the maximum number of cached directory inodes.
+ */
+size_t
+Filesystem::dirInodeCacheMaxEntries(void) const
+{
+  return mPriv->dirInodeCache.maxEntries();
+}
+
+/**
+ * Sets for how long the directory paths that were not found are remembered.
+ *
+ * While a path is remembered as not existing, looking up its inode fails with
+ * -ENOENT without contacting the cluster. Directories created by this
+ * Filesystem instance clear that information right away but the ones created
+ * by other clients will only be seen once it expires, so this is disabled
+ * (set to 0) by default.
+ *
+ * @param seconds the number of seconds during which a missing directory is
+ *        remembered (0 disables it).
+ */
+void
+Filesystem::setDirInodeNegativeCacheTtl(double seconds)
+{
+  mPriv->dirInodeCache.setNegativeTtl(seconds);
 }
 
 /**
- * Gets the maximum size of files for the given data pool.
- * @param pool the name of the data pool from which to get the size.
- * @return the maximum size of files for the given data pool.
+ * Gets for how long the directory paths that were not found are remembered.
+ * @see Filesystem::setDirInodeNegativeCacheTtl
+ * @return the number of seconds during which a missing directory is
+ *         remembered.
  */
-ssize_t
-Filesystem::dataPoolSize(const std::string &pool) const
+double
+Filesystem::dirInodeNegativeCacheTtl(void) const
 {
-  ssize_t size = -ENOENT;
-  boost::unique_lock<boost::mutex> lock(mPriv->poolMutex);
-
-  PoolListMap::const_iterator it;
-  for (it = mPriv->poolMap.begin(); it != mPriv->poolMap.end(); it++)
-  {
-    const PoolList &pools = (*it).second;
-    PoolList::const_iterator poolIt;
-
-    for (poolIt = pools.begin(); poolIt != pools.end(); poolIt++)
-    {
-      if ((*poolIt)->name == pool)
-      {
-        size = (*poolIt)->size;
-        break;
-      }
-    }
-
-    if (size >= 0)
-      break;
-  }
-
-  return size;
+  return mPriv->dirInodeCache.negativeTtl();
 }
 
 /**
- * Sets a pool to be used for the metadata associated with the given \a prefix.
- * Directory objects whose path prefixes match the one set by this method will
- * have their data stored in the mapped pool.
+ * Sets for how long the result of statting a path is cached.
  *
- * @note Keep in mind this method does not create the pool in the cluster so it
- *       needs to already exist beforehand.
- * @param name the name of the pool in the cluster.
- * @param prefix the prefix of the paths that is associated with this pool.
- * @return 0 on success, an error code otherwise.
+ * When this is set to a value greater than 0, successful stats are kept for up
+ * to the given number of seconds and statting the same path again in that
+ * period does not contact the cluster. The changes done through this
+ * Filesystem instance (chmod, chown, rename, remove, truncate) invalidate the
+ * affected paths right away but changes done by other clients will only be
+ * seen once the cached stat expires, so the cache is disabled (set to 0) by
+ * default.
+ *
+ * @param seconds the number of seconds during which a stat is cached (0
+ *        disables the cache and drops the currently cached stats).
  */
-int
-Filesystem::addMetadataPool(const std::string &name, const std::string &prefix)
+void
+Filesystem::setStatCacheTtl(double seconds)
 {
-  return mPriv->addPool(name,
-                        prefix,
-                        &mPriv->mtdPoolMap,
-                        mPriv->mtdPoolMutex);
+  mPriv->statCache.setTtl(seconds);
 }
 
 /**
- * Removes a metadata pool.
- *
- * @note As with Filesystem::addMetadataPool , this method does not affect the
- *       cluster itself which means that the pool will not be deleted from it
- *       but rather disassociated from the prefix to which it was previously set.
- * @param name the name of the metadata pool to remove.
- * @return 0 on success, an error code otherwise.
+ * Gets for how long the result of statting a path is cached.
+ * @see Filesystem::setStatCacheTtl
+ * @return the number of seconds during which a stat is cached.
  */
-int
-Filesystem::removeMetadataPool(const std::string &name)
+double
+Filesystem::statCacheTtl(void) const
 {
-  return mPriv->removePool(name, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+  return mPriv->statCache.ttl();
 }
 
 /**
- * Gets all the metadata pools.
- * @return A vector with the names of the metadata pools.
+ * Sets the maximum number of paths whose stats are cached. When the cache goes
+ * over this number, the least recently used paths are dropped.
+ *
+ * @see Filesystem::setStatCacheTtl
+ * @param maxEntries the maximum number of cached paths.
  */
-std::vector<std::string>
-Filesystem::metadataPools() const
+void
+Filesystem::setStatCacheMaxEntries(size_t maxEntries)
 {
-  return mPriv->pools(&mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+  mPriv->statCache.setMaxEntries(maxEntries);
 }
 
 /**
- * Gets the prefix associated with the given metadata pool.
- * @param pool a pool's name associated with a prefix.
- * @return The prefix associated with the given data pool.
+ * Gets the maximum number of paths whose stats are cached.
+ * @see Filesystem::setStatCacheMaxEntries
+ * @return the maximum number of cached paths.
  */
-std::string
-Filesystem::metadataPoolPrefix(const std::string &pool) const
+size_t
+Filesystem::statCacheMaxEntries(void) const
 {
-  return mPriv->poolPrefix(pool, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+  return mPriv->statCache.maxEntries();
 }
 
 /**
- * Gets the pool associated with the given \a prefix. (Does the opposite of
- * Filesystem::metadataPoolPrefix).
- * @param prefix a prefix associated with a metadata pool.
- * @return the name of the pool associated with the given
+ * Gets the number of stats that were served from the stat cache.
+ * @see Filesystem::setStatCacheTtl
+ * @return the number of stat cache hits.
  */
-std::string
-Filesystem::metadataPoolFromPrefix(const std::string &prefix) const
+uint64_t
+Filesystem::statCacheHits(void) const
 {
-  return mPriv->poolFromPrefix(prefix, &mPriv->mtdPoolMap, mPriv->mtdPoolMutex);
+  return mPriv->statCache.hits();
 }
 
 /**
- * Sets the \b uid and \b gid . The \b uid and \b gid are thread local and will
- * be used for any subsequent operations that require checking permissions.
- * @param uid the uid to be set.
- * @param gid the gid to be set.
+ * Gets the number of stats that could not be served from the stat cache
+ * (while it was enabled).
+ * @see Filesystem::setStatCacheTtl
+ * @return the number of stat cache misses.
  */
-void
-Filesystem::setIds(uid_t uid, gid_t gid)
+uint64_t
+Filesystem::statCacheMisses(void) const
 {
-  mPriv->setUid(uid);
-  mPriv->setGid(gid);
+  return mPriv->statCache.misses();
 }
 
 /**
- * Gets the current \b uid and \b gid values and sets them in the given \a uid
- * and \a gid.
- * @param[out] uid the location in which the uid will be set.
- * @param[out] gid the location in which the gid will be set.
+ * Sets the log level to be used.
+ * @param level the new log level.
  */
 void
-Filesystem::getIds(uid_t *uid, gid_t *gid) const
+Filesystem::setLogLevel(const Filesystem::LogLevel level)
 {
-  *uid = mPriv->getUid();
-  *gid = mPriv->getGid();
+  mPriv->logger.setLogLevel(level);
 }
 
 /**
- * Gets the current \b uid value.
- * @return the \b uid currently set.
+ * @enum Filesystem::LogLevel
+ *
+ * The possible values for setting the log level.
+ *
+ * @var Filesystem::LogLevel Filesystem::LOG_LEVEL_NONE
+ *      Turns off debug messages (nothing will be printed).
+ *
+ * @var Filesystem::LogLevel Filesystem::LOG_LEVEL_DEBUG
+ *      Turns on debug messages (prints all debug messages).
  */
-uid_t
-Filesystem::uid(void) const
-{
-  return mPriv->uid;
-}
 
 /**
- * Gets the current \b gid value.
- * @return the \b gid currently set.
+ * Gets the log level in use.
  */
-gid_t
-Filesystem::gid(void) const
+Filesystem::LogLevel
+Filesystem::logLevel(void) const
 {
-  return mPriv->gid;
+  return mPriv->logger.logLevel();
 }
 
 /**
- * Stats the given \a paths in parallel.
+ * @enum Filesystem::LogCategory
  *
- * Paths are statted in parallel not in to the worker threads that will
- * parallelize the operations from the client side but, in case they have the
- * same parent, they may be also statted in parallel on the cluster side. This
- * makes it ideal for e.g. statting all the entries in a directory as all the
- * files present in the directory will be statted in one go.
+ * The categories of the debug messages of hot paths, which can be logged on
+ * their own and be rate-limited or sampled.
  *
- * @param paths a vector of paths to files or directories.
- * @return a vector of pairs with the result of the stat operation over the
- *         paths. Each pair contains the operation's return code (0 on success,
- *         an error code otherwise) and a \b stat struct with the details of the
- *         stat operation.
+ * @var Filesystem::LogCategory Filesystem::LOG_CATEGORY_GENERAL
+ *      Every message that does not belong to the other categories.
+ *
+ * @var Filesystem::LogCategory Filesystem::LOG_CATEGORY_LOCKS
+ *      Acquiring, keeping and releasing the files' locks.
+ *
+ * @var Filesystem::LogCategory Filesystem::LOG_CATEGORY_CHUNKS
+ *      Writing and reading the files' chunks.
+ *
+ * @var Filesystem::LogCategory Filesystem::LOG_CATEGORY_DIR_CACHE
+ *      Reading and watching the directories' logs.
  */
-std::vector<std::pair<int, struct stat> >
-Filesystem::stat(const std::vector<std::string> &paths)
+
+/**
+ * Sets whether the debug messages of a category are logged even if the log
+ * level is Filesystem::LOG_LEVEL_NONE. This allows to debug a single subsystem
+ * without the cost of logging every message.
+ *
+ * @note As the log level, the categories' settings apply to every Filesystem
+ *       instance in the process.
+ * @param category the category.
+ * @param enabled whether to log the category's messages.
+ */
+void
+Filesystem::setLogCategoryEnabled(LogCategory category, bool enabled)
 {
-  std::map<std::string, std::pair<int, Stat> > stats =
-      mPriv->stat(paths);
+  Logger::setCategoryEnabled(category, enabled);
+}
 
-  std::vector<std::pair<int, struct stat> > results;
-  for (size_t i = 0; i < paths.size(); i++)
-  {
-    const std::string &path = paths[i];
-    const std::pair<int, Stat> &statResult = stats[path];
-    std::pair<int, struct stat> retResult(statResult.first,
-                                          statResult.second.statBuff);
-    results.push_back(retResult);
-  }
+/**
+ * Gets whether the debug messages of a category are logged regardless of the
+ * log level.
+ * @see Filesystem::setLogCategoryEnabled
+ * @param category the category.
+ * @return whether the category's messages are logged.
+ */
+bool
+Filesystem::logCategoryEnabled(LogCategory category) const
+{
+  return Logger::categoryEnabled(category);
+}
 
-  return results;
+/**
+ * Sets the maximum number of debug messages of a category that are logged per
+ * second. The messages over the limit are discarded and how many there were
+ * is logged instead.
+ * @param category the category.
+ * @param messagesPerSecond the maximum number of messages per second, or 0 for
+ *        no limit (the default).
+ */
+void
+Filesystem::setLogCategoryRateLimit(LogCategory category,
+                                    size_t messagesPerSecond)
+{
+  Logger::setCategoryRateLimit(category, messagesPerSecond);
 }
 
 /**
- * Stats the given \a path and fills the details in the given \a stat parameter.
- * @param path the path to be statted.
- * @param[out] buff the struct to be filled with the stat details.
- * @return 0 if the path was successfully statted, an error code
- *         otherwise.
+ * Gets the maximum number of debug messages of a category that are logged per
+ * second.
+ * @see Filesystem::setLogCategoryRateLimit
+ * @param category the category.
+ * @return the maximum number of messages per second, or 0 if there is no
+ *         limit.
  */
-int
-Filesystem::stat(const std::string &path, struct stat *buff)
+size_t
+Filesystem::logCategoryRateLimit(LogCategory category) const
 {
-  int ret = -ENOENT;
+  return Logger::categoryRateLimit(category);
+}
 
-  const std::string &sanitizedPath = sanitizePath(path);
+/**
+ * Sets the ratio of the debug messages of a category that are logged.
+ * @param category the category.
+ * @param rate the ratio of messages to log, from 0 to 1 (every message, the
+ *        default).
+ */
+void
+Filesystem::setLogCategorySampleRate(LogCategory category, double rate)
+{
+  Logger::setCategorySampleRate(category, rate);
+}
 
-  if (isDirPath(sanitizedPath))
-  {
-    Dir dir(this, sanitizedPath);
+/**
+ * Gets the ratio of the debug messages of a category that are logged.
+ * @see Filesystem::setLogCategorySampleRate
+ * @param category the category.
+ * @return the ratio of messages that are logged.
+ */
+double
+Filesystem::logCategorySampleRate(LogCategory category) const
+{
+  return Logger::categorySampleRate(category);
+}
 
-    ret = dir.stat(buff);
-  }
+/**
+ * Sets the file stripe size to be used by default.
+ * @param size the stripe size (in bytes).
+ */
+void
+Filesystem::setFileChunkSize(const size_t size)
+{
+  size_t realSize = size;
 
-  if (ret != 0)
+  if (size == 0)
   {
-    File file(this, sanitizedPath, File::MODE_READ);
-
-    ret = file.stat(buff);
+    realSize = 1;
+    radosfs_debug("Cannot set the file chunk size as 0. Setting to %d.",
+                  realSize);
   }
 
-  return ret;
+  mPriv->fileChunkSize = realSize;
 }
 
 /**
- * Gets the list of all the pools in the configured cluster.
- * @return A vector with the name of all the pools in the configured cluster.
+ * Gets the default file stripe size.
+ * @return the file stripe size.
  */
-std::vector<std::string>
-Filesystem::allPoolsInCluster() const
+size_t
+Filesystem::fileChunkSize(void) const
 {
-  std::vector<std::string> poolVector;
-  std::list<std::string> poolList;
+  return mPriv->fileChunkSize;
+}
 
-  mPriv->radosCluster.pool_list(poolList);
-  poolVector.insert(poolVector.begin(), poolList.begin(), poolList.end());
+/**
+ * Sets over how many data pools the chunks of new files are striped. When
+ * \a numPools is greater than 1, the chunks of files created from then on are
+ * distributed in a round-robin way over the file's data pool and the next
+ * ones configured for the same prefix (see Filesystem::addDataPool), so the
+ * reads and writes of a single big file are spread over all of them. The
+ * pools a file is striped over are recorded when it is created, so changing
+ * this does not affect existing files.
+ *
+ * @note Only the pools with the same alignment as the file's pool are used.
+ * @param numPools the maximum number of pools to stripe each file over (1, the
+ *        default, means no striping).
+ */
+void
+Filesystem::setFileStripeWidth(size_t numPools)
+{
+  mPriv->fileStripeWidth = std::max(numPools, (size_t) 1);
+}
 
-  return poolVector;
+/**
+ * Gets over how many data pools the chunks of new files are striped.
+ * @see Filesystem::setFileStripeWidth
+ * @return the maximum number of pools each new file is striped over.
+ */
+size_t
+Filesystem::fileStripeWidth(void) const
+{
+  return mPriv->fileStripeWidth;
 }
 
 /**
- * Stats the currently configured cluster. The space related values are returned
- * in KB.
- * @param[out] totalSpaceKb the location in which to return the total space.
- * @param[out] usedSpaceKb the location in which to return the used space.
- * @param[out] availableSpaceKb the location in which to return the available
- *             space.
- * @param[out] numberOfObjects  the location in which to return the number of
- *             objects.
- * @return 0 on success, an error code otherwise.
+ * Sets the range of chunk sizes for the files created under the given \a
+ * prefix (the longest prefix with a policy applies). Files created with a
+ * size hint (see File::create) get a chunk size that splits that size in
+ * about FILE_ADAPTIVE_CHUNKS_PER_FILE chunks, kept within this range, while
+ * files without a hint get the default chunk size (see
+ * Filesystem::setFileChunkSize), also kept within the range. Files created
+ * with an explicit chunk size are not affected.
+ *
+ * Without any policy, the chunk size picked from a size hint is kept between
+ * FILE_MIN_ADAPTIVE_CHUNK_SIZE and the default chunk size.
+ *
+ * @note The chunk size is recorded when a file is created, so policies only
+ *       affect files created after they are set.
+ * @param prefix the prefix of the paths the policy is applied to.
+ * @param minChunkSize the smallest chunk size for the files (in bytes).
+ * @param maxChunkSize the largest chunk size for the files (in bytes).
+ * @return 0 on success, -EINVAL if the sizes are not a valid range.
  */
 int
-Filesystem::statCluster(uint64_t *totalSpaceKb, uint64_t *usedSpaceKb,
-                        uint64_t *availableSpaceKb, uint64_t *numberOfObjects)
+Filesystem::setFileChunkSizePolicy(const std::string &prefix,
+                                   size_t minChunkSize, size_t maxChunkSize)
 {
-  int ret;
-  librados::cluster_stat_t clusterStat;
+  if (minChunkSize == 0 || minChunkSize > maxChunkSize)
+    return -EINVAL;
 
-  ret = mPriv->radosCluster.cluster_stat(clusterStat);
+  ChunkSizePolicy policy;
+  policy.minChunkSize = minChunkSize;
+  policy.maxChunkSize = maxChunkSize;
 
-  if (ret != 0)
-    return ret;
+  boost::unique_lock<boost::mutex> lock(mPriv->chunkSizePoliciesMutex);
+  mPriv->chunkSizePolicies[getDirPath(prefix)] = policy;
 
-  if (totalSpaceKb)
-    *totalSpaceKb = clusterStat.kb;
+  return 0;
+}
 
-  if (usedSpaceKb)
-    *usedSpaceKb = clusterStat.kb_used;
+/**
+ * Removes the chunk size policy of the given \a prefix.
+ * @see Filesystem::setFileChunkSizePolicy
+ * @param prefix the prefix the policy was set for.
+ * @return 0 on success, -ENOENT if there is no policy for the \a prefix.
+ */
+int
+Filesystem::removeFileChunkSizePolicy(const std::string &prefix)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->chunkSizePoliciesMutex);
 
-  if (availableSpaceKb)
-    *availableSpaceKb = clusterStat.kb_avail;
+  if (mPriv->chunkSizePolicies.erase(getDirPath(prefix)) == 0)
+    return -ENOENT;
 
-  if (numberOfObjects)
-    *numberOfObjects = clusterStat.num_objects;
+  return 0;
+}
+
+/**
+ * Sets whether the chunks of the files created under the given \a prefix are
+ * compressed (the longest prefix that was set applies, so compression can be
+ * disabled for a subdirectory of a compressed one). Compressed chunks are
+ * split in blocks of FILE_COMPRESSION_BLOCK_SIZE bytes that are compressed
+ * independently, and their layout is kept in the chunks' xattrs, so reads
+ * only decompress the blocks they need. Chunks that do not compress well are
+ * kept as they are.
+ *
+ * @note Whether a file is compressed is recorded when it is created, so this
+ *       only affects files created after it is set, and any client can read
+ *       the files that were compressed.
+ * @note Like in aligned pools, writes that do not cover whole chunks of
+ *       compressed files need to read and rewrite the chunks. Setting a
+ *       write-behind buffer (see Filesystem::setFileWriteBehindSize) lets the
+ *       small writes be accumulated first.
+ * @param prefix the prefix of the paths the setting is applied to.
+ * @param compress whether to compress the files' chunks.
+ */
+void
+Filesystem::setFileCompression(const std::string &prefix, bool compress)
+{
+  boost::unique_lock<boost::mutex> lock(mPriv->compressionPrefixesMutex);
+  mPriv->compressionPrefixes[getDirPath(prefix)] = compress;
+}
 
-  return ret;
+/**
+ * Returns whether the chunks of a new file created in the given \a path would
+ * be compressed.
+ * @see Filesystem::setFileCompression
+ * @param path the path of a file.
+ * @return whether the file's chunks would be compressed.
+ */
+bool
+Filesystem::fileCompression(const std::string &path) const
+{
+  return mPriv->shouldCompress(path);
 }
 
 /**
- * Sets an xattribute in the given \a path .
- * @param path a path to a file or directory.
- * @param attrName the name of the xattribute.
- * @param value the value of the xattribute.
- * @return 0 on success, an error code otherwise.
+ * Sets the size of the write-behind buffer used for files. When this size is
+ * greater than 0, small writes are kept in memory (merging adjacent and
+ * overlapping ones) and are only written to the cluster when the buffered data
+ * reaches \a size bytes, when the file is synced or read, or when no other
+ * writes are done to it for a short period of time.
+ *
+ * @note The new size only affects files that are opened after this call.
+ * @note Writes that affect a file's inline buffer always skip the write-behind
+ *       buffer. When it is enabled, writes to pools that require alignment are
+ *       buffered until they cover whole chunks (or up to the size of a couple
+ *       of chunks, or this \a size if it is bigger) in order to avoid
+ *       rewriting the chunks for every partial write.
+ * @param size the size of the write-behind buffer (in bytes) or 0 to disable
+ *        it (the default).
  */
-int
-Filesystem::setXAttr(const std::string &path, const std::string &attrName,
-                     const std::string &value)
+void
+Filesystem::setFileWriteBehindSize(const size_t size)
 {
-  Stat stat;
+  mPriv->fileWriteBehindSize = size;
+}
 
-  int ret = mPriv->stat(path, &stat);
+/**
+ * Gets the size of the write-behind buffer used for files.
+ * @return the size of the write-behind buffer (in bytes) or 0 if it is
+ *         disabled.
+ */
+size_t
+Filesystem::fileWriteBehindSize(void) const
+{
+  return mPriv->fileWriteBehindSize;
+}
 
-  if (ret != 0)
-    return ret;
+/**
+ * Sets for how long the size of a file can be cached before it has to be read
+ * again from the cluster. Regardless of this value, the size is always cached
+ * while the file is exclusively locked by this client (as no other client can
+ * change it meanwhile).
+ *
+ * @note The new value only affects files that are opened after this call.
+ * @param seconds the maximum age of a cached file size (in seconds) or 0 to
+ *        always read it from the cluster when not locked (the default).
+ */
+void
+Filesystem::setFileSizeCacheStaleness(double seconds)
+{
+  mPriv->fileSizeCacheStaleness = seconds;
+}
 
-  if (S_ISLNK(stat.statBuff.st_mode))
-    return setXAttr(stat.translatedPath, attrName, value);
+/**
+ * Gets for how long the size of a file can be cached.
+ * @return the maximum age of a cached file size (in seconds) or 0 if it is only
+ *         cached while the file is exclusively locked.
+ */
+double
+Filesystem::fileSizeCacheStaleness(void) const
+{
+  return mPriv->fileSizeCacheStaleness;
+}
 
-  if (!stat.pool)
-    return -ENODEV;
+/**
+ * Sets whether files that are read sequentially with File::read should have
+ * the data that follows each read read ahead asynchronously, so the next reads
+ * can be served from memory. This uses up to 16 MB of memory per file being
+ * read.
+ *
+ * @note The new value only affects files that are opened after this call.
+ * @param readAhead whether to read ahead (disabled by default).
+ */
+void
+Filesystem::setFileReadAhead(bool readAhead)
+{
+  mPriv->fileReadAhead = readAhead;
+}
 
-  return setXAttrFromPath(stat, uid(), gid(), attrName, value);
+/**
+ * Gets whether files that are read sequentially are read ahead.
+ * @return true if they are read ahead, false otherwise.
+ */
+bool
+Filesystem::fileReadAhead(void) const
+{
+  return mPriv->fileReadAhead;
 }
 
 /**
- * Gets an xattribute from the given \a path .
- * @param path a path to a file or directory.
- * @param attrName the name of the xattribute.
- * @param[out] value the variable to receive the value of the xattribute.
- * @return 0 on success, an error code otherwise.
+ * Sets the maximum number of chunk removals that are kept in flight when a
+ * file is removed or truncated.
+ *
+ * @note The new value only affects files that are opened after this call.
+ * @param window the maximum number of removals in flight (at least 1 is
+ *        always used).
  */
-int
-Filesystem::getXAttr(const std::string &path, const std::string &attrName,
-                     std::string &value)
+void
+Filesystem::setFileChunkRemovalWindow(size_t window)
 {
-  Stat stat;
+  mPriv->fileChunkRemovalWindow = window;
+}
 
-  int ret = mPriv->stat(path, &stat);
+/**
+ * Gets the maximum number of chunk removals that are kept in flight when a
+ * file is removed or truncated.
+ * @return the maximum number of removals in flight.
+ */
+size_t
+Filesystem::fileChunkRemovalWindow(void) const
+{
+  return mPriv->fileChunkRemovalWindow;
+}
 
-  if (ret != 0)
-    return ret;
+/**
+ * Sets whether the files that are removed while still in use by other File
+ * instances (and thus are only really removed when the last of those instances
+ * is released) should have their chunks removed in a background thread.
+ * Otherwise, the removal blocks the release of the last instance.
+ *
+ * @param background whether to remove those files' chunks in the background.
+ */
+void
+Filesystem::setFileBackgroundLazyRemoval(bool background)
+{
+  mPriv->fileBackgroundLazyRemoval = background;
+}
 
-  if (S_ISLNK(stat.statBuff.st_mode))
-    return getXAttr(stat.translatedPath, attrName, value);
+/**
+ * Gets whether the files that are removed while still in use are removed in
+ * the background.
+ * @return true if they are removed in the background, false otherwise.
+ */
+bool
+Filesystem::fileBackgroundLazyRemoval(void) const
+{
+  return mPriv->fileBackgroundLazyRemoval;
+}
 
-  if (!stat.pool)
-    return -ENODEV;
+/**
+ * Sets the maximum size of the cache of file chunks. This cache is shared by
+ * all the files in this filesystem instance and keeps the most recently read
+ * chunks in memory, so reading them again (even from different File instances)
+ * does not need to go to the cluster. Local writes, truncates and removals of a
+ * file discard its cached chunks.
+ *
+ * @note Only chunks whose size is at most a quarter of the cache size are
+ *       cached.
+ * @param size the maximum size of the cache (in bytes) or 0 to disable it (the
+ *        default).
+ */
+void
+Filesystem::setFileChunkCacheSize(size_t size)
+{
+  mPriv->chunkCache.setMaxSize(size);
+}
 
-  return getXAttrFromPath(stat.pool->ioctx, stat.statBuff, uid(), gid(),
-                          stat.translatedPath, attrName, value);
+/**
+ * Gets the maximum size of the cache of file chunks.
+ * @return the maximum size of the cache (in bytes) or 0 if it is disabled.
+ */
+size_t
+Filesystem::fileChunkCacheSize(void) const
+{
+  return mPriv->chunkCache.maxSize();
 }
 
 /**
- * Removes an xattribute from a given \a path .
- * @param path a path to a file or directory.
- * @param attrName the name of the xattribute.
- * @return 0 on success, an error code otherwise.
+ * Sets for how long a chunk can be kept in the chunk cache. Since the chunks
+ * may be changed by other clients, this sets the maximum time that a read may
+ * return outdated data.
+ *
+ * @param seconds the time (in seconds) that chunks are kept in the cache.
  */
-int
-Filesystem::removeXAttr(const std::string &path, const std::string &attrName)
+void
+Filesystem::setFileChunkCacheTtl(double seconds)
 {
-  Stat stat;
+  mPriv->chunkCache.setTtl(seconds);
+}
 
-  int ret = mPriv->stat(path, &stat);
+/**
+ * Gets for how long a chunk can be kept in the chunk cache.
+ * @return the time (in seconds) that chunks are kept in the cache.
+ */
+double
+Filesystem::fileChunkCacheTtl(void) const
+{
+  return mPriv->chunkCache.ttl();
+}
 
-  if (ret != 0)
-    return ret;
+/**
+ * Sets the interval during which the updates to the current sizes of quotas
+ * are accumulated in memory before being written to the quotas' objects.
+ *
+ * By default, each call to Quota::updateCurrentSize (or its user/group
+ * variants) writes to the quota object right away, which for files under the
+ * same quota means they all keep writing to the same object. When an interval
+ * is set, the differences are instead added up per quota (and per user/group)
+ * and written together in a single operation once the interval expires, or as
+ * soon as any of them reaches the size set with
+ * Filesystem::setQuotaUpdateMaxPendingSize.
+ *
+ * @note The quotas' objects (and thus other clients) can be behind by at most
+ *       the interval (plus the time the background checks take to run; see
+ *       FILE_OPS_IDLE_CHECKER_SLEEP). The quotas this instance loads or sets
+ *       (Quota::update, Quota::setQuotaSizes), as well as the destruction of
+ *       this Filesystem instance, write the accumulated sizes first.
+ * @param seconds the interval in seconds, or 0 to write the updates right away
+ *        (the default), in which case the updates accumulated so far are
+ *        written.
+ */
+void
+Filesystem::setQuotaUpdateInterval(double seconds)
+{
+  mPriv->quotaUpdateInterval = std::max(seconds, 0.0);
 
-  if (S_ISLNK(stat.statBuff.st_mode))
-    return removeXAttr(stat.translatedPath, attrName);
+  if (seconds <= 0)
+    mPriv->flushAllQuotaDeltas();
+}
 
-  if (!stat.pool)
-    return -ENODEV;
+/**
+ * Gets the interval during which the updates to the current sizes of quotas
+ * are accumulated.
+ * @see Filesystem::setQuotaUpdateInterval
+ * @return the interval in seconds, or 0 if the updates are written right away.
+ */
+double
+Filesystem::quotaUpdateInterval(void) const
+{
+  return mPriv->quotaUpdateInterval;
+}
 
-  return removeXAttrFromPath(stat.pool->ioctx, stat.statBuff, uid(), gid(),
-                             stat.translatedPath, attrName);
+/**
+ * Sets how big the accumulated difference to a quota's current size (or to
+ * one of its users' or groups' ones) can get before it is written, regardless
+ * of the quota update interval.
+ * @see Filesystem::setQuotaUpdateInterval
+ * @param size the maximum size (in bytes) or 0 to only write the updates when
+ *        the interval expires.
+ */
+void
+Filesystem::setQuotaUpdateMaxPendingSize(uint64_t size)
+{
+  mPriv->quotaUpdateMaxPendingSize = size;
 }
 
 /**
- * Gets a map of all the xattributes set in the given \a path.
- * @param path a path to a file or directory.
- * @param[out] map the map into which the xattributes will be set.
- * @return 0 on success, an error code otherwise.
+ * Gets how big the accumulated difference to a quota's current size can get
+ * before it is written.
+ * @see Filesystem::setQuotaUpdateMaxPendingSize
+ * @return the maximum size (in bytes) or 0 if there is no such limit.
  */
-int
-Filesystem::getXAttrsMap(const std::string &path,
-                         std::map<std::string, std::string> &map)
+uint64_t
+Filesystem::quotaUpdateMaxPendingSize(void) const
 {
-  Stat stat;
+  return mPriv->quotaUpdateMaxPendingSize;
+}
 
-  int ret = mPriv->stat(path, &stat);
+/**
+ * Gets the metrics about the operations this instance has done: for each
+ * kind of operation (stat, create, write, read, lock, dir_log_read,
+ * dir_compaction, quota_update), how many were done, how many failed and
+ * how long they took, as well as a number of counters (bytes written and
+ * read, lock retries, bytes of directory logs parsed, directory cache hits
+ * and misses, inline buffer write conflicts, etc.).
+ *
+ * @note The metrics are always collected: each thread keeps its own counters
+ *       so that recording in them does not need any locking, and they are
+ *       only added up when calling this method.
+ * @return the metrics since this instance was created (or since
+ *         Filesystem::resetMetrics was last called).
+ */
+FilesystemMetrics
+Filesystem::metrics(void) const
+{
+  FilesystemMetrics fsMetrics;
+  mPriv->getMetrics(fsMetrics);
 
-  if (ret != 0)
-    return ret;
+  return fsMetrics;
+}
 
-  if (S_ISLNK(stat.statBuff.st_mode))
-    return getXAttrsMap(stat.translatedPath, map);
+/**
+ * Resets the metrics about the operations (Filesystem::metrics will only
+ * count those done from now on). Counters that reflect the current state,
+ * like the number of entries in the directory cache, are not affected.
+ */
+void
+Filesystem::resetMetrics(void)
+{
+  mPriv->metrics.reset();
+}
 
-  if (!stat.pool)
-    return -ENODEV;
+/**
+ * Sets the interval at which the metrics (see Filesystem::metrics) are dumped,
+ * in one line, to the file set with Filesystem::setMetricsDumpPath (or to the
+ * debug log if no file is set).
+ * @param seconds the interval in seconds, or 0 not to dump the metrics (the
+ *        default).
+ */
+void
+Filesystem::setMetricsDumpInterval(double seconds)
+{
+  mPriv->metricsDumpInterval = std::max(seconds, 0.0);
+}
 
-  return getMapOfXAttrFromPath(stat.pool->ioctx, stat.statBuff, uid(), gid(),
-                               stat.translatedPath, map);
+/**
+ * Gets the interval at which the metrics are dumped.
+ * @see Filesystem::setMetricsDumpInterval
+ * @return the interval in seconds, or 0 if the metrics are not dumped.
+ */
+double
+Filesystem::metricsDumpInterval(void) const
+{
+  return mPriv->metricsDumpInterval;
 }
 
 /**
- * Sets the maximum size of the directory cache.
- * @param size the size to set.
+ * Sets the file to which the metrics are appended when they are periodically
+ * dumped (see Filesystem::setMetricsDumpInterval). Each line starts with the
+ * time of the dump in seconds since the Epoch.
+ * @param path the path to a local file, or an empty string to dump the
+ *        metrics to the debug log instead.
  */
 void
-Filesystem::setDirCacheMaxSize(size_t size)
+Filesystem::setMetricsDumpPath(const std::string &path)
 {
-  mPriv->dirCache.maxCacheSize = size;
-  mPriv->dirCache.adjustCache();
+  boost::unique_lock<boost::mutex> lock(mPriv->metricsDumpMutex);
+  mPriv->metricsDumpPath = path;
 }
 
 /**
- * Gets the maximum size of the directory cache.
- * @return the maximum size of the directory cache.
+ * Gets the file to which the metrics are dumped.
+ * @see Filesystem::setMetricsDumpPath
+ * @return the path to the file, or an empty string if the metrics are dumped
+ *         to the debug log.
  */
-size_t
-Filesystem::dirCacheMaxSize(void) const
+std::string
+Filesystem::metricsDumpPath(void) const
 {
-  return mPriv->dirCache.maxCacheSize;
+  boost::unique_lock<boost::mutex> lock(mPriv->metricsDumpMutex);
+  return mPriv->metricsDumpPath;
 }
 
 /**
- * Sets the directory compaction ratio.
- * @param ratio the ratio to set.
+ * Sets the ratio of operations that are traced. For each traced operation,
+ * spans are recorded for its stages: e.g. for a write, the time it was queued,
+ * waiting for the lock, setting the size, submitting and completing each
+ * chunk's write and calling its callback. Stats, file and directory creations
+ * and the indexing of entries in directories are traced as well.
+ *
+ * @note Operations that are started while tracing another one are always
+ *       traced as part of it.
+ * @see Filesystem::exportTrace
+ * @param rate the ratio of operations to trace, from 0 (no tracing, the
+ *        default) to 1 (every operation).
  */
 void
-Filesystem::setDirCompactRatio(float ratio)
+Filesystem::setTraceSampleRate(double rate)
 {
-  mPriv->dirCompactRatio = ratio;
+  mPriv->tracer.setSampleRate(rate);
 }
 
 /**
- * Gets the directory compaction ratio.
- * @return the directory compaction ratio.
+ * Gets the ratio of operations that are traced.
+ * @see Filesystem::setTraceSampleRate
+ * @return the ratio, from 0 (no tracing) to 1 (every operation).
  */
-float
-Filesystem::dirCompactRatio(void) const
+double
+Filesystem::traceSampleRate(void) const
 {
-  return mPriv->dirCompactRatio;
+  return mPriv->tracer.sampleRate();
 }
 
 /**
- * Sets the log level to be used.
- * @param level the new log level.
+ * Sets how many spans are kept for exporting the trace. Once the maximum is
+ * reached, the oldest spans are discarded.
+ * @param maxEvents the maximum number of spans.
  */
 void
-Filesystem::setLogLevel(const Filesystem::LogLevel level)
+Filesystem::setTraceMaxEvents(size_t maxEvents)
 {
-  mPriv->logger.setLogLevel(level);
+  mPriv->tracer.setMaxEvents(maxEvents);
 }
 
 /**
- * @enum Filesystem::LogLevel
- *
- * The possible values for setting the log level.
- *
- * @var Filesystem::LogLevel Filesystem::LOG_LEVEL_NONE
- *      Turns off debug messages (nothing will be printed).
- *
- * @var Filesystem::LogLevel Filesystem::LOG_LEVEL_DEBUG
- *      Turns on debug messages (prints all debug messages).
+ * Gets how many spans are kept for exporting the trace.
+ * @see Filesystem::setTraceMaxEvents
+ * @return the maximum number of spans.
  */
+size_t
+Filesystem::traceMaxEvents(void) const
+{
+  return mPriv->tracer.maxEvents();
+}
 
 /**
- * Gets the log level in use.
+ * Writes the spans traced so far (see Filesystem::setTraceSampleRate) to a
+ * file in the Chrome trace event format, which can be opened with, e.g.,
+ * chrome://tracing. Each span has the id of the operation it belongs to in
+ * its arguments.
+ * @param path the path to the local file to write.
+ * @return 0 on success, an error code otherwise.
  */
-Filesystem::LogLevel
-Filesystem::logLevel(void) const
+int
+Filesystem::exportTrace(const std::string &path)
 {
-  return mPriv->logger.logLevel();
+  return mPriv->tracer.exportChromeTrace(path);
 }
 
 /**
- * Sets the file stripe size to be used by default.
- * @param size the stripe size (in bytes).
+ * Discards the spans traced so far.
  */
 void
-Filesystem::setFileChunkSize(const size_t size)
+Filesystem::clearTrace(void)
 {
-  size_t realSize = size;
+  mPriv->tracer.clear();
+}
 
-  if (size == 0)
-  {
-    realSize = 1;
-    radosfs_debug("Cannot set the file chunk size as 0. Setting to %d.",
-                  realSize);
-  }
+/**
+ * Starts recording the operations done through this Filesystem (stats, reads,
+ * writes, truncations, creations and removals of files and directories, as
+ * well as directory listings and finds) to a file, so the workload can be
+ * replayed later with the libradosfs-replay tool (e.g. to try out different
+ * settings against it). For each operation, its kind, the hashes of its path
+ * and of its parent directory's path, its offset and length, when it started
+ * and for how long it ran, the thread that did it and its result are
+ * recorded in a compact binary form; the paths themselves are not recorded.
+ *
+ * @note Asynchronous operations are recorded for the time it took to start
+ *       them, and operations done on behalf of another one (e.g. the stat
+ *       of a file that is read) are not recorded.
+ * @see Filesystem::stopOpRecording
+ * @param path the path to the (local) file where the operations are recorded.
+ *        It is overwritten if it exists.
+ * @return 0 on success, -EBUSY if the operations are already being recorded,
+ *         or an error code otherwise.
+ */
+int
+Filesystem::startOpRecording(const std::string &path)
+{
+  return mPriv->opRecorder.start(path);
+}
 
-  mPriv->fileChunkSize = realSize;
+/**
+ * Stops recording the operations (see Filesystem::startOpRecording) and
+ * closes the file they were recorded to.
+ */
+void
+Filesystem::stopOpRecording(void)
+{
+  mPriv->opRecorder.stop();
 }
 
 /**
- * Gets the default file stripe size.
- * @return the file stripe size.
+ * Checks whether the operations are being recorded.
+ * @see Filesystem::startOpRecording
+ * @return true if they are being recorded, false otherwise.
  */
-size_t
-Filesystem::fileChunkSize(void) const
+bool
+Filesystem::recordingOps(void) const
 {
-  return mPriv->fileChunkSize;
+  return mPriv->opRecorder.recording();
 }
 
 /**
@@ -2217,6 +4771,8 @@ Filesystem::getInodeAndPool(const std::string &path, std::string *inode,
  * @param numWorkers the number of worker threads (minimum is 1).
  * @note The minimum number of generic workers is 1. Setting a lower value will
  *       instead set the minimum value.
+ * @note When diminishing the number of workers, this method waits for the
+ *       removed workers to finish their current job.
  */
 void
 Filesystem::setNumGenericWorkers(size_t numWorkers)
@@ -2229,15 +4785,7 @@ Filesystem::setNumGenericWorkers(size_t numWorkers)
     numWorkers = MIN_NUM_WORKER_THREADS;
   }
 
-  {
-    boost::unique_lock<boost::mutex> lock(mPriv->genericWorkersMutex);
-    mPriv->numGenericWorkers = numWorkers;
-  }
-
-  size_t currentNumWorkers = mPriv->generalWorkerThreads.size();
-
-  if (currentNumWorkers > 0 && currentNumWorkers != numWorkers)
-    mPriv->launchThreads();
+  mPriv->scheduler.setNumWorkers(numWorkers);
 }
 
 /**
@@ -2249,8 +4797,40 @@ Filesystem::setNumGenericWorkers(size_t numWorkers)
 size_t
 Filesystem::numGenericWorkers(void)
 {
-  boost::unique_lock<boost::mutex> lock(mPriv->genericWorkersMutex);
-  return mPriv->numGenericWorkers;
+  return mPriv->scheduler.numWorkers();
+}
+
+/**
+ * Gets an approximation of the given percentile of the operations' latency.
+ * @param percentile the percentile (between 0 and 100).
+ * @return the upper bound (in microseconds) of the latency histogram's
+ *         interval in which the percentile falls, or 0 if no operations were
+ *         counted.
+ */
+uint64_t
+OpMetrics::latencyPercentileUs(double percentile) const
+{
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < latencyHistogram.size(); i++)
+    total += latencyHistogram[i];
+
+  if (total == 0)
+    return 0;
+
+  const double rank = std::min(std::max(percentile, 0.0), 100.0) / 100.0 *
+                      total;
+  uint64_t accumulated = 0;
+
+  for (size_t i = 0; i < latencyHistogram.size(); i++)
+  {
+    accumulated += latencyHistogram[i];
+
+    if (accumulated >= rank && accumulated > 0)
+      return 1ULL << i;
+  }
+
+  return 1ULL << (latencyHistogram.size() - 1);
 }
 
 RADOS_FS_END_NAMESPACE
@@ -37,6 +37,12 @@ RADOS_FS_BEGIN_NAMESPACE
 
 typedef void (*AsyncOpCallback)(const std::string &opId, int retCode, void *args);
 
+typedef void (*AsyncOpBufferCallback)(const std::string &opId,
+                                      const char *buff, void *args);
+
+typedef void (*StatCallback)(const std::string &path, int retCode,
+                             const struct stat &buff, void *args);
+
 class FilesystemPriv;
 class FileInodePriv;
 class FsObj;
@@ -56,6 +62,43 @@ struct FileReadData
   ssize_t *retValue;
 };
 
+struct FileWriteData
+{
+  FileWriteData(const char *buff, off_t offset, size_t length)
+    : buff(buff),
+      offset(offset),
+      length(length)
+  {}
+
+  const char *buff;
+  off_t offset;
+  size_t length;
+};
+
+struct OpMetrics
+{
+  OpMetrics(void)
+    : count(0),
+      errors(0),
+      totalLatencyUs(0)
+  {}
+
+  uint64_t latencyPercentileUs(double percentile) const;
+
+  uint64_t count;
+  uint64_t errors;
+  uint64_t totalLatencyUs;
+  // Element i counts the operations that took less than 2^i microseconds
+  // (and not less than 2^(i-1))
+  std::vector<uint64_t> latencyHistogram;
+};
+
+struct FilesystemMetrics
+{
+  std::map<std::string, OpMetrics> operations;
+  std::map<std::string, uint64_t> counters;
+};
+
 class Filesystem
 {
 public:
@@ -68,6 +111,15 @@ public:
     LOG_LEVEL_DEBUG   = 1 << 0
   };
 
+  enum LogCategory
+  {
+    LOG_CATEGORY_GENERAL = 0,
+    LOG_CATEGORY_LOCKS,
+    LOG_CATEGORY_CHUNKS,
+    LOG_CATEGORY_DIR_CACHE,
+    LOG_CATEGORY_COUNT
+  };
+
   int init(const std::string &userName = "",
            const std::string &configurationFile = "");
 
@@ -92,6 +144,10 @@ public:
 
   std::string metadataPoolFromPrefix(const std::string &prefix) const;
 
+  int saveLayout(const std::string &pool) const;
+
+  int loadLayout(const std::string &pool);
+
   void setIds(uid_t uid, gid_t gid);
 
   void getIds(uid_t *uid, gid_t *gid) const;
@@ -110,6 +166,18 @@ public:
   std::vector<std::pair<int, struct stat> >
       stat(const std::vector<std::string> &paths);
 
+  int statAsync(const std::vector<std::string> &paths, StatCallback callback,
+                void *callbackArg = 0);
+
+  int sync(const std::string &opId = "");
+
+  int pollOp(const std::string &opId);
+
+  int waitForAnyOp(const std::vector<std::string> &opIds,
+                   std::string *finishedOpId = 0);
+
+  int opProgress(const std::string &opId, u_int64_t *done, u_int64_t *total);
+
   std::vector<std::string> allPoolsInCluster(void) const;
 
   int setXAttr(const std::string &path,
@@ -129,17 +197,137 @@ public:
 
   size_t dirCacheMaxSize(void) const;
 
+  void setDirCacheMaxBytes(size_t bytes);
+
+  size_t dirCacheMaxBytes(void) const;
+
   void setDirCompactRatio(float ratio);
 
   float dirCompactRatio(void) const;
 
+  void setDirLogBinaryCompaction(bool binary);
+
+  bool dirLogBinaryCompaction(void) const;
+
+  void setDirOmapIndex(bool omapIndex);
+
+  bool dirOmapIndex(void) const;
+
+  void setDirBackgroundCompaction(bool background);
+
+  bool dirBackgroundCompaction(void) const;
+
+  void setDirCacheWatch(bool watch);
+
+  bool dirCacheWatch(void) const;
+
+  void setDirServerSideFind(bool serverSide);
+
+  bool dirServerSideFind(void) const;
+
+  void setDirCompactionsPerInterval(size_t numCompactions);
+
+  size_t dirCompactionsPerInterval(void) const;
+
+  void setDirInodeCacheMaxEntries(size_t maxEntries);
+
+  size_t dirInodeCacheMaxEntries(void) const;
+
+  void setDirInodeNegativeCacheTtl(double seconds);
+
+  double dirInodeNegativeCacheTtl(void) const;
+
+  void setStatCacheTtl(double seconds);
+
+  double statCacheTtl(void) const;
+
+  void setStatCacheMaxEntries(size_t maxEntries);
+
+  size_t statCacheMaxEntries(void) const;
+
+  uint64_t statCacheHits(void) const;
+
+  uint64_t statCacheMisses(void) const;
+
   void setLogLevel(const LogLevel level);
 
   LogLevel logLevel(void) const;
 
+  void setLogCategoryEnabled(LogCategory category, bool enabled);
+  bool logCategoryEnabled(LogCategory category) const;
+
+  void setLogCategoryRateLimit(LogCategory category, size_t messagesPerSecond);
+  size_t logCategoryRateLimit(LogCategory category) const;
+
+  void setLogCategorySampleRate(LogCategory category, double rate);
+  double logCategorySampleRate(LogCategory category) const;
+
   void setFileChunkSize(const size_t size);
   size_t fileChunkSize(void) const;
 
+  void setFileStripeWidth(size_t numPools);
+  size_t fileStripeWidth(void) const;
+
+  int setFileChunkSizePolicy(const std::string &prefix, size_t minChunkSize,
+                             size_t maxChunkSize);
+  int removeFileChunkSizePolicy(const std::string &prefix);
+
+  void setFileCompression(const std::string &prefix, bool compress);
+  bool fileCompression(const std::string &path) const;
+
+  void setFileWriteBehindSize(const size_t size);
+  size_t fileWriteBehindSize(void) const;
+
+  void setFileSizeCacheStaleness(double seconds);
+  double fileSizeCacheStaleness(void) const;
+
+  void setFileReadAhead(bool readAhead);
+  bool fileReadAhead(void) const;
+
+  void setFileChunkRemovalWindow(size_t window);
+  size_t fileChunkRemovalWindow(void) const;
+
+  void setFileBackgroundLazyRemoval(bool background);
+  bool fileBackgroundLazyRemoval(void) const;
+
+  void setFileChunkCacheSize(size_t size);
+  size_t fileChunkCacheSize(void) const;
+
+  void setFileChunkCacheTtl(double seconds);
+  double fileChunkCacheTtl(void) const;
+
+  void setQuotaUpdateInterval(double seconds);
+  double quotaUpdateInterval(void) const;
+
+  void setQuotaUpdateMaxPendingSize(uint64_t size);
+  uint64_t quotaUpdateMaxPendingSize(void) const;
+
+  FilesystemMetrics metrics(void) const;
+
+  void resetMetrics(void);
+
+  void setMetricsDumpInterval(double seconds);
+  double metricsDumpInterval(void) const;
+
+  void setMetricsDumpPath(const std::string &path);
+  std::string metricsDumpPath(void) const;
+
+  void setTraceSampleRate(double rate);
+  double traceSampleRate(void) const;
+
+  void setTraceMaxEvents(size_t maxEvents);
+  size_t traceMaxEvents(void) const;
+
+  int exportTrace(const std::string &path);
+
+  void clearTrace(void);
+
+  int startOpRecording(const std::string &path);
+
+  void stopOpRecording(void);
+
+  bool recordingOps(void) const;
+
   FsObj * getFsObj(const std::string &path);
 
   int getInodeAndPool(const std::string &path, std::string *inode,
@@ -157,9 +345,11 @@ private:
   friend class FsObjPriv;
   friend class FilePriv;
   friend class DirPriv;
+  friend class Finder;
   friend class FileIO;
   friend class FileInodePriv;
   friend class QuotaPriv;
+  friend class FileInlineBuffer;
 };
 
 RADOS_FS_END_NAMESPACE
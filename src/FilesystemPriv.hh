@@ -20,7 +20,6 @@
 #ifndef __RADOS_FS_FILESYSTEM_PRIV_HH__
 #define __RADOS_FS_FILESYSTEM_PRIV_HH__
 
-#include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <map>
 #include <vector>
@@ -31,64 +30,93 @@
 
 #include "radosfscommon.h"
 #include "radosfsdefines.h"
+#include "ChunkCache.hh"
 #include "DirCache.hh"
 #include "FileIO.hh"
+#include "PoolTrie.hh"
 #include "Logger.hh"
 #include "Finder.hh"
+#include "DirInodeCache.hh"
+#include "ShardedDirCache.hh"
+#include "StatCache.hh"
+#include "StatResults.hh"
+#include "WorkScheduler.hh"
+#include "DeadlineQueue.hh"
+#include "Metrics.hh"
+#include "Tracer.hh"
+#include "OpRecorder.hh"
 
 RADOS_FS_BEGIN_NAMESPACE
 
 class Filesystem;
 
-typedef std::vector<PoolSP> PoolList;
-
-typedef std::map<std::string, PoolSP> PoolMap;
-typedef std::map<std::string, PoolList>  PoolListMap;
-
-typedef struct _LinkedList LinkedList;
-
-struct _LinkedList
-{
-  std::tr1::shared_ptr<DirCache> cachePtr;
-  size_t lastNumEntries;
-  LinkedList *previous;
-  LinkedList *next;
-};
-
 typedef struct {
   Stat stat;
-  std::map<std::string, std::pair<int, Stat> > entryStats;
+  // The results of statting each of the entries, in the same order
+  std::vector<std::pair<int, Stat> > entryStats;
   const std::vector<std::string> *entries;
   uint64_t psize;
   time_t pmtime;
   int statRet;
 } StatAsyncInfo;
 
-class PriorityCache
+// A file read from the inline buffers kept in its parent dir: its stat and,
+// when the inline buffer holds the whole file, its contents
+struct InlineFileRead
 {
-public:
-  PriorityCache();
-  ~PriorityCache();
+  InlineFileRead(void)
+    : ret(-ENOENT),
+      complete(false)
+  {}
 
-  void update(std::tr1::shared_ptr<DirCache> cache);
+  int ret;
+  Stat stat;
+  bool complete;
+  std::string contents;
+};
 
-  void adjustCache(void);
+typedef std::pair<std::string, std::vector<std::string> > StatBatch;
 
-  size_t size(void) { return cacheSize + cacheMap.size(); }
+struct StatCallbackBatch
+{
+  StatBatch batch;
+  StatCallback callback;
+  void *callbackArg;
+};
 
-  void cleanCache();
+typedef std::tr1::shared_ptr<StatCallbackBatch> StatCallbackBatchSP;
 
-  void moveToFront(LinkedList *link);
+// A batch of entries of the same dir to be statted, along with the indexes
+// of their results in a StatResults. A batch without entries is for statting
+// the dir itself and has its index as the only one.
+struct IndexedStatBatch
+{
+  std::string dir;
+  std::vector<std::string> entries;
+  std::vector<size_t> indexes;
+};
 
-  void removeCache(LinkedList *link, bool freeMemory = true);
+// The differences to the current sizes of a quota (keyed by their omap keys)
+// that were not yet written to its object
+// The range of chunk sizes that files created under a prefix can get
+struct ChunkSizePolicy
+{
+  size_t minChunkSize;
+  size_t maxChunkSize;
+};
 
-  void removeCache(const std::string &path, bool freeMemory = true);
+struct QuotaDelta
+{
+  PoolSP pool;
+  std::string name;
+  std::map<std::string, int64_t> sizes;
+};
 
-  std::map<std::string, LinkedList *> cacheMap;
-  LinkedList *head;
-  LinkedList *tail;
-  size_t cacheSize;
-  size_t maxCacheSize;
+struct PendingBacklink
+{
+  PoolSP pool;
+  std::string backLink;
+  std::string compare;
 };
 
 class FilesystemPriv
@@ -110,11 +138,18 @@ public:
               const std::string &prefix,
               PoolMap *map,
               boost::mutex &mutex,
+              PoolTrieHolder *trie,
               size_t size = 0);
 
   int createPrefixDir(PoolSP pool, const std::string &prefix);
 
-  PoolSP getPool(const std::string &path, PoolMap *map, boost::mutex &mutex);
+  int createPrefixDirs(const PoolMap &pools);
+
+  int openLayoutPool(const std::string &name,
+                     std::map<std::string, librados::IoCtx> &ioctxs,
+                     librados::IoCtx &ioctx);
+
+  PoolSP getPool(const std::string &path, const PoolTrieHolder &trie);
 
   PoolSP getMetadataPoolFromPath(const std::string &path);
 
@@ -131,13 +166,26 @@ public:
 
   PoolList getMtdPools(void);
 
+  PoolList getStripePools(const std::string &path, const PoolSP &pool);
+
+  size_t chooseChunkSize(const std::string &path, const PoolSP &pool,
+                         size_t chunkSize, size_t sizeHint);
+
+  bool shouldCompress(const std::string &path);
+
+  int getStripePoolsFromNames(const std::string &names, const PoolSP &pool,
+                              PoolList &stripePools);
+
+  static std::string stripePoolNames(const PoolList &pools);
+
   std::string poolPrefix(const std::string &pool,
                          PoolMap *map,
                          boost::mutex &mutex) const;
 
   int removePool(const std::string &name,
                  PoolMap *map,
-                 boost::mutex &mutex);
+                 boost::mutex &mutex,
+                 PoolTrieHolder *trie);
 
   std::string poolFromPrefix(const std::string &prefix,
                              PoolMap *map,
@@ -149,30 +197,67 @@ public:
 
   std::tr1::shared_ptr<DirCache> getDirInfo(const std::string &inode,
                                             PoolSP pool,
-                                            bool addToCache = true);
+                                            bool addToCache = true,
+                                            bool omapIndex = false);
 
   FileIOSP getFileIO(const std::string &path);
 
   FileIOSP getOrCreateFileIO(const std::string &path, const Stat *stat);
 
+  int setFileIOLayout(FileIO *io, const Stat *stat);
+
   void setFileIO(FileIOSP sharedFileIO);
   void removeFileIO(FileIOSP sharedFileIO);
 
+  void scheduleFileIOCheck(const std::string &inode, double seconds);
+
+  void checkFileIO(const std::string &inode);
+
   void updateDirCache(std::tr1::shared_ptr<DirCache> &cache);
 
   void removeDirCache(std::tr1::shared_ptr<DirCache> &cache);
 
+  void setDirCacheWatch(bool watch);
+
   int stat(const std::string &path, Stat *stat);
 
-  std::map<std::string, std::pair<int, Stat> >
-      stat(const std::vector<std::string> &paths);
+  int statUncached(const std::string &path, Stat *stat);
+
+  void invalidateStat(const std::string &path);
 
-  void parallelStat(
-      const std::map<std::string, std::vector<std::string> > &paths,
-      std::map<std::string, std::pair<int, Stat> > *stats);
+  void invalidateStatTree(const std::string &dirPath);
+
+  void stat(const std::vector<std::string> &paths, StatResults *results);
+
+  void parallelStat(const std::vector<IndexedStatBatch> &batches,
+                    StatResults *results);
+
+  int statIndexedBatch(const IndexedStatBatch &batch, StatResults *results,
+                       boost::mutex *resultsMutex);
+
+  void statEntryBatches(IndexedStatBatch &batch, StatResults *results);
 
   void statAsync(StatAsyncInfo *info);
 
+  void statAsync(const std::vector<std::string> &paths, StatCallback callback,
+                 void *callbackArg);
+
+  void statBatchWithCallback(StatCallbackBatchSP batch);
+
+  std::string runMetadataOpAsync(const boost::function<int (void)> &job,
+                                 AsyncOpCallback callback, void *callbackArg,
+                                 bool idHeld);
+
+  std::string runTrackedMetadataOpAsync(
+      const boost::function<int (AsyncOpSP)> &job, AsyncOpCallback callback,
+      void *callbackArg, bool idHeld);
+
+  void metadataOpInThread(boost::function<int (void)> job, AsyncOpSP op,
+                          uid_t opUid, gid_t opGid, bool forget);
+
+  int syncMetadataOps(const std::vector<std::string> &opIds,
+                      bool ignoreMissing = false);
+
   void statEntries(StatAsyncInfo *info,
                    std::map<std::string, std::string> &xattrs);
 
@@ -198,26 +283,70 @@ public:
 
   void removeDirInode(const std::string &path);
 
-  void updateTMIdSync(std::string path);
-
   void updateTMId(Stat *stat);
 
+  void flushScheduledTMIds(void);
+
+  void flushTMIds(void);
+
+  void queueBacklink(PoolSP pool, const std::string &inode,
+                     const std::string &backLink,
+                     const std::string *compare = 0);
+
+  bool takeBacklink(const std::string &inode, PendingBacklink *backLink = 0);
+
+  void flushScheduledBacklinks(void);
+
+  void flushPostedBacklinks(void);
+
+  void flushBacklinks(void);
+
   void updateDirTimes(Stat *stat, timespec *spec = 0);
 
   int statEntry(std::string path, std::string entry, size_t inlineBufferSize,
                 Stat *stat);
 
-  int statAsyncInfoInThread(const std::string path, StatAsyncInfo *info,
-                            boost::mutex *mutex, boost::condition_variable *cond,
-                            int *numJobs);
+  int statDirAndEntries(const std::string &path, StatAsyncInfo *info);
+
+  int readInlineFiles(const std::string &dirPath,
+                      const std::vector<std::string> &entries,
+                      std::vector<InlineFileRead> *files);
 
-  void generalWorkerThread(boost::shared_ptr<boost::asio::io_service> ioService);
+  void statEntryList(const std::string &dirPath,
+                     const std::vector<std::string> &entries,
+                     StatResults *results);
 
-  void launchThreads(void);
+  void statDirEntries(const std::string &dirPath,
+                      const std::vector<std::string> &entries,
+                      StatResults *results);
+
+  void statIndexedBatchInThread(const IndexedStatBatch *batch,
+                                StatResults *results, boost::mutex *mutex,
+                                boost::condition_variable *cond,
+                                int *numJobs);
 
   void checkFileLocks(void);
 
-  boost::shared_ptr<boost::asio::io_service> getIoService();
+  void manageDirCompaction(void);
+
+  void compactDirInBackground(std::tr1::shared_ptr<DirCache> cache);
+
+  bool addQuotaDelta(PoolSP pool, const std::string &quota,
+                     const std::map<std::string, int64_t> &sizes);
+
+  int flushQuotaDeltas(PoolSP pool, const std::string &quota);
+
+  int flushQuotaDelta(const std::string &key);
+
+  void flushAllQuotaDeltas(void);
+
+  void dropQuotaDeltas(PoolSP pool, const std::string &quota);
+
+  void getMetrics(FilesystemMetrics &fsMetrics);
+
+  void manageMetricsDump(void);
+
+  void dumpMetrics(void);
 
   int resetFileEntry(Stat &stat);
 
@@ -226,6 +355,10 @@ public:
   Filesystem *radosFs;
   librados::Rados radosCluster;
   bool initialized;
+  // Declared before everything that records in it, so it outlives them
+  Metrics metrics;
+  Tracer tracer;
+  OpRecorder opRecorder;
   static __thread uid_t uid;
   static __thread gid_t gid;
   std::vector<rados_completion_t> completionList;
@@ -233,21 +366,63 @@ public:
   boost::mutex poolMutex;
   PoolMap mtdPoolMap;
   boost::mutex mtdPoolMutex;
-  PriorityCache dirCache;
-  boost::mutex dirCacheMutex;
+  // Published from the maps above (with their locks) for lock-free lookups
+  PoolTrieHolder dataPoolTrie;
+  PoolTrieHolder mtdPoolTrie;
+  ShardedDirCache dirCache;
   std::map<std::string, std::tr1::shared_ptr<FileIO> > operations;
   boost::mutex operationsMutex;
-  std::map<std::string, Inode> dirPathInodeMap;
-  boost::mutex dirPathInodeMutex;
+  DeadlineQueue fileIOChecks;
+  DirInodeCache dirInodeCache;
+  StatCache statCache;
   float dirCompactRatio;
+  bool dirLogBinaryCompaction;
+  bool dirOmapIndex;
+  bool dirBackgroundCompaction;
+  bool dirCacheWatch;
+  bool dirServerSideFind;
+  size_t dirCompactionsPerInterval;
+  std::set<std::string> dirsBeingCompacted;
+  boost::mutex dirCompactionMutex;
+  boost::chrono::steady_clock::time_point lastDirCompactionCheck;
   Logger logger;
   size_t fileChunkSize;
-  boost::mutex genericWorkersMutex;
-  size_t numGenericWorkers;
-  std::list<boost::thread *> genericWorkersList;
-  boost::shared_ptr<boost::asio::io_service> ioService;
-  boost::shared_ptr<boost::asio::io_service::work> asyncWork;
-  boost::thread_group generalWorkerThreads;
+  size_t fileStripeWidth;
+  std::map<std::string, ChunkSizePolicy> chunkSizePolicies;
+  boost::mutex chunkSizePoliciesMutex;
+  std::map<std::string, bool> compressionPrefixes;
+  boost::mutex compressionPrefixesMutex;
+  size_t fileWriteBehindSize;
+  double fileSizeCacheStaleness;
+  bool fileReadAhead;
+  size_t fileChunkRemovalWindow;
+  bool fileBackgroundLazyRemoval;
+  double quotaUpdateInterval;
+  uint64_t quotaUpdateMaxPendingSize;
+  std::map<std::string, QuotaDelta> quotaDeltas;
+  // The quotas whose deltas are being written, so other flushes of the same
+  // quota wait for them instead of finding nothing to flush
+  std::set<std::string> quotaDeltasInFlight;
+  boost::condition_variable quotaDeltasCond;
+  boost::mutex quotaDeltasMutex;
+  DeadlineQueue quotaFlushes;
+  std::set<std::string> pendingTMIds;
+  bool tmIdFlushScheduled;
+  boost::mutex tmIdMutex;
+  boost::mutex tmIdFlushMutex;
+  std::map<std::string, PendingBacklink> pendingBacklinks;
+  bool backlinkFlushScheduled;
+  // Set while a flush for reaching FILE_BACKLINK_MAX_PENDING is posted
+  bool backlinkFlushPosted;
+  boost::mutex backlinksMutex;
+  boost::mutex backlinksFlushMutex;
+  double metricsDumpInterval;
+  std::string metricsDumpPath;
+  boost::mutex metricsDumpMutex;
+  boost::chrono::steady_clock::time_point lastMetricsDump;
+  ChunkCache chunkCache;
+  WorkScheduler scheduler;
+  OpsManager metadataOps;
   boost::thread fileOpsIdleChecker;
 };
 
@@ -17,13 +17,17 @@
  * for more details.
  */
 
+#include <algorithm>
 #include <errno.h>
 #include <regex.h>
+#include <stdio.h>
 #include <sys/stat.h>
 #include <utility>
 
 #include "radosfscommon.h"
 #include "Finder.hh"
+#include "DirPriv.hh"
+#include "FilesystemPriv.hh"
 #include "Logger.hh"
 
 #define DEFAULT_NUM_FINDER_THREADS 100
@@ -39,7 +43,8 @@ Finder::~Finder()
 {}
 
 static int
-runRegex(const std::string &expression, regex_t regex, const std::string &entry)
+runRegex(const std::string &expression, const regex_t &regex,
+         const std::string &entry)
 {
   int ret = regexec(&regex, entry.c_str(), 0, 0, 0);
 
@@ -69,11 +74,49 @@ makeExpRegex(const std::string &exp, bool icase, regex_t *regex)
   return ret;
 }
 
+static void
+deleteRegex(regex_t *regex)
+{
+  regfree(regex);
+  delete regex;
+}
+
+static int
+runArgRegex(const FinderArg &arg, const std::string &value)
+{
+  if (arg.regex)
+    return runRegex(arg.valueStr, *arg.regex, value);
+
+  // The argument was not compiled by a FinderPlan, so its expression has to
+  // be compiled here
+  regex_t regex;
+  bool icase = arg.options & FinderArg::FINDER_OPT_ICASE;
+  int ret = makeExpRegex(arg.valueStr, icase, &regex);
+
+  if (ret != 0)
+  {
+    if (ret != -EINVAL)
+      regfree(&regex);
+
+    radosfs_debug("Error making regex for %s.", arg.valueStr.c_str());
+
+    return -EINVAL;
+  }
+
+  ret = runRegex(arg.valueStr, regex, value);
+  regfree(&regex);
+
+  return ret;
+}
+
 static int
-checkEntryRegex(const std::string &value, const std::string &valueToCompare,
-                Finder::FindOptions option, regex_t regex)
+checkEntryRegex(const FinderArg &arg, const std::string &valueToCompare,
+                Finder::FindOptions option)
 {
-  int ret = runRegex(value, regex, valueToCompare);
+  int ret = runArgRegex(arg, valueToCompare);
+
+  if (ret == -EINVAL)
+    return ret;
 
   if (((option & Finder::FIND_EQ) && ret == 0) ||
       ((option & Finder::FIND_NE) && ret == REG_NOMATCH))
@@ -84,8 +127,172 @@ checkEntryRegex(const std::string &value, const std::string &valueToCompare,
   return -1;
 }
 
+static bool
+argUsesRegex(Finder::FindOptions option, const FinderArg &arg)
+{
+  if (option & Finder::FIND_NAME)
+    return true;
+
+  if (option & (Finder::FIND_MTD | Finder::FIND_XATTR))
+    return arg.key.empty() || !(arg.options & FinderArg::FINDER_OPT_CMP_NUM);
+
+  return false;
+}
+
+static FinderPlan::StepCost
+stepCost(Finder::FindOptions option)
+{
+  if (option & Finder::FIND_NAME)
+    return FinderPlan::STEP_COST_NAME;
+
+  // The metadata is kept in the directory's log, which is likely cached
+  if (option & Finder::FIND_MTD)
+    return FinderPlan::STEP_COST_MTD;
+
+  if (option & Finder::FIND_XATTR)
+    return FinderPlan::STEP_COST_XATTR;
+
+  return FinderPlan::STEP_COST_STAT;
+}
+
+static bool
+compareStepsCost(const FinderPlan::Step &step1, const FinderPlan::Step &step2)
+{
+  return step1.cost < step2.cost;
+}
+
+FinderPlan::FinderPlan(void)
+{}
+
+int
+FinderPlan::compile(const std::map<Finder::FindOptions, FinderArg> &args)
+{
+  steps.clear();
+
+  std::map<Finder::FindOptions, FinderArg>::const_iterator it;
+  for (it = args.begin(); it != args.end(); it++)
+  {
+    Step step;
+    step.option = (*it).first;
+    step.arg = (*it).second;
+    step.cost = stepCost(step.option);
+
+    if (argUsesRegex(step.option, step.arg))
+    {
+      regex_t *regex = new regex_t;
+      bool icase = step.arg.options & FinderArg::FINDER_OPT_ICASE;
+      int ret = makeExpRegex(step.arg.valueStr, icase, regex);
+
+      if (ret == 0)
+      {
+        step.arg.regex.reset(regex, deleteRegex);
+      }
+      else
+      {
+        // Such an argument never matches (as when the expression failed to
+        // be compiled for every entry)
+        if (ret != -EINVAL)
+          regfree(regex);
+
+        delete regex;
+
+        radosfs_debug("Error making regex for %s.", step.arg.valueStr.c_str());
+      }
+    }
+
+    steps.push_back(step);
+  }
+
+  std::stable_sort(steps.begin(), steps.end(), compareStepsCost);
+
+  return steps.empty() ? -EINVAL : 0;
+}
+
+bool
+FinderPlan::needsStat(void) const
+{
+  return firstStatStep() < steps.size();
+}
+
+size_t
+FinderPlan::firstStatStep(void) const
+{
+  size_t i;
+
+  for (i = 0; i < steps.size(); i++)
+  {
+    if (steps[i].cost == STEP_COST_STAT)
+      break;
+  }
+
+  return i;
+}
+
+static int
+dirLogCmp(Finder::FindOptions option)
+{
+  int cmp = 0;
+
+  if (option & Finder::FIND_EQ)
+    cmp |= DIR_LOG_CMP_EQ;
+  if (option & Finder::FIND_NE)
+    cmp |= DIR_LOG_CMP_NE;
+  if (option & Finder::FIND_LT)
+    cmp |= DIR_LOG_CMP_LT;
+  if (option & Finder::FIND_GT)
+    cmp |= DIR_LOG_CMP_GT;
+
+  return cmp;
+}
+
+size_t
+FinderPlan::dirLogPredicates(std::vector<DirLogPredicate> &predicates) const
+{
+  size_t i;
+
+  for (i = 0; i < steps.size(); i++)
+  {
+    const Step &step = steps[i];
+
+    if (step.cost != STEP_COST_NAME && step.cost != STEP_COST_MTD)
+      break;
+
+    DirLogPredicate predicate;
+    predicate.cmp = dirLogCmp(step.option);
+    predicate.icase = step.arg.options & FinderArg::FINDER_OPT_ICASE;
+
+    if (step.cost == STEP_COST_NAME)
+    {
+      predicate.type = DIR_LOG_PREDICATE_NAME;
+      predicate.value = step.arg.valueStr;
+    }
+    else
+    {
+      predicate.type = DIR_LOG_PREDICATE_MTD;
+      predicate.key = step.arg.key;
+      predicate.numeric = !step.arg.key.empty() &&
+                          (step.arg.options & FinderArg::FINDER_OPT_CMP_NUM);
+
+      if (predicate.numeric)
+      {
+        char value[32];
+        snprintf(value, sizeof(value), "%.9g", step.arg.valueNum);
+        predicate.value = value;
+      }
+      else
+      {
+        predicate.value = step.arg.valueStr;
+      }
+    }
+
+    predicates.push_back(predicate);
+  }
+
+  return i;
+}
+
 int
-Finder::checkEntryStatMember(FinderArg &arg, FindOptions option,
+Finder::checkEntryStatMember(const FinderArg &arg, FindOptions option,
                              const std::string &entry, const Dir &dir,
                              struct stat &buff,
                              FindStatMemberOption statMember)
@@ -123,8 +330,8 @@ Finder::checkEntryStatMember(FinderArg &arg, FindOptions option,
 }
 
 int
-Finder::checkEntryMtd(FinderArg &arg, FindOptions option, FindOptions mtdType,
-                      const std::string &entry, Dir &dir)
+Finder::checkEntryMtd(const FinderArg &arg, FindOptions option,
+                      FindOptions mtdType, const std::string &entry, Dir &dir)
 {
   int ret = 0;
   std::string mtdValue;
@@ -177,28 +384,19 @@ Finder::checkEntryMtd(FinderArg &arg, FindOptions option, FindOptions mtdType,
 }
 
 int
-Finder::checkMtdKeyPresence(FinderArg &arg, FindOptions option,
+Finder::checkMtdKeyPresence(const FinderArg &arg, FindOptions option,
                             const std::map<std::string, std::string> &mtd)
 {
-  regex_t regex;
-  bool icase = arg.options & FinderArg::FINDER_OPT_ICASE;
-  int ret = makeExpRegex(arg.valueStr, icase, &regex);
-
-  if (ret != 0)
-  {
-    radosfs_debug("Error making regex for %s.",
-                  arg.valueStr.c_str());
-    regfree(&regex);
-
-    return -EINVAL;
-  }
-
   bool matched = false;
 
   std::map<std::string, std::string>::const_iterator it;
   for (it = mtd.begin(); it != mtd.end(); it++)
   {
-    ret = runRegex(arg.valueStr, regex, (*it).first);
+    int ret = runArgRegex(arg, (*it).first);
+
+    if (ret == -EINVAL)
+      return ret;
+
     if (ret == 0)
     {
       matched = true;
@@ -206,8 +404,6 @@ Finder::checkMtdKeyPresence(FinderArg &arg, FindOptions option,
     }
   }
 
-  regfree(&regex);
-
   if ((matched && (option & FIND_EQ)) ||
       (!matched && (option & FIND_NE)))
     return 0;
@@ -216,33 +412,25 @@ Finder::checkMtdKeyPresence(FinderArg &arg, FindOptions option,
 }
 
 int
-Finder::compareEntryStrValue(FinderArg &arg, const std::string &entry,
+Finder::compareEntryStrValue(const FinderArg &arg, const std::string &entry,
                              FindOptions option, const std::string &value,
                              Dir &dir)
 {
-  regex_t regex;
-  bool icase = arg.options & FinderArg::FINDER_OPT_ICASE;
-  int ret = makeExpRegex(arg.valueStr, icase, &regex);
+  int ret = checkEntryRegex(arg, value, option);
 
-  if (ret != 0)
+  if (ret == -EINVAL)
   {
     radosfs_debug("Error making regex for %s on directory '%s' for entry '%s'.",
                   arg.valueStr.c_str(), dir.path().c_str(),
                   entry.c_str());
-    ret = -EINVAL;
-    goto bailout;
   }
 
-  ret = checkEntryRegex(arg.valueStr, value, option, regex);
-
-bailout:
-  regfree(&regex);
-
   return ret;
 }
 
 int
-Finder::compareEntryNumValue(FinderArg &arg, FindOptions option, float value)
+Finder::compareEntryNumValue(const FinderArg &arg, FindOptions option,
+                             float value)
 {
   int ret = -1;
 
@@ -267,22 +455,118 @@ Finder::compareEntryNumValue(FinderArg &arg, FindOptions option, float value)
 }
 
 int
-Finder::checkEntryName(FinderArg &arg, FindOptions option,
+Finder::checkEntryName(const FinderArg &arg, FindOptions option,
                        const std::string &entry)
 {
-  regex_t regex;
-  bool icase = arg.options & FinderArg::FINDER_OPT_ICASE;
-  int ret = makeExpRegex(arg.valueStr, icase, &regex);
+  return checkEntryRegex(arg, entry, option);
+}
+
+int
+Finder::checkStep(const FinderArg &arg, FindOptions option,
+                  const std::string &entry, Dir &dir, struct stat &buff)
+{
+  if (option & FIND_NAME)
+    return checkEntryName(arg, option, entry);
+
+  if (option & FIND_SIZE)
+    return checkEntryStatMember(arg, option, entry, dir, buff,
+                                FIND_STAT_MEMBER_SIZE);
 
-  if (ret == 0)
+  if (option & FIND_UID)
+    return checkEntryStatMember(arg, option, entry, dir, buff,
+                                FIND_STAT_MEMBER_UID);
+
+  if (option & FIND_GID)
+    return checkEntryStatMember(arg, option, entry, dir, buff,
+                                FIND_STAT_MEMBER_GID);
+
+  if (option & FIND_MTD)
+    return checkEntryMtd(arg, option, FIND_MTD, entry, dir);
+
+  if (option & FIND_XATTR)
+    return checkEntryMtd(arg, option, FIND_XATTR, entry, dir);
+
+  return 0;
+}
+
+bool
+Finder::reportResult(FinderData *data, const std::string &path)
+{
+  if (data->listener)
+    return data->listener->onResult(path);
+
+  data->results.insert(path);
+
+  return true;
+}
+
+// Has the name and metadata steps checked by the object class, in the OSD
+// that holds the directory's log, which then sends back only the matching
+// entries and the subdirectories
+int
+Finder::findInDirObject(FinderData *data, Dir &dir,
+                        std::set<std::string> &entries, size_t *firstStep)
+{
+  std::vector<DirLogPredicate> predicates;
+  const size_t numSteps = data->plan->dirLogPredicates(predicates);
+
+  if (numSteps == 0)
+    return -EINVAL;
+
+  if (!dir.exists())
+    return -ENOENT;
+
+  if (!dir.isReadable())
+    return -EACCES;
+
+  // The stat the Dir got when it was instanced is enough to find its object
+  const Stat *stat = dir.mPriv->fsStat();
+
+  // Only the directories that keep their entries in the log can be queried
+  if (dirUsesOmapIndex(stat))
+    return -ENOTSUP;
+
+  std::string query;
+  encodeDirLogQuery(predicates, query);
+
+  librados::bufferlist in, out;
+  in.append(query);
+
+  int ret = stat->pool->ioctx.exec(stat->translatedPath, DIR_FIND_OBJECT_CLASS,
+                                   DIR_FIND_OBJECT_CLASS_METHOD, in, out);
+
+  if (ret == -EOPNOTSUPP)
   {
-    ret = checkEntryRegex(arg.valueStr, entry, option, regex);
+    radosfs_debug("The object class " DIR_FIND_OBJECT_CLASS " is not "
+                  "available; checking the entries in the client from now on.");
+    radosFs->mPriv->dirServerSideFind = false;
+    return ret;
   }
 
-  if (ret != -EINVAL)
-    regfree(&regex);
+  if (ret < 0)
+    return ret;
 
-  return ret;
+  std::vector<std::string> matches, dirs;
+
+  if (!decodeDirLogQueryResult(out.c_str(), out.length(), matches, dirs))
+  {
+    radosfs_debug("Error decoding the find results for %s",
+                  dir.path().c_str());
+    return -EIO;
+  }
+
+  for (size_t i = 0; i < dirs.size(); i++)
+  {
+    if (data->listener)
+      data->listener->onDir(dir.path() + dirs[i]);
+    else
+      data->dirEntries.insert(dir.path() + dirs[i]);
+  }
+
+  entries.insert(matches.begin(), matches.end());
+  *firstStep = numSteps;
+
+  return 0;
 }
 
 int
@@ -292,16 +576,45 @@ Finder::find(FinderData *data)
   std::set<std::string> entries;
   Dir dir(radosFs, data->dir);
   std::set<std::string>::iterator it;
+  const std::vector<FinderPlan::Step> &steps = data->plan->steps;
+  const size_t firstStatStep = data->plan->firstStatStep();
+  std::vector<std::string> candidates;
+  const bool serverSideFind = radosFs->mPriv->dirServerSideFind;
 
-  dir.refresh();
+  // The dir was just statted when instanced, so its log only needs to be read
+  // when the entries are checked in the client
+  if (!serverSideFind)
+    dir.refresh();
 
   if (dir.isLink())
     return 0;
 
-  ret = dir.entryList(entries);
+  // The steps already checked on the OSD are skipped below
+  size_t firstStep = 0;
+  bool listedDirs = false;
+
+  if (serverSideFind)
+    listedDirs = findInDirObject(data, dir, entries, &firstStep) == 0;
+
+  if (listedDirs)
+  {
+    ret = 0;
+  }
+  else
+  {
+    if (serverSideFind)
+      dir.refresh();
+
+    ret = dir.entryList(entries);
+  }
 
+  // The steps that do not need to stat the entries are checked first, for
+  // every entry as it is listed
   for (it = entries.begin(); it != entries.end(); it++)
   {
+    if (data->listener && data->listener->cancelled())
+      return ret;
+
     struct stat buff;
     buff.st_nlink = 0;
 
@@ -309,54 +622,60 @@ Finder::find(FinderData *data)
 
     bool isDir = isDirPath(entry);
 
-    if (isDir)
-      data->dirEntries.insert(dir.path() + entry);
-
-    std::map<Finder::FindOptions, FinderArg>::const_iterator it;
-    for (it = data->args->begin(); it != data->args->end(); it++)
+    if (isDir && !listedDirs)
     {
-      Finder::FindOptions option = (*it).first;
-      FinderArg arg = (*it).second;
+      if (data->listener)
+        data->listener->onDir(dir.path() + entry);
+      else
+        data->dirEntries.insert(dir.path() + entry);
+    }
 
-      if (option & FIND_NAME)
-      {
-        ret = checkEntryName(arg, option, entry);
-      }
-      else if (option & FIND_SIZE)
-      {
-        ret = checkEntryStatMember(arg, option, entry, dir, buff,
-                                   FIND_STAT_MEMBER_SIZE);
-      }
-      else if (option & FIND_UID)
-      {
-        ret = checkEntryStatMember(arg, option, entry, dir, buff,
-                                   FIND_STAT_MEMBER_UID);
-      }
-      else if (option & FIND_GID)
-      {
-        ret = checkEntryStatMember(arg, option, entry, dir, buff,
-                                   FIND_STAT_MEMBER_GID);
-      }
-      else if (option & FIND_MTD)
-      {
-        ret = checkEntryMtd(arg, option, FIND_MTD, entry, dir);
-      }
-      else if (option & FIND_XATTR)
-      {
-        ret = checkEntryMtd(arg, option, FIND_XATTR, entry, dir);
-      }
+    int stepRet = 0;
 
-      if (ret != 0)
-        break;
-    }
+    for (size_t i = firstStep; i < firstStatStep && stepRet == 0; i++)
+      stepRet = checkStep(steps[i].arg, steps[i].option, entry, dir, buff);
 
-    if (ret != 0)
+    if (stepRet != 0)
+      continue;
+
+    if (firstStatStep < steps.size())
+      candidates.push_back(entry);
+    else if (!reportResult(data, dir.path() + entry))
+      return ret;
+  }
+
+  if (candidates.empty())
+    return ret;
+
+  // Only the entries that passed the other steps are statted, all at once
+  StatResults stats;
+  radosFs->mPriv->statDirEntries(dir.path(), candidates, &stats);
+
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    if (data->listener && data->listener->cancelled())
+      break;
+
+    const std::string &entry = candidates[i];
+    const std::string &path = dir.path() + entry;
+
+    if (stats.ret(i) != 0)
     {
-      ret = 0;
+      radosfs_debug("Error stating %s", path.c_str());
       continue;
     }
 
-    data->results.insert(dir.path() + entry);
+    struct stat buff = stats.statBuff(i);
+    // Makes sure it does not get statted again
+    buff.st_nlink = std::max(buff.st_nlink, (nlink_t) 1);
+
+    int stepRet = 0;
+
+    for (size_t j = firstStatStep; j < steps.size() && stepRet == 0; j++)
+      stepRet = checkStep(steps[j].arg, steps[j].option, entry, dir, buff);
+
+    if (stepRet == 0 && !reportResult(data, path))
+      break;
   }
 
   return ret;
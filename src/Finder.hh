@@ -6,10 +6,14 @@
 #include <list>
 #include <map>
 #include <queue>
+#include <regex.h>
 #include <set>
 #include <string>
+#include <tr1/memory>
+#include <vector>
 
 #include "Dir.hh"
+#include "DirLog.hh"
 #include "radosfsdefines.h"
 
 RADOS_FS_BEGIN_NAMESPACE
@@ -31,10 +35,27 @@ struct FinderArg
   float valueNum;
   std::string valueStr;
   int options;
+  // Compiled once by FinderPlan::compile, for the arguments that use it
+  std::tr1::shared_ptr<regex_t> regex;
 };
 
 typedef struct _FinderData FinderData;
 
+// Receives what a find operation comes across as it goes, instead of having it
+// collected in the FinderData's sets
+class FinderListener
+{
+public:
+  virtual ~FinderListener(void) {}
+
+  virtual void onDir(const std::string &path) = 0;
+
+  // Returning false stops going through the current directory
+  virtual bool onResult(const std::string &path) = 0;
+
+  virtual bool cancelled(void) = 0;
+};
+
 class Finder
 {
 public:
@@ -82,27 +103,74 @@ public:
 
   int find(FinderData *data);
 
-  int checkEntryMtd(FinderArg &arg, FindOptions option, FindOptions mtdType,
-                    const std::string &entry, Dir &dir);
+  int checkEntryMtd(const FinderArg &arg, FindOptions option,
+                    FindOptions mtdType, const std::string &entry, Dir &dir);
 
-  int checkEntryName(FinderArg &arg, FindOptions option,
+  int checkEntryName(const FinderArg &arg, FindOptions option,
                      const std::string &entry);
 
-  int compareEntryStrValue(FinderArg &arg, const std::string &entry,
+  int compareEntryStrValue(const FinderArg &arg, const std::string &entry,
                            FindOptions option, const std::string &value,
                            Dir &dir);
 
-  int compareEntryNumValue(FinderArg &arg, FindOptions option, float value);
+  int compareEntryNumValue(const FinderArg &arg, FindOptions option,
+                           float value);
 
 
-  int checkMtdKeyPresence(FinderArg &arg, FindOptions option,
-                            const std::map<std::string, std::string> &xattrs);
+  int checkMtdKeyPresence(const FinderArg &arg, FindOptions option,
+                          const std::map<std::string, std::string> &xattrs);
 
-  int checkEntryStatMember(FinderArg &arg, FindOptions option,
+  int checkEntryStatMember(const FinderArg &arg, FindOptions option,
                            const std::string &entry, const Dir &dir,
                            struct stat &buff, FindStatMemberOption statMember);
 
   Filesystem *radosFs;
+
+private:
+  int checkStep(const FinderArg &arg, FindOptions option,
+                const std::string &entry, Dir &dir, struct stat &buff);
+
+  bool reportResult(FinderData *data, const std::string &path);
+
+  int findInDirObject(FinderData *data, Dir &dir,
+                      std::set<std::string> &entries, size_t *firstStep);
+};
+
+// The arguments of a find operation, checked once when the operation starts
+// and ordered by how expensive they are to evaluate, so the cheap ones can
+// filter out entries before the others need to fetch anything for them
+class FinderPlan
+{
+public:
+  enum StepCost
+  {
+    STEP_COST_NAME = 0,
+    STEP_COST_MTD,
+    STEP_COST_XATTR,
+    STEP_COST_STAT
+  };
+
+  struct Step
+  {
+    Finder::FindOptions option;
+    FinderArg arg;
+    StepCost cost;
+  };
+
+  FinderPlan(void);
+
+  int compile(const std::map<Finder::FindOptions, FinderArg> &args);
+
+  bool needsStat(void) const;
+
+  // Index of the first step that needs the entries to be statted
+  size_t firstStatStep(void) const;
+
+  // Converts the leading steps that only need the directory's log into
+  // predicates the object class can check; returns how many were converted
+  size_t dirLogPredicates(std::vector<DirLogPredicate> &predicates) const;
+
+  std::vector<Step> steps;
 };
 
 struct _FinderData {
@@ -110,11 +178,12 @@ struct _FinderData {
   boost::mutex *mutex;
   boost::condition_variable *cond;
   std::string term;
-  const std::map<Finder::FindOptions, FinderArg> *args;
+  const FinderPlan *plan;
   std::set<std::string> dirEntries;
   std::set<std::string> results;
   int *numberRelatedJobs;
   int *retCode;
+  FinderListener *listener;
 };
 
 RADOS_FS_END_NAMESPACE
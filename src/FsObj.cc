@@ -410,8 +410,15 @@ FsObj::setXAttr(const std::string &attrName, const std::string &value)
   if (!pool)
     return -ENODEV;
 
-  return setXAttrFromPath(mPriv->stat, mPriv->radosFs->uid(),
-                          mPriv->radosFs->gid(), attrName, value);
+  int ret = setXAttrFromPath(mPriv->stat, mPriv->radosFs->uid(),
+                             mPriv->radosFs->gid(), attrName, value);
+
+  if (ret == 0 && S_ISREG(mPriv->stat.statBuff.st_mode))
+    mPriv->radosFsPriv()->queueBacklink(mPriv->stat.pool,
+                                        mPriv->stat.translatedPath,
+                                        mPriv->stat.path);
+
+  return ret;
 }
 
 /**
@@ -650,4 +657,56 @@ FsObj::rename(const std::string &newPath)
   return -EOPNOTSUPP;
 }
 
+/**
+ * Changes the permissions of the object asynchronously (see FsObj::chmod).
+ * @param permissions the new permissions (mode bits from sys/stat.h).
+ * @param[out] asyncOpId a string to return the operation's id, to be used
+ *             with Filesystem::sync, Filesystem::pollOp or
+ *             Filesystem::waitForAnyOp.
+ * @param callback a function to be called when the operation is finished.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @return 0 if the operation was scheduled.
+ * @note This instance must not be used or destroyed until the operation is
+ *       finished.
+ */
+int
+FsObj::chmodAsync(long int permissions, std::string *asyncOpId,
+                  AsyncOpCallback callback, void *callbackArg)
+{
+  const std::string &opId = mPriv->radosFsPriv()->runMetadataOpAsync(
+                              boost::bind(&FsObj::chmod, this, permissions),
+                              callback, callbackArg, asyncOpId != 0);
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  return 0;
+}
+
+/**
+ * Renames or moves the object asynchronously (see FsObj::rename).
+ * @param newPath the new path or name of the object.
+ * @param[out] asyncOpId a string to return the operation's id, to be used
+ *             with Filesystem::sync, Filesystem::pollOp or
+ *             Filesystem::waitForAnyOp.
+ * @param callback a function to be called when the operation is finished.
+ * @param callbackArg a pointer to be passed to the \a callback.
+ * @return 0 if the operation was scheduled.
+ * @note This instance must not be used or destroyed until the operation is
+ *       finished.
+ */
+int
+FsObj::renameAsync(const std::string &newPath, std::string *asyncOpId,
+                   AsyncOpCallback callback, void *callbackArg)
+{
+  const std::string &opId = mPriv->radosFsPriv()->runMetadataOpAsync(
+                              boost::bind(&FsObj::rename, this, newPath),
+                              callback, callbackArg, asyncOpId != 0);
+
+  if (asyncOpId)
+    asyncOpId->assign(opId);
+
+  return 0;
+}
+
 RADOS_FS_END_NAMESPACE
@@ -85,6 +85,12 @@ public:
 
   virtual int rename(const std::string &newPath);
 
+  int chmodAsync(long int permissions, std::string *asyncOpId = 0,
+                 AsyncOpCallback callback = 0, void *callbackArg = 0);
+
+  int renameAsync(const std::string &newPath, std::string *asyncOpId = 0,
+                  AsyncOpCallback callback = 0, void *callbackArg = 0);
+
 protected:
   void * fsStat(void);
 
@@ -17,11 +17,16 @@
  * for more details.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdarg>
+#include <cstdlib>
+#include <cstring>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
+#include <vector>
 
 #include "radosfscommon.h"
 #include "radosfsdefines.h"
@@ -31,121 +36,450 @@ RADOS_FS_BEGIN_NAMESPACE
 
 Filesystem::LogLevel Logger::level = Filesystem::LOG_LEVEL_DEBUG;
 
+static const char *categoryNames[] = {"general", "locks", "chunks",
+                                      "dir cache"};
+
+struct LogCategoryConf
+{
+  bool enabled;
+  uint64_t maxPerSecond;
+  double sampleRate;
+  // The second (of the monotonic clock) being rate-limited and the number of
+  // messages logged in it
+  uint64_t window;
+  uint64_t windowCount;
+  uint64_t suppressed;
+};
+
+static LogCategoryConf categoryConfs[Filesystem::LOG_CATEGORY_COUNT] =
+{
+  {false, 0, 1, 0, 0, 0},
+  {false, 0, 1, 0, 0, 0},
+  {false, 0, 1, 0, 0, 0},
+  {false, 0, 1, 0, 0, 0}
+};
+
+static size_t numEnabledCategories = 0;
+
+struct LogMessage
+{
+  const char *file;
+  int line;
+  struct timespec time;
+  char text[LOG_MESSAGE_MAX_SIZE];
+};
+
+// Written only by its thread (head, dropped) and read only by the log thread
+// (tail), so it needs no locking
+struct LogRingBuffer
+{
+  LogRingBuffer(void)
+    : head(0),
+      tail(0),
+      dropped(0),
+      reportedDropped(0),
+      orphaned(false)
+  {}
+
+  LogMessage messages[LOG_RING_BUFFER_SLOTS];
+  uint64_t head;
+  uint64_t tail;
+  uint64_t dropped;
+  uint64_t reportedDropped;
+  bool orphaned;
+};
+
+static void orphanRingBuffer(LogRingBuffer *buffer);
+
+class LogBackend
+{
+public:
+  static LogBackend &instance(void);
+
+  LogRingBuffer *threadBuffer(void);
+  void wake(void);
+  void flush(void);
+
+private:
+  LogBackend(void);
+
+  void run(void);
+  void drain(void);
+  void checkConfiguredLogLevel(void);
+
+  std::vector<LogRingBuffer *> mBuffers;
+  boost::mutex mBuffersMutex;
+  boost::mutex mDrainMutex;
+  boost::mutex mWakeMutex;
+  boost::condition_variable mWakeCond;
+  bool mWoken;
+  boost::thread_specific_ptr<LogRingBuffer> mThreadBuffers;
+  size_t mLevelFileSize;
+  bool mCheckLevelFile;
+  boost::thread mThread;
+};
+
+static __thread LogRingBuffer *currentRingBuffer = 0;
+
+static void
+orphanRingBuffer(LogRingBuffer *buffer)
+{
+  // The log thread prints what is left in the buffer before deleting it
+  currentRingBuffer = 0;
+  __atomic_store_n(&buffer->orphaned, true, __ATOMIC_RELEASE);
+}
+
+LogBackend &
+LogBackend::instance(void)
+{
+  // It is never destroyed so it can be used until the very end of the process
+  static LogBackend *backend = new LogBackend;
+
+  return *backend;
+}
+
+LogBackend::LogBackend(void)
+  : mWoken(false),
+    mThreadBuffers(orphanRingBuffer),
+    mLevelFileSize(0),
+    mCheckLevelFile(true),
+    mThread(&LogBackend::run, this)
+{}
+
+LogRingBuffer *
+LogBackend::threadBuffer(void)
+{
+  if (currentRingBuffer)
+    return currentRingBuffer;
+
+  LogRingBuffer *buffer = new LogRingBuffer;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mBuffersMutex);
+    mBuffers.push_back(buffer);
+  }
+
+  mThreadBuffers.reset(buffer);
+  currentRingBuffer = buffer;
+
+  return buffer;
+}
+
+void
+LogBackend::wake(void)
+{
+  boost::unique_lock<boost::mutex> lock(mWakeMutex);
+  mWoken = true;
+  mWakeCond.notify_one();
+}
+
+static void
+printMessage(const LogMessage &message)
+{
+  time_t _time = message.time.tv_sec;
+  struct tm currentTime;
+  localtime_r(&_time, &currentTime);
+
+  int milliseconds = round(static_cast<double>(message.time.tv_nsec / 1000000));
+
+  fprintf(stderr, "RADOSFS DEBUG %d-%.2d-%.2d %.2d:%.2d:%.2d.%.03d, %s:%.2d -- %s\n",
+          currentTime.tm_year + 1900,
+          currentTime.tm_mon,
+          currentTime.tm_mday,
+          currentTime.tm_hour,
+          currentTime.tm_min,
+          currentTime.tm_sec,
+          milliseconds,
+          message.file,
+          message.line,
+          message.text);
+}
+
+static bool
+messageIsOlder(const LogMessage *message1, const LogMessage *message2)
+{
+  if (message1->time.tv_sec != message2->time.tv_sec)
+    return message1->time.tv_sec < message2->time.tv_sec;
+
+  return message1->time.tv_nsec < message2->time.tv_nsec;
+}
+
+void
+LogBackend::drain(void)
+{
+  boost::unique_lock<boost::mutex> drainLock(mDrainMutex);
+  std::vector<LogRingBuffer *> buffers;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mBuffersMutex);
+    buffers = mBuffers;
+  }
+
+  std::vector<const LogMessage *> messages;
+  std::vector<uint64_t> heads(buffers.size());
+  std::vector<bool> orphaned(buffers.size());
+
+  for (size_t i = 0; i < buffers.size(); i++)
+  {
+    LogRingBuffer *buffer = buffers[i];
+
+    // If the buffer is orphaned, its thread is gone so nothing else is written
+    // after the head read here
+    orphaned[i] = __atomic_load_n(&buffer->orphaned, __ATOMIC_ACQUIRE);
+    heads[i] = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+
+    for (uint64_t pos = buffer->tail; pos < heads[i]; pos++)
+      messages.push_back(&buffer->messages[pos % LOG_RING_BUFFER_SLOTS]);
+  }
+
+  // Messages of different threads are printed in the order they were logged
+  std::stable_sort(messages.begin(), messages.end(), messageIsOlder);
+
+  for (size_t i = 0; i < messages.size(); i++)
+    printMessage(*messages[i]);
+
+  for (size_t i = 0; i < buffers.size(); i++)
+  {
+    LogRingBuffer *buffer = buffers[i];
+    __atomic_store_n(&buffer->tail, heads[i], __ATOMIC_RELEASE);
+
+    const uint64_t dropped = __atomic_load_n(&buffer->dropped,
+                                             __ATOMIC_RELAXED);
+
+    if (dropped != buffer->reportedDropped)
+    {
+      fprintf(stderr, "RADOSFS DEBUG -- %lu messages were dropped because "
+              "the log buffer was full\n",
+              (unsigned long) (dropped - buffer->reportedDropped));
+      buffer->reportedDropped = dropped;
+    }
+
+    if (orphaned[i])
+    {
+      boost::unique_lock<boost::mutex> lock(mBuffersMutex);
+      mBuffers.erase(std::find(mBuffers.begin(), mBuffers.end(), buffer));
+      delete buffer;
+    }
+  }
+
+  for (int i = 0; i < Filesystem::LOG_CATEGORY_COUNT; i++)
+  {
+    const uint64_t suppressed = __atomic_exchange_n(
+                                  &categoryConfs[i].suppressed, 0,
+                                  __ATOMIC_RELAXED);
+
+    if (suppressed > 0)
+    {
+      fprintf(stderr, "RADOSFS DEBUG -- %lu %s messages were suppressed by "
+              "the rate limit\n", (unsigned long) suppressed,
+              categoryNames[i]);
+    }
+  }
+
+  fflush(stderr);
+}
+
 void
-readConfiguredLogLevel(void *fsLogger)
+LogBackend::flush(void)
+{
+  drain();
+}
+
+void
+LogBackend::checkConfiguredLogLevel(void)
 {
   FILE *fp;
   struct stat statBuff;
-  size_t fileSize = 0;
   const int levelMaxChars = 10;
   char level[levelMaxChars];
   level[0] = '\0';
-  Logger *logger = (Logger *) fsLogger;
 
-  while (true)
+  // If there is no configuration file, the level is only set by the API
+  if (stat(LOG_LEVEL_CONF_FILE, &statBuff) != 0)
+  {
+    mCheckLevelFile = false;
+    return;
+  }
+
+  if (mLevelFileSize == (size_t) statBuff.st_size)
+    return;
+
+  mLevelFileSize = statBuff.st_size;
+
+  fp = fopen(LOG_LEVEL_CONF_FILE, "r");
+
+  if (!fp)
+    return;
+
+  if (!fgets(level, levelMaxChars, fp))
+    level[0] = '\0';
+
+  fclose(fp);
+
+  Filesystem::LogLevel previousLevel, newLevel;
+
+  newLevel = Logger::level;
+  previousLevel = newLevel;
+
+  const char *levelNames[] = {"NONE", "DEBUG", 0};
+  const Filesystem::LogLevel levels[] = {Filesystem::LOG_LEVEL_NONE,
+                                 Filesystem::LOG_LEVEL_DEBUG};
+
+  for (int i = 0; levelNames[i] != 0; i++)
   {
-    boost::this_thread::interruption_point();
+    if (strlen(level) < 2)
+    {
+      newLevel = Filesystem::LOG_LEVEL_NONE;
+      break;
+    }
 
-    if (stat(LOG_LEVEL_CONF_FILE, &statBuff) != 0)
+    if (strncmp(level, levelNames[i], strlen(levelNames[i])) == 0)
+    {
+      newLevel = levels[i];
       break;
+    }
+  }
+
+  if (newLevel != previousLevel)
+  {
+    Logger::level = newLevel;
 
-    if (fileSize != (size_t) statBuff.st_size)
+    radosfs_debug("Logger level changed to %s", level);
+  }
+}
+
+void
+LogBackend::run(void)
+{
+  const boost::chrono::milliseconds flushInterval(LOG_FLUSH_INTERVAL);
+  boost::chrono::steady_clock::time_point lastLevelCheck;
+
+  while (true)
+  {
+    boost::chrono::steady_clock::time_point now =
+        boost::chrono::steady_clock::now();
+
+    if (mCheckLevelFile &&
+        now - lastLevelCheck >= boost::chrono::seconds(LOG_LEVEL_CHECK_INTERVAL))
     {
-      fileSize = statBuff.st_size;
+      checkConfiguredLogLevel();
+      lastLevelCheck = now;
+    }
 
-      fp = fopen(LOG_LEVEL_CONF_FILE, "r");
-      fgets(level, levelMaxChars, fp);
+    drain();
 
-      fclose(fp);
+    boost::unique_lock<boost::mutex> lock(mWakeMutex);
 
-      Filesystem::LogLevel previousLevel, newLevel;
+    if (!mWoken)
+      mWakeCond.wait_for(lock, flushInterval);
 
-      newLevel = logger->logLevel();
-      previousLevel = newLevel;
+    mWoken = false;
+  }
+}
 
-      const char *levelNames[] = {"NONE", "DEBUG", 0};
-      const Filesystem::LogLevel levels[] = {Filesystem::LOG_LEVEL_NONE,
-                                     Filesystem::LOG_LEVEL_DEBUG};
+static bool
+shouldLogCategory(Filesystem::LogCategory category)
+{
+  LogCategoryConf &conf = categoryConfs[category];
 
-      for (int i = 0; levelNames[i] != 0; i++)
-      {
-        if (strlen(level) < 2)
-        {
-          newLevel = Filesystem::LOG_LEVEL_NONE;
-          break;
-        }
+  if (conf.sampleRate < 1)
+  {
+    static __thread unsigned int seed = 0;
 
-        if (strncmp(level, levelNames[i], strlen(levelNames[i])) == 0)
-        {
-          newLevel = levels[i];
-          break;
-        }
-      }
+    if (seed == 0)
+      seed = time(0) ^ (unsigned long) &seed;
 
-      if (newLevel != previousLevel)
-      {
-        logger->setLogLevel(newLevel);
+    if (rand_r(&seed) >= conf.sampleRate * RAND_MAX)
+      return false;
+  }
 
-        radosfs_debug("Logger level changed to %s", newLevel);
-      }
-    }
+  const uint64_t maxPerSecond = conf.maxPerSecond;
+
+  if (maxPerSecond == 0)
+    return true;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
 
-    boost::this_thread::interruption_point();
-    boost::this_thread::sleep_for(boost::chrono::seconds(2));
+  uint64_t window = __atomic_load_n(&conf.window, __ATOMIC_RELAXED);
+
+  // The first message of every second starts counting again
+  if (window != (uint64_t) now.tv_sec &&
+      __atomic_compare_exchange_n(&conf.window, &window, now.tv_sec, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+    __atomic_store_n(&conf.windowCount, 0, __ATOMIC_RELAXED);
+  }
+
+  if (__atomic_add_fetch(&conf.windowCount, 1, __ATOMIC_RELAXED) >
+      maxPerSecond)
+  {
+    __atomic_add_fetch(&conf.suppressed, 1, __ATOMIC_RELAXED);
+    return false;
   }
+
+  return true;
 }
 
 Logger::Logger()
-  : thread(&readConfiguredLogLevel, this)
-{}
+{
+  LogBackend::instance();
+}
 
 Logger::~Logger()
 {
-  thread.interrupt();
-  thread.join();
+  flush();
 }
 
 void
 Logger::log(const char *file, const int line, const Filesystem::LogLevel msgLevel,
-            const char *msg,
+            const Filesystem::LogCategory category, const char *msg,
             ...)
 {
   Filesystem::LogLevel currentLevel = Logger::level;
+  const bool levelEnabled = currentLevel != Filesystem::LOG_LEVEL_NONE &&
+                            (currentLevel & msgLevel) != 0;
 
-  if (currentLevel == Filesystem::LOG_LEVEL_NONE || (currentLevel & msgLevel) == 0)
+  if (!levelEnabled &&
+      (numEnabledCategories == 0 || !categoryConfs[category].enabled))
+  {
     return;
+  }
 
-  va_list args;
-
-  va_start(args, msg);
+  if (!shouldLogCategory(category))
+    return;
 
-  char *buffer = new char[mBufferMaxSize];
+  LogBackend &backend = LogBackend::instance();
+  LogRingBuffer *buffer = backend.threadBuffer();
+  const uint64_t head = buffer->head;
+  const uint64_t used = head - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
 
-  vsnprintf(buffer, mBufferMaxSize, msg, args);
+  if (used >= LOG_RING_BUFFER_SLOTS)
+  {
+    __atomic_store_n(&buffer->dropped, buffer->dropped + 1, __ATOMIC_RELAXED);
+    backend.wake();
+    return;
+  }
 
-  struct timespec times;
-  clock_gettime(CLOCK_REALTIME, &times);
+  LogMessage &message = buffer->messages[head % LOG_RING_BUFFER_SLOTS];
 
-  time_t _time = times.tv_sec;
-  struct tm *currentTime = localtime(&_time);
+  // The arguments may point to temporaries so they cannot outlive this call:
+  // only formatting them is done here, everything else happens in the log
+  // thread
+  va_list args;
 
-  int milliseconds = round(static_cast<double>(times.tv_nsec / 1000000));
+  va_start(args, msg);
+  vsnprintf(message.text, LOG_MESSAGE_MAX_SIZE, msg, args);
+  va_end(args);
 
-  fprintf(stderr, "RADOSFS DEBUG %d-%.2d-%.2d %.2d:%.2d:%.2d.%.03d, %s:%.2d -- %s\n",
-          currentTime->tm_year + 1900,
-          currentTime->tm_mon,
-          currentTime->tm_mday,
-          currentTime->tm_hour,
-          currentTime->tm_min,
-          currentTime->tm_sec,
-          milliseconds,
-          file,
-          line,
-          buffer);
+  message.file = file;
+  message.line = line;
+  clock_gettime(CLOCK_REALTIME, &message.time);
 
-  va_end(args);
+  __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
 
-  delete[] buffer;
+  if (used + 1 >= LOG_RING_BUFFER_SLOTS / 2)
+    backend.wake();
 }
 
 void
@@ -166,4 +500,58 @@ Logger::logLevel()
   return currentLevel;
 }
 
+void
+Logger::setCategoryEnabled(Filesystem::LogCategory category, bool enabled)
+{
+  static boost::mutex mutex;
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  if (categoryConfs[category].enabled == enabled)
+    return;
+
+  categoryConfs[category].enabled = enabled;
+
+  if (enabled)
+    numEnabledCategories++;
+  else
+    numEnabledCategories--;
+}
+
+bool
+Logger::categoryEnabled(Filesystem::LogCategory category)
+{
+  return categoryConfs[category].enabled;
+}
+
+void
+Logger::setCategoryRateLimit(Filesystem::LogCategory category,
+                             size_t messagesPerSecond)
+{
+  categoryConfs[category].maxPerSecond = messagesPerSecond;
+}
+
+size_t
+Logger::categoryRateLimit(Filesystem::LogCategory category)
+{
+  return categoryConfs[category].maxPerSecond;
+}
+
+void
+Logger::setCategorySampleRate(Filesystem::LogCategory category, double rate)
+{
+  categoryConfs[category].sampleRate = std::min(std::max(rate, 0.0), 1.0);
+}
+
+double
+Logger::categorySampleRate(Filesystem::LogCategory category)
+{
+  return categoryConfs[category].sampleRate;
+}
+
+void
+Logger::flush(void)
+{
+  LogBackend::instance().flush();
+}
+
 RADOS_FS_END_NAMESPACE
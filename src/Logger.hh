@@ -2,6 +2,7 @@
 #define __RADOS_FS_LOGGER_HH__
 
 #include <boost/thread.hpp>
+#include <stdint.h>
 #include <string>
 
 #include "radosfsdefines.h"
@@ -10,10 +11,23 @@
 #define radosfs_debug(...) radosfs::Logger::log(__FILE__, \
                                         __LINE__, \
                                         radosfs::Filesystem::LOG_LEVEL_DEBUG, \
+                                        radosfs::Filesystem::LOG_CATEGORY_GENERAL, \
                                         __VA_ARGS__)
 
+// For the messages of hot paths: they can be logged on their own (even if the
+// log level is LOG_LEVEL_NONE) and be rate-limited or sampled
+#define radosfs_debug_category(category, ...) \
+  radosfs::Logger::log(__FILE__, \
+                       __LINE__, \
+                       radosfs::Filesystem::LOG_LEVEL_DEBUG, \
+                       radosfs::Filesystem::LOG_CATEGORY_##category, \
+                       __VA_ARGS__)
+
 RADOS_FS_BEGIN_NAMESPACE
 
+// The messages are written to each thread's own ring buffer, without locking,
+// and printed by a background thread (that also checks the configured log
+// level), so logging does not block the threads doing the I/O
 class Logger
 {
 public:
@@ -25,16 +39,27 @@ public:
   static void log(const char *file,
                   const int line,
                   const Filesystem::LogLevel l,
+                  const Filesystem::LogCategory category,
                   const char *msg,
                   ...);
 
   void setLogLevel(const Filesystem::LogLevel level);
   Filesystem::LogLevel logLevel(void);
 
+  static void setCategoryEnabled(Filesystem::LogCategory category,
+                                 bool enabled);
+  static bool categoryEnabled(Filesystem::LogCategory category);
+  static void setCategoryRateLimit(Filesystem::LogCategory category,
+                                   size_t messagesPerSecond);
+  static size_t categoryRateLimit(Filesystem::LogCategory category);
+  static void setCategorySampleRate(Filesystem::LogCategory category,
+                                    double rate);
+  static double categorySampleRate(Filesystem::LogCategory category);
+
+  static void flush(void);
+
 private:
-  static const int mBufferMaxSize = 1024;
   boost::mutex mLevelMutex;
-  boost::thread thread;
 };
 
 RADOS_FS_END_NAMESPACE
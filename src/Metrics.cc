@@ -0,0 +1,244 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <cstring>
+
+#include "Metrics.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+static const char *opNames[] =
+{
+  "stat",
+  "create",
+  "write",
+  "read",
+  "lock",
+  "dir_log_read",
+  "dir_compaction",
+  "quota_update"
+};
+
+static const char *counterNames[] =
+{
+  "bytes_written",
+  "bytes_read",
+  "lock_retries",
+  "dir_log_bytes_parsed",
+  "dir_cache_hits",
+  "dir_cache_misses",
+  "inline_buffer_cas_retries",
+  "quota_deltas_aggregated"
+};
+
+static uint64_t lastMetricsId = 0;
+
+struct CurrentThreadMetrics
+{
+  uint64_t owner;
+  void *metrics;
+};
+
+static __thread CurrentThreadMetrics currentThreadMetrics = {0, 0};
+
+// Only the thread that owns the counters changes them, so they do not need to
+// be atomically incremented but only to be read (from another thread) without
+// tearing
+static inline void
+increment(uint64_t *counter, uint64_t value)
+{
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                   __ATOMIC_RELAXED);
+}
+
+static inline uint64_t
+load(const uint64_t *counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static size_t
+latencyBucket(uint64_t latencyUs)
+{
+  size_t bucket = 0;
+
+  while (latencyUs > 0 && bucket < Metrics::numLatencyBuckets - 1)
+  {
+    latencyUs >>= 1;
+    bucket++;
+  }
+
+  return bucket;
+}
+
+Metrics::Metrics(void)
+  : mId(__sync_add_and_fetch(&lastMetricsId, 1))
+{
+  memset(&mBaseline, 0, sizeof(mBaseline));
+}
+
+Metrics::~Metrics(void)
+{
+  std::map<boost::thread::id, ThreadMetrics *>::iterator it;
+
+  for (it = mThreadMetrics.begin(); it != mThreadMetrics.end(); it++)
+    delete (*it).second;
+}
+
+Metrics::ThreadMetrics *
+Metrics::threadMetrics(void)
+{
+  if (currentThreadMetrics.owner == mId)
+    return static_cast<ThreadMetrics *>(currentThreadMetrics.metrics);
+
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  ThreadMetrics *&metrics = mThreadMetrics[boost::this_thread::get_id()];
+
+  if (!metrics)
+  {
+    metrics = new ThreadMetrics;
+    memset(metrics, 0, sizeof(*metrics));
+  }
+
+  currentThreadMetrics.owner = mId;
+  currentThreadMetrics.metrics = metrics;
+
+  return metrics;
+}
+
+void
+Metrics::recordOp(Op op, uint64_t latencyUs, int ret)
+{
+  ThreadMetrics *metrics = threadMetrics();
+
+  increment(&metrics->counts[op], 1);
+  increment(&metrics->latencies[op], latencyUs);
+  increment(&metrics->histograms[op][latencyBucket(latencyUs)], 1);
+
+  if (ret < 0)
+    increment(&metrics->errors[op], 1);
+}
+
+void
+Metrics::add(Counter counter, uint64_t value)
+{
+  increment(&threadMetrics()->counters[counter], value);
+}
+
+// Important: this method needs to be run in a scope where mMutex is locked
+void
+Metrics::sum(ThreadMetrics &total)
+{
+  memset(&total, 0, sizeof(total));
+
+  const size_t numValues = sizeof(total) / sizeof(uint64_t);
+  uint64_t *totalValues = reinterpret_cast<uint64_t *>(&total);
+
+  std::map<boost::thread::id, ThreadMetrics *>::const_iterator it;
+  for (it = mThreadMetrics.begin(); it != mThreadMetrics.end(); it++)
+  {
+    const uint64_t *values = reinterpret_cast<const uint64_t *>((*it).second);
+
+    for (size_t i = 0; i < numValues; i++)
+      totalValues[i] += load(&values[i]);
+  }
+}
+
+void
+Metrics::get(FilesystemMetrics &metrics)
+{
+  ThreadMetrics total;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    sum(total);
+
+    const size_t numValues = sizeof(total) / sizeof(uint64_t);
+    uint64_t *totalValues = reinterpret_cast<uint64_t *>(&total);
+    const uint64_t *baseline = reinterpret_cast<const uint64_t *>(&mBaseline);
+
+    for (size_t i = 0; i < numValues; i++)
+      totalValues[i] -= baseline[i];
+  }
+
+  for (size_t i = 0; i < OP_COUNT; i++)
+  {
+    OpMetrics &opMetrics = metrics.operations[opNames[i]];
+    opMetrics.count = total.counts[i];
+    opMetrics.errors = total.errors[i];
+    opMetrics.totalLatencyUs = total.latencies[i];
+    opMetrics.latencyHistogram.assign(total.histograms[i],
+                                      total.histograms[i] + numLatencyBuckets);
+  }
+
+  for (size_t i = 0; i < COUNTER_COUNT; i++)
+    metrics.counters[counterNames[i]] = total.counters[i];
+}
+
+void
+Metrics::reset(void)
+{
+  // Other threads may be changing their counters, so instead of clearing
+  // them, what they have counted so far is discounted from now on
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  sum(mBaseline);
+}
+
+const char *
+Metrics::opName(Op op)
+{
+  return opNames[op];
+}
+
+const char *
+Metrics::counterName(Counter counter)
+{
+  return counterNames[counter];
+}
+
+MetricsTimer::MetricsTimer(Metrics *metrics, Metrics::Op op)
+  : mMetrics(metrics),
+    mOp(op),
+    mStart(boost::chrono::steady_clock::now())
+{}
+
+MetricsTimer::~MetricsTimer(void)
+{
+  finish(0);
+}
+
+int
+MetricsTimer::finish(int ret)
+{
+  if (!mMetrics)
+    return ret;
+
+  boost::chrono::microseconds latency =
+      boost::chrono::duration_cast<boost::chrono::microseconds>(
+        boost::chrono::steady_clock::now() - mStart);
+
+  mMetrics->recordOp(mOp, latency.count(), ret);
+  mMetrics = 0;
+
+  return ret;
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,121 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __METRICS_HH__
+#define __METRICS_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include "Filesystem.hh"
+#include "radosfsdefines.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Counts the operations done by a Filesystem and how long they took. Each
+// thread updates its own set of counters without any locking (the mutex is
+// only taken the first time a thread records something), and they are only
+// added up when the metrics are requested.
+class Metrics
+{
+public:
+  enum Op
+  {
+    OP_STAT = 0,
+    OP_CREATE,
+    OP_WRITE,
+    OP_READ,
+    OP_LOCK,
+    OP_DIR_LOG_READ,
+    OP_DIR_COMPACTION,
+    OP_QUOTA_UPDATE,
+    OP_COUNT
+  };
+
+  enum Counter
+  {
+    COUNTER_BYTES_WRITTEN = 0,
+    COUNTER_BYTES_READ,
+    COUNTER_LOCK_RETRIES,
+    COUNTER_DIR_LOG_BYTES_PARSED,
+    COUNTER_DIR_CACHE_HITS,
+    COUNTER_DIR_CACHE_MISSES,
+    COUNTER_INLINE_BUFFER_CAS_RETRIES,
+    COUNTER_QUOTA_DELTAS_AGGREGATED,
+    COUNTER_COUNT
+  };
+
+  static const size_t numLatencyBuckets = METRICS_LATENCY_BUCKETS;
+
+  Metrics(void);
+  virtual ~Metrics(void);
+
+  void recordOp(Op op, uint64_t latencyUs, int ret);
+  void add(Counter counter, uint64_t value = 1);
+  void get(FilesystemMetrics &metrics);
+  void reset(void);
+
+  static const char *opName(Op op);
+  static const char *counterName(Counter counter);
+
+private:
+  struct ThreadMetrics
+  {
+    uint64_t counts[OP_COUNT];
+    uint64_t errors[OP_COUNT];
+    uint64_t latencies[OP_COUNT];
+    uint64_t histograms[OP_COUNT][numLatencyBuckets];
+    uint64_t counters[COUNTER_COUNT];
+  };
+
+  ThreadMetrics *threadMetrics(void);
+  void sum(ThreadMetrics &total);
+
+  // The ids are never reused, so a thread's cached set of counters cannot be
+  // mistaken for one of an instance that got the same address
+  uint64_t mId;
+  std::map<boost::thread::id, ThreadMetrics *> mThreadMetrics;
+  // What had been counted when the metrics were last reset
+  ThreadMetrics mBaseline;
+  boost::mutex mMutex;
+};
+
+// Records the latency of an operation in the given Metrics (if any) when it
+// is finished or goes out of scope
+class MetricsTimer
+{
+public:
+  MetricsTimer(Metrics *metrics, Metrics::Op op);
+  ~MetricsTimer(void);
+
+  int finish(int ret);
+
+private:
+  Metrics *mMetrics;
+  Metrics::Op mOp;
+  boost::chrono::steady_clock::time_point mStart;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __METRICS_HH__ */
@@ -0,0 +1,274 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include "FsObj.hh"
+#include "OpRecorder.hh"
+#include "Tracer.hh"
+#include "radosfsdefines.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+static const char *opNames[] =
+{
+  "stat",
+  "read",
+  "write",
+  "write_sync",
+  "create_file",
+  "remove_file",
+  "truncate",
+  "create_dir",
+  "remove_dir",
+  "list",
+  "find"
+};
+
+static __thread bool recordingOp = false;
+
+OpRecorder::OpRecorder(void)
+  : mRecording(false),
+    mFile(0),
+    mBuffer(0)
+{}
+
+OpRecorder::~OpRecorder(void)
+{
+  stop();
+}
+
+int
+OpRecorder::start(const std::string &path)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  if (mFile)
+    return -EBUSY;
+
+  FILE *file = fopen(path.c_str(), "w");
+
+  if (!file)
+    return -errno;
+
+  mBuffer = new char[OP_RECORDER_BUFFER_SIZE];
+  setvbuf(file, mBuffer, _IOFBF, OP_RECORDER_BUFFER_SIZE);
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, OP_RECORDER_MAGIC, sizeof(header.magic));
+  header.version = OP_RECORDER_VERSION;
+  header.recordSize = sizeof(Record);
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+  {
+    int ret = -errno;
+    fclose(file);
+    delete [] mBuffer;
+    mBuffer = 0;
+
+    return ret;
+  }
+
+  mFile = file;
+  mEpoch = Clock::now();
+  mRecording = true;
+
+  return 0;
+}
+
+void
+OpRecorder::stop(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  mRecording = false;
+
+  if (!mFile)
+    return;
+
+  fclose(mFile);
+  mFile = 0;
+
+  delete [] mBuffer;
+  mBuffer = 0;
+}
+
+void
+OpRecorder::record(Op op, uint16_t flags, uint64_t pathHash,
+                   uint64_t parentHash, uint64_t offset, uint64_t length,
+                   const Clock::time_point &start, int ret)
+{
+  const Clock::time_point end = Clock::now();
+  Record record;
+
+  record.pathHash = pathHash;
+  record.parentHash = parentHash;
+  record.offset = offset;
+  record.length = length;
+  record.durationUs =
+      boost::chrono::duration_cast<boost::chrono::microseconds>(
+        end - start).count();
+  record.threadId = Tracer::currentThreadId();
+  record.ret = ret;
+  record.op = op;
+  record.flags = flags;
+
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  // The recording may have been stopped (and started again) meanwhile
+  if (!mFile || start < mEpoch)
+    return;
+
+  record.startUs =
+      boost::chrono::duration_cast<boost::chrono::microseconds>(
+        start - mEpoch).count();
+
+  fwrite(&record, sizeof(record), 1, mFile);
+}
+
+const char *
+OpRecorder::opName(Op op)
+{
+  if (op < 0 || op >= OP_COUNT)
+    return "unknown";
+
+  return opNames[op];
+}
+
+// Reads the records of a file written by an OpRecorder. A record cut short at
+// the end of the file (e.g. because the recording process crashed) is
+// ignored.
+int
+OpRecorder::readRecords(const std::string &path, std::vector<Record> &records)
+{
+  FILE *file = fopen(path.c_str(), "r");
+
+  if (!file)
+    return -errno;
+
+  Header header;
+  int ret = 0;
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, OP_RECORDER_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != OP_RECORDER_VERSION ||
+      header.recordSize != sizeof(Record))
+  {
+    ret = -EINVAL;
+  }
+
+  Record record;
+
+  while (ret == 0 && fread(&record, sizeof(record), 1, file) == 1)
+    records.push_back(record);
+
+  if (ret == 0 && ferror(file))
+    ret = -EIO;
+
+  fclose(file);
+
+  return ret;
+}
+
+RecordedOp::RecordedOp(OpRecorder *recorder, OpRecorder::Op op,
+                       const std::string &path, uint64_t offset,
+                       uint64_t length)
+  : mRecorder(0),
+    mOp(op),
+    mFlags(0),
+    mPathHash(0),
+    mParentHash(0),
+    mOffset(offset),
+    mLength(length)
+{
+  if (begin(recorder))
+    setPath(path);
+}
+
+RecordedOp::RecordedOp(OpRecorder *recorder, OpRecorder::Op op,
+                       const FsObj *obj, uint64_t offset, uint64_t length)
+  : mRecorder(0),
+    mOp(op),
+    mFlags(0),
+    mPathHash(0),
+    mParentHash(0),
+    mOffset(offset),
+    mLength(length)
+{
+  if (begin(recorder))
+    setPath(obj->path());
+}
+
+bool
+RecordedOp::begin(OpRecorder *recorder)
+{
+  if (!recorder || !recorder->recording() || recordingOp)
+    return false;
+
+  mRecorder = recorder;
+  recordingOp = true;
+  mStart = OpRecorder::Clock::now();
+
+  return true;
+}
+
+void
+RecordedOp::setPath(const std::string &path)
+{
+  const std::string &parent = getParentDir(path, 0);
+
+  mPathHash = hash(path.c_str());
+
+  if (!parent.empty())
+    mParentHash = hash(parent.c_str());
+}
+
+RecordedOp::~RecordedOp(void)
+{
+  finish(0);
+}
+
+int
+RecordedOp::finish(int ret)
+{
+  if (!mRecorder)
+    return ret;
+
+  mRecorder->record(mOp, mFlags, mPathHash, mParentHash, mOffset, mLength,
+                    mStart, ret);
+  mRecorder = 0;
+  recordingOp = false;
+
+  return ret;
+}
+
+UnrecordedOps::UnrecordedOps(void)
+  : mWasRecording(recordingOp)
+{
+  recordingOp = true;
+}
+
+UnrecordedOps::~UnrecordedOps(void)
+{
+  recordingOp = mWasRecording;
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,159 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __OP_RECORDER_HH__
+#define __OP_RECORDER_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+class FsObj;
+
+// Records the operations done through the public API (which one, on which
+// path, at what offset and with which size, when, for how long, from which
+// thread and its result) to a file, so a real workload can be replayed
+// later by the libradosfs-replay tool. Only hashes of the paths are kept.
+// The file starts with a Header and is followed by fixed-size Records, both
+// in the host's byte order.
+class OpRecorder
+{
+public:
+  typedef boost::chrono::steady_clock Clock;
+
+  enum Op
+  {
+    OP_STAT = 0,
+    OP_READ,
+    OP_WRITE,
+    OP_WRITE_SYNC,
+    OP_CREATE_FILE,
+    OP_REMOVE_FILE,
+    OP_TRUNCATE,
+    OP_CREATE_DIR,
+    OP_REMOVE_DIR,
+    OP_LIST,
+    OP_FIND,
+    OP_COUNT
+  };
+
+  enum Flags
+  {
+    FLAG_DIR = 1
+  };
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+  };
+
+  struct Record
+  {
+    uint64_t startUs;
+    uint64_t pathHash;
+    uint64_t parentHash;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t durationUs;
+    uint32_t threadId;
+    int32_t ret;
+    uint16_t op;
+    uint16_t flags;
+  };
+
+  OpRecorder(void);
+  virtual ~OpRecorder(void);
+
+  int start(const std::string &path);
+  void stop(void);
+  bool recording(void) const { return mRecording; }
+  void record(Op op, uint16_t flags, uint64_t pathHash, uint64_t parentHash,
+              uint64_t offset, uint64_t length, const Clock::time_point &start,
+              int ret);
+
+  static const char * opName(Op op);
+  static int readRecords(const std::string &path,
+                         std::vector<Record> &records);
+
+private:
+  volatile bool mRecording;
+  FILE *mFile;
+  char *mBuffer;
+  Clock::time_point mEpoch;
+  boost::mutex mMutex;
+};
+
+// Records an operation in an OpRecorder when it is finished or goes out of
+// scope. Operations started while recording another one in the same thread
+// (e.g. the stat done by a read) are not recorded, as replaying the outer
+// one already does them.
+class RecordedOp
+{
+public:
+  RecordedOp(OpRecorder *recorder, OpRecorder::Op op, const std::string &path,
+             uint64_t offset = 0, uint64_t length = 0);
+
+  // Only gets the object's path if the operation is recorded
+  RecordedOp(OpRecorder *recorder, OpRecorder::Op op, const FsObj *obj,
+             uint64_t offset = 0, uint64_t length = 0);
+
+  ~RecordedOp(void);
+
+  void setFlags(uint16_t flags) { mFlags = flags; }
+  int finish(int ret);
+
+private:
+  bool begin(OpRecorder *recorder);
+  void setPath(const std::string &path);
+
+  OpRecorder *mRecorder;
+  OpRecorder::Op mOp;
+  uint16_t mFlags;
+  uint64_t mPathHash;
+  uint64_t mParentHash;
+  uint64_t mOffset;
+  uint64_t mLength;
+  OpRecorder::Clock::time_point mStart;
+};
+
+// Keeps the operations done by the current thread from being recorded while it
+// exists, for the threads that work on behalf of another operation (which is
+// already recorded in the thread that started it)
+class UnrecordedOps
+{
+public:
+  UnrecordedOps(void);
+  ~UnrecordedOps(void);
+
+private:
+  bool mWasRecording;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __OP_RECORDER_HH__ */
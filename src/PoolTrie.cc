@@ -0,0 +1,216 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include "PoolTrie.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Index used for child nodes that do not exist. The root (index 0) is never
+// anyone's child.
+#define NO_CHILD 0
+
+PoolTrie::PoolTrie(void)
+  : mNodes(1)
+{
+}
+
+PoolTrie::PoolTrie(const PoolMap &pools)
+  : mNodes(1)
+{
+  PoolMap::const_iterator it;
+  for (it = pools.begin(); it != pools.end(); it++)
+    insert((*it).first, PoolList(1, (*it).second));
+}
+
+PoolTrie::PoolTrie(const PoolListMap &pools)
+  : mNodes(1)
+{
+  PoolListMap::const_iterator it;
+  for (it = pools.begin(); it != pools.end(); it++)
+    insert((*it).first, (*it).second);
+}
+
+size_t
+PoolTrie::findChild(const Node &node, char c) const
+{
+  for (size_t i = 0; i < node.children.size(); i++)
+  {
+    if (mNodes[node.children[i]].label[0] == c)
+      return node.children[i];
+  }
+
+  return NO_CHILD;
+}
+
+void
+PoolTrie::insert(const std::string &prefix, const PoolList &pools)
+{
+  size_t node = 0;
+  size_t pos = 0;
+
+  while (pos < prefix.length())
+  {
+    size_t child = findChild(mNodes[node], prefix[pos]);
+
+    if (child == NO_CHILD)
+    {
+      Node newNode;
+      newNode.label = prefix.substr(pos);
+      newNode.pools = pools;
+      mNodes.push_back(newNode);
+      mNodes[node].children.push_back(mNodes.size() - 1);
+
+      return;
+    }
+
+    const std::string label = mNodes[child].label;
+    size_t common = 0;
+
+    while (common < label.length() && pos + common < prefix.length() &&
+           label[common] == prefix[pos + common])
+    {
+      common++;
+    }
+
+    // The prefix diverges from the child's label, so the label is split with
+    // a new node for the common part that gets the child as its own child
+    if (common < label.length())
+    {
+      Node middle;
+      middle.label = label.substr(0, common);
+      middle.children.push_back(child);
+      mNodes.push_back(middle);
+
+      const size_t middleIndex = mNodes.size() - 1;
+      mNodes[child].label = label.substr(common);
+
+      std::vector<size_t> &siblings = mNodes[node].children;
+      for (size_t i = 0; i < siblings.size(); i++)
+      {
+        if (siblings[i] == child)
+          siblings[i] = middleIndex;
+      }
+
+      child = middleIndex;
+    }
+
+    node = child;
+    pos += common;
+  }
+
+  mNodes[node].pools = pools;
+}
+
+// Moves to the child of node that matches the path at pos, if there is one
+bool
+PoolTrie::followChild(const std::string &path, size_t *node,
+                      size_t *pos) const
+{
+  if (*pos >= path.length())
+    return false;
+
+  const size_t child = findChild(mNodes[*node], path[*pos]);
+
+  if (child == NO_CHILD)
+    return false;
+
+  const std::string &label = mNodes[child].label;
+
+  if (path.compare(*pos, label.length(), label) != 0)
+    return false;
+
+  *node = child;
+  *pos += label.length();
+
+  return true;
+}
+
+// Gets the pools of the longest prefix of path, or null if there is none
+const PoolList *
+PoolTrie::find(const std::string &path) const
+{
+  const PoolList *pools = 0;
+  size_t node = 0;
+  size_t pos = 0;
+
+  while (followChild(path, &node, &pos))
+  {
+    if (!mNodes[node].pools.empty())
+      pools = &mNodes[node].pools;
+  }
+
+  return pools;
+}
+
+// Gets the pool called poolName from the longest prefix of path that has it
+PoolSP
+PoolTrie::find(const std::string &path, const std::string &poolName) const
+{
+  PoolSP pool;
+  size_t node = 0;
+  size_t pos = 0;
+
+  while (followChild(path, &node, &pos))
+  {
+    const PoolList &pools = mNodes[node].pools;
+
+    for (size_t i = 0; i < pools.size(); i++)
+    {
+      if (pools[i]->name == poolName)
+      {
+        pool = pools[i];
+        break;
+      }
+    }
+  }
+
+  return pool;
+}
+
+PoolTrieHolder::PoolTrieHolder(void)
+  : mTrie(new PoolTrie)
+{
+}
+
+PoolTrieHolder::~PoolTrieHolder(void)
+{
+  reset();
+  delete mTrie;
+}
+
+void
+PoolTrieHolder::replace(PoolTrie *trie)
+{
+  PoolTrie *oldTrie = __atomic_exchange_n(&mTrie, trie, __ATOMIC_ACQ_REL);
+  mRetired.push_back(oldTrie);
+}
+
+void
+PoolTrieHolder::reset(void)
+{
+  replace(new PoolTrie);
+
+  for (size_t i = 0; i < mRetired.size(); i++)
+    delete mRetired[i];
+
+  mRetired.clear();
+}
+
+RADOS_FS_END_NAMESPACE
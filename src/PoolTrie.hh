@@ -0,0 +1,96 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __POOL_TRIE_HH__
+#define __POOL_TRIE_HH__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+typedef std::vector<PoolSP> PoolList;
+
+typedef std::map<std::string, PoolSP> PoolMap;
+typedef std::map<std::string, PoolList>  PoolListMap;
+
+// An immutable radix trie over the prefixes the pools are configured for,
+// used to find the pool(s) with the longest prefix of a path without going
+// through all the prefixes.
+class PoolTrie
+{
+public:
+  PoolTrie(void);
+  explicit PoolTrie(const PoolMap &pools);
+  explicit PoolTrie(const PoolListMap &pools);
+
+  const PoolList *find(const std::string &path) const;
+  PoolSP find(const std::string &path, const std::string &poolName) const;
+
+private:
+  struct Node
+  {
+    std::string label;
+    std::vector<size_t> children;
+    PoolList pools;
+  };
+
+  void insert(const std::string &prefix, const PoolList &pools);
+  size_t findChild(const Node &node, char c) const;
+  bool followChild(const std::string &path, size_t *node, size_t *pos) const;
+
+  std::vector<Node> mNodes;
+};
+
+// Holds the current PoolTrie of a pool map so it can be looked up without
+// taking the map's lock: a new trie is published atomically whenever the map
+// changes. The replaced tries cannot be deleted while a lookup may still be
+// using them, so they are kept until the holder is reset or destroyed (which
+// is cheap since the pools are rarely reconfigured).
+class PoolTrieHolder
+{
+public:
+  PoolTrieHolder(void);
+  ~PoolTrieHolder(void);
+
+  const PoolTrie *get(void) const
+  { return __atomic_load_n(&mTrie, __ATOMIC_ACQUIRE); }
+
+  // Must be called with the lock of the map the trie is built from
+  template<typename T>
+  void publish(const T &pools)
+  { replace(new PoolTrie(pools)); }
+
+  // Drops all the tries, only to be used when no lookups can be happening
+  void reset(void);
+
+private:
+  void replace(PoolTrie *trie);
+
+  PoolTrie *mTrie;
+  std::vector<PoolTrie *> mRetired;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __POOL_TRIE_HH__ */
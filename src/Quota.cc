@@ -22,6 +22,7 @@
 #include <map>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <rados/librados.hpp>
 
 #include "FilesystemPriv.hh"
@@ -86,6 +87,10 @@ QuotaPriv::remove(void)
   if (!exists)
     return -ENOENT;
 
+  // Whatever was still to be added to its sizes is no longer needed
+  if (fs)
+    fs->mPriv->dropQuotaDeltas(pool, name);
+
   return pool->ioctx.remove(name);
 }
 
@@ -97,6 +102,9 @@ QuotaPriv::load()
   if (!pool)
     return -ENODEV;
 
+  // So the sizes read include the updates this instance accumulated
+  flushCurrentSizes();
+
   std::map<std::string, librados::bufferlist> omap;
   int ret = this->pool->ioctx.omap_get_vals(name, "", XATTR_QUOTA_SIZE_PREFIX,
                                             UINT_MAX, &omap);
@@ -207,6 +215,81 @@ QuotaPriv::updateQuota(const std::string &key, int64_t diff)
   return ret;
 }
 
+int
+QuotaPriv::updateCurrentSizes(const std::map<std::string, int64_t> &sizes)
+{
+  if (!fs)
+    return addToCurrentSizes(pool, name, sizes);
+
+  if (fs->mPriv->addQuotaDelta(pool, name, sizes))
+    return 0;
+
+  MetricsTimer timer(&fs->mPriv->metrics, Metrics::OP_QUOTA_UPDATE);
+
+  return timer.finish(addToCurrentSizes(pool, name, sizes));
+}
+
+int
+QuotaPriv::flushCurrentSizes(void)
+{
+  if (!fs)
+    return 0;
+
+  return fs->mPriv->flushQuotaDeltas(pool, name);
+}
+
+template<typename T>
+static void encode(librados::bufferlist *in, const std::string &arg1, T arg2)
+{
+  int length = arg1.length();
+  in->append((char *) &length, sizeof(length));
+  in->append(arg1);
+
+  std::stringstream stream;
+  stream << arg2;
+
+  length = stream.str().length();
+
+  in->append((char *) &length, sizeof(length));
+  in->append(stream.str());
+}
+
+// Adds the given differences to the quota's current sizes (keyed by their omap
+// keys) in a single operation
+int
+QuotaPriv::addToCurrentSizes(PoolSP pool, const std::string &name,
+                             const std::map<std::string, int64_t> &sizes)
+{
+  if (!pool)
+    return -ENODEV;
+
+  librados::ObjectWriteOperation op;
+  // The output buffers are only filled when the operation runs, so they have
+  // to be kept until then
+  std::vector<librados::bufferlist> bls(sizes.size() * 2);
+  size_t opCounter = 0;
+
+  std::map<std::string, int64_t>::const_iterator it;
+  for (it = sizes.begin(); it != sizes.end(); it++)
+  {
+    if ((*it).second == 0)
+      continue;
+
+    librados::bufferlist *in, *out;
+    in = &bls[opCounter];
+    out = &bls[opCounter + 1];
+    opCounter += 2;
+
+    encode(in, (*it).first, (*it).second);
+    op.exec("numops", "add", *in, out, 0);
+  }
+
+  if (opCounter == 0)
+    return 0;
+
+  return pool->ioctx.operate(name, &op);
+}
+
 Quota::Quota()
   : mPriv(new QuotaPriv(0, "", QUOTA_OBJ_PREFIX + generateUuid()))
 {
@@ -288,19 +371,21 @@ getKeyWithPrefix(const char *prefix, const T &key)
 int
 Quota::updateUserCurrentSize(uid_t uid, int64_t difference)
 {
-  const std::string key = getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_USER_PREFIX,
-                                           uid);
+  std::map<std::string, int64_t> sizes;
+  sizes[getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_USER_PREFIX, uid)] =
+      difference;
 
-  return mPriv->updateQuota(key, difference);
+  return mPriv->updateCurrentSizes(sizes);
 }
 
 int
 Quota::updateGroupCurrentSize(gid_t gid, int64_t difference)
 {
-  const std::string key = getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_GROUP_PREFIX,
-                                           gid);
+  std::map<std::string, int64_t> sizes;
+  sizes[getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_GROUP_PREFIX, gid)] =
+      difference;
 
-  return mPriv->updateQuota(key, difference);
+  return mPriv->updateCurrentSizes(sizes);
 }
 
 int
@@ -312,46 +397,13 @@ Quota::setMaxSize(int64_t maxSize)
   return setQuotaSizes(&size, 0, 0);
 }
 
-template<typename T>
-static void encode(librados::bufferlist *in, const std::string &arg1, T arg2)
-{
-  int length = arg1.length();
-  in->append((char *) &length, sizeof(length));
-  in->append(arg1);
-
-  std::stringstream stream;
-  stream << arg2;
-
-  length = stream.str().length();
-
-  in->append((char *) &length, sizeof(length));
-  in->append(stream.str());
-}
-
 int
 Quota::updateCurrentSize(int64_t diff)
 {
-  std::stringstream stream;
-  librados::bufferlist bl1, bl2;
-
-  int length = strlen(XATTR_QUOTA_CURRENT_SIZE);
-  bl1.append((char *) &length, sizeof(length));
-  bl1.append(XATTR_QUOTA_CURRENT_SIZE);
-
-  stream.str("");
-  stream << diff;
-
-  length = stream.str().length();
-
-  bl1.append((char *) &length, sizeof(length));
-  bl1.append(stream.str());
-
-  int addRet;
-
-  librados::ObjectWriteOperation op;
-  op.exec("numops", "add", bl1, &bl2, &addRet);
+  std::map<std::string, int64_t> sizes;
+  sizes[XATTR_QUOTA_CURRENT_SIZE] = diff;
 
-  return mPriv->pool->ioctx.operate(mPriv->name, &op);
+  return mPriv->updateCurrentSizes(sizes);
 }
 
 int
@@ -377,67 +429,36 @@ Quota::updateCurrentSizes(int64_t currentSize,
                          const std::map<uid_t, int64_t> *userCurrentSize,
                          const std::map<uid_t, int64_t> *groupCurrentSize)
 {
-  librados::ObjectWriteOperation op;
-  const size_t numUsers = userCurrentSize ? userCurrentSize->size() : 0;
-  const size_t numGroups = groupCurrentSize ? groupCurrentSize->size() : 0;
-  const size_t totalOps = 1 + numUsers + numGroups;
-
-  librados::bufferlist *bls = new librados::bufferlist[totalOps * 2];
-  size_t opCounter = 0;
+  std::map<std::string, int64_t> sizes;
 
   if (currentSize != 0)
-  {
-    librados::bufferlist *in, *out;
-    in = &bls[opCounter];
-    out = &bls[opCounter + 1];
-
-    encode(in, XATTR_QUOTA_CURRENT_SIZE, currentSize);
-    op.exec("numops", "add", *in, out, 0);
-  }
+    sizes[XATTR_QUOTA_CURRENT_SIZE] = currentSize;
 
   if (userCurrentSize)
   {
     std::map<uid_t, int64_t>::const_iterator it;
-    librados::bufferlist *in, *out;
 
     for (it = userCurrentSize->begin(); it != userCurrentSize->end(); it++)
     {
-      opCounter += 2;
-      in = &bls[opCounter];
-      out = &bls[opCounter + 1];
-
       uid_t user = (*it).first;
-      int64_t size = (*it).second;
-
-      encode(in, getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_USER_PREFIX, user),
-             size);
-      op.exec("numops", "add", *in, out, 0);
+      sizes[getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_USER_PREFIX, user)] =
+          (*it).second;
     }
   }
 
   if (groupCurrentSize)
   {
     std::map<gid_t, int64_t>::const_iterator it;
-    librados::bufferlist *in, *out;
 
     for (it = groupCurrentSize->begin(); it != groupCurrentSize->end(); it++)
     {
-      opCounter += 2;
-      in = &bls[opCounter];
-      out = &bls[opCounter + 1];
-
       gid_t group = (*it).first;
-      int64_t size = (*it).second;
-
-      encode(in, getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_GROUP_PREFIX, group),
-             size);
-      op.exec("numops", "add", *in, out, 0);
+      sizes[getKeyWithPrefix(XATTR_QUOTA_CURRENT_SIZE_GROUP_PREFIX, group)] =
+          (*it).second;
     }
   }
 
-  delete [] bls;
-
-  return mPriv->pool->ioctx.operate(mPriv->name, &op);
+  return mPriv->updateCurrentSizes(sizes);
 }
 
 template<typename T>
@@ -513,6 +534,9 @@ Quota::setQuotaSizes(const QuotaSize *quotaSize,
   if (omap.empty())
     return -EINVAL;
 
+  // The accumulated differences are relative to the sizes being replaced
+  mPriv->flushCurrentSizes();
+
   return mPriv->pool->ioctx.omap_set(mPriv->name, omap);
 }
 
@@ -33,6 +33,13 @@ public:
 
   int updateQuota(const std::string &key, int64_t diff);
 
+  int updateCurrentSizes(const std::map<std::string, int64_t> &sizes);
+
+  int flushCurrentSizes(void);
+
+  static int addToCurrentSizes(PoolSP pool, const std::string &name,
+                               const std::map<std::string, int64_t> &sizes);
+
   int create(int64_t maxSize);
 
   int remove(void);
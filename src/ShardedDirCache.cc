@@ -0,0 +1,281 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include "radosfscommon.h"
+#include "ShardedDirCache.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+ShardedDirCache::ShardedDirCache(size_t maxSize, size_t maxBytes)
+  : mMaxSize(maxSize),
+    mMaxBytes(maxBytes)
+{}
+
+ShardedDirCache::~ShardedDirCache(void)
+{}
+
+ShardedDirCache::Shard &
+ShardedDirCache::shard(const std::string &inode)
+{
+  return mShards[hash(inode.c_str()) % DIR_CACHE_NUM_SHARDS];
+}
+
+size_t
+ShardedDirCache::shardMaxSize(void) const
+{
+  return mMaxSize / DIR_CACHE_NUM_SHARDS;
+}
+
+size_t
+ShardedDirCache::shardMaxBytes(void) const
+{
+  return mMaxBytes / DIR_CACHE_NUM_SHARDS;
+}
+
+std::tr1::shared_ptr<DirCache>
+ShardedDirCache::get(const std::string &inode)
+{
+  std::tr1::shared_ptr<DirCache> cache;
+  Shard &inodeShard = shard(inode);
+  boost::unique_lock<boost::mutex> lock(inodeShard.mutex);
+
+  std::map<std::string, std::list<CacheEntry>::iterator>::iterator it;
+  it = inodeShard.entries.find(inode);
+
+  if (it != inodeShard.entries.end())
+  {
+    inodeShard.lru.splice(inodeShard.lru.begin(), inodeShard.lru, (*it).second);
+    cache = (*(*it).second).cache;
+  }
+
+  return cache;
+}
+
+std::tr1::shared_ptr<DirCache>
+ShardedDirCache::add(std::tr1::shared_ptr<DirCache> cache)
+{
+  std::tr1::shared_ptr<DirCache> existing;
+
+  updateInShard(shard(cache->inode()), cache, true, &existing);
+
+  if (existing)
+    return existing;
+
+  return cache;
+}
+
+void
+ShardedDirCache::update(std::tr1::shared_ptr<DirCache> cache)
+{
+  updateInShard(shard(cache->inode()), cache, false, 0);
+}
+
+void
+ShardedDirCache::updateInShard(Shard &shard,
+                               std::tr1::shared_ptr<DirCache> cache,
+                               bool onlyIfNew,
+                               std::tr1::shared_ptr<DirCache> *existing)
+{
+  // Get the size before locking the shard since it locks the dir's contents;
+  // the number of entries includes the dir itself
+  const size_t size = cache->approximateSize();
+  const size_t numEntries = cache->numCachedEntries() + 1;
+  const std::string &inode = cache->inode();
+  boost::unique_lock<boost::mutex> lock(shard.mutex);
+
+  std::map<std::string, std::list<CacheEntry>::iterator>::iterator it;
+  it = shard.entries.find(inode);
+
+  if (it != shard.entries.end())
+  {
+    std::list<CacheEntry>::iterator entryIt = (*it).second;
+
+    if (onlyIfNew)
+    {
+      shard.lru.splice(shard.lru.begin(), shard.lru, entryIt);
+      *existing = (*entryIt).cache;
+      return;
+    }
+
+    shard.size -= (*entryIt).size;
+    shard.numEntries -= (*entryIt).numEntries;
+    shard.lru.erase(entryIt);
+    shard.entries.erase(it);
+  }
+
+  // A dir that does not fit in its shard is not cached at all
+  if (numEntries > shardMaxSize() || size > shardMaxBytes())
+    return;
+
+  CacheEntry entry;
+  entry.cache = cache;
+  entry.size = size;
+  entry.numEntries = numEntries;
+
+  shard.lru.push_front(entry);
+  shard.entries[inode] = shard.lru.begin();
+  shard.size += size;
+  shard.numEntries += numEntries;
+
+  evict(shard);
+}
+
+// Important: this method needs to be run in a scope where shard.mutex is
+// locked
+void
+ShardedDirCache::evict(Shard &shard)
+{
+  const size_t maxSize = shardMaxSize();
+  const size_t maxBytes = shardMaxBytes();
+
+  while ((shard.numEntries > maxSize || shard.size > maxBytes) &&
+         !shard.lru.empty())
+  {
+    CacheEntry &entry = shard.lru.back();
+
+    shard.size -= entry.size;
+    shard.numEntries -= entry.numEntries;
+    shard.entries.erase(entry.cache->inode());
+    shard.lru.pop_back();
+  }
+}
+
+void
+ShardedDirCache::remove(const std::string &inode)
+{
+  Shard &inodeShard = shard(inode);
+  boost::unique_lock<boost::mutex> lock(inodeShard.mutex);
+
+  std::map<std::string, std::list<CacheEntry>::iterator>::iterator it;
+  it = inodeShard.entries.find(inode);
+
+  if (it != inodeShard.entries.end())
+  {
+    inodeShard.size -= (*(*it).second).size;
+    inodeShard.numEntries -= (*(*it).second).numEntries;
+    inodeShard.lru.erase((*it).second);
+    inodeShard.entries.erase(it);
+  }
+}
+
+bool
+ShardedDirCache::contains(const std::string &inode)
+{
+  Shard &inodeShard = shard(inode);
+  boost::unique_lock<boost::mutex> lock(inodeShard.mutex);
+
+  return inodeShard.entries.count(inode) > 0;
+}
+
+void
+ShardedDirCache::getAll(std::vector<std::tr1::shared_ptr<DirCache> > &caches)
+{
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+
+    std::list<CacheEntry>::iterator it;
+    for (it = mShards[i].lru.begin(); it != mShards[i].lru.end(); it++)
+      caches.push_back((*it).cache);
+  }
+}
+
+void
+ShardedDirCache::clear(void)
+{
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+
+    mShards[i].lru.clear();
+    mShards[i].entries.clear();
+    mShards[i].size = 0;
+    mShards[i].numEntries = 0;
+  }
+}
+
+void
+ShardedDirCache::setMaxSize(size_t maxSize)
+{
+  setLimits(maxSize, mMaxBytes);
+}
+
+void
+ShardedDirCache::setMaxBytes(size_t maxBytes)
+{
+  setLimits(mMaxSize, maxBytes);
+}
+
+void
+ShardedDirCache::setLimits(size_t maxSize, size_t maxBytes)
+{
+  mMaxSize = maxSize;
+  mMaxBytes = maxBytes;
+
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+    evict(mShards[i]);
+  }
+}
+
+size_t
+ShardedDirCache::size(void)
+{
+  size_t totalSize = 0;
+
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+    totalSize += mShards[i].size;
+  }
+
+  return totalSize;
+}
+
+size_t
+ShardedDirCache::numEntries(void)
+{
+  size_t numEntries = 0;
+
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+    numEntries += mShards[i].numEntries;
+  }
+
+  return numEntries;
+}
+
+size_t
+ShardedDirCache::numDirs(void)
+{
+  size_t numDirs = 0;
+
+  for (size_t i = 0; i < DIR_CACHE_NUM_SHARDS; i++)
+  {
+    boost::unique_lock<boost::mutex> lock(mShards[i].mutex);
+    numDirs += mShards[i].entries.size();
+  }
+
+  return numDirs;
+}
+
+RADOS_FS_END_NAMESPACE
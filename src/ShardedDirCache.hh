@@ -0,0 +1,96 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __SHARDED_DIR_CACHE_HH__
+#define __SHARDED_DIR_CACHE_HH__
+
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <string>
+#include <tr1/memory>
+#include <vector>
+
+#include "DirCache.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// An LRU cache of directories, split into shards by inode so that threads
+// using different directories do not contend on the same lock. Each shard gets
+// an equal part of the maximum size (the number of directories plus their
+// entries) and of the maximum bytes (as approximated by
+// DirCache::approximateSize), and evicts its least recently used directories
+// one at a time until it fits in both.
+class ShardedDirCache
+{
+public:
+  ShardedDirCache(size_t maxSize, size_t maxBytes);
+  virtual ~ShardedDirCache(void);
+
+  std::tr1::shared_ptr<DirCache> get(const std::string &inode);
+  std::tr1::shared_ptr<DirCache> add(std::tr1::shared_ptr<DirCache> cache);
+  void update(std::tr1::shared_ptr<DirCache> cache);
+  void remove(const std::string &inode);
+  bool contains(const std::string &inode);
+  void getAll(std::vector<std::tr1::shared_ptr<DirCache> > &caches);
+  void clear(void);
+  void setMaxSize(size_t maxSize);
+  size_t maxSize(void) const { return mMaxSize; }
+  void setMaxBytes(size_t maxBytes);
+  size_t maxBytes(void) const { return mMaxBytes; }
+  size_t size(void);
+  size_t numEntries(void);
+  size_t numDirs(void);
+
+private:
+  struct CacheEntry
+  {
+    std::tr1::shared_ptr<DirCache> cache;
+    size_t size;
+    size_t numEntries;
+  };
+
+  struct Shard
+  {
+    Shard(void) : size(0), numEntries(0) {}
+
+    std::list<CacheEntry> lru;
+    std::map<std::string, std::list<CacheEntry>::iterator> entries;
+    size_t size;
+    size_t numEntries;
+    boost::mutex mutex;
+  };
+
+  Shard & shard(const std::string &inode);
+  size_t shardMaxSize(void) const;
+  size_t shardMaxBytes(void) const;
+  void setLimits(size_t maxSize, size_t maxBytes);
+  void updateInShard(Shard &shard, std::tr1::shared_ptr<DirCache> cache,
+                     bool onlyIfNew, std::tr1::shared_ptr<DirCache> *existing);
+  void evict(Shard &shard);
+
+  Shard mShards[DIR_CACHE_NUM_SHARDS];
+  size_t mMaxSize;
+  size_t mMaxBytes;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __SHARDED_DIR_CACHE_HH__ */
@@ -0,0 +1,190 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include "StatCache.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+StatCache::StatCache(size_t maxEntries, double ttl)
+  : mMaxEntries(maxEntries),
+    mTtl(ttl),
+    mHits(0),
+    mMisses(0)
+{}
+
+StatCache::~StatCache(void)
+{}
+
+bool
+StatCache::get(const std::string &path, Stat *stat)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  if (mTtl <= 0)
+    return false;
+
+  EntryMap::iterator it = mEntries.find(path);
+
+  if (it == mEntries.end())
+  {
+    mMisses++;
+    return false;
+  }
+
+  EntryList::iterator entryIt = (*it).second;
+  boost::chrono::duration<double> age =
+      boost::chrono::steady_clock::now() - (*entryIt).cachedTime;
+
+  if (age.count() >= mTtl)
+  {
+    removeEntry(it);
+    mMisses++;
+    return false;
+  }
+
+  mLru.splice(mLru.begin(), mLru, entryIt);
+  *stat = (*entryIt).stat;
+  mHits++;
+
+  return true;
+}
+
+void
+StatCache::set(const std::string &path, const Stat &stat)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  if (mTtl <= 0 || mMaxEntries == 0)
+    return;
+
+  EntryMap::iterator it = mEntries.find(path);
+
+  if (it != mEntries.end())
+    removeEntry(it);
+
+  CacheEntry entry;
+  entry.path = path;
+  entry.stat = stat;
+  entry.cachedTime = boost::chrono::steady_clock::now();
+
+  mLru.push_front(entry);
+  mEntries[path] = mLru.begin();
+
+  evict();
+}
+
+// Important: this method needs to be run in a scope where mMutex is locked
+void
+StatCache::removeEntry(EntryMap::iterator it)
+{
+  mLru.erase((*it).second);
+  mEntries.erase(it);
+}
+
+// Important: this method needs to be run in a scope where mMutex is locked
+void
+StatCache::evict(void)
+{
+  while (mEntries.size() > mMaxEntries)
+  {
+    mEntries.erase(mLru.back().path);
+    mLru.pop_back();
+  }
+}
+
+void
+StatCache::remove(const std::string &path)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  EntryMap::iterator it = mEntries.find(path);
+
+  if (it != mEntries.end())
+    removeEntry(it);
+}
+
+void
+StatCache::removeWithPrefix(const std::string &prefix)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  EntryMap::iterator it = mEntries.lower_bound(prefix);
+
+  while (it != mEntries.end() &&
+         (*it).first.compare(0, prefix.length(), prefix) == 0)
+  {
+    removeEntry(it++);
+  }
+}
+
+void
+StatCache::clear(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  mLru.clear();
+  mEntries.clear();
+}
+
+void
+StatCache::setMaxEntries(size_t maxEntries)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  mMaxEntries = maxEntries;
+  evict();
+}
+
+void
+StatCache::setTtl(double ttl)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  mTtl = ttl;
+
+  if (mTtl <= 0)
+  {
+    mLru.clear();
+    mEntries.clear();
+  }
+}
+
+size_t
+StatCache::size(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mEntries.size();
+}
+
+uint64_t
+StatCache::hits(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mHits;
+}
+
+uint64_t
+StatCache::misses(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mMisses;
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,82 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __STAT_CACHE_HH__
+#define __STAT_CACHE_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Keeps the results of statting paths for a limited time so that paths that
+// are statted repeatedly do not need to be read from the cluster every time.
+// Only successful stats are kept and a TTL of 0 disables the cache.
+class StatCache
+{
+public:
+  StatCache(size_t maxEntries, double ttl);
+  virtual ~StatCache(void);
+
+  bool get(const std::string &path, Stat *stat);
+  void set(const std::string &path, const Stat &stat);
+  void remove(const std::string &path);
+  void removeWithPrefix(const std::string &prefix);
+  void clear(void);
+  void setMaxEntries(size_t maxEntries);
+  size_t maxEntries(void) const { return mMaxEntries; }
+  void setTtl(double ttl);
+  double ttl(void) const { return mTtl; }
+  size_t size(void);
+  uint64_t hits(void);
+  uint64_t misses(void);
+
+private:
+  struct CacheEntry
+  {
+    std::string path;
+    Stat stat;
+    boost::chrono::steady_clock::time_point cachedTime;
+  };
+
+  typedef std::list<CacheEntry> EntryList;
+  typedef std::map<std::string, EntryList::iterator> EntryMap;
+
+  void removeEntry(EntryMap::iterator it);
+  void evict(void);
+
+  EntryList mLru;
+  EntryMap mEntries;
+  size_t mMaxEntries;
+  double mTtl;
+  uint64_t mHits;
+  uint64_t mMisses;
+  boost::mutex mMutex;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __STAT_CACHE_HH__ */
@@ -0,0 +1,140 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <cstring>
+#include <errno.h>
+
+#include "StatResults.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Pool index used for the records that have no pool
+#define NO_POOL_INDEX ((uint32_t) -1)
+
+StatResults::StatResults(void)
+{
+}
+
+void
+StatResults::addRecord(const std::string &prefix, const std::string &path)
+{
+  Record record;
+  memset(&record, 0, sizeof(Record));
+  record.ret = -ENOENT;
+  record.poolIndex = NO_POOL_INDEX;
+  record.pathOffset = mBuffer.length();
+  record.pathLength = prefix.length() + path.length();
+
+  mBuffer.append(prefix);
+  mBuffer.append(path);
+  mRecords.push_back(record);
+}
+
+void
+StatResults::reset(const std::vector<std::string> &paths)
+{
+  reset("", paths);
+}
+
+// Sets up one record per path (the prefix followed by each of the names), all
+// of them as not found until they are set
+void
+StatResults::reset(const std::string &prefix,
+                   const std::vector<std::string> &names)
+{
+  size_t bufferLength = 0;
+
+  for (size_t i = 0; i < names.size(); i++)
+    bufferLength += prefix.length() + names[i].length();
+
+  mRecords.clear();
+  mPools.clear();
+  mBuffer.clear();
+
+  mRecords.reserve(names.size());
+  mBuffer.reserve(bufferLength);
+
+  for (size_t i = 0; i < names.size(); i++)
+    addRecord(prefix, names[i]);
+}
+
+uint32_t
+StatResults::internPool(const PoolSP &pool)
+{
+  if (!pool)
+    return NO_POOL_INDEX;
+
+  // There are only a few pools configured so a linear search is enough
+  for (size_t i = 0; i < mPools.size(); i++)
+  {
+    if (mPools[i].get() == pool.get())
+      return i;
+  }
+
+  mPools.push_back(pool);
+
+  return mPools.size() - 1;
+}
+
+void
+StatResults::set(size_t index, int ret, const Stat &stat)
+{
+  Record &record = mRecords[index];
+
+  record.ret = ret;
+  record.statBuff = stat.statBuff;
+  record.poolIndex = internPool(stat.pool);
+  record.translatedPathOffset = mBuffer.length();
+  record.translatedPathLength = stat.translatedPath.length();
+
+  mBuffer.append(stat.translatedPath);
+}
+
+StringRef
+StatResults::path(size_t index) const
+{
+  const Record &record = mRecords[index];
+  StringRef ref = {mBuffer.data() + record.pathOffset, record.pathLength};
+
+  return ref;
+}
+
+StringRef
+StatResults::translatedPath(size_t index) const
+{
+  const Record &record = mRecords[index];
+  StringRef ref = {mBuffer.data() + record.translatedPathOffset,
+                   record.translatedPathLength};
+
+  return ref;
+}
+
+PoolSP
+StatResults::pool(size_t index) const
+{
+  const uint32_t poolIndex = mRecords[index].poolIndex;
+
+  if (poolIndex == NO_POOL_INDEX)
+    return PoolSP();
+
+  return mPools[poolIndex];
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,87 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __STAT_RESULTS_HH__
+#define __STAT_RESULTS_HH__
+
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// A reference to a string kept in a StatResults' buffer. It is only valid
+// until the StatResults is modified.
+struct StringRef
+{
+  const char *data;
+  size_t length;
+
+  std::string str(void) const { return std::string(data, length); }
+};
+
+// The results of statting many paths at once, kept in the same order as the
+// paths were given. Instead of a Stat per path (with its own strings, pool
+// reference and extra data), the results are kept as contiguous records that
+// refer to the paths in a single buffer and to a table of the pools used, so
+// statting millions of paths needs only a few allocations.
+class StatResults
+{
+public:
+  StatResults(void);
+
+  void reset(const std::vector<std::string> &paths);
+  void reset(const std::string &prefix, const std::vector<std::string> &names);
+  void set(size_t index, int ret, const Stat &stat);
+
+  size_t size(void) const { return mRecords.size(); }
+  int ret(size_t index) const { return mRecords[index].ret; }
+  const struct stat &statBuff(size_t index) const
+  { return mRecords[index].statBuff; }
+  StringRef path(size_t index) const;
+  StringRef translatedPath(size_t index) const;
+  PoolSP pool(size_t index) const;
+
+private:
+  struct Record
+  {
+    int ret;
+    uint32_t poolIndex;
+    struct stat statBuff;
+    size_t pathOffset;
+    size_t pathLength;
+    size_t translatedPathOffset;
+    size_t translatedPathLength;
+  };
+
+  void addRecord(const std::string &prefix, const std::string &path);
+  uint32_t internPool(const PoolSP &pool);
+
+  std::vector<Record> mRecords;
+  std::vector<PoolSP> mPools;
+  std::string mBuffer;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __STAT_RESULTS_HH__ */
@@ -0,0 +1,269 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Tracer.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+static __thread TraceSpan *currentSpan = 0;
+
+static uint64_t
+microsecondsSince(const Tracer::Clock::time_point &epoch,
+                  const Tracer::Clock::time_point &time)
+{
+  if (time < epoch)
+    return 0;
+
+  return boost::chrono::duration_cast<boost::chrono::microseconds>(
+           time - epoch).count();
+}
+
+static void
+writeJsonString(FILE *file, const std::string &str)
+{
+  fputc('"', file);
+
+  for (size_t i = 0; i < str.length(); i++)
+  {
+    const unsigned char c = str[i];
+
+    if (c == '"' || c == '\\')
+      fprintf(file, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(file, "\\u%04x", c);
+    else
+      fputc(c, file);
+  }
+
+  fputc('"', file);
+}
+
+Tracer::Tracer(size_t maxEvents)
+  : mSampleRate(0),
+    mMaxEvents(maxEvents),
+    mEpoch(Clock::now())
+{}
+
+Tracer::~Tracer(void)
+{}
+
+void
+Tracer::setSampleRate(double rate)
+{
+  mSampleRate = std::min(std::max(rate, 0.0), 1.0);
+}
+
+void
+Tracer::setMaxEvents(size_t maxEvents)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mMaxEvents = maxEvents;
+
+  while (mEvents.size() > mMaxEvents)
+    mEvents.pop_front();
+}
+
+bool
+Tracer::shouldTrace(void)
+{
+  const double rate = mSampleRate;
+
+  if (rate <= 0)
+    return false;
+
+  if (rate >= 1)
+    return true;
+
+  static __thread unsigned int seed = 0;
+
+  if (seed == 0)
+    seed = time(0) ^ (unsigned long) &seed;
+
+  return rand_r(&seed) < rate * RAND_MAX;
+}
+
+void
+Tracer::addSpan(const char *name, const char *category,
+                const std::string &opId, const Clock::time_point &start,
+                const Clock::time_point &end, const std::string &detail)
+{
+  Event event;
+  event.name = name;
+  event.category = category;
+  event.opId = opId;
+  event.detail = detail;
+  event.startUs = microsecondsSince(mEpoch, start);
+  event.durationUs = microsecondsSince(start, end);
+  event.threadId = currentThreadId();
+
+  boost::unique_lock<boost::mutex> lock(mMutex);
+
+  if (mMaxEvents == 0)
+    return;
+
+  // The oldest events are discarded, so the trace always has the most recent
+  // ones
+  if (mEvents.size() >= mMaxEvents)
+    mEvents.pop_front();
+
+  mEvents.push_back(event);
+}
+
+int
+Tracer::exportChromeTrace(const std::string &path)
+{
+  std::deque<Event> events;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    events = mEvents;
+  }
+
+  FILE *file = fopen(path.c_str(), "w");
+
+  if (!file)
+    return -errno;
+
+  const int pid = getpid();
+
+  fprintf(file, "{\"traceEvents\":[\n");
+
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    const Event &event = events[i];
+
+    fprintf(file, "{\"name\":");
+    writeJsonString(file, event.name);
+    fprintf(file, ",\"cat\":");
+    writeJsonString(file, event.category);
+    fprintf(file, ",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,"
+            "\"tid\":%ld,\"args\":{\"op\":",
+            (unsigned long long) event.startUs,
+            (unsigned long long) event.durationUs, pid, event.threadId);
+    writeJsonString(file, event.opId);
+
+    if (!event.detail.empty())
+    {
+      fprintf(file, ",\"detail\":");
+      writeJsonString(file, event.detail);
+    }
+
+    fprintf(file, "}}%s\n", i + 1 < events.size() ? "," : "");
+  }
+
+  fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+
+  int ret = 0;
+
+  if (ferror(file))
+    ret = -EIO;
+
+  if (fclose(file) != 0 && ret == 0)
+    ret = -errno;
+
+  return ret;
+}
+
+size_t
+Tracer::size(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mEvents.size();
+}
+
+void
+Tracer::clear(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  mEvents.clear();
+}
+
+long
+Tracer::currentThreadId(void)
+{
+  static __thread long threadId = 0;
+
+  if (threadId == 0)
+    threadId = syscall(SYS_gettid);
+
+  return threadId;
+}
+
+TraceSpan::TraceSpan(Tracer *tracer, const char *name, const char *category,
+                     const std::string &opId)
+  : mTracer(0),
+    mName(name),
+    mCategory(category),
+    mParent(0)
+{
+  if (tracer)
+    start(tracer, opId);
+}
+
+TraceSpan::TraceSpan(Tracer *tracer, const char *name, const char *category,
+                     bool sample)
+  : mTracer(0),
+    mName(name),
+    mCategory(category),
+    mParent(0)
+{
+  TraceSpan *parent = currentSpan;
+
+  if (parent && (!tracer || parent->mTracer == tracer))
+    start(parent->mTracer, parent->mOpId);
+  else if (tracer && sample && tracer->shouldTrace())
+    start(tracer, "");
+}
+
+TraceSpan::~TraceSpan(void)
+{
+  if (!mTracer)
+    return;
+
+  mTracer->addSpan(mName, mCategory, mOpId, mStart, Tracer::Clock::now(),
+                   mDetail);
+  currentSpan = mParent;
+}
+
+void
+TraceSpan::start(Tracer *tracer, const std::string &opId)
+{
+  mTracer = tracer;
+  mOpId = opId;
+  mStart = Tracer::Clock::now();
+  mParent = currentSpan;
+  currentSpan = this;
+}
+
+TraceSpan *
+TraceSpan::current(void)
+{
+  return currentSpan;
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,117 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __TRACER_HH__
+#define __TRACER_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <deque>
+#include <stdint.h>
+#include <string>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Keeps the spans (what was done, by which thread, from when and for how
+// long) of a sample of the operations, to be exported in the Chrome trace
+// event format. Nothing is recorded while the sample rate is 0.
+class Tracer
+{
+public:
+  typedef boost::chrono::steady_clock Clock;
+
+  struct Event
+  {
+    const char *name;
+    const char *category;
+    std::string opId;
+    std::string detail;
+    uint64_t startUs;
+    uint64_t durationUs;
+    long threadId;
+  };
+
+  Tracer(size_t maxEvents);
+  virtual ~Tracer(void);
+
+  void setSampleRate(double rate);
+  double sampleRate(void) const { return mSampleRate; }
+  void setMaxEvents(size_t maxEvents);
+  size_t maxEvents(void) const { return mMaxEvents; }
+  bool shouldTrace(void);
+  void addSpan(const char *name, const char *category, const std::string &opId,
+               const Clock::time_point &start, const Clock::time_point &end,
+               const std::string &detail = "");
+  int exportChromeTrace(const std::string &path);
+  size_t size(void);
+  void clear(void);
+
+  static long currentThreadId(void);
+
+private:
+  double mSampleRate;
+  size_t mMaxEvents;
+  Clock::time_point mEpoch;
+  std::deque<Event> mEvents;
+  boost::mutex mMutex;
+};
+
+// Records a span in a Tracer when it goes out of scope. While it exists, it is
+// the current thread's span, so the spans created meanwhile (even without
+// knowing the Tracer) are recorded as part of the same operation.
+class TraceSpan
+{
+public:
+  // Span of an operation that was (or not) chosen to be traced beforehand
+  // (the tracer is null if it was not)
+  TraceSpan(Tracer *tracer, const char *name, const char *category,
+            const std::string &opId);
+
+  // Span that is recorded if the thread is already tracing an operation or,
+  // if sample is true, if the tracer chooses to trace it
+  TraceSpan(Tracer *tracer, const char *name, const char *category,
+            bool sample = false);
+
+  ~TraceSpan(void);
+
+  bool active(void) const { return mTracer != 0; }
+  Tracer *tracer(void) const { return mTracer; }
+  const std::string &opId(void) const { return mOpId; }
+  void setDetail(const std::string &detail) { mDetail = detail; }
+
+  static TraceSpan *current(void);
+
+private:
+  void start(Tracer *tracer, const std::string &opId);
+
+  Tracer *mTracer;
+  const char *mName;
+  const char *mCategory;
+  std::string mOpId;
+  std::string mDetail;
+  Tracer::Clock::time_point mStart;
+  TraceSpan *mParent;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __TRACER_HH__ */
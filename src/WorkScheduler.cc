@@ -0,0 +1,523 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include "WorkScheduler.hh"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+__thread WorkScheduler::Worker *WorkScheduler::sCurrentWorker = 0;
+
+static size_t
+backgroundJobsLimit(size_t numWorkers)
+{
+  // Leave at least one worker free for the interactive and normal jobs
+  // (unless there is only one worker)
+  return numWorkers > 1 ? numWorkers - 1 : 1;
+}
+
+WorkScheduler::WorkScheduler(size_t numWorkers)
+  : mNumWorkers(numWorkers),
+    mNextWorker(0),
+    mRunningBackgroundJobs(0),
+    mStopping(false)
+{
+  for (int i = 0; i < NUM_PRIORITIES; i++)
+    mPendingJobs[i] = 0;
+}
+
+WorkScheduler::~WorkScheduler(void)
+{
+  stop();
+}
+
+WorkScheduler::Worker *
+WorkScheduler::createWorker(void)
+{
+  Worker *worker = new Worker;
+  worker->scheduler = this;
+  worker->stealCursor = 0;
+  worker->retiring = false;
+  worker->thread = new boost::thread(boost::bind(&WorkScheduler::workerThread,
+                                                 this, worker));
+
+  return worker;
+}
+
+void
+WorkScheduler::launchWorkers(void)
+{
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mWorkersMutex);
+
+    if (!mWorkers.empty())
+      return;
+  }
+
+  boost::unique_lock<boost::shared_mutex> lock(mWorkersMutex);
+  size_t numWorkers;
+
+  {
+    boost::unique_lock<boost::mutex> stateLock(mMutex);
+
+    if (mStopping)
+      return;
+
+    numWorkers = mNumWorkers;
+  }
+
+  while (mWorkers.size() < numWorkers)
+    mWorkers.push_back(createWorker());
+}
+
+void
+WorkScheduler::push(Worker *worker, const Job &job, Priority priority)
+{
+  // Important: this method needs to be run in a scope where mWorkersMutex is
+  // locked (shared)
+  boost::unique_lock<boost::mutex> lock(worker->mutex);
+
+  worker->queues[priority].push_back(job);
+
+  boost::unique_lock<boost::mutex> stateLock(mMutex);
+  mPendingJobs[priority]++;
+}
+
+void
+WorkScheduler::enqueue(const Job &job, Priority priority)
+{
+  boost::shared_lock<boost::shared_mutex> lock(mWorkersMutex);
+  Worker *worker = sCurrentWorker;
+
+  // Jobs posted from one of our workers stay in its queue, the others are
+  // spread across the workers
+  if (worker == 0 || worker->scheduler != this || worker->retiring)
+  {
+    if (mWorkers.empty())
+    {
+      // There are no workers anymore (the scheduler has been stopped) so the
+      // job is run right away instead of being dropped
+      lock.unlock();
+      job();
+      return;
+    }
+
+    size_t index;
+
+    {
+      boost::unique_lock<boost::mutex> stateLock(mMutex);
+      index = mNextWorker++ % mWorkers.size();
+    }
+
+    worker = mWorkers[index];
+  }
+
+  push(worker, job, priority);
+  lock.unlock();
+
+  mCond.notify_one();
+}
+
+void
+WorkScheduler::post(const Job &job, Priority priority)
+{
+  launchWorkers();
+  enqueue(job, priority);
+}
+
+void
+WorkScheduler::postDelayed(const Job &job, size_t delayUs, Priority priority)
+{
+  launchWorkers();
+
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+
+    if (!mStopping)
+    {
+      DelayedJob delayedJob;
+      delayedJob.job = job;
+      delayedJob.priority = priority;
+
+      mDelayedJobs.insert(std::make_pair(boost::chrono::steady_clock::now() +
+                                         boost::chrono::microseconds(delayUs),
+                                         delayedJob));
+      lock.unlock();
+
+      mCond.notify_one();
+      return;
+    }
+  }
+
+  enqueue(job, priority);
+}
+
+void
+WorkScheduler::enqueueDueJobs(void)
+{
+  std::vector<DelayedJob> dueJobs;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+
+    if (mDelayedJobs.empty())
+      return;
+
+    const boost::chrono::steady_clock::time_point now =
+        boost::chrono::steady_clock::now();
+
+    // When stopping, the delayed jobs are not kept waiting anymore
+    while (!mDelayedJobs.empty() &&
+           (mStopping || (*mDelayedJobs.begin()).first <= now))
+    {
+      dueJobs.push_back((*mDelayedJobs.begin()).second);
+      mDelayedJobs.erase(mDelayedJobs.begin());
+    }
+  }
+
+  std::vector<DelayedJob>::iterator it;
+  for (it = dueJobs.begin(); it != dueJobs.end(); it++)
+    enqueue((*it).job, (*it).priority);
+}
+
+bool
+WorkScheduler::popJob(Worker *worker, Priority priority, Job &job)
+{
+  boost::unique_lock<boost::mutex> lock(worker->mutex);
+  std::deque<Job> &queue = worker->queues[priority];
+
+  if (queue.empty())
+    return false;
+
+  // The owner takes its most recent job which is likely to still have its
+  // data in cache. So jobs are not run in the order they are posted, and those
+  // that need an order (like the write-behind flushes) must keep it themselves
+  // without waiting for other jobs.
+  job = queue.back();
+  queue.pop_back();
+
+  boost::unique_lock<boost::mutex> stateLock(mMutex);
+  mPendingJobs[priority]--;
+
+  return true;
+}
+
+bool
+WorkScheduler::stealJob(Worker *thief, Priority priority, Job &job)
+{
+  boost::shared_lock<boost::shared_mutex> lock(mWorkersMutex);
+  const size_t numWorkers = mWorkers.size();
+
+  for (size_t i = 0; i < numWorkers; i++)
+  {
+    const size_t index = (thief->stealCursor + i) % numWorkers;
+    Worker *victim = mWorkers[index];
+
+    if (victim == thief)
+      continue;
+
+    boost::unique_lock<boost::mutex> victimLock(victim->mutex);
+    std::deque<Job> &queue = victim->queues[priority];
+
+    if (queue.empty())
+      continue;
+
+    // Thieves take the oldest job so they interfere as little as possible
+    // with the owner
+    job = queue.front();
+    queue.pop_front();
+    thief->stealCursor = index + 1;
+
+    boost::unique_lock<boost::mutex> stateLock(mMutex);
+    mPendingJobs[priority]--;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool
+WorkScheduler::takeJob(Worker *worker, Job &job, Priority &priority)
+{
+  for (int i = 0; i < NUM_PRIORITIES; i++)
+  {
+    const Priority current = static_cast<Priority>(i);
+
+    if (current == PRIORITY_BACKGROUND)
+    {
+      boost::unique_lock<boost::mutex> lock(mMutex);
+
+      if (mPendingJobs[current] == 0 ||
+          mRunningBackgroundJobs >= backgroundJobsLimit(mNumWorkers))
+      {
+        return false;
+      }
+
+      mRunningBackgroundJobs++;
+    }
+
+    if (popJob(worker, current, job) || stealJob(worker, current, job))
+    {
+      priority = current;
+      return true;
+    }
+
+    if (current == PRIORITY_BACKGROUND)
+    {
+      boost::unique_lock<boost::mutex> lock(mMutex);
+      mRunningBackgroundJobs--;
+    }
+  }
+
+  return false;
+}
+
+bool
+WorkScheduler::hasRunnableJobs(void)
+{
+  // Important: this method needs to be run in a scope where mMutex is locked
+  if (mPendingJobs[PRIORITY_INTERACTIVE] > 0 ||
+      mPendingJobs[PRIORITY_NORMAL] > 0)
+  {
+    return true;
+  }
+
+  return mPendingJobs[PRIORITY_BACKGROUND] > 0 &&
+      mRunningBackgroundJobs < backgroundJobsLimit(mNumWorkers);
+}
+
+void
+WorkScheduler::workerThread(Worker *worker)
+{
+  sCurrentWorker = worker;
+
+  while (true)
+  {
+    enqueueDueJobs();
+
+    Job job;
+    Priority priority;
+
+    if (takeJob(worker, job, priority))
+    {
+      job();
+
+      if (priority == PRIORITY_BACKGROUND)
+      {
+        {
+          boost::unique_lock<boost::mutex> lock(mMutex);
+          mRunningBackgroundJobs--;
+        }
+
+        // A background job that was held back by the limit may run now
+        mCond.notify_one();
+      }
+
+      continue;
+    }
+
+    boost::unique_lock<boost::mutex> lock(mMutex);
+
+    if (worker->retiring)
+      break;
+
+    if (hasRunnableJobs())
+      continue;
+
+    if (mStopping)
+    {
+      if (!mDelayedJobs.empty())
+        continue;
+
+      if (mPendingJobs[PRIORITY_BACKGROUND] == 0)
+        break;
+    }
+
+    if (mDelayedJobs.empty())
+      mCond.wait(lock);
+    else
+      mCond.wait_until(lock, (*mDelayedJobs.begin()).first);
+  }
+
+  sCurrentWorker = 0;
+}
+
+/**
+ * Sets the number of workers. If the workers have been launched already,
+ * they're created or retired right away (the jobs queued in the retired
+ * workers are handed to the remaining ones).
+ * @note This method must not be called from one of the scheduler's jobs since
+ *       it waits for the retired workers to finish.
+ */
+void
+WorkScheduler::setNumWorkers(size_t numWorkers)
+{
+  std::vector<Worker *> retired;
+
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mWorkersMutex);
+
+    {
+      boost::unique_lock<boost::mutex> stateLock(mMutex);
+      mNumWorkers = numWorkers;
+    }
+
+    if (mWorkers.empty())
+      return;
+
+    while (mWorkers.size() < numWorkers)
+      mWorkers.push_back(createWorker());
+
+    while (mWorkers.size() > numWorkers)
+    {
+      retired.push_back(mWorkers.back());
+      mWorkers.pop_back();
+    }
+
+    size_t target = 0;
+    std::vector<Worker *>::iterator it;
+    for (it = retired.begin(); it != retired.end(); it++)
+    {
+      Worker *worker = *it;
+      boost::unique_lock<boost::mutex> workerLock(worker->mutex);
+
+      for (int i = 0; i < NUM_PRIORITIES; i++)
+      {
+        std::deque<Job> &queue = worker->queues[i];
+
+        while (!queue.empty())
+        {
+          Worker *remaining = mWorkers[target++ % mWorkers.size()];
+          boost::unique_lock<boost::mutex> remainingLock(remaining->mutex);
+
+          remaining->queues[i].push_back(queue.front());
+          queue.pop_front();
+        }
+      }
+
+      boost::unique_lock<boost::mutex> stateLock(mMutex);
+      worker->retiring = true;
+    }
+  }
+
+  mCond.notify_all();
+
+  std::vector<Worker *>::iterator it;
+  for (it = retired.begin(); it != retired.end(); it++)
+  {
+    (*it)->thread->join();
+    delete (*it)->thread;
+    delete *it;
+  }
+}
+
+size_t
+WorkScheduler::numWorkers(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mNumWorkers;
+}
+
+size_t
+WorkScheduler::numLaunchedWorkers(void)
+{
+  boost::shared_lock<boost::shared_mutex> lock(mWorkersMutex);
+  return mWorkers.size();
+}
+
+size_t
+WorkScheduler::maxBackgroundJobs(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return backgroundJobsLimit(mNumWorkers);
+}
+
+bool
+WorkScheduler::stopping(void)
+{
+  boost::unique_lock<boost::mutex> lock(mMutex);
+  return mStopping;
+}
+
+/**
+ * Tells whether the calling thread is one of this scheduler's workers. Jobs
+ * running in a worker must not block waiting for other jobs they posted, as
+ * those may be queued behind them.
+ */
+bool
+WorkScheduler::inWorkerThread(void)
+{
+  return sCurrentWorker != 0 && sCurrentWorker->scheduler == this;
+}
+
+/**
+ * Stops the scheduler: the workers run all the jobs that are queued (the
+ * delayed ones are run without waiting for their delay) and exit. Jobs that
+ * are posted after the workers exited are run in the caller's thread.
+ */
+void
+WorkScheduler::stop(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mStopping = true;
+  }
+
+  mCond.notify_all();
+
+  std::vector<Worker *> workers;
+
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mWorkersMutex);
+    workers = mWorkers;
+  }
+
+  std::vector<Worker *>::iterator it;
+  for (it = workers.begin(); it != workers.end(); it++)
+    (*it)->thread->join();
+
+  std::vector<Job> leftovers;
+
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mWorkersMutex);
+
+    for (it = mWorkers.begin(); it != mWorkers.end(); it++)
+    {
+      Worker *worker = *it;
+
+      for (int i = 0; i < NUM_PRIORITIES; i++)
+      {
+        leftovers.insert(leftovers.end(), worker->queues[i].begin(),
+                         worker->queues[i].end());
+      }
+
+      delete worker->thread;
+      delete worker;
+    }
+
+    mWorkers.clear();
+  }
+
+  std::vector<Job>::iterator jobIt;
+  for (jobIt = leftovers.begin(); jobIt != leftovers.end(); jobIt++)
+    (*jobIt)();
+}
+
+RADOS_FS_END_NAMESPACE
@@ -0,0 +1,115 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __WORK_SCHEDULER_HH__
+#define __WORK_SCHEDULER_HH__
+
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "radosfscommon.h"
+
+RADOS_FS_BEGIN_NAMESPACE
+
+// Runs the jobs of the generic worker threads. Every worker has its own
+// queue per priority: jobs posted from a worker go to its own queue and
+// idle workers steal from the others'. The higher priorities are always
+// served first and the number of background jobs running at the same time is
+// capped so that long jobs cannot take every worker from the short ones.
+class WorkScheduler
+{
+public:
+  typedef boost::function<void (void)> Job;
+
+  enum Priority
+  {
+    PRIORITY_INTERACTIVE = 0,
+    PRIORITY_NORMAL,
+    PRIORITY_BACKGROUND,
+    NUM_PRIORITIES
+  };
+
+  WorkScheduler(size_t numWorkers);
+  virtual ~WorkScheduler(void);
+
+  void post(const Job &job, Priority priority = PRIORITY_NORMAL);
+  void postDelayed(const Job &job, size_t delayUs,
+                   Priority priority = PRIORITY_NORMAL);
+  void setNumWorkers(size_t numWorkers);
+  size_t numWorkers(void);
+  size_t numLaunchedWorkers(void);
+  size_t maxBackgroundJobs(void);
+  bool stopping(void);
+  bool inWorkerThread(void);
+  void stop(void);
+
+private:
+  struct Worker
+  {
+    std::deque<Job> queues[NUM_PRIORITIES];
+    boost::mutex mutex;
+    boost::thread *thread;
+    WorkScheduler *scheduler;
+    size_t stealCursor;
+    bool retiring;
+  };
+
+  struct DelayedJob
+  {
+    Job job;
+    Priority priority;
+  };
+
+  typedef std::multimap<boost::chrono::steady_clock::time_point, DelayedJob>
+  DelayedJobMap;
+
+  void launchWorkers(void);
+  Worker *createWorker(void);
+  void enqueue(const Job &job, Priority priority);
+  void push(Worker *worker, const Job &job, Priority priority);
+  bool takeJob(Worker *worker, Job &job, Priority &priority);
+  bool popJob(Worker *worker, Priority priority, Job &job);
+  bool stealJob(Worker *thief, Priority priority, Job &job);
+  bool hasRunnableJobs(void);
+  void enqueueDueJobs(void);
+  void workerThread(Worker *worker);
+
+  static __thread Worker *sCurrentWorker;
+
+  std::vector<Worker *> mWorkers;
+  boost::shared_mutex mWorkersMutex;
+  size_t mNumWorkers;
+  size_t mNextWorker;
+  size_t mPendingJobs[NUM_PRIORITIES];
+  size_t mRunningBackgroundJobs;
+  bool mStopping;
+  DelayedJobMap mDelayedJobs;
+  boost::mutex mMutex;
+  boost::condition_variable mCond;
+};
+
+RADOS_FS_END_NAMESPACE
+
+#endif /* __WORK_SCHEDULER_HH__ */
@@ -0,0 +1,96 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <errno.h>
+#include <rados/objclass.h>
+#include <string>
+#include <vector>
+
+#include "DirLog.hh"
+
+// Object class that runs find queries over the log of a directory on the OSD
+// holding the directory's inode object, so only the matching entries (and the
+// subdirectories) are sent to the client instead of the whole log.
+//
+// To be used, the built libcls_radosfs.so has to be installed in the OSDs'
+// object classes directory (osd class dir) and allowed to be loaded (osd class
+// load list / osd class default list).
+
+CLS_VER(1,0)
+CLS_NAME(radosfs)
+
+static int
+findEntries(cls_method_context_t hctx, ceph::bufferlist *in,
+            ceph::bufferlist *out)
+{
+  std::vector<radosfs::DirLogPredicate> predicates;
+
+  if (!radosfs::decodeDirLogQuery(in->c_str(), in->length(), predicates))
+  {
+    CLS_LOG(1, "Malformed find query");
+    return -EINVAL;
+  }
+
+  uint64_t size = 0;
+  int ret = cls_cxx_stat(hctx, &size, 0);
+
+  if (ret < 0)
+    return ret;
+
+  ceph::bufferlist log;
+
+  if (size > 0)
+  {
+    ret = cls_cxx_read(hctx, 0, size, &log);
+
+    if (ret < 0)
+      return ret;
+  }
+
+  radosfs::DirLogEntries entries;
+
+  // As in the client, the entries are used up to the first malformed record
+  if (!radosfs::replayDirLog(log.c_str(), log.length(), entries))
+    CLS_LOG(1, "Malformed record in dir log");
+
+  std::vector<std::string> matches, dirs;
+  ret = radosfs::runDirLogQuery(entries, predicates, matches, dirs);
+
+  if (ret != 0)
+    return ret;
+
+  std::string result;
+  radosfs::encodeDirLogQueryResult(matches, dirs, result);
+  out->append(result);
+
+  return 0;
+}
+
+CLS_INIT(radosfs)
+{
+  CLS_LOG(1, "Loaded radosfs class");
+
+  cls_handle_t classHandle;
+  cls_method_handle_t findEntriesHandle;
+
+  cls_register(DIR_FIND_OBJECT_CLASS, &classHandle);
+  cls_register_cxx_method(classHandle, DIR_FIND_OBJECT_CLASS_METHOD,
+                          CLS_METHOD_RD, findEntries, &findEntriesHandle);
+}
@@ -18,7 +18,10 @@
  */
 
 #include "radosfscommon.h"
+#include "Tracer.hh"
+#include <algorithm>
 #include <climits>
+#include <deque>
 #include <sys/stat.h>
 #include <uuid/uuid.h>
 
@@ -116,6 +119,7 @@ statDirObj(Stat &stat)
   keys.insert(XATTR_MTIME);
   keys.insert(XATTR_CTIME);
   keys.insert(XATTR_QUOTA_OBJECT);
+  keys.insert(XATTR_DIR_INDEX);
 
   op.stat(&psize, &pmtime, &statRet);
   op.omap_get_vals_by_keys(keys, &omap, 0);
@@ -157,6 +161,12 @@ statDirObj(Stat &stat)
     stat.extraData[XATTR_QUOTA_OBJECT] = std::string(bl.c_str(), bl.length());
   }
 
+  if (omap.count(XATTR_DIR_INDEX) > 0)
+  {
+    librados::bufferlist bl = omap[XATTR_DIR_INDEX];
+    stat.extraData[XATTR_DIR_INDEX] = std::string(bl.c_str(), bl.length());
+  }
+
   genericStatFromAttrs(stat.translatedPath, permissions, ctime, mtime, psize,
                        pmtime, &stat.statBuff);
 
@@ -353,107 +363,281 @@ getParentDir(const std::string &path, int *pos)
   return path.substr(0, index);
 }
 
-std::string
-escapeObjName(const std::string &obj)
+// Notifies the watchers of the given dir that its log changed, if the dir's
+// pool is set to send notifications
+static void
+notifyIndexChange(const Stat *dirStat)
+{
+  if (dirStat->pool->notifyDirChanges && !dirUsesOmapIndex(dirStat))
+    notifyDirChange(dirStat->pool->ioctx, dirStat->translatedPath,
+                    DIR_NOTIFY_CHANGED);
+}
+
+static int
+addIndexObjectOps(librados::ObjectWriteOperation &writeOp,
+                  std::map<std::string, librados::bufferlist> &xattrs,
+                  const Stat *parentStat,
+                  const Stat *stat,
+                  char op)
 {
-  std::string str("");
+  std::string xAttrKey(""), xAttrValue("");
+  const std::string &baseName = stat->path.substr(parentStat->path.length(),
+                                                  std::string::npos);
+
+  int ret = addDirIndexOp(writeOp, parentStat, baseName, op);
 
-  for (size_t i = 0; i < obj.length(); i++)
+  if (ret != 0)
+    return ret;
+
+  if ((stat->statBuff.st_mode & S_IFDIR) == 0)
   {
-    if (obj[i] == '"')
-      str += "\\\"";
-    else if (obj[i] == '\n')
-      str += '%';
-    else if (obj[i] == '%')
-      str += "\\%";
+    xAttrKey = XATTR_FILE_PREFIX + baseName;
+
+    if (op == '+')
+      xAttrValue = getFileXAttrDirRecord(stat);
     else
-      str += obj[i];
+      xattrs[XATTR_FILE_INLINE_BUFFER + baseName].append("");
+
+    xattrs[xAttrKey].append(xAttrValue);
   }
 
-  return str;
+  return 0;
 }
 
-std::string
-unescapeObjName(const std::string &obj)
+int indexObject(const Stat *parentStat,
+                const Stat *stat,
+                char op)
 {
-  std::string str("");
+  if (parentStat->translatedPath == "")
+    return 0;
 
-  if (obj == "")
-    return str;
+  radosfs::TraceSpan span(0, "dir_index", "dir");
 
-  size_t i;
-  const size_t length = obj.length();
+  if (span.active())
+    span.setDetail(parentStat->path);
+
+  // Removals from omap dirs are canceled if the entry's metadata changes
+  // after it is read (nothing else is compared when removing), so they are
+  // run again
+  const int maxAttempts = op == '-' && dirUsesOmapIndex(parentStat) ?
+                          DIR_ENTRY_REMOVAL_MAX_ATTEMPTS : 1;
+  int ret = -ECANCELED;
 
-  for (i = 0; i < length - 1; i++)
+  for (int attempt = 0; attempt < maxAttempts && ret == -ECANCELED; attempt++)
   {
-    if (obj[i] == '\\')
-    {
-      if (obj[i + 1] == '"')
-        str += '"';
-      else if (obj[i + 1] == '%')
-        str += '%';
-      else if (obj[i + 1] == '"')
-        str += '"';
-      else
-        obj[i];
+    librados::ObjectWriteOperation writeOp;
+    std::map<std::string, librados::bufferlist> xattrs;
 
-      i++;
-    }
-    else if (obj[i] == '%')
-    {
-      str += '\n';
-    }
-    else
-    {
-      str += obj[i];
-    }
+    ret = addIndexObjectOps(writeOp, xattrs, parentStat, stat, op);
+
+    if (ret != 0)
+      return ret;
+
+    ret = writeDirOpAtomically(parentStat->pool->ioctx,
+                               parentStat->translatedPath, writeOp, &xattrs);
   }
 
-  if (i <= length - 1)
+  if (ret == 0)
+    notifyIndexChange(parentStat);
+
+  return ret;
+}
+
+// Indexes a new file in its parent together with the contents of its inline
+// buffer (if any), with a single operation. As with indexObject, it fails
+// with -ECANCELED if the file is already present in the parent.
+int
+indexFileWithInlineBuffer(const Stat *parentStat, const Stat *stat,
+                          const librados::bufferlist &inlineBuffer)
+{
+  librados::ObjectWriteOperation writeOp;
+  std::map<std::string, librados::bufferlist> xattrs;
+
+  int ret = addIndexObjectOps(writeOp, xattrs, parentStat, stat, '+');
+
+  if (ret != 0)
+    return ret;
+
+  if (inlineBuffer.length() > 0)
   {
-    if (obj[length - 1] == '%')
-      str += '\n';
-    else
-      str += obj[length - 1];
+    const std::string baseName = stat->path.substr(parentStat->path.length());
+    xattrs[XATTR_FILE_INLINE_BUFFER + baseName] = inlineBuffer;
   }
 
-  return str;
+  ret = writeDirOpAtomically(parentStat->pool->ioctx,
+                             parentStat->translatedPath, writeOp, &xattrs);
+
+  if (ret == 0)
+    notifyIndexChange(parentStat);
+
+  return ret;
 }
 
-int indexObject(const Stat *parentStat,
-                const Stat *stat,
-                char op)
+// Indexes all the given objects in their parent with a single operation, so
+// either all or none of them get indexed. As with indexObject, adding a file
+// that is already present in the parent fails with -ECANCELED.
+int
+indexObjects(const Stat *parentStat, const std::vector<Stat> &stats, char op)
 {
-  std::string contents;
-  std::string xAttrKey(""), xAttrValue("");
+  librados::ObjectWriteOperation writeOp;
+  std::map<std::string, librados::bufferlist> xattrs;
 
-  if (parentStat->translatedPath == "")
+  if (parentStat->translatedPath == "" || stats.empty())
     return 0;
 
-  const std::string &baseName = stat->path.substr(parentStat->path.length(),
-                                                  std::string::npos);
+  radosfs::TraceSpan span(0, "dir_index", "dir");
 
-  contents = getObjectIndexLine(baseName, op);
+  if (span.active())
+    span.setDetail(parentStat->path);
 
-  std::map<std::string, librados::bufferlist> xattrs;
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    int ret = addIndexObjectOps(writeOp, xattrs, parentStat, &stats[i], op);
 
-  if ((stat->statBuff.st_mode & S_IFDIR) == 0)
+    if (ret != 0)
+      return ret;
+  }
+
+  int ret = writeDirOpAtomically(parentStat->pool->ioctx,
+                                 parentStat->translatedPath, writeOp, &xattrs);
+
+  if (ret == 0)
+    notifyIndexChange(parentStat);
+
+  return ret;
+}
+
+bool
+dirUsesOmapIndex(const Stat *stat)
+{
+  std::map<std::string, std::string>::const_iterator it;
+  it = stat->extraData.find(XATTR_DIR_INDEX);
+
+  return it != stat->extraData.end() && (*it).second == DIR_INDEX_OMAP;
+}
+
+void
+setDirIndexMode(Stat *stat, bool omapIndex)
+{
+  if (omapIndex)
+    stat->extraData[XATTR_DIR_INDEX] = DIR_INDEX_OMAP;
+  else
+    stat->extraData.erase(XATTR_DIR_INDEX);
+}
+
+std::string
+makeDirEntryKey(const std::string &entry)
+{
+  return XATTR_DIR_ENTRY_PREFIX + entry;
+}
+
+// Metadata keys are made of the escaped entry name (which never contains a
+// new line) followed by a new line and the metadata key, so that all the
+// metadata of an entry can be fetched by prefix.
+std::string
+makeDirEntryMetadataPrefix(const std::string &entry)
+{
+  return XATTR_DIR_ENTRY_METADATA_PREFIX + escapeObjName(entry) + "\n";
+}
+
+// Changed whenever the metadata of the entry is, so removing the entry can
+// compare it to make sure no metadata was added after it was read
+std::string
+makeDirEntryMetadataVersionKey(const std::string &entry)
+{
+  return XATTR_DIR_ENTRY_MD_VERSION_PREFIX + entry;
+}
+
+int
+getDirEntryMetadata(librados::IoCtx &ioctx,
+                    const std::string &dirName,
+                    const std::string &entry,
+                    std::map<std::string, librados::bufferlist> &metadata)
+{
+  const std::string prefix = makeDirEntryMetadataPrefix(entry);
+  std::string startAfter("");
+
+  while (true)
   {
-    xAttrKey = XATTR_FILE_PREFIX + baseName;
+    std::map<std::string, librados::bufferlist> page;
 
-    if (op == '+')
-      xAttrValue = getFileXAttrDirRecord(stat);
-    else
-      xattrs[XATTR_FILE_INLINE_BUFFER + baseName].append("");
+    int ret = ioctx.omap_get_vals(dirName, startAfter, prefix,
+                                  DIR_OMAP_LIST_PAGE_SIZE, &page);
 
-    xattrs[xAttrKey].append(xAttrValue);
+    if (ret < 0)
+      return ret;
+
+    if (page.empty())
+      break;
+
+    startAfter = (*page.rbegin()).first;
+    metadata.insert(page.begin(), page.end());
+
+    if (page.size() < DIR_OMAP_LIST_PAGE_SIZE)
+      break;
   }
 
-  int ret =  writeContentsAtomically(parentStat->pool->ioctx,
-                                     parentStat->translatedPath, contents,
-                                     &xattrs);
+  return 0;
+}
+
+int
+addDirIndexOp(librados::ObjectWriteOperation &writeOp,
+              const Stat *dirStat,
+              const std::string &entry,
+              char op)
+{
+  if (!dirUsesOmapIndex(dirStat))
+  {
+    librados::bufferlist contents;
+    contents.append(getObjectIndexLine(entry, op));
+    writeOp.append(contents);
 
-  return ret;
+    return 0;
+  }
+
+  if (op == '+')
+  {
+    std::map<std::string, librados::bufferlist> omap;
+    omap[makeDirEntryKey(entry)];
+    writeOp.omap_set(omap);
+
+    return 0;
+  }
+
+  // Removing an entry also removes its metadata, otherwise it would show up
+  // again if an entry with the same name were created later. The metadata
+  // keys are read first, so the removal is only done if the metadata version
+  // did not change meanwhile (it fails with -ECANCELED otherwise).
+  std::map<std::string, librados::bufferlist> metadata, version;
+  std::set<std::string> keys;
+  const std::string versionKey = makeDirEntryMetadataVersionKey(entry);
+
+  keys.insert(versionKey);
+
+  int ret = dirStat->pool->ioctx.omap_get_vals_by_keys(dirStat->translatedPath,
+                                                       keys, &version);
+
+  if (ret == 0)
+    ret = getDirEntryMetadata(dirStat->pool->ioctx, dirStat->translatedPath,
+                              entry, metadata);
+
+  if (ret != 0 && ret != -ENOENT)
+    return ret;
+
+  // A missing version compares as an empty value
+  std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
+  omapCmp[versionKey] = std::pair<librados::bufferlist, int>(
+                          version[versionKey], LIBRADOS_CMPXATTR_OP_EQ);
+  writeOp.omap_cmp(omapCmp, 0);
+
+  std::map<std::string, librados::bufferlist>::iterator it;
+  for (it = metadata.begin(); it != metadata.end(); it++)
+    keys.insert((*it).first);
+
+  keys.insert(makeDirEntryKey(entry));
+  writeOp.omap_rm_keys(keys);
+
+  return 0;
 }
 
 std::string
@@ -462,12 +646,67 @@ getObjectIndexLine(const std::string &obj, char op)
   std::string contents;
 
   contents += op;
-  contents += INDEX_NAME_KEY "=\"" + escapeObjName(obj) + "\" ";
+  contents += INDEX_NAME_KEY "=\"";
+  appendEscapedObjName(contents, obj);
+  contents += "\" ";
   contents += "\n";
 
   return contents;
 }
 
+static void
+appendUint32(librados::bufferlist &buff, uint32_t value)
+{
+  char bytes[4];
+
+  bytes[0] = value & 0xff;
+  bytes[1] = (value >> 8) & 0xff;
+  bytes[2] = (value >> 16) & 0xff;
+  bytes[3] = (value >> 24) & 0xff;
+
+  buff.append(bytes, sizeof(bytes));
+}
+
+static void
+appendLengthPrefixed(librados::bufferlist &buff, const std::string &str)
+{
+  appendUint32(buff, str.length());
+  buff.append(str.c_str(), str.length());
+}
+
+// Appends a binary dir log record to buff. The record has the layout:
+//  version (1 byte), op (1 byte), payload length (4 bytes), then the payload:
+//  name length (4 bytes) + name, number of metadata entries (4 bytes) and,
+//  for each entry, op (1 byte), key length (4 bytes) + key,
+//  value length (4 bytes) + value.
+// All integers are little endian. The version byte never matches the first
+// character of a text record ('+' or '-') so both formats can coexist in the
+// same log.
+void
+appendDirLogRecord(librados::bufferlist &buff,
+                   char op,
+                   const std::string &name,
+                   const std::map<std::string, std::string> &metadata)
+{
+  librados::bufferlist payload;
+
+  appendLengthPrefixed(payload, name);
+  appendUint32(payload, metadata.size());
+
+  std::map<std::string, std::string>::const_iterator it;
+  for (it = metadata.begin(); it != metadata.end(); it++)
+  {
+    payload.append('+');
+    appendLengthPrefixed(payload, (*it).first);
+    appendLengthPrefixed(payload, (*it).second);
+  }
+
+  buff.append((char) DIR_LOG_RECORD_VERSION);
+  buff.append(op);
+  appendUint32(buff, payload.length());
+  buff.claim_append(payload);
+}
+
 std::string
 getFileXAttrDirRecord(const Stat *stat)
 {
@@ -499,15 +738,50 @@ indexObjectMetadata(librados::IoCtx &ioctx,
                     const std::string &dirName,
                     const std::string &baseName,
                     std::map<std::string, std::string> &metadata,
-                    char op)
+                    char op,
+                    bool omapIndex,
+                    bool notify)
 {
   std::string contents;
 
   if (dirName == "")
     return 0;
 
+  if (omapIndex)
+  {
+    librados::ObjectWriteOperation writeOp;
+    std::map<std::string, librados::bufferlist> omap;
+    std::set<std::string> keysToRemove;
+    const std::string prefix = makeDirEntryMetadataPrefix(baseName);
+
+    std::map<std::string, std::string>::iterator it;
+    for (it = metadata.begin(); it != metadata.end(); it++)
+    {
+      const std::string mdKey = prefix + (*it).first;
+
+      if (op == '+')
+        omap[mdKey].append((*it).second);
+      else
+        keysToRemove.insert(mdKey);
+    }
+
+    if (!omap.empty())
+      writeOp.omap_set(omap);
+
+    if (!keysToRemove.empty())
+      writeOp.omap_rm_keys(keysToRemove);
+
+    std::map<std::string, librados::bufferlist> version;
+    version[makeDirEntryMetadataVersionKey(baseName)].append(generateUuid());
+    writeOp.omap_set(version);
+
+    return writeDirOpAtomically(ioctx, dirName, writeOp);
+  }
+
   contents = "+";
-  contents += INDEX_NAME_KEY "=\"" + escapeObjName(baseName) + "\" ";
+  contents += INDEX_NAME_KEY "=\"";
+  appendEscapedObjName(contents, baseName);
+  contents += "\" ";
 
   std::map<std::string, std::string>::iterator it;
   for (it = metadata.begin(); it != metadata.end(); it++)
@@ -516,17 +790,28 @@ indexObjectMetadata(librados::IoCtx &ioctx,
     const std::string &value = (*it).second;
 
     contents += op;
-    contents += INDEX_METADATA_PREFIX ".\""  + escapeObjName(key) + "\"";
+    contents += INDEX_METADATA_PREFIX ".\"";
+    appendEscapedObjName(contents, key);
+    contents += "\"";
 
     if (op == '+')
-      contents += "=\"" + escapeObjName(value) + "\"";
+    {
+      contents += "=\"";
+      appendEscapedObjName(contents, value);
+      contents += "\"";
+    }
 
     contents += " ";
   }
 
   contents += "\n";
 
-  return writeContentsAtomically(ioctx, dirName.c_str(), contents);
+  int ret = writeContentsAtomically(ioctx, dirName.c_str(), contents);
+
+  if (ret == 0 && notify)
+    notifyDirChange(ioctx, dirName, DIR_NOTIFY_CHANGED);
+
+  return ret;
 }
 
 int
@@ -536,16 +821,26 @@ writeContentsAtomically(librados::IoCtx &ioctx,
                       const std::map<std::string, librados::bufferlist> *xattrs)
 {
   librados::ObjectWriteOperation writeOp;
+  librados::bufferlist contentsBuff;
+
+  contentsBuff.append(contents);
+  writeOp.append(contentsBuff);
+
+  return writeDirOpAtomically(ioctx, obj, writeOp, xattrs);
+}
+
+int
+writeDirOpAtomically(librados::IoCtx &ioctx,
+                     const std::string &obj,
+                     librados::ObjectWriteOperation &writeOp,
+                     const std::map<std::string, librados::bufferlist> *xattrs)
+{
   std::map<std::string, librados::bufferlist> omap;
   std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-  librados::bufferlist contentsBuff;
 
   omap[DIR_LOG_UPDATED].append(DIR_LOG_UPDATED_TRUE);
   omap[XATTR_MTIME].append(getCurrentTimeStr());
 
-  contentsBuff.append(contents);
-  writeOp.append(contentsBuff);
-
   std::set<std::string> keysToRemove;
 
   if (xattrs)
@@ -654,14 +949,7 @@ setXAttrFromPath(Stat &stat, uid_t uid, gid_t gid, const std::string &attrName,
 
   writeOp.omap_set(omap);
 
-  ret = stat.pool->ioctx.operate(stat.translatedPath, &writeOp);
-
-  if (S_ISREG(stat.statBuff.st_mode) && ret == 0)
-  {
-    setInodeBacklinkAsync(stat.pool, stat.path, stat.translatedPath);
-  }
-
-  return ret;
+  return stat.pool->ioctx.operate(stat.translatedPath, &writeOp);
 }
 
 int
@@ -773,112 +1061,6 @@ int getMapOfXAttrFromPath(librados::IoCtx &ioctx,
   return ret;
 }
 
-int
-splitToken(const std::string &line,
-           int startPos,
-           std::string &key,
-           std::string &value,
-           std::string *op)
-{
-  std::string token("");
-  bool gotKey(false);
-  char quoteFound('\0');
-
-  size_t i = startPos;
-
-  for (; i < line.length(); i++)
-  {
-    if ((line[i] == '"' || line[i] == '\'') && i > 1 && line[i - 1] != '\\')
-    {
-      if (quoteFound == '\0')
-      {
-        quoteFound = line[i];
-        continue;
-      }
-
-      if (quoteFound == line[i])
-      {
-        i++;
-        quoteFound = '\0';
-
-        if (gotKey)
-          break;
-      }
-    }
-
-    if (quoteFound == '\0')
-    {
-      if (line[i] == '=')
-      {
-        key = token;
-        token = "";
-        gotKey = true;
-        quoteFound = '\0';
-
-        if (op)
-          *op = "=";
-
-        continue;
-      }
-
-      if (line[i] == ' ')
-      {
-        if (token != "" && gotKey)
-            break;
-
-        continue;
-      }
-
-      if (op != 0)
-      {
-        if (line[i] == '<' || line[i] == '>')
-        {
-          key = token;
-          token = "";
-          gotKey = true;
-          quoteFound = '\0';
-          *op = line[i];
-
-          if (i + 1 < line.length() && line[i + 1] == '=')
-          {
-            *op += "=";
-            i++;
-          }
-
-          continue;
-        }
-
-        if (line[i] == '!')
-        {
-          if (i + 1 < line.length() && line[i + 1] == '=')
-          {
-            key = token;
-            token = "";
-            gotKey = true;
-            quoteFound = '\0';
-            *op = "!=";
-            i++;
-
-            continue;
-          }
-        }
-      }
-    }
-
-    token += line[i];
-  }
-
-  if (token != "")
-  {
-    if (gotKey)
-      value = token;
-    else
-      key = token;
-  }
-
-  return i;
-}
-
 std::string
 sanitizePath(const std::string &path)
 {
@@ -1014,17 +1196,9 @@ getCurrentTimeStr()
   return timespecToStr(&spec);
 }
 
-int
-createDirAndInode(const Stat *stat)
+static void
+makeDirInodeOp(const Stat *stat, librados::ObjectWriteOperation &writeOp)
 {
-  int ret = createDirObject(stat);
-
-  if (ret != 0)
-  {
-    return ret;
-  }
-
-  librados::ObjectWriteOperation writeOp;
   const std::string &timeSpec = timespecToStr(&stat->statBuff.st_ctim);
   const std::string &permissions = makePermissionsXAttr(stat->statBuff.st_mode,
                                                         stat->statBuff.st_uid,
@@ -1037,12 +1211,11 @@ createDirAndInode(const Stat *stat)
   omap[XATTR_MTIME].append(timeSpec);
   omap[XATTR_INODE_HARD_LINK].append(stat->path);
 
+  if (dirUsesOmapIndex(stat))
+    omap[XATTR_DIR_INDEX].append(DIR_INDEX_OMAP);
+
   writeOp.create(true);
   writeOp.omap_set(omap);
-
-  ret = stat->pool->ioctx.operate(stat->translatedPath, &writeOp);
-
-  return ret;
 }
 
 std::string
@@ -1056,22 +1229,186 @@ makeInodeXattr(const Stat *stat)
   return stream.str();
 }
 
-int
-createDirObject(const Stat *stat)
+static void
+makeDirObjectOp(const Stat *stat, librados::ObjectWriteOperation &writeOp)
 {
-  librados::ObjectWriteOperation writeOp;
-
   std::map<std::string, librados::bufferlist> omap;
   omap[XATTR_INODE].append(makeInodeXattr(stat));
 
   writeOp.create(true);
   writeOp.omap_set(omap);
+}
+
+int
+createDirObject(const Stat *stat)
+{
+  librados::ObjectWriteOperation writeOp;
+  makeDirObjectOp(stat, writeOp);
 
   int ret = stat->pool->ioctx.operate(stat->path, &writeOp);
 
   return ret;
 }
 
+int
+createDirAndInode(const Stat *stat)
+{
+  // The path and inode objects are written at the same time instead of one
+  // after the other, so creating a dir costs a single round trip
+  librados::ObjectWriteOperation dirOp, inodeOp;
+  makeDirObjectOp(stat, dirOp);
+  makeDirInodeOp(stat, inodeOp);
+
+  librados::AioCompletion *dirCompletion =
+      librados::Rados::aio_create_completion();
+  librados::AioCompletion *inodeCompletion =
+      librados::Rados::aio_create_completion();
+
+  stat->pool->ioctx.aio_operate(stat->path, dirCompletion, &dirOp);
+  stat->pool->ioctx.aio_operate(stat->translatedPath, inodeCompletion,
+                                &inodeOp);
+
+  dirCompletion->wait_for_complete();
+  inodeCompletion->wait_for_complete();
+
+  int ret = dirCompletion->get_return_value();
+  const int inodeRet = inodeCompletion->get_return_value();
+
+  dirCompletion->release();
+  inodeCompletion->release();
+
+  if (ret != 0)
+  {
+    // The path was taken (e.g. created meanwhile by another client) so the
+    // inode we have just written is not referenced by anything
+    if (inodeRet == 0)
+      stat->pool->ioctx.remove(stat->translatedPath);
+
+    return ret;
+  }
+
+  return inodeRet;
+}
+
+enum DirObjectOp
+{
+  DIR_OBJECT_CREATE_PATH,
+  DIR_OBJECT_CREATE_INODE,
+  DIR_OBJECT_REMOVE_PATH,
+  DIR_OBJECT_REMOVE_INODE
+};
+
+// Runs the given operation on the path or inode objects of the given dirs
+// whose result is still 0, keeping at most window operations in flight
+static void
+runDirObjectOpsAsync(const std::vector<Stat> &stats, DirObjectOp opType,
+                     size_t window, std::vector<int> &results)
+{
+  std::deque<std::pair<size_t, librados::AioCompletion *> > inFlight;
+  size_t next = 0;
+
+  window = std::max(window, (size_t) 1);
+
+  while (next < stats.size() || !inFlight.empty())
+  {
+    if (next < stats.size() && inFlight.size() < window)
+    {
+      const Stat &stat = stats[next];
+
+      if (results[next] == 0)
+      {
+        librados::ObjectWriteOperation writeOp;
+        librados::AioCompletion *completion;
+
+        if (opType == DIR_OBJECT_CREATE_INODE)
+          makeDirInodeOp(&stat, writeOp);
+        else if (opType == DIR_OBJECT_CREATE_PATH)
+          makeDirObjectOp(&stat, writeOp);
+        else
+          writeOp.remove();
+
+        const bool inodeObject = opType == DIR_OBJECT_CREATE_INODE ||
+                                 opType == DIR_OBJECT_REMOVE_INODE;
+
+        completion = librados::Rados::aio_create_completion();
+        stat.pool->ioctx.aio_operate(inodeObject ? stat.translatedPath :
+                                                   stat.path,
+                                     completion, &writeOp);
+        inFlight.push_back(std::make_pair(next, completion));
+      }
+
+      next++;
+      continue;
+    }
+
+    std::pair<size_t, librados::AioCompletion *> op = inFlight.front();
+    inFlight.pop_front();
+
+    op.second->wait_for_complete();
+    results[op.first] = op.second->get_return_value();
+    op.second->release();
+  }
+}
+
+// Creates the path and inode objects of all the given dirs with pipelined
+// asynchronous operations. The result of each creation is set in results, in
+// the same order as the stats.
+void
+createDirsAndInodes(const std::vector<Stat> &stats, std::vector<int> &results,
+                    size_t window)
+{
+  results.assign(stats.size(), 0);
+
+  runDirObjectOpsAsync(stats, DIR_OBJECT_CREATE_PATH, window, results);
+  runDirObjectOpsAsync(stats, DIR_OBJECT_CREATE_INODE, window, results);
+}
+
+// Creates only the path objects of the given dirs (pointing to their existing
+// inodes), with pipelined asynchronous operations
+void
+createDirObjects(const std::vector<Stat> &stats, std::vector<int> &results,
+                 size_t window)
+{
+  results.assign(stats.size(), 0);
+  runDirObjectOpsAsync(stats, DIR_OBJECT_CREATE_PATH, window, results);
+}
+
+// Removes the path objects of the given dirs (leaving their inodes), with
+// pipelined asynchronous operations
+void
+removeDirObjects(const std::vector<Stat> &stats, std::vector<int> &results,
+                 size_t window)
+{
+  results.assign(stats.size(), 0);
+  runDirObjectOpsAsync(stats, DIR_OBJECT_REMOVE_PATH, window, results);
+}
+
+// Removes the path and then the inode objects of the given dirs, with
+// pipelined asynchronous operations. Objects that no longer exist are not
+// considered an error.
+void
+removeDirsAndInodes(const std::vector<Stat> &stats, std::vector<int> &results,
+                    size_t window)
+{
+  results.assign(stats.size(), 0);
+
+  runDirObjectOpsAsync(stats, DIR_OBJECT_REMOVE_PATH, window, results);
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    if (results[i] == -ENOENT)
+      results[i] = 0;
+  }
+
+  runDirObjectOpsAsync(stats, DIR_OBJECT_REMOVE_INODE, window, results);
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    if (results[i] == -ENOENT)
+      results[i] = 0;
+  }
+}
+
 ino_t
 hash(const char *path)
 {
@@ -1084,6 +1421,23 @@ updateTimeAsyncCB(rados_completion_t comp, void *arg)
   rados_aio_release(comp);
 }
 
+// Tells the caches watching the given dir inode that its log has changed. The
+// notification is sent asynchronously and nobody waits for it.
+void
+notifyDirChange(librados::IoCtx &ioctx, const std::string &inode,
+                const char *event)
+{
+  librados::bufferlist eventBuff;
+  eventBuff.append(event);
+
+  rados_completion_t comp;
+
+  rados_aio_create_completion(0, 0, updateTimeAsyncCB, &comp);
+  librados::AioCompletion completion((librados::AioCompletionImpl *)comp);
+
+  ioctx.aio_notify(inode, &completion, eventBuff, DIR_NOTIFY_TIMEOUT, 0);
+}
+
 void
 updateTimeAsync(const Stat *stat, const char *timeXAttrKey,
                 const std::string &time)
@@ -1178,6 +1532,10 @@ size_t alignChunkSize(size_t chunkSize, size_t alignment)
   if (alignment == 0 || chunkSize % alignment == 0)
     return chunkSize;
 
+  // A chunk cannot be smaller than the alignment
+  if (chunkSize < alignment)
+    return alignment;
+
   return alignment * (chunkSize / alignment);
 }
 
@@ -1225,36 +1583,20 @@ fileSizeToHex(size_t num)
   return std::string(chunkNumHex, XATTR_FILE_SIZE_LENGTH);
 }
 
-void
-updateInodeBacklinkAsyncCB(rados_completion_t comp, void *arg)
+unsigned int
+backoffWithJitter(unsigned int backoff)
 {
-  rados_aio_release(comp);
-}
+  static __thread unsigned int seed = 0;
 
-void
-setInodeBacklinkAsync(PoolSP pool, const std::string &backlink,
-                      const std::string &inode, const std::string *compare,
-                      rados_callback_t callback, void *arg)
-{
-  librados::bufferlist backlinkBl, compareBl;
-  backlinkBl.append(backlink);
+  if (seed == 0)
+    seed = time(0) ^ (unsigned long) &seed;
 
-  if (compare)
-    compareBl.append(*compare);
+  // Return a random time (in microseconds) between half of the backoff (given
+  // in milliseconds) and the full backoff, so that the clients retrying the
+  // same operation do not do it at the same time
+  const unsigned int backoffUs = backoff * 1000;
 
-  librados::ObjectWriteOperation writeOp;
-  writeOp.setxattr(XATTR_INODE_HARD_LINK, backlinkBl);
-  writeOp.cmpxattr(XATTR_INODE_HARD_LINK, LIBRADOS_CMPXATTR_OP_EQ, compareBl);
-
-  rados_completion_t comp;
-
-  if (!callback)
-    callback = updateInodeBacklinkAsyncCB;
-
-  rados_aio_create_completion(arg, 0, callback, &comp);
-  librados::AioCompletion completion((librados::AioCompletionImpl *) comp);
-
-  pool->ioctx.aio_operate(inode, &completion, &writeOp);
+  return backoffUs / 2 + rand_r(&seed) % (backoffUs / 2 + 1);
 }
 
 int
@@ -1271,7 +1613,6 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
   std::set<std::string> omapKeys;
   std::map<std::string, librados::bufferlist> omapValues, newOmapValues;
   std::map<std::string, std::pair<librados::bufferlist, int> > omapCmp;
-  librados::bufferlist oldParentContents, newParentContents;
 
   omapKeys.insert(oldFileEntry);
   omapKeys.insert(oldInlineBufferEntry);
@@ -1301,11 +1642,13 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
   }
 
   // Deindex the old file name in the old parent and index it in the new parent
-  oldParentContents.append(getObjectIndexLine(oldBaseName, '-'));
-  newParentContents.append(getObjectIndexLine(newBaseName, '+'));
-
   librados::ObjectWriteOperation newParentWriteOp;
-  newParentWriteOp.append(newParentContents);
+
+  ret = addDirIndexOp(newParentWriteOp, &newParent, newBaseName, '+');
+
+  if (ret != 0)
+    return ret;
+
   newParentWriteOp.omap_set(newOmapValues);
 
   bool sameParent = oldParent.translatedPath == newParent.translatedPath;
@@ -1324,7 +1667,11 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
       omapCmp[key] = cmp;
     }
 
-    newParentWriteOp.append(oldParentContents);
+    ret = addDirIndexOp(newParentWriteOp, &oldParent, oldBaseName, '-');
+
+    if (ret != 0)
+      return ret;
+
     newParentWriteOp.omap_rm_keys(omapKeys);
 
     if (omapCmp.size() > 0)
@@ -1334,16 +1681,35 @@ moveLogicalFile(Stat &oldParent, Stat &newParent,
   ret = newParent.pool->ioctx.operate(newParent.translatedPath,
                                       &newParentWriteOp);
 
+  if (ret == 0)
+    notifyIndexChange(&newParent);
+
   if (ret == 0 && !sameParent)
   {
     // If we succeeded in moving the file's logical contents to the new parent
-    // then we delete the old ones
-    librados::ObjectWriteOperation oldParentWriteOp;
-    oldParentWriteOp.append(oldParentContents);
-    oldParentWriteOp.omap_rm_keys(omapKeys);
+    // then we delete the old ones (again if the entry's metadata changed
+    // meanwhile, as in indexObject)
+    ret = -ECANCELED;
+
+    for (int attempt = 0;
+         attempt < DIR_ENTRY_REMOVAL_MAX_ATTEMPTS && ret == -ECANCELED;
+         attempt++)
+    {
+      librados::ObjectWriteOperation oldParentWriteOp;
+
+      ret = addDirIndexOp(oldParentWriteOp, &oldParent, oldBaseName, '-');
+
+      if (ret != 0)
+        return ret;
+
+      oldParentWriteOp.omap_rm_keys(omapKeys);
+
+      ret = oldParent.pool->ioctx.operate(oldParent.translatedPath,
+                                          &oldParentWriteOp);
+    }
 
-    ret = oldParent.pool->ioctx.operate(oldParent.translatedPath,
-                                        &oldParentWriteOp);
+    if (ret == 0)
+      notifyIndexChange(&oldParent);
   }
 
   return ret;
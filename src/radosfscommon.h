@@ -30,22 +30,26 @@
 #include <sstream>
 #include <tr1/memory>
 #include <time.h>
+#include <vector>
 
 #include "hash64.h"
 #include "radosfsdefines.h"
+#include "radosfsstrings.h"
 
 struct Pool {
   std::string name;
   size_t size;
   librados::IoCtx ioctx;
   u_int64_t alignment;
+  bool notifyDirChanges;
 
   Pool(const std::string &poolName, size_t poolSize,
        librados::IoCtx &ioctx)
     : name(poolName),
       size(poolSize),
       ioctx(ioctx),
-      alignment(0)
+      alignment(0),
+      notifyDirChanges(false)
   {}
 
   ~Pool(void)
@@ -112,19 +116,51 @@ std::string makePermissionsXAttr(long int mode, uid_t uid, gid_t gid);
 
 std::string getParentDir(const std::string &path, int *pos);
 
-std::string escapeObjName(const std::string &obj);
+int indexObject(const Stat *parentStat, const Stat *stat, char op);
 
-std::string unescapeObjName(const std::string &obj);
+int indexObjects(const Stat *parentStat, const std::vector<Stat> &stats,
+                 char op);
 
-int indexObject(const Stat *parentStat, const Stat *stat, char op);
+int indexFileWithInlineBuffer(const Stat *parentStat, const Stat *stat,
+                              const librados::bufferlist &inlineBuffer);
 
 std::string getObjectIndexLine(const std::string &obj, char op);
 
+void appendDirLogRecord(librados::bufferlist &buff,
+                        char op,
+                        const std::string &name,
+                        const std::map<std::string, std::string> &metadata);
+
 int indexObjectMetadata(librados::IoCtx &ioctx,
                         const std::string &dirName,
                         const std::string &baseName,
                         std::map<std::string, std::string> &metadata,
-                        char op);
+                        char op,
+                        bool omapIndex = false,
+                        bool notify = false);
+
+void notifyDirChange(librados::IoCtx &ioctx, const std::string &inode,
+                     const char *event);
+
+bool dirUsesOmapIndex(const Stat *stat);
+
+void setDirIndexMode(Stat *stat, bool omapIndex);
+
+std::string makeDirEntryKey(const std::string &entry);
+
+std::string makeDirEntryMetadataPrefix(const std::string &entry);
+
+std::string makeDirEntryMetadataVersionKey(const std::string &entry);
+
+int getDirEntryMetadata(librados::IoCtx &ioctx,
+                        const std::string &dirName,
+                        const std::string &entry,
+                        std::map<std::string, librados::bufferlist> &metadata);
+
+int addDirIndexOp(librados::ObjectWriteOperation &writeOp,
+                  const Stat *dirStat,
+                  const std::string &entry,
+                  char op);
 
 std::string getDirPath(const std::string &path);
 
@@ -155,17 +191,16 @@ int getMapOfXAttrFromPath(librados::IoCtx &ioctx,
                           const std::string &path,
                           std::map<std::string, std::string> &map);
 
-int splitToken(const std::string &line,
-               int startPos,
-               std::string &key,
-               std::string &value,
-               std::string *op = 0);
-
 int writeContentsAtomically(librados::IoCtx &ioctx,
               const std::string &obj,
               const std::string &contents,
               const std::map<std::string, librados::bufferlist> *xattrs = 0);
 
+int writeDirOpAtomically(librados::IoCtx &ioctx,
+              const std::string &obj,
+              librados::ObjectWriteOperation &writeOp,
+              const std::map<std::string, librados::bufferlist> *xattrs = 0);
+
 std::string sanitizePath(const std::string &path);
 
 int statFromXAttr(const std::string &path,
@@ -193,8 +228,24 @@ std::string generateUuid(void);
 
 int createDirAndInode(const Stat *stat);
 
+void createDirsAndInodes(const std::vector<Stat> &stats,
+                         std::vector<int> &results,
+                         size_t window);
+
 int createDirObject(const Stat *stat);
 
+void createDirObjects(const std::vector<Stat> &stats,
+                      std::vector<int> &results,
+                      size_t window);
+
+void removeDirObjects(const std::vector<Stat> &stats,
+                      std::vector<int> &results,
+                      size_t window);
+
+void removeDirsAndInodes(const std::vector<Stat> &stats,
+                         std::vector<int> &results,
+                         size_t window);
+
 int getInodeAndPool(librados::IoCtx &ioctx, const std::string &path,
                     std::string &inode, std::string &pool);
 
@@ -230,9 +281,7 @@ int statAndGetXAttrs(librados::IoCtx &ioctx, const std::string &obj,
 
 std::string fileSizeToHex(size_t num);
 
-void setInodeBacklinkAsync(PoolSP pool, const std::string &backlink,
-                           const std::string &inode, const std::string *compare = 0,
-                           rados_callback_t callback = 0, void *arg = 0);
+unsigned int backoffWithJitter(unsigned int backoff);
 
 int moveLogicalFile(Stat &oldParent, Stat &newParent,
                     const std::string &oldFilePath,
@@ -0,0 +1,370 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define RADOS_FS_STRINGS_SIMD
+#endif
+
+#include "radosfsstrings.h"
+
+// Finds the first byte in data that is one of chars. Object names and dir log
+// lines are mostly made of characters that need no special treatment, so the
+// callers below use this to skip over them in bulk and copy whole spans at
+// once instead of examining and appending one character at a time.
+
+typedef size_t (*FindFirstOfFunc)(const char *data, size_t length,
+                                  const char *chars, size_t numChars);
+
+static size_t
+findFirstOfScalar(const char *data, size_t length, const char *chars,
+                  size_t numChars)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    if (memchr(chars, data[i], numChars) != 0)
+      return i;
+  }
+
+  return length;
+}
+
+#ifdef RADOS_FS_STRINGS_SIMD
+
+// SSE2 is always available on x86_64 so this is the baseline. Comparing
+// against each character and OR-ing the masks is as fast as SSE4.2's
+// pcmpestri for the handful of characters we look for.
+
+static size_t
+findFirstOfSSE2(const char *data, size_t length, const char *chars,
+                size_t numChars)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= length; i += 16)
+  {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i matches = _mm_setzero_si128();
+
+    for (size_t j = 0; j < numChars; j++)
+      matches = _mm_or_si128(matches,
+                             _mm_cmpeq_epi8(block, _mm_set1_epi8(chars[j])));
+
+    const int mask = _mm_movemask_epi8(matches);
+
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+
+  return i + findFirstOfScalar(data + i, length - i, chars, numChars);
+}
+
+__attribute__((target("avx2"))) static size_t
+findFirstOfAVX2(const char *data, size_t length, const char *chars,
+                size_t numChars)
+{
+  size_t i = 0;
+
+  for (; i + 32 <= length; i += 32)
+  {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    __m256i matches = _mm256_setzero_si256();
+
+    for (size_t j = 0; j < numChars; j++)
+      matches = _mm256_or_si256(matches,
+                                _mm256_cmpeq_epi8(block,
+                                                  _mm256_set1_epi8(chars[j])));
+
+    const unsigned int mask = _mm256_movemask_epi8(matches);
+
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+
+  return i + findFirstOfSSE2(data + i, length - i, chars, numChars);
+}
+
+static FindFirstOfFunc
+selectFindFirstOf(void)
+{
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return findFirstOfAVX2;
+
+  return findFirstOfSSE2;
+}
+
+#else
+
+static FindFirstOfFunc
+selectFindFirstOf(void)
+{
+  return findFirstOfScalar;
+}
+
+#endif
+
+static size_t
+findFirstOf(const char *data, size_t length, const char *chars,
+            size_t numChars)
+{
+  static const FindFirstOfFunc func = selectFindFirstOf();
+
+  return func(data, length, chars, numChars);
+}
+
+static const char ESCAPE_CHARS[] = {'"', '\n', '%'};
+static const char UNESCAPE_CHARS[] = {'\\', '%'};
+static const char QUOTED_TOKEN_CHARS[] = {'"', '\''};
+static const char TOKEN_CHARS[] = {'"', '\'', '=', ' '};
+static const char TOKEN_OP_CHARS[] = {'"', '\'', '=', ' ', '<', '>', '!'};
+
+void
+appendEscapedObjName(std::string &out, const std::string &obj)
+{
+  const char *data = obj.data();
+  const size_t length = obj.length();
+  size_t pos = 0;
+
+  while (pos < length)
+  {
+    size_t span = findFirstOf(data + pos, length - pos, ESCAPE_CHARS,
+                              sizeof(ESCAPE_CHARS));
+    out.append(data + pos, span);
+    pos += span;
+
+    if (pos == length)
+      break;
+
+    if (data[pos] == '"')
+      out += "\\\"";
+    else if (data[pos] == '\n')
+      out += '%';
+    else
+      out += "\\%";
+
+    pos++;
+  }
+}
+
+std::string
+escapeObjName(const std::string &obj)
+{
+  if (findFirstOf(obj.data(), obj.length(), ESCAPE_CHARS,
+                  sizeof(ESCAPE_CHARS)) == obj.length())
+    return obj;
+
+  std::string str;
+  str.reserve(obj.length() + obj.length() / 8 + 2);
+  appendEscapedObjName(str, obj);
+
+  return str;
+}
+
+std::string
+unescapeObjName(const std::string &obj)
+{
+  const char *data = obj.data();
+  const size_t length = obj.length();
+
+  if (findFirstOf(data, length, UNESCAPE_CHARS,
+                  sizeof(UNESCAPE_CHARS)) == length)
+    return obj;
+
+  std::string str;
+  str.reserve(length);
+
+  // The last character is handled separately below, so only look at the ones
+  // before it here
+
+  size_t i = 0;
+
+  while (i < length - 1)
+  {
+    size_t span = findFirstOf(data + i, length - 1 - i, UNESCAPE_CHARS,
+                              sizeof(UNESCAPE_CHARS));
+    str.append(data + i, span);
+    i += span;
+
+    if (i == length - 1)
+      break;
+
+    if (data[i] == '\\')
+    {
+      if (data[i + 1] == '"')
+        str += '"';
+      else if (data[i + 1] == '%')
+        str += '%';
+
+      i += 2;
+    }
+    else
+    {
+      str += '\n';
+      i++;
+    }
+  }
+
+  if (i == length - 1)
+  {
+    if (data[length - 1] == '%')
+      str += '\n';
+    else
+      str += data[length - 1];
+  }
+
+  return str;
+}
+
+int
+splitToken(const std::string &line,
+           int startPos,
+           std::string &key,
+           std::string &value,
+           std::string *op)
+{
+  std::string token("");
+  bool gotKey(false);
+  char quoteFound('\0');
+
+  size_t i = startPos;
+
+  for (; i < line.length(); i++)
+  {
+    // Skip over the characters that cannot change the parsing state;
+    // they all go into the token as they are
+
+    const char *chars = TOKEN_CHARS;
+    size_t numChars = sizeof(TOKEN_CHARS);
+
+    if (quoteFound != '\0')
+    {
+      chars = QUOTED_TOKEN_CHARS;
+      numChars = sizeof(QUOTED_TOKEN_CHARS);
+    }
+    else if (op != 0)
+    {
+      chars = TOKEN_OP_CHARS;
+      numChars = sizeof(TOKEN_OP_CHARS);
+    }
+
+    size_t span = findFirstOf(line.data() + i, line.length() - i, chars,
+                              numChars);
+    token.append(line, i, span);
+    i += span;
+
+    if (i == line.length())
+      break;
+
+    if ((line[i] == '"' || line[i] == '\'') && i > 1 && line[i - 1] != '\\')
+    {
+      if (quoteFound == '\0')
+      {
+        quoteFound = line[i];
+        continue;
+      }
+
+      if (quoteFound == line[i])
+      {
+        i++;
+        quoteFound = '\0';
+
+        if (gotKey)
+          break;
+      }
+    }
+
+    if (quoteFound == '\0')
+    {
+      if (line[i] == '=')
+      {
+        key = token;
+        token = "";
+        gotKey = true;
+        quoteFound = '\0';
+
+        if (op)
+          *op = "=";
+
+        continue;
+      }
+
+      if (line[i] == ' ')
+      {
+        if (token != "" && gotKey)
+            break;
+
+        continue;
+      }
+
+      if (op != 0)
+      {
+        if (line[i] == '<' || line[i] == '>')
+        {
+          key = token;
+          token = "";
+          gotKey = true;
+          quoteFound = '\0';
+          *op = line[i];
+
+          if (i + 1 < line.length() && line[i + 1] == '=')
+          {
+            *op += "=";
+            i++;
+          }
+
+          continue;
+        }
+
+        if (line[i] == '!')
+        {
+          if (i + 1 < line.length() && line[i + 1] == '=')
+          {
+            key = token;
+            token = "";
+            gotKey = true;
+            quoteFound = '\0';
+            *op = "!=";
+            i++;
+
+            continue;
+          }
+        }
+      }
+    }
+
+    token += line[i];
+  }
+
+  if (token != "")
+  {
+    if (gotKey)
+      value = token;
+    else
+      key = token;
+  }
+
+  return i;
+}
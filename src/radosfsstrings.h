@@ -0,0 +1,42 @@
+/*
+ * Rados Filesystem - A filesystem library based in librados
+ *
+ * Copyright (C) 2014-2015 CERN, Switzerland
+ *
+ * Author: Joaquim Rocha <joaquim.rocha@cern.ch>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License at http://www.gnu.org/licenses/lgpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __RADOS_FS_STRINGS_HH__
+#define __RADOS_FS_STRINGS_HH__
+
+#include <string>
+
+// String helpers that do not depend on librados, so they can also be used in
+// the object class that runs on the OSDs
+
+std::string escapeObjName(const std::string &obj);
+
+// Appends the escaped obj to out without building a temporary string
+void appendEscapedObjName(std::string &out, const std::string &obj);
+
+std::string unescapeObjName(const std::string &obj);
+
+int splitToken(const std::string &line,
+               int startPos,
+               std::string &key,
+               std::string &value,
+               std::string *op = 0);
+
+#endif /* __RADOS_FS_STRINGS_HH__ */
@@ -22,13 +22,17 @@
 #include <getopt.h>
 #include <gtest/gtest.h>
 #include <errno.h>
+#include <fstream>
 #include <cmath>
 #include <sstream>
 #include <stdexcept>
 #include <time.h>
 
+#include "DirEntryIndex.hh"
 #include "FileIO.hh"
 #include "FileInode.hh"
+#include "Logger.hh"
+#include "OpRecorder.hh"
 #include "Quota.hh"
 #include "RadosFsTest.hh"
 #include "radosfscommon.h"
@@ -176,6 +180,97 @@ TEST_F(RadosFsTest, Pools)
   EXPECT_EQ(2, radosFs.dataPools(poolPrefix).size());
 }
 
+TEST_F(RadosFsTest, NestedPoolPrefixes)
+{
+  const std::string dataPoolName(TEST_POOL);
+  const std::string otherPoolName(TEST_POOL_MTD);
+
+  // Set up pools for nested prefixes (and one sharing the start of a name)
+
+  EXPECT_EQ(0, radosFs.addDataPool(dataPoolName, "/", 0));
+  EXPECT_EQ(0, radosFs.addDataPool(otherPoolName, "/nested", 0));
+  EXPECT_EQ(0, radosFs.addMetadataPool(otherPoolName, "/"));
+  EXPECT_EQ(0, radosFs.addMetadataPool(dataPoolName, "/nested"));
+
+  // The pools of the longest matching prefix are used
+
+  EXPECT_EQ(dataPoolName, radosFsPriv()->getDataPool("/file")->name);
+  EXPECT_EQ(otherPoolName, radosFsPriv()->getDataPool("/nested/file")->name);
+  EXPECT_EQ(dataPoolName, radosFsPriv()->getDataPool("/nestedx/file")->name);
+  EXPECT_EQ(1, radosFsPriv()->getDataPools("/nested/dir/file").size());
+
+  EXPECT_EQ(otherPoolName,
+            radosFsPriv()->getMetadataPoolFromPath("/dir/")->name);
+  EXPECT_EQ(dataPoolName,
+            radosFsPriv()->getMetadataPoolFromPath("/nested/dir/")->name);
+
+  // Asking for a pool by name finds it in the longest prefix that has it
+
+  EXPECT_EQ(dataPoolName,
+            radosFsPriv()->getDataPool("/nested/file", dataPoolName)->name);
+
+  // Removing pools changes the lookups right away
+
+  EXPECT_EQ(0, radosFs.removeDataPool(otherPoolName));
+  EXPECT_EQ(dataPoolName, radosFsPriv()->getDataPool("/nested/file")->name);
+
+  EXPECT_EQ(0, radosFs.removeMetadataPool(dataPoolName));
+  EXPECT_EQ(otherPoolName,
+            radosFsPriv()->getMetadataPoolFromPath("/nested/dir/")->name);
+
+  EXPECT_EQ(0, radosFs.removeDataPool(dataPoolName));
+  EXPECT_EQ((void *) 0, radosFsPriv()->getDataPool("/file").get());
+}
+
+TEST_F(RadosFsTest, PoolLayout)
+{
+  const std::string dataPoolName(TEST_POOL);
+  const std::string otherPoolName(TEST_POOL_MTD);
+
+  // There is no layout to load yet
+
+  EXPECT_EQ(-ENOENT, radosFs.loadLayout(otherPoolName));
+
+  // Save the layout of a few prefixes
+
+  EXPECT_EQ(0, radosFs.addDataPool(dataPoolName, "/", 10));
+  EXPECT_EQ(0, radosFs.addDataPool(otherPoolName, "/", 20));
+  EXPECT_EQ(0, radosFs.addDataPool(otherPoolName, "/nested dir", 30));
+  EXPECT_EQ(0, radosFs.addMetadataPool(otherPoolName, "/"));
+  EXPECT_EQ(0, radosFs.addMetadataPool(dataPoolName, "/nested dir"));
+
+  EXPECT_EQ(0, radosFs.saveLayout(otherPoolName));
+
+  // Load it in another client and check it has the same pools
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+
+  EXPECT_EQ(0, otherClient.loadLayout(otherPoolName));
+
+  std::vector<std::string> dataPools = otherClient.dataPools("/");
+
+  ASSERT_EQ(2, dataPools.size());
+  EXPECT_EQ(dataPoolName, dataPools[0]);
+  EXPECT_EQ(otherPoolName, dataPools[1]);
+  EXPECT_EQ(30 * 1024 * 1024,
+            otherClient.dataPoolSize(otherClient.dataPools("/nested dir/")[0]));
+  EXPECT_EQ("/nested dir/", otherClient.metadataPoolPrefix(dataPoolName));
+  EXPECT_EQ(otherPoolName, otherClient.metadataPoolFromPrefix("/"));
+
+  // Loading it again conflicts with the pools that are already set
+
+  EXPECT_EQ(-EEXIST, otherClient.loadLayout(otherPoolName));
+  EXPECT_EQ(1, otherClient.dataPools("/nested dir/").size());
+
+  // The loaded pools can be used right away
+
+  radosfs::Dir dir(&otherClient, "/nested dir/dir");
+
+  EXPECT_EQ(0, dir.create());
+  EXPECT_TRUE(dir.exists());
+}
+
 TEST_F(RadosFsTest, CharacterConsistency)
 {
   AddPool();
@@ -212,6 +307,51 @@ TEST_F(RadosFsTest, CharacterConsistency)
   EXPECT_NE(entries.end(), entries.find(path + '/'));
 }
 
+TEST_F(RadosFsTest, EscapeObjNames)
+{
+  // Names without special characters are kept as they are, both when they
+  // are shorter and longer than the blocks that are scanned at once
+
+  std::string name("short-name");
+  EXPECT_EQ(name, escapeObjName(name));
+  EXPECT_EQ(name, unescapeObjName(name));
+
+  name = std::string(100, 'x');
+  EXPECT_EQ(name, escapeObjName(name));
+
+  // Special characters at the start, middle and end of long names
+
+  std::string prefix(37, 'a');
+  name = "\"" + prefix + "%" + prefix + "\n" + prefix + "\"";
+
+  std::string escaped = escapeObjName(name);
+
+  EXPECT_EQ("\\\"" + prefix + "\\%" + prefix + "%" + prefix + "\\\"",
+            escaped);
+  EXPECT_EQ(name, unescapeObjName(escaped));
+
+  std::string appended("prefix:");
+  appendEscapedObjName(appended, name);
+  EXPECT_EQ("prefix:" + escaped, appended);
+
+  // Split a long line with quoted values into its tokens
+
+  std::string line = "name=\"" + escaped + "\" key  =  \"" + prefix + " " +
+                     prefix + "\"";
+  std::string key, value;
+
+  int pos = splitToken(line, 0, key, value);
+
+  EXPECT_EQ("name", key);
+  EXPECT_EQ(name, unescapeObjName(value));
+
+  pos = splitToken(line, pos, key, value);
+
+  EXPECT_EQ("key", key);
+  EXPECT_EQ(prefix + " " + prefix, value);
+  EXPECT_EQ(line.length(), (size_t) pos);
+}
+
 TEST_F(RadosFsTest, PathsLength)
 {
   AddPool();
@@ -321,8 +461,8 @@ TEST_F(RadosFsTest, GenericWorkerThreads)
   file.write("CERN", 2, 2);
   file.sync();
 
-  EXPECT_EQ(MIN_NUM_WORKER_THREADS, radosFsPriv()->numGenericWorkers);
-  EXPECT_EQ(MIN_NUM_WORKER_THREADS, radosFsPriv()->generalWorkerThreads.size());
+  EXPECT_EQ(MIN_NUM_WORKER_THREADS, radosFsPriv()->scheduler.numWorkers());
+  EXPECT_EQ(MIN_NUM_WORKER_THREADS, radosFsPriv()->scheduler.numLaunchedWorkers());
 
   // Increase number of worker threads
 
@@ -334,8 +474,8 @@ TEST_F(RadosFsTest, GenericWorkerThreads)
   file.write("CERN", 2, 2);
   file.sync();
 
-  EXPECT_EQ(numWorkers, radosFsPriv()->numGenericWorkers);
-  EXPECT_EQ(numWorkers, radosFsPriv()->generalWorkerThreads.size());
+  EXPECT_EQ(numWorkers, radosFsPriv()->scheduler.numWorkers());
+  EXPECT_EQ(numWorkers, radosFsPriv()->scheduler.numLaunchedWorkers());
 
   // Diminish number of worker threads
 
@@ -346,8 +486,169 @@ TEST_F(RadosFsTest, GenericWorkerThreads)
   file.write("CERN", 0, 2);
   file.write("CERN", 2, 2);
 
-  EXPECT_EQ(numWorkers, radosFsPriv()->numGenericWorkers);
-  EXPECT_EQ(numWorkers, radosFsPriv()->generalWorkerThreads.size());
+  EXPECT_EQ(numWorkers, radosFsPriv()->scheduler.numWorkers());
+  EXPECT_EQ(numWorkers, radosFsPriv()->scheduler.numLaunchedWorkers());
+}
+
+struct SchedulerTestState
+{
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  bool releaseBlockers;
+  int runningBlockers;
+  int maxRunningBlockers;
+  int finishedJobs;
+};
+
+static void
+schedulerBlockingJob(SchedulerTestState *state)
+{
+  boost::unique_lock<boost::mutex> lock(state->mutex);
+
+  state->runningBlockers++;
+  state->maxRunningBlockers = std::max(state->maxRunningBlockers,
+                                       state->runningBlockers);
+
+  while (!state->releaseBlockers)
+    state->cond.wait(lock);
+
+  state->runningBlockers--;
+  state->finishedJobs++;
+  state->cond.notify_all();
+}
+
+static void
+schedulerShortJob(SchedulerTestState *state)
+{
+  boost::unique_lock<boost::mutex> lock(state->mutex);
+
+  state->finishedJobs++;
+  state->cond.notify_all();
+}
+
+TEST_F(RadosFsTest, WorkScheduler)
+{
+  const size_t numWorkers = 3;
+  radosfs::WorkScheduler scheduler(numWorkers);
+  SchedulerTestState state;
+  state.releaseBlockers = false;
+  state.runningBlockers = 0;
+  state.maxRunningBlockers = 0;
+  state.finishedJobs = 0;
+
+  // Workers are only launched when needed
+
+  EXPECT_EQ(0, scheduler.numLaunchedWorkers());
+  EXPECT_EQ(numWorkers - 1, scheduler.maxBackgroundJobs());
+
+  // Flood the scheduler with blocking background jobs
+
+  const int numBlockers = 10;
+
+  for (int i = 0; i < numBlockers; i++)
+    scheduler.post(boost::bind(&schedulerBlockingJob, &state),
+                   radosfs::WorkScheduler::PRIORITY_BACKGROUND);
+
+  EXPECT_EQ(numWorkers, scheduler.numLaunchedWorkers());
+
+  // Short jobs still get a worker while the background ones are blocked
+
+  const int numShortJobs = 5;
+
+  for (int i = 0; i < numShortJobs; i++)
+    scheduler.post(boost::bind(&schedulerShortJob, &state),
+                   radosfs::WorkScheduler::PRIORITY_INTERACTIVE);
+
+  scheduler.postDelayed(boost::bind(&schedulerShortJob, &state), 1000);
+
+  {
+    boost::unique_lock<boost::mutex> lock(state.mutex);
+
+    boost::cv_status status = boost::cv_status::no_timeout;
+
+    while (state.finishedJobs < numShortJobs + 1 &&
+           status == boost::cv_status::no_timeout)
+    {
+      status = state.cond.wait_for(lock, boost::chrono::seconds(10));
+    }
+
+    EXPECT_EQ(numShortJobs + 1, state.finishedJobs);
+    EXPECT_GE((int) scheduler.maxBackgroundJobs(), state.runningBlockers);
+
+    state.releaseBlockers = true;
+    state.cond.notify_all();
+  }
+
+  // Stopping runs all the queued jobs
+
+  scheduler.stop();
+
+  EXPECT_TRUE(scheduler.stopping());
+  EXPECT_EQ(0, scheduler.numLaunchedWorkers());
+  EXPECT_EQ(numBlockers + numShortJobs + 1, state.finishedJobs);
+  EXPECT_EQ((int) scheduler.maxBackgroundJobs(), state.maxRunningBlockers);
+
+  // Jobs posted after stopping are run in the caller's thread
+
+  scheduler.post(boost::bind(&schedulerShortJob, &state));
+
+  EXPECT_EQ(numBlockers + numShortJobs + 2, state.finishedJobs);
+}
+
+TEST_F(RadosFsTest, FileIOIdleChecks)
+{
+  // Only the keys that are due are returned and the earliest deadline is kept
+
+  radosfs::DeadlineQueue queue;
+  std::vector<std::string> due;
+
+  queue.scheduleIn("later", 60);
+  queue.scheduleIn("soon", 0.05);
+  queue.scheduleIn("soon", 60);
+
+  EXPECT_EQ(2, queue.size());
+
+  EXPECT_EQ(0, queue.waitForDue(due, boost::chrono::milliseconds(1)));
+
+  EXPECT_EQ(1, queue.waitForDue(due, boost::chrono::seconds(5)));
+  ASSERT_EQ(1, due.size());
+  EXPECT_EQ("soon", due[0]);
+
+  queue.remove("later");
+
+  EXPECT_EQ(0, queue.size());
+
+  // Released FileIO instances are reaped once they are idle
+
+  radosFs.addDataPool(TEST_POOL, "/", 50 * 1024);
+  radosFs.addMetadataPool(TEST_POOL, "/");
+
+  std::string inode;
+
+  {
+    radosfs::File file(&radosFs, "/file", radosfs::File::MODE_READ_WRITE);
+
+    EXPECT_EQ(0, file.create());
+
+    const std::string contents("abc");
+
+    EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+    inode = radosFsFilePriv(file)->getFileIO()->inode();
+
+    EXPECT_TRUE(radosFsPriv()->getFileIO(inode).get() != 0);
+  }
+
+  const boost::chrono::steady_clock::time_point limit =
+      boost::chrono::steady_clock::now() + boost::chrono::seconds(10);
+
+  while (radosFsPriv()->getFileIO(inode).get() != 0 &&
+         boost::chrono::steady_clock::now() < limit)
+  {
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+  }
+
+  EXPECT_TRUE(radosFsPriv()->getFileIO(inode).get() == 0);
 }
 
 TEST_F(RadosFsTest, CreateDir)
@@ -765,6 +1066,150 @@ TEST_F(RadosFsTest, StatFile)
   }
 }
 
+TEST_F(RadosFsTest, BulkStatResults)
+{
+  AddPool();
+
+  radosfs::Dir dir(&radosFs, "/bulk-stat");
+  ASSERT_EQ(0, dir.create());
+
+  radosfs::File file(&radosFs, dir.path() + "file");
+  ASSERT_EQ(0, file.create());
+
+  // The results keep the order of the paths, including repeated ones and
+  // directories mixed with files
+
+  std::vector<std::string> paths;
+  paths.push_back(file.path());
+  paths.push_back("/");
+  paths.push_back(dir.path() + "nonexistent");
+  paths.push_back(dir.path());
+  paths.push_back(file.path());
+
+  radosfs::StatResults results;
+  radosFsPriv()->stat(paths, &results);
+
+  ASSERT_EQ(paths.size(), results.size());
+
+  const int retCodes[] = {0, 0, -ENOENT, 0, 0};
+
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    EXPECT_EQ(retCodes[i], results.ret(i));
+    EXPECT_EQ(paths[i], results.path(i).str());
+  }
+
+  EXPECT_TRUE(S_ISREG(results.statBuff(0).st_mode));
+  EXPECT_TRUE(S_ISDIR(results.statBuff(1).st_mode));
+  EXPECT_TRUE(S_ISDIR(results.statBuff(3).st_mode));
+  EXPECT_TRUE(S_ISREG(results.statBuff(4).st_mode));
+
+  // The pool is shared by the records instead of copied
+
+  EXPECT_NE((void *) 0, results.pool(0).get());
+  EXPECT_EQ(results.pool(0).get(), results.pool(4).get());
+  EXPECT_EQ((void *) 0, results.pool(2).get());
+
+  Stat stat;
+  ASSERT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+  EXPECT_EQ(stat.translatedPath, results.translatedPath(0).str());
+}
+
+struct StatAsyncResults
+{
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  std::map<std::string, std::pair<int, struct stat> > results;
+  size_t numCalls;
+};
+
+static void
+statAsyncCallback(const std::string &path, int retCode,
+                  const struct stat &buff, void *args)
+{
+  StatAsyncResults *results = static_cast<StatAsyncResults *>(args);
+  boost::unique_lock<boost::mutex> lock(results->mutex);
+
+  results->results[path] = std::pair<int, struct stat>(retCode, buff);
+  results->numCalls++;
+  results->cond.notify_all();
+}
+
+TEST_F(RadosFsTest, StatAsync)
+{
+  AddPool();
+
+  // Create more files in one directory than what is statted per job
+
+  radosfs::Dir dir(&radosFs, "/dir/");
+
+  ASSERT_EQ(0, dir.create());
+
+  const size_t numFiles = STAT_BATCH_MAX_ENTRIES * 2 + 10;
+  std::vector<std::string> names;
+  std::vector<std::string> paths;
+
+  for (size_t i = 0; i < numFiles; i++)
+  {
+    std::stringstream stream;
+    stream << "file" << i;
+    names.push_back(stream.str());
+    paths.push_back(dir.path() + stream.str());
+  }
+
+  ASSERT_EQ(0, dir.createFiles(names));
+
+  paths.push_back(dir.path());
+  paths.push_back(dir.path() + "non-existing");
+
+  // A callback is required
+
+  EXPECT_EQ(-EINVAL, radosFs.statAsync(paths, 0));
+
+  // Stat the paths asynchronously and wait for all the results
+
+  StatAsyncResults results;
+  results.numCalls = 0;
+
+  ASSERT_EQ(0, radosFs.statAsync(paths, statAsyncCallback, &results));
+
+  {
+    boost::unique_lock<boost::mutex> lock(results.mutex);
+    boost::cv_status status = boost::cv_status::no_timeout;
+
+    while (results.numCalls < paths.size() &&
+           status == boost::cv_status::no_timeout)
+    {
+      status = results.cond.wait_for(lock, boost::chrono::seconds(30));
+    }
+
+    ASSERT_EQ(paths.size(), results.numCalls);
+  }
+
+  // Verify that the results match the synchronous stat
+
+  std::vector<std::pair<int, struct stat> > statResult = radosFs.stat(paths);
+
+  ASSERT_EQ(paths.size(), statResult.size());
+
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    const std::pair<int, struct stat> &asyncResult = results.results[paths[i]];
+
+    EXPECT_EQ(statResult[i].first, asyncResult.first);
+
+    if (asyncResult.first == 0)
+    {
+      EXPECT_EQ(statResult[i].second.st_mode, asyncResult.second.st_mode);
+    }
+  }
+
+  EXPECT_EQ(0, results.results[dir.path()].first);
+  EXPECT_TRUE(S_ISDIR(results.results[dir.path()].second.st_mode));
+  EXPECT_EQ(-ENOENT, results.results[dir.path() + "non-existing"].first);
+  EXPECT_TRUE(S_ISREG(results.results[paths[0]].second.st_mode));
+}
+
 TEST_F(RadosFsTest, DirPermissions)
 {
   AddPool();
@@ -1728,6 +2173,104 @@ TEST_F(RadosFsTest, FileVectorRead)
   delete buff2;
 }
 
+TEST_F(RadosFsTest, FileVectorWrite)
+{
+  AddPool();
+
+  // Set a small file chunk size so the intervals affect several chunks
+
+  const size_t chunkSize = 64;
+  radosFs.setFileChunkSize(chunkSize);
+
+  const size_t inlineSize = 8;
+  radosfs::File file(&radosFs, "/test");
+
+  EXPECT_EQ(0, file.create(-1, "", 0, inlineSize));
+
+  // Nothing is written without intervals or with empty ones
+
+  std::vector<radosfs::FileWriteData> intervals;
+
+  EXPECT_EQ(-EINVAL, file.write(intervals));
+
+  intervals.push_back(radosfs::FileWriteData("abc", 0, 0));
+
+  EXPECT_EQ(-EINVAL, file.write(intervals));
+
+  // Write intervals in the inline buffer, across chunks and overlapping
+
+  const std::string first(chunkSize, 'a');
+  const std::string second(chunkSize / 2, 'b');
+  const std::string third(4, 'c');
+  const size_t secondOffset = chunkSize * 2 + chunkSize / 2;
+  const size_t thirdOffset = inlineSize - 2;
+
+  intervals.clear();
+  intervals.push_back(radosfs::FileWriteData(first.c_str(), 0, first.length()));
+  intervals.push_back(radosfs::FileWriteData(second.c_str(), secondOffset,
+                                             second.length()));
+  intervals.push_back(radosfs::FileWriteData(third.c_str(), thirdOffset,
+                                             third.length()));
+
+  std::string opId;
+
+  EXPECT_EQ(0, file.write(intervals, &opId));
+  EXPECT_EQ(0, file.sync(opId));
+
+  // Check the contents, with the later intervals overriding the earlier ones
+
+  const size_t fileSize = secondOffset + second.length();
+  std::string expected(fileSize, '\0');
+  expected.replace(0, first.length(), first);
+  expected.replace(secondOffset, second.length(), second);
+  expected.replace(thirdOffset, third.length(), third);
+
+  struct stat statBuff;
+
+  EXPECT_EQ(0, file.stat(&statBuff));
+  EXPECT_EQ(fileSize, statBuff.st_size);
+
+  char *buff = new char[fileSize];
+
+  EXPECT_EQ(fileSize, file.read(buff, 0, fileSize));
+  EXPECT_EQ(expected, std::string(buff, fileSize));
+
+  // Vectored writes can be mixed with regular ones
+
+  EXPECT_EQ(0, file.write("x", 1, 1, true));
+
+  intervals.clear();
+  intervals.push_back(radosfs::FileWriteData("y", chunkSize + 1, 1));
+
+  EXPECT_EQ(0, file.write(intervals, &opId));
+  EXPECT_EQ(0, file.sync());
+
+  expected[1] = 'x';
+  expected[chunkSize + 1] = 'y';
+
+  EXPECT_EQ(fileSize, file.read(buff, 0, fileSize));
+  EXPECT_EQ(expected, std::string(buff, fileSize));
+
+  delete[] buff;
+
+  // Intervals only beyond the inline buffer fill it up, so the file's size is
+  // not taken from the inline buffer's contents
+
+  radosfs::File otherFile(&radosFs, "/other-test");
+
+  EXPECT_EQ(0, otherFile.create(-1, "", 0, inlineSize));
+
+  intervals.clear();
+  intervals.push_back(radosfs::FileWriteData(second.c_str(), secondOffset,
+                                             second.length()));
+
+  EXPECT_EQ(0, otherFile.write(intervals, &opId));
+  EXPECT_EQ(0, otherFile.sync(opId));
+
+  EXPECT_EQ(0, otherFile.stat(&statBuff));
+  EXPECT_EQ(fileSize, statBuff.st_size);
+}
+
 void fileReadWriteCallback(const std::string &opId, int retCode, void *arg)
 {
   std::string *argStr = static_cast<std::string *>(arg);
@@ -1789,1211 +2332,3960 @@ TEST_F(RadosFsTest, FileReadWriteWithCallbacks)
   delete cbArg;
 }
 
-TEST_F(RadosFsTest, FileInline)
+void fileBufferReleasedCallback(const std::string &opId, const char *buff,
+                                void *arg)
+{
+  std::vector<const char *> *releasedBuffers =
+      static_cast<std::vector<const char *> *>(arg);
+
+  releasedBuffers->push_back(buff);
+}
+
+TEST_F(RadosFsTest, FileWriteBufferCallback)
 {
   AddPool();
 
   radosfs::File file(&radosFs, "/file");
 
-  // Create a file with an inline buffer size that is too big
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
 
-  ASSERT_EQ(-EINVAL, file.create(-1, "", 0, MAX_FILE_INLINE_BUFFER_SIZE + 1));
+  std::vector<const char *> releasedBuffers;
+  std::string opId;
+  const std::string contents("testing...");
 
-  // Create a file with a custom inline buffer size
+  // Write without copying the buffer and check it is only released after the
+  // operation is finished
 
-  const size_t inlineBufferSize(512);
+  ASSERT_EQ(0, file.write(contents.c_str(), 0, contents.length(), false,
+                          &opId, 0, &releasedBuffers,
+                          fileBufferReleasedCallback));
 
-  ASSERT_EQ(0, file.create(-1, "", 0, inlineBufferSize));
+  ASSERT_EQ(0, file.sync(opId));
 
-  EXPECT_EQ(inlineBufferSize, file.inlineBufferSize());
+  ASSERT_EQ(1, releasedBuffers.size());
 
-  // Write contents only in the inline buffer
+  EXPECT_EQ(contents.c_str(), releasedBuffers[0]);
 
-  char contents[inlineBufferSize * 2];
-  memset(contents, 'x', inlineBufferSize * 2);
-  contents[inlineBufferSize * 2 - 1] = '\0';
+  // Write copying the buffer and check it is released right away
 
-  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize));
+  releasedBuffers.clear();
+  char *buff = new char[contents.length()];
+  memcpy(buff, contents.c_str(), contents.length());
 
-  // Verify that the inode object was not created
+  ASSERT_EQ(0, file.write(buff, contents.length(), contents.length(), true,
+                          &opId, 0, &releasedBuffers,
+                          fileBufferReleasedCallback));
 
-  std::string inodeObj = radosFsFilePriv(file)->inode->name();
-
-  Stat stat;
-  radosFsPriv()->stat(file.path(), &stat);
+  ASSERT_EQ(1, releasedBuffers.size());
 
-  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(inodeObj, 0, 0));
+  EXPECT_EQ(buff, releasedBuffers[0]);
 
-  // Read the inline contetns
+  // The buffer can be changed as it is no longer used
 
-  char contents2[inlineBufferSize * 2];
+  memset(buff, 'x', contents.length());
+  delete[] buff;
 
-  ASSERT_EQ(inlineBufferSize - 1, file.read(contents2, 0,
-                                            inlineBufferSize - 1));
+  ASSERT_EQ(0, file.sync(opId));
 
-  EXPECT_TRUE(strncmp(contents2, contents, inlineBufferSize - 1) == 0);
+  // The callback should not be called again
 
-  // Write beyond than the inline buffer size and verify it creates the inode
-  // object
+  EXPECT_EQ(1, releasedBuffers.size());
 
-  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+  char buffRead[contents.length() * 2];
 
-  file.sync();
+  ASSERT_EQ(contents.length() * 2, file.read(buffRead, 0,
+                                             contents.length() * 2));
 
-  EXPECT_EQ(0, stat.pool->ioctx.stat(inodeObj, 0, 0));
+  EXPECT_EQ(contents + contents, std::string(buffRead, contents.length() * 2));
+}
 
-  // Read the full file length
+TEST_F(RadosFsTest, FileWaitForAnyOp)
+{
+  AddPool();
 
-  bzero(contents2, inlineBufferSize);
+  radosfs::File file(&radosFs, "/file");
 
-  ASSERT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
 
-  contents2[inlineBufferSize * 2 - 1] = '\0';
+  // Unknown ops
 
-  EXPECT_TRUE(strcmp(contents2, contents) == 0);
+  std::vector<std::string> opIds;
 
-  // Truncate so contents only exist in the inline buffer
+  EXPECT_EQ(-ENOENT, file.pollOp("non-existing-op"));
+  EXPECT_EQ(-ENOENT, file.waitForAnyOp(opIds));
 
-  ASSERT_EQ(0, file.truncate(inlineBufferSize / 2));
+  // Launch several writes and wait for them one by one as they finish
 
-  // Verify that the size of the contents read match what was truncated
+  const size_t numWrites = 8;
+  const std::string contents("testing...");
+  std::set<std::string> pendingOps;
 
-  EXPECT_EQ(inlineBufferSize / 2, file.read(contents2, 0, inlineBufferSize / 2));
+  for (size_t i = 0; i < numWrites; i++)
+  {
+    std::string opId;
 
-  // Truncate to 0
+    ASSERT_EQ(0, file.write(contents.c_str(), i * contents.length(),
+                            contents.length(), true, &opId));
 
-  ASSERT_EQ(0, file.truncate(0));
+    opIds.push_back(opId);
+    pendingOps.insert(opId);
+  }
 
-  // Write beyond the inline buffer when it is not full and then only up to
-  // half of it
+  // Poll the last op without blocking until it finishes
 
-  bzero(contents2, inlineBufferSize * 2);
+  int ret = -EINPROGRESS;
 
-  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+  for (int i = 0; i < 1000 && ret == -EINPROGRESS; i++)
+  {
+    ret = file.pollOp(opIds.back());
 
-  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize / 2));
+    if (ret == -EINPROGRESS)
+      usleep(10000);
+  }
 
-  // Verify that all contents are read
+  ASSERT_EQ(0, ret);
 
-  EXPECT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+  pendingOps.erase(opIds.back());
 
-  char blankContents[inlineBufferSize / 2];
-  memset(blankContents, '\0', inlineBufferSize / 2);
+  // A finished op is forgotten once its result is returned
 
-  EXPECT_TRUE(strncmp(contents2 + inlineBufferSize / 2, blankContents,
-                      inlineBufferSize / 2) == 0);
-}
+  EXPECT_EQ(-ENOENT, file.pollOp(opIds.back()));
 
-TEST_F(RadosFsTest, RenameFile)
-{
-  AddPool();
+  while (!pendingOps.empty())
+  {
+    std::string finishedOpId;
 
-  std::string originalPath("/my-file");
-  std::string path("/moved-file");
+    ASSERT_EQ(0, file.waitForAnyOp(opIds, &finishedOpId));
+    ASSERT_EQ(1, pendingOps.erase(finishedOpId));
+  }
 
-  radosfs::File file(&radosFs, originalPath);
+  EXPECT_EQ(-ENOENT, file.waitForAnyOp(opIds));
 
-  // Rename file that doesn't exist
+  // Wait for several ops at once
 
-  EXPECT_EQ(-ENOENT, file.rename(path));
+  opIds.clear();
 
-  EXPECT_EQ(0, file.create());
+  for (size_t i = 0; i < numWrites; i++)
+  {
+    std::string opId;
 
-  // Move file into a directory that doesn't exist
+    ASSERT_EQ(0, file.write(contents.c_str(),
+                            (numWrites + i) * contents.length(),
+                            contents.length(), true, &opId));
+    opIds.push_back(opId);
+  }
 
-  EXPECT_EQ(-ENOENT, file.rename("/phony/" + path));
+  EXPECT_EQ(0, file.sync(opIds));
 
-  // Move file in the same directory
+  // Verify the contents
 
-  EXPECT_EQ(0, file.rename(path));
+  const size_t totalLength = 2 * numWrites * contents.length();
+  char buff[totalLength];
 
-  EXPECT_EQ(path, file.path());
+  ASSERT_EQ(totalLength, file.read(buff, 0, totalLength));
 
-  EXPECT_TRUE(file.exists());
+  std::string expected;
 
-  // Make sure that renaming didn't create the inode
+  for (size_t i = 0; i < 2 * numWrites; i++)
+    expected += contents;
 
-  Stat stat;
+  EXPECT_EQ(expected, std::string(buff, totalLength));
+}
 
-  EXPECT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+TEST_F(RadosFsTest, FileChunkSizePolicy)
+{
+  AddPool();
 
-  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+  const size_t globalChunkSize = radosFs.fileChunkSize();
 
-  file.setPath(originalPath);
+  // Without a size hint, files get the global chunk size
 
-  EXPECT_FALSE(file.exists());
+  radosfs::File file(&radosFs, "/file");
+  ASSERT_EQ(0, file.create());
 
-  // Create a user directory
+  EXPECT_EQ(globalChunkSize, radosFsFilePriv(file)->getFileIO()->chunkSize());
 
-  radosfs::Dir userDir(&radosFs, "/user-dir");
+  // A size hint picks a chunk size that gives the file a few chunks
 
-  EXPECT_EQ(0, userDir.create(-1, false, TEST_UID, TEST_GID));
+  radosfs::File hinted(&radosFs, "/hinted");
+  ASSERT_EQ(0, hinted.create(-1, "", 0, -1, 64 * MEGABYTE_CONVERSION));
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  EXPECT_EQ(4 * MEGABYTE_CONVERSION,
+            radosFsFilePriv(hinted)->getFileIO()->chunkSize());
 
-  file.setPath(path);
+  // Small files do not get chunks smaller than the minimum
 
-  // Rename file without the required permissions
+  radosfs::File tiny(&radosFs, "/tiny");
+  ASSERT_EQ(0, tiny.create(-1, "", 0, -1, 1024));
 
-  EXPECT_EQ(-EACCES, file.rename(originalPath));
+  EXPECT_EQ(FILE_MIN_ADAPTIVE_CHUNK_SIZE,
+            radosFsFilePriv(tiny)->getFileIO()->chunkSize());
 
-  // Rename a file as user
+  // Huge files do not get chunks bigger than the global chunk size
 
-  path = userDir.path() + "user-file";
+  radosfs::File huge(&radosFs, "/huge");
+  ASSERT_EQ(0, huge.create(-1, "", 0, -1, globalChunkSize * 1024));
 
-  file.setPath(path);
+  EXPECT_EQ(globalChunkSize, radosFsFilePriv(huge)->getFileIO()->chunkSize());
 
-  EXPECT_EQ(0, file.create(-1, "", 0, 124));
+  // Policies with invalid ranges are refused
 
-  // Add contents to the file's inline buffer
+  EXPECT_EQ(-EINVAL, radosFs.setFileChunkSizePolicy("/dir", 0,
+                                                    MEGABYTE_CONVERSION));
+  EXPECT_EQ(-EINVAL, radosFs.setFileChunkSizePolicy("/dir",
+                                                    2 * MEGABYTE_CONVERSION,
+                                                    MEGABYTE_CONVERSION));
 
-  std::string fileContents = "abcdef";
-  char *fileContsBuff = new char[fileContents.length()];
+  // A policy bounds the chunk sizes of the files in its prefix
 
-  EXPECT_EQ(0, file.writeSync(fileContents.c_str(), 0, fileContents.length()));
+  radosfs::Dir dir(&radosFs, "/dir");
+  ASSERT_EQ(0, dir.create());
 
-  EXPECT_EQ(fileContents.length(),
-            file.read(fileContsBuff, 0, fileContents.length()));
+  ASSERT_EQ(0, radosFs.setFileChunkSizePolicy("/dir",
+                                              8 * MEGABYTE_CONVERSION,
+                                              16 * MEGABYTE_CONVERSION));
 
-  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
-                       fileContents.length()));
+  radosfs::File policyFile(&radosFs, "/dir/file");
+  ASSERT_EQ(0, policyFile.create());
 
-  // Move the file inside the same directory
+  EXPECT_EQ(16 * MEGABYTE_CONVERSION,
+            radosFsFilePriv(policyFile)->getFileIO()->chunkSize());
 
-  path = userDir.path() + "file";
+  radosfs::File policyHinted(&radosFs, "/dir/hinted");
+  ASSERT_EQ(0, policyHinted.create(-1, "", 0, -1, 1024));
 
-  EXPECT_EQ(0, file.rename(path));
+  EXPECT_EQ(8 * MEGABYTE_CONVERSION,
+            radosFsFilePriv(policyHinted)->getFileIO()->chunkSize());
 
-  radosfs::File sameFile(&radosFs, path);
+  // An explicit chunk size overrides the policy
 
-  EXPECT_TRUE(sameFile.exists());
+  radosfs::File explicitChunk(&radosFs, "/dir/explicit");
+  ASSERT_EQ(0, explicitChunk.create(-1, "", 2 * MEGABYTE_CONVERSION, -1,
+                                    1024));
 
-  // Check the contents
+  EXPECT_EQ(2 * MEGABYTE_CONVERSION,
+            radosFsFilePriv(explicitChunk)->getFileIO()->chunkSize());
 
-  bzero(fileContsBuff, fileContents.length());
+  // Removing the policy
 
-  EXPECT_EQ(fileContents.length(),
-            sameFile.read(fileContsBuff, 0, fileContents.length()));
+  EXPECT_EQ(0, radosFs.removeFileChunkSizePolicy("/dir"));
+  EXPECT_EQ(-ENOENT, radosFs.removeFileChunkSizePolicy("/dir"));
 
-  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
-                       fileContents.length()));
+  radosfs::File afterPolicy(&radosFs, "/dir/after");
+  ASSERT_EQ(0, afterPolicy.create());
 
-  // Get the user dir's entries
+  EXPECT_EQ(globalChunkSize,
+            radosFsFilePriv(afterPolicy)->getFileIO()->chunkSize());
+}
 
-  std::set<std::string> entries;
+TEST_F(RadosFsTest, FileCompression)
+{
+  AddPool();
 
-  userDir.refresh();
+  const size_t chunkSize = 256 * 1024;
+  radosFs.setFileChunkSize(chunkSize);
 
-  EXPECT_EQ(0, userDir.entryList(entries));
+  EXPECT_FALSE(radosFs.fileCompression("/compressed/file"));
 
-  // Rename the file (owned by the user) as root
+  radosFs.setFileCompression("/compressed", true);
+  radosFs.setFileCompression("/compressed/raw", false);
 
-  radosFs.setIds(ROOT_UID, ROOT_UID);
+  EXPECT_TRUE(radosFs.fileCompression("/compressed/file"));
+  EXPECT_FALSE(radosFs.fileCompression("/compressed/raw/file"));
+  EXPECT_FALSE(radosFs.fileCompression("/file"));
 
-  path = "/file-moved";
+  radosfs::Dir dir(&radosFs, "/compressed/");
+  ASSERT_EQ(0, dir.create());
 
-  EXPECT_EQ(0, sameFile.rename(path));
+  radosfs::File file(&radosFs, "/compressed/file");
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
 
-  file.setPath(path);
+  radosfs::FileIOSP fileIO = radosFsFilePriv(file)->getFileIO();
 
-  EXPECT_TRUE(file.exists());
+  ASSERT_TRUE(fileIO->compression());
 
-  // Check the contents again
+  // Write a few chunks of compressible contents
 
-  bzero(fileContsBuff, fileContents.length());
+  std::string contents;
 
-  EXPECT_EQ(fileContents.length(),
-            file.read(fileContsBuff, 0, fileContents.length()));
+  while (contents.length() < chunkSize * 2 + chunkSize / 2)
+    contents += "Some compressible line of a log file\n";
 
-  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
-                       fileContents.length()));
+  ASSERT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
 
-  // Get the user dir's contents again and compare them with the old ones
+  librados::IoCtx &ioctx = fileIO->pool()->ioctx;
+  const std::string firstChunk = makeFileChunkName(fileIO->inode(), 0);
+  u_int64_t storedSize;
 
-  std::set<std::string> entries1;
+  ASSERT_EQ(0, ioctx.stat(firstChunk, &storedSize, 0));
+  EXPECT_GT(chunkSize / 2, storedSize);
 
-  userDir.refresh();
+  librados::bufferlist info;
+  ASSERT_LT(0, ioctx.getxattr(firstChunk, XATTR_CHUNK_COMPRESSION, info));
+  EXPECT_EQ(0, std::string(info.c_str(), info.length()).find("zlib"));
 
-  EXPECT_EQ(0, userDir.entryList(entries1));
+  // Read it all and across the chunks' boundaries
 
-  EXPECT_LT(entries1.size(), entries.size());
+  char *buff = new char[contents.length()];
 
-  EXPECT_EQ(entries1.find("file"), entries1.end());
+  ASSERT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
 
-  // Verify that the new file's parent can list it
+  ASSERT_EQ(1000, file.read(buff, chunkSize - 500, 1000));
+  EXPECT_EQ(contents.substr(chunkSize - 500, 1000), std::string(buff, 1000));
 
-  entries.clear();
+  // Overwrite a part of a chunk
 
-  radosfs::Dir rootDir(&radosFs, "/");
+  const std::string newContents(100, 'x');
+  contents.replace(chunkSize + 10, newContents.length(), newContents);
 
-  rootDir.refresh();
+  ASSERT_EQ(0, file.writeSync(newContents.c_str(), chunkSize + 10,
+                              newContents.length()));
 
-  EXPECT_EQ(0, rootDir.entryList(entries));
+  ASSERT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
 
-  EXPECT_NE(entries.find("file-moved"), entries.end());
+  // Truncate the file in the middle of a chunk
 
-  // Move the file to the user's dir
+  ASSERT_EQ(0, file.truncate(chunkSize + chunkSize / 4));
+  contents.resize(chunkSize + chunkSize / 4);
 
-  path = userDir.path() + path;
+  memset(buff, 0, contents.length());
+  ASSERT_EQ(contents.length(), file.read(buff, 0, contents.length() + 10));
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
 
-  EXPECT_EQ(0, file.rename(path));
+  // Another client reads the same contents without setting any compression
 
-  sameFile.setPath(path);
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+  otherClient.addDataPool(TEST_POOL, "/");
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
 
-  EXPECT_TRUE(sameFile.exists());
+  radosfs::File otherFile(&otherClient, file.path());
 
-  // Rename the file to an empty path argument
+  memset(buff, 0, contents.length());
+  ASSERT_EQ(contents.length(), otherFile.read(buff, 0, contents.length()));
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
 
-  EXPECT_EQ(-EINVAL, file.rename(""));
+  // An inode opened by name also compresses the chunks it rewrites
 
-  // Rename the file to its own name
+  {
+    radosfs::FileInode inode(&radosFs, TEST_POOL, fileIO->inode(), chunkSize);
 
-  EXPECT_EQ(-EPERM, file.rename(file.path()));
+    ASSERT_TRUE(fileInodePriv(inode)->io->compression());
 
-  // Rename the file to a directory path
+    contents.replace(10, newContents.length(), newContents);
 
-  EXPECT_EQ(-EISDIR, file.rename(userDir.path()));
+    ASSERT_EQ(0, inode.writeSync(newContents.c_str(), 10,
+                                 newContents.length()));
 
-  // Rename the file to be in the root directory
+    memset(buff, 0, contents.length());
+    ASSERT_EQ(contents.length(), inode.read(buff, 0, contents.length()));
+    EXPECT_EQ(contents, std::string(buff, contents.length()));
+  }
 
-  path = "/file";
+  // A chunk that cannot be decompressed fails the write instead of being
+  // rewritten as if it was empty
 
-  EXPECT_EQ(0, file.rename(path));
+  const std::string secondChunk = makeFileChunkName(fileIO->inode(), 1);
+  u_int64_t secondChunkSize;
+  librados::bufferlist badInfo;
+  badInfo.append("bogus");
 
-  EXPECT_EQ(path, file.path());
+  ASSERT_EQ(0, ioctx.stat(secondChunk, &secondChunkSize, 0));
+  ASSERT_EQ(0, ioctx.setxattr(secondChunk, XATTR_CHUNK_COMPRESSION, badInfo));
 
-  sameFile.refresh();
+  EXPECT_GT(0, otherFile.writeSync(newContents.c_str(), chunkSize + 10,
+                                   newContents.length()));
 
-  EXPECT_FALSE(sameFile.exists());
+  ASSERT_EQ(0, ioctx.stat(secondChunk, &storedSize, 0));
+  EXPECT_EQ(secondChunkSize, storedSize);
 
-  // Create a file without an inline buffer so we check if the backlink in its
-  // inode gets updated when the file is renamed
+  delete[] buff;
 
-  file = radosfs::File(&radosFs, "/new-file");
+  // Contents that do not compress are kept raw
 
-  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+  radosfs::File randomFile(&radosFs, "/compressed/random");
+  ASSERT_EQ(0, randomFile.create(-1, "", 0, 0));
 
-  EXPECT_EQ(0, file.writeSync("x", 0, 1));
+  std::string randomContents(chunkSize, '\0');
 
-  testFileInodeBackLink(file.path());
+  for (size_t i = 0; i < randomContents.length(); i++)
+    randomContents[i] = random() % 256;
 
-  path = "/new-file-renamed";
+  ASSERT_EQ(0, randomFile.writeSync(randomContents.c_str(), 0,
+                                    randomContents.length()));
 
-  EXPECT_EQ(0, file.rename(path));
+  radosfs::FileIOSP randomIO = radosFsFilePriv(randomFile)->getFileIO();
+  const std::string randomChunk = makeFileChunkName(randomIO->inode(), 0);
 
-  ASSERT_EQ(path, file.path());
+  info.clear();
+  ASSERT_LT(0, ioctx.getxattr(randomChunk, XATTR_CHUNK_COMPRESSION, info));
+  EXPECT_EQ(0, std::string(info.c_str(), info.length()).find("none"));
 
-  testFileInodeBackLink(file.path());
+  char randomBuff[1024];
+  ASSERT_EQ(sizeof(randomBuff), randomFile.read(randomBuff, 1000,
+                                                sizeof(randomBuff)));
+  EXPECT_EQ(randomContents.substr(1000, sizeof(randomBuff)),
+            std::string(randomBuff, sizeof(randomBuff)));
 
-  delete[] fileContsBuff;
-}
+  // Files in the excluded prefix are not compressed
 
-bool
-checkChunksExistence(librados::IoCtx ioctx, const std::string &baseName,
-                      size_t firstChunk, size_t lastChunk, bool shouldExist)
-{
-  bool checkResult = true;
-  for (size_t i = firstChunk; i <= lastChunk; i++)
-  {
-    std::string chunk = makeFileChunkName(baseName, i);
+  radosfs::Dir rawDir(&radosFs, "/compressed/raw/");
+  ASSERT_EQ(0, rawDir.create());
 
-    if (ioctx.stat(chunk, 0, 0) != 0)
-    {
-      if (shouldExist)
-      {
-        fprintf(stderr, "Error: Chunk %s does not exist!\n", chunk.c_str());
-        checkResult = false;
-      }
-    }
-    else if (!shouldExist)
-    {
-      fprintf(stderr, "Error: Chunk %s exist!\n", chunk.c_str());
-      checkResult = false;
-    }
-  }
+  radosfs::File rawFile(&radosFs, "/compressed/raw/file");
+  ASSERT_EQ(0, rawFile.create(-1, "", 0, 0));
 
-  return checkResult;
+  EXPECT_FALSE(radosFsFilePriv(rawFile)->getFileIO()->compression());
 }
 
-TEST_F(RadosFsTest, FileOpsMultClientsWriteTruncate)
+TEST_F(RadosFsTest, SparseFileHoles)
 {
-    const size_t size = pow(1024, 3);
-    const size_t numChunks = 30;
-    const size_t chunkSize = size / numChunks;
-    char *contents = new char[size];
-    const std::string fileName("/file");
-    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
-                    contents, size, 0, 0);
-    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
-                    0, 0, 0, 0);
+  AddPool();
 
-    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
-                                                       &c1, &c2);
+  const size_t chunkSize = 1024;
+  radosFs.setFileChunkSize(chunkSize);
 
-    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
-    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+  radosfs::File file(&radosFs, "/file");
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, 0, true));
+  radosfs::FileIOSP fileIO = radosFsFilePriv(file)->getFileIO();
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 1, numChunks, false));
+  ASSERT_TRUE(fileIO->tracksAllocatedChunks());
 
-    delete file;
-    delete [] contents;
-}
+  // Write the first chunk and one far from it, leaving holes in between and
+  // after it
 
-TEST_F(RadosFsTest, FileOpsMultClientsWriteRemove)
-{
-    const size_t size = pow(1024, 3);
-    const size_t numChunks = 30;
-    const size_t chunkSize = size / numChunks;
-    char *contents = new char[size];
-    const std::string fileName("/file");
-    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
-                    contents, size, 0, 0);
-    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
-                    0, 0, 0, 0);
+  const std::string head(100, 'h');
+  const std::string middle(chunkSize, 'm');
 
-    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
-                                                       &c1, &c2);
+  ASSERT_EQ(0, file.writeSync(head.c_str(), 0, head.length()));
+  ASSERT_EQ(0, file.writeSync(middle.c_str(), chunkSize * 5,
+                              middle.length()));
 
-    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
-    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+  const size_t fileSize = chunkSize * 10 + 100;
+  ASSERT_EQ(0, file.truncate(fileSize));
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+  // Only the written chunks are recorded
 
-    delete file;
-    delete [] contents;
-}
+  librados::IoCtx &ioctx = fileIO->pool()->ioctx;
+  std::map<std::string, librados::bufferlist> keys;
 
-TEST_F(RadosFsTest, FileOpsMultClientsTruncateRemove)
-{
-    const size_t size = pow(1024, 3);
-    const size_t numChunks = 30;
-    const size_t chunkSize = size / numChunks;
-    char *contents = new char[size];
-    const std::string fileName("/file");
-    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
-                    contents, size, 0, 0);
-    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
-                    0, 0, 0, 0);
+  ASSERT_EQ(0, ioctx.omap_get_vals(fileIO->inode(), "",
+                                   FILE_ALLOCATED_CHUNK_KEY_PREFIX, 100,
+                                   &keys));
+  EXPECT_EQ(1, keys.size());
 
-    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
-                                                       &c1, &c2);
+  EXPECT_EQ(-ENOENT, ioctx.stat(makeFileChunkName(fileIO->inode(), 2), 0, 0));
 
-    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
-    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+  // The holes are read as zeros
 
-    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+  std::string expected(fileSize, '\0');
+  expected.replace(0, head.length(), head);
+  expected.replace(chunkSize * 5, middle.length(), middle);
 
-    delete file;
-    delete [] contents;
-}
+  char *buff = new char[fileSize];
+  memset(buff, 'x', fileSize);
 
-TEST_F(RadosFsTest, DirOpsMultipleClients)
-{
-  radosFs.addDataPool(TEST_POOL, "/", 50 * 1024);
-  radosFs.addMetadataPool(TEST_POOL, "/");
+  ASSERT_EQ(fileSize, file.read(buff, 0, fileSize));
+  EXPECT_EQ(expected, std::string(buff, fileSize));
 
-  // Create another RadosFs instance to be used as a different client
+  // Find the data and the holes
+
+  EXPECT_EQ(10, file.seekData(10));
+  EXPECT_EQ(chunkSize, file.seekHole(10));
+  EXPECT_EQ(chunkSize * 5, file.seekData(chunkSize));
+  EXPECT_EQ(chunkSize * 6, file.seekHole(chunkSize * 5 + 10));
+  EXPECT_EQ(-ENXIO, file.seekData(chunkSize * 6));
+  EXPECT_EQ(chunkSize * 6 + 3, file.seekHole(chunkSize * 6 + 3));
+  EXPECT_EQ(-ENXIO, file.seekHole(fileSize));
+  EXPECT_EQ(-ENXIO, file.seekData(fileSize));
+
+  // Another client knows the same holes, and sees the chunks written by the
+  // first one after it loaded them
 
   radosfs::Filesystem otherClient;
   otherClient.init("", conf());
+  otherClient.addDataPool(TEST_POOL, "/");
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
 
-  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
-  otherClient.addMetadataPool(TEST_POOL, "/");
+  radosfs::File otherFile(&otherClient, file.path());
 
-  // Create the same directory from both clients
+  EXPECT_EQ(chunkSize * 5, otherFile.seekData(chunkSize));
 
-  radosfs::Dir cli1DirInst(&radosFs, "/dir");
-  radosfs::Dir cli2DirInst(&otherClient, "/dir");
+  memset(buff, 'x', fileSize);
+  ASSERT_EQ(fileSize, otherFile.read(buff, 0, fileSize));
+  EXPECT_EQ(expected, std::string(buff, fileSize));
 
-  EXPECT_EQ(0, cli1DirInst.create());
-  EXPECT_EQ(-EEXIST, cli2DirInst.create());
+  const std::string tail(50, 't');
+  expected.replace(chunkSize * 8, tail.length(), tail);
 
-  // Launch 10 threads for each client, creating files and dirs in the same
-  // directory
+  ASSERT_EQ(0, file.writeSync(tail.c_str(), chunkSize * 8, tail.length()));
 
-  const int numOps = 10;
-  boost::thread *cli1Threads[numOps], *cli2Threads[numOps];
-  FsActionInfo *cli1ActionInfos[numOps];
-  FsActionInfo *cli2ActionInfos[numOps];
+  EXPECT_EQ(chunkSize * 8, otherFile.seekData(chunkSize * 6));
+
+  memset(buff, 'x', fileSize);
+  ASSERT_EQ(fileSize, otherFile.read(buff, 0, fileSize));
+  EXPECT_EQ(expected, std::string(buff, fileSize));
+
+  // An inode opened by name records the chunks it writes too, so they are not
+  // taken for holes by the file's readers
 
-  for (int i = 0; i < numOps; i++)
   {
-    bool createDir = (i % 2) == 0;
-    FsActionType actionType = FS_ACTION_TYPE_FILE;
-    std::stringstream stream;
-    stream << cli1DirInst.path();
+    radosfs::FileInode inode(&radosFs, TEST_POOL, fileIO->inode(), chunkSize);
 
-    if (createDir)
-    {
-      stream << "client-1-dir-" << i;
-      actionType = FS_ACTION_TYPE_DIR;
-    }
-    else
-    {
-      stream << "client-1-file-" << i;
-    }
+    ASSERT_TRUE(fileInodePriv(inode)->io->tracksAllocatedChunks());
 
-    cli1ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
-                                          "create", "", 0, 0, 0);
-    cli1Threads[i] = new boost::thread(&RadosFsTest::runInThread,
-                                       cli1ActionInfos[i]);
+    expected.replace(chunkSize * 3, tail.length(), tail);
+
+    ASSERT_EQ(0, inode.writeSync(tail.c_str(), chunkSize * 3, tail.length()));
   }
 
-  for (int i = 0; i < numOps; i++)
+  keys.clear();
+  ASSERT_EQ(0, ioctx.omap_get_vals(fileIO->inode(), "",
+                                   FILE_ALLOCATED_CHUNK_KEY_PREFIX, 100,
+                                   &keys));
+  EXPECT_EQ(3, keys.size());
+
+  radosfs::Filesystem thirdClient;
+  thirdClient.init("", conf());
+  thirdClient.addDataPool(TEST_POOL, "/");
+  thirdClient.addMetadataPool(TEST_POOL_MTD, "/");
+
+  radosfs::File newReader(&thirdClient, file.path());
+
+  memset(buff, 'x', fileSize);
+  ASSERT_EQ(fileSize, newReader.read(buff, 0, fileSize));
+  EXPECT_EQ(expected, std::string(buff, fileSize));
+
+  delete[] buff;
+}
+
+TEST_F(RadosFsTest, FileStriping)
+{
+  AddPool(1);
+
+  const size_t chunkSize = 16;
+  radosFs.setFileChunkSize(chunkSize);
+
+  EXPECT_EQ(1, radosFs.fileStripeWidth());
+
+  // A file created without striping keeps all its chunks in one pool
+
+  radosfs::File unstriped(&radosFs, "/unstriped");
+  ASSERT_EQ(0, unstriped.create(-1, TEST_POOL, 0, 0));
+
+  EXPECT_TRUE(radosFsFilePriv(unstriped)->getFileIO()->stripePools().empty());
+
+  // Stripe new files over both data pools
+
+  radosFs.setFileStripeWidth(2);
+
+  EXPECT_EQ(2, radosFs.fileStripeWidth());
+
+  radosfs::File file(&radosFs, "/file");
+  ASSERT_EQ(0, file.create(-1, TEST_POOL, 0, 0));
+
+  const size_t numChunks = 5;
+  std::string contents;
+
+  for (size_t i = 0; i < numChunks; i++)
+    contents += std::string(chunkSize, 'a' + i);
+
+  ASSERT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  radosfs::FileIOSP fileIO = radosFsFilePriv(file)->getFileIO();
+  const radosfs::PoolList &pools = fileIO->stripePools();
+
+  ASSERT_EQ(2, pools.size());
+  EXPECT_EQ(TEST_POOL, pools[0]->name);
+
+  // The chunks alternate between the pools, starting with the file's one
+
+  for (size_t i = 0; i < numChunks; i++)
   {
-    bool createDir = (i % 2) != 0;
-    FsActionType actionType = FS_ACTION_TYPE_FILE;
-    std::stringstream stream;
-    stream << cli2DirInst.path();
+    const std::string chunk = makeFileChunkName(fileIO->inode(), i);
 
-    if (createDir)
-    {
-      stream << "client-1-dir-" << i;
-      actionType = FS_ACTION_TYPE_DIR;
-    }
-    else
-    {
-      stream << "client-1-file-" << i;
-    }
+    EXPECT_EQ(0, pools[i % 2]->ioctx.stat(chunk, 0, 0));
+    EXPECT_EQ(-ENOENT, pools[(i + 1) % 2]->ioctx.stat(chunk, 0, 0));
+  }
 
-    cli2ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
-                                          "create", "", 0, 0, 0);
+  // The layout is recorded, so another client reads the same contents
 
-    cli2Threads[i] = new boost::thread(&RadosFsTest::runInThread,
-                                       cli2ActionInfos[i]);
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+  otherClient.addDataPool(TEST_POOL, "/");
+  otherClient.addDataPool(pools[1]->name, "/");
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
+
+  radosfs::File otherFile(&otherClient, file.path());
+  char buff[numChunks * chunkSize];
+
+  ASSERT_EQ(contents.length(), otherFile.read(buff, 0, contents.length()));
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
+
+  // An inode opened by name gets the layout from its file
+
+  radosfs::FileInode inode(&radosFs, TEST_POOL, fileIO->inode(), chunkSize);
+
+  memset(buff, 0, sizeof(buff));
+
+  ASSERT_EQ(contents.length(), inode.read(buff, 0, contents.length()));
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
+
+  // A layout with a pool that cannot be opened is not used at all
+
+  radosfs::PoolList layoutPools;
+  const std::string names = TEST_POOL + std::string(1, FILE_STRIPE_POOLS_SEP) +
+                            "no-such-pool";
+
+  EXPECT_GT(0, radosFsPriv()->getStripePoolsFromNames(names, pools[0],
+                                                       layoutPools));
+  EXPECT_TRUE(layoutPools.empty());
+
+  // Truncating and removing the file affects the chunks in both pools
+
+  ASSERT_EQ(0, file.truncate(chunkSize * 2));
+
+  EXPECT_EQ(0, pools[1]->ioctx.stat(makeFileChunkName(fileIO->inode(), 1),
+                                    0, 0));
+  EXPECT_EQ(-ENOENT, pools[0]->ioctx.stat(makeFileChunkName(fileIO->inode(),
+                                                            2), 0, 0));
+  EXPECT_EQ(-ENOENT, pools[1]->ioctx.stat(makeFileChunkName(fileIO->inode(),
+                                                            3), 0, 0));
+
+  ASSERT_EQ(0, fileIO->remove());
+
+  EXPECT_EQ(-ENOENT, pools[1]->ioctx.stat(makeFileChunkName(fileIO->inode(),
+                                                            1), 0, 0));
+}
+
+TEST_F(RadosFsTest, FileChunkRemovalWindow)
+{
+  AddPool();
+
+  const size_t chunkSize = 16;
+  radosFs.setFileChunkSize(chunkSize);
+
+  // Use a window smaller than the number of chunks to remove
+
+  const size_t window = 3;
+  radosFs.setFileChunkRemovalWindow(window);
+
+  EXPECT_EQ(window, radosFs.fileChunkRemovalWindow());
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+
+  const size_t numChunks = 10;
+  const std::string contents(chunkSize * numChunks, 'x');
+
+  ASSERT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  radosfs::FileIO *fileIO = radosFsFilePriv(file)->getFileIO().get();
+
+  EXPECT_EQ(window, fileIO->chunkRemovalWindow());
+
+  Stat stat;
+  radosFsPriv()->stat(file.path(), &stat);
+
+  // Truncate to half and check the progress reported and the chunks left
+
+  radosfs::AsyncOpSP truncateOp(new radosfs::AsyncOp("truncate-op"));
+
+  ASSERT_EQ(0, fileIO->truncate(contents.length() / 2, truncateOp));
+
+  u_int64_t done, total;
+  truncateOp->progress(&done, &total);
+
+  EXPECT_EQ(numChunks / 2, total);
+  EXPECT_EQ(total, done);
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(
+              makeFileChunkName(fileIO->inode(), numChunks / 2), 0, 0));
+
+  EXPECT_EQ(0, stat.pool->ioctx.stat(
+              makeFileChunkName(fileIO->inode(), numChunks / 2 - 1), 0, 0));
+
+  // Remove the file and check the progress and that no chunks are left
+
+  radosfs::AsyncOpSP removeOp(new radosfs::AsyncOp("remove-op"));
+
+  ASSERT_EQ(0, fileIO->remove(removeOp));
+
+  removeOp->progress(&done, &total);
+
+  EXPECT_EQ(numChunks / 2, total);
+  EXPECT_EQ(total, done);
+
+  for (size_t i = 0; i < numChunks; i++)
+  {
+    EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(
+                makeFileChunkName(fileIO->inode(), i), 0, 0));
   }
+}
 
-  for (int i = 0; i < numOps; i++)
+TEST_F(RadosFsTest, FileReapWithoutFilesystem)
+{
+  AddPool();
+
+  const size_t chunkSize = 16;
+  radosFs.setFileChunkSize(chunkSize);
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+
+  const std::string contents(chunkSize * 3, 'x');
+
+  ASSERT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  Stat stat;
+  radosFsPriv()->stat(file.path(), &stat);
+
+  radosfs::FileIOSP writerIO = radosFsFilePriv(file)->getFileIO();
+  const std::string inode = writerIO->inode();
+
+  // Release the writer's lock so the inode can be locked for its removal
+  writerIO->manageIdleLock(0);
+
+  // Inodes are reaped in the background without a filesystem, so there are
+  // no metrics or tracer to record in
+
+  radosfs::FileIO fileIO(0, stat.pool, inode, chunkSize);
+
+  EXPECT_EQ(0, fileIO.remove());
+
+  for (size_t i = 0; i < 3; i++)
   {
-    cli1Threads[i]->join();
-    cli2Threads[i]->join();
+    EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(makeFileChunkName(inode, i), 0,
+                                             0));
+  }
+}
 
-    delete cli1Threads[i];
-    delete cli1ActionInfos[i];
-    delete cli2Threads[i];
-    delete cli2ActionInfos[i];
+TEST_F(RadosFsTest, FileSizeCache)
+{
+  AddPool();
+
+  // Allow the file size to be cached for longer than the test takes
+
+  const double staleness = 60;
+  radosFs.setFileSizeCacheStaleness(staleness);
+
+  EXPECT_EQ(staleness, radosFs.fileSizeCacheStaleness());
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+
+  // Write several times and check the size is still the expected one after
+  // the size updates have been coalesced
+
+  const std::string contents("0123456789");
+  const size_t numWrites = 10;
+
+  for (size_t i = 0; i < numWrites; i++)
+  {
+    ASSERT_EQ(0, file.write(contents.c_str(), i * contents.length(),
+                            contents.length(), true));
   }
 
-  // Verify that both dir instances have the same number of entries
+  ASSERT_EQ(0, file.sync());
 
-  cli1DirInst.refresh();
+  const size_t expectedSize = numWrites * contents.length();
+  radosfs::FileIO *fileIO = radosFsFilePriv(file)->getFileIO().get();
 
-  std::set<std::string> entries;
+  EXPECT_EQ(expectedSize, fileIO->getSize());
 
-  EXPECT_EQ(0, cli1DirInst.entryList(entries));
+  // Change the size stored in the cluster behind the file's back and check
+  // that the cached size is still used
 
-  EXPECT_EQ(2 * numOps, entries.size());
+  Stat stat;
+  radosFsPriv()->stat(file.path(), &stat);
 
-  entries.clear();
-  cli2DirInst.refresh();
+  librados::bufferlist sizeBl;
+  sizeBl.append(fileSizeToHex(expectedSize * 2));
 
-  EXPECT_EQ(0, cli2DirInst.entryList(entries));
+  ASSERT_EQ(0, stat.pool->ioctx.setxattr(fileIO->inode(), XATTR_FILE_SIZE,
+                                         sizeBl));
 
-  EXPECT_EQ(2 * numOps, entries.size());
+  EXPECT_EQ(expectedSize, fileIO->getSize());
+
+  // Without allowing any staleness, the size has to be read again
+
+  fileIO->setSizeCacheStaleness(0);
+
+  EXPECT_EQ(expectedSize * 2, fileIO->getSize());
 }
 
-TEST_F(RadosFsTest, StatCluster)
+TEST_F(RadosFsTest, FileChunkCache)
 {
   AddPool();
 
-  uint64_t total = 0, used = 1, available = 1, numberOfObjects;
+  const size_t chunkSize = 128;
+  radosFs.setFileChunkSize(chunkSize);
 
-  int ret = radosFs.statCluster(&total, &used, &available, &numberOfObjects);
+  // Enable the chunk cache and keep the chunks for longer than the test takes
 
-  EXPECT_EQ(0, ret);
+  const size_t cacheSize = 1024 * 1024;
+  radosFs.setFileChunkCacheSize(cacheSize);
+  radosFs.setFileChunkCacheTtl(60);
+
+  EXPECT_EQ(cacheSize, radosFs.fileChunkCacheSize());
+  EXPECT_EQ(60, radosFs.fileChunkCacheTtl());
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+
+  const std::string contents(chunkSize, 'x');
+
+  ASSERT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  // Read the file so its chunk gets cached
+
+  char buff[chunkSize];
+
+  ASSERT_EQ(chunkSize, file.read(buff, 0, chunkSize));
+
+  EXPECT_EQ(contents, std::string(buff, chunkSize));
+
+  // Change the chunk behind the file's back and check that another File
+  // instance still reads the cached contents
+
+  Stat stat;
+  radosFsPriv()->stat(file.path(), &stat);
+
+  const std::string chunkName =
+      makeFileChunkName(radosFsFilePriv(file)->getFileIO()->inode(), 0);
+  const std::string otherContents(chunkSize, 'y');
+  librados::bufferlist otherContentsBl;
+  otherContentsBl.append(otherContents);
+
+  ASSERT_EQ(0, stat.pool->ioctx.write(chunkName, otherContentsBl, chunkSize, 0));
+
+  radosfs::File otherFile(&radosFs, "/file");
+
+  ASSERT_EQ(chunkSize, otherFile.read(buff, 0, chunkSize));
+
+  EXPECT_EQ(contents, std::string(buff, chunkSize));
+
+  // Once the cached chunk expires, the new contents should be read
+
+  radosFs.setFileChunkCacheTtl(0);
+
+  ASSERT_EQ(chunkSize, otherFile.read(buff, 0, chunkSize));
+
+  EXPECT_EQ(otherContents, std::string(buff, chunkSize));
+
+  // Writing locally should invalidate the cached chunk
+
+  radosFs.setFileChunkCacheTtl(60);
+
+  ASSERT_EQ(chunkSize, otherFile.read(buff, 0, chunkSize));
+
+  const std::string newContents(chunkSize, 'z');
+
+  ASSERT_EQ(0, file.writeSync(newContents.c_str(), 0, newContents.length()));
+
+  ASSERT_EQ(chunkSize, otherFile.read(buff, 0, chunkSize));
+
+  EXPECT_EQ(newContents, std::string(buff, chunkSize));
+}
+
+TEST_F(RadosFsTest, FileReadAhead)
+{
+  AddPool();
+
+  const size_t chunkSize = 512;
+  radosFs.setFileChunkSize(chunkSize);
+
+  // Read-ahead is disabled by default
+
+  EXPECT_FALSE(radosFs.fileReadAhead());
+
+  radosFs.setFileReadAhead(true);
+
+  EXPECT_TRUE(radosFs.fileReadAhead());
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+
+  // Write contents spanning several chunks
+
+  const size_t fileSize = chunkSize * 20 + chunkSize / 2;
+  std::string contents;
+
+  for (size_t i = 0; i < fileSize; i++)
+    contents += 'a' + (i % 26);
+
+  ASSERT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  // Read the file sequentially in small steps so it will be read ahead
+
+  const size_t step = 100;
+  char buff[step];
+  std::string contentsRead;
+  ssize_t ret;
+
+  while ((ret = file.read(buff, contentsRead.length(), step)) > 0)
+    contentsRead.append(buff, ret);
+
+  EXPECT_EQ(contents, contentsRead);
+
+  // Read half of the file sequentially, overwrite the second half and check
+  // that the new contents are read (the read-ahead data has to be discarded)
+
+  contentsRead.clear();
+
+  while (contentsRead.length() < fileSize / 2)
+  {
+    ret = file.read(buff, contentsRead.length(), step);
+    ASSERT_EQ(step, ret);
+    contentsRead.append(buff, ret);
+  }
+
+  const size_t newContentsOffset = contentsRead.length();
+  std::string newContents(fileSize - newContentsOffset, 'X');
+  contents.replace(newContentsOffset, newContents.length(), newContents);
+
+  ASSERT_EQ(0, file.writeSync(newContents.c_str(), newContentsOffset,
+                              newContents.length()));
+
+  while ((ret = file.read(buff, contentsRead.length(), step)) > 0)
+    contentsRead.append(buff, ret);
+
+  EXPECT_EQ(contents, contentsRead);
+
+  // Read in a non-sequential way
+
+  for (ssize_t i = (fileSize / step) - 1; i >= 0; i--)
+  {
+    ret = file.read(buff, i * step, step);
+    ASSERT_EQ(step, ret);
+    EXPECT_EQ(contents.substr(i * step, step), std::string(buff, ret));
+  }
+}
+
+TEST_F(RadosFsTest, FileWriteBehind)
+{
+  AddPool();
+
+  const size_t chunkSize = 128;
+  radosFs.setFileChunkSize(chunkSize);
+
+  // Enable the write-behind buffer with a size bigger than what will be written
+
+  const size_t writeBehindSize = 1024 * 1024;
+  radosFs.setFileWriteBehindSize(writeBehindSize);
+
+  EXPECT_EQ(writeBehindSize, radosFs.fileWriteBehindSize());
+
+  radosfs::File file(&radosFs, "/file");
+
+  // Create the file without an inline buffer so writes are not kept there
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+
+  // Write small, sequential, contents which span several chunks
+
+  const size_t writeSize = 10;
+  const size_t numWrites = 50;
+  std::string contents;
+
+  for (size_t i = 0; i < numWrites; i++)
+  {
+    std::string piece(writeSize, 'a' + (i % 26));
+    contents += piece;
+
+    ASSERT_EQ(0, file.write(piece.c_str(), i * writeSize, writeSize, true));
+  }
+
+  // Overwrite a region in the middle, overlapping two of the previous writes
+
+  const std::string overwrite("XXXXXXXXXXXXXXX");
+  contents.replace(15, overwrite.length(), overwrite);
+
+  ASSERT_EQ(0, file.write(overwrite.c_str(), 15, overwrite.length(), true));
+
+  // Verify that the inode object was not created yet
+
+  std::string inodeObj = radosFsFilePriv(file)->inode->name();
+
+  Stat stat;
+  radosFsPriv()->stat(file.path(), &stat);
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(inodeObj, 0, 0));
+
+  // The size should already account for the buffered data
+
+  struct stat statBuff;
+
+  ASSERT_EQ(0, file.stat(&statBuff));
+
+  EXPECT_EQ(contents.length(), statBuff.st_size);
+
+  // Sync and verify the contents were written
+
+  ASSERT_EQ(0, file.sync());
+
+  EXPECT_EQ(0, stat.pool->ioctx.stat(inodeObj, 0, 0));
+
+  char buff[numWrites * writeSize];
+
+  ASSERT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
+
+  // Reading should also flush the buffered writes
+
+  const std::string moreContents("more contents");
+
+  ASSERT_EQ(0, file.write(moreContents.c_str(), contents.length(),
+                          moreContents.length(), true));
+
+  contents += moreContents;
+  char buff2[contents.length()];
+
+  ASSERT_EQ(contents.length(), file.read(buff2, 0, contents.length()));
+
+  EXPECT_EQ(contents, std::string(buff2, contents.length()));
+
+  // Set a write-behind size small enough to flush after a couple of writes
+
+  radosFs.setFileWriteBehindSize(writeSize * 2);
+
+  radosfs::File otherFile(&radosFs, "/other-file");
+
+  ASSERT_EQ(0, otherFile.create(-1, "", 0, 0));
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    ASSERT_EQ(0, otherFile.write(contents.c_str() + i * writeSize,
+                                 i * writeSize, writeSize, true));
+  }
+
+  ASSERT_EQ(0, otherFile.sync());
+
+  ASSERT_EQ(writeSize * 4, otherFile.read(buff, 0, writeSize * 4));
+
+  EXPECT_EQ(contents.substr(0, writeSize * 4), std::string(buff, writeSize * 4));
+
+  // Destroying a FileIO right after its write-behind buffer is handed to the
+  // workers waits for the data to be written
+
+  radosfs::File lastFile(&radosFs, "/last-file");
+
+  ASSERT_EQ(0, lastFile.create(-1, "", 0, 0));
+
+  const std::string lastInode = radosFsFilePriv(lastFile)->inode->name();
+  Stat lastStat;
+  radosFsPriv()->stat(lastFile.path(), &lastStat);
+
+  radosfs::FileIO *fileIO = new radosfs::FileIO(&radosFs, lastStat.pool,
+                                                lastInode, chunkSize);
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    ASSERT_EQ(0, fileIO->write(contents.c_str() + i * writeSize, i * writeSize,
+                               writeSize, 0, true));
+  }
+
+  delete fileIO;
+
+  radosfs::FileIO readerIO(&radosFs, lastStat.pool, lastInode, chunkSize);
+
+  ASSERT_EQ(writeSize * 4, readerIO.read(buff, 0, writeSize * 4));
+
+  EXPECT_EQ(contents.substr(0, writeSize * 4), std::string(buff, writeSize * 4));
+}
+
+TEST_F(RadosFsTest, FileWriteBehindSingleWorker)
+{
+  AddPool();
+
+  // With a single worker, the flushes of the write-behind buffer (and vectored
+  // writes) cannot wait for others that are queued behind them
+
+  radosFs.setNumGenericWorkers(MIN_NUM_WORKER_THREADS);
+
+  const size_t chunkSize = 128;
+  radosFs.setFileChunkSize(chunkSize);
+
+  const size_t writeSize = 10;
+  radosFs.setFileWriteBehindSize(writeSize * 2);
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+
+  // Each couple of writes posts a flush, so several are queued at once
+
+  const size_t numWrites = 40;
+  std::string contents;
+
+  for (size_t i = 0; i < numWrites; i++)
+  {
+    std::string piece(writeSize, 'a' + (i % 26));
+    contents += piece;
+
+    ASSERT_EQ(0, file.write(piece.c_str(), i * writeSize, writeSize, true));
+  }
+
+  ASSERT_EQ(0, file.sync());
+
+  char buff[numWrites * writeSize];
+
+  ASSERT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
+
+  // Consecutive vectored writes, with and without the write-behind buffer
+
+  const std::string first(writeSize, 'X');
+  const std::string second(writeSize, 'Y');
+  std::vector<radosfs::FileWriteData> intervals;
+
+  intervals.push_back(radosfs::FileWriteData(first.c_str(), 0, first.length()));
+
+  std::vector<radosfs::FileWriteData> otherIntervals;
+
+  otherIntervals.push_back(radosfs::FileWriteData(second.c_str(), chunkSize,
+                                                  second.length()));
+
+  EXPECT_EQ(0, file.write(intervals));
+  EXPECT_EQ(0, file.write(otherIntervals));
+
+  ASSERT_EQ(0, file.sync());
+
+  radosFs.setFileWriteBehindSize(0);
+
+  radosfs::File otherFile(&radosFs, "/other-file");
+
+  ASSERT_EQ(0, otherFile.create(-1, "", 0, 0));
+
+  EXPECT_EQ(0, otherFile.write(intervals));
+  EXPECT_EQ(0, otherFile.write(otherIntervals));
+
+  ASSERT_EQ(0, otherFile.sync());
+
+  contents.replace(0, first.length(), first);
+  contents.replace(chunkSize, second.length(), second);
+
+  ASSERT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+  EXPECT_EQ(contents, std::string(buff, contents.length()));
+
+  ASSERT_EQ(first.length(), otherFile.read(buff, 0, first.length()));
+
+  EXPECT_EQ(first, std::string(buff, first.length()));
+
+  ASSERT_EQ(second.length(), otherFile.read(buff, chunkSize, second.length()));
+
+  EXPECT_EQ(second, std::string(buff, second.length()));
+}
+
+TEST_F(RadosFsTest, FileInline)
+{
+  AddPool();
+
+  radosfs::File file(&radosFs, "/file");
+
+  // Create a file with an inline buffer size that is too big
+
+  ASSERT_EQ(-EINVAL, file.create(-1, "", 0, MAX_FILE_INLINE_BUFFER_SIZE + 1));
+
+  // Create a file with a custom inline buffer size
+
+  const size_t inlineBufferSize(512);
+
+  ASSERT_EQ(0, file.create(-1, "", 0, inlineBufferSize));
+
+  EXPECT_EQ(inlineBufferSize, file.inlineBufferSize());
+
+  // Write contents only in the inline buffer
+
+  char contents[inlineBufferSize * 2];
+  memset(contents, 'x', inlineBufferSize * 2);
+  contents[inlineBufferSize * 2 - 1] = '\0';
+
+  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize));
+
+  // Verify that the inode object was not created
+
+  std::string inodeObj = radosFsFilePriv(file)->inode->name();
+
+  Stat stat;
+  radosFsPriv()->stat(file.path(), &stat);
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(inodeObj, 0, 0));
+
+  // Read the inline contetns
+
+  char contents2[inlineBufferSize * 2];
+
+  ASSERT_EQ(inlineBufferSize - 1, file.read(contents2, 0,
+                                            inlineBufferSize - 1));
+
+  EXPECT_TRUE(strncmp(contents2, contents, inlineBufferSize - 1) == 0);
+
+  // Write beyond than the inline buffer size and verify it creates the inode
+  // object
+
+  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+
+  file.sync();
+
+  EXPECT_EQ(0, stat.pool->ioctx.stat(inodeObj, 0, 0));
+
+  // Read the full file length
+
+  bzero(contents2, inlineBufferSize);
+
+  ASSERT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+
+  contents2[inlineBufferSize * 2 - 1] = '\0';
+
+  EXPECT_TRUE(strcmp(contents2, contents) == 0);
+
+  // Truncate so contents only exist in the inline buffer
+
+  ASSERT_EQ(0, file.truncate(inlineBufferSize / 2));
+
+  // Verify that the size of the contents read match what was truncated
+
+  EXPECT_EQ(inlineBufferSize / 2, file.read(contents2, 0, inlineBufferSize / 2));
+
+  // Truncate to 0
+
+  ASSERT_EQ(0, file.truncate(0));
+
+  // Write beyond the inline buffer when it is not full and then only up to
+  // half of it
+
+  bzero(contents2, inlineBufferSize * 2);
+
+  ASSERT_EQ(0, file.write(contents, inlineBufferSize, inlineBufferSize));
+
+  ASSERT_EQ(0, file.write(contents, 0, inlineBufferSize / 2));
+
+  // Verify that all contents are read
+
+  EXPECT_EQ(inlineBufferSize * 2, file.read(contents2, 0, inlineBufferSize * 2));
+
+  char blankContents[inlineBufferSize / 2];
+  memset(blankContents, '\0', inlineBufferSize / 2);
+
+  EXPECT_TRUE(strncmp(contents2 + inlineBufferSize / 2, blankContents,
+                      inlineBufferSize / 2) == 0);
+}
+
+TEST_F(RadosFsTest, FileInlineConcurrentWrites)
+{
+  AddPool();
+
+  radosfs::File file(&radosFs, "/file");
+
+  const size_t inlineBufferSize(8);
+
+  ASSERT_EQ(0, file.create(-1, "", 0, inlineBufferSize));
+
+  const std::string contents(inlineBufferSize, 'x');
+
+  ASSERT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  // Change the inline buffer from another instance, so the contents last
+  // written by the file are no longer the current ones
+
+  Stat parentStat;
+
+  ASSERT_EQ(0, radosFsPriv()->stat("/", &parentStat));
+
+  radosfs::FileInlineBuffer otherInlineBuffer(&radosFs, &parentStat, "file",
+                                              inlineBufferSize);
+
+  EXPECT_EQ(2, otherInlineBuffer.write("yy", 4, 2));
+
+  // Write again from the file and check that both changes were kept
+
+  ASSERT_EQ(0, file.writeSync("zz", 0, 2));
+
+  char buff[inlineBufferSize];
+
+  ASSERT_EQ(inlineBufferSize, file.read(buff, 0, inlineBufferSize));
+
+  EXPECT_EQ("zzxxyyxx", std::string(buff, inlineBufferSize));
+
+  // Truncating (with the file exclusively locked) should still work from the
+  // last contents written
+
+  ASSERT_EQ(0, file.truncate(inlineBufferSize / 2));
+
+  ASSERT_EQ(inlineBufferSize / 2, file.read(buff, 0, inlineBufferSize));
+
+  EXPECT_EQ("zzxx", std::string(buff, inlineBufferSize / 2));
+}
+
+TEST_F(RadosFsTest, RenameFile)
+{
+  AddPool();
+
+  std::string originalPath("/my-file");
+  std::string path("/moved-file");
+
+  radosfs::File file(&radosFs, originalPath);
+
+  // Rename file that doesn't exist
+
+  EXPECT_EQ(-ENOENT, file.rename(path));
+
+  EXPECT_EQ(0, file.create());
+
+  // Move file into a directory that doesn't exist
+
+  EXPECT_EQ(-ENOENT, file.rename("/phony/" + path));
+
+  // Move file in the same directory
+
+  EXPECT_EQ(0, file.rename(path));
+
+  EXPECT_EQ(path, file.path());
+
+  EXPECT_TRUE(file.exists());
+
+  // Make sure that renaming didn't create the inode
+
+  Stat stat;
+
+  EXPECT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(stat.translatedPath, 0, 0));
+
+  file.setPath(originalPath);
+
+  EXPECT_FALSE(file.exists());
+
+  // Create a user directory
+
+  radosfs::Dir userDir(&radosFs, "/user-dir");
+
+  EXPECT_EQ(0, userDir.create(-1, false, TEST_UID, TEST_GID));
+
+  radosFs.setIds(TEST_UID, TEST_GID);
+
+  file.setPath(path);
+
+  // Rename file without the required permissions
+
+  EXPECT_EQ(-EACCES, file.rename(originalPath));
+
+  // Rename a file as user
+
+  path = userDir.path() + "user-file";
+
+  file.setPath(path);
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 124));
+
+  // Add contents to the file's inline buffer
+
+  std::string fileContents = "abcdef";
+  char *fileContsBuff = new char[fileContents.length()];
+
+  EXPECT_EQ(0, file.writeSync(fileContents.c_str(), 0, fileContents.length()));
+
+  EXPECT_EQ(fileContents.length(),
+            file.read(fileContsBuff, 0, fileContents.length()));
+
+  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
+                       fileContents.length()));
+
+  // Move the file inside the same directory
+
+  path = userDir.path() + "file";
+
+  EXPECT_EQ(0, file.rename(path));
+
+  radosfs::File sameFile(&radosFs, path);
+
+  EXPECT_TRUE(sameFile.exists());
+
+  // Check the contents
+
+  bzero(fileContsBuff, fileContents.length());
+
+  EXPECT_EQ(fileContents.length(),
+            sameFile.read(fileContsBuff, 0, fileContents.length()));
+
+  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
+                       fileContents.length()));
+
+  // Get the user dir's entries
+
+  std::set<std::string> entries;
+
+  userDir.refresh();
+
+  EXPECT_EQ(0, userDir.entryList(entries));
+
+  // Rename the file (owned by the user) as root
+
+  radosFs.setIds(ROOT_UID, ROOT_UID);
+
+  path = "/file-moved";
+
+  EXPECT_EQ(0, sameFile.rename(path));
+
+  file.setPath(path);
+
+  EXPECT_TRUE(file.exists());
+
+  // Check the contents again
+
+  bzero(fileContsBuff, fileContents.length());
+
+  EXPECT_EQ(fileContents.length(),
+            file.read(fileContsBuff, 0, fileContents.length()));
+
+  EXPECT_EQ(0, strncmp(fileContsBuff, fileContents.c_str(),
+                       fileContents.length()));
+
+  // Get the user dir's contents again and compare them with the old ones
+
+  std::set<std::string> entries1;
+
+  userDir.refresh();
+
+  EXPECT_EQ(0, userDir.entryList(entries1));
+
+  EXPECT_LT(entries1.size(), entries.size());
+
+  EXPECT_EQ(entries1.find("file"), entries1.end());
+
+  // Verify that the new file's parent can list it
+
+  entries.clear();
+
+  radosfs::Dir rootDir(&radosFs, "/");
+
+  rootDir.refresh();
+
+  EXPECT_EQ(0, rootDir.entryList(entries));
+
+  EXPECT_NE(entries.find("file-moved"), entries.end());
+
+  // Move the file to the user's dir
+
+  path = userDir.path() + path;
+
+  EXPECT_EQ(0, file.rename(path));
+
+  sameFile.setPath(path);
+
+  EXPECT_TRUE(sameFile.exists());
+
+  // Rename the file to an empty path argument
+
+  EXPECT_EQ(-EINVAL, file.rename(""));
+
+  // Rename the file to its own name
+
+  EXPECT_EQ(-EPERM, file.rename(file.path()));
+
+  // Rename the file to a directory path
+
+  EXPECT_EQ(-EISDIR, file.rename(userDir.path()));
+
+  // Rename the file to be in the root directory
+
+  path = "/file";
+
+  EXPECT_EQ(0, file.rename(path));
+
+  EXPECT_EQ(path, file.path());
+
+  sameFile.refresh();
+
+  EXPECT_FALSE(sameFile.exists());
+
+  // Create a file without an inline buffer so we check if the backlink in its
+  // inode gets updated when the file is renamed
+
+  file = radosfs::File(&radosFs, "/new-file");
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+
+  EXPECT_EQ(0, file.writeSync("x", 0, 1));
+
+  testFileInodeBackLink(file.path());
+
+  path = "/new-file-renamed";
+
+  EXPECT_EQ(0, file.rename(path));
+
+  ASSERT_EQ(path, file.path());
+
+  testFileInodeBackLink(file.path());
+
+  delete[] fileContsBuff;
+}
+
+TEST_F(RadosFsTest, CopyFile)
+{
+  AddPool();
+
+  const size_t chunkSize = 1024;
+  const size_t inlineBufferSize = 16;
+
+  radosfs::File file(&radosFs, "/file");
+
+  ASSERT_EQ(0, file.create(-1, "", chunkSize, inlineBufferSize));
+
+  // Write the inline buffer, the first chunk, and a chunk after a hole
+
+  const std::string inlineContents("0123456789abcdef");
+  const std::string chunkContents(chunkSize, 'x');
+  const size_t lastChunkOffset = inlineBufferSize + chunkSize * 3;
+
+  ASSERT_EQ(0, file.writeSync(inlineContents.c_str(), 0, inlineBufferSize));
+  ASSERT_EQ(0, file.writeSync(chunkContents.c_str(), inlineBufferSize,
+                              chunkSize));
+  ASSERT_EQ(0, file.writeSync(chunkContents.c_str(), lastChunkOffset,
+                              chunkSize));
+
+  const size_t fileSize = lastChunkOffset + chunkSize;
+
+  ASSERT_EQ(0, file.copyTo("/file-copy"));
+
+  radosfs::File copy(&radosFs, "/file-copy");
+
+  ASSERT_TRUE(copy.exists());
+
+  struct stat buff;
+  ASSERT_EQ(0, copy.stat(&buff));
+
+  EXPECT_EQ(fileSize, buff.st_size);
+
+  // The copy has its own inode with the same contents
+
+  Stat fileStat, copyStat;
+  ASSERT_EQ(0, radosFsPriv()->stat(file.path(), &fileStat));
+  ASSERT_EQ(0, radosFsPriv()->stat(copy.path(), &copyStat));
+
+  EXPECT_NE(fileStat.translatedPath, copyStat.translatedPath);
+
+  char *contents = new char[fileSize];
+  char *copyContents = new char[fileSize];
+
+  ASSERT_EQ(fileSize, file.read(contents, 0, fileSize));
+  ASSERT_EQ(fileSize, copy.read(copyContents, 0, fileSize));
+
+  EXPECT_EQ(0, memcmp(contents, copyContents, fileSize));
+
+  delete[] contents;
+  delete[] copyContents;
+
+  testFileInodeBackLink(copy.path());
+
+  // The copy hands back the lock it took, so writing to the original right
+  // away does not wait for it to be unlocked as idle
+
+  const boost::chrono::steady_clock::time_point writeStart =
+      boost::chrono::steady_clock::now();
+
+  ASSERT_EQ(0, file.writeSync(chunkContents.c_str(), inlineBufferSize,
+                              chunkSize));
+
+  boost::chrono::duration<double> writeDuration =
+      boost::chrono::steady_clock::now() - writeStart;
+
+  EXPECT_GT(FILE_IDLE_LOCK_TIMEOUT, writeDuration.count());
+
+  // Changing the copy does not change the original
+
+  ASSERT_EQ(0, copy.truncate(inlineBufferSize));
+
+  ASSERT_EQ(0, file.stat(&buff));
+
+  EXPECT_EQ(fileSize, buff.st_size);
+
+  // The destination cannot exist
+
+  EXPECT_EQ(-EEXIST, file.copyTo(copy.path()));
+
+  radosfs::Dir dir(&radosFs, "/dir");
+
+  ASSERT_EQ(0, dir.create());
+
+  EXPECT_EQ(-EISDIR, file.copyTo("/dir"));
+
+  // Copy an inode without any file
+
+  radosfs::FileInode inode(&radosFs, fileStat.pool->name,
+                           fileStat.translatedPath, chunkSize);
+  radosfs::FileInode otherInode(&radosFs, fileStat.pool->name, chunkSize);
+
+  ASSERT_EQ(0, inode.copyTo(otherInode));
+
+  u_int64_t inodeSize;
+  ASSERT_EQ(0, otherInode.getSize(inodeSize));
+
+  EXPECT_EQ(fileSize, inodeSize);
+
+  EXPECT_EQ(-EEXIST, inode.copyTo(otherInode));
+
+  radosfs::FileInode otherChunkSize(&radosFs, fileStat.pool->name,
+                                    chunkSize * 2);
+
+  EXPECT_EQ(-EINVAL, inode.copyTo(otherChunkSize));
+
+  // An empty file can also be copied
+
+  radosfs::File emptyFile(&radosFs, "/empty");
+
+  ASSERT_EQ(0, emptyFile.create());
+  ASSERT_EQ(0, emptyFile.copyTo("empty-copy"));
+
+  radosfs::File emptyCopy(&radosFs, "/empty-copy");
+
+  ASSERT_EQ(0, emptyCopy.stat(&buff));
+
+  EXPECT_EQ(0, buff.st_size);
+}
+
+TEST_F(RadosFsTest, RenameFilesBackLinks)
+{
+  AddPool();
+
+  const int numFiles = 20;
+  std::vector<radosfs::File *> files;
+
+  for (int i = 0; i < numFiles; i++)
+  {
+    std::stringstream stream;
+    stream << "/file" << i;
+
+    radosfs::File *file = new radosfs::File(&radosFs, stream.str());
+    files.push_back(file);
+
+    ASSERT_EQ(0, file->create(-1, "", 0, 0));
+    ASSERT_EQ(0, file->writeSync("x", 0, 1));
+  }
+
+  // Rename the files twice so their queued back links get replaced before
+  // being written
+
+  for (int i = 0; i < numFiles; i++)
+  {
+    ASSERT_EQ(0, files[i]->rename(files[i]->path() + "-renamed"));
+    ASSERT_EQ(0, files[i]->rename(files[i]->path() + "-again"));
+  }
+
+  for (int i = 0; i < numFiles; i++)
+  {
+    Stat stat;
+    ASSERT_EQ(0, radosFsPriv()->stat(files[i]->path(), &stat));
+
+    radosfs::FileInode inode(&radosFs, stat.pool->name, stat.translatedPath);
+
+    std::string backLink;
+    EXPECT_EQ(0, inode.getBackLink(&backLink));
+
+    EXPECT_EQ(files[i]->path(), backLink);
+  }
+
+  // A write after a rename sets the back link together with the size
+
+  radosfs::File *file = files.front();
+
+  ASSERT_EQ(0, file->rename("/file-written"));
+  ASSERT_EQ(0, file->truncate(2));
+
+  EXPECT_FALSE(radosFsPriv()->takeBacklink(
+                 radosFsFilePriv(*file)->inode->name()));
+
+  testFileInodeBackLink(file->path());
+
+  for (int i = 0; i < numFiles; i++)
+    delete files[i];
+}
+
+bool
+checkChunksExistence(librados::IoCtx ioctx, const std::string &baseName,
+                      size_t firstChunk, size_t lastChunk, bool shouldExist)
+{
+  bool checkResult = true;
+  for (size_t i = firstChunk; i <= lastChunk; i++)
+  {
+    std::string chunk = makeFileChunkName(baseName, i);
+
+    if (ioctx.stat(chunk, 0, 0) != 0)
+    {
+      if (shouldExist)
+      {
+        fprintf(stderr, "Error: Chunk %s does not exist!\n", chunk.c_str());
+        checkResult = false;
+      }
+    }
+    else if (!shouldExist)
+    {
+      fprintf(stderr, "Error: Chunk %s exist!\n", chunk.c_str());
+      checkResult = false;
+    }
+  }
+
+  return checkResult;
+}
+
+TEST_F(RadosFsTest, FileOpsMultClientsWriteTruncate)
+{
+    const size_t size = pow(1024, 3);
+    const size_t numChunks = 30;
+    const size_t chunkSize = size / numChunks;
+    char *contents = new char[size];
+    const std::string fileName("/file");
+    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
+                    contents, size, 0, 0);
+    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
+                    0, 0, 0, 0);
+
+    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
+                                                       &c1, &c2);
+
+    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
+    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, 0, true));
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 1, numChunks, false));
+
+    delete file;
+    delete [] contents;
+}
+
+TEST_F(RadosFsTest, FileOpsMultClientsWriteRemove)
+{
+    const size_t size = pow(1024, 3);
+    const size_t numChunks = 30;
+    const size_t chunkSize = size / numChunks;
+    char *contents = new char[size];
+    const std::string fileName("/file");
+    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "write",
+                    contents, size, 0, 0);
+    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
+                    0, 0, 0, 0);
+
+    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
+                                                       &c1, &c2);
+
+    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
+    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+
+    delete file;
+    delete [] contents;
+}
+
+TEST_F(RadosFsTest, FileOpsMultClientsTruncateRemove)
+{
+    const size_t size = pow(1024, 3);
+    const size_t numChunks = 30;
+    const size_t chunkSize = size / numChunks;
+    char *contents = new char[size];
+    const std::string fileName("/file");
+    FsActionInfo c1(0, FS_ACTION_TYPE_FILE, fileName, "truncate",
+                    contents, size, 0, 0);
+    FsActionInfo c2(0, FS_ACTION_TYPE_FILE, fileName, "remove",
+                    0, 0, 0, 0);
+
+    radosfs::File *file = launchFileOpsMultipleClients(chunkSize, fileName,
+                                                       &c1, &c2);
+
+    std::string inode = radosFsFilePriv(*file)->getFileIO()->inode();
+    librados::IoCtx ioctx = radosFsFilePriv(*file)->dataPool->ioctx;
+
+    EXPECT_TRUE(checkChunksExistence(ioctx, inode, 0, numChunks, false));
+
+    delete file;
+    delete [] contents;
+}
+
+TEST_F(RadosFsTest, DirOpsMultipleClients)
+{
+  radosFs.addDataPool(TEST_POOL, "/", 50 * 1024);
+  radosFs.addMetadataPool(TEST_POOL, "/");
+
+  // Create another RadosFs instance to be used as a different client
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL, "/");
+
+  // Create the same directory from both clients
+
+  radosfs::Dir cli1DirInst(&radosFs, "/dir");
+  radosfs::Dir cli2DirInst(&otherClient, "/dir");
+
+  EXPECT_EQ(0, cli1DirInst.create());
+  EXPECT_EQ(-EEXIST, cli2DirInst.create());
+
+  // Launch 10 threads for each client, creating files and dirs in the same
+  // directory
+
+  const int numOps = 10;
+  boost::thread *cli1Threads[numOps], *cli2Threads[numOps];
+  FsActionInfo *cli1ActionInfos[numOps];
+  FsActionInfo *cli2ActionInfos[numOps];
+
+  for (int i = 0; i < numOps; i++)
+  {
+    bool createDir = (i % 2) == 0;
+    FsActionType actionType = FS_ACTION_TYPE_FILE;
+    std::stringstream stream;
+    stream << cli1DirInst.path();
+
+    if (createDir)
+    {
+      stream << "client-1-dir-" << i;
+      actionType = FS_ACTION_TYPE_DIR;
+    }
+    else
+    {
+      stream << "client-1-file-" << i;
+    }
+
+    cli1ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
+                                          "create", "", 0, 0, 0);
+    cli1Threads[i] = new boost::thread(&RadosFsTest::runInThread,
+                                       cli1ActionInfos[i]);
+  }
+
+  for (int i = 0; i < numOps; i++)
+  {
+    bool createDir = (i % 2) != 0;
+    FsActionType actionType = FS_ACTION_TYPE_FILE;
+    std::stringstream stream;
+    stream << cli2DirInst.path();
+
+    if (createDir)
+    {
+      stream << "client-1-dir-" << i;
+      actionType = FS_ACTION_TYPE_DIR;
+    }
+    else
+    {
+      stream << "client-1-file-" << i;
+    }
+
+    cli2ActionInfos[i] = new FsActionInfo(&radosFs, actionType, stream.str(),
+                                          "create", "", 0, 0, 0);
+
+    cli2Threads[i] = new boost::thread(&RadosFsTest::runInThread,
+                                       cli2ActionInfos[i]);
+  }
+
+  for (int i = 0; i < numOps; i++)
+  {
+    cli1Threads[i]->join();
+    cli2Threads[i]->join();
+
+    delete cli1Threads[i];
+    delete cli1ActionInfos[i];
+    delete cli2Threads[i];
+    delete cli2ActionInfos[i];
+  }
+
+  // Verify that both dir instances have the same number of entries
+
+  cli1DirInst.refresh();
+
+  std::set<std::string> entries;
+
+  EXPECT_EQ(0, cli1DirInst.entryList(entries));
+
+  EXPECT_EQ(2 * numOps, entries.size());
+
+  entries.clear();
+  cli2DirInst.refresh();
+
+  EXPECT_EQ(0, cli2DirInst.entryList(entries));
+
+  EXPECT_EQ(2 * numOps, entries.size());
+}
+
+TEST_F(RadosFsTest, StatCluster)
+{
+  AddPool();
+
+  uint64_t total = 0, used = 1, available = 1, numberOfObjects;
+
+  int ret = radosFs.statCluster(&total, &used, &available, &numberOfObjects);
+
+  EXPECT_EQ(0, ret);
+
+  EXPECT_GT(total, used);
+
+  EXPECT_GT(total, available);
+}
+
+TEST_F(RadosFsTest, XAttrs)
+{
+  AddPool();
+
+  // Create a folder for the user
+
+  radosfs::Dir dir(&radosFs, "/user");
+  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
+
+  const std::string &fileName(dir.path() + "file");
+
+  radosFs.setIds(TEST_UID, TEST_GID);
+
+  // Create a file for the xattrs
+
+  radosfs::File file(&radosFs, fileName,
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
+
+  // Get an inexistent
+
+  std::string xAttrValue;
+
+  EXPECT_EQ(-ENODATA, radosFs.getXAttr(fileName, "inexistent", xAttrValue));
+
+  // Set a user attribute
+
+  const std::string attr("usr.attr");
+  const std::string value("value");
+  EXPECT_EQ(0, radosFs.setXAttr(fileName, attr, value));
+
+  testFileInodeBackLink(fileName);
+
+  // Check if the attribute got into the file inode's omap
+
+  Stat stat;
+  ASSERT_EQ(0, radosFsPriv()->stat(fileName, &stat));
+
+  std::map<std::string, librados::bufferlist> omap;
+  std::set<std::string> omapKeys;
+
+  omapKeys.insert(attr);
+  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
+                                              &omap));
+
+  ASSERT_TRUE(omap.find(attr) != omap.end());
+
+  // Get the attribute set above
+
+  std::string xAttrValue1;
+
+  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
+
+  // Verify that using the xattr with or without the "usr." prefix is the same
+
+  EXPECT_EQ(xAttrValue.length(), radosFs.getXAttr(fileName, "attr",
+                                                  xAttrValue1));
+
+  EXPECT_EQ(xAttrValue, xAttrValue1);
+
+  // Check the attribtue's value
+
+  EXPECT_EQ(value, xAttrValue);
+
+  // Change to another user
+
+  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+
+  // Set an xattr by an unauthorized user
+
+  EXPECT_EQ(-EACCES, radosFs.setXAttr(fileName, attr, value));
+
+  // Get an xattr by a user who can only read
+
+  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
+
+  // Check the attribute's value
+
+  EXPECT_EQ(value, xAttrValue);
+
+  // Remove an xattr by an unauthorized user
+
+  EXPECT_EQ(-EACCES, radosFs.removeXAttr(fileName, attr));
+
+  // Get the xattrs map
+
+  std::map<std::string, std::string> map;
+
+  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
+
+  // Check the xattrs map's size
+
+  EXPECT_EQ(1, map.size());
+
+  // Switch to the root user
+
+  radosFs.setIds(ROOT_UID, ROOT_UID);
+
+  map.clear();
+
+  // Set an xattr -- when being root -- in a different user's file
+
+  EXPECT_EQ(0, radosFs.setXAttr(fileName, "sys.attribute", "check"));
+
+  // Get the xattrs map
+
+  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
+
+  // Check the xattrs map's size
+
+  EXPECT_EQ(2, map.size());
+
+  // Check the xattrs map's value
+
+  EXPECT_EQ(map[attr], value);
+
+  // Set an attribute in a directory
+
+  const std::string dirAttr("usr.dir-attr");
+  EXPECT_EQ(0, radosFs.setXAttr(dir.path(), dirAttr, "check"));
+
+  // Check if the attribute got into the dir inode's omap
+
+  stat.reset();
+  ASSERT_EQ(0, radosFsPriv()->stat(dir.path(), &stat));
+
+  omap.clear();
+  omapKeys.clear();
+
+  omapKeys.insert(dirAttr);
+  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
+                                              &omap));
+
+  ASSERT_TRUE(omap.find(dirAttr) != omap.end());
+}
+
+TEST_F(RadosFsTest, XAttrsInInfo)
+{
+  AddPool();
+
+  radosfs::Dir dir(&radosFs, "/user");
+
+  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH),
+                          false, TEST_UID, TEST_GID));
+
+  testXAttrInFsInfo(dir);
+
+  radosFs.setIds(TEST_UID, TEST_GID);
+
+  // Create a file for the xattrs
+
+  radosfs::File file(&radosFs, dir.path() + "file",
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
+
+  testXAttrInFsInfo(file);
+}
+
+TEST_F(RadosFsTest, DirCacheEntryIndex)
+{
+  radosfs::DirEntryIndex index;
+
+  // Entries added in a batch are found right away but only sorted once
+  // committed
+
+  index.insert("c");
+  index.insert("a");
+  radosfs::DirEntryIndex::Entry *entry = index.insert("b");
+  index.setMetadata(entry, "key", "value");
+
+  EXPECT_EQ(3, index.size());
+  EXPECT_TRUE(index.find("a") != 0);
+  EXPECT_TRUE(index.find("d") == 0);
+
+  index.commit();
+
+  ASSERT_EQ(3, index.size());
+  EXPECT_EQ("a", index.name(0));
+  EXPECT_EQ("b", index.name(1));
+  EXPECT_EQ("c", index.name(2));
+
+  EXPECT_TRUE(index.metadata(0) == 0);
+  ASSERT_TRUE(index.metadata(1) != 0);
+  EXPECT_EQ("value", index.metadata(1)->find("key")->second);
+
+  EXPECT_EQ(1, index.upperBound("a"));
+  EXPECT_EQ(0, index.upperBound(""));
+  EXPECT_EQ(3, index.upperBound("c"));
+
+  // A copy is independent from the original
+
+  radosfs::DirEntryIndex copy(index);
+
+  index.erase(index.find("b"));
+  index.insert("bb");
+
+  EXPECT_TRUE(index.find("b") == 0);
+
+  index.commit();
+
+  ASSERT_EQ(3, index.size());
+  EXPECT_EQ("bb", index.name(1));
+  EXPECT_TRUE(index.metadata(1) == 0);
+
+  ASSERT_EQ(3, copy.size());
+  EXPECT_EQ("b", copy.name(1));
+  ASSERT_TRUE(copy.metadata(1) != 0);
+
+  // Entries removed and added again in the same batch are kept
+
+  index.erase(index.find("a"));
+  index.insert("a");
+  index.insert("d");
+  index.erase(index.find("d"));
+  index.commit();
+
+  ASSERT_EQ(3, index.size());
+  EXPECT_EQ("a", index.name(0));
+  EXPECT_TRUE(index.find("d") == 0);
+
+  // Removing metadata frees it
+
+  entry = index.find("c");
+  index.setMetadata(entry, "key", "value");
+
+  const size_t sizeWithMetadata = index.approximateSize();
+
+  index.removeMetadata(index.find("c"), "key");
+
+  EXPECT_TRUE(index.find("c")->metadata == 0);
+  EXPECT_LT(index.approximateSize(), sizeWithMetadata);
+
+  // The names of the removed entries are released when most of them are gone
+
+  const int numEntries = 1000;
+
+  for (int i = 0; i < numEntries; i++)
+  {
+    std::stringstream stream;
+    stream << "entry-with-a-long-name-" << i;
+    index.insert(stream.str());
+  }
+
+  index.commit();
+
+  const size_t fullSize = index.approximateSize();
+
+  for (int i = 0; i < numEntries; i++)
+  {
+    std::stringstream stream;
+    stream << "entry-with-a-long-name-" << i;
+    index.erase(index.find(stream.str()));
+  }
+
+  index.commit();
+
+  EXPECT_EQ(3, index.size());
+  EXPECT_LT(index.approximateSize(), fullSize / 2);
+}
+
+TEST_F(RadosFsTest, DirCache)
+{
+  AddPool();
+
+  const size_t maxBytes = DIR_CACHE_NUM_SHARDS * MEGABYTE_CONVERSION;
+
+  // Set a maximum size (in entries) and memory for the cache and verify
+
+  EXPECT_EQ(DEFAULT_DIR_CACHE_MAX_SIZE, radosFs.dirCacheMaxSize());
+  EXPECT_EQ(DEFAULT_DIR_CACHE_MAX_BYTES, radosFs.dirCacheMaxBytes());
+
+  const size_t maxSize = DIR_CACHE_NUM_SHARDS * 100;
+  radosFs.setDirCacheMaxSize(maxSize);
+  radosFs.setDirCacheMaxBytes(maxBytes);
+
+  EXPECT_EQ(maxSize, radosFs.dirCacheMaxSize());
+  EXPECT_EQ(maxBytes, radosFs.dirCacheMaxBytes());
+
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
+  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+
+  // Instantiate a dir and check that the cache stays the same
+
+  radosfs::Dir dir(&radosFs, "/dir");
+
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
+
+  // Create that dir and check that it gets cached
+
+  EXPECT_EQ(0, dir.create());
+
+  EXPECT_EQ(1, radosFsPriv()->dirCache.numDirs());
+
+  const std::string dirInode = radosFsDirPriv(dir)->fsStat()->translatedPath;
+
+  EXPECT_TRUE(radosFsPriv()->dirCache.contains(dirInode));
+
+  // Instantiate another dir from the one before and verify the cache
+  // stays the same
+
+  radosfs::Dir otherDir(dir);
+
+  EXPECT_EQ(1, radosFsPriv()->dirCache.numDirs());
+
+  // Change the path and verify the new dir gets cached
+
+  otherDir.setPath("/dir1");
+  otherDir.create();
+
+  EXPECT_EQ(2, radosFsPriv()->dirCache.numDirs());
+
+  EXPECT_TRUE(radosFsPriv()->dirCache.contains(
+                radosFsDirPriv(otherDir)->fsStat()->translatedPath));
+
+  // Create a sub directory and verify that it gets cached
+
+  radosfs::Dir subdir(&radosFs, "/dir/subdir");
+  EXPECT_EQ(0, subdir.create());
+
+  EXPECT_EQ(3, radosFsPriv()->dirCache.numDirs());
+
+  const std::string subdirInode =
+      radosFsDirPriv(subdir)->fsStat()->translatedPath;
+
+  // Update the parent dir of the one we created and verify that the size of
+  // the cache grows (because now it has an entry)
+
+  const size_t sizeBefore = radosFsPriv()->dirCache.size();
+  const size_t numEntriesBefore = radosFsPriv()->dirCache.numEntries();
+
+  dir.refresh();
+
+  EXPECT_EQ(3, radosFsPriv()->dirCache.numDirs());
+  EXPECT_GT(radosFsPriv()->dirCache.size(), sizeBefore);
+  EXPECT_EQ(numEntriesBefore + 1, radosFsPriv()->dirCache.numEntries());
+
+  const size_t emptyDirSize = radosFsDirPriv(subdir)->dirInfo->approximateSize();
+  const size_t dirSize = radosFsDirPriv(dir)->dirInfo->approximateSize();
+
+  EXPECT_GT(dirSize, emptyDirSize);
+
+  // Change the cache's max size so each shard only holds one dir with no
+  // entries and verify that the dirs that no longer fit are evicted
+
+  radosFs.setDirCacheMaxSize(DIR_CACHE_NUM_SHARDS);
+
+  EXPECT_FALSE(radosFsPriv()->dirCache.contains(dirInode));
+
+  // Do the same with the max memory and verify it also evicts the dirs
+
+  radosFs.setDirCacheMaxSize(maxSize);
+
+  dir.refresh();
+
+  EXPECT_TRUE(radosFsPriv()->dirCache.contains(dirInode));
+
+  radosFs.setDirCacheMaxBytes(DIR_CACHE_NUM_SHARDS * emptyDirSize);
+
+  EXPECT_FALSE(radosFsPriv()->dirCache.contains(dirInode));
+
+  // Update dir with one entry and verify it doesn't get cached
+  // (because it is bigger than the shard's size)
+
+  dir.refresh();
+
+  EXPECT_FALSE(radosFsPriv()->dirCache.contains(dirInode));
+
+  // Update the subdir (with no entries) and verify it is cached
+
+  subdir.refresh();
+
+  EXPECT_TRUE(radosFsPriv()->dirCache.contains(subdirInode));
+
+  // Remove the cached dir and verify it leaves the cache
+
+  subdir.remove();
+
+  EXPECT_FALSE(radosFsPriv()->dirCache.contains(subdirInode));
+
+  // A ridiculously small size cleans the cache
+
+  radosFs.setDirCacheMaxSize(1);
+
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
+  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+
+  // Create an uncacheable dir and verify the cache isn't affected
+
+  radosFs.setDirCacheMaxSize(maxSize);
+  radosFs.setDirCacheMaxBytes(maxBytes);
+
+  radosfs::Dir notCachedDir(&radosFs, "/notcached", false);
+  EXPECT_EQ(0, notCachedDir.create());
+
+  notCachedDir.refresh();
+
+  EXPECT_EQ(0, radosFsPriv()->dirCache.numDirs());
+}
+
+TEST_F(RadosFsTest, CompactDir)
+{
+  AddPool();
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
+
+  // Set a different compact ratio
+  // (and a lower one as well, so it doesn't trigger compaction)
+
+  const float newRatio = 0.01;
+
+  radosFs.setDirCompactRatio(newRatio);
+  EXPECT_EQ(newRatio, radosFs.dirCompactRatio());
+
+  // Create files and remove half of them
+
+  const size_t numFiles = 10;
+
+  createNFiles(numFiles);
+  removeNFiles(numFiles / 2);
+
+  // Check that the size of the object is greater than the original one,
+  // after the dir is updated
+
+  const std::string dirPath("/");
+  struct stat statBefore, statAfter;
+
+  radosFs.stat(dirPath, &statBefore);
+
+  radosfs::Dir dir(&radosFs, dirPath);
+  dir.refresh();
+
+  radosFs.stat(dirPath, &statAfter);
+
+  EXPECT_GT(statBefore.st_size, 0);
+
+  EXPECT_EQ(statAfter.st_size, statBefore.st_size);
+
+  // Get the entries before the compaction
+
+  std::set<std::string> entriesBefore, entriesAfter;
+  dir.entryList(entriesBefore);
+
+  // Instance the same dir from a different client
+
+  radosfs::Dir sameDir(&otherClient, dir.path());
+
+  sameDir.refresh();
+
+  std::set<std::string> otherClientEntries;
+  sameDir.entryList(otherClientEntries);
+
+  // Check that it gets the same number of entries for the same dir
+
+  EXPECT_EQ(entriesBefore.size(), otherClientEntries.size());
+
+  // Set a hight compact ratio so it automatically compacts
+  // when we update the dir
+
+  radosFs.setDirCompactRatio(0.9);
+
+  dir.refresh();
+
+  // Check if it compacted after the update
+
+  radosFs.stat(dirPath, &statAfter);
+
+  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+
+  // Compact it "manually"
+
+  radosFs.setDirCompactRatio(0.01);
+
+  createNFiles(numFiles);
+  removeNFiles(numFiles / 2);
+
+  dir.compact();
+
+  radosFs.stat(dirPath, &statAfter);
+
+  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+
+  // Check the integrity of the entries in the dir, before and after the
+  // compaction
+
+  dir.refresh();
+
+  dir.entryList(entriesAfter);
+
+  EXPECT_EQ(entriesBefore, entriesAfter);
+
+  // Check that the other client's dir instance also gets the same entries
+  // after it had been compacted from a different client
+
+  sameDir.refresh();
+
+  otherClientEntries.clear();
+  sameDir.entryList(otherClientEntries);
+
+  EXPECT_EQ(entriesAfter, otherClientEntries);
+
+  // Compact when metadata exists
+
+  const int totalMetadata(5);
+  const std::string key("mykey"), value("myvalue");
+  std::stringstream fileNameStr;
+  fileNameStr << "file" << (numFiles / 2 + 1);
+
+  for (int i = 0; i < totalMetadata; i++)
+  {
+    std::ostringstream keyStr, valueStr;
+
+    keyStr << key << i;
+    valueStr << value << i;
+
+    EXPECT_EQ(0, dir.setMetadata(fileNameStr.str(),
+                                 keyStr.str(),
+                                 valueStr.str()));
+  }
+
+  radosFs.stat(dirPath, &statBefore);
+
+  dir.compact();
+
+  radosFs.stat(dirPath, &statAfter);
+
+  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+
+  for (int i = 0; i < totalMetadata; i++)
+  {
+    std::string valueSet;
+    std::ostringstream keyStr, valueStr;
+
+    keyStr << key << i;
+    valueStr << value << i;
+
+    EXPECT_EQ(0, dir.getMetadata(fileNameStr.str(), keyStr.str(), valueSet));
+    EXPECT_EQ(valueStr.str(), valueSet);
+  }
+}
+
+TEST_F(RadosFsTest, DirBackgroundCompaction)
+{
+  AddPool();
+
+  EXPECT_FALSE(radosFs.dirBackgroundCompaction());
+  EXPECT_EQ(DEFAULT_DIR_COMPACTIONS_PER_INTERVAL,
+            radosFs.dirCompactionsPerInterval());
+
+  radosFs.setDirCompactionsPerInterval(0);
+  EXPECT_EQ(1, radosFs.dirCompactionsPerInterval());
+
+  radosFs.setDirCompactionsPerInterval(2);
+  EXPECT_EQ(2, radosFs.dirCompactionsPerInterval());
+
+  radosFs.setDirBackgroundCompaction(true);
+  EXPECT_TRUE(radosFs.dirBackgroundCompaction());
+
+  // A ratio that makes the dir need compaction once half of its files are gone
+
+  radosFs.setDirCompactRatio(0.9);
+
+  const size_t numFiles = 10;
+
+  createNFiles(numFiles);
+  removeNFiles(numFiles / 2);
+
+  const std::string dirPath("/");
+  struct stat statBefore, statAfter;
+
+  radosFs.stat(dirPath, &statBefore);
+
+  // Refreshing leaves the compaction to the background
+
+  radosfs::Dir dir(&radosFs, dirPath);
+  dir.refresh();
+
+  std::set<std::string> entriesBefore, entriesAfter;
+  dir.entryList(entriesBefore);
+
+  // Wait for the background compaction
+
+  for (int i = 0; i < 50; i++)
+  {
+    radosFs.stat(dirPath, &statAfter);
+
+    if (statAfter.st_size < statBefore.st_size)
+      break;
+
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  }
+
+  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+
+  // The entries are kept and new ones are still read after the compaction
+
+  createNFiles(numFiles);
+
+  dir.refresh();
+  dir.entryList(entriesAfter);
+
+  EXPECT_EQ(numFiles, entriesAfter.size());
+  EXPECT_EQ(entriesBefore.size(), numFiles / 2);
+}
+
+TEST_F(RadosFsTest, CompactDirBinaryLog)
+{
+  AddPool();
+
+  EXPECT_EQ(DEFAULT_DIR_LOG_BINARY_COMPACTION,
+            radosFs.dirLogBinaryCompaction());
+
+  radosFs.setDirLogBinaryCompaction(true);
+  EXPECT_TRUE(radosFs.dirLogBinaryCompaction());
+
+  // Don't let refresh compact the dir on its own
+
+  radosFs.setDirCompactRatio(0.01);
+
+  const size_t numFiles = 10;
+
+  createNFiles(numFiles);
+  removeNFiles(numFiles / 2);
+
+  radosfs::Dir dir(&radosFs, "/");
+  dir.refresh();
+
+  // Set metadata with characters that the text format needs to escape
+
+  const std::string file("file6");
+  const std::string key("my key\n"), value("my \"value\"");
+
+  EXPECT_EQ(0, dir.setMetadata(file, key, value));
+
+  dir.refresh();
+
+  std::set<std::string> entriesBefore, entriesAfter;
+  dir.entryList(entriesBefore);
+
+  struct stat statBefore, statAfter;
+  radosFs.stat(dir.path(), &statBefore);
+
+  EXPECT_EQ(0, dir.compact());
+
+  radosFs.stat(dir.path(), &statAfter);
+
+  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+
+  // Read the compacted dir from scratch in a different client
+
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
+
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
+
+  radosfs::Dir sameDir(&otherClient, dir.path());
+  sameDir.refresh();
+
+  sameDir.entryList(entriesAfter);
+
+  EXPECT_EQ(entriesBefore, entriesAfter);
+
+  std::string valueSet;
+  EXPECT_EQ(0, sameDir.getMetadata(file, key, valueSet));
+  EXPECT_EQ(value, valueSet);
+
+  // Text records appended after the compaction are read along with the binary
+  // ones
+
+  radosfs::File newFile(&radosFs, "/new-file");
+  EXPECT_EQ(0, newFile.create());
+
+  EXPECT_EQ(0, dir.removeMetadata(file, key));
+
+  radosfs::Dir freshDir(&otherClient, dir.path());
+  freshDir.refresh();
+
+  entriesAfter.clear();
+  freshDir.entryList(entriesAfter);
+
+  entriesBefore.insert("new-file");
+
+  EXPECT_EQ(entriesBefore, entriesAfter);
+  EXPECT_EQ(-ENOENT, freshDir.getMetadata(file, key, valueSet));
+}
+
+TEST_F(RadosFsTest, RenameDir)
+{
+  AddPool();
+
+  std::string originalPath("/my-dir/");
+  std::string path("/moved-dir/");
+  std::string userDirPath("/user-dir/");
+
+  radosfs::Dir dir(&radosFs, originalPath);
+
+  // Rename dir that doesn't exist
+
+  EXPECT_EQ(-ENOENT, dir.rename(path));
+
+  EXPECT_EQ(0, dir.create());
+
+  // Move dir to a path that doesn't exist
+
+  EXPECT_EQ(-ENOENT, dir.rename("/phony/" + path));
+
+  // Create a user directory
+
+  radosfs::Dir userDir(&radosFs, userDirPath);
+
+  EXPECT_EQ(0, userDir.create(-1, false, TEST_UID, TEST_GID));
+
+  radosFs.setIds(TEST_UID, TEST_GID);
+
+  dir.setPath(path);
+
+  // Rename dir without the required permissions
+
+  EXPECT_EQ(-EACCES, userDir.rename(originalPath));
+
+  // Create a dir as user
+
+  originalPath = userDir.path() + "other-dir";
+  path = originalPath + "-moved";
+
+  dir.setPath(originalPath);
+
+  EXPECT_EQ(0, dir.create());
+
+  // Move the dir inside the same parent
+
+  EXPECT_EQ(0, dir.rename(path));
+
+  radosfs::Dir sameDir(&radosFs, path);
+
+  EXPECT_TRUE(sameDir.exists());
+
+  // Rename the dir (owned by the user) as root
+
+  radosFs.setIds(ROOT_UID, ROOT_UID);
+
+  path = "/other-dir-moved";
+
+  EXPECT_EQ(0, sameDir.rename(path));
+
+  dir.setPath(path);
+
+  EXPECT_TRUE(dir.exists());
+
+  // Move the dir to the user's dir
+
+  path = userDir.path() + path;
+
+  EXPECT_EQ(0, dir.rename(path));
+
+  sameDir.setPath(path);
+
+  EXPECT_TRUE(sameDir.exists());
+
+  // Rename the dir to an empty path argument
+
+  EXPECT_EQ(-EINVAL, dir.rename(""));
+
+  // Rename the dir to the same name
+
+  EXPECT_EQ(-EPERM, dir.rename(dir.path()));
+
+  EXPECT_EQ(-EPERM, dir.rename(dir.path() + "/other"));
+
+  // Create a file in the user dir to see if it is moved
+
+  dir.setPath(userDirPath);
+
+  std::string fileName = "my-file";
+  radosfs::File file(&radosFs, dir.path() + fileName);
+
+  EXPECT_EQ(0, file.create());
+
+  // Rename the user dir to a different name
+
+  userDirPath = "/moved-user-dir";
+
+  EXPECT_EQ(0, dir.rename(userDirPath));
+
+  // Check that the subdir of the user dir no longer exists (it was moved)
+
+  sameDir.refresh();
+
+  EXPECT_FALSE(sameDir.exists());
+
+  // Check that the new subdir (with the new user dir path as parent) now exists
+
+  sameDir.setPath(userDirPath + "/other-dir-moved");
+
+  EXPECT_TRUE(sameDir.exists());
+
+  // Check that the file in the old user dir no longer exists
+
+  file.refresh();
+
+  EXPECT_FALSE(file.exists());
+
+  // Check that the file in the new user dir exists
+
+  file.setPath(dir.path() + fileName);
+
+  EXPECT_TRUE(file.exists());
+
+  // Rename the dir to a file path
+
+  EXPECT_EQ(-EPERM, dir.rename(file.path()));
+
+  // Rename the dir to an existing dir path
+
+  EXPECT_EQ(-EPERM, sameDir.rename(dir.path()));
+}
+
+TEST_F(RadosFsTest, RenameWithLinks)
+{
+  AddPool();
+
+  std::string dirPath("/dir"), linkPath("/dir-link"), filePath("/file");
+
+  // Create a dir and a link to it
+
+  radosfs::Dir dir(&radosFs, dirPath);
+
+  EXPECT_EQ(0, dir.create());
+
+  EXPECT_EQ(0, dir.createLink(linkPath));
+
+  // Create a file and rename it to a path that includes the dir link
+
+  radosfs::File file(&radosFs, filePath);
+
+  EXPECT_EQ(0, file.create());
+
+  EXPECT_EQ(0, file.rename(linkPath + filePath));
+
+  // Create a dir and rename it to a path that includes the dir link
+
+  EXPECT_EQ(-EPERM, dir.rename(linkPath + "/dir-moved"));
+
+  // Rename the dir to the link path
+
+  EXPECT_EQ(-EPERM, dir.rename(linkPath));
+
+  radosfs::Dir linkDir(&radosFs, linkPath);
+
+  EXPECT_TRUE(linkDir.exists());
+
+  // Rename the file with link path in the name
+
+  EXPECT_EQ(dir.path() + "file", file.path());
+
+  EXPECT_EQ(0, file.rename(linkPath));
+
+  // Verify that the old dir link object is now the file we renamed
+
+  linkDir.refresh();
+
+  EXPECT_TRUE(linkDir.exists());
+
+  EXPECT_FALSE(linkDir.isDir());
+
+  EXPECT_FALSE(linkDir.isLink());
+}
+
+struct RenameProgress
+{
+  size_t calls;
+  size_t movedDirs;
+  size_t foundDirs;
+};
+
+static void
+renameProgressCallback(const std::string &path, size_t movedDirs,
+                       size_t foundDirs, void *arg)
+{
+  RenameProgress *progress = reinterpret_cast<RenameProgress *>(arg);
+
+  progress->calls++;
+  progress->movedDirs = movedDirs;
+  progress->foundDirs = foundDirs;
+}
+
+TEST_F(RadosFsTest, DirTreeRename)
+{
+  AddPool();
+
+  const size_t numDirsPerLevel = 3;
+  const size_t numFilesPerLevel = 2;
+  const ssize_t levels = 3;
+  // The moved dir itself plus 3 + 9 + 27 subdirs
+  const size_t numDirs = 1 + 3 + 9 + 27;
+
+  radosfs::Dir dir(&radosFs, "/tree/");
+
+  EXPECT_EQ(0, dir.create());
+
+  EXPECT_EQ(0, createContentsRecursively(dir.path(), numDirsPerLevel,
+                                         numFilesPerLevel, levels));
+
+  // Move the tree reporting the progress
+
+  RenameProgress progress;
+  progress.calls = 0;
+
+  EXPECT_EQ(0, dir.rename("/moved-tree/", renameProgressCallback, &progress));
+
+  EXPECT_EQ("/moved-tree/", dir.path());
+  EXPECT_EQ(numDirs, progress.calls);
+  EXPECT_EQ(numDirs, progress.movedDirs);
+  EXPECT_EQ(numDirs, progress.foundDirs);
+
+  radosfs::Dir deepDir(&radosFs, "/moved-tree/d2/d1/d0/");
+  radosfs::File deepFile(&radosFs, deepDir.path() + "f1");
+
+  EXPECT_TRUE(deepDir.exists());
+  EXPECT_TRUE(deepFile.exists());
+
+  deepDir.setPath("/tree/d2/d1/d0/");
+
+  EXPECT_FALSE(deepDir.exists());
+  EXPECT_FALSE(radosfs::Dir(&radosFs, "/tree/").exists());
+
+  // Make moving the tree fail halfway with a path object left in the way
+
+  const std::string stalePath("/other-tree/d1/d2/");
+  PoolSP mtdPool = radosFsPriv()->getMetadataPoolFromPath(stalePath);
+
+  ASSERT_EQ(0, mtdPool->ioctx.create(stalePath, true));
+
+  EXPECT_EQ(-EEXIST, dir.rename("/other-tree/"));
+
+  // The old tree is intact and nothing but the stale object is left in the new
+  // path
+
+  EXPECT_EQ("/moved-tree/", dir.path());
+  EXPECT_TRUE(radosfs::Dir(&radosFs, "/moved-tree/d1/d2/d0/").exists());
+  EXPECT_FALSE(radosfs::Dir(&radosFs, "/other-tree/").exists());
+  EXPECT_FALSE(radosfs::Dir(&radosFs, "/other-tree/d0/").exists());
+
+  std::set<std::string> entries;
+  radosfs::Dir root(&radosFs, "/");
+
+  EXPECT_EQ(0, root.entryList(entries));
+  EXPECT_EQ(1, entries.count("moved-tree/"));
+  EXPECT_EQ(0, entries.count("other-tree/"));
+
+  // Once the stale object is gone, the rename can be retried
+
+  ASSERT_EQ(0, mtdPool->ioctx.remove(stalePath));
+
+  EXPECT_EQ(0, dir.rename("/other-tree/"));
+
+  EXPECT_TRUE(radosfs::Dir(&radosFs, "/other-tree/d1/d2/d0/").exists());
+  EXPECT_FALSE(radosfs::Dir(&radosFs, "/moved-tree/").exists());
+}
+
+TEST_F(RadosFsTest, DirRemoveRecursive)
+{
+  AddPool();
+
+  // The removed dir itself plus 3 + 9 + 27 subdirs, and 2 files in every dir
+  // but the deepest ones
+  const size_t numDirs = 1 + 3 + 9 + 27;
+  const size_t numFiles = 2 * (1 + 3 + 9);
+
+  radosfs::Dir dir(&radosFs, "/tree/");
+  std::string opId;
+
+  // Removing a dir that does not exist
+
+  EXPECT_EQ(0, dir.removeRecursive(&opId));
+  EXPECT_EQ(-ENOENT, radosFs.sync(opId));
+
+  EXPECT_EQ(0, dir.create());
+
+  EXPECT_EQ(0, createContentsRecursively(dir.path(), 3, 2, 3));
+
+  // Give one of the files data in its inode, and link to another one
+
+  Stat fileStat;
+
+  {
+    radosfs::File file(&radosFs, "/tree/d1/d2/f0");
+
+    EXPECT_EQ(0, file.remove());
+    EXPECT_EQ(0, file.create(-1, "", 0, 0));
+    EXPECT_EQ(0, file.write("data", 0, 4));
+    EXPECT_EQ(0, file.sync());
+  }
+
+  EXPECT_EQ(0, radosFsPriv()->stat("/tree/d1/d2/f0", &fileStat));
+  EXPECT_EQ(0, fileStat.pool->ioctx.stat(fileStat.translatedPath, 0, 0));
+
+  radosfs::File file(&radosFs, "/tree/d0/f1");
+
+  EXPECT_EQ(0, file.createLink("/tree/link"));
+
+  // Remove the tree as a user without permissions in its parent
+
+  radosFs.setIds(TEST_UID, TEST_GID);
+
+  EXPECT_EQ(0, dir.removeRecursive(&opId));
+  EXPECT_EQ(-EACCES, radosFs.sync(opId));
+
+  radosFs.setIds(ROOT_UID, ROOT_UID);
+
+  // Remove the tree and follow its progress
+
+  u_int64_t done = 0, total = 0;
+
+  EXPECT_EQ(-ENOENT, radosFs.opProgress("non-existing-op", &done, &total));
+
+  EXPECT_EQ(0, dir.removeRecursive(&opId));
+
+  while (total == 0 || done < total)
+  {
+    ASSERT_EQ(0, radosFs.opProgress(opId, &done, &total));
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  }
+
+  EXPECT_EQ(0, radosFs.sync(opId));
+  EXPECT_EQ(numDirs + numFiles + 1, total);
+
+  EXPECT_FALSE(dir.exists());
+  EXPECT_FALSE(radosfs::Dir(&radosFs, "/tree/d1/d2/d0/").exists());
+  EXPECT_FALSE(radosfs::File(&radosFs, "/tree/d1/d2/f0").exists());
+  EXPECT_EQ(-ENOENT, fileStat.pool->ioctx.stat(fileStat.translatedPath, 0, 0));
+
+  std::set<std::string> entries;
+  radosfs::Dir root(&radosFs, "/");
+
+  EXPECT_EQ(0, root.entryList(entries));
+  EXPECT_EQ(0, entries.count("tree/"));
+
+  // The dir can be created again, empty
+
+  EXPECT_EQ(0, dir.create());
+
+  entries.clear();
+
+  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_TRUE(entries.empty());
+
+  // With a single worker, the removal's walk runs in the worker itself and so
+  // cannot wait for jobs queued behind it
+
+  EXPECT_EQ(0, createContentsRecursively(dir.path(), 2, 1, 2));
+
+  radosFs.setNumGenericWorkers(MIN_NUM_WORKER_THREADS);
+
+  EXPECT_EQ(0, dir.removeRecursive(&opId));
+  EXPECT_EQ(0, radosFs.sync(opId));
+
+  EXPECT_FALSE(dir.exists());
+}
+
+TEST_F(RadosFsTest, Metadata)
+{
+  AddPool();
+
+  const std::string &basePath = "f1";
+
+  radosfs::Dir dir(&radosFs, "/");
+
+  std::string key = "mykey", value = "myvalue";
+
+  // Set metadata on an inexistent file
+
+  EXPECT_EQ(-ENOENT, dir.setMetadata(basePath, key, value));
+
+  // Create the file and check again
+
+  radosfs::File file(&radosFs, "/" + basePath,
+                     radosfs::File::MODE_READ_WRITE);
+
+  file.create();
+
+  EXPECT_EQ(0, dir.setMetadata(basePath, key, value));
+
+  // Verify the value set
+
+  std::string newValue = "";
+
+  EXPECT_EQ(0, dir.getMetadata(basePath, key, newValue));
+
+  EXPECT_EQ(value, newValue);
+
+  // Remove inexistent metadata
+
+  EXPECT_EQ(-ENOENT, dir.removeMetadata(basePath, key + "_fake"));
+
+  // Remove the metadata set before
+
+  EXPECT_EQ(0, dir.removeMetadata(basePath, key));
+
+  // Get the metadata previously removed
+
+  EXPECT_EQ(-ENOENT, dir.getMetadata(basePath, key, newValue));
+
+  // Set metadata with an empty string as key
+
+  EXPECT_EQ(-EINVAL, dir.setMetadata(basePath, "", value));
+
+  // Set metadata with an empty string as value
+
+  EXPECT_EQ(0, dir.setMetadata(basePath, "empty", ""));
+
+  // Set metadata with non-ascii chars and whitespace
+
+  key = "\n acções \n  über \n\n   %%   #  caractères \n \"extraños\" \n%";
+  value = "\n value of " + key + " \n value";
+
+  EXPECT_EQ(0, dir.setMetadata(basePath, key, value));
+
+  EXPECT_EQ(0, dir.getMetadata(basePath, key, newValue));
+
+  EXPECT_EQ(value, newValue);
+
+  // Get the map of metadata
+
+  std::map<std::string, std::string> mtdMap;
+  ASSERT_EQ(0, dir.getMetadataMap(basePath, mtdMap));
+
+  ASSERT_EQ(2, mtdMap.size());
+
+  ASSERT_EQ(1, mtdMap.count(key));
+
+  EXPECT_EQ(value, mtdMap[key]);
+
+  // Get the metadata with an unauthorized user
 
-  EXPECT_GT(total, used);
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  EXPECT_GT(total, available);
+  EXPECT_EQ(-EACCES, dir.setMetadata(basePath, key, value));
 }
 
-TEST_F(RadosFsTest, XAttrs)
+TEST_F(RadosFsTest, DirEntryIndex)
 {
   AddPool();
 
-  // Create a folder for the user
+  radosfs::Dir dir(&radosFs, "/");
 
-  radosfs::Dir dir(&radosFs, "/user");
-  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH), false, TEST_UID, TEST_GID));
+  const size_t numFiles = 20;
+  createNFiles(numFiles);
 
-  const std::string &fileName(dir.path() + "file");
+  dir.refresh();
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  std::set<std::string> entries;
+  EXPECT_EQ(0, dir.entryList(entries));
+  ASSERT_EQ(numFiles, entries.size());
 
-  // Create a file for the xattrs
+  // Entries are accessed by index in sorted order
 
-  radosfs::File file(&radosFs, fileName,
-                     radosfs::File::MODE_READ_WRITE);
+  std::string entry;
+  std::set<std::string>::iterator it;
+  int i = 0;
 
-  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
+  for (it = entries.begin(); it != entries.end(); it++, i++)
+  {
+    EXPECT_EQ(0, dir.entry(i, entry));
+    EXPECT_EQ(*it, entry);
+  }
 
-  // Get an inexistent
+  // Out of range indexes give an empty entry
 
-  std::string xAttrValue;
+  EXPECT_EQ(0, dir.entry(numFiles, entry));
+  EXPECT_EQ("", entry);
 
-  EXPECT_EQ(-ENODATA, radosFs.getXAttr(fileName, "inexistent", xAttrValue));
+  EXPECT_EQ(0, dir.entry(-1, entry));
+  EXPECT_EQ("", entry);
 
-  // Set a user attribute
+  // The indexes follow the changes in the directory
 
-  const std::string attr("usr.attr");
-  const std::string value("value");
-  EXPECT_EQ(0, radosFs.setXAttr(fileName, attr, value));
+  removeNFiles(numFiles / 2);
+  dir.refresh();
 
-  testFileInodeBackLink(fileName);
+  entries.clear();
+  EXPECT_EQ(0, dir.entryList(entries));
+  ASSERT_EQ(numFiles / 2, entries.size());
 
-  // Check if the attribute got into the file inode's omap
+  for (it = entries.begin(), i = 0; it != entries.end(); it++, i++)
+  {
+    EXPECT_EQ(0, dir.entry(i, entry));
+    EXPECT_EQ(*it, entry);
+  }
 
-  Stat stat;
-  ASSERT_EQ(0, radosFsPriv()->stat(fileName, &stat));
+  EXPECT_EQ(0, dir.entry(numFiles / 2, entry));
+  EXPECT_EQ("", entry);
+}
 
-  std::map<std::string, librados::bufferlist> omap;
-  std::set<std::string> omapKeys;
+TEST_F(RadosFsTest, DirInodeCache)
+{
+  AddPool();
 
-  omapKeys.insert(attr);
-  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
-                                              &omap));
+  radosfs::FilesystemPriv *fsPriv = radosFsPriv();
+  Inode inode;
+  const std::string dirPath("/dir/");
 
-  ASSERT_TRUE(omap.find(attr) != omap.end());
+  // Missing directories are not remembered by default
 
-  // Get the attribute set above
+  EXPECT_EQ(0, radosFs.dirInodeNegativeCacheTtl());
 
-  std::string xAttrValue1;
+  fsPriv->dirInodeCache.clear();
 
-  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
+  EXPECT_EQ(-ENOENT, fsPriv->getDirInode(dirPath, inode));
+  EXPECT_EQ(0, fsPriv->dirInodeCache.size());
 
-  // Verify that using the xattr with or without the "usr." prefix is the same
+  // Remember the missing directories and check that creating one of them
+  // clears that information
 
-  EXPECT_EQ(xAttrValue.length(), radosFs.getXAttr(fileName, "attr",
-                                                  xAttrValue1));
+  radosFs.setDirInodeNegativeCacheTtl(60);
 
-  EXPECT_EQ(xAttrValue, xAttrValue1);
+  EXPECT_EQ(-ENOENT, fsPriv->getDirInode(dirPath, inode));
+  EXPECT_EQ(1, fsPriv->dirInodeCache.size());
 
-  // Check the attribtue's value
+  radosfs::Dir dir(&radosFs, dirPath);
+  EXPECT_EQ(0, dir.create());
 
-  EXPECT_EQ(value, xAttrValue);
+  inode = Inode();
+  EXPECT_EQ(0, fsPriv->getDirInode(dirPath, inode));
+  EXPECT_NE("", inode.inode);
 
-  // Change to another user
+  // The negative entries expire
 
-  radosFs.setIds(TEST_UID + 1, TEST_GID + 1);
+  radosFs.setDirInodeNegativeCacheTtl(1);
 
-  // Set an xattr by an unauthorized user
+  const std::string otherDirPath("/other-dir/");
+  EXPECT_EQ(-ENOENT, fsPriv->getDirInode(otherDirPath, inode));
 
-  EXPECT_EQ(-EACCES, radosFs.setXAttr(fileName, attr, value));
+  Stat stat;
+  stat.path = otherDirPath;
+  stat.translatedPath = generateUuid();
+  stat.pool = fsPriv->getMetadataPoolFromPath(otherDirPath);
+  stat.statBuff.st_uid = ROOT_UID;
+  stat.statBuff.st_gid = ROOT_UID;
+  stat.statBuff.st_mode = DEFAULT_MODE_DIR;
 
-  // Get an xattr by a user who can only read
+  // Create the directory behind the cache's back, as another client would
 
-  EXPECT_EQ(value.length(), radosFs.getXAttr(fileName, attr, xAttrValue));
+  ASSERT_EQ(0, createDirAndInode(&stat));
 
-  // Check the attribute's value
+  EXPECT_EQ(-ENOENT, fsPriv->getDirInode(otherDirPath, inode));
 
-  EXPECT_EQ(value, xAttrValue);
+  sleep(1);
 
-  // Remove an xattr by an unauthorized user
+  EXPECT_EQ(0, fsPriv->getDirInode(otherDirPath, inode));
+  EXPECT_EQ(stat.translatedPath, inode.inode);
 
-  EXPECT_EQ(-EACCES, radosFs.removeXAttr(fileName, attr));
+  // Renaming a directory moves its cached inode
 
-  // Get the xattrs map
+  const std::string inodeName = inode.inode;
+  radosfs::Dir otherDir(&radosFs, otherDirPath);
 
-  std::map<std::string, std::string> map;
+  EXPECT_EQ(0, otherDir.rename("/renamed-dir"));
 
-  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
+  inode = Inode();
+  EXPECT_EQ(0, fsPriv->getDirInode("/renamed-dir/", inode));
+  EXPECT_EQ(inodeName, inode.inode);
 
-  // Check the xattrs map's size
+  // The cache does not grow over its maximum number of entries
 
-  EXPECT_EQ(1, map.size());
+  const size_t maxEntries = DIR_INODE_CACHE_NUM_SHARDS;
+  radosFs.setDirInodeCacheMaxEntries(maxEntries);
 
-  // Switch to the root user
+  EXPECT_EQ(maxEntries, radosFs.dirInodeCacheMaxEntries());
+  EXPECT_GE(maxEntries, fsPriv->dirInodeCache.size());
 
-  radosFs.setIds(ROOT_UID, ROOT_UID);
+  for (int i = 0; i < 50; i++)
+  {
+    std::stringstream stream;
+    stream << "/dir-" << i << "/";
 
-  map.clear();
+    radosfs::Dir subDir(&radosFs, stream.str());
 
-  // Set an xattr -- when being root -- in a different user's file
+    EXPECT_EQ(0, subDir.create());
+    EXPECT_EQ(0, fsPriv->getDirInode(subDir.path(), inode));
+  }
 
-  EXPECT_EQ(0, radosFs.setXAttr(fileName, "sys.attribute", "check"));
+  EXPECT_GE(maxEntries, fsPriv->dirInodeCache.size());
 
-  // Get the xattrs map
+  for (int i = 0; i < 50; i++)
+  {
+    std::stringstream stream;
+    stream << "/dir-" << i << "/";
 
-  EXPECT_EQ(0, radosFs.getXAttrsMap(fileName, map));
+    EXPECT_EQ(0, fsPriv->getDirInode(stream.str(), inode));
+  }
+}
 
-  // Check the xattrs map's size
+TEST_F(RadosFsTest, StatCache)
+{
+  AddPool();
 
-  EXPECT_EQ(2, map.size());
+  // The cache is disabled by default
 
-  // Check the xattrs map's value
+  EXPECT_EQ(0, radosFs.statCacheTtl());
 
-  EXPECT_EQ(map[attr], value);
+  radosfs::File file(&radosFs, "/file", radosfs::File::MODE_READ_WRITE);
+  EXPECT_EQ(0, file.create());
 
-  // Set an attribute in a directory
+  struct stat buff;
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
+  EXPECT_EQ(0, radosFs.statCacheHits());
+  EXPECT_EQ(0, radosFs.statCacheMisses());
 
-  const std::string dirAttr("usr.dir-attr");
-  EXPECT_EQ(0, radosFs.setXAttr(dir.path(), dirAttr, "check"));
+  // Enable the cache and check that statting the same path is served from it
 
-  // Check if the attribute got into the dir inode's omap
+  radosFs.setStatCacheTtl(60);
 
-  stat.reset();
-  ASSERT_EQ(0, radosFsPriv()->stat(dir.path(), &stat));
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
 
-  omap.clear();
-  omapKeys.clear();
+  const uint64_t misses = radosFs.statCacheMisses();
+  EXPECT_LT(0, misses);
 
-  omapKeys.insert(dirAttr);
-  ASSERT_EQ(0, stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", UINT_MAX,
-                                              &omap));
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
+  EXPECT_LT(0, radosFs.statCacheHits());
+  EXPECT_EQ(misses, radosFs.statCacheMisses());
 
-  ASSERT_TRUE(omap.find(dirAttr) != omap.end());
-}
+  // Local changes invalidate the cached stats
 
-TEST_F(RadosFsTest, XAttrsInInfo)
-{
-  AddPool();
+  EXPECT_EQ(0, file.chmod(S_IRUSR | S_IWUSR));
+  EXPECT_EQ(0, radosFs.stat(file.path(), &buff));
+  EXPECT_EQ(S_IFREG | S_IRUSR | S_IWUSR, buff.st_mode);
 
-  radosfs::Dir dir(&radosFs, "/user");
+  EXPECT_EQ(0, file.rename("/renamed-file"));
+  EXPECT_EQ(-ENOENT, radosFs.stat("/file", &buff));
+  EXPECT_EQ(0, radosFs.stat("/renamed-file", &buff));
 
-  EXPECT_EQ(0, dir.create((S_IRWXU | S_IRGRP | S_IROTH),
-                          false, TEST_UID, TEST_GID));
+  EXPECT_EQ(0, file.remove());
+  EXPECT_EQ(-ENOENT, radosFs.stat("/renamed-file", &buff));
 
-  testXAttrInFsInfo(dir);
+  // Renaming a directory invalidates the stats of its contents
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  radosfs::Dir dir(&radosFs, "/dir/");
+  EXPECT_EQ(0, dir.create());
 
-  // Create a file for the xattrs
+  radosfs::File otherFile(&radosFs, "/dir/file",
+                          radosfs::File::MODE_READ_WRITE);
+  EXPECT_EQ(0, otherFile.create());
 
-  radosfs::File file(&radosFs, dir.path() + "file",
-                     radosfs::File::MODE_READ_WRITE);
+  EXPECT_EQ(0, radosFs.stat(otherFile.path(), &buff));
+  EXPECT_EQ(0, dir.rename("/other-dir"));
+  EXPECT_EQ(-ENOENT, radosFs.stat("/dir/file", &buff));
+  EXPECT_EQ(0, radosFs.stat("/other-dir/file", &buff));
 
-  EXPECT_EQ(0, file.create((S_IRWXU | S_IRGRP | S_IROTH)));
+  // The cache does not grow over its maximum number of entries
 
-  testXAttrInFsInfo(file);
+  radosFs.setStatCacheMaxEntries(1);
+  EXPECT_EQ(1, radosFs.statCacheMaxEntries());
+  EXPECT_GE(1, radosFsPriv()->statCache.size());
+
+  // Disabling the cache drops the cached stats
+
+  radosFs.setStatCacheTtl(0);
+  EXPECT_EQ(0, radosFsPriv()->statCache.size());
 }
 
-TEST_F(RadosFsTest, DirCache)
+TEST_F(RadosFsTest, AsyncMetadataOps)
 {
   AddPool();
 
-  const size_t maxSize = 4;
-
-  // Set a maximum size for the cache and verify
+  // Unknown ops
 
-  radosFs.setDirCacheMaxSize(maxSize);
-
-  EXPECT_EQ(maxSize, radosFs.dirCacheMaxSize());
-
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  EXPECT_EQ(-ENOENT, radosFs.sync("non-existing-op"));
+  EXPECT_EQ(-ENOENT, radosFs.pollOp("non-existing-op"));
+  EXPECT_EQ(0, radosFs.sync());
 
-  // Instantiate a dir and check that the cache size stays the same
+  // Create a dir and several files in it asynchronously
 
-  radosfs::Dir dir(&radosFs, "/dir");
+  radosfs::Dir dir(&radosFs, "/dir/");
+  std::string dirOpId;
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  ASSERT_EQ(0, dir.createAsync(-1, false, -1, -1, &dirOpId));
+  ASSERT_EQ(0, radosFs.sync(dirOpId));
 
-  // Create that dir and check that the cache size increments
+  dir.refresh();
 
-  EXPECT_EQ(0, dir.create());
+  ASSERT_TRUE(dir.exists());
 
-  EXPECT_EQ(1, radosFsPriv()->dirCache.size());
+  const size_t numFiles = 16;
+  std::vector<radosfs::File *> files;
+  std::vector<std::string> opIds;
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we created
+  for (size_t i = 0; i < numFiles; i++)
+  {
+    std::stringstream stream;
+    stream << dir.path() << "file" << i;
 
-  EXPECT_EQ(radosFsDirPriv(dir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+    radosfs::File *file = new radosfs::File(&radosFs, stream.str());
+    std::string opId;
 
-  // Instantiate another dir from the one before and verify the cache
-  // stays the same
+    ASSERT_EQ(0, file->createAsync(-1, "", 0, -1, &opId));
 
-  radosfs::Dir otherDir(dir);
+    files.push_back(file);
+    opIds.push_back(opId);
+  }
 
-  EXPECT_EQ(1, radosFsPriv()->dirCache.size());
+  // Wait for them as they finish
 
-  // Change the path and verify the cache size increments
+  std::set<std::string> pendingOps(opIds.begin(), opIds.end());
 
-  otherDir.setPath("/dir1");
-  otherDir.create();
+  while (!pendingOps.empty())
+  {
+    std::string finishedOpId;
 
-  EXPECT_EQ(2, radosFsPriv()->dirCache.size());
+    ASSERT_EQ(0, radosFs.waitForAnyOp(opIds, &finishedOpId));
+    ASSERT_EQ(1, pendingOps.erase(finishedOpId));
+  }
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we created
+  for (size_t i = 0; i < numFiles; i++)
+  {
+    radosfs::File file(&radosFs, files[i]->path());
+    EXPECT_TRUE(file.exists());
+  }
 
-  EXPECT_EQ(radosFsDirPriv(otherDir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+  // Errors are returned when syncing
 
-  // Create a sub directory and verify that the cache size increments
+  radosfs::File existingFile(&radosFs, files[0]->path());
+  std::string opId;
 
-  radosfs::Dir subdir(&radosFs, "/dir/subdir");
-  EXPECT_EQ(0, subdir.create());
+  ASSERT_EQ(0, existingFile.createAsync(-1, "", 0, -1, &opId));
+  EXPECT_EQ(-EEXIST, radosFs.sync(opId));
 
-  EXPECT_EQ(3, radosFsPriv()->dirCache.size());
+  // Change permissions and rename asynchronously
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we created
+  ASSERT_EQ(0, files[0]->chmodAsync(S_IRWXU, &opId));
+  EXPECT_EQ(0, radosFs.sync(opId));
 
-  EXPECT_EQ(radosFsDirPriv(subdir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+  struct stat buff;
 
-  // Update the parent dir of the one we created and verify
-  // that the cache size increments (because now it has an entry)
+  ASSERT_EQ(0, radosFs.stat(files[0]->path(), &buff));
+  EXPECT_EQ(S_IRWXU, buff.st_mode & ~S_IFMT);
 
-  dir.refresh();
+  const std::string newPath = dir.path() + "renamed";
 
-  EXPECT_EQ(4, radosFsPriv()->dirCache.size());
+  ASSERT_EQ(0, files[1]->renameAsync(newPath, &opId));
+  EXPECT_EQ(0, radosFs.sync(opId));
 
-  // Check that the most recent cached dir has the same inode
-  // as the one we updated
+  EXPECT_EQ(-ENOENT, radosFs.stat(dir.path() + "file1", &buff));
+  EXPECT_EQ(0, radosFs.stat(newPath, &buff));
 
-  EXPECT_EQ(radosFsDirPriv(dir)->fsStat()->translatedPath,
-            radosFsPriv()->dirCache.head->cachePtr->inode());
+  // The calling thread's ids are used by the async ops
 
-  // Change the cache's max size so it allows to hold only one dir
-  // with no entries
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  radosFs.setDirCacheMaxSize(1);
+  radosfs::File userFile(&radosFs, dir.path() + "user-file");
 
-  // Verify that the cache's contents were cleaned due to the
-  // ridiculously small size
+  ASSERT_EQ(0, userFile.createAsync(-1, "", 0, -1, &opId));
+  EXPECT_EQ(-EACCES, radosFs.sync(opId));
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  radosFs.setIds(ROOT_UID, ROOT_UID);
 
-  // Update dir with one entry and verify it doesn't get cached
-  // (because the cache size would be greater than the maximum)
+  // An op whose id is not kept is forgotten once its callback is called
 
-  dir.refresh();
+  std::string callbackOpId;
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  ASSERT_EQ(0, files[2]->chmodAsync(S_IRWXU, 0, fileReadWriteCallback,
+                                    &callbackOpId));
+  EXPECT_EQ(0, radosFs.sync());
 
-  // Update the subdir (with no entries) and verify the cache
-  // size increments
+  radosfs::OpsManager &metadataOps = radosFsPriv()->metadataOps;
+  size_t numOps = 1;
 
-  subdir.refresh();
+  for (int i = 0; i < 100 && numOps > 0; i++)
+  {
+    {
+      boost::unique_lock<boost::mutex> lock(metadataOps.opsMutex);
+      numOps = metadataOps.mOperations.size();
+    }
 
-  EXPECT_EQ(1, radosFsPriv()->dirCache.size());
+    if (numOps > 0)
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  }
 
-  // Remove the cached dir and verify the cache size decrements
+  EXPECT_EQ(0, numOps);
+  EXPECT_FALSE(callbackOpId.empty());
 
-  subdir.remove();
+  // Remove everything asynchronously
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  for (size_t i = 0; i < numFiles; i++)
+  {
+    files[i]->refresh();
+    ASSERT_EQ(0, files[i]->removeAsync());
+  }
 
-  // Create an uncacheable dir and verify the cache isn't affected
+  EXPECT_EQ(0, radosFs.sync());
 
-  radosFs.setDirCacheMaxSize(100);
+  ASSERT_EQ(0, dir.removeAsync(&opId));
+  EXPECT_EQ(0, radosFs.sync(opId));
 
-  radosfs::Dir notCachedDir(&radosFs, "/notcached", false);
-  EXPECT_EQ(0, notCachedDir.create());
+  dir.refresh();
 
-  notCachedDir.refresh();
+  EXPECT_FALSE(dir.exists());
 
-  EXPECT_EQ(0, radosFsPriv()->dirCache.size());
+  for (size_t i = 0; i < numFiles; i++)
+    delete files[i];
 }
 
-TEST_F(RadosFsTest, CompactDir)
+TEST_F(RadosFsTest, DirBatchCreate)
 {
   AddPool();
 
-  radosfs::Filesystem otherClient;
-  otherClient.init("", conf());
-
-  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
-  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
-
-  // Set a different compact ratio
-  // (and a lower one as well, so it doesn't trigger compaction)
+  radosfs::Dir dir(&radosFs, "/dir/");
+  EXPECT_EQ(0, dir.create());
 
-  const float newRatio = 0.01;
+  const size_t numEntries = 50;
+  std::vector<std::string> files, dirs;
 
-  radosFs.setDirCompactRatio(newRatio);
-  EXPECT_EQ(newRatio, radosFs.dirCompactRatio());
+  for (size_t i = 0; i < numEntries; i++)
+  {
+    std::stringstream stream;
+    stream << "entry-" << i;
 
-  // Create files and remove half of them
+    files.push_back(stream.str() + "-file");
+    dirs.push_back(stream.str() + "-dir");
+  }
 
-  const size_t numFiles = 10;
+  // Invalid names are refused
 
-  createNFiles(numFiles);
-  removeNFiles(numFiles / 2);
+  std::vector<std::string> invalidNames;
+  invalidNames.push_back("sub/file");
 
-  // Check that the size of the object is greater than the original one,
-  // after the dir is updated
+  EXPECT_EQ(-EINVAL, dir.createFiles(invalidNames));
+  EXPECT_EQ(-EINVAL, dir.createDirs(invalidNames));
 
-  const std::string dirPath("/");
-  struct stat statBefore, statAfter;
+  // Create all the files and dirs at once
 
-  radosFs.stat(dirPath, &statBefore);
+  EXPECT_EQ(0, dir.createFiles(files, S_IRWXU));
+  EXPECT_EQ(0, dir.createDirs(dirs));
 
-  radosfs::Dir dir(&radosFs, dirPath);
   dir.refresh();
 
-  radosFs.stat(dirPath, &statAfter);
-
-  EXPECT_GT(statBefore.st_size, 0);
-
-  EXPECT_EQ(statAfter.st_size, statBefore.st_size);
-
-  // Get the entries before the compaction
-
-  std::set<std::string> entriesBefore, entriesAfter;
-  dir.entryList(entriesBefore);
-
-  // Instance the same dir from a different client
-
-  radosfs::Dir sameDir(&otherClient, dir.path());
+  std::set<std::string> entries;
+  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_EQ(numEntries * 2, entries.size());
 
-  sameDir.refresh();
+  for (size_t i = 0; i < numEntries; i++)
+  {
+    radosfs::File file(&radosFs, dir.path() + files[i],
+                       radosfs::File::MODE_READ_WRITE);
 
-  std::set<std::string> otherClientEntries;
-  sameDir.entryList(otherClientEntries);
+    EXPECT_TRUE(file.exists());
+    EXPECT_TRUE(file.isFile());
 
-  // Check that it gets the same number of entries for the same dir
+    struct stat buff;
+    EXPECT_EQ(0, file.stat(&buff));
+    EXPECT_EQ(S_IFREG | S_IRWXU, buff.st_mode);
 
-  EXPECT_EQ(entriesBefore.size(), otherClientEntries.size());
+    radosfs::Dir subDir(&radosFs, dir.path() + dirs[i]);
 
-  // Set a hight compact ratio so it automatically compacts
-  // when we update the dir
+    EXPECT_TRUE(subDir.exists());
+    EXPECT_TRUE(subDir.isDir());
+  }
 
-  radosFs.setDirCompactRatio(0.9);
+  // The created files can be written and read
 
-  dir.refresh();
+  radosfs::File file(&radosFs, dir.path() + files[0],
+                     radosfs::File::MODE_READ_WRITE);
+  const std::string contents("contents");
+  char buff[contents.length() + 1];
 
-  // Check if it compacted after the update
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+  buff[contents.length()] = '\0';
+  EXPECT_EQ(contents, std::string(buff));
 
-  radosFs.stat(dirPath, &statAfter);
+  // Existing or repeated entries make the whole creation fail
 
-  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+  std::vector<std::string> newFiles;
+  newFiles.push_back("new-file");
+  newFiles.push_back(files[0]);
 
-  // Compact it "manually"
+  EXPECT_EQ(-EEXIST, dir.createFiles(newFiles));
+  EXPECT_FALSE(radosfs::File(&radosFs, "/dir/new-file").exists());
 
-  radosFs.setDirCompactRatio(0.01);
+  newFiles.pop_back();
+  newFiles.push_back("new-file");
 
-  createNFiles(numFiles);
-  removeNFiles(numFiles / 2);
+  EXPECT_EQ(-EEXIST, dir.createFiles(newFiles));
+  EXPECT_EQ(-EEXIST, dir.createDirs(dirs));
 
-  dir.compact();
+  // Creating in a directory without write permissions
 
-  radosFs.stat(dirPath, &statAfter);
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+  EXPECT_EQ(-EACCES, dir.createFiles(std::vector<std::string>(1, "other")));
+}
 
-  // Check the integrity of the entries in the dir, before and after the
-  // compaction
+TEST_F(RadosFsTest, DirCacheWatch)
+{
+  AddPool();
 
-  dir.refresh();
+  radosFs.setDirCacheWatch(true);
+  EXPECT_TRUE(radosFs.dirCacheWatch());
 
-  dir.entryList(entriesAfter);
+  // Create another Filesystem instance to be used as a different client
 
-  EXPECT_EQ(entriesBefore, entriesAfter);
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
 
-  // Check that the other client's dir instance also gets the same entries
-  // after it had been compacted from a different client
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL, "/");
+  otherClient.setDirCacheWatch(true);
 
-  sameDir.refresh();
+  radosfs::Dir dir(&radosFs, "/dir");
+  EXPECT_EQ(0, dir.create());
 
-  otherClientEntries.clear();
-  sameDir.entryList(otherClientEntries);
+  EXPECT_TRUE(radosFsDirPriv(dir)->dirInfo->watching());
 
-  EXPECT_EQ(entriesAfter, otherClientEntries);
+  radosfs::File file(&otherClient, "/dir/aa", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, file.create());
 
-  // Compact when metadata exists
+  // Wait for the change to be notified
 
-  const int totalMetadata(5);
-  const std::string key("mykey"), value("myvalue");
-  std::stringstream fileNameStr;
-  fileNameStr << "file" << (numFiles / 2 + 1);
+  std::set<std::string> entries;
 
-  for (int i = 0; i < totalMetadata; i++)
+  for (int i = 0; i < 50 && entries.count("aa") == 0; i++)
   {
-    std::ostringstream keyStr, valueStr;
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
 
-    keyStr << key << i;
-    valueStr << value << i;
-
-    EXPECT_EQ(0, dir.setMetadata(fileNameStr.str(),
-                                 keyStr.str(),
-                                 valueStr.str()));
+    dir.refresh();
+    entries.clear();
+    EXPECT_EQ(0, dir.entryList(entries));
   }
 
-  radosFs.stat(dirPath, &statBefore);
+  EXPECT_EQ(1, entries.count("aa"));
 
-  dir.compact();
+  // Replace the entry with another one with a name of the same length and
+  // compact the dir from the other client, which results in a log with the same
+  // size as the one that was read before, and check that it is noticed
 
-  radosFs.stat(dirPath, &statAfter);
+  radosfs::File otherFile(&otherClient, "/dir/bb", radosfs::File::MODE_WRITE);
+  EXPECT_EQ(0, file.remove());
+  EXPECT_EQ(0, otherFile.create());
 
-  EXPECT_LT(statAfter.st_size, statBefore.st_size);
+  radosfs::Dir otherDir(&otherClient, "/dir");
+  EXPECT_EQ(0, otherDir.compact());
 
-  for (int i = 0; i < totalMetadata; i++)
+  for (int i = 0; i < 50 && entries.count("bb") == 0; i++)
   {
-    std::string valueSet;
-    std::ostringstream keyStr, valueStr;
-
-    keyStr << key << i;
-    valueStr << value << i;
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
 
-    EXPECT_EQ(0, dir.getMetadata(fileNameStr.str(), keyStr.str(), valueSet));
-    EXPECT_EQ(valueStr.str(), valueSet);
+    dir.refresh();
+    entries.clear();
+    EXPECT_EQ(0, dir.entryList(entries));
   }
+
+  EXPECT_EQ(0, entries.count("aa"));
+  EXPECT_EQ(1, entries.count("bb"));
+
+  // Disabling the option unwatches the cached dirs
+
+  radosFs.setDirCacheWatch(false);
+
+  EXPECT_FALSE(radosFsDirPriv(dir)->dirInfo->watching());
 }
 
-TEST_F(RadosFsTest, RenameDir)
+TEST_F(RadosFsTest, DirListing)
 {
   AddPool();
 
-  std::string originalPath("/my-dir/");
-  std::string path("/moved-dir/");
-  std::string userDirPath("/user-dir/");
+  radosfs::DirListing listing;
+  std::vector<std::string> batch;
 
-  radosfs::Dir dir(&radosFs, originalPath);
+  // A listing that was not opened
 
-  // Rename dir that doesn't exist
+  EXPECT_TRUE(listing.atEnd());
+  EXPECT_EQ(-EBADF, listing.next(batch, 10));
 
-  EXPECT_EQ(-ENOENT, dir.rename(path));
+  radosfs::Dir dir(&radosFs, "/");
 
-  EXPECT_EQ(0, dir.create());
+  const size_t numFiles = 10;
+  createNFiles(numFiles);
 
-  // Move dir to a path that doesn't exist
+  dir.refresh();
 
-  EXPECT_EQ(-ENOENT, dir.rename("/phony/" + path));
+  std::set<std::string> entries;
+  EXPECT_EQ(0, dir.entryList(entries));
 
-  // Create a user directory
+  ASSERT_EQ(0, dir.openListing(listing));
+  EXPECT_FALSE(listing.atEnd());
 
-  radosfs::Dir userDir(&radosFs, userDirPath);
+  // Read it in batches
 
-  EXPECT_EQ(0, userDir.create(-1, false, TEST_UID, TEST_GID));
+  const size_t batchSize = 3;
+  int ret;
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  while ((ret = listing.next(batch, batchSize)) > 0)
+    EXPECT_LE(ret, batchSize);
 
-  dir.setPath(path);
+  EXPECT_EQ(0, ret);
+  EXPECT_TRUE(listing.atEnd());
 
-  // Rename dir without the required permissions
+  EXPECT_EQ(entries.size(), batch.size());
+  EXPECT_EQ(entries, std::set<std::string>(batch.begin(), batch.end()));
 
-  EXPECT_EQ(-EACCES, userDir.rename(originalPath));
+  // Batches come in sorted order
 
-  // Create a dir as user
+  for (size_t i = 1; i < batch.size(); i++)
+    EXPECT_LT(batch[i - 1], batch[i]);
 
-  originalPath = userDir.path() + "other-dir";
-  path = originalPath + "-moved";
+  // Entries added while listing do not affect the position of the cursor
 
-  dir.setPath(originalPath);
+  listing.rewind();
+  EXPECT_FALSE(listing.atEnd());
 
-  EXPECT_EQ(0, dir.create());
+  batch.clear();
+  EXPECT_EQ(batchSize, listing.next(batch, batchSize));
 
-  // Move the dir inside the same parent
+  radosfs::File file(&radosFs, "/a-file-before-the-others");
+  EXPECT_EQ(0, file.create());
 
-  EXPECT_EQ(0, dir.rename(path));
+  dir.refresh();
 
-  radosfs::Dir sameDir(&radosFs, path);
+  while (listing.next(batch, batchSize) > 0);
 
-  EXPECT_TRUE(sameDir.exists());
+  EXPECT_EQ(entries.size(), batch.size());
 
-  // Rename the dir (owned by the user) as root
+  // List with the absolute paths
 
-  radosFs.setIds(ROOT_UID, ROOT_UID);
+  radosfs::DirListing absListing;
+  ASSERT_EQ(0, dir.openListing(absListing, true));
 
-  path = "/other-dir-moved";
+  batch.clear();
+  while (absListing.next(batch, batchSize) > 0);
 
-  EXPECT_EQ(0, sameDir.rename(path));
+  entries.clear();
+  EXPECT_EQ(0, dir.entryList(entries, true));
 
-  dir.setPath(path);
+  EXPECT_EQ(entries, std::set<std::string>(batch.begin(), batch.end()));
 
-  EXPECT_TRUE(dir.exists());
+  // Listing a dir that doesn't exist
 
-  // Move the dir to the user's dir
+  radosfs::Dir nonexistentDir(&radosFs, "/nonexistent");
+  EXPECT_EQ(-ENOENT, nonexistentDir.openListing(listing));
+}
 
-  path = userDir.path() + path;
+TEST_F(RadosFsTest, DirListingWithStat)
+{
+  AddPool();
 
-  EXPECT_EQ(0, dir.rename(path));
+  radosfs::Dir dir(&radosFs, "/dir/");
 
-  sameDir.setPath(path);
+  EXPECT_EQ(0, dir.create());
 
-  EXPECT_TRUE(sameDir.exists());
+  const std::string contents("abc");
+  radosfs::File file(&radosFs, dir.path() + "file",
+                     radosfs::File::MODE_READ_WRITE);
 
-  // Rename the dir to an empty path argument
+  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
 
-  EXPECT_EQ(-EINVAL, dir.rename(""));
+  radosfs::File emptyFile(&radosFs, dir.path() + "empty",
+                          radosfs::File::MODE_READ_WRITE);
 
-  // Rename the dir to the same name
+  EXPECT_EQ(0, emptyFile.create());
 
-  EXPECT_EQ(-EPERM, dir.rename(dir.path()));
+  radosfs::Dir subdir(&radosFs, dir.path() + "subdir/");
 
-  EXPECT_EQ(-EPERM, dir.rename(dir.path() + "/other"));
+  EXPECT_EQ(0, subdir.create());
 
-  // Create a file in the user dir to see if it is moved
+  std::map<std::string, struct stat> entries;
 
-  dir.setPath(userDirPath);
+  // A file is not listed
 
-  std::string fileName = "my-file";
-  radosfs::File file(&radosFs, dir.path() + fileName);
+  radosfs::Dir notDir(&radosFs, file.path());
 
-  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(-ENOTDIR, notDir.entryListWithStat(entries));
 
-  // Rename the user dir to a different name
+  dir.refresh();
 
-  userDirPath = "/moved-user-dir";
+  EXPECT_EQ(0, dir.entryListWithStat(entries));
+  ASSERT_EQ(3, entries.size());
 
-  EXPECT_EQ(0, dir.rename(userDirPath));
+  // The stats are the same as the ones from statting each entry
 
-  // Check that the subdir of the user dir no longer exists (it was moved)
+  std::map<std::string, struct stat>::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++)
+  {
+    struct stat buff;
 
-  sameDir.refresh();
+    EXPECT_EQ(0, radosFs.stat(dir.path() + (*it).first, &buff));
+    EXPECT_EQ(buff.st_mode, (*it).second.st_mode);
+    EXPECT_EQ(buff.st_size, (*it).second.st_size);
+    EXPECT_EQ(buff.st_uid, (*it).second.st_uid);
+  }
 
-  EXPECT_FALSE(sameDir.exists());
+  EXPECT_EQ(contents.length(), entries["file"].st_size);
+  EXPECT_EQ(0, entries["empty"].st_size);
+  EXPECT_TRUE(S_ISDIR(entries["subdir/"].st_mode));
+  EXPECT_TRUE(S_ISREG(entries["file"].st_mode));
 
-  // Check that the new subdir (with the new user dir path as parent) now exists
+  // With absolute paths
 
-  sameDir.setPath(userDirPath + "/other-dir-moved");
+  entries.clear();
 
-  EXPECT_TRUE(sameDir.exists());
+  EXPECT_EQ(0, dir.entryListWithStat(entries, true));
+  EXPECT_EQ(1, entries.count(file.path()));
+  EXPECT_EQ(1, entries.count(subdir.path()));
 
-  // Check that the file in the old user dir no longer exists
+  // Entries removed after the refresh are not listed
 
-  file.refresh();
+  EXPECT_EQ(0, emptyFile.remove());
 
-  EXPECT_FALSE(file.exists());
+  entries.clear();
 
-  // Check that the file in the new user dir exists
+  EXPECT_EQ(0, dir.entryListWithStat(entries));
+  EXPECT_EQ(2, entries.size());
+  EXPECT_EQ(0, entries.count("empty"));
+}
 
-  file.setPath(dir.path() + fileName);
+TEST_F(RadosFsTest, DirReadSmallFiles)
+{
+  AddPool();
 
-  EXPECT_TRUE(file.exists());
+  radosFs.setFileChunkSize(64);
 
-  // Rename the dir to a file path
+  radosfs::Dir dir(&radosFs, "/dir/");
 
-  EXPECT_EQ(-EPERM, dir.rename(file.path()));
+  EXPECT_EQ(0, dir.create());
 
-  // Rename the dir to an existing dir path
+  // Create files that fit in their inline buffer, one that does not and one
+  // that cannot be read by other users
 
-  EXPECT_EQ(-EPERM, sameDir.rename(dir.path()));
-}
+  const size_t inlineSize = 16;
+  const std::string smallContents("abc");
+  const std::string bigContents(200, 'x');
 
-TEST_F(RadosFsTest, RenameWithLinks)
-{
-  AddPool();
+  radosfs::File small(&radosFs, dir.path() + "small");
+  radosfs::File empty(&radosFs, dir.path() + "empty");
+  radosfs::File big(&radosFs, dir.path() + "big");
+  radosfs::File priv(&radosFs, dir.path() + "private");
 
-  std::string dirPath("/dir"), linkPath("/dir-link"), filePath("/file");
+  EXPECT_EQ(0, small.create(-1, "", 0, inlineSize));
+  EXPECT_EQ(0, small.writeSync(smallContents.c_str(), 0,
+                               smallContents.length()));
+  EXPECT_EQ(0, empty.create(-1, "", 0, inlineSize));
+  EXPECT_EQ(0, big.create(-1, "", 0, inlineSize));
+  EXPECT_EQ(0, big.writeSync(bigContents.c_str(), 0, bigContents.length()));
+  EXPECT_EQ(0, priv.create(S_IRWXU, "", 0, inlineSize));
+  EXPECT_EQ(0, priv.writeSync(smallContents.c_str(), 0,
+                              smallContents.length()));
 
-  // Create a dir and a link to it
+  std::vector<std::string> names;
+  names.push_back("small");
+  names.push_back("empty");
+  names.push_back("big");
+  names.push_back("nonexistent");
+  names.push_back("private");
 
-  radosfs::Dir dir(&radosFs, dirPath);
+  std::vector<std::string> contents;
+  std::vector<int> retCodes;
 
-  EXPECT_EQ(0, dir.create());
+  // A file cannot be used for reading its entries
 
-  EXPECT_EQ(0, dir.createLink(linkPath));
+  radosfs::Dir notDir(&radosFs, small.path());
 
-  // Create a file and rename it to a path that includes the dir link
+  EXPECT_EQ(-ENOTDIR, notDir.readSmallFiles(names, contents, retCodes));
 
-  radosfs::File file(&radosFs, filePath);
+  // Read all the files at once
 
-  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(0, dir.readSmallFiles(names, contents, retCodes));
 
-  EXPECT_EQ(0, file.rename(linkPath + filePath));
+  ASSERT_EQ(names.size(), contents.size());
+  ASSERT_EQ(names.size(), retCodes.size());
 
-  // Create a dir and rename it to a path that includes the dir link
+  EXPECT_EQ(0, retCodes[0]);
+  EXPECT_EQ(smallContents, contents[0]);
+  EXPECT_EQ(0, retCodes[1]);
+  EXPECT_EQ("", contents[1]);
+  EXPECT_EQ(0, retCodes[2]);
+  EXPECT_EQ(bigContents, contents[2]);
+  EXPECT_EQ(-ENOENT, retCodes[3]);
+  EXPECT_EQ("", contents[3]);
+  EXPECT_EQ(0, retCodes[4]);
+  EXPECT_EQ(smallContents, contents[4]);
 
-  EXPECT_EQ(-EPERM, dir.rename(linkPath + "/dir-moved"));
+  // Files that are not readable by the user are not read
 
-  // Rename the dir to the link path
+  radosFs.setIds(TEST_UID, TEST_GID);
 
-  EXPECT_EQ(-EPERM, dir.rename(linkPath));
+  EXPECT_EQ(0, dir.readSmallFiles(names, contents, retCodes));
 
-  radosfs::Dir linkDir(&radosFs, linkPath);
+  EXPECT_EQ(0, retCodes[0]);
+  EXPECT_EQ(smallContents, contents[0]);
+  EXPECT_EQ(-EACCES, retCodes[4]);
+  EXPECT_EQ("", contents[4]);
+}
 
-  EXPECT_TRUE(linkDir.exists());
+TEST_F(RadosFsTest, DirOmapIndex)
+{
+  AddPool();
 
-  // Rename the file with link path in the name
+  EXPECT_EQ(DEFAULT_DIR_OMAP_INDEX, radosFs.dirOmapIndex());
 
-  EXPECT_EQ(dir.path() + "file", file.path());
+  radosFs.setDirOmapIndex(true);
+  EXPECT_TRUE(radosFs.dirOmapIndex());
 
-  EXPECT_EQ(0, file.rename(linkPath));
+  radosfs::Dir dir(&radosFs, "/omap-dir/");
+  EXPECT_EQ(0, dir.create());
 
-  // Verify that the old dir link object is now the file we renamed
+  // Directories keep the index mode they were created with
 
-  linkDir.refresh();
+  radosFs.setDirOmapIndex(false);
 
-  EXPECT_TRUE(linkDir.exists());
+  const size_t numFiles = 5;
+  std::set<std::string> expectedEntries;
 
-  EXPECT_FALSE(linkDir.isDir());
+  for (size_t i = 0; i < numFiles; i++)
+  {
+    std::ostringstream name;
+    name << "file" << i;
 
-  EXPECT_FALSE(linkDir.isLink());
-}
+    radosfs::File file(&radosFs, dir.path() + name.str());
+    EXPECT_EQ(0, file.create());
 
-TEST_F(RadosFsTest, Metadata)
-{
-  AddPool();
+    expectedEntries.insert(name.str());
+  }
 
-  const std::string &basePath = "f1";
+  radosfs::Dir subDir(&radosFs, dir.path() + "subdir");
+  EXPECT_EQ(0, subDir.create());
 
-  radosfs::Dir dir(&radosFs, "/");
+  expectedEntries.insert("subdir/");
 
-  std::string key = "mykey", value = "myvalue";
+  // Nothing is appended to the dir log
 
-  // Set metadata on an inexistent file
+  struct stat buff;
+  EXPECT_EQ(0, radosFs.stat(dir.path(), &buff));
+  EXPECT_EQ(0, buff.st_size);
 
-  EXPECT_EQ(-ENOENT, dir.setMetadata(basePath, key, value));
+  dir.refresh();
 
-  // Create the file and check again
+  std::set<std::string> entries;
+  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_EQ(expectedEntries, entries);
 
-  radosfs::File file(&radosFs, "/" + basePath,
-                     radosfs::File::MODE_READ_WRITE);
+  // List the entries in pages
 
-  file.create();
+  std::set<std::string> page, pagedEntries;
+  std::string lastEntry("");
+  int numPages = 0;
 
-  EXPECT_EQ(0, dir.setMetadata(basePath, key, value));
+  while (true)
+  {
+    page.clear();
+    int ret = dir.entryList(page, lastEntry, 2);
 
-  // Verify the value set
+    ASSERT_GE(ret, 0);
 
-  std::string newValue = "";
+    if (ret == 0)
+      break;
 
-  EXPECT_EQ(0, dir.getMetadata(basePath, key, newValue));
+    EXPECT_LE(ret, 2);
+    EXPECT_EQ(ret, page.size());
+    EXPECT_GT(*page.begin(), lastEntry);
 
-  EXPECT_EQ(value, newValue);
+    lastEntry = *page.rbegin();
+    pagedEntries.insert(page.begin(), page.end());
+    numPages++;
+  }
 
-  // Remove inexistent metadata
+  EXPECT_EQ(expectedEntries, pagedEntries);
+  EXPECT_EQ((expectedEntries.size() + 1) / 2, numPages);
 
-  EXPECT_EQ(-ENOENT, dir.removeMetadata(basePath, key + "_fake"));
+  std::string entry;
+  EXPECT_EQ(0, dir.entry(0, entry));
+  EXPECT_EQ(*expectedEntries.begin(), entry);
 
-  // Remove the metadata set before
+  // Metadata
 
-  EXPECT_EQ(0, dir.removeMetadata(basePath, key));
+  const std::string key("my key"), value("my value");
 
-  // Get the metadata previously removed
+  EXPECT_EQ(-ENOENT, dir.setMetadata("nonexistent", key, value));
+  EXPECT_EQ(0, dir.setMetadata("file0", key, value));
+  EXPECT_EQ(0, dir.setMetadata("file0", "other", ""));
 
-  EXPECT_EQ(-ENOENT, dir.getMetadata(basePath, key, newValue));
+  std::string valueSet;
+  EXPECT_EQ(0, dir.getMetadata("file0", key, valueSet));
+  EXPECT_EQ(value, valueSet);
 
-  // Set metadata with an empty string as key
+  std::map<std::string, std::string> mtdMap;
+  EXPECT_EQ(0, dir.getMetadataMap("file0", mtdMap));
+  EXPECT_EQ(2, mtdMap.size());
+  EXPECT_EQ(value, mtdMap[key]);
 
-  EXPECT_EQ(-EINVAL, dir.setMetadata(basePath, "", value));
+  EXPECT_EQ(0, dir.removeMetadata("file0", "other"));
+  EXPECT_EQ(-ENOENT, dir.getMetadata("file0", "other", valueSet));
 
-  // Set metadata with an empty string as value
+  // Another client reads the same entries and metadata
 
-  EXPECT_EQ(0, dir.setMetadata(basePath, "empty", ""));
+  radosfs::Filesystem otherClient;
+  otherClient.init("", conf());
 
-  // Set metadata with non-ascii chars and whitespace
+  otherClient.addDataPool(TEST_POOL, "/", 50 * 1024);
+  otherClient.addMetadataPool(TEST_POOL_MTD, "/");
 
-  key = "\n acções \n  über \n\n   %%   #  caractères \n \"extraños\" \n%";
-  value = "\n value of " + key + " \n value";
+  radosfs::Dir sameDir(&otherClient, dir.path());
+  sameDir.refresh();
 
-  EXPECT_EQ(0, dir.setMetadata(basePath, key, value));
+  entries.clear();
+  EXPECT_EQ(0, sameDir.entryList(entries));
+  EXPECT_EQ(expectedEntries, entries);
 
-  EXPECT_EQ(0, dir.getMetadata(basePath, key, newValue));
+  EXPECT_EQ(0, sameDir.getMetadata("file0", key, valueSet));
+  EXPECT_EQ(value, valueSet);
 
-  EXPECT_EQ(value, newValue);
+  // Removing an entry removes its metadata too
 
-  // Get the map of metadata
+  radosfs::File file(&radosFs, dir.path() + "file0");
+  EXPECT_EQ(0, file.remove());
 
-  std::map<std::string, std::string> mtdMap;
-  ASSERT_EQ(0, dir.getMetadataMap(basePath, mtdMap));
+  EXPECT_EQ(-ENOENT, sameDir.getMetadata("file0", key, valueSet));
 
-  ASSERT_EQ(2, mtdMap.size());
+  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(-ENOENT, dir.getMetadata("file0", key, valueSet));
 
-  ASSERT_EQ(1, mtdMap.count(key));
+  // Rename an entry
 
-  EXPECT_EQ(value, mtdMap[key]);
+  EXPECT_EQ(0, file.rename(dir.path() + "renamed"));
 
-  // Get the metadata with an unauthorized user
+  expectedEntries.erase("file0");
+  expectedEntries.insert("renamed");
 
-  radosFs.setIds(TEST_UID, TEST_GID);
+  dir.refresh();
 
-  EXPECT_EQ(-EACCES, dir.setMetadata(basePath, key, value));
+  entries.clear();
+  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_EQ(expectedEntries, entries);
+
+  // The dir is not empty so it cannot be removed
+
+  EXPECT_EQ(-ENOTEMPTY, dir.remove());
+
+  EXPECT_EQ(0, subDir.remove());
+
+  expectedEntries.erase("subdir/");
+
+  dir.refresh();
+
+  entries.clear();
+  EXPECT_EQ(0, dir.entryList(entries));
+  EXPECT_EQ(expectedEntries, entries);
 }
 
 TEST_F(RadosFsTest, LinkDir)
@@ -3757,6 +7049,314 @@ TEST_F(RadosFsTest, Find)
   EXPECT_EQ(1, results.size());
 }
 
+struct FindStreamResults
+{
+  std::set<std::string> paths;
+  size_t stopAfter;
+};
+
+static bool
+findStreamCallback(const std::string &path, void *arg)
+{
+  FindStreamResults *results = reinterpret_cast<FindStreamResults *>(arg);
+  results->paths.insert(path);
+
+  return results->stopAfter == 0 || results->paths.size() < results->stopAfter;
+}
+
+TEST_F(RadosFsTest, FindStreaming)
+{
+  AddPool();
+
+  radosfs::Dir dir(&radosFs, "/");
+
+  const int numDirsPerLevel = 4;
+  const int levels = 3;
+
+  EXPECT_EQ(0, createContentsRecursively("/", numDirsPerLevel,
+                                         numDirsPerLevel / 2, levels));
+
+  dir.refresh();
+
+  FindStreamResults streamed;
+  streamed.stopAfter = 0;
+
+  // A callback is needed
+
+  EXPECT_EQ(-EINVAL, dir.find("name=\"^d.*\"", 0));
+
+  EXPECT_EQ(-EINVAL, dir.find("bogus = something", findStreamCallback,
+                              &streamed));
+
+  // Streaming gives the same results as the regular find
+
+  std::set<std::string> results;
+
+  EXPECT_EQ(0, dir.find("name=\"^d.*\"", results));
+  EXPECT_EQ(0, dir.find("name=\"^d.*\"", findStreamCallback, &streamed));
+
+  EXPECT_EQ(results, streamed.paths);
+
+  // Stop after a maximum number of results
+
+  const size_t maxResults = 5;
+  streamed.paths.clear();
+
+  EXPECT_EQ(0, dir.find("name=\"^d.*\"", findStreamCallback, &streamed,
+                        maxResults));
+
+  EXPECT_EQ(maxResults, streamed.paths.size());
+
+  // Stop from the callback
+
+  streamed.paths.clear();
+  streamed.stopAfter = 1;
+
+  EXPECT_EQ(0, dir.find("name=\"^f.*\"", findStreamCallback, &streamed));
+
+  ASSERT_EQ(1, streamed.paths.size());
+  EXPECT_TRUE(results.count(*streamed.paths.begin()) == 0);
+}
+
+TEST_F(RadosFsTest, FindPlan)
+{
+  // The steps are ordered by their cost and the expressions compiled once
+
+  std::map<radosfs::Finder::FindOptions, radosfs::FinderArg> args;
+  radosfs::FinderArg sizeArg, xattrArg, mtdArg, nameArg;
+
+  sizeArg.valueNum = 0;
+  xattrArg.valueStr = "^x";
+  mtdArg.key = "m";
+  mtdArg.valueStr = "1";
+  mtdArg.options = radosfs::FinderArg::FINDER_OPT_CMP_NUM;
+  nameArg.valueStr = "^f";
+
+  args[static_cast<radosfs::Finder::FindOptions>(radosfs::Finder::FIND_SIZE |
+                                                 radosfs::Finder::FIND_GT)] =
+      sizeArg;
+  args[radosfs::Finder::FIND_XATTR_EQ] = xattrArg;
+  args[radosfs::Finder::FIND_MTD_GE] = mtdArg;
+  args[radosfs::Finder::FIND_NAME_EQ] = nameArg;
+
+  radosfs::FinderPlan plan;
+
+  EXPECT_EQ(-EINVAL,
+            plan.compile(std::map<radosfs::Finder::FindOptions,
+                                  radosfs::FinderArg>()));
+
+  ASSERT_EQ(0, plan.compile(args));
+  ASSERT_EQ(4, plan.steps.size());
+
+  EXPECT_EQ(radosfs::FinderPlan::STEP_COST_NAME, plan.steps[0].cost);
+  EXPECT_EQ(radosfs::FinderPlan::STEP_COST_MTD, plan.steps[1].cost);
+  EXPECT_EQ(radosfs::FinderPlan::STEP_COST_XATTR, plan.steps[2].cost);
+  EXPECT_EQ(radosfs::FinderPlan::STEP_COST_STAT, plan.steps[3].cost);
+
+  EXPECT_TRUE(plan.steps[0].arg.regex.get() != 0);
+  EXPECT_TRUE(plan.steps[1].arg.regex.get() == 0);
+  EXPECT_TRUE(plan.steps[2].arg.regex.get() != 0);
+
+  EXPECT_TRUE(plan.needsStat());
+  EXPECT_EQ(3, plan.firstStatStep());
+
+  // Stat queries are only evaluated for the entries that match the name
+
+  AddPool();
+
+  radosfs::Dir dir(&radosFs, "/dir/");
+
+  EXPECT_EQ(0, dir.create());
+
+  const std::string contents("abc");
+  const int numFiles = 4;
+
+  for (int i = 0; i < numFiles; i++)
+  {
+    std::ostringstream stream;
+    stream << i;
+
+    radosfs::File file(&radosFs, dir.path() + "f" + stream.str(),
+                       radosfs::File::MODE_READ_WRITE);
+
+    EXPECT_EQ(0, file.create());
+
+    if (i % 2 == 0)
+    {
+      EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+    }
+
+    radosfs::File otherFile(&radosFs, dir.path() + "g" + stream.str(),
+                            radosfs::File::MODE_READ_WRITE);
+
+    EXPECT_EQ(0, otherFile.create());
+    EXPECT_EQ(0, otherFile.writeSync(contents.c_str(), 0, contents.length()));
+  }
+
+  dir.refresh();
+
+  std::set<std::string> results;
+
+  EXPECT_EQ(0, dir.find("size > 0 name = '^f'", results));
+
+  EXPECT_EQ(numFiles / 2, results.size());
+  EXPECT_EQ(1, results.count(dir.path() + "f0"));
+  EXPECT_EQ(1, results.count(dir.path() + "f2"));
+
+  results.clear();
+
+  EXPECT_EQ(0, dir.find("size = 0 uid = 0 name = '^f'", results));
+
+  EXPECT_EQ(numFiles / 2, results.size());
+  EXPECT_EQ(1, results.count(dir.path() + "f1"));
+}
+
+TEST_F(RadosFsTest, DirLogQuery)
+{
+  // Replay a log and query it as the object class does
+
+  std::map<std::string, std::string> metadata;
+  librados::bufferlist log;
+
+  metadata["color"] = "red";
+  metadata["size"] = "10";
+  appendDirLogRecord(log, '+', "f0", metadata);
+
+  metadata["color"] = "blue";
+  metadata["size"] = "2";
+  appendDirLogRecord(log, '+', "f1", metadata);
+
+  appendDirLogRecord(log, '+', "f2", std::map<std::string, std::string>());
+  appendDirLogRecord(log, '+', "d0/", std::map<std::string, std::string>());
+  appendDirLogRecord(log, '+', "g0", std::map<std::string, std::string>());
+  appendDirLogRecord(log, '-', "g0", std::map<std::string, std::string>());
+
+  radosfs::DirLogEntries entries;
+
+  ASSERT_TRUE(radosfs::replayDirLog(log.c_str(), log.length(), entries));
+  ASSERT_EQ(4, entries.size());
+  EXPECT_EQ(0, entries.count("g0"));
+  EXPECT_EQ("red", entries["f0"]["color"]);
+
+  std::vector<radosfs::DirLogPredicate> predicates, decodedPredicates;
+  radosfs::DirLogPredicate namePredicate, mtdPredicate;
+
+  namePredicate.type = radosfs::DIR_LOG_PREDICATE_NAME;
+  namePredicate.value = "^f";
+  mtdPredicate.type = radosfs::DIR_LOG_PREDICATE_MTD;
+  mtdPredicate.cmp = radosfs::DIR_LOG_CMP_GT | radosfs::DIR_LOG_CMP_EQ;
+  mtdPredicate.key = "size";
+  mtdPredicate.value = "5";
+  mtdPredicate.numeric = true;
+
+  predicates.push_back(namePredicate);
+  predicates.push_back(mtdPredicate);
+
+  std::string query;
+  radosfs::encodeDirLogQuery(predicates, query);
+
+  ASSERT_TRUE(radosfs::decodeDirLogQuery(query.c_str(), query.length(),
+                                         decodedPredicates));
+  ASSERT_EQ(predicates.size(), decodedPredicates.size());
+  EXPECT_EQ("size", decodedPredicates[1].key);
+  EXPECT_TRUE(decodedPredicates[1].numeric);
+
+  std::vector<std::string> matches, dirs;
+
+  EXPECT_EQ(0, radosfs::runDirLogQuery(entries, decodedPredicates, matches,
+                                       dirs));
+
+  std::string result;
+  radosfs::encodeDirLogQueryResult(matches, dirs, result);
+
+  matches.clear();
+  dirs.clear();
+
+  ASSERT_TRUE(radosfs::decodeDirLogQueryResult(result.c_str(), result.length(),
+                                               matches, dirs));
+
+  ASSERT_EQ(1, matches.size());
+  EXPECT_EQ("f0", matches[0]);
+  ASSERT_EQ(1, dirs.size());
+  EXPECT_EQ("d0/", dirs[0]);
+
+  // The plan converts only the steps that need nothing but the log
+
+  std::map<radosfs::Finder::FindOptions, radosfs::FinderArg> args;
+  radosfs::FinderArg sizeArg, nameArg;
+
+  sizeArg.valueNum = 0;
+  nameArg.valueStr = "^f";
+
+  args[static_cast<radosfs::Finder::FindOptions>(radosfs::Finder::FIND_SIZE |
+                                                 radosfs::Finder::FIND_GT)] =
+      sizeArg;
+  args[radosfs::Finder::FIND_NAME_EQ] = nameArg;
+
+  radosfs::FinderPlan plan;
+
+  ASSERT_EQ(0, plan.compile(args));
+
+  predicates.clear();
+
+  EXPECT_EQ(1, plan.dirLogPredicates(predicates));
+  ASSERT_EQ(1, predicates.size());
+  EXPECT_EQ(radosfs::DIR_LOG_PREDICATE_NAME, predicates[0].type);
+  EXPECT_EQ(radosfs::DIR_LOG_CMP_EQ, predicates[0].cmp);
+
+  // Finding with the option enabled gives the same results (the option is
+  // disabled if the object class is not loaded in the OSDs)
+
+  AddPool();
+
+  radosfs::Dir dir(&radosFs, "/dir/");
+
+  EXPECT_EQ(0, dir.create());
+
+  radosfs::File file(&radosFs, dir.path() + "f0",
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create());
+  EXPECT_EQ(0, dir.setMetadata("f0", "color", "red"));
+
+  radosfs::File otherFile(&radosFs, dir.path() + "g0",
+                          radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, otherFile.create());
+  EXPECT_EQ(0, dir.setMetadata("g0", "color", "blue"));
+
+  radosfs::Dir subdir(&radosFs, dir.path() + "d0/");
+
+  EXPECT_EQ(0, subdir.create());
+
+  radosfs::File subdirFile(&radosFs, subdir.path() + "f1",
+                           radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, subdirFile.create());
+
+  dir.refresh();
+
+  std::set<std::string> results, serverResults;
+
+  EXPECT_FALSE(radosFs.dirServerSideFind());
+
+  EXPECT_EQ(0, dir.find("name = '^f'", results));
+
+  radosFs.setDirServerSideFind(true);
+
+  EXPECT_EQ(0, dir.find("name = '^f'", serverResults));
+
+  EXPECT_EQ(2, results.size());
+  EXPECT_TRUE(results == serverResults);
+
+  results.clear();
+
+  EXPECT_EQ(0, dir.find("mtd.'color' = 'red'", results));
+
+  EXPECT_EQ(1, results.size());
+  EXPECT_EQ(1, results.count(dir.path() + "f0"));
+}
+
 TEST_F(RadosFsTest, PoolAlignment)
 {
   AddPool();
@@ -3853,6 +7453,81 @@ TEST_F(RadosFsTest, PoolAlignment)
   EXPECT_EQ(contentsSize * 2, statBuff.st_size);
 }
 
+TEST_F(RadosFsTest, PoolAlignmentWriteAccumulation)
+{
+  AddPool();
+
+  const size_t alignment(4);
+  const size_t chunkSize(128);
+  const size_t writeSize(8);
+
+  radosFs.setFileChunkSize(chunkSize);
+
+  // The writes are only accumulated if the write-behind buffer is enabled
+
+  radosFs.setFileWriteBehindSize(writeSize);
+
+  radosfs::File file(&radosFs, "/file");
+
+  // Pretend the file is in an aligned pool
+
+  radosFsFilePriv(file)->dataPool->alignment = alignment;
+
+  file.refresh();
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+
+  // Write a whole chunk with small writes and a part of the next chunk
+
+  const size_t contentsSize(chunkSize + chunkSize / 2);
+  std::string contents;
+
+  for (size_t i = 0; i < contentsSize / writeSize; i++)
+  {
+    std::string piece(writeSize, 'a' + (i % 26));
+    contents += piece;
+
+    ASSERT_EQ(0, file.write(piece.c_str(), i * writeSize, writeSize, true));
+  }
+
+  // The partially written chunk should still be kept in memory
+
+  Stat stat;
+
+  EXPECT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+
+  radosfs::FileIO *fileIO = radosFsFilePriv(file)->getFileIO().get();
+  const std::string lastChunkName = makeFileChunkName(stat.translatedPath, 1);
+
+  EXPECT_EQ(-ENOENT, stat.pool->ioctx.stat(lastChunkName, 0, 0));
+
+  struct stat statBuff;
+
+  EXPECT_EQ(0, file.stat(&statBuff));
+
+  EXPECT_EQ(contentsSize, statBuff.st_size);
+
+  // Sync and check the contents and that the chunks have the aligned size
+
+  ASSERT_EQ(0, file.sync());
+
+  u_int64_t size;
+
+  EXPECT_EQ(0, stat.pool->ioctx.stat(lastChunkName, &size, 0));
+
+  EXPECT_EQ(fileIO->chunkSize(), size);
+
+  char readBuff[contentsSize];
+
+  EXPECT_EQ(contentsSize, file.read(readBuff, 0, contentsSize));
+
+  EXPECT_EQ(contents, std::string(readBuff, contentsSize));
+
+  EXPECT_EQ(0, file.stat(&statBuff));
+
+  EXPECT_EQ(contentsSize, statBuff.st_size);
+}
+
 TEST_F(RadosFsTest, DirTimes)
 {
   AddPool();
@@ -4137,6 +7812,60 @@ TEST_F(RadosFsTest, DirTMId)
   EXPECT_NE(tmId1, tmId0);
 }
 
+TEST_F(RadosFsTest, DirTMIdCoalescing)
+{
+  AddPool();
+
+  radosfs::Dir dirB(&radosFs, "/a/b/");
+
+  ASSERT_EQ(0, dirB.create(-1, true));
+
+  radosfs::Dir dirA(&radosFs, "/a/");
+
+  EXPECT_EQ(0, dirA.useTMId(true));
+  EXPECT_EQ(0, dirB.useTMId(true));
+
+  std::string tmIdA, tmIdB;
+
+  // Many changes in the same dir end up in a single TM id, shared by all the
+  // ancestors
+
+  const int numFiles = 50;
+
+  for (int i = 0; i < numFiles; i++)
+  {
+    std::stringstream stream;
+    stream << dirB.path() << "file" << i;
+
+    radosfs::File file(&radosFs, stream.str());
+
+    ASSERT_EQ(0, file.create());
+    ASSERT_EQ(0, file.writeSync("CERN", 0, 4));
+  }
+
+  EXPECT_EQ(0, dirA.getTMId(tmIdA));
+  EXPECT_EQ(0, dirB.getTMId(tmIdB));
+
+  EXPECT_FALSE(tmIdA.empty());
+  EXPECT_EQ(tmIdA, tmIdB);
+
+  // Reading the TM id right after a change already reflects it
+
+  radosfs::File file(&radosFs, dirB.path() + "file0");
+
+  ASSERT_EQ(0, file.truncate(2));
+
+  std::string newTMId;
+
+  EXPECT_EQ(0, dirB.getTMId(newTMId));
+
+  EXPECT_NE(tmIdB, newTMId);
+
+  EXPECT_EQ(0, dirA.getTMId(tmIdA));
+
+  EXPECT_EQ(newTMId, tmIdA);
+}
+
 TEST_F(RadosFsTest, FileTimes)
 {
   AddPool();
@@ -4177,11 +7906,68 @@ TEST_F(RadosFsTest, FileTimes)
 
   ASSERT_EQ(0, file.truncate(4));
 
-  statBuff = newStatBuff;
+  statBuff = newStatBuff;
+
+  ASSERT_EQ(0, file.stat(&newStatBuff));
+
+  EXPECT_LT(statBuff.st_mtim.tv_sec, newStatBuff.st_mtim.tv_sec);
+}
+
+TEST_F(RadosFsTest, FileMtimeWriteBack)
+{
+  AddPool();
+
+  radosfs::File file(&radosFs, "/my-file");
+
+  ASSERT_EQ(0, file.create(-1, "", 0, 0));
+  ASSERT_EQ(0, file.write("X", 0, 1));
+  ASSERT_EQ(0, file.sync());
+
+  Stat stat;
+  librados::bufferlist mtimeXAttr;
+
+  ASSERT_EQ(0, radosFsPriv()->stat(file.path(), &stat));
+  ASSERT_LT(0, stat.pool->ioctx.getxattr(stat.translatedPath, XATTR_MTIME,
+                                         mtimeXAttr));
+
+  const std::string storedMtime(mtimeXAttr.c_str(), mtimeXAttr.length());
+  struct stat statBuff, newStatBuff;
+
+  ASSERT_EQ(0, file.stat(&statBuff));
+
+  // Sleep to affect the tested times
+  sleep(1);
+
+  // The writes do not update the mtime in the inode right away, but the file
+  // already reports it
+
+  for (int i = 0; i < 10; i++)
+    ASSERT_EQ(0, file.write("Y", i, 1));
+
+  mtimeXAttr.clear();
+  ASSERT_LT(0, stat.pool->ioctx.getxattr(stat.translatedPath, XATTR_MTIME,
+                                         mtimeXAttr));
+
+  EXPECT_EQ(storedMtime, std::string(mtimeXAttr.c_str(), mtimeXAttr.length()));
+
+  ASSERT_EQ(0, file.stat(&newStatBuff));
+
+  EXPECT_LT(statBuff.st_mtim.tv_sec, newStatBuff.st_mtim.tv_sec);
+
+  // Syncing the file writes it
+
+  ASSERT_EQ(0, file.sync());
+
+  mtimeXAttr.clear();
+  ASSERT_LT(0, stat.pool->ioctx.getxattr(stat.translatedPath, XATTR_MTIME,
+                                         mtimeXAttr));
 
-  ASSERT_EQ(0, file.stat(&newStatBuff));
+  timespec storedSpec;
+  strToTimespec(std::string(mtimeXAttr.c_str(), mtimeXAttr.length()),
+                &storedSpec);
 
-  EXPECT_LT(statBuff.st_mtim.tv_sec, newStatBuff.st_mtim.tv_sec);
+  EXPECT_EQ(newStatBuff.st_mtim.tv_sec, storedSpec.tv_sec);
+  EXPECT_EQ(newStatBuff.st_mtim.tv_nsec, storedSpec.tv_nsec);
 }
 
 TEST_F(RadosFsTest, ChownFile)
@@ -4566,6 +8352,545 @@ TEST_F(RadosFsTest, Quota)
   EXPECT_EQ(2, exceedingGroups.size());
 }
 
+static int64_t
+storedQuotaSize(radosfs::FilesystemPriv *fsPriv, const std::string &quota,
+                const std::string &key)
+{
+  PoolSP pool = fsPriv->getMtdPoolFromName(TEST_POOL_MTD);
+  std::set<std::string> keys;
+  std::map<std::string, librados::bufferlist> omap;
+
+  keys.insert(key);
+
+  if (pool->ioctx.omap_get_vals_by_keys(quota, keys, &omap) != 0 ||
+      omap.count(key) == 0)
+  {
+    return -1;
+  }
+
+  return atoll(std::string(omap[key].c_str(), omap[key].length()).c_str());
+}
+
+TEST_F(RadosFsTest, QuotaRecursive)
+{
+  AddPool();
+
+  radosfs::Dir dir(&radosFs, "/project/");
+
+  EXPECT_EQ(0, dir.create());
+
+  EXPECT_EQ(0, createContentsRecursively(dir.path(), 3, 1, 3));
+
+  radosfs::Quota quota(&radosFs, TEST_POOL_MTD);
+  radosfs::Quota otherQuota(&radosFs, TEST_POOL_MTD);
+
+  EXPECT_EQ(0, quota.create(MEGABYTE_CONVERSION));
+  EXPECT_EQ(0, otherQuota.create(MEGABYTE_CONVERSION));
+
+  // Add both quotas to the whole tree
+
+  EXPECT_EQ(0, dir.addToQuota(quota, true));
+  EXPECT_EQ(0, dir.addToQuota(otherQuota, true));
+
+  // Adding a quota again changes nothing
+
+  EXPECT_EQ(0, dir.addToQuota(quota, true));
+
+  const char *paths[] = {"/project/", "/project/d0/", "/project/d2/d1/",
+                         "/project/d1/d2/d0/", 0};
+
+  for (int i = 0; paths[i] != 0; i++)
+  {
+    std::vector<radosfs::Quota> quotas;
+    radosfs::Dir subDir(&radosFs, paths[i]);
+
+    EXPECT_EQ(0, subDir.getQuotas(quotas));
+    EXPECT_EQ(2, quotas.size());
+  }
+
+  // Removing one of them keeps the other
+
+  EXPECT_EQ(0, dir.removeFromQuota(quota, true));
+
+  for (int i = 0; paths[i] != 0; i++)
+  {
+    std::vector<radosfs::Quota> quotas;
+    radosfs::Dir subDir(&radosFs, paths[i]);
+
+    EXPECT_EQ(0, subDir.getQuotas(quotas));
+    ASSERT_EQ(1, quotas.size());
+    EXPECT_EQ(otherQuota.name(), quotas[0].name());
+    EXPECT_EQ(otherQuota.pool(), quotas[0].pool());
+  }
+
+  EXPECT_EQ(0, dir.removeFromQuota(otherQuota, true));
+
+  radosfs::Dir deepDir(&radosFs, "/project/d1/d2/d0/");
+
+  EXPECT_FALSE(deepDir.hasQuota());
+}
+
+TEST_F(RadosFsTest, QuotaUpdateInterval)
+{
+  AddPool();
+
+  EXPECT_EQ(0, radosFs.quotaUpdateInterval());
+
+  radosfs::Quota quota(&radosFs, TEST_POOL_MTD);
+
+  ASSERT_EQ(0, quota.create(MEGABYTE_CONVERSION));
+
+  const std::string sizeKey(XATTR_QUOTA_CURRENT_SIZE);
+  std::stringstream stream;
+  stream << XATTR_QUOTA_CURRENT_SIZE_USER_PREFIX << TEST_UID;
+  const std::string userSizeKey(stream.str());
+
+  // The updates are accumulated and not written right away
+
+  radosFs.setQuotaUpdateInterval(2);
+  radosFs.setQuotaUpdateMaxPendingSize(0);
+
+  EXPECT_EQ(2, radosFs.quotaUpdateInterval());
+
+  EXPECT_EQ(0, quota.updateCurrentSize(100));
+  EXPECT_EQ(0, quota.updateCurrentSize(50));
+  EXPECT_EQ(0, quota.updateUserCurrentSize(TEST_UID, 30));
+
+  EXPECT_EQ(1, radosFsPriv()->quotaDeltas.size());
+  EXPECT_NE(150, storedQuotaSize(radosFsPriv(), quota.name(), sizeKey));
+
+  // Loading the quota writes the accumulated sizes first
+
+  EXPECT_EQ(0, quota.update());
+
+  EXPECT_EQ(150, quota.getQuotaSize().current);
+  EXPECT_EQ(0, radosFsPriv()->quotaDeltas.size());
+  EXPECT_EQ(30, storedQuotaSize(radosFsPriv(), quota.name(), userSizeKey));
+
+  // They are written when the interval expires
+
+  EXPECT_EQ(0, quota.updateCurrentSize(-50));
+  EXPECT_EQ(100 + 50,
+            storedQuotaSize(radosFsPriv(), quota.name(), sizeKey));
+
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(2500));
+
+  EXPECT_EQ(100, storedQuotaSize(radosFsPriv(), quota.name(), sizeKey));
+
+  // Or when they reach the maximum pending size
+
+  radosFs.setQuotaUpdateMaxPendingSize(1000);
+
+  EXPECT_EQ(0, quota.updateCurrentSize(500));
+  EXPECT_EQ(100, storedQuotaSize(radosFsPriv(), quota.name(), sizeKey));
+
+  EXPECT_EQ(0, quota.updateCurrentSize(500));
+  EXPECT_EQ(1100, storedQuotaSize(radosFsPriv(), quota.name(), sizeKey));
+
+  // Disabling the interval writes whatever is pending
+
+  EXPECT_EQ(0, quota.updateCurrentSize(1));
+
+  radosFs.setQuotaUpdateInterval(0);
+
+  EXPECT_EQ(1101, storedQuotaSize(radosFsPriv(), quota.name(), sizeKey));
+
+  EXPECT_EQ(0, quota.updateCurrentSize(1));
+  EXPECT_EQ(1102, storedQuotaSize(radosFsPriv(), quota.name(), sizeKey));
+}
+
+TEST_F(RadosFsTest, Metrics)
+{
+  AddPool();
+
+  radosfs::FilesystemMetrics metrics = radosFs.metrics();
+
+  EXPECT_EQ(0, metrics.operations["create"].count);
+  EXPECT_EQ(0, metrics.counters["bytes_written"]);
+
+  // The operations are counted
+
+  radosfs::Dir dir(&radosFs, "/dir/");
+
+  EXPECT_EQ(0, dir.create());
+
+  radosfs::File file(&radosFs, "/dir/file",
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+
+  const std::string contents(1024, 'x');
+  char buff[1024];
+
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+  EXPECT_EQ(contents.length(), file.read(buff, 0, contents.length()));
+
+  struct stat statBuff;
+
+  EXPECT_EQ(0, radosFs.stat("/dir/file", &statBuff));
+  EXPECT_EQ(-ENOENT, radosFs.stat("/nonexistent", &statBuff));
+
+  metrics = radosFs.metrics();
+
+  EXPECT_EQ(2, metrics.operations["create"].count);
+  EXPECT_EQ(0, metrics.operations["create"].errors);
+  EXPECT_LE(1, metrics.operations["write"].count);
+  EXPECT_LE(1, metrics.operations["read"].count);
+  EXPECT_LE(1, metrics.operations["lock"].count);
+  EXPECT_LE(2, metrics.operations["stat"].count);
+  EXPECT_LE(1, metrics.operations["stat"].errors);
+  EXPECT_EQ(contents.length(), metrics.counters["bytes_written"]);
+  EXPECT_EQ(contents.length(), metrics.counters["bytes_read"]);
+  EXPECT_LT(0, metrics.counters["dir_cache_hits"] +
+               metrics.counters["dir_cache_misses"]);
+  EXPECT_LE(1, metrics.counters["file_io_instances"]);
+
+  const radosfs::OpMetrics &statMetrics = metrics.operations["stat"];
+  uint64_t histogramCount = 0;
+
+  for (size_t i = 0; i < statMetrics.latencyHistogram.size(); i++)
+    histogramCount += statMetrics.latencyHistogram[i];
+
+  EXPECT_EQ(statMetrics.count, histogramCount);
+  EXPECT_LE(statMetrics.latencyPercentileUs(50),
+            statMetrics.latencyPercentileUs(99));
+
+  // Operations in other threads are counted as well
+
+  boost::thread thread(boost::bind(&radosfs::Filesystem::stat, &radosFs,
+                                   std::string("/dir/"), &statBuff));
+  thread.join();
+
+  EXPECT_LT(statMetrics.count, radosFs.metrics().operations["stat"].count);
+
+  // Resetting only counts what is done from then on
+
+  radosFs.resetMetrics();
+
+  metrics = radosFs.metrics();
+
+  EXPECT_EQ(0, metrics.operations["stat"].count);
+  EXPECT_EQ(0, metrics.counters["bytes_written"]);
+  EXPECT_LE(1, metrics.counters["file_io_instances"]);
+
+  EXPECT_EQ(0, radosFs.stat("/dir/file", &statBuff));
+
+  EXPECT_LT(0, radosFs.metrics().operations["stat"].count);
+
+  // The metrics can be dumped periodically
+
+  const std::string dumpPath("/tmp/radosfs-test-metrics");
+  remove(dumpPath.c_str());
+
+  EXPECT_EQ(0, radosFs.metricsDumpInterval());
+
+  radosFs.setMetricsDumpPath(dumpPath);
+  radosFs.setMetricsDumpInterval(0.2);
+
+  EXPECT_EQ(dumpPath, radosFs.metricsDumpPath());
+  EXPECT_EQ(0.2, radosFs.metricsDumpInterval());
+
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(500));
+
+  radosFs.setMetricsDumpInterval(0);
+
+  std::ifstream dump(dumpPath.c_str());
+  std::string line;
+
+  ASSERT_TRUE(std::getline(dump, line));
+  EXPECT_NE(std::string::npos, line.find("stat: count="));
+
+  remove(dumpPath.c_str());
+}
+
+TEST_F(RadosFsTest, Tracing)
+{
+  AddPool();
+
+  // Nothing is traced by default
+
+  EXPECT_EQ(0, radosFs.traceSampleRate());
+
+  radosfs::Dir dir(&radosFs, "/dir/");
+
+  EXPECT_EQ(0, dir.create());
+
+  EXPECT_EQ(0, radosFsPriv()->tracer.size());
+
+  // Every operation is traced
+
+  radosFs.setTraceSampleRate(1);
+
+  EXPECT_EQ(1, radosFs.traceSampleRate());
+
+  radosfs::File file(&radosFs, "/dir/file",
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create(-1, "", 0, 0));
+
+  const std::string contents(1024, 'x');
+  std::string opId;
+
+  EXPECT_EQ(0, file.write(contents.c_str(), 0, contents.length(), false, &opId));
+  EXPECT_EQ(0, file.sync(opId));
+
+  struct stat statBuff;
+
+  EXPECT_EQ(0, radosFs.stat("/dir/file", &statBuff));
+
+  EXPECT_LT(0, radosFsPriv()->tracer.size());
+
+  const std::string tracePath("/tmp/radosfs-test-trace.json");
+
+  EXPECT_EQ(0, radosFs.exportTrace(tracePath));
+
+  std::ifstream traceFile(tracePath.c_str());
+  std::stringstream trace;
+  trace << traceFile.rdbuf();
+
+  EXPECT_EQ(0, trace.str().find("{\"traceEvents\":["));
+
+  const char *spans[] = {"create_file", "dir_index", "queued", "lock_wait",
+                         "set_size", "chunk_submit", "aio", "wait", "stat"};
+
+  for (size_t i = 0; i < sizeof(spans) / sizeof(spans[0]); i++)
+  {
+    const std::string name = std::string("\"name\":\"") + spans[i] + "\"";
+    EXPECT_NE(std::string::npos, trace.str().find(name)) << spans[i];
+  }
+
+  // The spans of the write belong to its op
+
+  EXPECT_NE(std::string::npos, trace.str().find("\"op\":\"" + opId + "\""));
+
+  remove(tracePath.c_str());
+
+  // The number of spans kept is limited
+
+  radosFs.setTraceMaxEvents(2);
+
+  EXPECT_EQ(2, radosFs.traceMaxEvents());
+  EXPECT_EQ(2, radosFsPriv()->tracer.size());
+
+  // Disabling the tracing stops recording spans
+
+  radosFs.setTraceSampleRate(0);
+  radosFs.clearTrace();
+
+  EXPECT_EQ(0, radosFs.stat("/dir/file", &statBuff));
+  EXPECT_EQ(0, file.write(contents.c_str(), 0, contents.length(), false, &opId));
+  EXPECT_EQ(0, file.sync(opId));
+
+  EXPECT_EQ(0, radosFsPriv()->tracer.size());
+}
+
+TEST_F(RadosFsTest, OpRecording)
+{
+  AddPool();
+
+  // Nothing is recorded by default
+
+  EXPECT_FALSE(radosFs.recordingOps());
+
+  const std::string recordPath("/tmp/radosfs-test-ops.trace");
+
+  EXPECT_EQ(0, radosFs.startOpRecording(recordPath));
+  EXPECT_TRUE(radosFs.recordingOps());
+
+  // Only one recording at a time
+
+  EXPECT_EQ(-EBUSY, radosFs.startOpRecording(recordPath));
+
+  radosfs::Dir dir(&radosFs, "/dir/");
+
+  EXPECT_EQ(0, dir.create());
+
+  radosfs::File file(&radosFs, "/dir/file",
+                     radosfs::File::MODE_READ_WRITE);
+
+  EXPECT_EQ(0, file.create());
+
+  const std::string contents(1024, 'x');
+
+  EXPECT_EQ(0, file.writeSync(contents.c_str(), 0, contents.length()));
+
+  char buff[1024];
+
+  EXPECT_EQ(contents.length(), file.read(buff, 0, sizeof(buff)));
+
+  struct stat statBuff;
+
+  EXPECT_EQ(0, radosFs.stat("/dir/", &statBuff));
+  EXPECT_EQ(-ENOENT, radosFs.stat("/dir/nonexistent", &statBuff));
+
+  std::set<std::string> entries;
+
+  dir.refresh();
+
+  EXPECT_EQ(0, dir.entryList(entries));
+
+  radosFs.stopOpRecording();
+
+  EXPECT_FALSE(radosFs.recordingOps());
+
+  // Operations are no longer recorded after stopping
+
+  EXPECT_EQ(0, file.truncate(0));
+
+  std::vector<radosfs::OpRecorder::Record> records;
+
+  ASSERT_EQ(0, radosfs::OpRecorder::readRecords(recordPath, records));
+
+  // The stats done on behalf of the other operations are not recorded
+
+  const radosfs::OpRecorder::Op ops[] =
+    {radosfs::OpRecorder::OP_CREATE_DIR, radosfs::OpRecorder::OP_CREATE_FILE,
+     radosfs::OpRecorder::OP_WRITE_SYNC, radosfs::OpRecorder::OP_READ,
+     radosfs::OpRecorder::OP_STAT, radosfs::OpRecorder::OP_STAT,
+     radosfs::OpRecorder::OP_LIST};
+  const size_t numOps = sizeof(ops) / sizeof(ops[0]);
+
+  ASSERT_EQ(numOps, records.size());
+
+  for (size_t i = 0; i < numOps; i++)
+  {
+    EXPECT_EQ(ops[i], records[i].op) << i;
+
+    if (i > 0)
+    {
+      EXPECT_LE(records[i - 1].startUs, records[i].startUs);
+    }
+  }
+
+  // The paths are hashed and the files know their parent dir
+
+  EXPECT_EQ(hash("/dir/file"), records[1].pathHash);
+  EXPECT_EQ(hash("/dir/"), records[1].parentHash);
+  EXPECT_EQ(records[0].pathHash, records[1].parentHash);
+
+  EXPECT_EQ(0, records[2].offset);
+  EXPECT_EQ(contents.length(), records[2].length);
+  EXPECT_EQ(contents.length(), records[3].ret);
+
+  EXPECT_EQ(radosfs::OpRecorder::FLAG_DIR, records[4].flags);
+  EXPECT_EQ(0, records[4].ret);
+  EXPECT_EQ(0, records[5].flags);
+  EXPECT_EQ(-ENOENT, records[5].ret);
+
+  // Files that are not traces are not read
+
+  EXPECT_EQ(-EINVAL, radosfs::OpRecorder::readRecords("/dev/null", records));
+
+  remove(recordPath.c_str());
+}
+
+static void
+writeRepeatedly(radosfs::Filesystem *fs, const std::string &path,
+                int numWrites)
+{
+  radosfs::File file(fs, path, radosfs::File::MODE_READ_WRITE);
+  const std::string contents(128, 'x');
+
+  for (int i = 0; i < numWrites; i++)
+  {
+    std::string opId;
+    EXPECT_EQ(0, file.write(contents.c_str(), 0, contents.length(), false,
+                            &opId));
+    EXPECT_EQ(0, file.sync(opId));
+  }
+}
+
+TEST_F(RadosFsTest, LogCategories)
+{
+  AddPool();
+
+  const radosfs::Filesystem::LogCategory categories[] =
+    {radosfs::Filesystem::LOG_CATEGORY_GENERAL,
+     radosfs::Filesystem::LOG_CATEGORY_LOCKS,
+     radosfs::Filesystem::LOG_CATEGORY_CHUNKS,
+     radosfs::Filesystem::LOG_CATEGORY_DIR_CACHE};
+  const size_t numCategories = sizeof(categories) / sizeof(categories[0]);
+
+  ASSERT_EQ(radosfs::Filesystem::LOG_CATEGORY_COUNT, numCategories);
+
+  // Check the defaults
+
+  for (size_t i = 0; i < numCategories; i++)
+  {
+    EXPECT_FALSE(radosFs.logCategoryEnabled(categories[i]));
+    EXPECT_EQ(0, radosFs.logCategoryRateLimit(categories[i]));
+    EXPECT_EQ(1.0, radosFs.logCategorySampleRate(categories[i]));
+  }
+
+  // Enable a single category and limit how much it logs
+
+  radosFs.setLogCategoryEnabled(radosfs::Filesystem::LOG_CATEGORY_LOCKS, true);
+  radosFs.setLogCategoryRateLimit(radosfs::Filesystem::LOG_CATEGORY_LOCKS, 5);
+
+  EXPECT_TRUE(radosFs.logCategoryEnabled(
+                radosfs::Filesystem::LOG_CATEGORY_LOCKS));
+  EXPECT_FALSE(radosFs.logCategoryEnabled(
+                 radosfs::Filesystem::LOG_CATEGORY_CHUNKS));
+  EXPECT_EQ(5, radosFs.logCategoryRateLimit(
+                 radosfs::Filesystem::LOG_CATEGORY_LOCKS));
+
+  // The sample rate is kept between 0 and 1
+
+  radosFs.setLogCategorySampleRate(radosfs::Filesystem::LOG_CATEGORY_CHUNKS,
+                                   0.5);
+
+  EXPECT_EQ(0.5, radosFs.logCategorySampleRate(
+                   radosfs::Filesystem::LOG_CATEGORY_CHUNKS));
+
+  radosFs.setLogCategorySampleRate(radosfs::Filesystem::LOG_CATEGORY_CHUNKS,
+                                   2);
+
+  EXPECT_EQ(1.0, radosFs.logCategorySampleRate(
+                   radosfs::Filesystem::LOG_CATEGORY_CHUNKS));
+
+  radosFs.setLogCategorySampleRate(radosfs::Filesystem::LOG_CATEGORY_CHUNKS,
+                                   -1);
+
+  EXPECT_EQ(0.0, radosFs.logCategorySampleRate(
+                   radosfs::Filesystem::LOG_CATEGORY_CHUNKS));
+
+  // Log locking messages from several threads, over the rate limit
+
+  radosfs::Dir dir(&radosFs, "/dir/");
+
+  EXPECT_EQ(0, dir.create());
+
+  const int numThreads = 4;
+  boost::thread_group threads;
+
+  for (int i = 0; i < numThreads; i++)
+  {
+    std::stringstream path;
+    path << "/dir/file" << i;
+
+    threads.create_thread(boost::bind(&writeRepeatedly, &radosFs, path.str(),
+                                      10));
+  }
+
+  threads.join_all();
+
+  // Every message that was queued is printed once flushed
+
+  radosfs::Logger::flush();
+
+  // Restore the defaults
+
+  for (size_t i = 0; i < numCategories; i++)
+  {
+    radosFs.setLogCategoryEnabled(categories[i], false);
+    radosFs.setLogCategoryRateLimit(categories[i], 0);
+    radosFs.setLogCategorySampleRate(categories[i], 1);
+  }
+
+  EXPECT_FALSE(radosFs.logCategoryEnabled(
+                 radosfs::Filesystem::LOG_CATEGORY_LOCKS));
+}
+
 GTEST_API_ int
 main(int argc, char **argv)
 {
@@ -17,9 +17,12 @@
  * for more details.
  */
 
+#include <algorithm>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include <rados/librados.hpp>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -31,6 +34,14 @@
 #include "FilesystemPriv.hh"
 
 #define ANIMATION_STEP_TIMEOUT 150 // ms
+#define INODE_SCAN_RANGES_PER_THREAD 4
+#define INODE_SCAN_BATCH_SIZE 1024 // objects
+#define INODE_SCAN_RANGE_DONE "done"
+#define CHECKPOINT_MAGIC "radosfsck-checkpoint"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_SAVE_INTERVAL 30 // seconds
+#define QUOTA_STAT_BATCH_SIZE 1024 // paths
+#define QUOTA_MAX_PENDING_DIRS_PER_THREAD 256
 
 void
 RadosFsChecker::generalWorkerThread(
@@ -73,9 +84,12 @@ RadosFsChecker::RadosFsChecker(radosfs::Filesystem *radosFs, size_t numThreads)
     mAnimationStep(0),
     mAnimationLastUpdate(boost::chrono::system_clock::now()),
     mAnimation("|/-\\"),
+    mNumThreads(std::max(numThreads, (size_t) 1)),
+    mPendingQuotaDirs(0),
     mVerbose(false),
     mFix(false),
-    mDry(false)
+    mDry(false),
+    mIncremental(false)
 {
   while (numThreads-- > 0)
     generalWorkerThreads.create_thread(
@@ -388,6 +402,23 @@ RadosFsChecker::checkDir(std::string path, bool recursive,
     exit(ENOTSUP);
   }
 
+  DirCheckpoint dirCheckpoint;
+  DiagnosticSP dirDiagnostic = diagnostic;
+
+  if (mCheckpoint)
+  {
+    // The entries are changed through the dir's inode object, so if neither
+    // its size nor its mtime changed, neither did the entries
+    stat.pool->ioctx.stat(stat.translatedPath, &dirCheckpoint.logSize,
+                          &dirCheckpoint.mtime);
+
+    if (skipUnchangedDir(path, dirCheckpoint, recursive, diagnostic))
+      return;
+
+    // The dir's issues are collected apart to know whether it had any
+    dirDiagnostic.reset(new Diagnostic);
+  }
+
   radosfs::Dir dir(mRadosFs, path);
 
   dir.refresh();
@@ -402,13 +433,13 @@ RadosFsChecker::checkDir(std::string path, bool recursive,
 
     log(" Error in '%s': %d\n", path.c_str(), ret);
 
-    diagnostic->addDirIssue(issue);
+    dirDiagnostic->addDirIssue(issue);
   }
 
   std::map<std::string, librados::bufferlist> omap;
   stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", "", UINT_MAX, &omap);
 
-  verifyDirObject(stat, omap, diagnostic);
+  verifyDirObject(stat, omap, dirDiagnostic);
 
   std::set<std::string>::iterator it;
   for (it = entries.begin(); it != entries.end(); it++)
@@ -428,7 +459,7 @@ RadosFsChecker::checkDir(std::string path, bool recursive,
       {
         log(" Error in '%s': %d\n", entryPath.c_str(), ret);
 
-        diagnostic->addDirIssue(issue);
+        dirDiagnostic->addDirIssue(issue);
       }
       else
       {
@@ -437,7 +468,7 @@ RadosFsChecker::checkDir(std::string path, bool recursive,
 
         log(" Error in '%s': %d\n", entryPath.c_str(), issue.errorCode);
 
-        diagnostic->addFileIssue(issue);
+        dirDiagnostic->addFileIssue(issue);
       }
 
       continue;
@@ -445,22 +476,74 @@ RadosFsChecker::checkDir(std::string path, bool recursive,
 
     if (S_ISLNK (stat.statBuff.st_mode) || S_ISREG (stat.statBuff.st_mode))
     {
-      ret = verifyFileObject(stat, omap, diagnostic);
+      ret = verifyFileObject(stat, omap, dirDiagnostic);
     }
     else if (recursive)
     {
+      dirCheckpoint.subdirs.push_back(entryPath);
+
       ioService->post(boost::bind(&RadosFsChecker::checkDir, this, entryPath,
                                   recursive, diagnostic));
     }
     else
     {
+      dirCheckpoint.subdirs.push_back(entryPath);
+
       std::map<std::string, librados::bufferlist> omap;
       stat.pool->ioctx.omap_get_vals(stat.translatedPath, "", "", UINT_MAX,
                                      &omap);
 
-      verifyDirObject(stat, omap, diagnostic);
+      verifyDirObject(stat, omap, dirDiagnostic);
+    }
+  }
+
+  if (mCheckpoint)
+  {
+    dirCheckpoint.run = mCheckpoint->run;
+    dirCheckpoint.numIssues = dirDiagnostic->numIssues();
+    mCheckpoint->setDir(path, dirCheckpoint);
+    mCheckpoint->saveIfNeeded();
+
+    diagnostic->merge(*dirDiagnostic);
+  }
+}
+
+bool
+RadosFsChecker::skipUnchangedDir(const std::string &path,
+                                 const DirCheckpoint &current, bool recursive,
+                                 DiagnosticSP diagnostic)
+{
+  DirCheckpoint previous;
+
+  if (!mCheckpoint->getDir(path, &previous))
+    return false;
+
+  // Dirs checked by a previous run are only skipped in incremental mode and
+  // dirs with issues are always checked again so they keep being reported
+  if ((previous.run != mCheckpoint->run && !mIncremental) ||
+      previous.numIssues > 0 || previous.logSize != current.logSize ||
+      previous.mtime != current.mtime)
+  {
+    return false;
+  }
+
+  log("Skipping unchanged dir '%s'\n", path.c_str());
+
+  previous.run = mCheckpoint->run;
+  mCheckpoint->setDir(path, previous);
+
+  // The subdirs may have changed even if the dir did not
+  if (recursive)
+  {
+    std::vector<std::string>::const_iterator it;
+    for (it = previous.subdirs.begin(); it != previous.subdirs.end(); it++)
+    {
+      ioService->post(boost::bind(&RadosFsChecker::checkDir, this, *it,
+                                  recursive, diagnostic));
     }
   }
+
+  return true;
 }
 
 void
@@ -616,8 +699,21 @@ RadosFsChecker::checkInode(PoolSP pool, std::string inode,
   if (nameIsChunk(inode))
   {
     std::string baseInode = getBaseInode(inode);
+    bool baseFound = pool->ioctx.stat(baseInode, 0, 0) == 0;
+
+    // The chunks of striped files are in other pools than their base inode
+    if (!baseFound)
+    {
+      const std::vector<PoolSP> pools = mRadosFs->mPriv->getDataPools();
+
+      for (size_t i = 0; i < pools.size() && !baseFound; i++)
+      {
+        if (pools[i]->name != pool->name)
+          baseFound = pools[i]->ioctx.stat(baseInode, 0, 0) == 0;
+      }
+    }
 
-    if (pool->ioctx.stat(baseInode, 0, 0) != 0)
+    if (!baseFound)
     {
       log("Inode chunk '%s' is loose!\n", inode.c_str());
       Issue issue(inode, LOOSE_INODE_CHUNK);
@@ -662,25 +758,85 @@ RadosFsChecker::checkInode(PoolSP pool, std::string inode,
 }
 
 void
-RadosFsChecker::checkInodeInThread(PoolSP pool, const std::string &inode,
-                                   DiagnosticSP diagnostic)
+RadosFsChecker::checkInodeRange(PoolSP pool, size_t range, size_t numRanges,
+                                DiagnosticSP diagnostic)
 {
-  if (!nameIsInode(inode))
-    return;
+  librados::ObjectCursor start, finish;
+  pool->ioctx.object_list_slice(pool->ioctx.object_list_begin(),
+                                pool->ioctx.object_list_end(), range,
+                                numRanges, &start, &finish);
+
+  if (mCheckpoint)
+  {
+    const std::string cursor = mCheckpoint->getInodeScanCursor(pool->name,
+                                                               range);
+    librados::ObjectCursor resumed;
+
+    if (cursor == INODE_SCAN_RANGE_DONE)
+      return;
+
+    if (!cursor.empty() && resumed.from_str(cursor))
+      start = resumed;
+  }
+
+  const librados::bufferlist filter;
+  int ret = 0;
+
+  // The inodes are checked by the worker listing them, so each range has at
+  // most one batch of objects in memory and one check in flight
+  while (start < finish)
+  {
+    std::vector<librados::ObjectItem> objects;
+    ret = pool->ioctx.object_list(start, finish, INODE_SCAN_BATCH_SIZE, filter,
+                                  &objects, &start);
+
+    if (ret < 0)
+    {
+      log("Error listing the objects of range %lu/%lu in pool '%s': %s (%d)\n",
+          range, numRanges, pool->name.c_str(), strerror(abs(ret)), ret);
+      Issue issue(pool->name, ret);
+      issue.extraInfo.append("failed to list the objects' range starting at " +
+                             start.to_str());
+      diagnostic->addInodeIssue(issue);
+      break;
+    }
+
+    if (objects.empty())
+      break;
+
+    std::vector<librados::ObjectItem>::const_iterator it;
+    for (it = objects.begin(); it != objects.end(); it++)
+    {
+      if (nameIsInode((*it).oid))
+        checkInode(pool, (*it).oid, diagnostic);
+    }
+
+    if (mCheckpoint)
+    {
+      mCheckpoint->setInodeScanCursor(pool->name, range, start.to_str());
+      mCheckpoint->saveIfNeeded();
+    }
+  }
 
-  ioService->post(boost::bind(&RadosFsChecker::checkInode, this, pool,
-                              inode, diagnostic));
+  if (mCheckpoint && ret >= 0)
+    mCheckpoint->setInodeScanCursor(pool->name, range, INODE_SCAN_RANGE_DONE);
 }
 
 void
 RadosFsChecker::checkInodes(PoolSP pool, DiagnosticSP diagnostic)
 {
-  librados::NObjectIterator it;
-  for (it = pool->ioctx.nobjects_begin(); it != pool->ioctx.nobjects_end(); it++)
-  {
-    const std::string &inode = (*it).get_oid();
-    checkInodeInThread(pool, inode, diagnostic);
-  }
+  // Listing a large pool in a single stream is much slower than the cluster
+  // can go, so the objects are split into more ranges than workers (some
+  // ranges may be emptier than others) and each range is listed by a worker
+  size_t numRanges = mNumThreads * INODE_SCAN_RANGES_PER_THREAD;
+
+  // An interrupted scan is resumed with the ranges it was split into
+  if (mCheckpoint)
+    numRanges = mCheckpoint->getInodeScanRanges(pool->name, numRanges);
+
+  for (size_t i = 0; i < numRanges; i++)
+    ioService->post(boost::bind(&RadosFsChecker::checkInodeRange, this, pool,
+                                i, numRanges, diagnostic));
 }
 
 void
@@ -704,55 +860,33 @@ RadosFsChecker::checkInodes(DiagnosticSP diagnostic)
 }
 
 void
-RadosFsChecker::calculateFromPaths(const std::vector<radosfs::Quota> &quotas,
-                                   std::set<std::string> &paths,
-                                   std::set<std::string> &dirs,
-                                   boost::shared_ptr<QuotaInfo> info,
+RadosFsChecker::calculateFromPaths(const std::vector<std::string> &paths,
+                                   DirQuotaTotals *totals,
                                    DiagnosticSP diagnostic)
 {
-  std::vector<std::string> pathsVec(paths.begin(), paths.end());
+  radosfs::StatResults stats;
+  mRadosFs->mPriv->stat(paths, &stats);
 
-  std::map<std::string, std::pair<int, Stat> > stats =
-      mRadosFs->mPriv->stat(pathsVec);
-
-  std::map<std::string, std::pair<int, Stat> >::const_iterator it;
-  size_t i;
-  for (it = stats.begin(), i = 0; it != stats.end(); it++, i++)
+  for (size_t i = 0; i < paths.size(); i++)
   {
-    const std::string &path = (*it).first;
-    std::pair<int, Stat> statOp = (*it).second;
-    int statResult = statOp.first;
+    const std::string &path = paths[i];
 
-    if (statOp.first != 0)
+    if (stats.ret(i) != 0)
     {
       Issue issue(path, NO_ENT);
       diagnostic->addFileIssue(issue);
       continue;
     }
 
-    struct stat pathStat = statOp.second.statBuff;
-
-    if (statResult != 0)
-    {
-      continue;
-    }
+    const struct stat &pathStat = stats.statBuff(i);
 
     if (S_ISDIR(pathStat.st_mode) && !S_ISLNK(pathStat.st_mode))
     {
-      dirs.insert(path);
+      totals->subdirs.push_back(path);
       continue;
     }
 
-    std::vector<radosfs::Quota>::const_iterator it;
-    for (it = quotas.begin(); it != quotas.end(); it++)
-    {
-      MemQuota *memQuota = info->getMemQuota((*it).name());
-      memQuota->pool = (*it).pool();
-
-      memQuota->addUserSize(pathStat.st_uid, pathStat.st_size);
-      memQuota->addGroupSize(pathStat.st_gid, pathStat.st_size);
-      memQuota->addSize(pathStat.st_size);
-    }
+    totals->add(pathStat.st_uid, pathStat.st_gid, pathStat.st_size);
   }
 }
 
@@ -788,19 +922,101 @@ RadosFsChecker::calculateQuota(std::string path,
         dir.path().c_str());
   }
 
-  std::set<std::string> entries, dirs;
-  if (dir.entryList(entries, true) == 0)
+  DirQuotaTotals totals;
+
+  // The dirs summed before this run was interrupted are not listed again
+  if (mCheckpoint && mCheckpoint->getDirQuota(path, &totals))
   {
-    calculateFromPaths(quotas, entries, dirs, info, diagnostic);
+    log("\tUsing the sizes recorded in the checkpoint for dir '%s'.\n",
+        dir.path().c_str());
+  }
+  else
+  {
+    radosfs::DirListing listing;
+    if (dir.openListing(listing, true) != 0)
+      return;
+
+    // The entries are statted in batches so large dirs are not held in memory
+    std::vector<std::string> entries;
+    int ret;
+    while ((ret = listing.next(entries, QUOTA_STAT_BATCH_SIZE)) > 0)
+    {
+      calculateFromPaths(entries, &totals, diagnostic);
+      entries.clear();
+    }
+
+    if (ret < 0)
+    {
+      Issue issue(path, ret);
+      issue.extraInfo.append("failed to list the dir's entries");
+      diagnostic->addDirIssue(issue);
+      return;
+    }
+
+    if (mCheckpoint)
+    {
+      totals.run = mCheckpoint->run;
+      mCheckpoint->setDirQuota(path, totals);
+      mCheckpoint->saveIfNeeded();
+    }
+  }
+
+  std::vector<radosfs::Quota>::const_iterator quotaIt;
+  for (quotaIt = quotas.begin(); quotaIt != quotas.end(); quotaIt++)
+  {
+    MemQuota *memQuota = info->getMemQuota((*quotaIt).name());
+    memQuota->pool = (*quotaIt).pool();
+    memQuota->addTotals(totals);
+  }
+
+  std::vector<std::string>::const_iterator it;
+  for (it = totals.subdirs.begin(); it != totals.subdirs.end(); it++)
+  {
+    if ((*it) != path)
+      scheduleQuotaCalculation(*it, info, diagnostic);
+  }
+}
+
+void
+RadosFsChecker::scheduleQuotaCalculation(const std::string &path,
+                                         boost::shared_ptr<QuotaInfo> info,
+                                         DiagnosticSP diagnostic)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mPendingQuotaDirsMutex);
 
-    std::set<std::string>::const_iterator it;
-    for (it = dirs.begin(); it != dirs.end(); it++)
+    if (mPendingQuotaDirs < mNumThreads * QUOTA_MAX_PENDING_DIRS_PER_THREAD)
     {
-      if ((*it) != path)
-        ioService->post(boost::bind(&RadosFsChecker::calculateQuota, this, *it,
-                                    info, diagnostic));
+      mPendingQuotaDirs++;
+      ioService->post(boost::bind(&RadosFsChecker::runQuotaCalculation, this,
+                                  path, info, diagnostic));
+      return;
     }
   }
+
+  // When enough dirs are queued for the other workers, the subtree is summed
+  // right away (depth first) so the queue does not grow with the tree's width
+  calculateQuota(path, info, diagnostic);
+}
+
+void
+RadosFsChecker::runQuotaCalculation(std::string path,
+                                    boost::shared_ptr<QuotaInfo> info,
+                                    DiagnosticSP diagnostic)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mPendingQuotaDirsMutex);
+    mPendingQuotaDirs--;
+  }
+
+  calculateQuota(path, info, diagnostic);
+}
+
+void
+RadosFsChecker::setCheckpoint(CheckpointSP checkpoint, bool incremental)
+{
+  mCheckpoint = checkpoint;
+  mIncremental = incremental;
 }
 
 void
@@ -808,6 +1024,17 @@ RadosFsChecker::finishCheck(void)
 {
   asyncWork.reset();
   generalWorkerThreads.join_all();
+
+  if (mCheckpoint)
+  {
+    int ret = mCheckpoint->save(true);
+
+    if (ret != 0)
+    {
+      fprintf(stderr, "Error saving the checkpoint '%s': %s (retcode=%d)\n",
+              mCheckpoint->path.c_str(), strerror(abs(ret)), ret);
+    }
+  }
 }
 
 void
@@ -1113,6 +1340,48 @@ Diagnostic::print(const std::map<ErrorCode, std::string> &errors, bool dry)
   }
 }
 
+size_t
+Diagnostic::numIssues(void)
+{
+  boost::unique_lock<boost::mutex> fileLock(fileIssuesMutex);
+  boost::unique_lock<boost::mutex> dirLock(dirIssuesMutex);
+  boost::unique_lock<boost::mutex> inodeLock(inodeIssuesMutex);
+  boost::unique_lock<boost::mutex> fileSolvedLock(fileSolvedIssuesMutex);
+  boost::unique_lock<boost::mutex> dirSolvedLock(dirSolvedIssuesMutex);
+  boost::unique_lock<boost::mutex> inodeSolvedLock(inodeSolvedIssuesMutex);
+
+  return fileIssues.size() + dirIssues.size() + inodeIssues.size() +
+      fileSolvedIssues.size() + dirSolvedIssues.size() +
+      inodeSolvedIssues.size();
+}
+
+void
+Diagnostic::merge(Diagnostic &other)
+{
+  std::vector<Issue>::const_iterator it;
+
+  for (it = other.fileIssues.begin(); it != other.fileIssues.end(); it++)
+    addFileIssue(*it);
+
+  for (it = other.fileSolvedIssues.begin(); it != other.fileSolvedIssues.end();
+       it++)
+    addFileIssue(*it);
+
+  for (it = other.dirIssues.begin(); it != other.dirIssues.end(); it++)
+    addDirIssue(*it);
+
+  for (it = other.dirSolvedIssues.begin(); it != other.dirSolvedIssues.end();
+       it++)
+    addDirIssue(*it);
+
+  for (it = other.inodeIssues.begin(); it != other.inodeIssues.end(); it++)
+    addInodeIssue(*it);
+
+  for (it = other.inodeSolvedIssues.begin();
+       it != other.inodeSolvedIssues.end(); it++)
+    addInodeIssue(*it);
+}
+
 MemQuota::MemQuota(const std::string &name)
   : name(name),
     currentSize(0)
@@ -1155,28 +1424,431 @@ MemQuota::addSize(int64_t size)
   currentSize += size;
 }
 
+void
+MemQuota::addTotals(const DirQuotaTotals &totals)
+{
+  std::map<uid_t, int64_t>::const_iterator it;
+
+  for (it = totals.users.begin(); it != totals.users.end(); it++)
+    addUserSize((*it).first, (*it).second);
+
+  for (it = totals.groups.begin(); it != totals.groups.end(); it++)
+    addGroupSize((*it).first, (*it).second);
+
+  addSize(totals.size);
+}
+
+void
+MemQuota::merge(const MemQuota &other)
+{
+  std::map<uid_t, int64_t>::const_iterator it;
+
+  for (it = other.users.begin(); it != other.users.end(); it++)
+    addUserSize((*it).first, (*it).second);
+
+  for (it = other.groups.begin(); it != other.groups.end(); it++)
+    addGroupSize((*it).first, (*it).second);
+
+  addSize(other.currentSize);
+
+  if (pool.empty())
+    pool = other.pool;
+}
+
+void
+DirQuotaTotals::add(uid_t uid, gid_t gid, int64_t fileSize)
+{
+  users[uid] += fileSize;
+  groups[gid] += fileSize;
+  size += fileSize;
+}
+
 MemQuota *
 QuotaInfo::getMemQuota(const std::string &name)
 {
   boost::unique_lock<boost::mutex> lock(mapMutex);
-  if (quotaMap.count(name) != 0)
-  {
-    quotaMap[name].name = name;
-  }
+  std::map<std::string, MemQuota> &quotas =
+      workerQuotas[boost::this_thread::get_id()];
+  std::map<std::string, MemQuota>::iterator it = quotas.find(name);
+
+  if (it == quotas.end())
+    it = quotas.insert(std::make_pair(name, MemQuota(name))).first;
 
-  return &quotaMap[name];
+  return &(*it).second;
 }
 
 bool
 QuotaInfo::empty()
 {
   boost::unique_lock<boost::mutex> lock(mapMutex);
-  return quotaMap.empty();
+  return workerQuotas.empty();
 }
 
 std::map<std::string, MemQuota>
 QuotaInfo::getQuotas(void)
 {
   boost::unique_lock<boost::mutex> lock(mapMutex);
-  return quotaMap;
+  std::map<std::string, MemQuota> quotas;
+
+  std::map<boost::thread::id, std::map<std::string, MemQuota> >::iterator it;
+  for (it = workerQuotas.begin(); it != workerQuotas.end(); it++)
+  {
+    std::map<std::string, MemQuota>::const_iterator quotaIt;
+    for (quotaIt = (*it).second.begin(); quotaIt != (*it).second.end();
+         quotaIt++)
+    {
+      const std::string &name = (*quotaIt).first;
+
+      if (quotas.count(name) == 0)
+        quotas.insert(std::make_pair(name, MemQuota(name)));
+
+      quotas[name].merge((*quotaIt).second);
+    }
+  }
+
+  return quotas;
+}
+
+static std::string
+escapeCheckpointField(const std::string &field)
+{
+  std::string escaped;
+
+  for (size_t i = 0; i < field.length(); i++)
+  {
+    if (field[i] == '\\')
+      escaped += "\\\\";
+    else if (field[i] == '\t')
+      escaped += "\\t";
+    else if (field[i] == '\n')
+      escaped += "\\n";
+    else
+      escaped += field[i];
+  }
+
+  return escaped;
+}
+
+static std::vector<std::string>
+splitCheckpointLine(const std::string &line)
+{
+  std::vector<std::string> fields(1);
+
+  for (size_t i = 0; i < line.length(); i++)
+  {
+    if (line[i] == '\t')
+    {
+      fields.push_back("");
+    }
+    else if (line[i] == '\\' && i + 1 < line.length())
+    {
+      const char escaped = line[++i];
+
+      if (escaped == 't')
+        fields.back() += '\t';
+      else if (escaped == 'n')
+        fields.back() += '\n';
+      else
+        fields.back() += escaped;
+    }
+    else
+    {
+      fields.back() += line[i];
+    }
+  }
+
+  return fields;
+}
+
+Checkpoint::Checkpoint(const std::string &path)
+  : path(path),
+    run(1),
+    lastSave(boost::chrono::system_clock::now())
+{}
+
+int
+Checkpoint::load(void)
+{
+  std::ifstream file(path.c_str());
+
+  if (!file.is_open())
+    return -errno;
+
+  std::string line;
+
+  if (!std::getline(file, line))
+    return -EINVAL;
+
+  std::vector<std::string> fields = splitCheckpointLine(line);
+
+  if (fields.size() != 4 || fields[0] != CHECKPOINT_MAGIC ||
+      atoi(fields[1].c_str()) != CHECKPOINT_VERSION)
+  {
+    return -EINVAL;
+  }
+
+  const size_t lastRun = strtoul(fields[2].c_str(), 0, 10);
+  const bool finished = fields[3] == "1";
+
+  // An interrupted run is resumed while a finished one is followed by a new
+  // one, which only uses the dirs' records if it is incremental
+  run = finished ? lastRun + 1 : lastRun;
+
+  boost::unique_lock<boost::mutex> lock(mutex);
+
+  while (std::getline(file, line))
+  {
+    fields = splitCheckpointLine(line);
+
+    if (fields[0] == "D" && fields.size() >= 6)
+    {
+      DirCheckpoint &dir = dirs[fields[5]];
+      dir.run = strtoul(fields[1].c_str(), 0, 10);
+      dir.logSize = strtoull(fields[2].c_str(), 0, 10);
+      dir.mtime = strtoll(fields[3].c_str(), 0, 10);
+      dir.numIssues = strtoul(fields[4].c_str(), 0, 10);
+      dir.subdirs.assign(fields.begin() + 6, fields.end());
+    }
+    else if (fields[0] == "Q" && fields.size() >= 6 && !finished)
+    {
+      DirQuotaTotals &totals = dirQuotas[fields[2]];
+      totals.run = strtoul(fields[1].c_str(), 0, 10);
+      totals.size = strtoll(fields[3].c_str(), 0, 10);
+
+      // The users' and groups' sizes are lists of id:size pairs
+      std::vector<std::string> sizes;
+      splitToVector(fields[4], sizes, ',');
+      for (size_t i = 0; i < sizes.size(); i++)
+      {
+        uid_t uid;
+        long long size;
+        if (sscanf(sizes[i].c_str(), "%u:%lld", &uid, &size) == 2)
+          totals.users[uid] = size;
+      }
+
+      sizes.clear();
+      splitToVector(fields[5], sizes, ',');
+      for (size_t i = 0; i < sizes.size(); i++)
+      {
+        gid_t gid;
+        long long size;
+        if (sscanf(sizes[i].c_str(), "%u:%lld", &gid, &size) == 2)
+          totals.groups[gid] = size;
+      }
+
+      totals.subdirs.assign(fields.begin() + 6, fields.end());
+    }
+    else if (fields[0] == "I" && fields.size() >= 3)
+    {
+      InodeScanCheckpoint &scan = inodeScans[fields[2]];
+      scan.run = strtoul(fields[1].c_str(), 0, 10);
+      scan.cursors.assign(fields.begin() + 3, fields.end());
+    }
+    else if (!line.empty())
+    {
+      return -EINVAL;
+    }
+  }
+
+  return 0;
+}
+
+int
+Checkpoint::save(bool finished)
+{
+  boost::unique_lock<boost::mutex> saveLock(saveMutex);
+  std::stringstream contents;
+
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    contents << CHECKPOINT_MAGIC << "\t" << CHECKPOINT_VERSION << "\t" << run
+             << "\t" << finished << "\n";
+
+    std::map<std::string, DirCheckpoint>::const_iterator dirIt;
+    for (dirIt = dirs.begin(); dirIt != dirs.end(); dirIt++)
+    {
+      const DirCheckpoint &dir = (*dirIt).second;
+
+      // Dirs not reached by a finished run no longer exist (or are no longer
+      // checked)
+      if (finished && dir.run != run)
+        continue;
+
+      contents << "D\t" << dir.run << "\t" << dir.logSize << "\t"
+               << dir.mtime << "\t" << dir.numIssues << "\t"
+               << escapeCheckpointField((*dirIt).first);
+
+      for (size_t i = 0; i < dir.subdirs.size(); i++)
+        contents << "\t" << escapeCheckpointField(dir.subdirs[i]);
+
+      contents << "\n";
+    }
+
+    // The files' sizes may change without their dirs' inode objects changing,
+    // so the dirs' quota totals are only kept to resume this run
+    std::map<std::string, DirQuotaTotals>::const_iterator quotaIt;
+    for (quotaIt = dirQuotas.begin(); !finished && quotaIt != dirQuotas.end();
+         quotaIt++)
+    {
+      const DirQuotaTotals &totals = (*quotaIt).second;
+
+      contents << "Q\t" << totals.run << "\t"
+               << escapeCheckpointField((*quotaIt).first) << "\t"
+               << totals.size << "\t";
+
+      std::map<uid_t, int64_t>::const_iterator it;
+      for (it = totals.users.begin(); it != totals.users.end(); it++)
+        contents << (*it).first << ":" << (*it).second << ",";
+
+      contents << "\t";
+
+      for (it = totals.groups.begin(); it != totals.groups.end(); it++)
+        contents << (*it).first << ":" << (*it).second << ",";
+
+      for (size_t i = 0; i < totals.subdirs.size(); i++)
+        contents << "\t" << escapeCheckpointField(totals.subdirs[i]);
+
+      contents << "\n";
+    }
+
+    // The inodes are always fully checked in a new run
+    std::map<std::string, InodeScanCheckpoint>::const_iterator scanIt;
+    for (scanIt = inodeScans.begin(); !finished && scanIt != inodeScans.end();
+         scanIt++)
+    {
+      const InodeScanCheckpoint &scan = (*scanIt).second;
+
+      contents << "I\t" << scan.run << "\t"
+               << escapeCheckpointField((*scanIt).first);
+
+      for (size_t i = 0; i < scan.cursors.size(); i++)
+        contents << "\t" << escapeCheckpointField(scan.cursors[i]);
+
+      contents << "\n";
+    }
+
+    lastSave = boost::chrono::system_clock::now();
+  }
+
+  // The checkpoint is replaced at once so an interruption while saving it does
+  // not leave it truncated
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream file(tmpPath.c_str(), std::ios::trunc);
+
+  file << contents.str();
+  file.close();
+
+  if (file.fail())
+    return -EIO;
+
+  if (rename(tmpPath.c_str(), path.c_str()) != 0)
+    return -errno;
+
+  return 0;
+}
+
+void
+Checkpoint::saveIfNeeded(void)
+{
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    boost::chrono::system_clock::time_point now =
+        boost::chrono::system_clock::now();
+
+    if (now - lastSave < boost::chrono::seconds(CHECKPOINT_SAVE_INTERVAL))
+      return;
+
+    lastSave = now;
+  }
+
+  int ret = save(false);
+
+  if (ret != 0)
+  {
+    fprintf(stderr, "Error saving the checkpoint '%s': %s (retcode=%d)\n",
+            path.c_str(), strerror(abs(ret)), ret);
+  }
+}
+
+bool
+Checkpoint::getDir(const std::string &path, DirCheckpoint *dir)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  std::map<std::string, DirCheckpoint>::const_iterator it = dirs.find(path);
+
+  if (it == dirs.end())
+    return false;
+
+  *dir = (*it).second;
+
+  return true;
+}
+
+void
+Checkpoint::setDir(const std::string &path, const DirCheckpoint &dir)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  dirs[path] = dir;
+}
+
+size_t
+Checkpoint::getInodeScanRanges(const std::string &pool, size_t numRanges)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  InodeScanCheckpoint &scan = inodeScans[pool];
+
+  if (scan.run == run && !scan.cursors.empty())
+    return scan.cursors.size();
+
+  scan.run = run;
+  scan.cursors.assign(numRanges, "");
+
+  return numRanges;
+}
+
+std::string
+Checkpoint::getInodeScanCursor(const std::string &pool, size_t range)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  std::map<std::string, InodeScanCheckpoint>::const_iterator it;
+  it = inodeScans.find(pool);
+
+  if (it == inodeScans.end() || range >= (*it).second.cursors.size())
+    return "";
+
+  return (*it).second.cursors[range];
+}
+
+void
+Checkpoint::setInodeScanCursor(const std::string &pool, size_t range,
+                               const std::string &cursor)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  InodeScanCheckpoint &scan = inodeScans[pool];
+
+  if (range < scan.cursors.size())
+    scan.cursors[range] = cursor;
+}
+
+bool
+Checkpoint::getDirQuota(const std::string &path, DirQuotaTotals *totals)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  std::map<std::string, DirQuotaTotals>::const_iterator it;
+  it = dirQuotas.find(path);
+
+  if (it == dirQuotas.end() || (*it).second.run != run)
+    return false;
+
+  *totals = (*it).second;
+
+  return true;
+}
+
+void
+Checkpoint::setDirQuota(const std::string &path, const DirQuotaTotals &totals)
+{
+  boost::unique_lock<boost::mutex> lock(mutex);
+  dirQuotas[path] = totals;
 }
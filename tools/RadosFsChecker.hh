@@ -74,6 +74,22 @@ struct Issue
   void setFixed(void) { fixed = true; }
 };
 
+struct DirQuotaTotals
+{
+  DirQuotaTotals(void)
+    : run(0),
+      size(0)
+  {}
+
+  void add(uid_t uid, gid_t gid, int64_t size);
+
+  size_t run;
+  int64_t size;
+  std::map<uid_t, int64_t> users;
+  std::map<gid_t, int64_t> groups;
+  std::vector<std::string> subdirs;
+};
+
 struct MemQuota
 {
   MemQuota(void)
@@ -87,6 +103,8 @@ struct MemQuota
   void addUserSize(uid_t, int64_t);
   void addGroupSize(gid_t, int64_t);
   void addSize(int64_t);
+  void addTotals(const DirQuotaTotals &totals);
+  void merge(const MemQuota &other);
 
   std::string name;
   std::string pool;
@@ -104,7 +122,9 @@ struct QuotaInfo
   bool empty(void);
   std::map<std::string, MemQuota> getQuotas(void);
 
-  std::map<std::string, MemQuota> quotaMap;
+  // Each worker thread sums the sizes into its own quotas, which are only
+  // merged in the end
+  std::map<boost::thread::id, std::map<std::string, MemQuota> > workerQuotas;
   std::string originalQuota;
   boost::mutex mapMutex;
 };
@@ -132,10 +152,71 @@ struct Diagnostic
                 std::vector<Issue> &fixedIssues,
                 boost::mutex &fixedIssuesMutex);
   void print(const std::map<ErrorCode, std::string> &errors, bool dry);
+  size_t numIssues(void);
+  void merge(Diagnostic &other);
 };
 
 typedef boost::shared_ptr<Diagnostic> DiagnosticSP;
 
+struct DirCheckpoint
+{
+  DirCheckpoint(void)
+    : run(0),
+      logSize(0),
+      mtime(0),
+      numIssues(0)
+  {}
+
+  size_t run;
+  uint64_t logSize;
+  time_t mtime;
+  size_t numIssues;
+  std::vector<std::string> subdirs;
+};
+
+struct InodeScanCheckpoint
+{
+  InodeScanCheckpoint(void)
+    : run(0)
+  {}
+
+  size_t run;
+  // The cursor each range of the pool's objects is at: empty if the range was
+  // not started and "done" if it was fully checked
+  std::vector<std::string> cursors;
+};
+
+struct Checkpoint
+{
+  Checkpoint(const std::string &path);
+
+  int load(void);
+  int save(bool finished);
+  void saveIfNeeded(void);
+
+  bool getDir(const std::string &path, DirCheckpoint *dir);
+  void setDir(const std::string &path, const DirCheckpoint &dir);
+
+  size_t getInodeScanRanges(const std::string &pool, size_t numRanges);
+  std::string getInodeScanCursor(const std::string &pool, size_t range);
+  void setInodeScanCursor(const std::string &pool, size_t range,
+                          const std::string &cursor);
+
+  bool getDirQuota(const std::string &path, DirQuotaTotals *totals);
+  void setDirQuota(const std::string &path, const DirQuotaTotals &totals);
+
+  std::string path;
+  size_t run;
+  std::map<std::string, DirCheckpoint> dirs;
+  std::map<std::string, InodeScanCheckpoint> inodeScans;
+  std::map<std::string, DirQuotaTotals> dirQuotas;
+  boost::chrono::system_clock::time_point lastSave;
+  boost::mutex mutex;
+  boost::mutex saveMutex;
+};
+
+typedef boost::shared_ptr<Checkpoint> CheckpointSP;
+
 class RadosFsChecker
 {
 public:
@@ -175,6 +256,8 @@ public:
 
   void setHasPools(bool hasPools) { mHasPools = hasPools; }
 
+  void setCheckpoint(CheckpointSP checkpoint, bool incremental);
+
   PoolSP getPool(const std::string &name);
 
 private:
@@ -192,8 +275,11 @@ private:
 
   void checkInode(PoolSP pool, std::string inode, DiagnosticSP diagnostic);
 
-  void checkInodeInThread(PoolSP pool, const std::string &inode,
-                          DiagnosticSP diagnostic);
+  void checkInodeRange(PoolSP pool, size_t range, size_t numRanges,
+                       DiagnosticSP diagnostic);
+
+  bool skipUnchangedDir(const std::string &path, const DirCheckpoint &current,
+                        bool recursive, DiagnosticSP diagnostic);
 
   void checkInodeBackLink(const std::string &inode, Pool &pool,
                           const std::string &backLink,
@@ -206,11 +292,15 @@ private:
   int fixInodeBackLink(Stat &backLinkStat, const std::string &inode,
                        Pool &pool, Issue &issue);
 
-  void calculateFromPaths(const std::vector<radosfs::Quota> &quotas,
-                          std::set<std::string> &paths,
-                          std::set<std::string> &dirs,
-                          boost::shared_ptr<QuotaInfo> info,
-                          DiagnosticSP diagnostic);
+  void calculateFromPaths(const std::vector<std::string> &paths,
+                          DirQuotaTotals *totals, DiagnosticSP diagnostic);
+
+  void scheduleQuotaCalculation(const std::string &path,
+                                boost::shared_ptr<QuotaInfo> info,
+                                DiagnosticSP diagnostic);
+
+  void runQuotaCalculation(std::string path, boost::shared_ptr<QuotaInfo> info,
+                           DiagnosticSP diagnostic);
 
   void log(const char *msg, ...);
 
@@ -222,10 +312,15 @@ private:
   size_t mAnimationStep;
   boost::chrono::system_clock::time_point mAnimationLastUpdate;
   const std::string mAnimation;
+  size_t mNumThreads;
+  size_t mPendingQuotaDirs;
+  boost::mutex mPendingQuotaDirsMutex;
   bool mVerbose;
   bool mFix;
   bool mDry;
   bool mHasPools;
+  CheckpointSP mCheckpoint;
+  bool mIncremental;
 };
 
 #endif // __RADOS_FS_CHECKER_HH__
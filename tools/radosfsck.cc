@@ -50,6 +50,10 @@
 #define USER_ARG_CHAR 'u'
 #define DRY_ARG "dry"
 #define DRY_ARG_CHAR 'n'
+#define CHECKPOINT_ARG "checkpoint"
+#define CHECKPOINT_ARG_CHAR 'k'
+#define INCREMENTAL_ARG "incremental"
+#define INCREMENTAL_ARG_CHAR 'I'
 #define HELP_ARG "help"
 #define HELP_ARG_CHAR 'h'
 #define OUTPUT_SPAN "%-50s"
@@ -130,6 +134,19 @@ showUsage(const char *name)
                   "check (default=%d)\n", arg.str().c_str(),
                   DEFAULT_NUM_THREADS);
 
+  arg.str("");
+  arg << "--" << CHECKPOINT_ARG << "=FILE, -" << CHECKPOINT_ARG_CHAR <<
+         " FILE";
+  fprintf(stdout, OPTION_SPAN "record the progress of the check in FILE and "
+                  "resume it from there if it was interrupted\n",
+          arg.str().c_str());
+
+  arg.str("");
+  arg << "--" << INCREMENTAL_ARG << ", -" << INCREMENTAL_ARG_CHAR;
+  fprintf(stdout, OPTION_SPAN "skip the directories that did not change since "
+                  "the last check recorded in the --%s file\n",
+          arg.str().c_str(), CHECKPOINT_ARG);
+
   arg.str("");
   arg << "--" << USER_ARG << "=USER_NAME, -" << USER_ARG_CHAR << " USER_NAME";
   fprintf(stdout, OPTION_SPAN "the user name to use when initializing the "
@@ -150,6 +167,7 @@ static int
 parseArguments(int argc, char **argv,
                std::string &confPath,
                std::string &userName,
+               std::string &checkpointPath,
                std::vector<std::string> &pools,
                std::vector<std::string> &dirsToCheck,
                bool *checkInodes,
@@ -160,6 +178,7 @@ parseArguments(int argc, char **argv,
                bool *recursive,
                bool *fix,
                bool *dry,
+               bool *incremental,
                bool *verbose)
 {
   confPath = "";
@@ -180,6 +199,8 @@ parseArguments(int argc, char **argv,
    {USER_ARG, required_argument, 0, USER_ARG_CHAR},
    {FIX_ARG, no_argument, 0, FIX_ARG_CHAR},
    {DRY_ARG, no_argument, 0, DRY_ARG_CHAR},
+   {CHECKPOINT_ARG, required_argument, 0, CHECKPOINT_ARG_CHAR},
+   {INCREMENTAL_ARG, no_argument, 0, INCREMENTAL_ARG_CHAR},
    {VERBOSE_ARG, no_argument, 0, VERBOSE_ARG_CHAR},
    {HELP_ARG, no_argument, 0, HELP_ARG_CHAR},
    {0, 0, 0, 0}
@@ -188,9 +209,11 @@ parseArguments(int argc, char **argv,
   *recursive = false;
   *fix = false;
   *dry = false;
+  *incremental = false;
   *verbose = false;
   *numThreads = DEFAULT_NUM_THREADS;
   userName = "";
+  checkpointPath = "";
 
   std::string args;
 
@@ -236,6 +259,12 @@ parseArguments(int argc, char **argv,
       case FIX_ARG_CHAR:
         *fix = true;
         break;
+      case CHECKPOINT_ARG_CHAR:
+        checkpointPath = optarg;
+        break;
+      case INCREMENTAL_ARG_CHAR:
+        *incremental = true;
+        break;
       case USER_ARG_CHAR:
         userName = optarg;
         break;
@@ -319,15 +348,16 @@ int
 main(int argc, char **argv)
 {
   int ret;
-  bool checkInodes, recursive, fix, dry, verbose;
+  bool checkInodes, recursive, fix, dry, incremental, verbose;
   int numThreads;
-  std::string confPath, userName;
+  std::string confPath, userName, checkpointPath;
   std::vector<std::string> dirsToCheck, poolsToCheckInodes, pools, pathsToCheck,
       pathsToQuota;
 
   ret = parseArguments(argc, argv,
                        confPath,
                        userName,
+                       checkpointPath,
                        pools,
                        dirsToCheck,
                        &checkInodes,
@@ -338,6 +368,7 @@ main(int argc, char **argv)
                        &recursive,
                        &fix,
                        &dry,
+                       &incremental,
                        &verbose);
 
   if (ret != 0)
@@ -357,6 +388,30 @@ main(int argc, char **argv)
 
   DiagnosticSP diagnostic(new Diagnostic);
 
+  if (incremental && checkpointPath.empty())
+  {
+    fprintf(stderr, "The --%s option can only be used together with the --%s "
+                    "option\n", INCREMENTAL_ARG, CHECKPOINT_ARG);
+
+    exit(EOPNOTSUPP);
+  }
+
+  if (!checkpointPath.empty())
+  {
+    CheckpointSP checkpoint(new Checkpoint(checkpointPath));
+    ret = checkpoint->load();
+
+    // There is no checkpoint yet in the first run
+    if (ret != 0 && ret != -ENOENT)
+    {
+      fprintf(stderr, "Cannot load the checkpoint '%s': %s (retcode=%d)\n",
+              checkpointPath.c_str(), strerror(abs(ret)), ret);
+      exit(abs(ret));
+    }
+
+    checker.setCheckpoint(checkpoint, incremental);
+  }
+
   // Verify the user asked for something to be checked
   if (dirsToCheck.empty() && pathsToCheck.empty() &&
       poolsToCheckInodes.empty() && !checkInodes && pathsToQuota.empty())